@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Client of the gptjX server: sends each line of stdin, comma separated token ids, as a request and prints the tokens
+// as they are streamed back, one line per request.
+//
+// usage: gptj_client [address (default unix:/tmp/gptjX.sock)] [max_new_tokens (default: the server's)]
+
+#include "src/fastertransformer/utils/batching_server.h"
+#include "src/fastertransformer/utils/logger.h"
+
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+using namespace fastertransformer;
+
+int main(int argc, char* argv[])
+{
+    const std::string address        = argc > 1 ? argv[1] : "unix:/tmp/gptjX.sock";
+    const uint32_t    max_new_tokens = argc > 2 ? (uint32_t)std::stoul(argv[2]) : 0;
+
+    const int fd = connectServerSocket(address);
+
+    uint32_t    request_id = 0;
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        ServerRequest request;
+        request.request_id     = request_id++;
+        request.max_new_tokens = max_new_tokens;
+        std::stringstream line_stream(line);
+        std::string       token;
+        while (std::getline(line_stream, token, ',')) {
+            request.input_ids.push_back(std::stoi(token));
+        }
+        if (request.input_ids.empty()) {
+            continue;
+        }
+        if (!writeServerRequest(fd, request)) {
+            FT_LOG_ERROR("Lost the connection to %s", address.c_str());
+            break;
+        }
+
+        ServerResponse response;
+        do {
+            if (!readServerResponse(fd, &response) || response.request_id != request.request_id) {
+                FT_LOG_ERROR("Lost the connection to %s", address.c_str());
+                close(fd);
+                return -1;
+            }
+            for (int token : response.tokens) {
+                printf("%d ", token);
+            }
+            fflush(stdout);
+        } while (!(response.flags & SERVER_RESPONSE_FINISHED));
+        printf("\n");
+        if (response.flags & SERVER_RESPONSE_ERROR) {
+            FT_LOG_WARNING("Request %u was rejected", request.request_id);
+        }
+    }
+    close(fd);
+    return 0;
+}
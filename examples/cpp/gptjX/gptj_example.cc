@@ -17,15 +17,18 @@
 #include "3rdparty/INIReader.h"
 #include "examples/cpp/multi_gpu_gpt/gpt_example_utils.h"
 #include "src/fastertransformer/models/gptj/GptJ.h"
+#include "src/fastertransformer/utils/batching_server.h"
 #include "src/fastertransformer/utils/nccl_utils.h"
 #include "src/fastertransformer/utils/nvtx_utils.h"
+#include "src/fastertransformer/utils/stop_word_matcher.h"
 #include "src/fastertransformer/utils/word_list.h"
 
+#include <csignal>
 #include <cuda_profiler_api.h>
-#include <fstream>
-#include <sstream>
+#include <pthread.h>
 #include <string>
 #include <sys/time.h>
+#include <thread>
 #include <vector>
 
 #ifdef USE_NVTX
@@ -37,77 +40,302 @@ using namespace fastertransformer;
 template<typename T>
 void gptj_example(const INIReader reader);
 
-void read_start_idsX(int batch_size,
-                     std::vector<int>* v_start_lengths,
-                     std::vector<int>* v_start_ids,
-                     int& max_input_len,
-                     const int end_id,
-                     const int beam_width)
-{
-    std::vector<std::vector<int>> tmp_start_ids;
-    std::vector<int> tmp_start_lengths;
-
-    std::string cmnd{""};
-    int i0 = 0;
-    while (getline(std::cin, cmnd)) {
-        if (cmnd == "") {
-            break;
-        }
-        if(cmnd[0] == '['){
-            std::string tmp = cmnd.substr(1);
-            cmnd = tmp;
+// Runtime arguments shared by the requests of the server.
+struct GptJRuntimeArgs {
+    size_t             beam_width;
+    uint               top_k;
+    float              top_p;
+    float              temperature;
+    float              repetition_penalty;
+    float              len_penalty;
+    float              beam_search_diversity_rate;
+    unsigned long long random_seed;
+    int                start_id;
+    int                end_id;
+    uint32_t           memory_len;
+    std::vector<int>   bad_words;   // [2, len] word list
+    std::vector<int>   stop_words;  // [2, len] word list
+};
+
+// Generates the batches of the batching server with GptJ.
+//
+// Rank 0 runs the server and broadcasts every batch to the other ranks, which follow() it until stop(). When sampling,
+// the tokens of a request are streamed after every step; beam search streams the best beam at the end, the beams
+// being reordered until then. A generated stop word is cut from the output, so the last tokens which may start a
+// stop word are held back until it is ruled out.
+template<typename T>
+class GptJBatchGenerator: public BatchGenerator {
+public:
+    GptJBatchGenerator(GptJ<T>* gpt, GptJWeight<T>* weights, const GptJRuntimeArgs& args):
+        gpt_(gpt),
+        weights_(weights),
+        args_(args),
+        stop_word_automaton_(StopWordAutomaton::fromWordList(args.stop_words))
+    {
+        for (size_t word = 0; word < stop_word_automaton_.getNumWords(); word++) {
+            held_back_len_ = std::max(held_back_len_, stop_word_automaton_.getWordLength(word) - 1);
         }
-        if(cmnd[cmnd.size()-1] == ']'){
-            cmnd.pop_back();
+    }
+
+    void generate(const std::vector<const ServerRequest*>& requests, TokenStream* stream) override
+    {
+        Batch batch;
+        batch.batch_size    = requests.size();
+        batch.max_input_len = 0;
+        for (const ServerRequest* request : requests) {
+            batch.max_input_len = std::max(batch.max_input_len, (int)request->input_ids.size());
         }
-        // std::cout << cmnd << std::endl;
-        if (cmnd == "!EXIT") {
-            // maybe better cleanup?
-            exit(0);
+        // padded with end_id
+        batch.input_ids.resize(batch.batch_size * batch.max_input_len, args_.end_id);
+        for (int i = 0; i < batch.batch_size; i++) {
+            const ServerRequest& request = *requests[i];
+            std::copy(request.input_ids.begin(), request.input_ids.end(), &batch.input_ids[i * batch.max_input_len]);
+            batch.input_lengths.push_back(request.input_ids.size());
+            batch.output_seq_len.push_back(request.input_ids.size() + request.max_new_tokens);
         }
-        std::stringstream lineS(cmnd);
-        std::string vals;
-        int i1 = 0;
-        std::vector<int> tmp_vec;
-        while (std::getline(lineS, vals, ',')) {
-            tmp_vec.push_back(std::stoi(vals));
-            i1++;
+        broadcast(&batch);
+        forward(batch, stream);
+    }
+
+    // Runs the batches of rank 0 on the other ranks, until stop().
+    void follow()
+    {
+        while (true) {
+            Batch batch;
+            broadcast(&batch);
+            if (batch.batch_size == 0) {
+                return;
+            }
+            forward(batch, nullptr);
         }
-        tmp_start_ids.push_back(tmp_vec);
-        tmp_start_lengths.push_back(i1);
-        i0++;
     }
 
-    max_input_len = tmp_start_lengths.data()[0];
-    for (uint i = 1; i < (uint)tmp_start_lengths.size(); i++) {
-        max_input_len = max_input_len > tmp_start_lengths.data()[i] ? max_input_len : tmp_start_lengths.data()[i];
+    // Called by rank 0 to release the other ranks.
+    void stop()
+    {
+        Batch batch;
+        batch.batch_size = 0;
+        broadcast(&batch);
+    }
+
+private:
+    struct Batch {
+        int                   batch_size    = 0;
+        int                   max_input_len = 0;
+        std::vector<int>      input_ids;       // [batch_size, max_input_len]
+        std::vector<int>      input_lengths;   // [batch_size]
+        std::vector<uint32_t> output_seq_len;  // [batch_size], input included
+    };
+
+    // From rank 0 to the other ranks.
+    void broadcast(Batch* batch)
+    {
+        if (mpi::getCommWorldSize() == 1) {
+            return;
+        }
+        int header[2] = {batch->batch_size, batch->max_input_len};
+        mpi::bcast(header, 2, mpi::MPI_TYPE_INT, 0, mpi::COMM_WORLD);
+        batch->batch_size    = header[0];
+        batch->max_input_len = header[1];
+        batch->input_ids.resize(batch->batch_size * batch->max_input_len);
+        batch->input_lengths.resize(batch->batch_size);
+        batch->output_seq_len.resize(batch->batch_size);
+        if (batch->batch_size > 0) {
+            mpi::bcast(batch->input_ids.data(), batch->input_ids.size(), mpi::MPI_TYPE_INT, 0, mpi::COMM_WORLD);
+            mpi::bcast(batch->input_lengths.data(), batch->batch_size, mpi::MPI_TYPE_INT, 0, mpi::COMM_WORLD);
+            mpi::bcast(batch->output_seq_len.data(), batch->batch_size, mpi::MPI_TYPE_UINT32_T, 0, mpi::COMM_WORLD);
+        }
     }
 
-    while ((int)tmp_start_lengths.size() < batch_size) {
-        std::vector<int> padding_ids;
-        for (int i = 0; i < max_input_len; i++) {
-            padding_ids.push_back(end_id);
+    void forward(const Batch& batch, TokenStream* stream)
+    {
+        const size_t batch_size         = batch.batch_size;
+        const size_t max_input_len      = batch.max_input_len;
+        const size_t beam_width         = args_.beam_width;
+        const size_t max_output_len     = *std::max_element(batch.output_seq_len.begin(), batch.output_seq_len.end());
+        const size_t request_output_len = max_output_len - max_input_len;
+
+        int* d_input_ids;
+        int* d_input_lengths;
+        deviceMalloc(&d_input_ids, batch_size * max_input_len, false);
+        deviceMalloc(&d_input_lengths, batch_size, false);
+        cudaH2Dcpy(d_input_ids, batch.input_ids.data(), batch_size * max_input_len);
+        cudaH2Dcpy(d_input_lengths, batch.input_lengths.data(), batch_size);
+
+        int* d_output_ids;
+        int* d_sequence_lengths;
+        deviceMalloc(&d_output_ids, batch_size * beam_width * max_output_len, false);
+        deviceMalloc(&d_sequence_lengths, batch_size * beam_width, false);
+
+        std::vector<uint32_t> output_seq_len = batch.output_seq_len;
+        std::vector<int>      start_ids(batch_size, args_.start_id);
+        std::vector<int>      end_ids(batch_size, args_.end_id);
+        float                 temperature        = args_.temperature;
+        float                 len_penalty        = args_.len_penalty;
+        float                 repetition_penalty = args_.repetition_penalty;
+        float                 diversity_rate     = args_.beam_search_diversity_rate;
+        unsigned long long    random_seed        = args_.random_seed;
+        float                 top_p              = args_.top_p;
+        uint                  top_k              = args_.top_k;
+        uint32_t              memory_len         = args_.memory_len;
+
+        std::unordered_map<std::string, Tensor> input_tensors = std::unordered_map<std::string, Tensor>{
+            {"input_ids", Tensor{MEMORY_GPU, TYPE_INT32, {batch_size, max_input_len}, d_input_ids}},
+            {"input_lengths", Tensor{MEMORY_GPU, TYPE_INT32, {batch_size}, d_input_lengths}},
+            {"output_seq_len", Tensor{MEMORY_CPU, TYPE_UINT32, {batch_size}, output_seq_len.data()}},
+            {"temperature", Tensor{MEMORY_CPU, TYPE_FP32, {1}, &temperature}},
+            {"len_penalty", Tensor{MEMORY_CPU, TYPE_FP32, {1}, &len_penalty}},
+            {"repetition_penalty", Tensor{MEMORY_CPU, TYPE_FP32, {1}, &repetition_penalty}},
+            {"start_id", Tensor{MEMORY_CPU, TYPE_INT32, {batch_size}, start_ids.data()}},
+            {"end_id", Tensor{MEMORY_CPU, TYPE_INT32, {batch_size}, end_ids.data()}}};
+
+        int* d_bad_words = nullptr;
+        if (!args_.bad_words.empty()) {
+            deviceMalloc(&d_bad_words, args_.bad_words.size(), false);
+            cudaH2Dcpy(d_bad_words, args_.bad_words.data(), args_.bad_words.size());
+            input_tensors.insert(
+                {"bad_words_list", Tensor{MEMORY_GPU, TYPE_INT32, {2, args_.bad_words.size() / 2}, d_bad_words}});
         }
-        tmp_start_ids.push_back(padding_ids);
-        tmp_start_lengths.push_back(max_input_len);
-    }
+        // Tile with same dict for each element
+        int* d_stop_words = nullptr;
+        if (!args_.stop_words.empty()) {
+            std::vector<int> tiled_stop_words;
+            for (size_t i = 0; i < batch_size; i++) {
+                tiled_stop_words.insert(tiled_stop_words.end(), args_.stop_words.begin(), args_.stop_words.end());
+            }
+            deviceMalloc(&d_stop_words, tiled_stop_words.size(), false);
+            cudaH2Dcpy(d_stop_words, tiled_stop_words.data(), tiled_stop_words.size());
+            input_tensors.insert(
+                {"stop_words_list",
+                 Tensor{MEMORY_GPU, TYPE_INT32, {batch_size, 2, args_.stop_words.size() / 2}, d_stop_words}});
+        }
+        if (top_k == 0 && top_p == 0.0f) {
+            FT_CHECK(beam_width > 1);
+            input_tensors.insert({"beam_search_diversity_rate", Tensor{MEMORY_CPU, TYPE_FP32, {1}, &diversity_rate}});
+        }
+        else {
+            input_tensors.insert({"random_seed", Tensor{MEMORY_CPU, TYPE_UINT64, {1}, &random_seed}});
+            if (top_p != 0.0f) {
+                input_tensors.insert({"runtime_top_p", Tensor{MEMORY_CPU, TYPE_FP32, {1}, &top_p}});
+            }
+            if (top_k != 0) {
+                input_tensors.insert({"runtime_top_k", Tensor{MEMORY_CPU, TYPE_UINT32, {1}, &top_k}});
+            }
+        }
+        if (memory_len > 0) {
+            input_tensors.insert({"memory_len", {MEMORY_CPU, TYPE_UINT32, {1}, &memory_len}});
+        }
+
+        std::unordered_map<std::string, Tensor> output_tensors = std::unordered_map<std::string, Tensor>{
+            {"output_ids", Tensor{MEMORY_GPU, TYPE_INT32, {batch_size, beam_width, max_output_len}, d_output_ids}},
+            {"sequence_length", Tensor{MEMORY_GPU, TYPE_INT32, {batch_size, beam_width}, d_sequence_lengths}},
+            {"output_log_probs",
+             Tensor{MEMORY_GPU, TYPE_FP32, {request_output_len, batch_size, beam_width}, nullptr}}};
+
+        struct timeval start, end;
+        gettimeofday(&start, NULL);
+        StopWordMatcher stop_word_matcher(&stop_word_automaton_, batch_size);
+        if (stream != nullptr) {
+            batch_             = &batch;
+            stream_            = stream;
+            stop_word_matcher_ = &stop_word_matcher;
+            num_fed_.assign(batch_size, 0);
+            num_streamed_.assign(batch_size, 0);
+            streamed_all_.assign(batch_size, false);
+            if (beam_width == 1) {
+                gpt_->registerCallback(&GptJBatchGenerator::tokenGeneratedCallback, this);
+            }
+        }
+        gpt_->forward(&output_tensors, &input_tensors, weights_);
+        gpt_->unRegisterCallback();
+        if (stream != nullptr) {
+            streamTokens(&output_tensors, true);
+            stream_ = nullptr;
+        }
+        cudaDeviceSynchronize();
+        gettimeofday(&end, NULL);
+        FT_LOG_DEBUG("batch_size %ld max_input_len %ld max_output_len %ld time %.2f ms",
+                     batch_size,
+                     max_input_len,
+                     max_output_len,
+                     (end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) * 0.001);
 
-    // Add padding
-    for (int i = 0; i < (int)tmp_start_ids.size(); i++) {
-        for (int j = (int)tmp_start_ids[i].size(); j < max_input_len; j++) {
-            tmp_start_ids[i].push_back(end_id);
+        deviceFree(d_input_ids);
+        deviceFree(d_input_lengths);
+        deviceFree(d_output_ids);
+        deviceFree(d_sequence_lengths);
+        if (d_bad_words != nullptr) {
+            deviceFree(d_bad_words);
+        }
+        if (d_stop_words != nullptr) {
+            deviceFree(d_stop_words);
         }
     }
 
-    for (int i = 0; i < (int)tmp_start_ids.size(); i++) {
-        for (int b = 0; b < beam_width; b++) {
-            for (int j = 0; j < (int)tmp_start_ids[i].size(); j++) {
-                v_start_ids->push_back(tmp_start_ids[i][j]);
+    static void tokenGeneratedCallback(std::unordered_map<std::string, Tensor>* output_tensors, void* ctx)
+    {
+        static_cast<GptJBatchGenerator*>(ctx)->streamTokens(output_tensors, false);
+    }
+
+    // Streams the new tokens of beam 0 of every request; last flushes the held back tokens and finishes the batch.
+    void streamTokens(std::unordered_map<std::string, Tensor>* output_tensors, bool last)
+    {
+        const Tensor&    output_ids     = output_tensors->at("output_ids");
+        const size_t     batch_size     = output_ids.shape[0];
+        const size_t     beam_width     = output_ids.shape[1];
+        const size_t     max_output_len = output_ids.shape[2];
+        std::vector<int> h_output_ids(output_ids.size());
+        std::vector<int> h_sequence_lengths(batch_size * beam_width);
+        cudaD2Hcpy(h_output_ids.data(), output_ids.getPtr<int>(), h_output_ids.size());
+        cudaD2Hcpy(h_sequence_lengths.data(),
+                   output_tensors->at("sequence_length").getPtr<int>(),
+                   h_sequence_lengths.size());
+
+        for (size_t i = 0; i < batch_size; i++) {
+            if (streamed_all_[i]) {
+                continue;
+            }
+            const int* tokens    = h_output_ids.data() + i * beam_width * max_output_len + batch_->input_lengths[i];
+            const int  generated = h_sequence_lengths[i * beam_width] - batch_->input_lengths[i];
+            bool       matched   = false;
+            while (!matched && (int)num_fed_[i] < generated) {
+                matched = stop_word_matcher_->update(i, tokens[num_fed_[i]++]);
+            }
+            size_t end;
+            if (matched) {
+                // the output ends before the first stop word generated
+                const StopWordMatch match = stop_word_matcher_->getMatch(i);
+                FT_LOG_DEBUG("output %ld: stop word %d at %ld", i, match.word, match.start);
+                end = match.start;
+            }
+            else {
+                end = last ? num_fed_[i] : num_fed_[i] - std::min(num_fed_[i], held_back_len_);
+            }
+            if (end > num_streamed_[i]) {
+                stream_->push(i, tokens + num_streamed_[i], end - num_streamed_[i]);
+                num_streamed_[i] = end;
+            }
+            if (matched || last) {
+                stream_->finish(i);
+                streamed_all_[i] = true;
             }
-            v_start_lengths->push_back(tmp_start_lengths[i]);
         }
     }
-}
+
+    GptJ<T>*                gpt_;
+    GptJWeight<T>*          weights_;
+    const GptJRuntimeArgs   args_;
+    const StopWordAutomaton stop_word_automaton_;
+    size_t                  held_back_len_ = 0;
+
+    // the batch being streamed
+    const Batch*        batch_             = nullptr;
+    TokenStream*        stream_            = nullptr;
+    StopWordMatcher*    stop_word_matcher_ = nullptr;
+    std::vector<size_t> num_fed_;       // generated tokens fed to the stop word matcher
+    std::vector<size_t> num_streamed_;  // generated tokens streamed
+    std::vector<bool>   streamed_all_;
+};
 
 int main(int argc, char* argv[])
 {
@@ -178,10 +406,15 @@ void gptj_example(const INIReader reader)
     const size_t hidden_units = head_num * size_per_head;
     const size_t inter_size = reader.GetInteger(model_name, "inter_size");
 
-    const size_t request_batch_size = reader.GetInteger("request", "request_batch_size");
-    // The length of tokens we hope this model to generate
-    // const int request_output_len = reader.GetInteger("request", "request_output_len");
-    const int request_output_len = 200;
+    // The server batches up to max_batch_size requests, waiting at most max_wait_ms for a batch to fill
+    BatchingServerConfig server_config;
+    server_config.max_batch_size =
+        reader.GetInteger("server", "max_batch_size", reader.GetInteger("request", "request_batch_size"));
+    server_config.max_wait_ms = reader.GetInteger("server", "max_wait_ms", 10);
+    // The length of tokens we hope this model to generate, when the request does not tell
+    server_config.default_max_new_tokens = reader.GetInteger("server", "default_max_new_tokens", 200);
+    server_config.max_seq_len = max_seq_len;
+    const std::string server_address = reader.Get("server", "address", "unix:/tmp/gptjX.sock");
     const uint32_t memory_len = reader.GetInteger("request", "memory_len", 0);
 
     FT_CHECK(head_num % tensor_para_size == 0);
@@ -233,67 +466,14 @@ void gptj_example(const INIReader reader)
     std::vector<int> bad_words;
     // read_word_list("../examples/cpp/gptj/bad_words.csv", bad_words);
 
-    int* d_bad_words = nullptr;
-    deviceMalloc(&d_bad_words, bad_words.size(), false);
-    cudaH2Dcpy(d_bad_words, bad_words.data(), bad_words.size());
-
     // Handle stop_words dictionary
     std::vector<int> stop_words;
     // read_word_list("../examples/cpp/gptj/stop_words.csv", stop_words);
-
-    const size_t stop_words_len = stop_words.size() / 2;
-    // Tile with same dict for each element
-    std::vector<int> tiled_stop_words;
-    for (int i = 0; i < request_batch_size; i++) {
-        tiled_stop_words.insert(tiled_stop_words.end(), stop_words.begin(), stop_words.end());
-    }
-
-    int* d_stop_words = nullptr;
-    deviceMalloc(&d_stop_words, tiled_stop_words.size(), false);
-    cudaH2Dcpy(d_stop_words, tiled_stop_words.data(), tiled_stop_words.size());
-
-    // Read ids of request from file.
-    int max_input_len = -1;
-    std::vector<int> v_start_lengths;
-    std::vector<int> v_start_ids;
-    // read_start_ids(request_batch_size,
-    //                &v_start_lengths,
-    //                &v_start_ids,
-    //                max_input_len,
-    //                end_id,
-    //                1,
-    //                "../examples/cpp/gptj/start_ids.csv");
-    /* DUMMY FOR WARMUP */
-    v_start_lengths.push_back(10);
-    for(int i = 0; i < 10; i++){
-        v_start_ids.push_back(13);
-    }
-    max_input_len = 10;
-    // read_start_idsX(request_batch_size,
-    //                &v_start_lengths,
-    //                &v_start_ids,
-    //                max_input_len,
-    //                end_id,
-    //                1);
-
-    int* d_input_ids;
-    int* d_input_lengths;
-    if (max_input_len == 0) {
-        // unconditional case, no input ids, so do nothing.
-        d_input_ids = nullptr;
-        d_input_lengths = nullptr;
-    }
-    else {
-        // conditional case.
-        deviceMalloc(&d_input_ids, request_batch_size * max_input_len, false);
-        deviceMalloc(&d_input_lengths, request_batch_size, false);
-        cudaH2Dcpy(d_input_ids, v_start_ids.data(), request_batch_size * max_input_len);
-        cudaH2Dcpy(d_input_lengths, v_start_lengths.data(), request_batch_size);
+    const std::string stop_words_file = reader.Get("request", "stop_words_file", "");
+    if (!stop_words_file.empty()) {
+        read_word_list(stop_words_file, stop_words);
     }
 
-    std::vector<int> start_ids(request_batch_size, start_id);
-    std::vector<int> end_ids(request_batch_size, end_id);
-
     // Prompt Learning Configurations
     // NOTE: if you don't need prefix prompts, remember to set max_prefix_len to 0 and others to nullptr
     int prompt_learning_start_id = reader.GetInteger(model_name, "prompt_learning_start_id", end_id + 1);
@@ -303,12 +483,6 @@ void gptj_example(const INIReader reader)
     std::map<std::string, std::pair<int, int>> prefix_prompt_table_pair;
     std::vector<int> prefix_prompt_task_ids{};
 
-    const int total_output_len = max_input_len + request_output_len;
-    if (total_output_len > (int)max_seq_len) {
-        printf("[ERROR] total_output_len (%d) should be <= max_seq_len (%ld). \n", total_output_len, max_seq_len);
-        exit(-1);
-    }
-
     cudaStream_t stream;
     cublasHandle_t cublas_handle;
     cublasLtHandle_t cublaslt_handle;
@@ -387,148 +561,75 @@ void gptj_example(const INIReader reader)
                           false,
                           &prop);
 
-    int* d_output_ids;
-    int* d_sequence_lengths;
-    deviceMalloc(&d_output_ids, request_batch_size * beam_width * total_output_len, false);
-    deviceMalloc(&d_sequence_lengths, request_batch_size * beam_width, false);
-    std::vector<uint32_t> output_seq_len(request_batch_size, total_output_len);
-    std::unordered_map<std::string, Tensor> input_tensors = std::unordered_map<std::string, Tensor>{
-        {"input_ids",
-         Tensor{MEMORY_GPU, TYPE_INT32, std::vector<size_t>{request_batch_size, (size_t)max_input_len}, d_input_ids}},
-        {"input_lengths", Tensor{MEMORY_GPU, TYPE_INT32, std::vector<size_t>{request_batch_size}, d_input_lengths}},
-        // NOTE: if you need prefix prompts, remember to add prefix_prompt_task_ids here
-        // {"prompt_learning_task_name_ids", Tensor{MEMORY_CPU, TYPE_INT32, std::vector<size_t>{request_batch_size},
-        // prefix_prompt_task_ids.data()}},
-        {"output_seq_len",
-         Tensor{MEMORY_CPU, TYPE_UINT32, std::vector<size_t>{request_batch_size}, output_seq_len.data()}},
-        {"temperature", Tensor{MEMORY_CPU, TYPE_FP32, std::vector<size_t>{1}, &temperature}},
-        {"len_penalty", Tensor{MEMORY_CPU, TYPE_FP32, std::vector<size_t>{1}, &len_penalty}},
-        {"repetition_penalty", Tensor{MEMORY_CPU, TYPE_FP32, std::vector<size_t>{1}, &repetition_penalty}},
-        {"start_id", Tensor{MEMORY_CPU, TYPE_INT32, std::vector<size_t>{request_batch_size}, start_ids.data()}},
-        {"end_id", Tensor{MEMORY_CPU, TYPE_INT32, std::vector<size_t>{request_batch_size}, end_ids.data()}}};
-    if (!bad_words.empty()) {
-        input_tensors.insert(
-            {"bad_words_list", Tensor{MEMORY_GPU, TYPE_INT32, {2, bad_words.size() / 2}, d_bad_words}});
-    }
-    if (stop_words_len != 0) {
-        input_tensors.insert(
-            {"stop_words_list", Tensor{MEMORY_GPU, TYPE_INT32, {request_batch_size, 2, stop_words_len}, d_stop_words}});
-    }
-    if (top_k == 0 && top_p == 0.0f) {
-        FT_CHECK(beam_width > 1);
-        input_tensors.insert({"beam_search_diversity_rate",
-                              Tensor{MEMORY_CPU, TYPE_FP32, std::vector<size_t>{1}, &beam_search_diversity_rate}});
-    }
-    else {
-        input_tensors.insert({"random_seed", Tensor{MEMORY_CPU, TYPE_UINT64, std::vector<size_t>{1}, &random_seed}});
-        if (top_p != 0.0f) {
-            input_tensors.insert({"runtime_top_p", Tensor{MEMORY_CPU, TYPE_FP32, std::vector<size_t>{1}, &top_p}});
-        }
-        if (top_k != 0) {
-            input_tensors.insert({"runtime_top_k", Tensor{MEMORY_CPU, TYPE_UINT32, std::vector<size_t>{1}, &top_k}});
-        }
-    }
-    if (memory_len > 0) {
-        input_tensors.insert({"memory_len", {MEMORY_CPU, TYPE_UINT32, {1}, &memory_len}});
-    }
-
-    std::unordered_map<std::string, Tensor> output_tensors = std::unordered_map<std::string, Tensor>{
-        {"output_ids",
-         Tensor{MEMORY_GPU,
-                TYPE_INT32,
-                std::vector<size_t>{request_batch_size, beam_width, (size_t)total_output_len},
-                d_output_ids}},
-        {"sequence_length",
-         Tensor{MEMORY_GPU, TYPE_INT32, std::vector<size_t>{request_batch_size, beam_width}, d_sequence_lengths}},
-        {"output_log_probs",
-         Tensor{MEMORY_GPU,
-                TYPE_FP32,
-                std::vector<size_t>{(size_t)request_output_len, request_batch_size, beam_width},
-                nullptr}}};
+    GptJRuntimeArgs args;
+    args.beam_width                 = beam_width;
+    args.top_k                      = top_k;
+    args.top_p                      = top_p;
+    args.temperature                = temperature;
+    args.repetition_penalty         = repetition_penalty;
+    args.len_penalty                = len_penalty;
+    args.beam_search_diversity_rate = beam_search_diversity_rate;
+    args.random_seed                = random_seed;
+    args.start_id                   = start_id;
+    args.end_id                     = end_id;
+    args.memory_len                 = memory_len;
+    args.bad_words                  = bad_words;
+    args.stop_words                 = stop_words;
+    GptJBatchGenerator<T> generator(&gpt, &gpt_weights, args);
 
     print_mem_usage("After loading model");
 
-    int ite = 1;
     cudaDeviceSynchronize();
     mpi::barrier();
 
     cudaProfilerStart();
-    // warm up
-    ite = 1;
-    nvtx::setScope("warmup_time");
-    PUSH_RANGE("warmup time")
-    for (int i = 0; i < ite; ++i) {
-        gpt.forward(&output_tensors, &input_tensors, &gpt_weights);
+    if (rank == 0) {
+        // Stops the server on SIGINT or SIGTERM, received by a dedicated thread: they are blocked before the server
+        // threads start, which inherit the mask.
+        sigset_t stop_signals;
+        sigemptyset(&stop_signals);
+        sigaddset(&stop_signals, SIGINT);
+        sigaddset(&stop_signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &stop_signals, nullptr);
+
+        // warm up
+        nvtx::setScope("warmup_time");
+        PUSH_RANGE("warmup time")
+        ServerRequest warmup_request;
+        warmup_request.input_ids.assign(10, 13);
+        warmup_request.max_new_tokens = server_config.default_max_new_tokens;
+        generator.generate({&warmup_request}, nullptr);
+        print_mem_usage("After forward");
+        POP_RANGE;
+        nvtx::resetScope();
+
+        BatchingServer server(server_config, &generator);
+        server.listen(server_address);
+        std::thread signal_thread([&] {
+            int signal;
+            sigwait(&stop_signals, &signal);
+            FT_LOG_INFO("Received signal %d, stopping the server", signal);
+            server.stop();
+        });
+        server.run();
+        signal_thread.join();
+
+        const BatchingServerStats stats = server.getStats();
+        FT_LOG_INFO("Served %lu requests (%lu rejected, %lu failed) in %lu batches of %.2f requests, %lu tokens",
+                    stats.num_requests,
+                    stats.num_rejected,
+                    stats.num_failed,
+                    stats.num_batches,
+                    stats.meanBatchSize(),
+                    stats.num_generated);
+        generator.stop();
+    }
+    else {
+        generator.follow();
     }
-    print_mem_usage("After forward");
     cudaDeviceSynchronize();
     mpi::barrier();
 
-    POP_RANGE;
-    nvtx::resetScope();
-
-    // test time
-    struct timeval start, end;
-
-    // loop
-    while (true) {
-        v_start_ids.clear();
-        v_start_lengths.clear();
-        deviceFree(d_input_ids);
-        deviceFree(d_input_lengths);
-        mpi::barrier();
-        cudaDeviceSynchronize();
-        gettimeofday(&start, NULL);
-        read_start_idsX(request_batch_size, &v_start_lengths, &v_start_ids, max_input_len, end_id, 1);
-        if (max_input_len == 0) {
-            // unconditional case, no input ids, so do nothing.
-            d_input_ids = nullptr;
-            d_input_lengths = nullptr;
-        }
-        else {
-            // conditional case.
-            printf("Mallocing...\n");
-            deviceMalloc(&d_input_ids, request_batch_size * max_input_len, false);
-            deviceMalloc(&d_input_lengths, request_batch_size, false);
-            cudaH2Dcpy(d_input_ids, v_start_ids.data(), request_batch_size * max_input_len);
-            cudaH2Dcpy(d_input_lengths, v_start_lengths.data(), request_batch_size);
-        }
-        input_tensors.erase("input_ids");
-        input_tensors.erase("input_lengths");
-        input_tensors.insert({"input_ids", Tensor{MEMORY_GPU, TYPE_INT32, std::vector<size_t>{request_batch_size, (size_t)max_input_len}, d_input_ids}});
-        input_tensors.insert({"input_lengths", Tensor{MEMORY_GPU, TYPE_INT32, std::vector<size_t>{request_batch_size}, d_input_lengths}});
-        for (int i = 0; i < ite; ++i) {
-            gpt.forward(&output_tensors, &input_tensors, &gpt_weights);
-        }
-        cudaDeviceSynchronize();
-        mpi::barrier();
-        gettimeofday(&start, NULL);
-        printf("[INFO] request_batch_size %ld beam_width %ld head_num %ld size_per_head %ld total_output_len %d"
-               " decoder_layers %ld vocab_size %ld FT-CPP-decoding-beamsearch-time %.2f ms\n",
-               request_batch_size,
-               beam_width,
-               head_num,
-               size_per_head,
-               total_output_len,
-               decoder_layers,
-               vocab_size,
-               ((end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) * 0.001) / ite);
-        if (rank == 0) {
-            size_t outCount = total_output_len * request_batch_size * beam_width;
-            int* hBuf = new int[outCount];
-            cudaD2Hcpy(hBuf, d_output_ids, outCount);
-            int j = 0;
-            for(int rbs_i = 0; rbs_i < request_batch_size; rbs_i++){
-                for(int bw_i = 0; bw_i < beam_width; bw_i++){
-                    for(int i = 0; i < total_output_len; i++){
-                        std::cout << hBuf[j++] << " ";
-                    }
-                    std::cout << "\n";
-                }
-            }
-        }
-    }
-
     cudaProfilerStop();
     ftNcclParamDestroy(tensor_para);
     ftNcclParamDestroy(pipeline_para);
@@ -536,20 +637,5 @@ void gptj_example(const INIReader reader)
     delete cublas_algo_map;
     delete cublas_wrapper_mutex;
 
-    cudaFree(d_bad_words);
-    cudaFree(d_stop_words);
-    if (d_input_ids != nullptr) {
-        cudaFree(d_input_ids);
-    }
-    if (d_input_lengths != nullptr) {
-        cudaFree(d_input_lengths);
-    }
-    if (d_output_ids != nullptr) {
-        cudaFree(d_output_ids);
-    }
-    if (d_sequence_lengths != nullptr) {
-        cudaFree(d_sequence_lengths);
-    }
-
     return;
 }
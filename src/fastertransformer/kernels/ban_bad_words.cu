@@ -161,4 +161,118 @@ template void invokeBanBadWords(float*       logits,
                                 size_t       step,
                                 cudaStream_t stream);
 
+template<typename T>
+__global__ void
+ban_tokens(T* logits, const int* banned_rows, const int* banned_tokens, int num_banned, int vocab_size_padded)
+{
+    const int id = blockIdx.x * blockDim.x + threadIdx.x;
+    if (id < num_banned && 0 <= banned_tokens[id] && banned_tokens[id] < vocab_size_padded) {
+        logits[banned_rows[id] * vocab_size_padded + banned_tokens[id]] = static_cast<T>(-INFINITY);
+    }
+}
+
+template<typename T>
+void invokeBanTokens(T*           logits,
+                     const int*   banned_rows,
+                     const int*   banned_tokens,
+                     int          num_banned,
+                     int          vocab_size_padded,
+                     cudaStream_t stream)
+{
+    dim3 block, grid;
+    block.x = min(((num_banned + 32 - 1) / 32) * 32, 256);
+    grid.x  = (num_banned + block.x - 1) / block.x;
+    ban_tokens<<<grid, block, 0, stream>>>(logits, banned_rows, banned_tokens, num_banned, vocab_size_padded);
+    sync_check_cuda_error();
+}
+
+template void invokeBanTokens(half*        logits,
+                              const int*   banned_rows,
+                              const int*   banned_tokens,
+                              int          num_banned,
+                              int          vocab_size_padded,
+                              cudaStream_t stream);
+#ifdef ENABLE_BF16
+template void invokeBanTokens(__nv_bfloat16* logits,
+                              const int*     banned_rows,
+                              const int*     banned_tokens,
+                              int            num_banned,
+                              int            vocab_size_padded,
+                              cudaStream_t   stream);
+#endif
+template void invokeBanTokens(float*       logits,
+                              const int*   banned_rows,
+                              const int*   banned_tokens,
+                              int          num_banned,
+                              int          vocab_size_padded,
+                              cudaStream_t stream);
+
+template<typename T>
+__global__ void allow_tokens(T*         logits,
+                             const int* rows,
+                             const int* allowed_offsets,
+                             const int* allowed_tokens,
+                             int        vocab_size_padded)
+{
+    // one block per row, each token looked up in the sorted allowed tokens of the row
+    T*         row_logits = logits + (size_t)rows[blockIdx.x] * vocab_size_padded;
+    const int* begin      = allowed_tokens + allowed_offsets[blockIdx.x];
+    const int  num        = allowed_offsets[blockIdx.x + 1] - allowed_offsets[blockIdx.x];
+    for (int token = threadIdx.x; token < vocab_size_padded; token += blockDim.x) {
+        int low  = 0;
+        int high = num;
+        while (low < high) {
+            const int mid = (low + high) / 2;
+            if (begin[mid] < token) {
+                low = mid + 1;
+            }
+            else {
+                high = mid;
+            }
+        }
+        if (low == num || begin[low] != token) {
+            row_logits[token] = static_cast<T>(-INFINITY);
+        }
+    }
+}
+
+template<typename T>
+void invokeAllowTokens(T*           logits,
+                       const int*   rows,
+                       const int*   allowed_offsets,
+                       const int*   allowed_tokens,
+                       int          num_rows,
+                       int          vocab_size_padded,
+                       cudaStream_t stream)
+{
+    dim3 block(min(vocab_size_padded, 256));
+    dim3 grid(num_rows);
+    allow_tokens<<<grid, block, 0, stream>>>(logits, rows, allowed_offsets, allowed_tokens, vocab_size_padded);
+    sync_check_cuda_error();
+}
+
+template void invokeAllowTokens(half*        logits,
+                                const int*   rows,
+                                const int*   allowed_offsets,
+                                const int*   allowed_tokens,
+                                int          num_rows,
+                                int          vocab_size_padded,
+                                cudaStream_t stream);
+#ifdef ENABLE_BF16
+template void invokeAllowTokens(__nv_bfloat16* logits,
+                                const int*     rows,
+                                const int*     allowed_offsets,
+                                const int*     allowed_tokens,
+                                int            num_rows,
+                                int            vocab_size_padded,
+                                cudaStream_t   stream);
+#endif
+template void invokeAllowTokens(float*       logits,
+                                const int*   rows,
+                                const int*   allowed_offsets,
+                                const int*   allowed_tokens,
+                                int          num_rows,
+                                int          vocab_size_padded,
+                                cudaStream_t stream);
+
 }  // namespace fastertransformer
@@ -36,4 +36,25 @@ void invokeBanBadWords(T*           logits,
                        size_t       step,
                        cudaStream_t stream);
 
+// Sets logits[banned_rows[i], banned_tokens[i]] to -inf for i < num_banned. logits is [rows, vocab_size_padded].
+template<typename T>
+void invokeBanTokens(T*           logits,
+                     const int*   banned_rows,
+                     const int*   banned_tokens,
+                     int          num_banned,
+                     int          vocab_size_padded,
+                     cudaStream_t stream);
+
+// Masks the rows constrained to a set of tokens: for i < num_rows, every logit of row rows[i] is set to -inf except
+// those of the tokens allowed_tokens[allowed_offsets[i] .. allowed_offsets[i + 1]), sorted in increasing order.
+// logits is [rows, vocab_size_padded].
+template<typename T>
+void invokeAllowTokens(T*           logits,
+                       const int*   rows,
+                       const int*   allowed_offsets,
+                       const int*   allowed_tokens,
+                       int          num_rows,
+                       int          vocab_size_padded,
+                       cudaStream_t stream);
+
 }  // namespace fastertransformer
@@ -0,0 +1,309 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/fastertransformer/kernels/beam_hypotheses_kernels.h"
+#include "src/fastertransformer/utils/cuda_utils.h"
+
+namespace fastertransformer {
+
+// The hypotheses of a request live in the [beam_width] slice of its buffers.
+__device__ __forceinline__ void add_beam_hypothesis(BeamHypothesesBuffers& hyps,
+                                                    const int              batch_id,
+                                                    const int              K,
+                                                    const float            cum_log_prob,
+                                                    const float            log_prob,
+                                                    const int              length,
+                                                    const int              step,
+                                                    const int              token,
+                                                    const int              parent_beam,
+                                                    const float            length_penalty)
+{
+    const int   offset = batch_id * K;
+    const float score  = cum_log_prob / powf((float)length, length_penalty);
+    int         slot   = offset + hyps.num_hyps[batch_id];
+    if (hyps.num_hyps[batch_id] < K) {
+        hyps.num_hyps[batch_id]++;
+    }
+    else {
+        // replaces the first worst hypothesis
+        slot = offset;
+        for (int i = offset + 1; i < offset + K; i++) {
+            if (hyps.scores[i] < hyps.scores[slot]) {
+                slot = i;
+            }
+        }
+        if (!(score > hyps.scores[slot])) {
+            return;
+        }
+    }
+    hyps.scores[slot]         = score;
+    hyps.cum_log_probs[slot]  = cum_log_prob;
+    hyps.last_log_probs[slot] = log_prob;
+    hyps.lengths[slot]        = length;
+    hyps.steps[slot]          = step;
+    hyps.last_tokens[slot]    = token;
+    hyps.parent_beams[slot]   = parent_beam;
+}
+
+__device__ __forceinline__ bool is_beam_search_done(const BeamHypothesesBuffers& hyps,
+                                                    const int                    batch_id,
+                                                    const int                    K,
+                                                    const float                  best_cum_log_prob,
+                                                    const int                    cur_length,
+                                                    const int                    max_length,
+                                                    const float                  length_penalty,
+                                                    const BeamEarlyStopping      early_stopping)
+{
+    if (hyps.num_hyps[batch_id] < K) {
+        return false;
+    }
+    if (early_stopping == BeamEarlyStopping::ALWAYS) {
+        return true;
+    }
+    float worst_score = hyps.scores[batch_id * K];
+    for (int i = 1; i < K; i++) {
+        worst_score = fminf(worst_score, hyps.scores[batch_id * K + i]);
+    }
+    const int length = early_stopping == BeamEarlyStopping::NEVER && length_penalty > 0.0f ? max_length : cur_length;
+    return worst_score >= best_cum_log_prob / powf((float)length, length_penalty);
+}
+
+// One thread per request: moves the end candidates among the first K to the hypotheses and fills the K slots with the
+// others, then checks whether the request is done. A done request gets its hypotheses as final beams: their tokens are
+// backtracked and written over the histories of its rows, which then only repeat the end token.
+__global__ void update_beam_hypotheses_kernel(BeamHypothesesBuffers   hyps,
+                                              int*                    output_ids,
+                                              int*                    parent_ids,
+                                              float*                  cum_log_probs,
+                                              float*                  output_log_probs,
+                                              bool*                   finished,
+                                              int*                    sequence_lengths,
+                                              const int*              end_ids,
+                                              const uint32_t*         sequence_limit_length,
+                                              const int               batch_size,
+                                              const int               local_batch_size,
+                                              const int               batch_offset,
+                                              const int               K,
+                                              const int               vocab_size,
+                                              const int               step,
+                                              const int               first_step,
+                                              const int               max_seq_len,
+                                              const float             length_penalty,
+                                              const BeamEarlyStopping early_stopping)
+{
+    const int vector_id = blockIdx.x * blockDim.x + threadIdx.x;  // request in the local batch
+    if (vector_id >= local_batch_size) {
+        return;
+    }
+    const int batch_id   = batch_offset + vector_id;  // request in the batch
+    const int row_offset = vector_id * K;             // rows of the request in the local batch
+    const int num_rows   = batch_size * K;
+    const int end_id     = end_ids[vector_id];
+    // entries of the step in the histories
+    int*   step_ids        = output_ids + step * num_rows + batch_id * K;
+    int*   step_parent_ids = parent_ids + step * num_rows + batch_id * K;
+    float* step_log_probs  = output_log_probs != nullptr ? output_log_probs + row_offset : nullptr;
+
+    if (hyps.is_done[batch_id]) {
+        for (int i = 0; i < K; ++i) {
+            step_ids[i]        = end_id;
+            step_parent_ids[i] = i;
+            if (step_log_probs != nullptr) {
+                step_log_probs[i] = 0.0f;
+            }
+        }
+        return;
+    }
+
+    int   lengths[MAX_BEAM_HYPOTHESES_BEAM_WIDTH];
+    float prev_cum_log_probs[MAX_BEAM_HYPOTHESES_BEAM_WIDTH];
+    for (int i = 0; i < K; ++i) {
+        lengths[i]            = sequence_lengths[row_offset + i];
+        prev_cum_log_probs[i] = cum_log_probs[row_offset + i];
+    }
+    const int*   candidate_ids           = hyps.candidate_ids + vector_id * 2 * K;
+    const float* candidate_cum_log_probs = hyps.candidate_cum_log_probs + vector_id * 2 * K;
+
+    int   beams[MAX_BEAM_HYPOTHESES_BEAM_WIDTH];
+    int   tokens[MAX_BEAM_HYPOTHESES_BEAM_WIDTH];
+    float new_cum_log_probs[MAX_BEAM_HYPOTHESES_BEAM_WIDTH];
+    int   num_beams = 0;
+    for (int rank = 0; rank < 2 * K && num_beams < K; ++rank) {
+        const int   id           = candidate_ids[rank];
+        const float cum_log_prob = candidate_cum_log_probs[rank];
+        const int   beam         = (id / vocab_size) % K;
+        const int   token        = id % vocab_size;
+        if (token == end_id) {
+            if (rank < K) {
+                add_beam_hypothesis(hyps,
+                                    batch_id,
+                                    K,
+                                    cum_log_prob,
+                                    cum_log_prob - prev_cum_log_probs[beam],
+                                    lengths[beam] + 1,
+                                    step,
+                                    end_id,
+                                    beam,
+                                    length_penalty);
+            }
+            continue;
+        }
+        beams[num_beams]             = beam;
+        tokens[num_beams]            = token;
+        new_cum_log_probs[num_beams] = cum_log_prob;
+        num_beams++;
+    }
+
+    const int max_step   = sequence_limit_length != nullptr ? (int)sequence_limit_length[batch_id] : max_seq_len - 1;
+    const int cur_length = lengths[(candidate_ids[0] / vocab_size) % K] + 1;
+    bool      is_done    = is_beam_search_done(hyps,
+                                       batch_id,
+                                       K,
+                                       candidate_cum_log_probs[0],
+                                       cur_length,
+                                       cur_length + max_step - step,
+                                       length_penalty,
+                                       early_stopping);
+    if (!is_done && step >= max_step) {
+        for (int i = 0; i < K; ++i) {
+            add_beam_hypothesis(hyps,
+                                batch_id,
+                                K,
+                                new_cum_log_probs[i],
+                                new_cum_log_probs[i] - prev_cum_log_probs[beams[i]],
+                                lengths[beams[i]] + 1,
+                                step,
+                                tokens[i],
+                                beams[i],
+                                length_penalty);
+        }
+        is_done = true;
+    }
+    if (!is_done) {
+        for (int i = 0; i < K; ++i) {
+            step_ids[i]                      = tokens[i];
+            step_parent_ids[i]               = beams[i];
+            cum_log_probs[row_offset + i]    = new_cum_log_probs[i];
+            sequence_lengths[row_offset + i] = lengths[beams[i]] + 1;
+            finished[row_offset + i]         = false;
+            if (step_log_probs != nullptr) {
+                step_log_probs[i] = new_cum_log_probs[i] - prev_cum_log_probs[beams[i]];
+            }
+        }
+        return;
+    }
+
+    // final beams: the hypotheses, best first
+    hyps.is_done[batch_id] = true;
+    const int hyp_offset   = batch_id * K;
+    int       order[MAX_BEAM_HYPOTHESES_BEAM_WIDTH];
+    for (int i = 0; i < K; ++i) {
+        int j = i;
+        for (; j > 0 && hyps.scores[hyp_offset + order[j - 1]] < hyps.scores[hyp_offset + i]; --j) {
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+    }
+    // backtrack every final beam before the histories of the request are rewritten
+    int*   final_tokens    = hyps.tokens + (size_t)batch_id * K * max_seq_len;
+    float* final_log_probs = hyps.log_probs + (size_t)batch_id * K * max_seq_len;
+    for (int i = 0; i < K; ++i) {
+        const int h           = hyp_offset + order[i];
+        int*      tokens_i    = final_tokens + i * max_seq_len;
+        float*    log_probs_i = final_log_probs + i * max_seq_len;
+        int       beam        = hyps.parent_beams[h];
+        tokens_i[hyps.steps[h]]    = hyps.last_tokens[h];
+        log_probs_i[hyps.steps[h]] = hyps.last_log_probs[h];
+        for (int u = hyps.steps[h] - 1; u >= first_step; --u) {
+            const int index = u * num_rows + batch_id * K + beam;
+            tokens_i[u]     = output_ids[index];
+            if (step_log_probs != nullptr) {
+                log_probs_i[u] = step_log_probs[(u - step) * num_rows + beam];
+            }
+            beam = parent_ids[index];
+        }
+    }
+    for (int i = 0; i < K; ++i) {
+        const int    h           = hyp_offset + order[i];
+        const int*   tokens_i    = final_tokens + i * max_seq_len;
+        const float* log_probs_i = final_log_probs + i * max_seq_len;
+        for (int u = first_step; u < step; ++u) {
+            const int index   = u * num_rows + batch_id * K + i;
+            output_ids[index] = u <= hyps.steps[h] ? tokens_i[u] : end_id;
+            parent_ids[index] = i;
+            if (step_log_probs != nullptr) {
+                step_log_probs[(u - step) * num_rows + i] = u <= hyps.steps[h] ? log_probs_i[u] : 0.0f;
+            }
+        }
+        const bool ends_now              = hyps.steps[h] == step;
+        step_ids[i]                      = ends_now ? hyps.last_tokens[h] : end_id;
+        step_parent_ids[i]               = i;
+        cum_log_probs[row_offset + i]    = hyps.cum_log_probs[h];
+        sequence_lengths[row_offset + i] = hyps.lengths[h];
+        finished[row_offset + i]         = true;
+        if (step_log_probs != nullptr) {
+            step_log_probs[i] = ends_now ? hyps.last_log_probs[h] : 0.0f;
+        }
+    }
+}
+
+void invokeUpdateBeamHypotheses(BeamHypothesesBuffers   hyps,
+                                int*                    output_ids,
+                                int*                    parent_ids,
+                                float*                  cum_log_probs,
+                                float*                  output_log_probs,
+                                bool*                   finished,
+                                int*                    sequence_lengths,
+                                const int*              end_ids,
+                                const uint32_t*         sequence_limit_length,
+                                const int               batch_size,
+                                const int               local_batch_size,
+                                const int               batch_offset,
+                                const int               beam_width,
+                                const int               vocab_size,
+                                const int               step,
+                                const int               first_step,
+                                const int               max_seq_len,
+                                const float             length_penalty,
+                                const BeamEarlyStopping early_stopping,
+                                cudaStream_t            stream)
+{
+    FT_CHECK_WITH_INFO(beam_width <= MAX_BEAM_HYPOTHESES_BEAM_WIDTH,
+                       fmtstr("Early stopping does not support beam_width=%d", beam_width));
+    dim3 block(32);
+    dim3 grid((local_batch_size + block.x - 1) / block.x);
+    update_beam_hypotheses_kernel<<<grid, block, 0, stream>>>(hyps,
+                                                              output_ids,
+                                                              parent_ids,
+                                                              cum_log_probs,
+                                                              output_log_probs,
+                                                              finished,
+                                                              sequence_lengths,
+                                                              end_ids,
+                                                              sequence_limit_length,
+                                                              batch_size,
+                                                              local_batch_size,
+                                                              batch_offset,
+                                                              beam_width,
+                                                              vocab_size,
+                                                              step,
+                                                              first_step,
+                                                              max_seq_len,
+                                                              length_penalty,
+                                                              early_stopping);
+}
+
+}  // namespace fastertransformer
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "src/fastertransformer/utils/beam_hypotheses.h"
+#include <cstdint>
+#include <cuda_runtime.h>
+
+namespace fastertransformer {
+
+// Largest beam width supported with early stopping.
+static const int MAX_BEAM_HYPOTHESES_BEAM_WIDTH = 64;
+
+// Hypotheses of the requests with early stopping, see BeamHypotheses.
+struct BeamHypothesesBuffers {
+    float* scores;                   // [batch_size, beam_width]
+    float* cum_log_probs;            // [batch_size, beam_width]
+    float* last_log_probs;           // [batch_size, beam_width], log prob of the last token
+    int*   lengths;                  // [batch_size, beam_width]
+    int*   steps;                    // [batch_size, beam_width]
+    int*   last_tokens;              // [batch_size, beam_width]
+    int*   parent_beams;             // [batch_size, beam_width]
+    int*   num_hyps;                 // [batch_size]
+    bool*  is_done;                  // [batch_size]
+    int*   tokens;                   // [batch_size, beam_width, max_seq_len], workspace of the final beams
+    float* log_probs;                // [batch_size, beam_width, max_seq_len], workspace of the final beams
+    int*   candidate_ids;            // [batch_size, 2 * beam_width], beam * vocab_size_padded + token, best first
+    float* candidate_cum_log_probs;  // [batch_size, 2 * beam_width]
+};
+
+// One beam search step with early stopping for the local batch [batch_offset, batch_offset + local_batch_size) of a
+// batch of batch_size requests, from the candidates of its requests (hyps.candidate_ids of the i-th request of the
+// local batch start at i * 2 * beam_width, the rows of the ids being those of the local batch). Replaces the update of
+// the beam states: writes the tokens and parents of the step into the output_ids and parent_ids histories
+// [max_seq_len, batch_size * beam_width] and updates cum_log_probs, finished and sequence_lengths
+// [local_batch_size * beam_width]. output_log_probs, optional, is the [local_batch_size * beam_width] entry of the step
+// in a history [num_steps, batch_size * beam_width] of consecutive steps holding first_step, as DynamicDecodeLayer
+// passes it. The histories of the requests done at this step are rewritten with their final beams.
+void invokeUpdateBeamHypotheses(BeamHypothesesBuffers   hyps,
+                                int*                    output_ids,
+                                int*                    parent_ids,
+                                float*                  cum_log_probs,
+                                float*                  output_log_probs,
+                                bool*                   finished,
+                                int*                    sequence_lengths,
+                                const int*              end_ids,
+                                const uint32_t*         sequence_limit_length,
+                                const int               batch_size,
+                                const int               local_batch_size,
+                                const int               batch_offset,
+                                const int               beam_width,
+                                const int               vocab_size,
+                                const int               step,
+                                const int               first_step,
+                                const int               max_seq_len,
+                                const float             length_penalty,
+                                const BeamEarlyStopping early_stopping,
+                                cudaStream_t            stream);
+
+}  // namespace fastertransformer
@@ -485,6 +485,124 @@ template void invokeTopkBeamSearch(void*        workspace,
                                    const int*   end_ids,
                                    cudaStream_t stream);
 
+// Selects the 2 * k best of the k * k candidates of a request, best first, for early stopping. The diversity rate only
+// ranks the candidates of a beam, candidate_cum_log_probs being read from log_probs.
+template<typename T, int BLOCK_SIZE>
+__global__ void topk_stage_2_candidates(const int* __restrict topk_tmp_id_buf,
+                                        T*          topk_tmp_val_buf,
+                                        const T*    log_probs,
+                                        int*        candidate_ids,
+                                        float*      candidate_cum_log_probs,
+                                        const int   k,
+                                        const float diversity_rate)
+{
+    const int  size      = k * k;
+    const int  tid       = threadIdx.x;
+    const int  batch_id  = blockIdx.x;
+    const bool IS_FP16   = std::is_same<T, half>::value;
+    const T    MAX_T_VAL = (IS_FP16) ? HALF_FLT_MAX : FLT_MAX;
+
+    typedef cub::BlockReduce<TopK_2<T>, BLOCK_SIZE> BlockReduce;
+    __shared__ typename BlockReduce::TempStorage    temp_storage;
+    extern __shared__ char                          array[];
+    T*                                              s_val = topk_tmp_val_buf + batch_id * size;
+    int*                                            s_id  = (int*)(array);
+
+    for (int i = tid; i < size; i += BLOCK_SIZE) {
+        s_val[i] += (T)(diversity_rate * (i % k));
+    }
+    __syncthreads();
+
+    TopK_2<T> partial;
+
+    for (int ite = 0; ite < 2 * k; ite++) {
+        partial.init();
+#pragma unroll
+        for (int i = tid; i < size; i += BLOCK_SIZE) {
+            partial.insert(s_val[i], i);
+        }
+
+        TopK_2<T> total = BlockReduce(temp_storage).Reduce(partial, reduce_topk_op_2<T>);
+
+        if (tid == 0) {
+            s_id[ite]      = total.p;
+            s_val[total.p] = -MAX_T_VAL;
+        }
+        __syncthreads();
+    }
+    for (int i = tid; i < 2 * k; i += BLOCK_SIZE) {
+        const int id                                  = topk_tmp_id_buf[batch_id * size + s_id[i]];
+        candidate_ids[batch_id * 2 * k + i]           = id;
+        candidate_cum_log_probs[batch_id * 2 * k + i] = (float)log_probs[id];
+    }
+}
+
+template<typename T>
+void invokeTopkBeamSearchCandidates(void*        workspace,
+                                    size_t&      workspace_size,
+                                    T*           log_probs,
+                                    int*         candidate_ids,
+                                    float*       candidate_cum_log_probs,
+                                    const int    batch_size,
+                                    const int    beam_width,
+                                    const int    vocab_size_padded_,
+                                    const float  diversity_rate,
+                                    cudaStream_t stream)
+{
+    // the same workspace as invokeTopkBeamSearch
+    if (workspace == nullptr) {
+        invokeTopkBeamSearch<T>(nullptr,
+                                workspace_size,
+                                nullptr,
+                                nullptr,
+                                nullptr,
+                                nullptr,
+                                batch_size,
+                                beam_width,
+                                vocab_size_padded_,
+                                (T)0.0f,
+                                0.0f,
+                                nullptr,
+                                stream);
+        return;
+    }
+    const int vocab_size              = vocab_size_padded_;
+    const int temp_log_probs_buf_size = (int)(ceil(batch_size * beam_width * vocab_size / 4.)) * 4;
+    const int topk_tmp_ids_buf_size   = (int)(ceil(batch_size * beam_width * beam_width * 8 / 4.)) * 4;
+    T*        temp_log_probs          = (T*)workspace;
+    int*      topk_tmp_id_buf         = (int*)(temp_log_probs + temp_log_probs_buf_size);
+    T*        topk_tmp_val_buf        = (T*)(topk_tmp_id_buf + topk_tmp_ids_buf_size);
+
+    // the beam_width best tokens of each beam, without length penalty as the running beams are ranked by cum_log_prob
+    topk_stage_1_opt2_general<T, 128, 1><<<batch_size * beam_width, 128, 0, stream>>>(log_probs,
+                                                                                     temp_log_probs,
+                                                                                     topk_tmp_id_buf,
+                                                                                     topk_tmp_val_buf,
+                                                                                     nullptr,
+                                                                                     nullptr,
+                                                                                     beam_width,
+                                                                                     vocab_size,
+                                                                                     0.0f);
+    topk_stage_2_candidates<T, 128><<<batch_size, 128, 2 * beam_width * sizeof(int), stream>>>(topk_tmp_id_buf,
+                                                                                               topk_tmp_val_buf,
+                                                                                               log_probs,
+                                                                                               candidate_ids,
+                                                                                               candidate_cum_log_probs,
+                                                                                               beam_width,
+                                                                                               diversity_rate);
+}
+
+template void invokeTopkBeamSearchCandidates(void*        workspace,
+                                             size_t&      workspace_size,
+                                             float*       log_probs,
+                                             int*         candidate_ids,
+                                             float*       candidate_cum_log_probs,
+                                             const int    batch_size,
+                                             const int    beam_width,
+                                             const int    vocab_size_padded_,
+                                             const float  diversity_rate,
+                                             cudaStream_t stream);
+
 template<typename T>
 __global__ void tileEncoderResults(T*         tiled_output,
                                    int*       tiled_sequence_length,
@@ -35,6 +35,21 @@ void invokeTopkBeamSearch(void*        workspace,
                           const int*   end_ids,
                           cudaStream_t stream);
 
+// Candidates of beam search with early stopping, see invokeUpdateBeamHypotheses: the 2 * beam_width best of the
+// beam_width best tokens of each beam of log_probs (batch, beam, vocab), [batch_size, 2 * beam_width] best first. Uses
+// the workspace of invokeTopkBeamSearch.
+template<typename T>
+void invokeTopkBeamSearchCandidates(void*        workspace,
+                                    size_t&      workspace_size,
+                                    T*           log_probs,
+                                    int*         candidate_ids,
+                                    float*       candidate_cum_log_probs,
+                                    const int    batch_size,
+                                    const int    beam_width,
+                                    const int    vocab_size_padded_,
+                                    const float  diversity_rate,
+                                    cudaStream_t stream);
+
 template<typename T>
 void invokeTileEncoderResults(T*           tiled_encoder_output,
                               int*         tiled_encoder_sequence_length,
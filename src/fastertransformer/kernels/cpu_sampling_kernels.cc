@@ -0,0 +1,716 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/fastertransformer/kernels/cpu_sampling_kernels.h"
+#include "src/fastertransformer/kernels/philox_random.h"
+#include "src/fastertransformer/utils/cuda_utils.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <memory>
+#include <numeric>
+#include <vector>
+
+namespace fastertransformer {
+
+// Largest k supported by the top-k sampling layer.
+constexpr int CPU_TOP_K_MAX = 1024;
+// Largest number of alternatives of invokeTopLogProbs.
+constexpr int CPU_TOP_LOG_PROBS_MAX = 32;
+
+void cpuCurandInitialize(CpuCurandState* states, const size_t batch_size, unsigned long long random_seed)
+{
+    // curand_init(seed, 0, 0, &state): the salt and the mixing constants of curand_kernel.h. The subsequence and the
+    // offset are 0, so no skip-ahead is needed.
+    const uint32_t s0 = static_cast<uint32_t>(random_seed) ^ 0xaad26b49U;
+    const uint32_t s1 = static_cast<uint32_t>(random_seed >> 32) ^ 0xf7dcefddU;
+    const uint32_t t0 = 1099087573U * s0;
+    const uint32_t t1 = 2591861531U * s1;
+    for (size_t i = 0; i < batch_size; i++) {
+        states[i].d    = 6615241U + t1 + t0;
+        states[i].v[0] = 123456789U + t0;
+        states[i].v[1] = 362436069U ^ t0;
+        states[i].v[2] = 521288629U + t1;
+        states[i].v[3] = 88675123U ^ t1;
+        states[i].v[4] = 5783321U + t0;
+    }
+}
+
+void cpuCurandBatchInitialize(CpuCurandState*           states,
+                              const size_t              batch_size,
+                              const unsigned long long* random_seeds)
+{
+    for (size_t i = 0; i < batch_size; i++) {
+        cpuCurandInitialize(states + i, 1, random_seeds[i]);
+    }
+}
+
+uint32_t cpuCurand(CpuCurandState* state)
+{
+    const uint32_t t = state->v[0] ^ (state->v[0] >> 2);
+    state->v[0]      = state->v[1];
+    state->v[1]      = state->v[2];
+    state->v[2]      = state->v[3];
+    state->v[3]      = state->v[4];
+    state->v[4]      = (state->v[4] ^ (state->v[4] << 4)) ^ (t ^ (t << 1));
+    state->d += 362437U;
+    return state->v[4] + state->d;
+}
+
+float cpuCurandUniform(CpuCurandState* state)
+{
+    // x * 2^-32 + 2^-33, which nvcc contracts into a single fma
+    const float CURAND_2POW32_INV = 2.3283064e-10f;
+    return std::fma(static_cast<float>(cpuCurand(state)), CURAND_2POW32_INV, CURAND_2POW32_INV / 2.0f);
+}
+
+void cpuBatchApplyTemperaturePenalty(float*       logits,
+                                     const float* bias,
+                                     const float* temperatures,
+                                     const int    batch_size,
+                                     const int    vocab_size,
+                                     const int    vocab_size_padd)
+{
+    for (int batch_idx = 0; batch_idx < batch_size; batch_idx++) {
+        const float inv_temperature = 1.0f / temperatures[batch_idx];
+        float*      row             = logits + batch_idx * vocab_size_padd;
+        if (bias != nullptr) {
+            for (int i = 0; i < vocab_size; i++) {
+                row[i] = (row[i] + bias[i]) * inv_temperature;
+            }
+        }
+        else {
+            for (int i = 0; i < vocab_size; i++) {
+                row[i] = row[i] * inv_temperature;
+            }
+        }
+        std::fill(row + vocab_size, row + vocab_size_padd, -FLT_MAX);
+    }
+}
+
+void cpuBatchApplyRepetitionPenalty(float*       logits,
+                                    const float* penalties,
+                                    const int*   output_ids,
+                                    const int    batch_size,
+                                    const int    local_batch_size,
+                                    const int    vocab_size,
+                                    const int*   input_lengths,
+                                    const int    max_input_length,
+                                    const int    step)
+{
+    std::vector<int>   penalty_indices(step);
+    std::vector<float> penalty_logits(step);
+    for (int batch_idx = 0; batch_idx < local_batch_size; batch_idx++) {
+        const float penalty      = penalties[batch_idx];
+        const int   input_length = input_lengths != nullptr ? input_lengths[batch_idx] : max_input_length;
+        float*      row          = logits + batch_idx * vocab_size;
+
+        // Penalize from the original values so that an id appearing several times is penalized once.
+        int num_indices = 0;
+        for (int index = 0; index < step; index++) {
+            // Skip the padding tokens in input sequences.
+            if (index >= input_length && index < max_input_length) {
+                continue;
+            }
+            const int penalty_index = output_ids[index * batch_size + batch_idx];
+            FT_CHECK(penalty_index >= 0 && penalty_index < vocab_size);
+            const float logit            = row[penalty_index];
+            penalty_indices[num_indices] = penalty_index;
+            penalty_logits[num_indices]  = logit < 0.0f ? logit * penalty : logit / penalty;
+            num_indices++;
+        }
+        for (int i = 0; i < num_indices; i++) {
+            row[penalty_indices[i]] = penalty_logits[i];
+        }
+    }
+}
+
+void cpuBanBadWords(float*     logits,
+                    const int* output_ids_buf,
+                    const int* parent_ids_buf,
+                    int        batch_size,
+                    int        local_batch_size,
+                    int        beam_width,
+                    const int* bad_words,
+                    bool       share_words,
+                    size_t     bad_words_len,
+                    int        id_offset,
+                    int        vocab_size_padded,
+                    size_t     step)
+{
+    for (int batch_idx = 0; batch_idx < local_batch_size; batch_idx++) {
+        const int* base_bad_words         = share_words ? bad_words : bad_words + batch_idx * 2 * bad_words_len;
+        const int* base_bad_words_offsets = base_bad_words + bad_words_len;
+
+        for (int beam_idx = 0; beam_idx < beam_width; beam_idx++) {
+            for (size_t id = 0; id < bad_words_len; id++) {
+                if (base_bad_words_offsets[id] < 0) {
+                    continue;
+                }
+                const int item_end   = base_bad_words_offsets[id];
+                const int item_start = (id > 0) ? base_bad_words_offsets[id - 1] : 0;
+                const int item_size  = item_end - item_start;
+
+                // The single-token case unconditionally bans the token.
+                bool should_ban = item_size == 1;
+
+                // Multi-token case and enough previously generated tokens to look for a match
+                if (item_size > 1 && step >= (size_t)item_size - 1) {
+                    should_ban    = true;
+                    int parent_id = beam_idx;
+                    for (int token_idx = item_size - 2; token_idx >= 0; token_idx--) {
+                        const size_t pos = (step - (item_size - 1) + token_idx) * batch_size * beam_width + id_offset
+                                           + batch_idx * beam_width + parent_id;
+                        if (output_ids_buf[pos] != base_bad_words[item_start + token_idx]) {
+                            should_ban = false;
+                            break;
+                        }
+                        if (beam_width > 1) {
+                            parent_id = parent_ids_buf[pos];
+                            if (parent_id < 0 || parent_id >= beam_width) {
+                                should_ban = false;
+                                break;
+                            }
+                        }
+                    }
+                }
+
+                const int banned_token = base_bad_words[item_end - 1];
+                if (should_ban && 0 < banned_token && banned_token < vocab_size_padded) {
+                    logits[(batch_idx * beam_width + beam_idx) * vocab_size_padded + banned_token] = -INFINITY;
+                }
+            }
+        }
+    }
+}
+
+void cpuAddBiasEndMask(
+    float* logits, const float* bias, const int* end_ids, const bool* finished, const int m, const int n)
+{
+    for (int bid = 0; bid < m; bid++) {
+        float* row = logits + bid * n;
+        if (finished != nullptr && finished[bid]) {
+            std::fill(row, row + n, -FLT_MAX);
+            row[end_ids[bid]] = FLT_MAX;
+        }
+        else if (bias != nullptr) {
+            for (int i = 0; i < n; i++) {
+                row[i] += bias[i];
+            }
+        }
+    }
+}
+
+void cpuAddBiasSoftMax(float*       logits,
+                       const float* bias,
+                       const int*   end_ids,
+                       const bool*  finished,
+                       const int    m,
+                       const int    n_padded,
+                       const int    n)
+{
+    for (int bid = 0; bid < m; bid++) {
+        float* row = logits + bid * n_padded;
+        if (finished != nullptr && finished[bid]) {
+            std::fill(row, row + n, -FLT_MAX);
+            row[end_ids[bid]] = FLT_MAX;
+        }
+        else if (bias != nullptr) {
+            for (int i = 0; i < n; i++) {
+                row[i] += bias[i];
+            }
+        }
+        std::fill(row + n, row + n_padded, -FLT_MAX);
+
+        const float max_val = *std::max_element(row, row + n_padded);
+        float       sum_val = 0.0f;
+        for (int i = 0; i < n_padded; i++) {
+            row[i] = std::exp(row[i] - max_val);
+            sum_val += row[i];
+        }
+        const float inv_sum = 1.0f / (sum_val + 1e-6f);
+        for (int i = 0; i < n_padded; i++) {
+            row[i] = row[i] * inv_sum;
+        }
+    }
+}
+
+// Indices of the k largest values of row in descending order, equal values by index.
+static void topKIndices(std::vector<int>* indices, const float* row, const int n, const int k)
+{
+    indices->resize(n);
+    std::iota(indices->begin(), indices->end(), 0);
+    std::partial_sort(indices->begin(), indices->begin() + k, indices->end(), [row](int a, int b) {
+        return row[a] > row[b] || (row[a] == row[b] && a < b);
+    });
+    indices->resize(k);
+}
+
+static void updateSequenceState(
+    int* ids, int* sequence_length, bool* finished, const int* end_ids, const int batch_idx, const int id)
+{
+    ids[batch_idx] = id;
+    if (sequence_length != nullptr && finished != nullptr) {
+        sequence_length[batch_idx] = finished[batch_idx] ? sequence_length[batch_idx] : sequence_length[batch_idx] + 1;
+        finished[batch_idx]        = id == end_ids[batch_idx];
+    }
+}
+
+void cpuBatchTopKSampling(const float*              log_probs,
+                          const unsigned long long* random_seeds,
+                          const int*                random_steps,
+                          int*                      ids,
+                          int*                      sequence_length,
+                          bool*                     finished,
+                          float*                    cum_log_probs,
+                          float*                    output_log_probs,
+                          const int*                top_ks,
+                          const float*              top_ps,
+                          const int                 vocab_size_padded,
+                          const int*                end_ids,
+                          const int                 batch_size,
+                          const bool*               skip_decode)
+{
+    const bool         is_prob = cum_log_probs != nullptr || output_log_probs != nullptr;
+    std::vector<int>   indices;
+    std::vector<float> vals;
+    for (int batch_idx = 0; batch_idx < batch_size; batch_idx++) {
+        if (skip_decode != nullptr && skip_decode[batch_idx]) {
+            continue;
+        }
+        if (finished != nullptr && finished[batch_idx]) {
+            ids[batch_idx] = end_ids[batch_idx];
+            continue;
+        }
+        const int k = top_ks[batch_idx];
+        FT_CHECK_WITH_INFO(0 < k && k <= std::min(vocab_size_padded, CPU_TOP_K_MAX),
+                           fmtstr("top-k sampling supports 1<=k<=%d but got k=%d", CPU_TOP_K_MAX, k));
+        const float* row = log_probs + batch_idx * vocab_size_padded;
+        topKIndices(&indices, row, vocab_size_padded, k);
+
+        // When log probs are requested the inputs are already probabilities.
+        const float s_max = row[indices[0]];
+        float       s_sum = 0.0f;
+        vals.resize(k);
+        for (int i = 0; i < k; i++) {
+            vals[i] = is_prob ? row[indices[i]] : std::exp(row[indices[i]] - s_max);
+            s_sum += vals[i];
+        }
+
+        float rand_num = philoxUniform(random_seeds[batch_idx], random_steps[batch_idx]) * top_ps[batch_idx] * s_sum;
+        for (int i = 0; i < k; i++) {
+            rand_num = rand_num - vals[i];
+            if (rand_num <= 0.0f || i == k - 1) {
+                if (is_prob) {
+                    const float log_prob = logf(vals[i]);
+                    if (cum_log_probs != nullptr) {
+                        cum_log_probs[batch_idx] += log_prob;
+                    }
+                    if (output_log_probs != nullptr) {
+                        // log P(i | i is in top-k), as the GPU kernel
+                        output_log_probs[batch_idx] = log_prob - logf(s_sum);
+                    }
+                }
+                updateSequenceState(ids, sequence_length, finished, end_ids, batch_idx, indices[i]);
+                break;
+            }
+        }
+    }
+}
+
+void cpuBatchTopPSampling(const float*              probs,
+                          const unsigned long long* random_seeds,
+                          const int*                random_steps,
+                          int*                      ids,
+                          int*                      sequence_length,
+                          bool*                     finished,
+                          float*                    cum_log_probs,
+                          float*                    output_log_probs,
+                          const float*              top_ps,
+                          const int                 vocab_size_padded,
+                          const int*                end_ids,
+                          const int                 batch_size,
+                          const bool*               skip_decode)
+{
+    std::vector<int> indices(vocab_size_padded);
+    for (int batch_idx = 0; batch_idx < batch_size; batch_idx++) {
+        if (skip_decode != nullptr && skip_decode[batch_idx]) {
+            continue;
+        }
+        const float* row      = probs + batch_idx * vocab_size_padded;
+        const float  top_p    = top_ps[batch_idx];
+        const float  rand_num = philoxUniform(random_seeds[batch_idx], random_steps[batch_idx]) * top_p;
+
+        // The most likely token alone exceeds top_p: the GPU skips the sort and takes it.
+        const int top_id   = std::max_element(row, row + vocab_size_padded) - row;
+        int       selected = -1;
+        if (row[top_id] >= top_p) {
+            selected = top_id;
+        }
+        else {
+            // cub's radix sort is stable, equal probabilities keep their id order
+            std::iota(indices.begin(), indices.end(), 0);
+            std::stable_sort(indices.begin(), indices.end(), [row](int a, int b) { return row[a] > row[b]; });
+            float prefix = 0.0f;
+            for (int i = 0; i < vocab_size_padded; i++) {
+                prefix += row[indices[i]];
+                if (rand_num <= prefix) {
+                    selected = indices[i];
+                    break;
+                }
+            }
+        }
+
+        if (selected < 0) {
+            // Rounding left the total below rand_num: the GPU outputs the most likely token and leaves the log
+            // probs and the sequence state untouched.
+            ids[batch_idx] = indices[0];
+            continue;
+        }
+        if (cum_log_probs != nullptr || output_log_probs != nullptr) {
+            const float log_prob = logf(row[selected]);
+            if (cum_log_probs != nullptr) {
+                cum_log_probs[batch_idx] += log_prob;
+            }
+            if (output_log_probs != nullptr) {
+                output_log_probs[batch_idx] = log_prob;
+            }
+        }
+        updateSequenceState(ids, sequence_length, finished, end_ids, batch_idx, selected);
+    }
+}
+
+void cpuStopWordsCriterion(const int* output_ids,
+                           const int* parent_ids,
+                           const int* stop_words,
+                           bool*      finished,
+                           size_t     id_offset,
+                           size_t     stop_words_len,
+                           int        batch_size,
+                           int        beam_width,
+                           int        step)
+{
+    for (int batch_idx = 0; batch_idx < batch_size; batch_idx++) {
+        const int* base_stop_words = stop_words + batch_idx * 2 * stop_words_len;
+        const int* base_offsets    = base_stop_words + stop_words_len;
+
+        for (int beam_idx = 0; beam_idx < beam_width; beam_idx++) {
+            for (size_t id = 0; id < stop_words_len; id++) {
+                if (base_offsets[id] < 0) {
+                    continue;
+                }
+                const int item_end   = base_offsets[id];
+                const int item_start = (id > 0) ? base_offsets[id - 1] : 0;
+                const int item_size  = item_end - item_start;
+
+                // Enough previously generated tokens to look for a match
+                bool should_stop = false;
+                if (step + 1 >= item_size) {
+                    should_stop   = true;
+                    int parent_id = beam_idx;
+                    for (int token_idx = item_size - 1; token_idx >= 0; token_idx--) {
+                        const size_t pos = (step - (item_size - 1) + token_idx) * batch_size * beam_width + id_offset
+                                           + batch_idx * beam_width + parent_id;
+                        if (output_ids[pos] != base_stop_words[item_start + token_idx]) {
+                            should_stop = false;
+                            break;
+                        }
+                        if (beam_width > 1) {
+                            parent_id = parent_ids[pos];
+                            if (parent_id < 0 || parent_id >= beam_width) {
+                                should_stop = false;
+                                break;
+                            }
+                        }
+                    }
+                }
+                if (should_stop) {
+                    finished[batch_idx * beam_width + beam_idx] = true;
+                }
+            }
+        }
+    }
+}
+
+void cpuLengthCriterion(bool*           finished,
+                        bool*           should_stop,
+                        const uint32_t* sequence_limit_length,
+                        int             batch_size,
+                        int             beam_width,
+                        int             step)
+{
+    int finished_sum = 0;
+    for (int index = 0; index < batch_size * beam_width; index++) {
+        finished[index] |= step >= (int)sequence_limit_length[index / beam_width];
+        finished_sum += finished[index] ? 1 : 0;
+    }
+    *should_stop = finished_sum == batch_size * beam_width;
+}
+
+void cpuLogProbFromLogits(float*       cum_log_probs,
+                          const float* logits,
+                          const int*   input_ids,
+                          const int*   input_lengths,
+                          const size_t max_input_length,
+                          const size_t batch_size,
+                          const size_t vocab_size,
+                          const size_t vocab_size_padded,
+                          const bool   batch_first)
+{
+    FT_CHECK(vocab_size <= vocab_size_padded);
+    for (size_t bidx = 0; bidx < batch_size; bidx++) {
+        float accum = 0.0f;
+        for (int step = 0; step < input_lengths[bidx] - 1; step++) {
+            const size_t step_offset = batch_first ? step * vocab_size_padded : step * batch_size * vocab_size_padded;
+            const size_t batch_offset =
+                batch_first ? bidx * max_input_length * vocab_size_padded : bidx * vocab_size_padded;
+            const float* row = logits + step_offset + batch_offset;
+
+            const float max_logit = *std::max_element(row, row + vocab_size);
+            float       sum_exp   = 0.0f;
+            for (size_t i = 0; i < vocab_size; i++) {
+                sum_exp += std::exp(row[i] - max_logit);
+            }
+            const size_t token_idx = batch_first ? step + 1 + bidx * max_input_length : (step + 1) * batch_size + bidx;
+            accum += row[input_ids[token_idx]] - max_logit - logf(sum_exp + 1e-9f);
+        }
+        cum_log_probs[bidx] = accum;
+    }
+}
+
+void cpuTopLogProbs(int*         top_ids,
+                    float*       top_log_probs,
+                    const float* logits,
+                    const int*   num_top_log_probs,
+                    const bool*  skip_decode,
+                    const int    max_num_top_log_probs,
+                    const int    batch_size,
+                    const int    vocab_size,
+                    const int    vocab_size_padded,
+                    const bool   is_probs)
+{
+    FT_CHECK_WITH_INFO(
+        0 < max_num_top_log_probs && max_num_top_log_probs <= CPU_TOP_LOG_PROBS_MAX,
+        fmtstr("top log probs supports 1<=n<=%d but got n=%d", CPU_TOP_LOG_PROBS_MAX, max_num_top_log_probs));
+    std::vector<int> indices;
+    for (int bid = 0; bid < batch_size; bid++) {
+        if (skip_decode != nullptr && skip_decode[bid]) {
+            continue;
+        }
+        const float* row  = logits + bid * vocab_size_padded;
+        int*         ids  = top_ids + bid * max_num_top_log_probs;
+        float*       vals = top_log_probs + bid * max_num_top_log_probs;
+        const int    n    = num_top_log_probs != nullptr ? std::min(num_top_log_probs[bid], max_num_top_log_probs) :
+                                                               max_num_top_log_probs;
+        std::fill(ids, ids + max_num_top_log_probs, -1);
+        std::fill(vals, vals + max_num_top_log_probs, -INFINITY);
+        if (n <= 0) {
+            continue;
+        }
+
+        float log_normalizer = 0.0f;
+        if (!is_probs) {
+            const float max_logit = *std::max_element(row, row + vocab_size);
+            float       sum_exp   = 0.0f;
+            for (int i = 0; i < vocab_size; i++) {
+                sum_exp += std::exp(row[i] - max_logit);
+            }
+            log_normalizer = max_logit + std::log(sum_exp);
+        }
+        topKIndices(&indices, row, vocab_size, std::min(n, vocab_size));
+        for (size_t i = 0; i < indices.size(); i++) {
+            ids[i]  = indices[i];
+            vals[i] = is_probs ? std::log(row[indices[i]]) : row[indices[i]] - log_normalizer;
+        }
+    }
+}
+
+void cpuDynamicDecode(CpuDynamicDecodeOutputs*      outputs,
+                      const CpuDynamicDecodeInputs& inputs,
+                      const unsigned long long*     random_seeds,
+                      const int                     batch_size,
+                      const int                     vocab_size,
+                      const int                     vocab_size_padded)
+{
+    FT_CHECK(inputs.logits != nullptr && inputs.end_ids != nullptr);
+    FT_CHECK(inputs.runtime_top_k != nullptr && inputs.runtime_top_p != nullptr);
+    FT_CHECK(outputs->output_ids != nullptr && outputs->finished != nullptr && outputs->sequence_length != nullptr);
+    const int step = inputs.step;
+    // the generation steps of the rows, which key their random numbers with their seeds
+    std::vector<int> random_steps(batch_size, step - inputs.max_input_length);
+    if (inputs.random_steps != nullptr) {
+        std::copy(inputs.random_steps, inputs.random_steps + batch_size, random_steps.begin());
+    }
+
+    if (inputs.bad_words_list != nullptr) {
+        cpuBanBadWords(inputs.logits,
+                       outputs->output_ids,
+                       nullptr,
+                       batch_size,
+                       batch_size,
+                       1,
+                       inputs.bad_words_list,
+                       true,
+                       inputs.bad_words_len,
+                       0,
+                       vocab_size_padded,
+                       step);
+    }
+
+    // Runtime arguments as set up by TopKSamplingLayer and TopPSamplingLayer: a row is sampled by the top-k layer
+    // when top_k > 0 and by the top-p layer otherwise, and top_k = top_p = 0 falls back to greedy decoding.
+    std::vector<int>        top_ks(batch_size);
+    std::vector<float>      topk_top_ps(batch_size);
+    std::vector<float>      topp_top_ps(batch_size);
+    std::unique_ptr<bool[]> topk_skip_decode(new bool[batch_size]);
+    std::unique_ptr<bool[]> topp_skip_decode(new bool[batch_size]);
+    bool                    any_topk = false;
+    bool                    any_topp = false;
+    for (int i = 0; i < batch_size; i++) {
+        uint32_t    k = inputs.runtime_top_k[i];
+        const float p = inputs.runtime_top_p[i];
+        if (k == 0 && p == 0.0f) {
+            k = 1;
+        }
+        top_ks[i]           = std::min<int>(k, CPU_TOP_K_MAX);
+        topp_top_ps[i]      = std::min(std::max(p, 0.0f), 1.0f);
+        topk_top_ps[i]      = (k > 0 && p == 0.0f) ? 1.0f : topp_top_ps[i];
+        topk_skip_decode[i] = k == 0;
+        topp_skip_decode[i] = k > 0;
+        any_topk |= k > 0;
+        any_topp |= k == 0;
+    }
+
+    // BaseSamplingLayer applies the penalties to the logits of each layer.
+    std::vector<float> temperatures(batch_size, 1.0f);
+    bool               apply_temperature = inputs.embedding_bias != nullptr;
+    for (int i = 0; inputs.temperature != nullptr && i < batch_size; i++) {
+        temperatures[i] = inputs.temperature[i];
+        apply_temperature |= temperatures[i] != 1.0f;
+    }
+    std::vector<float> repetition_penalties(batch_size, 1.0f);
+    bool               apply_repetition_penalty = false;
+    for (int i = 0; inputs.repetition_penalty != nullptr && i < batch_size; i++) {
+        repetition_penalties[i] = inputs.repetition_penalty[i];
+        apply_repetition_penalty |= step > 1 && repetition_penalties[i] != 1.0f;
+    }
+    if (apply_temperature) {
+        cpuBatchApplyTemperaturePenalty(
+            inputs.logits, inputs.embedding_bias, temperatures.data(), batch_size, vocab_size, vocab_size_padded);
+    }
+    if (apply_repetition_penalty) {
+        cpuBatchApplyRepetitionPenalty(inputs.logits,
+                                       repetition_penalties.data(),
+                                       outputs->output_ids,
+                                       batch_size,
+                                       batch_size,
+                                       vocab_size_padded,
+                                       inputs.input_lengths,
+                                       inputs.max_input_length,
+                                       step);
+    }
+
+    int*               ids               = outputs->output_ids + step * batch_size;
+    const bool         compute_log_probs = outputs->cum_log_probs != nullptr || outputs->output_log_probs != nullptr;
+    std::vector<float> topk_logits;
+    if (any_topk) {
+        // The rows of the two layers are disjoint, the top-k layer works on a copy only when both run.
+        float* logits = inputs.logits;
+        if (any_topp) {
+            topk_logits.assign(inputs.logits, inputs.logits + batch_size * vocab_size_padded);
+            logits = topk_logits.data();
+        }
+        cpuAddBiasEndMask(logits, nullptr, inputs.end_ids, outputs->finished, batch_size, vocab_size_padded);
+        if (compute_log_probs) {
+            cpuAddBiasSoftMax(
+                logits, nullptr, inputs.end_ids, outputs->finished, batch_size, vocab_size_padded, vocab_size);
+        }
+        if (outputs->top_log_probs != nullptr) {
+            cpuTopLogProbs(outputs->top_log_prob_ids,
+                           outputs->top_log_probs,
+                           logits,
+                           inputs.num_top_log_probs,
+                           topk_skip_decode.get(),
+                           outputs->max_num_top_log_probs,
+                           batch_size,
+                           vocab_size,
+                           vocab_size_padded,
+                           compute_log_probs);
+        }
+        cpuBatchTopKSampling(logits,
+                             random_seeds,
+                             random_steps.data(),
+                             ids,
+                             outputs->sequence_length,
+                             outputs->finished,
+                             outputs->cum_log_probs,
+                             outputs->output_log_probs,
+                             top_ks.data(),
+                             topk_top_ps.data(),
+                             vocab_size_padded,
+                             inputs.end_ids,
+                             batch_size,
+                             topk_skip_decode.get());
+    }
+    if (any_topp) {
+        cpuAddBiasSoftMax(
+            inputs.logits, nullptr, inputs.end_ids, outputs->finished, batch_size, vocab_size_padded, vocab_size);
+        if (outputs->top_log_probs != nullptr) {
+            cpuTopLogProbs(outputs->top_log_prob_ids,
+                           outputs->top_log_probs,
+                           inputs.logits,
+                           inputs.num_top_log_probs,
+                           topp_skip_decode.get(),
+                           outputs->max_num_top_log_probs,
+                           batch_size,
+                           vocab_size,
+                           vocab_size_padded,
+                           true);
+        }
+        cpuBatchTopPSampling(inputs.logits,
+                             random_seeds,
+                             random_steps.data(),
+                             ids,
+                             outputs->sequence_length,
+                             outputs->finished,
+                             outputs->cum_log_probs,
+                             outputs->output_log_probs,
+                             topp_top_ps.data(),
+                             vocab_size_padded,
+                             inputs.end_ids,
+                             batch_size,
+                             topp_skip_decode.get());
+    }
+
+    if (inputs.stop_words_list != nullptr) {
+        cpuStopWordsCriterion(outputs->output_ids,
+                              nullptr,
+                              inputs.stop_words_list,
+                              outputs->finished,
+                              0,
+                              inputs.stop_words_len,
+                              batch_size,
+                              1,
+                              step);
+    }
+    if (inputs.sequence_limit_length != nullptr) {
+        cpuLengthCriterion(
+            outputs->finished, &outputs->should_stop, inputs.sequence_limit_length, batch_size, 1, step);
+    }
+}
+
+}  // namespace fastertransformer
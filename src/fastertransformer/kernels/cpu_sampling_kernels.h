@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * CPU reference of the sampling kernels
+ *
+ * Host implementations of the kernels run by DynamicDecodeLayer for sampling: temperature and repetition penalties,
+ * bad words, top-k / top-p sampling, stop criteria and log probs. Each cpuXxx function follows the buffer layouts and
+ * semantics of the invokeXxx kernel it mirrors, so that the decode path can be tested without a GPU and small models
+ * can be served from the CPU.
+ *
+ * The sampling functions draw the same counter-based random numbers as the kernels (philoxUniform of the seed of a row
+ * and the generation step), so a row draws the same random numbers on both backends. CpuCurandState reproduces the
+ * default curandState_t (XORWOW) as seeded by invokeCurandInitialize and invokeCurandBatchInitialize, for host code
+ * drawing curand streams. The sampled ids match the GPU as long as the probabilities do: the top-k kernel normalizes with __expf and the top-p kernel scans the sorted
+ * probabilities in parallel, so results can differ when a random number falls within rounding of a bucket boundary.
+ * Equal logits are ordered by token id, which the multi-block top-k kernel does not guarantee across blocks.
+ *
+ * Only float logits and beam_width 1 sampling are supported; the stop criteria and bad words also handle beams.
+ **/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace fastertransformer {
+
+struct CpuCurandState {
+    uint32_t d;
+    uint32_t v[5];
+};
+
+void cpuCurandInitialize(CpuCurandState* states, const size_t batch_size, unsigned long long random_seed);
+
+void cpuCurandBatchInitialize(CpuCurandState*           states,
+                              const size_t              batch_size,
+                              const unsigned long long* random_seeds);
+
+// curand() and curand_uniform() of curandState_t
+uint32_t cpuCurand(CpuCurandState* state);
+float    cpuCurandUniform(CpuCurandState* state);
+
+void cpuBatchApplyTemperaturePenalty(float*       logits,
+                                     const float* bias,
+                                     const float* temperatures,
+                                     const int    batch_size,
+                                     const int    vocab_size,
+                                     const int    vocab_size_padd);
+
+void cpuBatchApplyRepetitionPenalty(float*       logits,
+                                    const float* penalties,
+                                    const int*   output_ids,
+                                    const int    batch_size,
+                                    const int    local_batch_size,
+                                    const int    vocab_size,
+                                    const int*   input_lengths,
+                                    const int    max_input_length,
+                                    const int    step);
+
+void cpuBanBadWords(float*     logits,
+                    const int* output_ids_buf,
+                    const int* parent_ids_buf,
+                    int        batch_size,
+                    int        local_batch_size,
+                    int        beam_width,
+                    const int* bad_words,
+                    bool       share_words,
+                    size_t     bad_words_len,
+                    int        id_offset,
+                    int        vocab_size_padded,
+                    size_t     step);
+
+void cpuAddBiasEndMask(
+    float* logits, const float* bias, const int* end_ids, const bool* finished, const int m, const int n);
+
+void cpuAddBiasSoftMax(float*       logits,
+                       const float* bias,
+                       const int*   end_ids,
+                       const bool*  finished,
+                       const int    m,
+                       const int    n_padded,
+                       const int    n);
+
+// log_probs are logits, or probabilities when cum_log_probs or output_log_probs is given (see TopKSamplingLayer).
+void cpuBatchTopKSampling(const float*              log_probs,
+                          const unsigned long long* random_seeds,
+                          const int*                random_steps,
+                          int*                      ids,
+                          int*                      sequence_length,
+                          bool*                     finished,
+                          float*                    cum_log_probs,
+                          float*                    output_log_probs,
+                          const int*                top_ks,
+                          const float*              top_ps,
+                          const int                 vocab_size_padded,
+                          const int*                end_ids,
+                          const int                 batch_size,
+                          const bool*               skip_decode);
+
+// probs are the output of cpuAddBiasSoftMax.
+void cpuBatchTopPSampling(const float*              probs,
+                          const unsigned long long* random_seeds,
+                          const int*                random_steps,
+                          int*                      ids,
+                          int*                      sequence_length,
+                          bool*                     finished,
+                          float*                    cum_log_probs,
+                          float*                    output_log_probs,
+                          const float*              top_ps,
+                          const int                 vocab_size_padded,
+                          const int*                end_ids,
+                          const int                 batch_size,
+                          const bool*               skip_decode);
+
+void cpuStopWordsCriterion(const int* output_ids,
+                           const int* parent_ids,
+                           const int* stop_words,
+                           bool*      finished,
+                           size_t     id_offset,
+                           size_t     stop_words_len,
+                           int        batch_size,
+                           int        beam_width,
+                           int        step);
+
+void cpuLengthCriterion(bool*           finished,
+                        bool*           should_stop,
+                        const uint32_t* sequence_limit_length,
+                        int             batch_size,
+                        int             beam_width,
+                        int             step);
+
+void cpuLogProbFromLogits(float*       cum_log_probs,
+                          const float* logits,
+                          const int*   input_ids,
+                          const int*   input_lengths,
+                          const size_t max_input_length,
+                          const size_t batch_size,
+                          const size_t vocab_size,
+                          const size_t vocab_size_padded,
+                          const bool   batch_first = false);
+
+// The n most likely tokens of each row and their log probs, in decreasing order and equal values by id. logits are
+// logits, or probabilities when is_probs. Outputs are [batch_size, max_num_top_log_probs], padded with -1 and -inf,
+// and max_num_top_log_probs is at most 32 as in invokeTopLogProbs.
+void cpuTopLogProbs(int*         top_ids,
+                    float*       top_log_probs,
+                    const float* logits,
+                    const int*   num_top_log_probs,
+                    const bool*  skip_decode,
+                    const int    max_num_top_log_probs,
+                    const int    batch_size,
+                    const int    vocab_size,
+                    const int    vocab_size_padded,
+                    const bool   is_probs);
+
+// One sampling step of DynamicDecodeLayer (beam_width 1, ite 0). Optional inputs are nullptr. random_seeds
+// [batch_size] are the seeds of the rows, drawing at their generation steps random_steps, or step - max_input_length
+// for every row when random_steps is nullptr.
+struct CpuDynamicDecodeInputs {
+    float*          logits                = nullptr;  // [batch_size, vocab_size_padded], overwritten
+    const float*    embedding_bias        = nullptr;  // [vocab_size_padded]
+    int             step                  = 0;
+    int             max_input_length      = 0;
+    const int*      input_lengths         = nullptr;  // [batch_size]
+    const int*      end_ids               = nullptr;  // [batch_size]
+    const uint32_t* runtime_top_k         = nullptr;  // [batch_size]
+    const float*    runtime_top_p         = nullptr;  // [batch_size]
+    const float*    temperature           = nullptr;  // [batch_size]
+    const float*    repetition_penalty    = nullptr;  // [batch_size]
+    const int*      bad_words_list        = nullptr;  // [2, bad_words_len], shared by the batch
+    size_t          bad_words_len         = 0;
+    const int*      stop_words_list       = nullptr;  // [batch_size, 2, stop_words_len]
+    size_t          stop_words_len        = 0;
+    const uint32_t* sequence_limit_length = nullptr;  // [batch_size]
+    const int*      num_top_log_probs     = nullptr;  // [batch_size]
+    const int*      random_steps          = nullptr;  // [batch_size]
+};
+
+struct CpuDynamicDecodeOutputs {
+    int*   output_ids       = nullptr;  // [max_seq_len, batch_size]
+    bool*  finished         = nullptr;  // [batch_size]
+    int*   sequence_length  = nullptr;  // [batch_size]
+    float* cum_log_probs    = nullptr;  // [batch_size]
+    float* output_log_probs = nullptr;  // [batch_size], log probs of the current step
+    bool   should_stop      = false;
+    // [batch_size, max_num_top_log_probs], the most likely tokens of the current step
+    int*   top_log_prob_ids      = nullptr;
+    float* top_log_probs         = nullptr;
+    int    max_num_top_log_probs = 0;
+};
+
+void cpuDynamicDecode(CpuDynamicDecodeOutputs*      outputs,
+                      const CpuDynamicDecodeInputs& inputs,
+                      const unsigned long long*     random_seeds,
+                      const int                     batch_size,
+                      const int                     vocab_size,
+                      const int                     vocab_size_padded);
+
+}  // namespace fastertransformer
@@ -66,6 +66,14 @@ struct Multihead_attention_params_base {
     // The indirections to use for cache when beam sampling.
     const int* cache_indir = nullptr;
 
+    // Paged cache: when block_table is set, k_cache and v_cache are pools of blocks of kv_block_size timesteps and
+    // timestep t of sequence bi lives in block block_table[bi * max_blocks_per_seq + t / kv_block_size]. The layouts
+    // of a block are H x Dh/x x kv_block_size x x for the Ks and H x kv_block_size x Dh for the Vs. Beams own their
+    // block tables (see KVBlockManager), so cache_indir must be null. Masked self attention only.
+    const int* block_table        = nullptr;
+    int        kv_block_size      = 0;
+    int        max_blocks_per_seq = 0;
+
     // Stride to handle the case when KQV is a single buffer
     int stride = 0;
 
@@ -758,6 +758,27 @@ inline __device__ constexpr uint32_t shfl_mask(int threads)
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
+// Offset of the 16B chunk co of the key of timestep ti in a paged cache (see params.block_table).
+template<typename T, int Dh>
+inline __device__ size_t
+paged_k_cache_offset(const Multihead_attention_params_base<T>& params, int bi, int hi, int co, int ti)
+{
+    constexpr int QK_ELTS_IN_16B = 16 / sizeof(T);
+    const int     block          = params.block_table[bi * params.max_blocks_per_seq + ti / params.kv_block_size];
+    return ((size_t)block * params.num_heads + hi) * Dh * params.kv_block_size
+           + ((size_t)co * params.kv_block_size + ti % params.kv_block_size) * QK_ELTS_IN_16B;
+}
+
+// Offset of the value of timestep ti in a paged cache (see params.block_table).
+template<typename T, int Dh>
+inline __device__ size_t paged_v_cache_offset(const Multihead_attention_params_base<T>& params, int bi, int hi, int ti)
+{
+    const int block = params.block_table[bi * params.max_blocks_per_seq + ti / params.kv_block_size];
+    return (((size_t)block * params.num_heads + hi) * params.kv_block_size + ti % params.kv_block_size) * Dh;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
 template<
     // The type of the inputs. Supported types: float and half.
     typename T,
@@ -869,6 +890,9 @@ __global__ void masked_multihead_attention_kernel(Multihead_attention_params<T,
 
     const size_t bi_seq_len_offset = bi * params.memory_max_len;
 
+    // Whether the cache is paged, see params.block_table.
+    const bool is_paged = !DO_CROSS_ATTENTION && params.block_table != nullptr;
+
     // int tlength = (DO_CROSS_ATTENTION)? params.memory_length_per_sample[bi] - 1 : params.timestep;
     int       tlength      = (DO_CROSS_ATTENTION) ? params.memory_length_per_sample[bi] - 1 :
                              (params.length_per_sample == nullptr) ?
@@ -1022,9 +1046,10 @@ __global__ void masked_multihead_attention_kernel(Multihead_attention_params<T,
         int ci = tidx % QK_VECS_IN_16B * QK_VEC_SIZE;
 
         // Two chunks are separated by L * x elements. A thread write QK_VEC_SIZE elements.
-        int offset = bhi * params.memory_max_len * Dh + co * params.memory_max_len * QK_ELTS_IN_16B +
-                     // params.timestep*QK_ELTS_IN_16B +
-                     tlength_circ * QK_ELTS_IN_16B + ci;
+        size_t offset = is_paged ? paged_k_cache_offset<T, Dh>(params, bi, hi, co, tlength_circ) + ci :
+                                   bhi * params.memory_max_len * Dh + co * params.memory_max_len * QK_ELTS_IN_16B +
+                                       // params.timestep*QK_ELTS_IN_16B +
+                                       tlength_circ * QK_ELTS_IN_16B + ci;
 
         if (handle_k) {
             // Trigger the stores to global memory.
@@ -1137,13 +1162,19 @@ __global__ void masked_multihead_attention_kernel(Multihead_attention_params<T,
         for (int ii = 0; ii < K_VECS_PER_THREAD; ++ii) {
             int jj = ii * params.memory_max_len + ti_circ;
             // if( ti < params.timestep ) {
-            const bool within_bounds = (Dh == Dh_MAX || jj * QK_ELTS_IN_16B < Dh * params.memory_max_len);
+            const bool within_bounds = (Dh == Dh_MAX
+                                        || (is_paged ? ii * QK_ELTS_IN_16B < Dh :
+                                                       jj * QK_ELTS_IN_16B < Dh * params.memory_max_len));
             if (ti < tlength) {
                 if (!within_bounds) {
                     k[ii] = k_vec_zero;
                 }
                 else {
-                    if (has_beams) {
+                    if (is_paged) {
+                        k[ii] = *reinterpret_cast<const K_vec*>(
+                            &params.k_cache[paged_k_cache_offset<T, Dh>(params, bi, hi, ii, ti_circ) + ki]);
+                    }
+                    else if (has_beams) {
                         const int beam_offset = beam_indices[ti_circ] * params.num_heads * params.memory_max_len * Dh;
                         k[ii] = *reinterpret_cast<const K_vec*>(&k_cache_batch[beam_offset + jj * QK_ELTS_IN_16B]);
                     }
@@ -1303,7 +1334,10 @@ __global__ void masked_multihead_attention_kernel(Multihead_attention_params<T,
             const int beam_src = (params.cache_indir != nullptr) ? params.cache_indir[bi_seq_len_offset + ti_circ] : 0;
             const int beam_offset = beam_src * params.num_heads * params.memory_max_len * Dh;
             // Load the values from the cache.
-            V_vec v = *reinterpret_cast<const V_vec*>(&v_cache_batch[beam_offset + ti_circ * Dh]);
+            V_vec v = is_paged ?
+                          *reinterpret_cast<const V_vec*>(
+                              &params.v_cache[paged_v_cache_offset<T, Dh>(params, bi, hi, ti_circ) + vi]) :
+                          *reinterpret_cast<const V_vec*>(&v_cache_batch[beam_offset + ti_circ * Dh]);
             if (DO_CROSS_ATTENTION && params.timestep == 0) {
                 v                                            = add(v, *reinterpret_cast<V_vec*>(&bias_smem[vi]));
                 *reinterpret_cast<V_vec*>(&v_cache[ti * Dh]) = v;
@@ -1342,7 +1376,13 @@ __global__ void masked_multihead_attention_kernel(Multihead_attention_params<T,
 
             // Store the values with bias back to global memory in the cache for V.
             //*reinterpret_cast<V_vec*>(&v_cache[params.timestep*Dh]) = v;
-            *reinterpret_cast<V_vec*>(&v_cache[tlength_circ * Dh]) = v;
+            if (is_paged) {
+                *reinterpret_cast<V_vec*>(
+                    &params.v_cache[paged_v_cache_offset<T, Dh>(params, bi, hi, tlength_circ) + vi]) = v;
+            }
+            else {
+                *reinterpret_cast<V_vec*>(&v_cache[tlength_circ * Dh]) = v;
+            }
         }
 
         // Initialize the output value with the current timestep.
@@ -621,4 +621,85 @@ void invokePlusScalar(T* buf, const T val, const int size, cudaStream_t stream)
 
 template void invokePlusScalar(int* buf, const int val, const int size, cudaStream_t stream);
 
+template<typename T, bool SCATTER>
+__global__ void gatherRows(T*           dst,
+                           const T*     src,
+                           const int*   indices,
+                           const size_t num_indices,
+                           const size_t num_rows,
+                           const size_t row_size)
+{
+    // grid: (num_indices, num_outer), the packed tensor has num_rows rows and the gathered one num_indices.
+    const size_t packed_row = (size_t)blockIdx.y * num_rows + indices[blockIdx.x];
+    const size_t group_row  = (size_t)blockIdx.y * num_indices + blockIdx.x;
+    T*           to         = dst + (SCATTER ? packed_row : group_row) * row_size;
+    const T*     from       = src + (SCATTER ? group_row : packed_row) * row_size;
+    for (size_t i = threadIdx.x; i < row_size; i += blockDim.x) {
+        to[i] = from[i];
+    }
+}
+
+template<typename T>
+void invokeGatherRows(T*           dst,
+                      const T*     src,
+                      const int*   indices,
+                      const size_t num_indices,
+                      const size_t num_outer,
+                      const size_t num_src_rows,
+                      const size_t row_size,
+                      cudaStream_t stream)
+{
+    if (num_indices == 0 || num_outer == 0) {
+        return;
+    }
+    dim3 grid(num_indices, num_outer);
+    dim3 block(min((size_t)256, row_size));
+    gatherRows<T, false><<<grid, block, 0, stream>>>(dst, src, indices, num_indices, num_src_rows, row_size);
+}
+
+template<typename T>
+void invokeScatterRows(T*           dst,
+                       const T*     src,
+                       const int*   indices,
+                       const size_t num_indices,
+                       const size_t num_outer,
+                       const size_t num_dst_rows,
+                       const size_t row_size,
+                       cudaStream_t stream)
+{
+    if (num_indices == 0 || num_outer == 0) {
+        return;
+    }
+    dim3 grid(num_indices, num_outer);
+    dim3 block(min((size_t)256, row_size));
+    gatherRows<T, true><<<grid, block, 0, stream>>>(dst, src, indices, num_indices, num_dst_rows, row_size);
+}
+
+#define INSTANTIATE_GATHER_ROWS(T)                                                                                     \
+    template void invokeGatherRows(T*           dst,                                                                   \
+                                   const T*     src,                                                                   \
+                                   const int*   indices,                                                               \
+                                   const size_t num_indices,                                                           \
+                                   const size_t num_outer,                                                             \
+                                   const size_t num_src_rows,                                                          \
+                                   const size_t row_size,                                                              \
+                                   cudaStream_t stream);                                                               \
+    template void invokeScatterRows(T*           dst,                                                                  \
+                                    const T*     src,                                                                  \
+                                    const int*   indices,                                                              \
+                                    const size_t num_indices,                                                          \
+                                    const size_t num_outer,                                                            \
+                                    const size_t num_dst_rows,                                                         \
+                                    const size_t row_size,                                                             \
+                                    cudaStream_t stream)
+INSTANTIATE_GATHER_ROWS(float);
+INSTANTIATE_GATHER_ROWS(half);
+INSTANTIATE_GATHER_ROWS(int);
+INSTANTIATE_GATHER_ROWS(uint32_t);
+INSTANTIATE_GATHER_ROWS(bool);
+#ifdef ENABLE_BF16
+INSTANTIATE_GATHER_ROWS(__nv_bfloat16);
+#endif
+#undef INSTANTIATE_GATHER_ROWS
+
 }  // namespace fastertransformer
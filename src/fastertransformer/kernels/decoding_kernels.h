@@ -114,4 +114,27 @@ void invokePlusUnfinishedSeqlen(int* sequence_lengths, const bool* finished, con
 template<typename T>
 void invokePlusScalar(T* buf, const T val, const int size, cudaStream_t stream);
 
+// Row gathers of [num_outer, num_rows, row_size] tensors, used to decode a group of a MixedDecodeBatch on its own:
+//   invokeGatherRows:  dst[o, i, :] = src[o, indices[i], :], dst having num_indices rows and src num_src_rows rows.
+//   invokeScatterRows: dst[o, indices[i], :] = src[o, i, :], other rows of dst being left untouched.
+template<typename T>
+void invokeGatherRows(T*           dst,
+                      const T*     src,
+                      const int*   indices,
+                      const size_t num_indices,
+                      const size_t num_outer,
+                      const size_t num_src_rows,
+                      const size_t row_size,
+                      cudaStream_t stream);
+
+template<typename T>
+void invokeScatterRows(T*           dst,
+                       const T*     src,
+                       const int*   indices,
+                       const size_t num_indices,
+                       const size_t num_outer,
+                       const size_t num_dst_rows,
+                       const size_t row_size,
+                       cudaStream_t stream);
+
 }  // namespace fastertransformer
@@ -803,6 +803,7 @@ __global__ void uncompact_outputs(T*         uncompact_buffer,
 {
     /* Uncompact a buffer IN of size [Compact, Stride] into OUT of size [Batch, Stride]
      * so that \forall i, OUT[i, :] = IN[batch_to_compact_idx[i], :]
+     * Rows i with a negative batch_to_compact_idx[i] are left untouched.
      */
     const int global_idx = blockIdx.x * blockDim.x + threadIdx.x;
 
@@ -813,7 +814,10 @@ __global__ void uncompact_outputs(T*         uncompact_buffer,
     const int stride_idx = global_idx % buffer_stride;
     const int batch_idx  = global_idx / buffer_stride;
 
-    const int src                = batch_to_compact_idx[batch_idx];
+    const int src = batch_to_compact_idx[batch_idx];
+    if (src < 0) {
+        return;
+    }
     uncompact_buffer[global_idx] = compact_buffer[src * buffer_stride + stride_idx];
 }
 
@@ -949,6 +953,376 @@ INSTANTIATE_INVOKE_UNCOMPACT_CACHES(float);
 INSTANTIATE_INVOKE_UNCOMPACT_CACHES(__nv_bfloat16);
 #endif
 
+template<typename T>
+__global__ void compact_rows(
+    T* compact_buffer, const T* buffer, const int* compact_to_batch, size_t compact_size, size_t stride)
+{
+    for (size_t index = blockIdx.x * blockDim.x + threadIdx.x; index < compact_size * stride;
+         index += blockDim.x * gridDim.x) {
+        const size_t row      = index / stride;
+        compact_buffer[index] = buffer[compact_to_batch[row] * stride + index % stride];
+    }
+}
+
+template<typename T>
+void invokeCompactRows(T*           compact_buffer,
+                       const T*     buffer,
+                       const int*   compact_to_batch,
+                       size_t       compact_size,
+                       size_t       stride,
+                       cudaStream_t stream)
+{
+    if (compact_size * stride == 0) {
+        return;
+    }
+    const dim3 block(512);
+    const dim3 grid(std::min((int)((compact_size * stride + block.x - 1) / block.x), 65536));
+    compact_rows<T><<<grid, block, 0, stream>>>(compact_buffer, buffer, compact_to_batch, compact_size, stride);
+}
+
+#define INSTANTIATE_INVOKE_COMPACT_ROWS(T)                                                                             \
+    template void invokeCompactRows(T*           compact_buffer,                                                       \
+                                    const T*     buffer,                                                               \
+                                    const int*   compact_to_batch,                                                     \
+                                    size_t       compact_size,                                                         \
+                                    size_t       stride,                                                               \
+                                    cudaStream_t stream)
+INSTANTIATE_INVOKE_COMPACT_ROWS(half);
+INSTANTIATE_INVOKE_COMPACT_ROWS(float);
+INSTANTIATE_INVOKE_COMPACT_ROWS(int);
+INSTANTIATE_INVOKE_COMPACT_ROWS(bool);
+#ifdef ENABLE_BF16
+INSTANTIATE_INVOKE_COMPACT_ROWS(__nv_bfloat16);
+#endif
+
+template<typename T>
+void invokeMoveCacheRows(T*           buffer,
+                         const int*   dst_rows,
+                         const int*   src_rows,
+                         size_t       num_moves,
+                         size_t       num_layer,
+                         size_t       num_rows,
+                         size_t       row_size,
+                         cudaStream_t stream)
+{
+    // a row is contiguous in each layer: one strided copy per row covers all the layers
+    const size_t layer_pitch = sizeof(T) * num_rows * row_size;
+    for (size_t i = 0; i < num_moves; i++) {
+        check_cuda_error(cudaMemcpy2DAsync(buffer + dst_rows[i] * row_size,
+                                           layer_pitch,
+                                           buffer + src_rows[i] * row_size,
+                                           layer_pitch,
+                                           sizeof(T) * row_size,
+                                           num_layer,
+                                           cudaMemcpyDeviceToDevice,
+                                           stream));
+    }
+}
+
+#define INSTANTIATE_INVOKE_MOVE_CACHE_ROWS(T)                                                                          \
+    template void invokeMoveCacheRows(T*           buffer,                                                             \
+                                      const int*   dst_rows,                                                           \
+                                      const int*   src_rows,                                                           \
+                                      size_t       num_moves,                                                          \
+                                      size_t       num_layer,                                                          \
+                                      size_t       num_rows,                                                           \
+                                      size_t       row_size,                                                           \
+                                      cudaStream_t stream)
+INSTANTIATE_INVOKE_MOVE_CACHE_ROWS(half);
+INSTANTIATE_INVOKE_MOVE_CACHE_ROWS(float);
+#ifdef ENABLE_BF16
+INSTANTIATE_INVOKE_MOVE_CACHE_ROWS(__nv_bfloat16);
+#endif
+
+template<typename T>
+__global__ void gather_prefix_kv(T*         prefix_kv,
+                                 const T**  prefix_kv_batch,
+                                 const T*   kv_pool,
+                                 const int* block_tables,
+                                 const int* prefix_lengths,
+                                 size_t     max_blocks_per_seq,
+                                 size_t     max_prefix_len,
+                                 size_t     num_layer,
+                                 size_t     first_layer,
+                                 size_t     local_num_layer,
+                                 size_t     num_heads,
+                                 size_t     block_size,
+                                 size_t     size_per_head)
+{
+    // grid: (max_prefix_len, batch_size, local_num_layer * 2 * num_heads), block: size_per_head
+    const int    token_idx = blockIdx.x;
+    const int    batch_idx = blockIdx.y;
+    const size_t layer     = blockIdx.z / (2 * num_heads);
+    const size_t kv_head   = blockIdx.z % (2 * num_heads);  // k heads, then v heads
+    const int    length    = prefix_lengths[batch_idx];
+
+    // each sequence gets max_prefix_len timesteps of room, laid out as a prefix prompt of its own length
+    T* seq_prefix_kv = prefix_kv + batch_idx * num_layer * 2 * num_heads * max_prefix_len * size_per_head;
+    if (token_idx == 0 && blockIdx.z == 0 && threadIdx.x == 0) {
+        prefix_kv_batch[batch_idx] = seq_prefix_kv;
+    }
+    if (token_idx >= length) {
+        return;
+    }
+
+    const int block = block_tables[batch_idx * max_blocks_per_seq + token_idx / block_size];
+    const T*  src   = kv_pool + (((block * local_num_layer + layer) * 2 * num_heads + kv_head) * block_size
+                               + token_idx % block_size)
+                                  * size_per_head;
+    T* dst = seq_prefix_kv + (((first_layer + layer) * 2 * num_heads + kv_head) * length + token_idx) * size_per_head;
+    for (int i = threadIdx.x; i < size_per_head; i += blockDim.x) {
+        dst[i] = src[i];
+    }
+}
+
+template<typename T>
+void invokeGatherPrefixKV(T*           prefix_kv,
+                          const T**    prefix_kv_batch,
+                          const T*     kv_pool,
+                          const int*   block_tables,
+                          const int*   prefix_lengths,
+                          size_t       batch_size,
+                          size_t       max_blocks_per_seq,
+                          size_t       max_prefix_len,
+                          size_t       num_layer,
+                          size_t       first_layer,
+                          size_t       local_num_layer,
+                          size_t       num_heads,
+                          size_t       block_size,
+                          size_t       size_per_head,
+                          cudaStream_t stream)
+{
+    if (batch_size == 0 || max_prefix_len == 0) {
+        return;
+    }
+    const dim3 grid(max_prefix_len, batch_size, local_num_layer * 2 * num_heads);
+    const dim3 block(std::min(size_per_head, (size_t)1024));
+    gather_prefix_kv<<<grid, block, 0, stream>>>(prefix_kv,
+                                                 prefix_kv_batch,
+                                                 kv_pool,
+                                                 block_tables,
+                                                 prefix_lengths,
+                                                 max_blocks_per_seq,
+                                                 max_prefix_len,
+                                                 num_layer,
+                                                 first_layer,
+                                                 local_num_layer,
+                                                 num_heads,
+                                                 block_size,
+                                                 size_per_head);
+}
+
+#define INSTANTIATE_INVOKE_GATHER_PREFIX_KV(T)                                                                         \
+    template void invokeGatherPrefixKV(T*           prefix_kv,                                                         \
+                                       const T**    prefix_kv_batch,                                                   \
+                                       const T*     kv_pool,                                                           \
+                                       const int*   block_tables,                                                      \
+                                       const int*   prefix_lengths,                                                    \
+                                       size_t       batch_size,                                                        \
+                                       size_t       max_blocks_per_seq,                                                \
+                                       size_t       max_prefix_len,                                                    \
+                                       size_t       num_layer,                                                         \
+                                       size_t       first_layer,                                                       \
+                                       size_t       local_num_layer,                                                   \
+                                       size_t       num_heads,                                                         \
+                                       size_t       block_size,                                                        \
+                                       size_t       size_per_head,                                                     \
+                                       cudaStream_t stream)
+INSTANTIATE_INVOKE_GATHER_PREFIX_KV(half);
+INSTANTIATE_INVOKE_GATHER_PREFIX_KV(float);
+#ifdef ENABLE_BF16
+INSTANTIATE_INVOKE_GATHER_PREFIX_KV(__nv_bfloat16);
+#endif
+
+template<typename T>
+__global__ void gather_prefix_kv_from_cache(T*         prefix_kv,
+                                            const T**  prefix_kv_batch,
+                                            const T*   k_cache,
+                                            const T*   v_cache,
+                                            const int* prefix_lengths,
+                                            size_t     batch_size,
+                                            size_t     max_prefix_len,
+                                            size_t     num_layer,
+                                            size_t     first_layer,
+                                            size_t     num_heads,
+                                            size_t     max_seq_len,
+                                            size_t     size_per_head)
+{
+    // grid: (max_prefix_len, batch_size, local_num_layer * 2 * num_heads), block: size_per_head
+    const int    x_size    = 16 / sizeof(T);
+    const int    token_idx = blockIdx.x;
+    const int    batch_idx = blockIdx.y;
+    const size_t layer     = blockIdx.z / (2 * num_heads);
+    const size_t kv_head   = blockIdx.z % (2 * num_heads);  // k heads, then v heads
+    const size_t head      = kv_head % num_heads;
+    const int    length    = prefix_lengths[batch_idx];
+
+    T* seq_prefix_kv = prefix_kv + batch_idx * num_layer * 2 * num_heads * max_prefix_len * size_per_head;
+    if (token_idx == 0 && blockIdx.z == 0 && threadIdx.x == 0) {
+        prefix_kv_batch[batch_idx] = seq_prefix_kv;
+    }
+    if (token_idx >= length) {
+        return;
+    }
+
+    // the K cache is [L, B, H, Dh/x, max_seq_len, x], the V cache [L, B, H, max_seq_len, Dh]
+    const size_t bhi = (layer * batch_size + batch_idx) * num_heads + head;
+    T* dst = seq_prefix_kv + (((first_layer + layer) * 2 * num_heads + kv_head) * length + token_idx) * size_per_head;
+    for (int i = threadIdx.x; i < size_per_head; i += blockDim.x) {
+        dst[i] = kv_head < num_heads ?
+                     k_cache[bhi * size_per_head * max_seq_len + (i / x_size * max_seq_len + token_idx) * x_size
+                             + i % x_size] :
+                     v_cache[(bhi * max_seq_len + token_idx) * size_per_head + i];
+    }
+}
+
+template<typename T>
+void invokeGatherPrefixKVFromCache(T*           prefix_kv,
+                                   const T**    prefix_kv_batch,
+                                   const T*     k_cache,
+                                   const T*     v_cache,
+                                   const int*   prefix_lengths,
+                                   size_t       batch_size,
+                                   size_t       max_prefix_len,
+                                   size_t       num_layer,
+                                   size_t       first_layer,
+                                   size_t       local_num_layer,
+                                   size_t       num_heads,
+                                   size_t       max_seq_len,
+                                   size_t       size_per_head,
+                                   cudaStream_t stream)
+{
+    if (batch_size == 0 || max_prefix_len == 0) {
+        return;
+    }
+    const dim3 grid(max_prefix_len, batch_size, local_num_layer * 2 * num_heads);
+    const dim3 block(std::min(size_per_head, (size_t)1024));
+    gather_prefix_kv_from_cache<<<grid, block, 0, stream>>>(prefix_kv,
+                                                            prefix_kv_batch,
+                                                            k_cache,
+                                                            v_cache,
+                                                            prefix_lengths,
+                                                            batch_size,
+                                                            max_prefix_len,
+                                                            num_layer,
+                                                            first_layer,
+                                                            num_heads,
+                                                            max_seq_len,
+                                                            size_per_head);
+}
+
+#define INSTANTIATE_INVOKE_GATHER_PREFIX_KV_FROM_CACHE(T)                                                              \
+    template void invokeGatherPrefixKVFromCache(T*           prefix_kv,                                                \
+                                                const T**    prefix_kv_batch,                                          \
+                                                const T*     k_cache,                                                  \
+                                                const T*     v_cache,                                                  \
+                                                const int*   prefix_lengths,                                           \
+                                                size_t       batch_size,                                               \
+                                                size_t       max_prefix_len,                                           \
+                                                size_t       num_layer,                                                \
+                                                size_t       first_layer,                                              \
+                                                size_t       local_num_layer,                                          \
+                                                size_t       num_heads,                                                \
+                                                size_t       max_seq_len,                                              \
+                                                size_t       size_per_head,                                            \
+                                                cudaStream_t stream)
+INSTANTIATE_INVOKE_GATHER_PREFIX_KV_FROM_CACHE(half);
+INSTANTIATE_INVOKE_GATHER_PREFIX_KV_FROM_CACHE(float);
+#ifdef ENABLE_BF16
+INSTANTIATE_INVOKE_GATHER_PREFIX_KV_FROM_CACHE(__nv_bfloat16);
+#endif
+
+template<typename T>
+__global__ void store_prefix_kv(T*         kv_pool,
+                                const T*   k_cache,
+                                const T*   v_cache,
+                                const int* blocks,
+                                const int* batch_idx,
+                                const int* start_token,
+                                size_t     local_num_layer,
+                                size_t     batch_size,
+                                size_t     num_heads,
+                                size_t     max_seq_len,
+                                size_t     block_size,
+                                size_t     size_per_head)
+{
+    // grid: (num_blocks, local_num_layer * num_heads)
+    const int    x_size = 16 / sizeof(T);
+    const size_t layer  = blockIdx.y / num_heads;
+    const size_t head   = blockIdx.y % num_heads;
+    const int    block  = blocks[blockIdx.x];
+    const size_t bhi    = (layer * batch_size + batch_idx[blockIdx.x]) * num_heads + head;
+
+    // the K cache is [L, B, H, Dh/x, max_seq_len, x], the V cache [L, B, H, max_seq_len, Dh]
+    const T* k_src = k_cache + bhi * size_per_head * max_seq_len;
+    const T* v_src = v_cache + bhi * size_per_head * max_seq_len + start_token[blockIdx.x] * size_per_head;
+    T*       k_dst = kv_pool + ((block * local_num_layer + layer) * 2 * num_heads + head) * block_size * size_per_head;
+    T*       v_dst = k_dst + num_heads * block_size * size_per_head;
+
+    for (int i = threadIdx.x; i < block_size * size_per_head; i += blockDim.x) {
+        const int token = start_token[blockIdx.x] + i / size_per_head;
+        const int d     = i % size_per_head;
+        k_dst[i]        = k_src[(d / x_size * max_seq_len + token) * x_size + d % x_size];
+        v_dst[i]        = v_src[i];
+    }
+}
+
+template<typename T>
+void invokeStorePrefixKV(T*           kv_pool,
+                         const T*     k_cache,
+                         const T*     v_cache,
+                         const int*   blocks,
+                         const int*   batch_idx,
+                         const int*   start_token,
+                         size_t       num_blocks,
+                         size_t       local_num_layer,
+                         size_t       batch_size,
+                         size_t       num_heads,
+                         size_t       max_seq_len,
+                         size_t       block_size,
+                         size_t       size_per_head,
+                         cudaStream_t stream)
+{
+    if (num_blocks == 0) {
+        return;
+    }
+    const dim3 grid(num_blocks, local_num_layer * num_heads);
+    const dim3 block(std::min(block_size * size_per_head, (size_t)512));
+    store_prefix_kv<<<grid, block, 0, stream>>>(kv_pool,
+                                                k_cache,
+                                                v_cache,
+                                                blocks,
+                                                batch_idx,
+                                                start_token,
+                                                local_num_layer,
+                                                batch_size,
+                                                num_heads,
+                                                max_seq_len,
+                                                block_size,
+                                                size_per_head);
+}
+
+#define INSTANTIATE_INVOKE_STORE_PREFIX_KV(T)                                                                          \
+    template void invokeStorePrefixKV(T*           kv_pool,                                                            \
+                                      const T*     k_cache,                                                            \
+                                      const T*     v_cache,                                                            \
+                                      const int*   blocks,                                                             \
+                                      const int*   batch_idx,                                                          \
+                                      const int*   start_token,                                                        \
+                                      size_t       num_blocks,                                                         \
+                                      size_t       local_num_layer,                                                    \
+                                      size_t       batch_size,                                                         \
+                                      size_t       num_heads,                                                          \
+                                      size_t       max_seq_len,                                                        \
+                                      size_t       block_size,                                                         \
+                                      size_t       size_per_head,                                                      \
+                                      cudaStream_t stream)
+INSTANTIATE_INVOKE_STORE_PREFIX_KV(half);
+INSTANTIATE_INVOKE_STORE_PREFIX_KV(float);
+#ifdef ENABLE_BF16
+INSTANTIATE_INVOKE_STORE_PREFIX_KV(__nv_bfloat16);
+#endif
+
 template<bool PREFIX_PROMPT>
 __global__ void update_padding_count(int*       total_padding_count,
                                      const int* input_lengths,
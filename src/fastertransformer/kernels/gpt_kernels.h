@@ -160,6 +160,8 @@ void invokeCompactInputs(T*           compact_input,
                          size_t       hidden_dimension,
                          cudaStream_t stream = 0);
 
+// The rows i with a negative batch_to_compact_idx[i] are left untouched by invokeUnCompactOutputs and
+// invokeUnCompactCaches, so a compact batch can be scattered into some rows of a larger one.
 template<typename T>
 void invokeUnCompactOutputs(T*           uncompact_buffer,
                             const T*     compact_buffer,
@@ -183,6 +185,86 @@ void invokeUnCompactCaches(T*           uncompact_k_cache,
                            size_t       ite,
                            cudaStream_t stream = 0);
 
+// Gathers the rows compact_to_batch[i] of a buffer [batch_size, stride] into compact_buffer [compact_size, stride], the
+// inverse of invokeUnCompactOutputs. Used to run the decoder on the live rows of beam search with early stopping.
+template<typename T>
+void invokeCompactRows(T*           compact_buffer,
+                       const T*     buffer,
+                       const int*   compact_to_batch,
+                       size_t       compact_size,
+                       size_t       stride,
+                       cudaStream_t stream = 0);
+
+// Moves the rows of a buffer [num_layer, num_rows, row_size] in place, row dst_rows[i] of every layer taking row
+// src_rows[i] (host arrays of num_moves rows), such as the rows of a KV cache when the live rows are compacted. The
+// moves are issued in order on the stream, so a row may be the source of a move and the destination of a later one.
+template<typename T>
+void invokeMoveCacheRows(T*           buffer,
+                         const int*   dst_rows,
+                         const int*   src_rows,
+                         size_t       num_moves,
+                         size_t       num_layer,
+                         size_t       num_rows,
+                         size_t       row_size,
+                         cudaStream_t stream = 0);
+
+// Prefix KV cache (see PrefixCache). The pool holds blocks of [local_num_layer, 2, num_heads, block_size,
+// size_per_head]. invokeGatherPrefixKV lays the first prefix_lengths[i] timesteps of the blocks of sequence i out as a
+// prefix prompt ([num_layer, 2, num_heads, prefix_lengths[i], size_per_head], max_prefix_len timesteps of room per
+// sequence) and writes its address to prefix_kv_batch[i], for the context attention to start after the prefix.
+template<typename T>
+void invokeGatherPrefixKV(T*           prefix_kv,
+                          const T**    prefix_kv_batch,
+                          const T*     kv_pool,
+                          const int*   block_tables,
+                          const int*   prefix_lengths,
+                          size_t       batch_size,
+                          size_t       max_blocks_per_seq,
+                          size_t       max_prefix_len,
+                          size_t       num_layer,
+                          size_t       first_layer,
+                          size_t       local_num_layer,
+                          size_t       num_heads,
+                          size_t       block_size,
+                          size_t       size_per_head,
+                          cudaStream_t stream = 0);
+
+// Lays the first prefix_lengths[i] timesteps of row i of the KV cache out as a prefix prompt, like
+// invokeGatherPrefixKV, for a context pass to continue the sequences (the verification pass of speculative decoding).
+template<typename T>
+void invokeGatherPrefixKVFromCache(T*           prefix_kv,
+                                   const T**    prefix_kv_batch,
+                                   const T*     k_cache,
+                                   const T*     v_cache,
+                                   const int*   prefix_lengths,
+                                   size_t       batch_size,
+                                   size_t       max_prefix_len,
+                                   size_t       num_layer,
+                                   size_t       first_layer,
+                                   size_t       local_num_layer,
+                                   size_t       num_heads,
+                                   size_t       max_seq_len,
+                                   size_t       size_per_head,
+                                   cudaStream_t stream = 0);
+
+// Copies timesteps start_token[i] .. start_token[i] + block_size of row batch_idx[i] of the KV cache into pool block
+// blocks[i], to cache them after the context phase.
+template<typename T>
+void invokeStorePrefixKV(T*           kv_pool,
+                         const T*     k_cache,
+                         const T*     v_cache,
+                         const int*   blocks,
+                         const int*   batch_idx,
+                         const int*   start_token,
+                         size_t       num_blocks,
+                         size_t       local_num_layer,
+                         size_t       batch_size,
+                         size_t       num_heads,
+                         size_t       max_seq_len,
+                         size_t       block_size,
+                         size_t       size_per_head,
+                         cudaStream_t stream = 0);
+
 void invokeUpdatePaddingCount(int*         total_padding_count,
                               const int*   input_lengths,
                               const int*   tiled_prompt_lengths,
@@ -17,6 +17,7 @@
 #include <assert.h>
 #include <cuda_fp16.h>
 #include <cuda_runtime.h>
+#include <stdexcept>
 
 #ifndef CUDART_VERSION
 #error CUDART_VERSION Undefined!
@@ -28,6 +29,7 @@
 
 #include "src/fastertransformer/kernels/logprob_kernels.h"
 #include "src/fastertransformer/kernels/reduce_kernel_utils.cuh"
+#include "src/fastertransformer/utils/cuda_utils.h"
 #include "src/fastertransformer/utils/logger.h"
 
 namespace fastertransformer {
@@ -207,4 +209,183 @@ template void invokeLogProbFromLogits(float*       cum_log_probs,
                                       const size_t workspace_size,
                                       cudaStream_t stream,
                                       const bool   batch_first);
+
+struct __align__(8) MaxSumExp {
+    float m;  // running max
+    float s;  // sum of exp(x - m)
+};
+
+__device__ __forceinline__ MaxSumExp reduce_max_sum_exp_op(const MaxSumExp& a, const MaxSumExp& b)
+{
+    const bool       a_bigger = a.m > b.m;
+    const MaxSumExp& bigger   = a_bigger ? a : b;
+    const MaxSumExp& smaller  = a_bigger ? b : a;
+    MaxSumExp        res;
+    res.m = bigger.m;
+    res.s = bigger.s + smaller.s * __expf(smaller.m - bigger.m);
+    return res;
+}
+
+template<typename T, int MAX_K, int BLOCK_SIZE>
+__global__ void top_log_probs_kernel(int*        top_ids,
+                                     float*      top_log_probs,
+                                     const T*    logits,
+                                     const int*  num_top_log_probs,
+                                     const bool* skip_decode,
+                                     const int   max_num_top_log_probs,
+                                     const int   vocab_size,
+                                     const int   vocab_size_padded,
+                                     const bool  is_probs)
+{
+    // Find the top-n tokens of a row and their log probabilities in a single pass over the vocabulary.
+    //
+    // top_ids, top_log_probs: [batch_size, max_num_top_log_probs], padded with -1 and -inf after n.
+    // logits: [batch_size, vocab_size_padded], logits or, when is_probs, probabilities.
+    // num_top_log_probs: [batch_size], n of each row, max_num_top_log_probs when nullptr.
+    //
+    // From logits, the log softmax normalizer is accumulated online along the top-n selection, so the row is read once.
+
+    typedef cub::BlockReduce<TopK<float, MAX_K>, BLOCK_SIZE> BlockReduceTopK;
+    typedef cub::BlockReduce<MaxSumExp, BLOCK_SIZE>          BlockReduceMaxSumExp;
+    __shared__ union {
+        typename BlockReduceTopK::TempStorage      topk;
+        typename BlockReduceMaxSumExp::TempStorage max_sum_exp;
+    } temp_storage;
+    __shared__ float s_log_normalizer;
+
+    const int tid = threadIdx.x;
+    const int bid = blockIdx.x;
+    if (skip_decode != nullptr && skip_decode[bid]) {
+        return;
+    }
+    const int n =
+        num_top_log_probs != nullptr ? min(num_top_log_probs[bid], max_num_top_log_probs) : max_num_top_log_probs;
+    top_ids += bid * max_num_top_log_probs;
+    top_log_probs += bid * max_num_top_log_probs;
+    for (int i = max(n, 0) + tid; i < max_num_top_log_probs; i += BLOCK_SIZE) {
+        top_ids[i]       = -1;
+        top_log_probs[i] = -INFINITY;
+    }
+    if (n <= 0) {
+        return;
+    }
+    logits += bid * vocab_size_padded;
+
+    TopK<float, MAX_K> partial;
+    partial.init();
+    MaxSumExp partial_sum{-FLT_MAX, 0.0f};
+    for (int i = tid; i < vocab_size; i += BLOCK_SIZE) {
+        const float val = static_cast<float>(logits[i]);
+        partial.insert(val, i);
+        if (!is_probs) {
+            if (val > partial_sum.m) {
+                partial_sum.s = partial_sum.s * __expf(partial_sum.m - val) + 1.0f;
+                partial_sum.m = val;
+            }
+            else {
+                partial_sum.s += __expf(val - partial_sum.m);
+            }
+        }
+    }
+
+    if (!is_probs) {
+        MaxSumExp total_sum = BlockReduceMaxSumExp(temp_storage.max_sum_exp).Reduce(partial_sum, reduce_max_sum_exp_op);
+        if (tid == 0) {
+            s_log_normalizer = total_sum.m + logf(total_sum.s);
+        }
+        __syncthreads();
+    }
+    TopK<float, MAX_K> total = BlockReduceTopK(temp_storage.topk).Reduce(partial, reduce_topk_op<float, MAX_K>);
+
+    if (tid == 0) {
+        for (int i = 0; i < n; i++) {
+            const bool valid = total.p[i] != -1;
+            top_ids[i]       = valid ? total.p[i] : -1;
+            if (!valid) {
+                top_log_probs[i] = -INFINITY;
+            }
+            else if (is_probs) {
+                top_log_probs[i] = logf(total.u[i]);
+            }
+            else {
+                top_log_probs[i] = total.u[i] - s_log_normalizer;
+            }
+        }
+    }
+}
+
+template<typename T>
+void invokeTopLogProbs(int*         top_ids,
+                       float*       top_log_probs,
+                       const T*     logits,
+                       const int*   num_top_log_probs,
+                       const bool*  skip_decode,
+                       const int    max_num_top_log_probs,
+                       const int    batch_size,
+                       const int    vocab_size,
+                       const int    vocab_size_padded,
+                       const bool   is_probs,
+                       cudaStream_t stream)
+{
+    // Top-n alternatives of the distribution a sampling layer draws from, without a softmax of its own: logits are the
+    // logits given to the sampling kernel or, when is_probs, the probabilities the sampling softmax already computed.
+    //
+    // top_ids, top_log_probs: [batch_size, max_num_top_log_probs]
+    // logits: [batch_size, vocab_size_padded]
+    // num_top_log_probs: [batch_size], optional, at most max_num_top_log_probs.
+    // skip_decode: [batch_size], optional, rows left untouched.
+
+    FT_LOG_DEBUG(__PRETTY_FUNCTION__);
+    const int block_size = 256;
+
+#define CASE_K(K_MIN, K_MAX)                                                                                           \
+    case K_MIN ... K_MAX:                                                                                              \
+        top_log_probs_kernel<T, K_MAX, block_size><<<batch_size, block_size, 0, stream>>>(top_ids,                    \
+                                                                                          top_log_probs,              \
+                                                                                          logits,                     \
+                                                                                          num_top_log_probs,          \
+                                                                                          skip_decode,                \
+                                                                                          max_num_top_log_probs,      \
+                                                                                          vocab_size,                 \
+                                                                                          vocab_size_padded,          \
+                                                                                          is_probs);                  \
+        break;
+
+    switch (max_num_top_log_probs) {
+        CASE_K(1, 1);
+        CASE_K(2, 4);
+        CASE_K(5, 8);
+        CASE_K(9, 16);
+        CASE_K(17, 32);
+        default:
+            throw std::domain_error(fmtstr("top log probs kernel supports 1<=n<=%d but got n=%d",
+                                           TOP_LOG_PROBS_MAX,
+                                           max_num_top_log_probs));
+    }
+#undef CASE_K
+}
+
+template void invokeTopLogProbs(int*         top_ids,
+                                float*       top_log_probs,
+                                const float* logits,
+                                const int*   num_top_log_probs,
+                                const bool*  skip_decode,
+                                const int    max_num_top_log_probs,
+                                const int    batch_size,
+                                const int    vocab_size,
+                                const int    vocab_size_padded,
+                                const bool   is_probs,
+                                cudaStream_t stream);
+
+template void invokeTopLogProbs(int*         top_ids,
+                                float*       top_log_probs,
+                                const half*  logits,
+                                const int*   num_top_log_probs,
+                                const bool*  skip_decode,
+                                const int    max_num_top_log_probs,
+                                const int    batch_size,
+                                const int    vocab_size,
+                                const int    vocab_size_padded,
+                                const bool   is_probs,
+                                cudaStream_t stream);
 }  // end of namespace fastertransformer
@@ -31,4 +31,20 @@ void invokeLogProbFromLogits(float*       cum_log_probs,
                              const size_t workspace_size,
                              cudaStream_t stream,
                              const bool   batch_first = false);
+
+// Largest number of alternatives invokeTopLogProbs returns per row.
+static const int TOP_LOG_PROBS_MAX = 32;
+
+template<typename T>
+void invokeTopLogProbs(int*         top_ids,
+                       float*       top_log_probs,
+                       const T*     logits,
+                       const int*   num_top_log_probs,
+                       const bool*  skip_decode,
+                       const int    max_num_top_log_probs,
+                       const int    batch_size,
+                       const int    vocab_size,
+                       const int    vocab_size_padded,
+                       const bool   is_probs,
+                       cudaStream_t stream);
 }  // namespace fastertransformer
@@ -621,4 +621,168 @@ template void invokeTopkSoftMax<half>(const half*  log_probs,
                                       const float  length_penalty,
                                       cudaStream_t stream);
 
-}  // end of namespace fastertransformer
+// One block per request: the 2 * K best of the K * K candidates (K per beam), best first, for early stopping.
+template<typename T, int MAX_K, int THREADBLOCK_SIZE>
+__launch_bounds__(THREADBLOCK_SIZE) __global__
+    void batch_topk_candidates_kernel(const int* __restrict x,
+                                      const T* __restrict y,
+                                      int* __restrict candidate_ids,
+                                      float* __restrict candidate_cum_log_probs,
+                                      const int   K,
+                                      const float diversity_rate)
+{
+    const int thread_id = threadIdx.x;
+    const int vector_id = blockIdx.x;
+    const int V         = K * K;
+
+    x += vector_id * V;
+    y += vector_id * V;
+
+    typedef cub::BlockReduce<TopK<T, 2 * MAX_K>, THREADBLOCK_SIZE> BlockReduce;
+    __shared__ typename BlockReduce::TempStorage                    temp_storage;
+
+    TopK<T, 2 * MAX_K> partial;
+    for (int i = 0; i < 2 * MAX_K; ++i) {
+        partial.p[i] = -1;
+        partial.u[i] = -FLT_MAX;
+    }
+    for (int elem_id = thread_id; elem_id < V; elem_id += THREADBLOCK_SIZE) {
+        // the diversity rate only ranks the candidates of a beam, as in batch_topk_kernel
+        partial.insert((T)((float)y[elem_id] + diversity_rate * (elem_id % K)), elem_id);
+    }
+    TopK<T, 2 * MAX_K> total = BlockReduce(temp_storage).Reduce(partial, reduce_topk_op<T, 2 * MAX_K>);
+
+    if (thread_id == 0) {
+        for (int i = 0; i < 2 * K; ++i) {
+            candidate_ids[vector_id * 2 * K + i]           = x[total.p[i]];
+            candidate_cum_log_probs[vector_id * 2 * K + i] = (float)y[total.p[i]];
+        }
+    }
+}
+
+template<typename T, int MAX_K>
+void topK_softMax_candidates_kernelLauncher(const T*     log_probs,
+                                            const T*     bias,
+                                            const bool*  finished,
+                                            const float* cum_log_probs,
+                                            int*         candidate_ids,
+                                            float*       candidate_cum_log_probs,
+                                            void*        temp_storage,
+                                            const int    temp_storage_size,
+                                            const int    batch_size,
+                                            const int    beam_width,
+                                            const int    vocab_size,
+                                            const int*   end_ids,
+                                            const float  diversity_rate,
+                                            cudaStream_t stream)
+{
+    const int items_per_thread = 1;
+    const int block_sz         = (MAX_K < 16) ? (MAX_K < 8) ? SMALL_TOP_K_SOFTMAX_THREADBLOCK_SIZE : 128 : 64;
+
+    assert(temp_storage_size >= 2 * batch_size * beam_width * beam_width);
+
+    const int topk_buf_offset  = ceil(batch_size * beam_width * beam_width / 4.) * 4;
+    int*      topk_tmp_id_buf  = reinterpret_cast<int*>(temp_storage);
+    T*        topk_tmp_val_buf = reinterpret_cast<T*>(topk_tmp_id_buf + topk_buf_offset);
+    float*    tmp_buffer       = reinterpret_cast<float*>(topk_tmp_val_buf + topk_buf_offset);
+
+    // the beam_width best candidates of each beam, as in topK_softMax_kernelLauncher
+#ifdef DO_SPLIT_SMALL_TOP_K_SOFTMAX
+    int voc_parts = 4;
+    if (batch_size * beam_width < 256) {
+        voc_parts = (240 + batch_size * beam_width - 1) / (batch_size * beam_width);
+        voc_parts = std::min(128, voc_parts);
+    }
+    dim3 grid(batch_size * beam_width, voc_parts);
+    cudaFuncSetAttribute(beam_online_softmax_topk_stage1_kernel<T, items_per_thread, MAX_K, block_sz>,
+                         cudaFuncAttributePreferredSharedMemoryCarveout,
+                         cudaSharedmemCarveoutMaxL1);
+    beam_online_softmax_topk_stage1_kernel<T, items_per_thread, MAX_K, block_sz>
+        <<<grid, block_sz, 0, stream>>>(log_probs, bias, finished, tmp_buffer, vocab_size, beam_width, end_ids);
+    beam_online_softmax_topk_stage2_kernelLauncher<T, MAX_K>(
+        tmp_buffer, cum_log_probs, topk_tmp_id_buf, topk_tmp_val_buf, batch_size, beam_width, voc_parts, stream);
+#else
+    beam_online_softmax_topk_kernel<T, items_per_thread, MAX_K, block_sz>
+        <<<batch_size * beam_width, block_sz, 0, stream>>>(log_probs,
+                                                           bias,
+                                                           cum_log_probs,
+                                                           finished,
+                                                           topk_tmp_id_buf,
+                                                           topk_tmp_val_buf,
+                                                           vocab_size,
+                                                           beam_width,
+                                                           end_ids);
+#endif
+    batch_topk_candidates_kernel<T, MAX_K, 32><<<batch_size, 32, 0, stream>>>(
+        topk_tmp_id_buf, topk_tmp_val_buf, candidate_ids, candidate_cum_log_probs, beam_width, diversity_rate);
+}
+
+#define CASE_K(K, MAX_K)                                                                                               \
+    case K:                                                                                                            \
+        topK_softMax_candidates_kernelLauncher<T, MAX_K>(log_probs,                                                    \
+                                                         bias,                                                         \
+                                                         finished,                                                     \
+                                                         cum_log_probs,                                                \
+                                                         candidate_ids,                                                \
+                                                         candidate_cum_log_probs,                                      \
+                                                         temp_storage,                                                 \
+                                                         temp_storage_size,                                            \
+                                                         batch_size,                                                   \
+                                                         beam_width,                                                   \
+                                                         vocab_size,                                                   \
+                                                         end_ids,                                                      \
+                                                         diversity_rate,                                               \
+                                                         stream);                                                      \
+        break;
+
+template<typename T>
+void invokeTopkSoftMaxCandidates(const T*     log_probs,
+                                 const T*     bias,
+                                 const bool*  finished,
+                                 const float* cum_log_probs,
+                                 int*         candidate_ids,
+                                 float*       candidate_cum_log_probs,
+                                 void*        temp_storage,
+                                 const int    temp_storage_size,
+                                 const int    batch_size,
+                                 const int    beam_width,
+                                 const int    vocab_size,
+                                 const int*   end_ids,
+                                 const float  diversity_rate,
+                                 cudaStream_t stream)
+{
+    switch (beam_width) {
+        CASE_K(2, 2);
+        CASE_K(3, 3);
+        CASE_K(4, 4);
+        CASE_K(8, 8);
+        default:
+            throw std::runtime_error(
+                fmtstr("Topk kernel does not support early stopping with beam_width=%d", beam_width));
+    }
+}
+
+#undef CASE_K
+
+#define INSTANTIATE_TOPK_SOFTMAX_CANDIDATES(T)                                                                         \
+    template void invokeTopkSoftMaxCandidates<T>(const T*     log_probs,                                               \
+                                                 const T*     bias,                                                    \
+                                                 const bool*  finished,                                                \
+                                                 const float* cum_log_probs,                                           \
+                                                 int*         candidate_ids,                                           \
+                                                 float*       candidate_cum_log_probs,                                 \
+                                                 void*        temp_storage,                                            \
+                                                 const int    temp_storage_size,                                       \
+                                                 const int    batch_size,                                              \
+                                                 const int    beam_width,                                              \
+                                                 const int    vocab_size,                                              \
+                                                 const int*   end_ids,                                                 \
+                                                 const float  diversity_rate,                                          \
+                                                 cudaStream_t stream)
+
+INSTANTIATE_TOPK_SOFTMAX_CANDIDATES(float);
+INSTANTIATE_TOPK_SOFTMAX_CANDIDATES(half);
+
+#undef INSTANTIATE_TOPK_SOFTMAX_CANDIDATES
+
+}  // namespace fastertransformer
@@ -35,4 +35,23 @@ void invokeTopkSoftMax(const T*     log_probs,
                        const float  length_penalty,
                        cudaStream_t stream);
 
+// Candidates of beam search with early stopping, see invokeUpdateBeamHypotheses: the 2 * beam_width best of the
+// beam_width best tokens of each beam, [batch_size, 2 * beam_width] best first. Unlike invokeTopkSoftMax, the beam
+// states are not updated.
+template<typename T>
+void invokeTopkSoftMaxCandidates(const T*     log_probs,
+                                 const T*     bias,
+                                 const bool*  finished,
+                                 const float* cum_log_probs,
+                                 int*         candidate_ids,
+                                 float*       candidate_cum_log_probs,
+                                 void*        temp_storage,
+                                 const int    temp_storage_size,
+                                 const int    batch_size,
+                                 const int    beam_width,
+                                 const int    vocab_size,
+                                 const int*   end_ids,
+                                 const float  diversity_rate,
+                                 cudaStream_t stream);
+
 }  // namespace fastertransformer
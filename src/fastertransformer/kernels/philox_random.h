@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * Counter-based random numbers of the sampling kernels
+ *
+ * Philox4x32-10 (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3", SC 2011) maps a 128-bit counter and a
+ * 64-bit key to 128 random bits, without any state. The sampling kernels key it with the seed of a request and count
+ * the generation steps of the request, so the random number a request draws at a step neither depends on its slot in
+ * the batch, nor on the other requests, nor on when it joined the batch. No per-slot state has to be initialized or
+ * kept across steps either.
+ *
+ * The functions are shared by the kernels and their CPU reference, which draw bit-identical numbers.
+ **/
+
+#pragma once
+
+#include <cstdint>
+#include <cuda_runtime.h>
+
+namespace fastertransformer {
+
+struct PhiloxValue {
+    uint32_t x[4];
+};
+
+__host__ __device__ inline void philoxMulHiLo(uint32_t a, uint32_t b, uint32_t* hi, uint32_t* lo)
+{
+    const uint64_t product = (uint64_t)a * (uint64_t)b;
+    *hi                    = (uint32_t)(product >> 32);
+    *lo                    = (uint32_t)product;
+}
+
+// Philox4x32-10 of counter (c0, c1, c2, c3) under key (k0, k1).
+__host__ __device__ inline PhiloxValue
+philox4x32(uint32_t c0, uint32_t c1, uint32_t c2, uint32_t c3, uint32_t k0, uint32_t k1)
+{
+    const uint32_t kMul0  = 0xD2511F53;
+    const uint32_t kMul1  = 0xCD9E8D57;
+    const uint32_t kWeyl0 = 0x9E3779B9;
+    const uint32_t kWeyl1 = 0xBB67AE85;
+    PhiloxValue    value  = {{c0, c1, c2, c3}};
+    for (int round = 0; round < 10; round++) {
+        uint32_t hi0, lo0, hi1, lo1;
+        philoxMulHiLo(kMul0, value.x[0], &hi0, &lo0);
+        philoxMulHiLo(kMul1, value.x[2], &hi1, &lo1);
+        value.x[0] = hi1 ^ value.x[1] ^ k0;
+        value.x[1] = lo1;
+        value.x[2] = hi0 ^ value.x[3] ^ k1;
+        value.x[3] = lo0;
+        k0 += kWeyl0;
+        k1 += kWeyl1;
+    }
+    return value;
+}
+
+// The random bits of a request at a generation step: the seed is the key, the step the counter.
+__host__ __device__ inline uint32_t philoxRandom(unsigned long long seed, uint32_t step)
+{
+    return philox4x32(step, 0, 0, 0, (uint32_t)seed, (uint32_t)(seed >> 32)).x[0];
+}
+
+// Uniform in (0, 1], as curand_uniform.
+__host__ __device__ inline float philoxUniform(unsigned long long seed, uint32_t step)
+{
+    const float kTwoPow32Inv = 2.3283064e-10f;
+    return philoxRandom(seed, step) * kTwoPow32Inv + kTwoPow32Inv / 2.0f;
+}
+
+}  // namespace fastertransformer
@@ -422,4 +422,140 @@ template void invokeBatchApplyRepetitionPenalty(half*        logits,
                                                 const int    step,
                                                 cudaStream_t stream);
 
+__global__ void updateTokenCounts(int*       token_counts,
+                                  bool*      prompt_tokens,
+                                  const int* output_ids,
+                                  const int  batch_size,
+                                  const int  vocab_size_padd,
+                                  const int* input_lengths,
+                                  const int  max_input_length,
+                                  const int  start_step,
+                                  const int  step)
+{
+    const int batch_idx    = blockIdx.x;
+    const int input_length = input_lengths != nullptr ? input_lengths[batch_idx] : max_input_length;
+
+    token_counts += batch_idx * vocab_size_padd;
+    prompt_tokens += batch_idx * vocab_size_padd;
+    for (int index = start_step + threadIdx.x; index < step; index += blockDim.x) {
+        // Skip the padding tokens in input sequences.
+        if (index >= input_length && index < max_input_length) {
+            continue;
+        }
+        const int token = output_ids[index * batch_size + batch_idx];
+        assert(token < vocab_size_padd);
+        if (index < max_input_length) {
+            prompt_tokens[token] = true;
+        }
+        else {
+            atomicAdd(token_counts + token, 1);
+        }
+    }
+}
+
+void invokeUpdateTokenCounts(int*         token_counts,
+                             bool*        prompt_tokens,
+                             const int*   output_ids,
+                             const int    batch_size,
+                             const int    local_batch_size,
+                             const int    vocab_size_padd,
+                             const int*   input_lengths,
+                             const int    max_input_length,
+                             const int    start_step,
+                             const int    step,
+                             cudaStream_t stream)
+{
+    if (step <= start_step) {
+        return;
+    }
+    dim3 block(min(step - start_step, 1024));
+    dim3 grid(local_batch_size);
+    updateTokenCounts<<<grid, block, 0, stream>>>(token_counts,
+                                                  prompt_tokens,
+                                                  output_ids,
+                                                  batch_size,
+                                                  vocab_size_padd,
+                                                  input_lengths,
+                                                  max_input_length,
+                                                  start_step,
+                                                  step);
+}
+
+template<typename T>
+__global__ void batchApplyTokenCountPenalty(T*           logits,
+                                            const int*   token_counts,
+                                            const bool*  prompt_tokens,
+                                            const float* repetition_penalties,
+                                            const float* presence_penalties,
+                                            const float* frequency_penalties,
+                                            const int    batch_size,
+                                            const int    vocab_size,
+                                            const int    vocab_size_padd)
+{
+    for (int index = blockIdx.x * blockDim.x + threadIdx.x; index < batch_size * vocab_size_padd;
+         index += blockDim.x * gridDim.x) {
+        const int vocab_idx = index % vocab_size_padd;
+        const int count     = token_counts[index];
+        if (vocab_idx >= vocab_size || (count == 0 && !prompt_tokens[index])) {
+            continue;
+        }
+        // every token is penalized once from its original value, as in batchApplyRepetitionPenalty
+        const int   batch_idx = index / vocab_size_padd;
+        const float penalty   = repetition_penalties[batch_idx];
+        float       logit     = (float)logits[index];
+        logit                 = logit < 0.0f ? logit * penalty : logit / penalty;
+        if (count > 0) {
+            logit -= presence_penalties[batch_idx] + frequency_penalties[batch_idx] * count;
+        }
+        logits[index] = (T)logit;
+    }
+}
+
+template<typename T>
+void invokeBatchApplyTokenCountPenalty(T*           logits,
+                                       const int*   token_counts,
+                                       const bool*  prompt_tokens,
+                                       const float* repetition_penalties,
+                                       const float* presence_penalties,
+                                       const float* frequency_penalties,
+                                       const int    local_batch_size,
+                                       const int    vocab_size,
+                                       const int    vocab_size_padd,
+                                       cudaStream_t stream)
+{
+    dim3 block(min(vocab_size_padd, 1024));
+    dim3 grid(min(local_batch_size * vocab_size_padd / block.x, 65536));
+    batchApplyTokenCountPenalty<T><<<grid, block, 0, stream>>>(logits,
+                                                               token_counts,
+                                                               prompt_tokens,
+                                                               repetition_penalties,
+                                                               presence_penalties,
+                                                               frequency_penalties,
+                                                               local_batch_size,
+                                                               vocab_size,
+                                                               vocab_size_padd);
+}
+
+template void invokeBatchApplyTokenCountPenalty(float*       logits,
+                                                const int*   token_counts,
+                                                const bool*  prompt_tokens,
+                                                const float* repetition_penalties,
+                                                const float* presence_penalties,
+                                                const float* frequency_penalties,
+                                                const int    local_batch_size,
+                                                const int    vocab_size,
+                                                const int    vocab_size_padd,
+                                                cudaStream_t stream);
+
+template void invokeBatchApplyTokenCountPenalty(half*        logits,
+                                                const int*   token_counts,
+                                                const bool*  prompt_tokens,
+                                                const float* repetition_penalties,
+                                                const float* presence_penalties,
+                                                const float* frequency_penalties,
+                                                const int    local_batch_size,
+                                                const int    vocab_size,
+                                                const int    vocab_size_padd,
+                                                cudaStream_t stream);
+
 }  // namespace fastertransformer
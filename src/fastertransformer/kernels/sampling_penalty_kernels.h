@@ -47,6 +47,39 @@ void invokeBatchApplyRepetitionPenalty(T*           logits,
                                        const int    step,
                                        cudaStream_t stream);
 
+// Token count table of the penalties: for every sequence, token_counts [local_batch_size, vocab_size_padd] holds the
+// number of times each token was generated and prompt_tokens [local_batch_size, vocab_size_padd] whether it is in the
+// prompt. invokeUpdateTokenCounts adds the positions [start_step, step) of output_ids [step, batch_size] (with offset
+// ite * local_batch_size), so that a table is updated by the one new token of every step instead of rescanning the
+// history. Positions below max_input_length are the prompt, and its padding [input_length, max_input_length) is
+// skipped.
+void invokeUpdateTokenCounts(int*         token_counts,
+                             bool*        prompt_tokens,
+                             const int*   output_ids,
+                             const int    batch_size,
+                             const int    local_batch_size,
+                             const int    vocab_size_padd,
+                             const int*   input_lengths,
+                             const int    max_input_length,
+                             const int    start_step,
+                             const int    step,
+                             cudaStream_t stream);
+
+// Applies, from the token count table, the repetition penalty of invokeBatchApplyRepetitionPenalty to the tokens of
+// the prompt or generated, then the OpenAI style presence and frequency penalties to the generated tokens:
+// logit -= presence_penalty * (count > 0) + frequency_penalty * count. The penalties are [local_batch_size].
+template<typename T>
+void invokeBatchApplyTokenCountPenalty(T*           logits,
+                                       const int*   token_counts,
+                                       const bool*  prompt_tokens,
+                                       const float* repetition_penalties,
+                                       const float* presence_penalties,
+                                       const float* frequency_penalties,
+                                       const int    local_batch_size,
+                                       const int    vocab_size,
+                                       const int    vocab_size_padd,
+                                       cudaStream_t stream);
+
 template<typename T>
 void invokeApplyTemperaturePenalty(T*           logits,
                                    const T*     bias,
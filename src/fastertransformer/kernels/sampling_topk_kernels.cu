@@ -24,6 +24,7 @@
 #include "3rdparty/cub/cub.cuh"
 #endif
 
+#include "src/fastertransformer/kernels/philox_random.h"
 #include "src/fastertransformer/kernels/reduce_kernel_utils.cuh"
 #include "src/fastertransformer/kernels/sampling_topk_kernels.h"
 
@@ -187,21 +188,22 @@ __global__ void topk_stage1(const T* __restrict log_probs,
 }
 
 template<typename T, int BLOCK_SIZE_, int BLOCKS_PER_BEAM_>
-__global__ void topk_stage2_sampling(const int* __restrict topk_tmp_id_buf,
-                                     T*             topk_tmp_val_buf,
-                                     int*           ids,
-                                     int*           sequence_length,
-                                     bool*          finished,
-                                     float*         cum_log_probs,
-                                     float*         output_log_probs,
-                                     const int      max_top_k,
-                                     const int*     top_ks,
-                                     const float    top_p,
-                                     const float*   top_ps,
-                                     curandState_t* curandstate,
-                                     const int*     end_ids,
-                                     const int      vocab_size,
-                                     const bool*    skip_decode)
+__global__ void topk_stage2_sampling(const int* __restrict     topk_tmp_id_buf,
+                                     T*                        topk_tmp_val_buf,
+                                     int*                      ids,
+                                     int*                      sequence_length,
+                                     bool*                     finished,
+                                     float*                    cum_log_probs,
+                                     float*                    output_log_probs,
+                                     const int                 max_top_k,
+                                     const int*                top_ks,
+                                     const float               top_p,
+                                     const float*              top_ps,
+                                     const unsigned long long* random_seeds,
+                                     const int*                random_steps,
+                                     const int*                end_ids,
+                                     const int                 vocab_size,
+                                     const bool*               skip_decode)
 {
     const bool IS_FP16   = std::is_same<T, half>::value;
     const T    MAX_T_VAL = (IS_FP16) ? HALF_FLT_MAX : FLT_MAX;
@@ -264,7 +266,7 @@ __global__ void topk_stage2_sampling(const int* __restrict topk_tmp_id_buf,
     }
 
     if (tid == 0) {
-        rand_num = (float)curand_uniform(curandstate + blockIdx.x) * prob_threshold * s_sum;
+        rand_num = philoxUniform(random_seeds[batch_id], random_steps[batch_id]) * prob_threshold * s_sum;
         for (int i = 0; i < k; i++) {
             float exp_logit = s_val2[i];
             rand_num        = rand_num - exp_logit;
@@ -320,31 +322,33 @@ __global__ void topk_stage2_sampling(const int* __restrict topk_tmp_id_buf,
                                                                                                  top_ks,               \
                                                                                                  top_p,                \
                                                                                                  top_ps,               \
-                                                                                                 curandstate,          \
+                                                                                                 random_seeds,         \
+                                                                                                 random_steps,         \
                                                                                                  end_ids,              \
                                                                                                  vocab_size,           \
                                                                                                  skip_decode);         \
         break;
 
 template<typename T>
-void invokeBatchTopKSampling(void*          workspace,
-                             size_t&        workspace_size,
-                             const T*       log_probs,
-                             int*           ids,
-                             int*           sequence_length,
-                             bool*          finished,
-                             float*         cum_log_probs,
-                             float*         output_log_probs,
-                             curandState_t* curandstate,
-                             const int      max_top_k,
-                             const int*     top_ks,
-                             const float    top_p,
-                             const float*   top_ps,
-                             const int      vocab_size_padded,
-                             const int*     end_ids,
-                             cudaStream_t   stream,
-                             const int      batch_size,
-                             const bool*    skip_decode)
+void invokeBatchTopKSampling(void*                     workspace,
+                             size_t&                   workspace_size,
+                             const T*                  log_probs,
+                             int*                      ids,
+                             int*                      sequence_length,
+                             bool*                     finished,
+                             float*                    cum_log_probs,
+                             float*                    output_log_probs,
+                             const unsigned long long* random_seeds,
+                             const int*                random_steps,
+                             const int                 max_top_k,
+                             const int*                top_ks,
+                             const float               top_p,
+                             const float*              top_ps,
+                             const int                 vocab_size_padded,
+                             const int*                end_ids,
+                             cudaStream_t              stream,
+                             const int                 batch_size,
+                             const bool*               skip_decode)
 {
     // Not allow an ambiguous inputs top_p and top_ps.
     assert(top_p == 1.0f || top_ps == nullptr);
@@ -381,61 +385,64 @@ void invokeBatchTopKSampling(void*          workspace,
 
 #undef CASE_K
 
-template void invokeBatchTopKSampling(void*          workspace,
-                                      size_t&        workspace_size,
-                                      const float*   log_probs,
-                                      int*           ids,
-                                      int*           sequence_length,
-                                      bool*          finished_buf,
-                                      float*         cum_log_probs,
-                                      float*         output_log_probs,
-                                      curandState_t* curandstate,
-                                      const int      max_top_k,
-                                      const int*     top_ks,
-                                      const float    top_p,
-                                      const float*   top_ps,
-                                      const int      vocab_size_padded,
-                                      const int*     end_ids,
-                                      cudaStream_t   stream,
-                                      const int      batch_size,
-                                      const bool*    skip_decode);
-
-template void invokeBatchTopKSampling(void*          workspace,
-                                      size_t&        workspace_size,
-                                      const half*    log_probs,
-                                      int*           ids,
-                                      int*           sequence_length,
-                                      bool*          finished_buf,
-                                      float*         cum_log_probs,
-                                      float*         output_log_probs,
-                                      curandState_t* curandstate,
-                                      const int      max_top_k,
-                                      const int*     top_ks,
-                                      const float    top_p,
-                                      const float*   top_ps,
-                                      const int      vocab_size_padded,
-                                      const int*     end_ids,
-                                      cudaStream_t   stream,
-                                      const int      batch_size,
-                                      const bool*    skip_decode);
+template void invokeBatchTopKSampling(void*                     workspace,
+                                      size_t&                   workspace_size,
+                                      const float*              log_probs,
+                                      int*                      ids,
+                                      int*                      sequence_length,
+                                      bool*                     finished_buf,
+                                      float*                    cum_log_probs,
+                                      float*                    output_log_probs,
+                                      const unsigned long long* random_seeds,
+                                      const int*                random_steps,
+                                      const int                 max_top_k,
+                                      const int*                top_ks,
+                                      const float               top_p,
+                                      const float*              top_ps,
+                                      const int                 vocab_size_padded,
+                                      const int*                end_ids,
+                                      cudaStream_t              stream,
+                                      const int                 batch_size,
+                                      const bool*               skip_decode);
+
+template void invokeBatchTopKSampling(void*                     workspace,
+                                      size_t&                   workspace_size,
+                                      const half*               log_probs,
+                                      int*                      ids,
+                                      int*                      sequence_length,
+                                      bool*                     finished_buf,
+                                      float*                    cum_log_probs,
+                                      float*                    output_log_probs,
+                                      const unsigned long long* random_seeds,
+                                      const int*                random_steps,
+                                      const int                 max_top_k,
+                                      const int*                top_ks,
+                                      const float               top_p,
+                                      const float*              top_ps,
+                                      const int                 vocab_size_padded,
+                                      const int*                end_ids,
+                                      cudaStream_t              stream,
+                                      const int                 batch_size,
+                                      const bool*               skip_decode);
 
 template<typename T>
-void invokeTopKSampling(void*          workspace,
-                        size_t&        workspace_size,
-                        const T*       log_probs,
-                        int*           ids,
-                        int*           sequence_length,
-                        bool*          finished_buf,
-                        float*         cum_log_probs,
-                        float*         output_log_probs,
-                        curandState_t* curandstate,
-                        const int      top_k,
-                        const float    top_p,
-                        const int      vocab_size_padded,
-                        const int*     end_ids,
-                        cudaStream_t   stream,
-                        const int      batch_size,
-                        const bool*    skip_decode)
+void invokeTopKSampling(void*                     workspace,
+                        size_t&                   workspace_size,
+                        const T*                  log_probs,
+                        int*                      ids,
+                        int*                      sequence_length,
+                        bool*                     finished_buf,
+                        float*                    cum_log_probs,
+                        float*                    output_log_probs,
+                        const unsigned long long* random_seeds,
+                        const int*                random_steps,
+                        const int                 top_k,
+                        const float               top_p,
+                        const int                 vocab_size_padded,
+                        const int*                end_ids,
+                        cudaStream_t              stream,
+                        const int                 batch_size,
+                        const bool*               skip_decode)
 {
     invokeBatchTopKSampling(workspace,
                             workspace_size,
@@ -445,7 +452,8 @@ void invokeTopKSampling(void*          workspace,
                             finished_buf,
                             cum_log_probs,
                             output_log_probs,
-                            curandstate,
+                            random_seeds,
+                            random_steps,
                             top_k,
                             nullptr,
                             top_p,
@@ -457,56 +465,59 @@ void invokeTopKSampling(void*          workspace,
                             skip_decode);
 }
 
-template void invokeTopKSampling(void*          workspace,
-                                 size_t&        workspace_size,
-                                 const float*   log_probs,
-                                 int*           ids,
-                                 int*           sequence_length,
-                                 bool*          finished_buf,
-                                 float*         cum_log_probs,
-                                 float*         output_log_probs,
-                                 curandState_t* curandstate,
-                                 const int      top_k,
-                                 const float    top_p,
-                                 const int      vocab_size_padded,
-                                 const int*     end_ids,
-                                 cudaStream_t   stream,
-                                 const int      batch_size,
-                                 const bool*    skip_decode);
-
-template void invokeTopKSampling(void*          workspace,
-                                 size_t&        workspace_size,
-                                 const half*    log_probs,
-                                 int*           ids,
-                                 int*           sequence_length,
-                                 bool*          finished_buf,
-                                 float*         cum_log_probs,
-                                 float*         output_log_probs,
-                                 curandState_t* curandstate,
-                                 const int      top_k,
-                                 const float    top_p,
-                                 const int      vocab_size_padded,
-                                 const int*     end_ids,
-                                 cudaStream_t   stream,
-                                 const int      batch_size,
-                                 const bool*    skip_decode);
+template void invokeTopKSampling(void*                     workspace,
+                                 size_t&                   workspace_size,
+                                 const float*              log_probs,
+                                 int*                      ids,
+                                 int*                      sequence_length,
+                                 bool*                     finished_buf,
+                                 float*                    cum_log_probs,
+                                 float*                    output_log_probs,
+                                 const unsigned long long* random_seeds,
+                                 const int*                random_steps,
+                                 const int                 top_k,
+                                 const float               top_p,
+                                 const int                 vocab_size_padded,
+                                 const int*                end_ids,
+                                 cudaStream_t              stream,
+                                 const int                 batch_size,
+                                 const bool*               skip_decode);
+
+template void invokeTopKSampling(void*                     workspace,
+                                 size_t&                   workspace_size,
+                                 const half*               log_probs,
+                                 int*                      ids,
+                                 int*                      sequence_length,
+                                 bool*                     finished_buf,
+                                 float*                    cum_log_probs,
+                                 float*                    output_log_probs,
+                                 const unsigned long long* random_seeds,
+                                 const int*                random_steps,
+                                 const int                 top_k,
+                                 const float               top_p,
+                                 const int                 vocab_size_padded,
+                                 const int*                end_ids,
+                                 cudaStream_t              stream,
+                                 const int                 batch_size,
+                                 const bool*               skip_decode);
 
 template<typename T>
-void invokeTopKTopPSampling(void*          workspace,
-                            size_t&        workspace_size,
-                            int*           output_ids,
-                            const T*       logits,
-                            int*           sequence_length,
-                            bool*          finished_buf,
-                            float*         cum_log_probs,
-                            float*         output_log_probs,
-                            curandState_t* curandstate,
-                            const int      batch_size,
-                            const int      top_k,
-                            const float    top_p,
-                            const int      vocab_size_padded,
-                            const int*     end_ids,
-                            cudaStream_t   stream)
+void invokeTopKTopPSampling(void*                     workspace,
+                            size_t&                   workspace_size,
+                            int*                      output_ids,
+                            const T*                  logits,
+                            int*                      sequence_length,
+                            bool*                     finished_buf,
+                            float*                    cum_log_probs,
+                            float*                    output_log_probs,
+                            const unsigned long long* random_seeds,
+                            const int*                random_steps,
+                            const int                 batch_size,
+                            const int                 top_k,
+                            const float               top_p,
+                            const int                 vocab_size_padded,
+                            const int*                end_ids,
+                            cudaStream_t              stream)
 {
     // invokeTopKTopPSampling will be deprecated. Please use invokeTopKSampling instead.
     invokeTopKSampling(workspace,
@@ -517,7 +528,8 @@ void invokeTopKTopPSampling(void*          workspace,
                        finished_buf,
                        cum_log_probs,
                        output_log_probs,
-                       curandstate,
+                       random_seeds,
+                       random_steps,
                        top_k,
                        top_p,
                        vocab_size_padded,
@@ -527,36 +539,38 @@ void invokeTopKTopPSampling(void*          workspace,
                        nullptr);
 }
 
-template void invokeTopKTopPSampling(void*          workspace,
-                                     size_t&        workspace_size,
-                                     int*           output_ids,
-                                     const float*   logits,
-                                     int*           sequence_length,
-                                     bool*          finished_buf,
-                                     float*         cum_log_probs,
-                                     float*         output_log_probs,
-                                     curandState_t* curandstate,
-                                     const int      batch_size,
-                                     const int      top_k,
-                                     const float    top_p,
-                                     const int      vocab_size_padded,
-                                     const int*     end_ids,
-                                     cudaStream_t   stream);
-
-template void invokeTopKTopPSampling(void*          workspace,
-                                     size_t&        workspace_size,
-                                     int*           output_ids,
-                                     const half*    logits,
-                                     int*           sequence_length,
-                                     bool*          finished_buf,
-                                     float*         cum_log_probs,
-                                     float*         output_log_probs,
-                                     curandState_t* curandstate,
-                                     const int      batch_size,
-                                     const int      top_k,
-                                     const float    top_p,
-                                     const int      vocab_size_padded,
-                                     const int*     end_ids,
-                                     cudaStream_t   stream);
+template void invokeTopKTopPSampling(void*                     workspace,
+                                     size_t&                   workspace_size,
+                                     int*                      output_ids,
+                                     const float*              logits,
+                                     int*                      sequence_length,
+                                     bool*                     finished_buf,
+                                     float*                    cum_log_probs,
+                                     float*                    output_log_probs,
+                                     const unsigned long long* random_seeds,
+                                     const int*                random_steps,
+                                     const int                 batch_size,
+                                     const int                 top_k,
+                                     const float               top_p,
+                                     const int                 vocab_size_padded,
+                                     const int*                end_ids,
+                                     cudaStream_t              stream);
+
+template void invokeTopKTopPSampling(void*                     workspace,
+                                     size_t&                   workspace_size,
+                                     int*                      output_ids,
+                                     const half*               logits,
+                                     int*                      sequence_length,
+                                     bool*                     finished_buf,
+                                     float*                    cum_log_probs,
+                                     float*                    output_log_probs,
+                                     const unsigned long long* random_seeds,
+                                     const int*                random_steps,
+                                     const int                 batch_size,
+                                     const int                 top_k,
+                                     const float               top_p,
+                                     const int                 vocab_size_padded,
+                                     const int*                end_ids,
+                                     cudaStream_t              stream);
 
 }  // namespace fastertransformer
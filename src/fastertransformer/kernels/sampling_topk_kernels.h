@@ -20,43 +20,49 @@
 #include <curand_kernel.h>
 namespace fastertransformer {
 
+// The sampling kernels draw one random number per row: philoxUniform(random_seeds[row], random_steps[row]), see
+// philox_random.h. random_seeds [batch_size] are the seeds of the requests and random_steps [batch_size], on the
+// device, their own generation steps, so a request samples the same tokens whatever its row, the step at which it
+// joined the batch and the rest of the batch.
 template<typename T>
-void invokeTopKSampling(void*          workspace,
-                        size_t&        workspace_size,
-                        const T*       log_probs,
-                        int*           ids,
-                        int*           sequence_length,
-                        bool*          finished_buf,
-                        float*         cum_log_probs,
-                        float*         output_log_probs,
-                        curandState_t* curandstate,
-                        const int      top_k,
-                        const float    top_p,
-                        const int      vocab_size_padded,
-                        const int*     end_ids,
-                        cudaStream_t   stream,
-                        const int      batch_size,
-                        const bool*    skip_decode);
+void invokeTopKSampling(void*                     workspace,
+                        size_t&                   workspace_size,
+                        const T*                  log_probs,
+                        int*                      ids,
+                        int*                      sequence_length,
+                        bool*                     finished_buf,
+                        float*                    cum_log_probs,
+                        float*                    output_log_probs,
+                        const unsigned long long* random_seeds,
+                        const int*                random_steps,
+                        const int                 top_k,
+                        const float               top_p,
+                        const int                 vocab_size_padded,
+                        const int*                end_ids,
+                        cudaStream_t              stream,
+                        const int                 batch_size,
+                        const bool*               skip_decode);
 
 template<typename T>
-void invokeBatchTopKSampling(void*          workspace,
-                             size_t&        workspace_size,
-                             const T*       log_probs,
-                             int*           ids,
-                             int*           sequence_length,
-                             bool*          finished,
-                             float*         cum_log_probs,
-                             float*         output_log_probs,
-                             curandState_t* curandstate,
-                             const int      max_top_k,
-                             const int*     top_ks,
-                             const float    top_p,
-                             const float*   top_ps,
-                             const int      vocab_size_padded,
-                             const int*     end_ids,
-                             cudaStream_t   stream,
-                             const int      batch_size,
-                             const bool*    skip_decode);
+void invokeBatchTopKSampling(void*                     workspace,
+                             size_t&                   workspace_size,
+                             const T*                  log_probs,
+                             int*                      ids,
+                             int*                      sequence_length,
+                             bool*                     finished,
+                             float*                    cum_log_probs,
+                             float*                    output_log_probs,
+                             const unsigned long long* random_seeds,
+                             const int*                random_steps,
+                             const int                 max_top_k,
+                             const int*                top_ks,
+                             const float               top_p,
+                             const float*              top_ps,
+                             const int                 vocab_size_padded,
+                             const int*                end_ids,
+                             cudaStream_t              stream,
+                             const int                 batch_size,
+                             const bool*               skip_decode);
 
 void invokeCurandInitialize(curandState_t*     state,
                             const size_t       batch_size,
@@ -73,20 +79,21 @@ void invokeAddBiasEndMask(
     T* logits, const T* bias, const int* end_ids, const bool* finished, const int m, const int n, cudaStream_t stream);
 
 template<typename T>
-void invokeTopKTopPSampling(void*          workspace,
-                            size_t&        workspace_size,
-                            int*           output_ids,
-                            const T*       logits,
-                            int*           sequence_length,
-                            bool*          finished_buf,
-                            float*         cum_log_probs,
-                            float*         output_log_probs,
-                            curandState_t* curandstate,
-                            const int      batch_size,
-                            const int      top_k,
-                            const float    top_p,
-                            const int      vocab_size_padded,
-                            const int*     end_ids,
-                            cudaStream_t   stream);
+void invokeTopKTopPSampling(void*                     workspace,
+                            size_t&                   workspace_size,
+                            int*                      output_ids,
+                            const T*                  logits,
+                            int*                      sequence_length,
+                            bool*                     finished_buf,
+                            float*                    cum_log_probs,
+                            float*                    output_log_probs,
+                            const unsigned long long* random_seeds,
+                            const int*                random_steps,
+                            const int                 batch_size,
+                            const int                 top_k,
+                            const float               top_p,
+                            const int                 vocab_size_padded,
+                            const int*                end_ids,
+                            cudaStream_t              stream);
 
 }  // namespace fastertransformer
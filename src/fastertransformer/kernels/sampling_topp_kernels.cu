@@ -22,6 +22,7 @@
 #include "3rdparty/cub/cub.cuh"
 #endif
 
+#include "src/fastertransformer/kernels/philox_random.h"
 #include "src/fastertransformer/kernels/reduce_kernel_utils.cuh"
 #include "src/fastertransformer/kernels/sampling_topp_kernels.h"
 #include "src/fastertransformer/utils/cuda_utils.h"
@@ -875,22 +876,23 @@ struct BlockPrefixCallbackOp {
 };
 
 template<typename T, int BLOCK_SIZE>
-__global__ void topp_sampling(T*             sorted_log_probs,
-                              int*           sorted_id_vals,
-                              int*           ids,
-                              int*           sequence_length,
-                              bool*          finished_buf,
-                              float*         cum_log_probs,
-                              float*         output_log_probs,
-                              const int*     begin_offset_buf,
-                              const int*     offset_buf,
-                              const int      vocab_size,
-                              curandState_t* curandstate,
-                              const float    top_p,
-                              const float*   top_ps,
-                              const int*     end_ids,
-                              const int      batch_size,
-                              const bool*    skip_decode)
+__global__ void topp_sampling(T*                        sorted_log_probs,
+                              int*                      sorted_id_vals,
+                              int*                      ids,
+                              int*                      sequence_length,
+                              bool*                     finished_buf,
+                              float*                    cum_log_probs,
+                              float*                    output_log_probs,
+                              const int*                begin_offset_buf,
+                              const int*                offset_buf,
+                              const int                 vocab_size,
+                              const unsigned long long* random_seeds,
+                              const int*                random_steps,
+                              const float               top_p,
+                              const float*              top_ps,
+                              const int*                end_ids,
+                              const int                 batch_size,
+                              const bool*               skip_decode)
 {
     __shared__ int   stop_shared;
     __shared__ float rand_num_s;
@@ -909,7 +911,7 @@ __global__ void topp_sampling(T*             sorted_log_probs,
 
     if (threadIdx.x == 0) {
         stop_shared = 0;
-        rand_num_s  = curand_uniform(curandstate + blockIdx.x) * prob_threshold;
+        rand_num_s  = philoxUniform(random_seeds[batch_id], random_steps[batch_id]) * prob_threshold;
     }
 
     // if begin_offset_buf and offset_buf of sorting have same value,
@@ -1004,27 +1006,28 @@ __global__ void topp_sampling(T*             sorted_log_probs,
 }
 
 template<typename T>
-void invokeBatchTopPSampling(void*           workspace,
-                             size_t&         workspace_size,
-                             size_t&         cub_temp_storage_size,
-                             int*            output_ids,
-                             int*            sequence_length,
-                             bool*           finished_buf,
-                             float*          cum_log_probs,
-                             float*          output_log_probs,
-                             const T*        log_probs,
-                             const int*      id_vals,
-                             int*            offset_buf,
-                             int*            begin_offset_buf,
-                             curandState_t*  curandstate,
-                             const int       batch_size,
-                             const size_t    vocab_size_padded,
-                             const int*      end_ids,
-                             const float     max_top_p,
-                             const float*    top_ps,
-                             cudaStream_t    stream,
-                             cudaDeviceProp* cuda_device_prop,
-                             const bool*     skip_decode)
+void invokeBatchTopPSampling(void*                     workspace,
+                             size_t&                   workspace_size,
+                             size_t&                   cub_temp_storage_size,
+                             int*                      output_ids,
+                             int*                      sequence_length,
+                             bool*                     finished_buf,
+                             float*                    cum_log_probs,
+                             float*                    output_log_probs,
+                             const T*                  log_probs,
+                             const int*                id_vals,
+                             int*                      offset_buf,
+                             int*                      begin_offset_buf,
+                             const unsigned long long* random_seeds,
+                             const int*                random_steps,
+                             const int                 batch_size,
+                             const size_t              vocab_size_padded,
+                             const int*                end_ids,
+                             const float               max_top_p,
+                             const float*              top_ps,
+                             cudaStream_t              stream,
+                             cudaDeviceProp*           cuda_device_prop,
+                             const bool*               skip_decode)
 {
     // Here, we put batch size as an argument because the batch size of initialization
     // and inference may be different due to pipeline parallelism.
@@ -1152,7 +1155,8 @@ void invokeBatchTopPSampling(void*           workspace,
                                                                                     begin_offset_buf,
                                                                                     offset_buf + 1,
                                                                                     vocab_size,
-                                                                                    curandstate,
+                                                                                    random_seeds,
+                                                                                    random_steps,
                                                                                     max_top_p,
                                                                                     top_ps,
                                                                                     end_ids,
@@ -1160,71 +1164,74 @@ void invokeBatchTopPSampling(void*           workspace,
                                                                                     skip_decode);
 }
 
-template void invokeBatchTopPSampling(void*           workspace,
-                                      size_t&         workspace_size,
-                                      size_t&         cub_temp_storage_size,
-                                      int*            output_ids,
-                                      int*            sequence_length,
-                                      bool*           finished_buf,
-                                      float*          cum_log_probs,
-                                      float*          output_log_probs,
-                                      const float*    log_probs,
-                                      const int*      id_vals,
-                                      int*            offset_buf,
-                                      int*            begin_offset_buf,
-                                      curandState_t*  curandstate,
-                                      const int       batch_size,
-                                      const size_t    vocab_size_padded,
-                                      const int*      end_ids,
-                                      const float     max_top_p,
-                                      const float*    top_ps,
-                                      cudaStream_t    stream,
-                                      cudaDeviceProp* cuda_device_prop,
-                                      const bool*     skip_decode);
-
-template void invokeBatchTopPSampling(void*           workspace,
-                                      size_t&         workspace_size,
-                                      size_t&         cub_temp_storage_size,
-                                      int*            output_ids,
-                                      int*            sequence_length,
-                                      bool*           finished_buf,
-                                      float*          cum_log_probs,
-                                      float*          output_log_probs,
-                                      const half*     log_probs,
-                                      const int*      id_vals,
-                                      int*            offset_buf,
-                                      int*            begin_offset_buf,
-                                      curandState_t*  curandstate,
-                                      const int       batch_size,
-                                      const size_t    vocab_size_padded,
-                                      const int*      end_ids,
-                                      const float     max_top_p,
-                                      const float*    top_ps,
-                                      cudaStream_t    stream,
-                                      cudaDeviceProp* cuda_device_prop,
-                                      const bool*     skip_decode);
+template void invokeBatchTopPSampling(void*                     workspace,
+                                      size_t&                   workspace_size,
+                                      size_t&                   cub_temp_storage_size,
+                                      int*                      output_ids,
+                                      int*                      sequence_length,
+                                      bool*                     finished_buf,
+                                      float*                    cum_log_probs,
+                                      float*                    output_log_probs,
+                                      const float*              log_probs,
+                                      const int*                id_vals,
+                                      int*                      offset_buf,
+                                      int*                      begin_offset_buf,
+                                      const unsigned long long* random_seeds,
+                                      const int*                random_steps,
+                                      const int                 batch_size,
+                                      const size_t              vocab_size_padded,
+                                      const int*                end_ids,
+                                      const float               max_top_p,
+                                      const float*              top_ps,
+                                      cudaStream_t              stream,
+                                      cudaDeviceProp*           cuda_device_prop,
+                                      const bool*               skip_decode);
+
+template void invokeBatchTopPSampling(void*                     workspace,
+                                      size_t&                   workspace_size,
+                                      size_t&                   cub_temp_storage_size,
+                                      int*                      output_ids,
+                                      int*                      sequence_length,
+                                      bool*                     finished_buf,
+                                      float*                    cum_log_probs,
+                                      float*                    output_log_probs,
+                                      const half*               log_probs,
+                                      const int*                id_vals,
+                                      int*                      offset_buf,
+                                      int*                      begin_offset_buf,
+                                      const unsigned long long* random_seeds,
+                                      const int*                random_steps,
+                                      const int                 batch_size,
+                                      const size_t              vocab_size_padded,
+                                      const int*                end_ids,
+                                      const float               max_top_p,
+                                      const float*              top_ps,
+                                      cudaStream_t              stream,
+                                      cudaDeviceProp*           cuda_device_prop,
+                                      const bool*               skip_decode);
 
 template<typename T>
-void invokeTopPSampling(void*           workspace,
-                        size_t&         workspace_size,
-                        size_t&         cub_temp_storage_size,
-                        int*            output_ids,
-                        int*            sequence_length,
-                        bool*           finished_buf,
-                        float*          cum_log_probs,
-                        float*          output_log_probs,
-                        const T*        log_probs,
-                        const int*      id_vals,
-                        int*            offset_buf,
-                        int*            begin_offset_buf,
-                        curandState_t*  curandstate,
-                        const int       batch_size,
-                        const size_t    vocab_size_padded,
-                        const int*      end_ids,
-                        const float     top_p,
-                        cudaStream_t    stream,
-                        cudaDeviceProp* cuda_device_prop,
-                        const bool*     skip_decode)
+void invokeTopPSampling(void*                     workspace,
+                        size_t&                   workspace_size,
+                        size_t&                   cub_temp_storage_size,
+                        int*                      output_ids,
+                        int*                      sequence_length,
+                        bool*                     finished_buf,
+                        float*                    cum_log_probs,
+                        float*                    output_log_probs,
+                        const T*                  log_probs,
+                        const int*                id_vals,
+                        int*                      offset_buf,
+                        int*                      begin_offset_buf,
+                        const unsigned long long* random_seeds,
+                        const int*                random_steps,
+                        const int                 batch_size,
+                        const size_t              vocab_size_padded,
+                        const int*                end_ids,
+                        const float               top_p,
+                        cudaStream_t              stream,
+                        cudaDeviceProp*           cuda_device_prop,
+                        const bool*               skip_decode)
 {
     invokeBatchTopPSampling(workspace,
                             workspace_size,
@@ -1238,7 +1245,8 @@ void invokeTopPSampling(void*           workspace,
                             id_vals,
                             offset_buf,
                             begin_offset_buf,
-                            curandstate,
+                            random_seeds,
+                            random_steps,
                             batch_size,
                             vocab_size_padded,
                             end_ids,
@@ -1249,47 +1257,49 @@ void invokeTopPSampling(void*           workspace,
                             skip_decode);
 }
 
-template void invokeTopPSampling(void*           workspace,
-                                 size_t&         workspace_size,
-                                 size_t&         cub_temp_storage_size,
-                                 int*            output_ids,
-                                 int*            sequence_length,
-                                 bool*           finished_buf,
-                                 float*          cum_log_probs,
-                                 float*          output_log_probs,
-                                 const float*    log_probs,
-                                 const int*      id_vals,
-                                 int*            offset_buf,
-                                 int*            begin_offset_buf,
-                                 curandState_t*  curandstate,
-                                 const int       batch_size,
-                                 const size_t    vocab_size_padded,
-                                 const int*      end_ids,
-                                 const float     top_p,
-                                 cudaStream_t    stream,
-                                 cudaDeviceProp* cuda_device_prop,
-                                 const bool*     skip_decode);
-
-template void invokeTopPSampling(void*           workspace,
-                                 size_t&         workspace_size,
-                                 size_t&         cub_temp_storage_size,
-                                 int*            output_ids,
-                                 int*            sequence_length,
-                                 bool*           finished_buf,
-                                 float*          cum_log_probs,
-                                 float*          output_log_probs,
-                                 const half*     log_probs,
-                                 const int*      id_vals,
-                                 int*            offset_buf,
-                                 int*            begin_offset_buf,
-                                 curandState_t*  curandstate,
-                                 const int       batch_size,
-                                 const size_t    vocab_size_padded,
-                                 const int*      end_ids,
-                                 const float     top_p,
-                                 cudaStream_t    stream,
-                                 cudaDeviceProp* cuda_device_prop,
-                                 const bool*     skip_decode);
+template void invokeTopPSampling(void*                     workspace,
+                                 size_t&                   workspace_size,
+                                 size_t&                   cub_temp_storage_size,
+                                 int*                      output_ids,
+                                 int*                      sequence_length,
+                                 bool*                     finished_buf,
+                                 float*                    cum_log_probs,
+                                 float*                    output_log_probs,
+                                 const float*              log_probs,
+                                 const int*                id_vals,
+                                 int*                      offset_buf,
+                                 int*                      begin_offset_buf,
+                                 const unsigned long long* random_seeds,
+                                 const int*                random_steps,
+                                 const int                 batch_size,
+                                 const size_t              vocab_size_padded,
+                                 const int*                end_ids,
+                                 const float               top_p,
+                                 cudaStream_t              stream,
+                                 cudaDeviceProp*           cuda_device_prop,
+                                 const bool*               skip_decode);
+
+template void invokeTopPSampling(void*                     workspace,
+                                 size_t&                   workspace_size,
+                                 size_t&                   cub_temp_storage_size,
+                                 int*                      output_ids,
+                                 int*                      sequence_length,
+                                 bool*                     finished_buf,
+                                 float*                    cum_log_probs,
+                                 float*                    output_log_probs,
+                                 const half*               log_probs,
+                                 const int*                id_vals,
+                                 int*                      offset_buf,
+                                 int*                      begin_offset_buf,
+                                 const unsigned long long* random_seeds,
+                                 const int*                random_steps,
+                                 const int                 batch_size,
+                                 const size_t              vocab_size_padded,
+                                 const int*                end_ids,
+                                 const float               top_p,
+                                 cudaStream_t              stream,
+                                 cudaDeviceProp*           cuda_device_prop,
+                                 const bool*               skip_decode);
 
 template<typename T>
 __global__ void
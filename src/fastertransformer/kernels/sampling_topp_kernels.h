@@ -26,50 +26,53 @@ void invokeTopPInitialize(int*         topp_id_val_buf,
                           const int    n,
                           cudaStream_t stream);
 
+// random_seeds and random_steps as in invokeTopKSampling.
 template<typename T>
-void invokeTopPSampling(void*           workspace,
-                        size_t&         workspace_size,
-                        size_t&         cub_temp_storage_size,
-                        int*            output_ids,
-                        int*            sequence_length,
-                        bool*           finished_buf,
-                        float*          cum_log_probs,
-                        float*          output_log_probs,
-                        const T*        log_probs,
-                        const int*      id_vals,
-                        int*            offset_buf,
-                        int*            begin_offset_buf,
-                        curandState_t*  curandstate,
-                        const int       batch_size,
-                        const size_t    vocab_size_padded,
-                        const int*      end_ids,
-                        const float     top_p,
-                        cudaStream_t    stream,
-                        cudaDeviceProp* cuda_device_prop,
-                        const bool*     skip_decode);
+void invokeTopPSampling(void*                     workspace,
+                        size_t&                   workspace_size,
+                        size_t&                   cub_temp_storage_size,
+                        int*                      output_ids,
+                        int*                      sequence_length,
+                        bool*                     finished_buf,
+                        float*                    cum_log_probs,
+                        float*                    output_log_probs,
+                        const T*                  log_probs,
+                        const int*                id_vals,
+                        int*                      offset_buf,
+                        int*                      begin_offset_buf,
+                        const unsigned long long* random_seeds,
+                        const int*                random_steps,
+                        const int                 batch_size,
+                        const size_t              vocab_size_padded,
+                        const int*                end_ids,
+                        const float               top_p,
+                        cudaStream_t              stream,
+                        cudaDeviceProp*           cuda_device_prop,
+                        const bool*               skip_decode);
 
 template<typename T>
-void invokeBatchTopPSampling(void*           workspace,
-                             size_t&         workspace_size,
-                             size_t&         cub_temp_storage_size,
-                             int*            output_ids,
-                             int*            sequence_length,
-                             bool*           finished_buf,
-                             float*          cum_log_probs,
-                             float*          output_log_probs,
-                             const T*        log_probs,
-                             const int*      id_vals,
-                             int*            offset_buf,
-                             int*            begin_offset_buf,
-                             curandState_t*  curandstate,
-                             const int       batch_size,
-                             const size_t    vocab_size_padded,
-                             const int*      end_ids,
-                             const float     max_top_p,
-                             const float*    top_ps,
-                             cudaStream_t    stream,
-                             cudaDeviceProp* cuda_device_prop,
-                             const bool*     skip_decode);
+void invokeBatchTopPSampling(void*                     workspace,
+                             size_t&                   workspace_size,
+                             size_t&                   cub_temp_storage_size,
+                             int*                      output_ids,
+                             int*                      sequence_length,
+                             bool*                     finished_buf,
+                             float*                    cum_log_probs,
+                             float*                    output_log_probs,
+                             const T*                  log_probs,
+                             const int*                id_vals,
+                             int*                      offset_buf,
+                             int*                      begin_offset_buf,
+                             const unsigned long long* random_seeds,
+                             const int*                random_steps,
+                             const int                 batch_size,
+                             const size_t              vocab_size_padded,
+                             const int*                end_ids,
+                             const float               max_top_p,
+                             const float*              top_ps,
+                             cudaStream_t              stream,
+                             cudaDeviceProp*           cuda_device_prop,
+                             const bool*               skip_decode);
 
 template<typename T>
 void invokeAddBiasSoftMax(T*           logits,
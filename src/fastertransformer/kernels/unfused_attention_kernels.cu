@@ -1702,6 +1702,175 @@ template void invokeTranspose4dBatchMajor(__nv_bfloat16*       k_dst,
                                           cudaStream_t         stream);
 #endif
 
+template<typename T>
+__global__ void transpose_4d_batch_major_paged_k_cache(T*         k_dst,
+                                                       const T*   k_src,
+                                                       const int* block_table,
+                                                       const int  max_blocks_per_seq,
+                                                       const int  block_size,
+                                                       const int  head_num,
+                                                       const int  size_per_head,
+                                                       const int  seq_len)
+{
+    const int     batch_id = blockIdx.y;
+    const int     head_id  = blockIdx.z;
+    constexpr int X_ELEMS  = (sizeof(T) == 4) ? 4 : 8;
+
+    auto key_src = reinterpret_cast<const uint4*>(k_src + batch_id * head_num * size_per_head * seq_len
+                                                  + head_id * size_per_head * seq_len);
+    auto key_dst = reinterpret_cast<uint4*>(k_dst);
+
+    // idx is over the chunks of x elements of the input keys, Dh/x * L
+    const int idx                 = blockIdx.x * blockDim.x + threadIdx.x;
+    const int size_per_head_div_x = size_per_head / X_ELEMS;
+    if (idx >= size_per_head_div_x * seq_len) {
+        return;
+    }
+    const int k_seq_len_id   = idx % seq_len;
+    const int k_head_size_id = idx / seq_len;
+    const int block          = block_table[batch_id * max_blocks_per_seq + k_seq_len_id / block_size];
+
+    // a block is [H, Dh/x, block_size, x]
+    key_dst[(((size_t)block * head_num + head_id) * size_per_head_div_x + k_head_size_id) * block_size
+            + k_seq_len_id % block_size] = key_src[k_seq_len_id * size_per_head_div_x + k_head_size_id];
+}
+
+template<typename T>
+__global__ void transpose_4d_batch_major_paged_v_cache(T*         v_dst,
+                                                       const T*   v_src,
+                                                       const int* block_table,
+                                                       const int  max_blocks_per_seq,
+                                                       const int  block_size,
+                                                       const int  head_num,
+                                                       const int  size_per_head,
+                                                       const int  seq_len)
+{
+    const int     batch_id = blockIdx.y;
+    const int     head_id  = blockIdx.z;
+    constexpr int X_ELEMS  = (sizeof(T) == 4) ? 4 : 8;
+
+    auto val_src = reinterpret_cast<const uint4*>(v_src + batch_id * head_num * size_per_head * seq_len
+                                                  + head_id * size_per_head * seq_len);
+    auto val_dst = reinterpret_cast<uint4*>(v_dst);
+
+    const int idx                 = blockIdx.x * blockDim.x + threadIdx.x;
+    const int size_per_head_div_x = size_per_head / X_ELEMS;
+    if (idx >= size_per_head_div_x * seq_len) {
+        return;
+    }
+    const int v_seq_len_id = idx / size_per_head_div_x;
+    const int block        = block_table[batch_id * max_blocks_per_seq + v_seq_len_id / block_size];
+
+    // a block is [H, block_size, Dh]
+    val_dst[(((size_t)block * head_num + head_id) * block_size + v_seq_len_id % block_size) * size_per_head_div_x
+            + idx % size_per_head_div_x] = val_src[idx];
+}
+
+template<typename T>
+void invokeTranspose4dBatchMajorPaged(T*           k_dst,
+                                      T*           v_dst,
+                                      const T*     k_src,
+                                      const T*     v_src,
+                                      const int*   block_table,
+                                      const int    max_blocks_per_seq,
+                                      const int    block_size,
+                                      const int    local_batch_size,
+                                      const int    seq_len,
+                                      const int    size_per_head,
+                                      const int    local_head_num,
+                                      cudaStream_t stream)
+{
+    constexpr int block_sz = 128;
+    constexpr int x        = (sizeof(T) == 4) ? 4 : 8;
+    dim3          grid((seq_len * size_per_head / x + block_sz - 1) / block_sz, local_batch_size, local_head_num);
+
+    transpose_4d_batch_major_paged_k_cache<<<grid, block_sz, 0, stream>>>(
+        k_dst, k_src, block_table, max_blocks_per_seq, block_size, local_head_num, size_per_head, seq_len);
+
+    transpose_4d_batch_major_paged_v_cache<<<grid, block_sz, 0, stream>>>(
+        v_dst, v_src, block_table, max_blocks_per_seq, block_size, local_head_num, size_per_head, seq_len);
+}
+
+#define INSTANTIATE_TRANSPOSE_4D_BATCH_MAJOR_PAGED(T)                                                                  \
+    template void invokeTranspose4dBatchMajorPaged(T*           k_dst,                                                 \
+                                                   T*           v_dst,                                                 \
+                                                   const T*     k_src,                                                 \
+                                                   const T*     v_src,                                                 \
+                                                   const int*   block_table,                                           \
+                                                   const int    max_blocks_per_seq,                                    \
+                                                   const int    block_size,                                            \
+                                                   const int    local_batch_size,                                      \
+                                                   const int    seq_len,                                               \
+                                                   const int    size_per_head,                                         \
+                                                   const int    local_head_num,                                        \
+                                                   cudaStream_t stream)
+INSTANTIATE_TRANSPOSE_4D_BATCH_MAJOR_PAGED(float);
+INSTANTIATE_TRANSPOSE_4D_BATCH_MAJOR_PAGED(half);
+#ifdef ENABLE_BF16
+INSTANTIATE_TRANSPOSE_4D_BATCH_MAJOR_PAGED(__nv_bfloat16);
+#endif
+#undef INSTANTIATE_TRANSPOSE_4D_BATCH_MAJOR_PAGED
+
+template<typename T>
+__global__ void copyKVCacheBlocks(T* k_pool, T* v_pool, const int* copies, const size_t block_elems, const size_t layer_elems)
+{
+    // copies is [num_copies, 2] of (src_block, dst_block)
+    const int    src_block = copies[blockIdx.y * 2];
+    const int    dst_block = copies[blockIdx.y * 2 + 1];
+    const size_t layer     = blockIdx.z;
+
+    auto k_src = reinterpret_cast<const uint4*>(k_pool + layer * layer_elems + src_block * block_elems);
+    auto k_dst = reinterpret_cast<uint4*>(k_pool + layer * layer_elems + dst_block * block_elems);
+    auto v_src = reinterpret_cast<const uint4*>(v_pool + layer * layer_elems + src_block * block_elems);
+    auto v_dst = reinterpret_cast<uint4*>(v_pool + layer * layer_elems + dst_block * block_elems);
+
+    const size_t num_vecs = block_elems * sizeof(T) / sizeof(uint4);
+    for (size_t i = blockIdx.x * blockDim.x + threadIdx.x; i < num_vecs; i += gridDim.x * blockDim.x) {
+        k_dst[i] = k_src[i];
+        v_dst[i] = v_src[i];
+    }
+}
+
+template<typename T>
+void invokeCopyKVCacheBlocks(T*           k_pool,
+                             T*           v_pool,
+                             const int*   copies,
+                             const int    num_copies,
+                             const int    num_layers,
+                             const int    num_blocks,
+                             const int    block_size,
+                             const int    size_per_head,
+                             const int    local_head_num,
+                             cudaStream_t stream)
+{
+    if (num_copies == 0) {
+        return;
+    }
+    const size_t block_elems = (size_t)local_head_num * block_size * size_per_head;
+    const size_t num_vecs    = block_elems * sizeof(T) / sizeof(uint4);
+    constexpr int block_sz   = 256;
+    dim3          grid(std::min((num_vecs + block_sz - 1) / block_sz, (size_t)64), num_copies, num_layers);
+    copyKVCacheBlocks<<<grid, block_sz, 0, stream>>>(k_pool, v_pool, copies, block_elems, block_elems * num_blocks);
+}
+
+#define INSTANTIATE_COPY_KV_CACHE_BLOCKS(T)                                                                            \
+    template void invokeCopyKVCacheBlocks(T*           k_pool,                                                         \
+                                          T*           v_pool,                                                         \
+                                          const int*   copies,                                                         \
+                                          const int    num_copies,                                                     \
+                                          const int    num_layers,                                                     \
+                                          const int    num_blocks,                                                     \
+                                          const int    block_size,                                                     \
+                                          const int    size_per_head,                                                  \
+                                          const int    local_head_num,                                                 \
+                                          cudaStream_t stream)
+INSTANTIATE_COPY_KV_CACHE_BLOCKS(float);
+INSTANTIATE_COPY_KV_CACHE_BLOCKS(half);
+#ifdef ENABLE_BF16
+INSTANTIATE_COPY_KV_CACHE_BLOCKS(__nv_bfloat16);
+#endif
+#undef INSTANTIATE_COPY_KV_CACHE_BLOCKS
+
 template<typename T>
 __global__ void addRelativeAttentionBias(
     T* qk_buf, const T* relative_attention_bias, const int batch_size, const int head_num, const int seq_len)
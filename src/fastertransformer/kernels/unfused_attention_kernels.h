@@ -164,6 +164,36 @@ void invokeTranspose4dBatchMajor(T*           k_dst,
                                  const int    local_head_num,
                                  cudaStream_t stream);
 
+// Same as invokeTranspose4dBatchMajor, into a paged cache: k/v_dst are pools of blocks of block_size timesteps laid out
+// as [H, Dh/x, block_size, x] and [H, block_size, Dh], block_table is [local_batch_size, max_blocks_per_seq].
+template<typename T>
+void invokeTranspose4dBatchMajorPaged(T*           k_dst,
+                                      T*           v_dst,
+                                      const T*     k_src,
+                                      const T*     v_src,
+                                      const int*   block_table,
+                                      const int    max_blocks_per_seq,
+                                      const int    block_size,
+                                      const int    local_batch_size,
+                                      const int    seq_len,
+                                      const int    size_per_head,
+                                      const int    local_head_num,
+                                      cudaStream_t stream);
+
+// Applies the copy-on-writes of a KVBlockManager. copies is [num_copies, 2] of (src_block, dst_block) on the device,
+// the pools are [num_layers, num_blocks, block].
+template<typename T>
+void invokeCopyKVCacheBlocks(T*           k_pool,
+                             T*           v_pool,
+                             const int*   copies,
+                             const int    num_copies,
+                             const int    num_layers,
+                             const int    num_blocks,
+                             const int    block_size,
+                             const int    size_per_head,
+                             const int    local_head_num,
+                             cudaStream_t stream);
+
 template<typename T>
 void invokeAddRelativeAttentionBias(T*           qk_buf,
                                     const T*     relative_attention_bias,
@@ -16,6 +16,7 @@
 
 #include "src/fastertransformer/layers/DynamicDecodeLayer.h"
 #include "src/fastertransformer/kernels/ban_bad_words.h"
+#include "src/fastertransformer/kernels/decoding_kernels.h"
 #include "src/fastertransformer/kernels/stop_criteria_kernels.h"
 #include "src/fastertransformer/layers/beam_search_layers/BaseBeamSearchLayer.h"
 #include "src/fastertransformer/layers/beam_search_layers/BeamSearchLayer.h"
@@ -23,6 +24,10 @@
 #include "src/fastertransformer/layers/sampling_layers/TopKSamplingLayer.h"
 #include "src/fastertransformer/layers/sampling_layers/TopKTopPSamplingLayer.h"
 #include "src/fastertransformer/layers/sampling_layers/TopPSamplingLayer.h"
+#include "src/fastertransformer/utils/memory_utils.h"
+
+#include <algorithm>
+#include <unordered_set>
 
 namespace fastertransformer {
 
@@ -39,6 +44,22 @@ void DynamicDecodeLayer<T>::freeBuffer()
 {
     FT_LOG_DEBUG(__PRETTY_FUNCTION__);
     allocator_->free((void**)(&finished_sum_));
+    if (banned_ids_buf_ != nullptr) {
+        allocator_->free((void**)(&banned_ids_buf_));
+    }
+    if (allowed_tokens_buf_ != nullptr) {
+        allocator_->free((void**)(&allowed_tokens_buf_));
+    }
+    if (num_top_logprobs_buf_ != nullptr) {
+        allocator_->free((void**)(&num_top_logprobs_buf_));
+    }
+    if (mixed_indices_buf_ != nullptr) {
+        allocator_->free((void**)(&mixed_indices_buf_));
+    }
+    for (auto& buf : mixed_bufs_) {
+        allocator_->free((void**)(&buf.second));
+    }
+    mixed_bufs_.clear();
     return;
 }
 
@@ -164,9 +185,23 @@ void DynamicDecodeLayer<T>::setup(const size_t
     //     temperature [1] or [batch_size] on cpu, optional
     //     len_penalty [1] or [batch_size] on cpu, optional
     //     repetition_penalty [1] or [batch_size] on cpu, optional
+    //     presence_penalty [1] or [batch_size] on cpu, optional, sampling only
+    //     frequency_penalty [1] or [batch_size] on cpu, optional, sampling only
+    //     beam_widths [batch_size] on cpu, optional, int
+    //         the beam width of each request, 1 for sampling, to decode beam search and sampling requests in one
+    //         batch. beam_width is ignored and forward() then takes the packed layout of MixedDecodeBatch.
 
     FT_LOG_DEBUG(__PRETTY_FUNCTION__);
+    if (runtime_args->count("beam_widths")) {
+        setupMixed(batch_size, runtime_args);
+        return;
+    }
+    mixed_batch_.reset();
     has_diff_runtime_args_ = hasDiffRuntimeArgs(runtime_args);
+    FT_CHECK_WITH_INFO(beam_width == 1
+                           || (runtime_args->count("presence_penalty") == 0
+                               && runtime_args->count("frequency_penalty") == 0),
+                       "presence_penalty and frequency_penalty are only supported in sampling (beam_width = 1).");
     if (beam_width == 1) {  // sampling layers
         topk_decode_->setup(batch_size, beam_width, runtime_args);
         topp_decode_->setup(batch_size, beam_width, runtime_args);
@@ -196,8 +231,37 @@ void DynamicDecodeLayer<T>::forward(std::unordered_map<std::string, Tensor>*
     *   \param  temperature [1] or [batch_size] on cpu, optional, float
     *   \param  len_penalty [1] or [batch_size] on cpu, optional, float
     *   \param  repetition_penalty [1] or [batch_size] on cpu, optional, float
+    *   \param  presence_penalty [1] or [batch_size] on cpu, optional, float
+                    sampling only, subtracted from the logits of the tokens generated since setup()
+    *   \param  frequency_penalty [1] or [batch_size] on cpu, optional, float
+                    sampling only, subtracted from the logits of the tokens generated since setup() once per occurrence
     *   \param  random_seed [1] or [batch_size] on cpu, optional, unsigned long long int
+    *   \param  random_steps [batch_size] on cpu, optional, int
+                    sampling only, the generation steps of the requests, which key their random numbers with their
+                    seeds. step - max_input_length for every request by default; a batch whose requests started at
+                    different steps gives each its own, so that a request samples the same tokens wherever it runs.
     *   \param  bad_words_list [2, bad_words_length] or [batch_size, 2, bad_words_length], optional
+    *   \param  bad_words_trie [2, bad_words_length] on cpu, optional, int
+                    words banned for the whole batch, matched by a TokenTrie against the generated tokens, so a step
+                    costs the number of matched prefixes instead of the list length. It must be given from the first
+                    generation step (step == max_input_length) on.
+    *   \param  allowed_words_trie [2, allowed_words_length] on cpu, optional, int
+                    the generated tokens must spell words of this list: every other token is masked, and the end id
+                    is allowed once a word is complete. It must be given from the first generation step on, with a
+                    single end id for the batch.
+    *   \param  allowed_words_repeat [1] on cpu, optional, bool
+                    with allowed_words_trie, whether another word may follow a complete word
+    *   \param  num_top_logprobs [1] or [batch_size] on cpu, optional, int
+                    the number of alternatives returned in output_top_logprobs for each request, at most its last
+                    dimension (the default)
+    *   \param  no_repeat_ngram_size [1] on cpu, optional, int
+                    bans the tokens that would repeat an n-gram of the beam, prompt included; 0 disables it. It
+                    must be given from the first generation step (step == max_input_length) on.
+    *   \param  early_stopping [1] on cpu, optional, int
+                    beam search only: 0 (heuristic), 1 (true) or 2 (never) to stop a request once its best finished
+                    beams cannot be improved, see BeamHypotheses. A done request has all its beams finished, the
+                    final beams in its output_ids, parent_ids and output_log_probs. It must be given from the first
+                    generation step on, with beam_width <= 64.
     *   \param  src_key_cache
                     [layer, batch_size * beam_width, local_head_num,
                      size_per_head / (16 / sizeof(T)), max_output_seq_len, 16 / sizeof(T)]
@@ -209,6 +273,12 @@ void DynamicDecodeLayer<T>::forward(std::unordered_map<std::string, Tensor>*
                     [local_batch_size, beam_width, max_seq_len]
                     the k/v cache index for beam search
     *   \param  is_initialize_random_table [1] on cpu, bool
+    *   \param  beam_widths [batch_size] on cpu, optional, int
+                    the beam widths given to setup(), for a batch mixing beam search and sampling requests. The rows
+                    (beams) are then packed request by request, num_rows = sum(beam_widths), and the tensors of
+                    shape [batch_size, beam_width, ...] or [..., batch_size * beam_width, ...] above are
+                    [num_rows, ...] or [..., num_rows, ...] instead. ite must be 0, and no_repeat_ngram_size, the
+                    word tries and output_top_logprobs are not supported.
 
     * output_tensors:
     *   \param  output_ids [max_seq_len, batch_size]
@@ -218,12 +288,25 @@ void DynamicDecodeLayer<T>::forward(std::unordered_map<std::string, Tensor>*
     *   \param  parent_ids [max_seq_len, batch_size * beam_width]
     *   \param  sequence_length [batch_size * beam_width]
     *   \param  output_log_probs [request_ouptut_length, batch_size * beam_width], must be float*, optional
+    *   \param  output_top_logprobs [request_ouptut_length, batch_size * beam_width, N], must be float*, optional
+                    the log probs of the N most likely tokens of each step, in decreasing order, from the distribution
+                    sampled from (after temperature and penalties). Only supported in sampling (beam_width = 1).
+    *   \param  output_top_logprob_ids [request_ouptut_length, batch_size * beam_width, N], must be int*, optional
+                    the ids of these tokens, necessary with output_top_logprobs. Entries after num_top_logprobs are
+                    -1 with a log prob of -inf.
     *   \param  tgt_cache_indirection
                     [local_batch_size, beam_width, max_seq_len]
                     the k/v cache index for beam search
+    *   \param  is_done [batch_size], must be bool*, optional
+                    beam search with early_stopping only: whether each request is done, for the model to only run
+                    the decoder on the rows of the other requests
 
     **/
     FT_LOG_DEBUG(__PRETTY_FUNCTION__);
+    if (input_tensors->count("beam_widths")) {
+        forwardMixed(output_tensors, input_tensors);
+        return;
+    }
     const int ite  = input_tensors->at("ite").getVal<int>();
     const int step = input_tensors->at("step").getVal<int>();
     FT_CHECK(input_tensors->at("logits").shape.size() == 3);
@@ -232,6 +315,17 @@ void DynamicDecodeLayer<T>::forward(std::unordered_map<std::string, Tensor>*
     const size_t beam_width       = input_tensors->at("logits").shape[1];
     const size_t local_batch_size = (size_t)input_tensors->at("local_batch_size").getVal<int>();
 
+    if (input_tensors->find("no_repeat_ngram_size") != input_tensors->end()) {
+        banRepeatedNgrams(output_tensors, input_tensors);
+    }
+    if (input_tensors->find("bad_words_trie") != input_tensors->end()) {
+        applyTokenTrie(output_tensors, input_tensors, TokenTrieMode::BAN, &bad_words_trie_, &bad_words_matcher_);
+    }
+    if (input_tensors->find("allowed_words_trie") != input_tensors->end()) {
+        applyTokenTrie(
+            output_tensors, input_tensors, TokenTrieMode::ALLOW, &allowed_words_trie_, &allowed_words_matcher_);
+    }
+
     if (input_tensors->find("bad_words_list") != input_tensors->end()) {
         const auto&  bad_words        = input_tensors->at("bad_words_list");
         const int*   bad_words_ptr    = reinterpret_cast<const int*>(bad_words.data);
@@ -260,6 +354,8 @@ void DynamicDecodeLayer<T>::forward(std::unordered_map<std::string, Tensor>*
 
     // dynamic decode GPT
     if (beam_width > 1) {
+        FT_CHECK_WITH_INFO(output_tensors->count("output_top_logprobs") == 0,
+                           "output_top_logprobs is only supported in sampling (beam_width = 1).");
         // Because we still not support batch beam search now, so we need to compute one by one if there are different
         // runtime arguments.
         const size_t dynamic_decode_batch_size      = has_diff_runtime_args_ ? 1 : local_batch_size;
@@ -341,6 +437,13 @@ void DynamicDecodeLayer<T>::forward(std::unordered_map<std::string, Tensor>*
 
             dynamic_decode_input_tensors.insert({"src_cache_indirection", input_tensors->at("src_cache_indirection")});
 
+            if (output_tensors->count("is_done")) {
+                dynamic_decode_output_tensors.insert(
+                    {"is_done",
+                     output_tensors->at("is_done").slice({dynamic_decode_batch_size},
+                                                         dynamic_ite * dynamic_decode_batch_size)});
+            }
+
             dynamic_decode_output_tensors.insert({"parent_ids", output_tensors->at("parent_ids")});
             dynamic_decode_output_tensors.insert(
                 {"tgt_cache_indirection", output_tensors->at("tgt_cache_indirection")});
@@ -374,6 +477,10 @@ void DynamicDecodeLayer<T>::forward(std::unordered_map<std::string, Tensor>*
             {"input_lengths",
              input_lengths.slice({local_batch_size * beam_width, input_lengths.shape[1]}, local_batch_offset)},
             {"ite", Tensor{MEMORY_CPU, TYPE_INT32, {1}, &ite}}};
+        if (input_tensors->count("random_steps")) {
+            decode_input_tensors.insert(
+                {"random_steps", input_tensors->at("random_steps").slice({local_batch_size}, ite * local_batch_size)});
+        }
 
         Tensor finished        = output_tensors->at("finished");
         Tensor sequence_length = output_tensors->at("sequence_length");
@@ -396,6 +503,40 @@ void DynamicDecodeLayer<T>::forward(std::unordered_map<std::string, Tensor>*
                                                                   local_batch_size * beam_width},
                                                                  step_offset + local_batch_offset)});
         }
+        if (output_tensors->count("output_top_logprobs")) {
+            Tensor       top_logprobs     = output_tensors->at("output_top_logprobs");
+            Tensor       top_logprob_ids  = output_tensors->at("output_top_logprob_ids");
+            const size_t num_top_logprobs = top_logprobs.shape[2];
+            const size_t step_offset =
+                ((step - input_tensors->at("max_input_length").getVal<int>()) * batch_size * beam_width
+                 + local_batch_offset)
+                * num_top_logprobs;
+            decode_output_tensors.insert(
+                {"output_top_logprobs",
+                 top_logprobs.slice({local_batch_size * beam_width, num_top_logprobs}, step_offset)});
+            decode_output_tensors.insert(
+                {"output_top_logprob_ids",
+                 top_logprob_ids.slice({local_batch_size * beam_width, num_top_logprobs}, step_offset)});
+
+            if (input_tensors->count("num_top_logprobs")) {
+                const Tensor num = input_tensors->at("num_top_logprobs");
+                FT_CHECK_WITH_INFO(num.size() == 1 || num.size() == batch_size,
+                                   fmtstr("num_top_logprobs must be of shape [1] or [batch_size(%ld)], got %s",
+                                          batch_size,
+                                          vec2str(num.shape).c_str()));
+                num_top_logprobs_buf_ =
+                    (int*)allocator_->reMalloc(num_top_logprobs_buf_, sizeof(int) * local_batch_size, false);
+                if (num.size() == 1) {
+                    deviceFill(num_top_logprobs_buf_, local_batch_size, num.getVal<int>(), stream_);
+                }
+                else {
+                    cudaAutoCpy(
+                        num_top_logprobs_buf_, num.getPtr<int>() + ite * local_batch_size, local_batch_size, stream_);
+                }
+                decode_input_tensors.insert(
+                    {"num_top_logprobs", Tensor{MEMORY_GPU, TYPE_INT32, {local_batch_size}, num_top_logprobs_buf_}});
+            }
+        }
 
         // Run topk / topp decode layers.
         // Currently, we support batch sampling. If the runtime arguments are like
@@ -436,6 +577,552 @@ void DynamicDecodeLayer<T>::forward(std::unordered_map<std::string, Tensor>*
     }
 }
 
+// Reads the tokens generated by the local rows at the previous step, tokens [local_rows], and with beams the rows they
+// continue, parent_rows [batch_size * beam_width], the other rows continuing themselves.
+template<typename T>
+void DynamicDecodeLayer<T>::readLastStepTokens(const std::unordered_map<std::string, Tensor>* output_tensors,
+                                               const std::unordered_map<std::string, Tensor>* input_tensors,
+                                               std::vector<int>*                              tokens,
+                                               std::vector<int>*                              parent_rows)
+{
+    const int    ite        = input_tensors->at("ite").getVal<int>();
+    const int    step       = input_tensors->at("step").getVal<int>();
+    const size_t beam_width = input_tensors->at("logits").shape[1];
+    const size_t num_rows   = input_tensors->at("logits").shape[0] * beam_width;
+    const size_t local_rows = (size_t)input_tensors->at("local_batch_size").getVal<int>() * beam_width;
+    const size_t row_offset = ite * local_rows;
+    const int*   output_ids = output_tensors->at("output_ids").getPtr<const int>();
+
+    tokens->resize(local_rows);
+    cudaD2Hcpy(tokens->data(), output_ids + (step - 1) * num_rows + row_offset, local_rows);
+    parent_rows->clear();
+    if (beam_width > 1) {
+        // the beams of the previous step continue the beams given by parent_ids
+        std::vector<int> parent_ids(local_rows);
+        cudaD2Hcpy(parent_ids.data(),
+                   output_tensors->at("parent_ids").getPtr<const int>() + (step - 1) * num_rows + row_offset,
+                   local_rows);
+        parent_rows->resize(num_rows);
+        for (size_t row = 0; row < num_rows; row++) {
+            (*parent_rows)[row] = (int)row;
+        }
+        for (size_t row = 0; row < local_rows; row++) {
+            (*parent_rows)[row_offset + row] = (int)(row_offset + (row / beam_width) * beam_width + parent_ids[row]);
+        }
+    }
+}
+
+template<typename T>
+void DynamicDecodeLayer<T>::banRepeatedNgrams(std::unordered_map<std::string, Tensor>*       output_tensors,
+                                              const std::unordered_map<std::string, Tensor>* input_tensors)
+{
+    FT_LOG_DEBUG(__PRETTY_FUNCTION__);
+    const int ngram_size = input_tensors->at("no_repeat_ngram_size").getVal<int>();
+    if (ngram_size <= 0) {
+        return;
+    }
+    const int    ite              = input_tensors->at("ite").getVal<int>();
+    const int    step             = input_tensors->at("step").getVal<int>();
+    const int    max_input_length = input_tensors->at("max_input_length").getVal<int>();
+    const size_t batch_size       = input_tensors->at("logits").shape[0];
+    const size_t beam_width       = input_tensors->at("logits").shape[1];
+    const size_t local_batch_size = (size_t)input_tensors->at("local_batch_size").getVal<int>();
+    const size_t num_rows         = batch_size * beam_width;
+    const size_t local_rows       = local_batch_size * beam_width;
+    const size_t row_offset       = ite * local_rows;
+    const int*   output_ids       = output_tensors->at("output_ids").getPtr<const int>();
+
+    // The index follows the beams on the host: read the tokens written since the last step.
+    check_cuda_error(cudaStreamSynchronize(stream_));
+    if (step == max_input_length) {
+        if (ite == 0 || ngram_index_ == nullptr || ngram_index_->getBatchSize() != num_rows
+            || ngram_index_->getNgramSize() != (size_t)ngram_size) {
+            ngram_index_.reset(new NgramIndex(num_rows, ngram_size));
+        }
+        // output_ids [max_input_length, batch_size * beam_width] holds the prompts, padded after input_lengths
+        const int*       d_input_lengths = input_tensors->at("input_lengths").getPtr<const int>();
+        std::vector<int> prompts(max_input_length * num_rows);
+        std::vector<int> input_lengths(local_rows);
+        cudaD2Hcpy(prompts.data(), output_ids, prompts.size());
+        cudaD2Hcpy(input_lengths.data(), d_input_lengths + row_offset, local_rows);
+        for (size_t row = row_offset; row < row_offset + local_rows; row++) {
+            ngram_index_->reset(row);
+            for (int i = 0; i < input_lengths[row - row_offset]; i++) {
+                ngram_index_->add(row, prompts[i * num_rows + row]);
+            }
+        }
+    }
+    else {
+        FT_CHECK_WITH_INFO(ngram_index_ != nullptr && ngram_index_->getBatchSize() == num_rows
+                               && ngram_index_->getNgramSize() == (size_t)ngram_size,
+                           "no_repeat_ngram_size must be the same from the first generation step on.");
+        std::vector<int> tokens;
+        std::vector<int> parent_rows;
+        readLastStepTokens(output_tensors, input_tensors, &tokens, &parent_rows);
+        if (!parent_rows.empty()) {
+            ngram_index_->gather(parent_rows.data());
+        }
+        for (size_t row = 0; row < local_rows; row++) {
+            ngram_index_->add(row_offset + row, tokens[row]);
+        }
+    }
+
+    std::vector<int> banned_ids;  // rows then tokens
+    std::vector<int> banned_tokens;
+    std::vector<int> row_tokens;
+    for (size_t row = 0; row < local_rows; row++) {
+        ngram_index_->getBannedTokens(row_offset + row, &row_tokens);
+        banned_ids.insert(banned_ids.end(), row_tokens.size(), (int)row);
+        banned_tokens.insert(banned_tokens.end(), row_tokens.begin(), row_tokens.end());
+    }
+    const int num_banned = (int)banned_tokens.size();
+    if (num_banned == 0) {
+        return;
+    }
+    banned_ids.insert(banned_ids.end(), banned_tokens.begin(), banned_tokens.end());
+    banned_ids_buf_ = (int*)allocator_->reMalloc(banned_ids_buf_, sizeof(int) * banned_ids.size(), false);
+    cudaH2Dcpy(banned_ids_buf_, banned_ids.data(), banned_ids.size());
+    invokeBanTokens((T*)input_tensors->at("logits").getPtrWithOffset(row_offset * vocab_size_padded_),
+                    banned_ids_buf_,
+                    banned_ids_buf_ + num_banned,
+                    num_banned,
+                    vocab_size_padded_,
+                    stream_);
+}
+
+template<typename T>
+void DynamicDecodeLayer<T>::applyTokenTrie(std::unordered_map<std::string, Tensor>*       output_tensors,
+                                           const std::unordered_map<std::string, Tensor>* input_tensors,
+                                           const TokenTrieMode                            mode,
+                                           std::unique_ptr<TokenTrie>*                    trie,
+                                           std::unique_ptr<TokenTrieMatcher>*             matcher)
+{
+    FT_LOG_DEBUG(__PRETTY_FUNCTION__);
+    const bool    is_ban           = mode == TokenTrieMode::BAN;
+    const char*   name             = is_ban ? "bad_words_trie" : "allowed_words_trie";
+    const Tensor& word_list        = input_tensors->at(name);
+    const int     ite              = input_tensors->at("ite").getVal<int>();
+    const int     step             = input_tensors->at("step").getVal<int>();
+    const int     max_input_length = input_tensors->at("max_input_length").getVal<int>();
+    const size_t  batch_size       = input_tensors->at("logits").shape[0];
+    const size_t  beam_width       = input_tensors->at("logits").shape[1];
+    const size_t  num_rows         = batch_size * beam_width;
+    const size_t  local_rows       = (size_t)input_tensors->at("local_batch_size").getVal<int>() * beam_width;
+    const size_t  row_offset       = ite * local_rows;
+    FT_CHECK_WITH_INFO(word_list.where == MEMORY_CPU && word_list.shape.size() == 2 && word_list.shape[0] == 2,
+                       fmtstr("%s must be a [2, len] word list on cpu.", name));
+
+    // The matcher follows the beams on the host: read the tokens written since the last step.
+    check_cuda_error(cudaStreamSynchronize(stream_));
+    if (step == max_input_length) {
+        if (ite == 0 || *matcher == nullptr) {
+            int end_id = -1;
+            if (!is_ban) {
+                std::vector<int> end_ids(batch_size);
+                cudaAutoCpy(end_ids.data(), input_tensors->at("end_id").getPtr<const int>(), batch_size, stream_);
+                check_cuda_error(cudaStreamSynchronize(stream_));
+                FT_CHECK_WITH_INFO(
+                    std::all_of(end_ids.begin(), end_ids.end(), [&](int id) { return id == end_ids[0]; }),
+                    "allowed_words_trie needs a single end id for the batch.");
+                end_id = end_ids[0];
+            }
+            const bool allow_repeat = input_tensors->count("allowed_words_repeat")
+                                      && input_tensors->at("allowed_words_repeat").getVal<bool>();
+            trie->reset(new TokenTrie(TokenTrie::fromWordList(word_list.getPtr<const int>(), word_list.shape[1])));
+            matcher->reset(new TokenTrieMatcher(trie->get(), mode, num_rows, end_id, allow_repeat));
+        }
+        for (size_t row = row_offset; row < row_offset + local_rows; row++) {
+            (*matcher)->reset(row);
+        }
+    }
+    else {
+        FT_CHECK_WITH_INFO(*matcher != nullptr,
+                           fmtstr("%s must be given from the first generation step on.", name));
+        std::vector<int> tokens;
+        std::vector<int> parent_rows;
+        readLastStepTokens(output_tensors, input_tensors, &tokens, &parent_rows);
+        if (!parent_rows.empty()) {
+            (*matcher)->gather(parent_rows.data());
+        }
+        for (size_t row = 0; row < local_rows; row++) {
+            (*matcher)->update(row_offset + row, tokens[row]);
+        }
+    }
+
+    TokenTrieMask mask;
+    (*matcher)->getMask(&mask);
+    T* logits = (T*)input_tensors->at("logits").getPtrWithOffset(row_offset * vocab_size_padded_);
+    if (is_ban) {
+        std::vector<int> banned_ids;  // rows then tokens
+        for (size_t row = 0; row < local_rows; row++) {
+            banned_ids.insert(banned_ids.end(),
+                              mask.offsets[row_offset + row + 1] - mask.offsets[row_offset + row],
+                              (int)row);
+        }
+        const int num_banned = (int)banned_ids.size();
+        if (num_banned == 0) {
+            return;
+        }
+        banned_ids.insert(banned_ids.end(),
+                          mask.tokens.begin() + mask.offsets[row_offset],
+                          mask.tokens.begin() + mask.offsets[row_offset + local_rows]);
+        banned_ids_buf_ = (int*)allocator_->reMalloc(banned_ids_buf_, sizeof(int) * banned_ids.size(), false);
+        cudaH2Dcpy(banned_ids_buf_, banned_ids.data(), banned_ids.size());
+        invokeBanTokens(logits, banned_ids_buf_, banned_ids_buf_ + num_banned, num_banned, vocab_size_padded_, stream_);
+        return;
+    }
+
+    std::vector<int> rows;
+    std::vector<int> offsets(1, 0);
+    std::vector<int> allowed_tokens;
+    for (size_t row = 0; row < local_rows; row++) {
+        if (mask.unconstrained[row_offset + row]) {
+            continue;
+        }
+        // invokeAllowTokens looks the tokens up in a sorted list
+        const size_t begin = allowed_tokens.size();
+        allowed_tokens.insert(allowed_tokens.end(),
+                              mask.tokens.begin() + mask.offsets[row_offset + row],
+                              mask.tokens.begin() + mask.offsets[row_offset + row + 1]);
+        std::sort(allowed_tokens.begin() + begin, allowed_tokens.end());
+        allowed_tokens.erase(std::unique(allowed_tokens.begin() + begin, allowed_tokens.end()), allowed_tokens.end());
+        rows.push_back((int)row);
+        offsets.push_back((int)allowed_tokens.size());
+    }
+    const int num_constrained = (int)rows.size();
+    if (num_constrained == 0) {
+        return;
+    }
+    rows.insert(rows.end(), offsets.begin(), offsets.end());
+    rows.insert(rows.end(), allowed_tokens.begin(), allowed_tokens.end());
+    allowed_tokens_buf_ = (int*)allocator_->reMalloc(allowed_tokens_buf_, sizeof(int) * rows.size(), false);
+    cudaH2Dcpy(allowed_tokens_buf_, rows.data(), rows.size());
+    invokeAllowTokens(logits,
+                      allowed_tokens_buf_,
+                      allowed_tokens_buf_ + num_constrained,
+                      allowed_tokens_buf_ + 2 * num_constrained + 1,
+                      num_constrained,
+                      vocab_size_padded_,
+                      stream_);
+}
+
+// Copies the rows of a packed tensor [num_outer, num_rows, row_bytes] to a group tensor [num_outer, num_indices,
+// row_bytes], or back with scatter. Rows are only moved, so any type is copied as 4, 2 or 1-byte words.
+template<typename U>
+static void copyRows(void*        dst,
+                     const void*  src,
+                     const int*   indices,
+                     const size_t num_indices,
+                     const size_t num_outer,
+                     const size_t num_rows,
+                     const size_t row_bytes,
+                     const bool   scatter,
+                     cudaStream_t stream)
+{
+    if (scatter) {
+        invokeScatterRows(
+            (U*)dst, (const U*)src, indices, num_indices, num_outer, num_rows, row_bytes / sizeof(U), stream);
+    }
+    else {
+        invokeGatherRows(
+            (U*)dst, (const U*)src, indices, num_indices, num_outer, num_rows, row_bytes / sizeof(U), stream);
+    }
+}
+
+static void copyGroupRows(void*        dst,
+                          const void*  src,
+                          const int*   indices,
+                          const size_t num_indices,
+                          const size_t num_outer,
+                          const size_t num_rows,
+                          const size_t row_bytes,
+                          const bool   scatter,
+                          cudaStream_t stream)
+{
+    if (num_indices == 0 || num_outer == 0 || row_bytes == 0) {
+        return;
+    }
+    if (row_bytes % sizeof(int) == 0) {
+        copyRows<int>(dst, src, indices, num_indices, num_outer, num_rows, row_bytes, scatter, stream);
+    }
+    else if (row_bytes % sizeof(half) == 0) {
+        copyRows<half>(dst, src, indices, num_indices, num_outer, num_rows, row_bytes, scatter, stream);
+    }
+    else {
+        copyRows<bool>(dst, src, indices, num_indices, num_outer, num_rows, row_bytes, scatter, stream);
+    }
+}
+
+// Values of the requests of a group for a per-request argument [batch_size, ...] on cpu. Other tensors are shared by
+// the batch and returned as they are.
+static Tensor gatherRequestArg(const Tensor&                   tensor,
+                               const MixedDecodeGroup&         group,
+                               const size_t                    batch_size,
+                               std::vector<std::vector<char>>* storage)
+{
+    if (tensor.where != MEMORY_CPU || tensor.shape.empty() || tensor.shape[0] != batch_size || batch_size == 1) {
+        return tensor;
+    }
+    const size_t row_bytes = tensor.sizeBytes() / batch_size;
+    storage->emplace_back(group.requests.size() * row_bytes);
+    gatherRows(storage->back().data(),
+               (const char*)tensor.data,
+               group.requests.data(),
+               group.requests.size(),
+               1,
+               batch_size,
+               row_bytes);
+    std::vector<size_t> shape = tensor.shape;
+    shape[0]                  = group.requests.size();
+    return Tensor{MEMORY_CPU, tensor.type, shape, storage->back().data()};
+}
+
+template<typename T>
+void* DynamicDecodeLayer<T>::getMixedBuffer(const std::string& name, size_t size)
+{
+    // sized for the whole batch, so that every group reuses it
+    void*& buf = mixed_bufs_[name];
+    buf        = allocator_->reMalloc(buf, size, false);
+    return buf;
+}
+
+template<typename T>
+void DynamicDecodeLayer<T>::setupMixed(const size_t                                   batch_size,
+                                       const std::unordered_map<std::string, Tensor>* runtime_args)
+{
+    FT_LOG_DEBUG(__PRETTY_FUNCTION__);
+    const Tensor beam_widths = runtime_args->at("beam_widths");
+    FT_CHECK_WITH_INFO(beam_widths.where == MEMORY_CPU && beam_widths.type == TYPE_INT32
+                           && beam_widths.size() == batch_size,
+                       fmtstr("beam_widths must be [batch_size(%ld)] int on cpu, got %s",
+                              batch_size,
+                              beam_widths.toString().c_str()));
+    mixed_batch_.reset(new MixedDecodeBatch(beam_widths.getPtr<const int>(), batch_size));
+    FT_LOG_DEBUG("%s", mixed_batch_->toString().c_str());
+
+    // rows then requests of each group, the indices of the gathers of forward()
+    std::vector<int> indices;
+    mixed_index_offsets_.clear();
+    for (const MixedDecodeGroup& group : mixed_batch_->getGroups()) {
+        mixed_index_offsets_.push_back(indices.size());
+        indices.insert(indices.end(), group.rows.begin(), group.rows.end());
+        indices.insert(indices.end(), group.requests.begin(), group.requests.end());
+    }
+    mixed_indices_buf_ = (int*)allocator_->reMalloc(mixed_indices_buf_, sizeof(int) * indices.size(), false);
+    cudaH2Dcpy(mixed_indices_buf_, indices.data(), indices.size());
+
+    // The sampling layers only see the sampling requests. Beam search takes its arguments in forward().
+    const MixedDecodeGroup& sampling = mixed_batch_->getGroups()[0];
+    if (sampling.beam_width == 1) {
+        std::vector<std::vector<char>>          storage;
+        std::unordered_map<std::string, Tensor> sampling_args;
+        for (const auto& arg : *runtime_args) {
+            if (arg.first != "beam_widths") {
+                sampling_args.insert({arg.first, gatherRequestArg(arg.second, sampling, batch_size, &storage)});
+            }
+        }
+        topk_decode_->setup(sampling.requests.size(), 1, &sampling_args);
+        topp_decode_->setup(sampling.requests.size(), 1, &sampling_args);
+    }
+}
+
+template<typename T>
+void DynamicDecodeLayer<T>::forwardMixed(std::unordered_map<std::string, Tensor>*       output_tensors,
+                                         const std::unordered_map<std::string, Tensor>* input_tensors)
+{
+    // Decodes each group of MixedDecodeBatch with the uniform beam width path of forward(): the tensors of the group
+    // are gathered from the packed rows, decoded, and the rows written by the step are scattered back.
+    FT_LOG_DEBUG(__PRETTY_FUNCTION__);
+    FT_CHECK_WITH_INFO(mixed_batch_ != nullptr, "beam_widths must be given to setup() before forward().");
+    const MixedDecodeBatch& batch       = *mixed_batch_;
+    const size_t            batch_size  = batch.getBatchSize();
+    const size_t            num_rows    = batch.getNumRows();
+    const Tensor            beam_widths = input_tensors->at("beam_widths");
+    FT_CHECK_WITH_INFO(beam_widths.size() == batch_size
+                           && std::equal(batch.getBeamWidths().begin(),
+                                         batch.getBeamWidths().end(),
+                                         beam_widths.getPtr<const int>()),
+                       "beam_widths must be the ones given to setup().");
+    FT_CHECK_WITH_INFO(input_tensors->at("ite").getVal<int>() == 0
+                           && (size_t)input_tensors->at("local_batch_size").getVal<int>() == batch_size,
+                       "A mixed batch is decoded at once (ite = 0, local_batch_size = batch_size).");
+    FT_CHECK_WITH_INFO(
+        input_tensors->at("logits").shape.size() == 2 && input_tensors->at("logits").shape[0] == num_rows,
+        fmtstr("logits must be [num_rows(%ld), vocab_size_padded], got %s",
+               num_rows,
+               vec2str(input_tensors->at("logits").shape).c_str()));
+    FT_CHECK_WITH_INFO(output_tensors->count("output_top_logprobs") == 0
+                           && (input_tensors->count("no_repeat_ngram_size") == 0
+                               || input_tensors->at("no_repeat_ngram_size").getVal<int>() <= 0)
+                           && input_tensors->count("bad_words_trie") == 0
+                           && input_tensors->count("allowed_words_trie") == 0,
+                       "output_top_logprobs, no_repeat_ngram_size and the word tries are not supported with "
+                       "beam_widths.");
+
+    const int    step        = input_tensors->at("step").getVal<int>();
+    const int    gen_step    = step - input_tensors->at("max_input_length").getVal<int>();
+    const size_t max_seq_len = output_tensors->at("output_ids").shape[0];
+    bool         should_stop = true;
+
+    // inputs with a row per beam and with a row per request
+    const std::unordered_set<std::string> row_inputs     = {"logits", "input_lengths", "src_cache_indirection"};
+    const std::unordered_set<std::string> request_inputs = {
+        "end_id", "sequence_limit_length", "stop_words_list", "bad_words_list"};
+    // outputs [num_rows] read and written by the step, and [max_seq_len, num_rows] histories written at the step
+    const std::vector<std::string> state_outputs   = {"finished", "sequence_length", "cum_log_probs"};
+    const std::vector<std::string> history_outputs = {"output_ids", "parent_ids"};
+
+    for (size_t g = 0; g < batch.getGroups().size(); g++) {
+        const MixedDecodeGroup& group             = batch.getGroups()[g];
+        const size_t            num_requests      = group.requests.size();
+        const size_t            beam_width        = group.beam_width;
+        const size_t            group_rows        = group.rows.size();
+        const int*              rows              = mixed_indices_buf_ + mixed_index_offsets_[g];
+        const int*              requests          = rows + group_rows;
+        int                     ite               = 0;
+        int                     local_batch_size  = (int)num_requests;
+        bool                    group_should_stop = false;
+
+        std::vector<std::vector<char>>          storage;
+        std::unordered_map<std::string, Tensor> group_inputs{
+            {"ite", Tensor{MEMORY_CPU, TYPE_INT32, {1}, &ite}},
+            {"local_batch_size", Tensor{MEMORY_CPU, TYPE_INT32, {1}, &local_batch_size}}};
+        for (const auto& input : *input_tensors) {
+            const std::string& name   = input.first;
+            const Tensor&      tensor = input.second;
+            if (group_inputs.count(name) || name == "beam_widths"
+                || (name == "src_cache_indirection" && beam_width == 1)) {
+                continue;
+            }
+            const bool by_row     = row_inputs.count(name) > 0;
+            const bool by_request = request_inputs.count(name) > 0 && tensor.shape[0] == batch_size
+                                    && !(name == "bad_words_list" && tensor.shape.size() == 2);
+            if (!by_row && !by_request) {
+                group_inputs.insert({name, gatherRequestArg(tensor, group, batch_size, &storage)});
+                continue;
+            }
+            // [num_rows, ...] becomes [num_requests, beam_width, ...], [batch_size, ...] becomes [num_requests, ...]
+            const size_t        num_src_rows = by_row ? num_rows : batch_size;
+            std::vector<size_t> shape        = {num_requests};
+            if (by_row) {
+                shape.push_back(beam_width);
+            }
+            shape.insert(shape.end(), tensor.shape.begin() + 1, tensor.shape.end());
+            void* buf = getMixedBuffer(name, tensor.sizeBytes());
+            copyGroupRows(buf,
+                          tensor.data,
+                          by_row ? rows : requests,
+                          by_row ? group_rows : num_requests,
+                          1,
+                          num_src_rows,
+                          tensor.sizeBytes() / num_src_rows,
+                          false,
+                          stream_);
+            group_inputs.insert({name, Tensor{tensor.where, tensor.type, shape, buf}});
+        }
+
+        std::unordered_map<std::string, Tensor> group_outputs{
+            {"should_stop", Tensor{MEMORY_CPU, TYPE_BOOL, {1}, &group_should_stop}}};
+        for (const std::string& name : state_outputs) {
+            if (output_tensors->count(name)) {
+                const Tensor& tensor = output_tensors->at(name);
+                void*         buf    = getMixedBuffer(name, tensor.sizeBytes());
+                copyGroupRows(
+                    buf, tensor.data, rows, group_rows, 1, num_rows, Tensor::getTypeSize(tensor.type), false, stream_);
+                group_outputs.insert({name, Tensor{tensor.where, tensor.type, {group_rows}, buf}});
+            }
+        }
+        for (const std::string& name : history_outputs) {
+            if (output_tensors->count(name)) {
+                const Tensor& tensor = output_tensors->at(name);
+                void*         buf    = getMixedBuffer(name, tensor.sizeBytes());
+                copyGroupRows(buf, tensor.data, rows, group_rows, step, num_rows, sizeof(int), false, stream_);
+                group_outputs.insert(
+                    {name, Tensor{tensor.where, tensor.type, {max_seq_len, num_requests, beam_width}, buf}});
+            }
+        }
+        if (output_tensors->count("output_log_probs")) {
+            const Tensor& tensor = output_tensors->at("output_log_probs");
+            group_outputs.insert({"output_log_probs",
+                                  Tensor{tensor.where,
+                                         tensor.type,
+                                         {tensor.shape[0], group_rows},
+                                         getMixedBuffer("output_log_probs", tensor.sizeBytes())}});
+        }
+        if (beam_width > 1) {
+            const Tensor& tensor = output_tensors->at("tgt_cache_indirection");
+            const size_t  row    = tensor.sizeBytes() / num_rows;
+            void*         buf    = getMixedBuffer("tgt_cache_indirection", tensor.sizeBytes());
+            copyGroupRows(buf, tensor.data, rows, group_rows, 1, num_rows, row, false, stream_);
+            group_outputs.insert({"tgt_cache_indirection",
+                                  Tensor{tensor.where,
+                                         tensor.type,
+                                         {num_requests, beam_width, tensor.size() / num_rows},
+                                         buf}});
+        }
+
+        has_diff_runtime_args_ = hasDiffRuntimeArgs(&group_inputs);
+        forward(&group_outputs, &group_inputs);
+
+        for (const std::string& name : state_outputs) {
+            if (output_tensors->count(name)) {
+                const Tensor& tensor = output_tensors->at(name);
+                copyGroupRows((void*)tensor.data,
+                              group_outputs.at(name).data,
+                              rows,
+                              group_rows,
+                              1,
+                              num_rows,
+                              Tensor::getTypeSize(tensor.type),
+                              true,
+                              stream_);
+            }
+        }
+        for (const std::string& name : history_outputs) {
+            if (output_tensors->count(name)) {
+                copyGroupRows(output_tensors->at(name).getPtrWithOffset(step * num_rows),
+                              group_outputs.at(name).getPtrWithOffset(step * group_rows),
+                              rows,
+                              group_rows,
+                              1,
+                              num_rows,
+                              sizeof(int),
+                              true,
+                              stream_);
+            }
+        }
+        if (output_tensors->count("output_log_probs")) {
+            copyGroupRows(output_tensors->at("output_log_probs").getPtrWithOffset(gen_step * num_rows),
+                          group_outputs.at("output_log_probs").getPtrWithOffset(gen_step * group_rows),
+                          rows,
+                          group_rows,
+                          1,
+                          num_rows,
+                          sizeof(float),
+                          true,
+                          stream_);
+        }
+        if (beam_width > 1) {
+            const Tensor& tensor = output_tensors->at("tgt_cache_indirection");
+            copyGroupRows((void*)tensor.data,
+                          group_outputs.at("tgt_cache_indirection").data,
+                          rows,
+                          group_rows,
+                          1,
+                          num_rows,
+                          tensor.sizeBytes() / num_rows,
+                          true,
+                          stream_);
+        }
+        should_stop = should_stop && group_should_stop;
+    }
+
+    // the batch stops once every group does
+    if (input_tensors->count("sequence_limit_length")) {
+        *output_tensors->at("should_stop").getPtr<bool>() = should_stop;
+    }
+}
+
 template<typename T>
 bool DynamicDecodeLayer<T>::hasDiffRuntimeArgs(const std::unordered_map<std::string, Tensor>* input_tensors)
 {
@@ -16,12 +16,17 @@
 
 #pragma once
 
+#include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "src/fastertransformer/layers/BaseLayer.h"
 #include "src/fastertransformer/layers/DynamicDecodeBaseLayer.h"
 #include "src/fastertransformer/layers/sampling_layers/TopPSamplingLayer.h"
+#include "src/fastertransformer/utils/mixed_decode_batch.h"
+#include "src/fastertransformer/utils/ngram_index.h"
+#include "src/fastertransformer/utils/token_trie.h"
 
 namespace fastertransformer {
 
@@ -32,6 +37,21 @@ protected:
     void freeBuffer() override;
     void initialize();
     bool hasDiffRuntimeArgs(const std::unordered_map<std::string, Tensor>* input_tensors);
+    void readLastStepTokens(const std::unordered_map<std::string, Tensor>* output_tensors,
+                            const std::unordered_map<std::string, Tensor>* input_tensors,
+                            std::vector<int>*                              tokens,
+                            std::vector<int>*                              parent_rows);
+    void banRepeatedNgrams(std::unordered_map<std::string, Tensor>*       output_tensors,
+                           const std::unordered_map<std::string, Tensor>* input_tensors);
+    void applyTokenTrie(std::unordered_map<std::string, Tensor>*       output_tensors,
+                        const std::unordered_map<std::string, Tensor>* input_tensors,
+                        const TokenTrieMode                            mode,
+                        std::unique_ptr<TokenTrie>*                    trie,
+                        std::unique_ptr<TokenTrieMatcher>*             matcher);
+    void setupMixed(const size_t batch_size, const std::unordered_map<std::string, Tensor>* runtime_args);
+    void forwardMixed(std::unordered_map<std::string, Tensor>*       output_tensors,
+                      const std::unordered_map<std::string, Tensor>* input_tensors);
+    void* getMixedBuffer(const std::string& name, size_t size);
 
     DynamicDecodeBaseLayer* online_beamsearch_decode_;
     DynamicDecodeBaseLayer* beamsearch_decode_;
@@ -49,6 +69,25 @@ protected:
     bool has_diff_runtime_args_ = false;
     int* finished_sum_          = nullptr;
 
+    // n-grams of every beam for no_repeat_ngram_size, built at the first generation step
+    std::unique_ptr<NgramIndex> ngram_index_;
+    int*                        banned_ids_buf_ = nullptr;  // [2, num_banned], rows then tokens
+
+    // bad_words_trie and allowed_words_trie, matched against the generated tokens of every beam
+    std::unique_ptr<TokenTrie>        bad_words_trie_;
+    std::unique_ptr<TokenTrieMatcher> bad_words_matcher_;
+    std::unique_ptr<TokenTrie>        allowed_words_trie_;
+    std::unique_ptr<TokenTrieMatcher> allowed_words_matcher_;
+    int*                              allowed_tokens_buf_ = nullptr;  // rows, offsets then tokens of invokeAllowTokens
+
+    int* num_top_logprobs_buf_ = nullptr;  // [batch_size], alternatives of each request for output_top_logprobs
+
+    // requests with their own beam width (beam_widths), decoded group by group
+    std::unique_ptr<MixedDecodeBatch>      mixed_batch_;
+    int*                                   mixed_indices_buf_ = nullptr;  // rows then requests of each group
+    std::vector<size_t>                    mixed_index_offsets_;          // offset of each group in mixed_indices_buf_
+    std::unordered_map<std::string, void*> mixed_bufs_;                   // tensors of the group being decoded
+
 public:
     DynamicDecodeLayer(size_t           vocab_size,
                        size_t           vocab_size_padded,
@@ -56,7 +56,10 @@ void fusedQKV_masked_attention_dispatch(const T*     qkv_buf,
                                         const float  q_scaling,
                                         const int    relative_attention_bias_stride,
                                         const bool*  masked_tokens,
-                                        cudaStream_t stream)
+                                        cudaStream_t stream,
+                                        const int*   block_table,
+                                        const int    kv_block_size,
+                                        const int    max_blocks_per_seq)
 {
     using DataType = typename SATypeConverter<T>::Type;
     // Prepare the parameters.
@@ -109,6 +112,14 @@ void fusedQKV_masked_attention_dispatch(const T*     qkv_buf,
     params.relative_attention_bias_stride = relative_attention_bias_stride;
     params.masked_tokens                  = masked_tokens;
 
+    if (block_table != nullptr) {
+        FT_CHECK_WITH_INFO(cache_indir == nullptr, "The paged KV cache does not use cache indirections.");
+        FT_CHECK(kv_block_size > 0 && memory_max_len == max_blocks_per_seq * kv_block_size);
+        params.block_table        = block_table;
+        params.kv_block_size      = kv_block_size;
+        params.max_blocks_per_seq = max_blocks_per_seq;
+    }
+
     masked_multihead_attention(params, stream);
 }
 
@@ -137,7 +148,10 @@ template void fusedQKV_masked_attention_dispatch(const float* qkv_buf,
                                                  const float  q_scaling,
                                                  const int    relative_attention_bias_stride,
                                                  const bool*  masked_tokens,
-                                                 cudaStream_t stream);
+                                                 cudaStream_t stream,
+                                                 const int*   block_table,
+                                                 const int    kv_block_size,
+                                                 const int    max_blocks_per_seq);
 
 template void fusedQKV_masked_attention_dispatch(const half*  qkv_buf,
                                                  const half*  qkv_bias,
@@ -164,7 +178,10 @@ template void fusedQKV_masked_attention_dispatch(const half*  qkv_buf,
                                                  const float  q_scaling,
                                                  const int    relative_attention_bias_stride,
                                                  const bool*  masked_tokens,
-                                                 cudaStream_t stream);
+                                                 cudaStream_t stream,
+                                                 const int*   block_table,
+                                                 const int    kv_block_size,
+                                                 const int    max_blocks_per_seq);
 
 template<typename T>
 void DecoderSelfAttentionLayer<T>::allocateBuffer()
@@ -431,14 +448,17 @@ void DecoderSelfAttentionLayer<T>::forward(std::vector<fastertransformer::Tensor
     //      cache_indirection [batch_size / beam_width, beam_width, memory_max_len]
     //      masked_tokens [batch_size, memory_len]
     //      relative_attention_bias [1, head_num, step, step] or [1, head_num, max_seq_len, max_seq_len] (option)
+    //      block_table [batch_size, max_blocks_per_seq] (option, paged cache, cache_indirection must be empty)
 
     // output tensors:
     //      attention_output [batch_size, d_model_],
     //      key_cache [batch, local_head_num, size_per_head // x, memory_max_len, x]
+    //                or [num_blocks, local_head_num, size_per_head // x, block_size, x] when paged
     //      value_cache [batch, local_head_num, memory_max_len, size_per_head]
+    //                  or [num_blocks, local_head_num, block_size, size_per_head] when paged
 
     FT_LOG_DEBUG(__PRETTY_FUNCTION__);
-    FT_CHECK(input_tensors->size() == 10 || input_tensors->size() == 11);
+    FT_CHECK(input_tensors->size() >= 10 && input_tensors->size() <= 12);
     FT_CHECK(output_tensors->size() == 3);
     FT_CHECK(output_tensors->at(1).shape.size() == 5 || output_tensors->at(1).shape.size() == 3);
     FT_CHECK(output_tensors->at(2).shape.size() == 4 || output_tensors->at(2).shape.size() == 3);
@@ -449,8 +469,9 @@ void DecoderSelfAttentionLayer<T>::forward(std::vector<fastertransformer::Tensor
     const int*  sequence_lengths        = input_tensors->at(2).getPtr<int>();
     const int*  cache_indir             = input_tensors->at(8).getPtr<int>();
     const bool* masked_tokens           = input_tensors->at(9).getPtr<bool>();
-    const T*    relative_attention_bias = input_tensors->size() == 11 ? input_tensors->at(10).getPtr<T>() : nullptr;
-    const int   relative_attention_bias_stride = input_tensors->size() == 11 ? input_tensors->at(10).shape[3] : 0;
+    const T*    relative_attention_bias = input_tensors->size() > 10 ? input_tensors->at(10).getPtr<T>() : nullptr;
+    const int   relative_attention_bias_stride = relative_attention_bias != nullptr ? input_tensors->at(10).shape[3] : 0;
+    const int*  block_table = input_tensors->size() > 11 ? input_tensors->at(11).getPtr<int>() : nullptr;
 
     T* attention_out = (T*)(output_tensors->at(0).data);
     T* key_cache     = (T*)(output_tensors->at(1).data);
@@ -458,7 +479,11 @@ void DecoderSelfAttentionLayer<T>::forward(std::vector<fastertransformer::Tensor
 
     const int batch_size     = input_tensors->at(0).shape[0];
     const int beam_width     = input_tensors->at(8).shape[1];
-    const int memory_max_len = output_tensors->at(1).shape[3];
+    // a paged cache holds blocks of block_size timesteps, a sequence holds at most max_blocks_per_seq of them
+    const int kv_block_size      = block_table != nullptr ? output_tensors->at(1).shape[3] : 0;
+    const int max_blocks_per_seq = block_table != nullptr ? input_tensors->at(11).shape[1] : 0;
+    const int memory_max_len =
+        block_table != nullptr ? max_blocks_per_seq * kv_block_size : output_tensors->at(1).shape[3];
 
     const int* d_prefix_prompt_lengths  = input_tensors->at(4).getPtr<int>();
     const int  max_prefix_prompt_length = input_tensors->at(5).getVal<int>();
@@ -538,7 +563,10 @@ void DecoderSelfAttentionLayer<T>::forward(std::vector<fastertransformer::Tensor
         q_scaling_,
         relative_attention_bias_stride,
         masked_tokens,
-        stream_);
+        stream_,
+        block_table,
+        kv_block_size,
+        max_blocks_per_seq);
     sync_check_cuda_error();
 
 #ifdef SPARSITY_ENABLED
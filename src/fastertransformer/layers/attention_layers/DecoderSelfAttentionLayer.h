@@ -165,6 +165,9 @@ void fusedQKV_masked_attention_dispatch(const T*     qkv_buf,
                                         const float  q_scaling,
                                         const int    relative_attention_bias_stride,
                                         const bool*  masked_tokens,
-                                        cudaStream_t stream);
+                                        cudaStream_t stream,
+                                        const int*   block_table        = nullptr,
+                                        const int    kv_block_size      = 0,
+                                        const int    max_blocks_per_seq = 0);
 
 }  // namespace fastertransformer
@@ -34,11 +34,14 @@ void GptContextAttentionLayer<T>::forward(std::vector<fastertransformer::Tensor>
     //      d_prefix_prompt_lengths [batch_size], int
     //      layer_id [1], int on cpu
     //      padding_offset, int, [token_num]
+    //      block_table [batch_size, max_blocks_per_seq], int (optional, paged cache)
 
     // output_tensors:
     //      attention_out [token_num, hidden_dimension]
     //      key_cache [batch, local_head_num, size_per_head // x, max_seq_len, x]
+    //                or [num_blocks, local_head_num, size_per_head // x, block_size, x] when paged
     //      value_cache [batch, local_head_num, max_seq_len, size_per_head]
+    //                  or [num_blocks, local_head_num, block_size, size_per_head] when paged
 
     FT_CHECK(input_tensors->size() >= 6);
     FT_CHECK(output_tensors->size() == 3);
@@ -50,7 +53,8 @@ void GptContextAttentionLayer<T>::forward(std::vector<fastertransformer::Tensor>
     const int  layer_id                = *(int*)input_tensors->at(5).data;
     const T**  d_prefix_prompt_batch   = (const T**)input_tensors->at(3).data;
     const int* d_prefix_prompt_lengths = (const int*)input_tensors->at(4).data;
-    const int* padding_offset          = input_tensors->size() == 7 ? input_tensors->at(6).getPtr<int>() : nullptr;
+    const int* padding_offset          = input_tensors->size() > 6 ? input_tensors->at(6).getPtr<int>() : nullptr;
+    const int* block_table             = input_tensors->size() > 7 ? input_tensors->at(7).getPtr<int>() : nullptr;
 
     allocateBuffer(request_batch_size, request_seq_len + max_prompt_length);
     sync_check_cuda_error();
@@ -121,20 +125,40 @@ void GptContextAttentionLayer<T>::forward(std::vector<fastertransformer::Tensor>
                                    stream_);
     sync_check_cuda_error();
 
-    const int max_seq_len = (int)(output_tensors->at(1).shape[3]);  // max output seq length
-    // Use batch major
-    // put k/v_buf from shape [B, H, PL + L, Dh]
-    // to cache [B, H, Dh/x, PL + L, x]  and [B, H, PL + L, Dh/x, x], PL denotes prompt length
-    invokeTranspose4dBatchMajor((T*)output_tensors->at(1).data,
-                                (T*)output_tensors->at(2).data,
-                                k_buf_2_,
-                                v_buf_2_,
-                                request_batch_size,
-                                max_prompt_length + request_seq_len,  // max input length + prefix prompt length
-                                max_seq_len,
-                                size_per_head_,
-                                local_head_num_,
-                                stream_);
+    if (block_table != nullptr) {
+        // put k/v_buf from shape [B, H, PL + L, Dh] to the blocks of the sequences
+        const int kv_block_size      = (int)(output_tensors->at(1).shape[3]);
+        const int max_blocks_per_seq = (int)(input_tensors->at(7).shape[1]);
+        FT_CHECK(max_prompt_length + request_seq_len <= max_blocks_per_seq * kv_block_size);
+        invokeTranspose4dBatchMajorPaged((T*)output_tensors->at(1).data,
+                                         (T*)output_tensors->at(2).data,
+                                         k_buf_2_,
+                                         v_buf_2_,
+                                         block_table,
+                                         max_blocks_per_seq,
+                                         kv_block_size,
+                                         request_batch_size,
+                                         max_prompt_length + request_seq_len,
+                                         size_per_head_,
+                                         local_head_num_,
+                                         stream_);
+    }
+    else {
+        const int max_seq_len = (int)(output_tensors->at(1).shape[3]);  // max output seq length
+        // Use batch major
+        // put k/v_buf from shape [B, H, PL + L, Dh]
+        // to cache [B, H, Dh/x, PL + L, x]  and [B, H, PL + L, Dh/x, x], PL denotes prompt length
+        invokeTranspose4dBatchMajor((T*)output_tensors->at(1).data,
+                                    (T*)output_tensors->at(2).data,
+                                    k_buf_2_,
+                                    v_buf_2_,
+                                    request_batch_size,
+                                    max_prompt_length + request_seq_len,  // max input length + prefix prompt length
+                                    max_seq_len,
+                                    size_per_head_,
+                                    local_head_num_,
+                                    stream_);
+    }
     // IDEA : after this, k_cache = (batch_size, num_heads, Dh/x, prefix_prompt_len + L, x)
     // k_cache = (batch_size, num_heads, prefix_prompt_len + L, Dh)
     sync_check_cuda_error();
@@ -227,9 +251,8 @@ void GptContextAttentionLayer<T>::forward(std::vector<fastertransformer::Tensor>
                                             attention_seq_len_1 * size_per_head_,
                                             request_batch_size * local_head_num_);
 
-        // transpose (batch_size, num_heads, L, Dh) to (batch_size, L, num_heads * Dh)
-        invokeTransposeQKV(
-            qkv_buf_3_, qkv_buf_2_, request_batch_size, attention_seq_len_1, local_head_num_, size_per_head_, stream_);
+        // transpose (batch_size, num_heads, L, Dh) to (batch_size, L, num_heads * Dh), or to the packed
+        // (token_num, num_heads * Dh) when the padding is removed
         if (padding_offset == nullptr) {
             invokeTransposeQKV(qkv_buf_3_,
                                qkv_buf_2_,
@@ -114,6 +114,7 @@ BaseBeamSearchLayer<T>::~BaseBeamSearchLayer()
 {
     FT_LOG_DEBUG(__PRETTY_FUNCTION__);
     freeBuffer();
+    freeHypothesesBuffer();
 }
 
 template<typename T>
@@ -125,6 +126,116 @@ void BaseBeamSearchLayer<T>::freeBuffer()
     }
 }
 
+template<typename T>
+void BaseBeamSearchLayer<T>::allocateHypothesesBuffer(size_t batch_size, size_t beam_width, size_t max_seq_len)
+{
+    FT_LOG_DEBUG(__PRETTY_FUNCTION__);
+    if (is_allocate_hyps_ && batch_size == hyps_batch_size_ && beam_width == hyps_beam_width_
+        && max_seq_len == hyps_max_seq_len_) {
+        return;
+    }
+    const size_t num_hyps = batch_size * beam_width;
+    hyps_.scores          = (float*)allocator_->reMalloc(hyps_.scores, sizeof(float) * num_hyps, false);
+    hyps_.cum_log_probs   = (float*)allocator_->reMalloc(hyps_.cum_log_probs, sizeof(float) * num_hyps, false);
+    hyps_.last_log_probs  = (float*)allocator_->reMalloc(hyps_.last_log_probs, sizeof(float) * num_hyps, false);
+    hyps_.lengths         = (int*)allocator_->reMalloc(hyps_.lengths, sizeof(int) * num_hyps, false);
+    hyps_.steps           = (int*)allocator_->reMalloc(hyps_.steps, sizeof(int) * num_hyps, false);
+    hyps_.last_tokens     = (int*)allocator_->reMalloc(hyps_.last_tokens, sizeof(int) * num_hyps, false);
+    hyps_.parent_beams    = (int*)allocator_->reMalloc(hyps_.parent_beams, sizeof(int) * num_hyps, false);
+    hyps_.num_hyps        = (int*)allocator_->reMalloc(hyps_.num_hyps, sizeof(int) * batch_size, true);
+    hyps_.is_done         = (bool*)allocator_->reMalloc(hyps_.is_done, sizeof(bool) * batch_size, true);
+    hyps_.tokens          = (int*)allocator_->reMalloc(hyps_.tokens, sizeof(int) * num_hyps * max_seq_len, false);
+    hyps_.log_probs = (float*)allocator_->reMalloc(hyps_.log_probs, sizeof(float) * num_hyps * max_seq_len, false);
+    hyps_.candidate_ids = (int*)allocator_->reMalloc(hyps_.candidate_ids, sizeof(int) * 2 * num_hyps, false);
+    hyps_.candidate_cum_log_probs =
+        (float*)allocator_->reMalloc(hyps_.candidate_cum_log_probs, sizeof(float) * 2 * num_hyps, false);
+
+    hyps_batch_size_  = batch_size;
+    hyps_beam_width_  = beam_width;
+    hyps_max_seq_len_ = max_seq_len;
+    is_allocate_hyps_ = true;
+}
+
+template<typename T>
+void BaseBeamSearchLayer<T>::freeHypothesesBuffer()
+{
+    if (is_allocate_hyps_) {
+        allocator_->free((void**)(&hyps_.scores));
+        allocator_->free((void**)(&hyps_.cum_log_probs));
+        allocator_->free((void**)(&hyps_.last_log_probs));
+        allocator_->free((void**)(&hyps_.lengths));
+        allocator_->free((void**)(&hyps_.steps));
+        allocator_->free((void**)(&hyps_.last_tokens));
+        allocator_->free((void**)(&hyps_.parent_beams));
+        allocator_->free((void**)(&hyps_.num_hyps));
+        allocator_->free((void**)(&hyps_.is_done));
+        allocator_->free((void**)(&hyps_.tokens));
+        allocator_->free((void**)(&hyps_.log_probs));
+        allocator_->free((void**)(&hyps_.candidate_ids));
+        allocator_->free((void**)(&hyps_.candidate_cum_log_probs));
+        is_allocate_hyps_ = false;
+    }
+}
+
+template<typename T>
+void BaseBeamSearchLayer<T>::prepareHypotheses(const std::unordered_map<std::string, Tensor>* output_tensors,
+                                               const std::unordered_map<std::string, Tensor>* input_tensors)
+{
+    const Tensor& output_ids       = output_tensors->at("output_ids");
+    const int     step             = input_tensors->at("step").getVal<int>();
+    const int     ite              = input_tensors->at("ite").getVal<int>();
+    const int     local_batch_size = input_tensors->at("logits").shape[0];
+    // the first generated token, the histories before it being the same for all beams
+    const int first_step = std::max(input_tensors->at("max_input_length").getVal<int>(), 1);
+    allocateHypothesesBuffer(output_ids.shape[1], output_ids.shape[2], output_ids.shape[0]);
+    if (step == first_step) {
+        cudaMemsetAsync(hyps_.num_hyps + ite * local_batch_size, 0, sizeof(int) * local_batch_size, stream_);
+        cudaMemsetAsync(hyps_.is_done + ite * local_batch_size, 0, sizeof(bool) * local_batch_size, stream_);
+    }
+}
+
+template<typename T>
+void BaseBeamSearchLayer<T>::updateHypotheses(std::unordered_map<std::string, Tensor>*       output_tensors,
+                                              const std::unordered_map<std::string, Tensor>* input_tensors)
+{
+    const Tensor& output_ids       = output_tensors->at("output_ids");
+    const int     step             = input_tensors->at("step").getVal<int>();
+    const int     ite              = input_tensors->at("ite").getVal<int>();
+    const int     local_batch_size = input_tensors->at("logits").shape[0];
+    const float   length_penalty =
+        input_tensors->count("len_penalty") ? input_tensors->at("len_penalty").getVal<float>() : 0.0f;
+    invokeUpdateBeamHypotheses(
+        hyps_,
+        output_ids.getPtr<int>(),
+        output_tensors->at("parent_ids").getPtr<int>(),
+        output_tensors->at("cum_log_probs").getPtr<float>(),
+        output_tensors->count("output_log_probs") ? output_tensors->at("output_log_probs").getPtr<float>() : nullptr,
+        output_tensors->at("finished").getPtr<bool>(),
+        output_tensors->at("sequence_length").getPtr<int>(),
+        input_tensors->at("end_id").getPtr<int>(),
+        input_tensors->count("sequence_limit_length") ?
+            input_tensors->at("sequence_limit_length").getPtr<const uint32_t>() :
+            nullptr,
+        output_ids.shape[1],
+        local_batch_size,
+        ite * local_batch_size,
+        output_ids.shape[2],
+        vocab_size_padded_,
+        step,
+        std::max(input_tensors->at("max_input_length").getVal<int>(), 1),
+        output_ids.shape[0],
+        length_penalty,
+        getBeamEarlyStopping(input_tensors->at("early_stopping").getVal<int>()),
+        stream_);
+    if (output_tensors->count("is_done")) {
+        cudaMemcpyAsync(output_tensors->at("is_done").getPtr<bool>(),
+                        hyps_.is_done + ite * local_batch_size,
+                        sizeof(bool) * local_batch_size,
+                        cudaMemcpyDeviceToDevice,
+                        stream_);
+    }
+}
+
 template<typename T>
 void BaseBeamSearchLayer<T>::setup(const size_t                                   batch_size,
                                    const size_t                                   beam_width,
@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include "src/fastertransformer/kernels/beam_hypotheses_kernels.h"
 #include "src/fastertransformer/layers/DynamicDecodeBaseLayer.h"
 
 namespace fastertransformer {
@@ -25,6 +26,15 @@ class BaseBeamSearchLayer: public DynamicDecodeBaseLayer {
 private:
     void freeBuffer();
 
+    // hypotheses of early stopping, kept across the steps so not freed with the other buffers
+    bool   is_allocate_hyps_ = false;
+    size_t hyps_batch_size_  = 0;
+    size_t hyps_beam_width_  = 0;
+    size_t hyps_max_seq_len_ = 0;
+
+    void allocateHypothesesBuffer(size_t batch_size, size_t beam_width, size_t max_seq_len);
+    void freeHypothesesBuffer();
+
 protected:
     // meta data
     size_t vocab_size_;
@@ -33,6 +43,8 @@ protected:
     size_t topk_softmax_workspace_size_;
     void*  topk_softmax_workspace_ = nullptr;
 
+    BeamHypothesesBuffers hyps_ = {};
+
     virtual void allocateBuffer()                                                            = 0;
     virtual void allocateBuffer(size_t batch_size, size_t beam_width)                        = 0;
     virtual void invokeSoftMax(std::vector<fastertransformer::Tensor>*       output_tensors,
@@ -40,6 +52,13 @@ protected:
     virtual void invokeSoftMax(std::unordered_map<std::string, Tensor>*       output_tensors,
                                const std::unordered_map<std::string, Tensor>* input_tensors) = 0;
 
+    // Early stopping, for invokeSoftMax with the early_stopping input: prepareHypotheses() before the candidates of the
+    // step are written to hyps_, then updateHypotheses() in place of the update of the beam states.
+    void prepareHypotheses(const std::unordered_map<std::string, Tensor>* output_tensors,
+                           const std::unordered_map<std::string, Tensor>* input_tensors);
+    void updateHypotheses(std::unordered_map<std::string, Tensor>*       output_tensors,
+                          const std::unordered_map<std::string, Tensor>* input_tensors);
+
 public:
     BaseBeamSearchLayer(size_t           max_batch_size,
                         size_t           head_num,
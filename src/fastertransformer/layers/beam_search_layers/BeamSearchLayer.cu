@@ -210,6 +210,8 @@ void BeamSearchLayer<T>::invokeSoftMax(std::unordered_map<std::string, Tensor>*
     //      temperature [1] on cpu, optional
     //      len_penalty [1] on cpu, optional
     //      repetition_penalty [1] on cpu, optional
+    //      early_stopping [1] on cpu, optional, int, see getBeamEarlyStopping
+    //      sequence_limit_length [batch_size], optional, bounds the steps of a request with early stopping
 
     // output_tensors:
     //      output_ids [max_seq_len, batch_size, beam_width]
@@ -219,6 +221,7 @@ void BeamSearchLayer<T>::invokeSoftMax(std::unordered_map<std::string, Tensor>*
     //      sequence_length [local_batch_size * beam_width]
     //      tgt_cache_indirection [local_batch_size, beam_width, max_seq_len]
     //      output_log_probs [local_batch_size * beam_width], optional
+    //      is_done [local_batch_size], optional, bool, whether the requests are done with early stopping
 
     FT_CHECK(input_tensors->size() >= 7);
     FT_CHECK(output_tensors->size() >= 6);
@@ -246,6 +249,24 @@ void BeamSearchLayer<T>::invokeSoftMax(std::unordered_map<std::string, Tensor>*
                                stream_);
     sync_check_cuda_error();
 
+    if (input_tensors->count("early_stopping")) {
+        prepareHypotheses(output_tensors, input_tensors);
+        invokeTopkBeamSearchCandidates<float>(topk_softmax_workspace_,
+                                              topk_softmax_workspace_size_,
+                                              float_log_prob_buf_,
+                                              hyps_.candidate_ids,
+                                              hyps_.candidate_cum_log_probs,
+                                              local_batch_size,
+                                              beam_width,
+                                              vocab_size_padded_,
+                                              diversity_rate,
+                                              stream_);
+        sync_check_cuda_error();
+        updateHypotheses(output_tensors, input_tensors);
+        sync_check_cuda_error();
+        return;
+    }
+
     invokeTopkBeamSearch<float>(
         topk_softmax_workspace_,
         topk_softmax_workspace_size_,
@@ -128,6 +128,8 @@ void OnlineBeamSearchLayer<T>::invokeSoftMax(std::unordered_map<std::string, Ten
     //      temperature [1] on cpu, optional
     //      len_penalty [1] on cpu, optional
     //      repetition_penalty [1] on cpu, optional
+    //      early_stopping [1] on cpu, optional, int, see getBeamEarlyStopping
+    //      sequence_limit_length [batch_size], optional, bounds the steps of a request with early stopping
 
     // output_tensors:
     //      output_ids [max_seq_len, batch_size, beam_width]
@@ -137,6 +139,7 @@ void OnlineBeamSearchLayer<T>::invokeSoftMax(std::unordered_map<std::string, Ten
     //      sequence_length [local_batch_size * beam_width]
     //      tgt_cache_indirection [local_batch_size, beam_width, max_seq_len]
     //      output_log_probs [local_batch_size * beam_width]
+    //      is_done [local_batch_size], optional, bool, whether the requests are done with early stopping
 
     FT_CHECK(input_tensors->size() >= 7);
     FT_CHECK(output_tensors->size() >= 6);
@@ -152,6 +155,28 @@ void OnlineBeamSearchLayer<T>::invokeSoftMax(std::unordered_map<std::string, Ten
     const float length_penalty =
         input_tensors->count("len_penalty") ? input_tensors->at("len_penalty").getVal<float>() : 0.0f;
 
+    if (input_tensors->count("early_stopping")) {
+        prepareHypotheses(output_tensors, input_tensors);
+        invokeTopkSoftMaxCandidates(input_tensors->at("logits").getPtr<T>(),
+                                    (const T*)(nullptr),
+                                    output_tensors->at("finished").getPtr<bool>(),
+                                    output_tensors->at("cum_log_probs").getPtr<float>(),
+                                    hyps_.candidate_ids,
+                                    hyps_.candidate_cum_log_probs,
+                                    topk_softmax_workspace_,
+                                    topk_softmax_workspace_size_,
+                                    local_batch_size,
+                                    beam_width,
+                                    vocab_size_padded_,
+                                    input_tensors->at("end_id").getPtr<int>(),
+                                    diversity_rate,
+                                    stream_);
+        sync_check_cuda_error();
+        updateHypotheses(output_tensors, input_tensors);
+        sync_check_cuda_error();
+        return;
+    }
+
     float* output_log_probs =
         output_tensors->count("output_log_probs") ? (float*)output_tensors->at("output_log_probs").data : nullptr;
     const int id_offset = step * batch_size * beam_width + local_batch_size * ite * beam_width;
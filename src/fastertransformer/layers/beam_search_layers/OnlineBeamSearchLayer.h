@@ -41,6 +41,9 @@ private:
     using BaseBeamSearchLayer<T>::stream_;
     using BaseBeamSearchLayer<T>::is_allocate_buffer_;
     using BaseBeamSearchLayer<T>::allocator_;
+    using BaseBeamSearchLayer<T>::hyps_;
+    using BaseBeamSearchLayer<T>::prepareHypotheses;
+    using BaseBeamSearchLayer<T>::updateHypotheses;
 
 protected:
 public:
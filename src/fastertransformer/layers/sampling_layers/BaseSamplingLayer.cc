@@ -16,6 +16,7 @@
  */
 
 #include "src/fastertransformer/layers/sampling_layers/BaseSamplingLayer.h"
+#include "src/fastertransformer/kernels/logprob_kernels.h"
 #include "src/fastertransformer/kernels/sampling_penalty_kernels.h"
 #include "src/fastertransformer/kernels/sampling_topk_kernels.h"
 #include "src/fastertransformer/utils/cuda_utils.h"
@@ -29,22 +30,35 @@ template<typename T>
 void BaseSamplingLayer<T>::allocateBuffer(size_t batch_size, Tensor top_k, Tensor top_p)
 {
     FT_LOG_DEBUG(__PRETTY_FUNCTION__);
-    curandstate_buf_ = reinterpret_cast<curandState_t*>(
-        allocator_->reMalloc(curandstate_buf_, sizeof(curandState_t) * batch_size, false));
     random_seeds_buf_ = reinterpret_cast<unsigned long long*>(
         allocator_->reMalloc(random_seeds_buf_, sizeof(unsigned long long) * batch_size, false));
+    random_steps_buf_ =
+        reinterpret_cast<int*>(allocator_->reMalloc(random_steps_buf_, sizeof(int) * batch_size, false));
     temperature_buf_ =
         reinterpret_cast<float*>(allocator_->reMalloc(temperature_buf_, sizeof(float) * batch_size, false));
     repetition_penalty_buf_ =
         reinterpret_cast<float*>(allocator_->reMalloc(repetition_penalty_buf_, sizeof(float) * batch_size, false));
+    presence_penalty_buf_ =
+        reinterpret_cast<float*>(allocator_->reMalloc(presence_penalty_buf_, sizeof(float) * batch_size, false));
+    frequency_penalty_buf_ =
+        reinterpret_cast<float*>(allocator_->reMalloc(frequency_penalty_buf_, sizeof(float) * batch_size, false));
     runtime_logits_buf_ = reinterpret_cast<T*>(
         allocator_->reMalloc(runtime_logits_buf_, sizeof(T) * batch_size * vocab_size_padded_, false));
     skip_decode_buf_ =
         reinterpret_cast<bool*>(allocator_->reMalloc(skip_decode_buf_, sizeof(bool) * batch_size, false));
 
-    // host buffers.
+    // host buffers, reallocated by every setup() for its batch size.
+    if (is_allocate_buffer_) {
+        delete[] temperature_;
+        delete[] repetition_penalty_;
+        delete[] presence_penalty_;
+        delete[] frequency_penalty_;
+        delete[] skip_decode_;
+    }
     temperature_        = new float[batch_size];
     repetition_penalty_ = new float[batch_size];
+    presence_penalty_   = new float[batch_size];
+    frequency_penalty_  = new float[batch_size];
     skip_decode_        = new bool[batch_size];
 
     is_allocate_buffer_ = true;
@@ -55,15 +69,23 @@ void BaseSamplingLayer<T>::freeBuffer()
 {
     FT_LOG_DEBUG(__PRETTY_FUNCTION__);
     if (is_allocate_buffer_) {
-        allocator_->free((void**)(&curandstate_buf_));
         allocator_->free((void**)(&random_seeds_buf_));
+        allocator_->free((void**)(&random_steps_buf_));
         allocator_->free((void**)(&temperature_buf_));
         allocator_->free((void**)(&repetition_penalty_buf_));
+        allocator_->free((void**)(&presence_penalty_buf_));
+        allocator_->free((void**)(&frequency_penalty_buf_));
+        allocator_->free((void**)(&token_counts_buf_));
+        allocator_->free((void**)(&prompt_tokens_buf_));
         allocator_->free((void**)(&runtime_logits_buf_));
         allocator_->free((void**)(&skip_decode_buf_));
         delete[] temperature_;
         delete[] repetition_penalty_;
+        delete[] presence_penalty_;
+        delete[] frequency_penalty_;
         delete[] skip_decode_;
+        // the token counts are rebuilt from output_ids
+        std::fill(token_counts_steps_.begin(), token_counts_steps_.end(), 0);
         is_allocate_buffer_ = false;
     }
 }
@@ -116,15 +138,16 @@ void BaseSamplingLayer<T>::setup(const size_t
     //     runtime_top_p [1] or [batch_size] on cpu, optional
     //     temperature [1] or [batch_size] on cpu, optional
     //     repetition_penalty [1] or [batch_size] on cpu, optional
+    //     presence_penalty [1] or [batch_size] on cpu, optional
+    //     frequency_penalty [1] or [batch_size] on cpu, optional
 
     FT_LOG_DEBUG(__PRETTY_FUNCTION__);
     Tensor runtime_top_k = runtime_args->count("runtime_top_k") ? runtime_args->at("runtime_top_k") : Tensor();
     Tensor runtime_top_p = runtime_args->count("runtime_top_p") ? runtime_args->at("runtime_top_p") : Tensor();
     allocateBuffer(batch_size, runtime_top_k, runtime_top_p);
 
-    // If runtime argument has single random seed, using this random seed to initialize the random table of all
-    // sentences. If the argument has [batch_size] random seeds, initializing the random table by different random seeds
-    // respectively. If no random seed, initialize the random table of all sentences by 0 directly.
+    // A single random seed is shared by all sentences, [batch_size] random seeds give each sentence its own, and the
+    // seed is 0 by default. The random numbers of a sentence only depend on its seed and step (see philox_random.h).
     if (runtime_args->count("random_seed")) {
         Tensor random_seeds = runtime_args->at("random_seed");
         FT_CHECK_WITH_INFO(random_seeds.shape.size() == 1
@@ -133,47 +156,44 @@ void BaseSamplingLayer<T>::setup(const size_t
                                   batch_size,
                                   vec2str(random_seeds.shape).c_str()));
         if (random_seeds.size() == 1) {
-            invokeCurandInitialize(curandstate_buf_, batch_size, random_seeds.getVal<unsigned long long>(), stream_);
-            sync_check_cuda_error();
+            deviceFill(random_seeds_buf_, batch_size, random_seeds.getVal<unsigned long long>(), stream_);
         }
         else {
             unsigned long long* random_seed_ptr = random_seeds.getPtr<unsigned long long>();
             cudaAutoCpy(random_seeds_buf_, random_seed_ptr, batch_size, stream_);
-            invokeCurandBatchInitialize(curandstate_buf_, batch_size, random_seeds_buf_, stream_);
-            sync_check_cuda_error();
         }
+        sync_check_cuda_error();
     }
     else {
-        // Initialize curand states using the default seed 0.
-        invokeCurandInitialize(curandstate_buf_, batch_size, 0, stream_);
+        deviceFill(random_seeds_buf_, batch_size, 0ULL, stream_);
     }
 
     // Setup penalties.
-    const float default_temperature = 1.0f;
-    Tensor      temperature         = runtime_args->count("temperature") ? runtime_args->at("temperature") :
-                                                                           Tensor(MEMORY_CPU, TYPE_FP32, {1}, &default_temperature);
-    if (temperature.size() == 1) {
-        float tp = temperature.getVal<float>();
-        deviceFill(temperature_buf_, batch_size, tp, stream_);
-        std::fill_n(temperature_, batch_size, tp);
-    }
-    else {
-        cudaAutoCpy(temperature_buf_, temperature.getPtr<float>(), batch_size, stream_);
-        std::copy_n(temperature.getPtr<float>(), batch_size, temperature_);
-    }
+    setupPenalty(runtime_args, "temperature", 1.0f, batch_size, temperature_buf_, temperature_);
+    setupPenalty(runtime_args, "repetition_penalty", 1.0f, batch_size, repetition_penalty_buf_, repetition_penalty_);
+    setupPenalty(runtime_args, "presence_penalty", 0.0f, batch_size, presence_penalty_buf_, presence_penalty_);
+    setupPenalty(runtime_args, "frequency_penalty", 0.0f, batch_size, frequency_penalty_buf_, frequency_penalty_);
+    token_counts_steps_.assign(batch_size, 0);
+}
 
-    const float default_repetition_penalty = 1.0f;
-    Tensor      repetition_penalty         = runtime_args->count("repetition_penalty") ?
-                                                 runtime_args->at("repetition_penalty") :
-                                                 Tensor(MEMORY_CPU, TYPE_FP32, {1}, &default_repetition_penalty);
-    if (repetition_penalty.size() == 1) {
-        float rp = repetition_penalty.getVal<float>();
-        deviceFill(repetition_penalty_buf_, batch_size, rp, stream_);
-        std::fill_n(repetition_penalty_, batch_size, rp);
+template<typename T>
+void BaseSamplingLayer<T>::setupPenalty(const std::unordered_map<std::string, Tensor>* runtime_args,
+                                        const std::string&                             name,
+                                        const float                                    default_value,
+                                        const size_t                                   batch_size,
+                                        float*                                         buf,
+                                        float*                                         host)
+{
+    Tensor penalty =
+        runtime_args->count(name) ? runtime_args->at(name) : Tensor(MEMORY_CPU, TYPE_FP32, {1}, &default_value);
+    if (penalty.size() == 1) {
+        float value = penalty.getVal<float>();
+        deviceFill(buf, batch_size, value, stream_);
+        std::fill_n(host, batch_size, value);
     }
     else {
-        cudaAutoCpy(repetition_penalty_buf_, repetition_penalty.getPtr<float>(), batch_size, stream_);
-        std::copy_n(repetition_penalty.getPtr<float>(), batch_size, repetition_penalty_);
+        cudaAutoCpy(buf, penalty.getPtr<float>(), batch_size, stream_);
+        std::copy_n(penalty.getPtr<float>(), batch_size, host);
     }
 }
 
@@ -224,6 +244,8 @@ void BaseSamplingLayer<T>::forward(std::unordered_map<std::string, Tensor>*
     //      max_input_length [1] on cpu
     //      input_lengths [local_batch_size]
     //      ite [1] on cpu
+    //      random_steps [local_batch_size] on cpu, optional, int
+    //          the generation steps of the rows, step - max_input_length for every row by default
 
     // output_tensors:
     //      output_ids [max_seq_len, batch_size]
@@ -237,9 +259,7 @@ void BaseSamplingLayer<T>::forward(std::unordered_map<std::string, Tensor>*
     FT_LOG_DEBUG(__PRETTY_FUNCTION__);
     FT_CHECK(input_tensors->size() >= 6);
     FT_CHECK(output_tensors->size() >= 3);
-    const int batch_size       = output_tensors->at("output_ids").shape[1];
     const int local_batch_size = input_tensors->at("logits").shape[0];
-    const int step             = input_tensors->at("step").getVal<int>();
     const int ite              = input_tensors->at("ite").getVal<int>();
     T*        logits           = input_tensors->at("logits").getPtr<T>();
 
@@ -272,22 +292,24 @@ void BaseSamplingLayer<T>::forward(std::unordered_map<std::string, Tensor>*
     }
     sync_check_cuda_error();
 
-    if (step > 1 && !ALL_OF(repetition_penalty_ + ite * local_batch_size, local_batch_size, float, 1.0f)) {
-        invokeBatchApplyRepetitionPenalty(
-            logits,
-            repetition_penalty_buf_ + ite * local_batch_size,
-            output_tensors->at("output_ids").getPtrWithOffset<int>(ite * local_batch_size),
-            batch_size,
-            local_batch_size,
-            vocab_size_padded_,
-            input_tensors->at("input_lengths").getPtr<int>(),
-            input_tensors->at("max_input_length").getVal<int>(),
-            step,
-            stream_);
-        sync_check_cuda_error();
+    const int offset = ite * local_batch_size;
+    if (!ALL_OF(repetition_penalty_ + offset, local_batch_size, float, 1.0f)
+        || !ALL_OF(presence_penalty_ + offset, local_batch_size, float, 0.0f)
+        || !ALL_OF(frequency_penalty_ + offset, local_batch_size, float, 0.0f)) {
+        applyPenalties(logits, output_tensors, input_tensors);
     }
 #undef ALL_OF
 
+    if (input_tensors->count("random_steps")) {
+        cudaAutoCpy(
+            random_steps_buf_ + offset, input_tensors->at("random_steps").getPtr<int>(), local_batch_size, stream_);
+    }
+    else {
+        const int random_step =
+            input_tensors->at("step").getVal<int>() - input_tensors->at("max_input_length").getVal<int>();
+        deviceFill(random_steps_buf_ + offset, local_batch_size, random_step, stream_);
+    }
+
     runSampling(output_tensors, input_tensors);
 
     if (is_free_buffer_after_forward_) {
@@ -296,6 +318,99 @@ void BaseSamplingLayer<T>::forward(std::unordered_map<std::string, Tensor>*
     sync_check_cuda_error();
 }
 
+template<typename T>
+void BaseSamplingLayer<T>::applyPenalties(T*                                             logits,
+                                          std::unordered_map<std::string, Tensor>*       output_tensors,
+                                          const std::unordered_map<std::string, Tensor>* input_tensors)
+{
+    FT_LOG_DEBUG(__PRETTY_FUNCTION__);
+    const int batch_size       = output_tensors->at("output_ids").shape[1];
+    const int local_batch_size = input_tensors->at("logits").shape[0];
+    const int step             = input_tensors->at("step").getVal<int>();
+    const int ite              = input_tensors->at("ite").getVal<int>();
+    const int offset           = ite * local_batch_size;
+    FT_CHECK(token_counts_steps_.size() >= (size_t)(offset + local_batch_size));
+
+    token_counts_buf_ = reinterpret_cast<int*>(
+        allocator_->reMalloc(token_counts_buf_, sizeof(int) * batch_size * vocab_size_padded_, false));
+    prompt_tokens_buf_ = reinterpret_cast<bool*>(
+        allocator_->reMalloc(prompt_tokens_buf_, sizeof(bool) * batch_size * vocab_size_padded_, false));
+    int*  token_counts  = token_counts_buf_ + offset * vocab_size_padded_;
+    bool* prompt_tokens = prompt_tokens_buf_ + offset * vocab_size_padded_;
+
+    // the rows of a local batch are counted together, usually one new position per step
+    const int counted_step = token_counts_steps_[offset];
+    if (counted_step == 0) {
+        cudaMemsetAsync(token_counts, 0, sizeof(int) * local_batch_size * vocab_size_padded_, stream_);
+        cudaMemsetAsync(prompt_tokens, false, sizeof(bool) * local_batch_size * vocab_size_padded_, stream_);
+    }
+    invokeUpdateTokenCounts(token_counts,
+                            prompt_tokens,
+                            output_tensors->at("output_ids").getPtrWithOffset<int>(offset),
+                            batch_size,
+                            local_batch_size,
+                            vocab_size_padded_,
+                            input_tensors->at("input_lengths").getPtr<int>(),
+                            input_tensors->at("max_input_length").getVal<int>(),
+                            counted_step,
+                            step,
+                            stream_);
+    std::fill_n(token_counts_steps_.begin() + offset, local_batch_size, std::max(counted_step, step));
+
+    invokeBatchApplyTokenCountPenalty(logits,
+                                      token_counts,
+                                      prompt_tokens,
+                                      repetition_penalty_buf_ + offset,
+                                      presence_penalty_buf_ + offset,
+                                      frequency_penalty_buf_ + offset,
+                                      local_batch_size,
+                                      vocab_size_,
+                                      vocab_size_padded_,
+                                      stream_);
+    sync_check_cuda_error();
+}
+
+template<typename T>
+void BaseSamplingLayer<T>::computeTopLogProbs(std::unordered_map<std::string, Tensor>*       output_tensors,
+                                              const std::unordered_map<std::string, Tensor>* input_tensors,
+                                              const T*                                       logits,
+                                              const bool                                     is_probs)
+{
+    // input_tensors:
+    //      num_top_logprobs [local_batch_size] on gpu, optional, int
+    //          The number of alternatives of each request, all of them when not given.
+    //      ite [1] on cpu
+
+    // output_tensors:
+    //      output_top_logprobs [local_batch_size, num_top_logprobs], must be float*, optional
+    //          The log probs of the most likely tokens at the current step, in decreasing order.
+    //      output_top_logprob_ids [local_batch_size, num_top_logprobs], must be int*
+    //          Their token ids. Entries after the number of alternatives of a request are -1 with a log prob of -inf.
+
+    if (output_tensors->count("output_top_logprobs") == 0) {
+        return;
+    }
+    FT_LOG_DEBUG(__PRETTY_FUNCTION__);
+    const Tensor top_logprobs     = output_tensors->at("output_top_logprobs");
+    const int    local_batch_size = top_logprobs.shape[0];
+    const int    ite              = input_tensors->at("ite").getVal<int>();
+    FT_CHECK_WITH_INFO(output_tensors->count("output_top_logprob_ids") > 0,
+                       "output_top_logprob_ids must be given with output_top_logprobs.");
+    invokeTopLogProbs(output_tensors->at("output_top_logprob_ids").getPtr<int>(),
+                      top_logprobs.getPtr<float>(),
+                      logits,
+                      input_tensors->count("num_top_logprobs") ? input_tensors->at("num_top_logprobs").getPtr<int>() :
+                                                                 nullptr,
+                      skip_decode_buf_ + ite * local_batch_size,
+                      top_logprobs.shape[1],
+                      local_batch_size,
+                      vocab_size_,
+                      vocab_size_padded_,
+                      is_probs,
+                      stream_);
+    sync_check_cuda_error();
+}
+
 template class BaseSamplingLayer<float>;
 template class BaseSamplingLayer<half>;
 
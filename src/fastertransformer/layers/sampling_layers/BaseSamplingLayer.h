@@ -17,8 +17,6 @@
 
 #pragma once
 
-#include <curand_kernel.h>
-
 #include "src/fastertransformer/layers/DynamicDecodeBaseLayer.h"
 
 namespace fastertransformer {
@@ -27,6 +25,13 @@ template<typename T>
 class BaseSamplingLayer: public DynamicDecodeBaseLayer {
 private:
     bool isValidBatchSize(size_t batch_size);
+    // Sets buf [batch_size] on gpu and host [batch_size] from the runtime argument `name`, [1] or [batch_size].
+    void setupPenalty(const std::unordered_map<std::string, Tensor>* runtime_args,
+                      const std::string&                             name,
+                      const float                                    default_value,
+                      const size_t                                   batch_size,
+                      float*                                         buf,
+                      float*                                         host);
 
 protected:
     size_t vocab_size_;
@@ -34,24 +39,50 @@ protected:
 
     size_t              sampling_workspace_size_;
     void*               sampling_workspace_ = nullptr;
-    curandState_t*      curandstate_buf_    = nullptr;
     unsigned long long* random_seeds_buf_   = nullptr;
 
+    // Generation steps of the rows [batch_size], which key their random numbers with random_seeds_buf_. Set by
+    // forward() for the local batch before runSampling().
+    int* random_steps_buf_ = nullptr;
+
     float* temperature_buf_        = nullptr;
     float* repetition_penalty_buf_ = nullptr;
+    float* presence_penalty_buf_   = nullptr;
+    float* frequency_penalty_buf_  = nullptr;
     bool*  skip_decode_buf_        = nullptr;
     T*     runtime_logits_buf_     = nullptr;
 
     float* temperature_        = nullptr;
     float* repetition_penalty_ = nullptr;
+    float* presence_penalty_   = nullptr;
+    float* frequency_penalty_  = nullptr;
     bool*  skip_decode_        = nullptr;
     bool   skip_any_           = false;
 
+    // Token count table of the penalties (see invokeUpdateTokenCounts), [batch_size, vocab_size_padded]. It is
+    // allocated by the first step using a penalty and caught up lazily with the positions of output_ids that each local
+    // batch has not counted yet, token_counts_steps_ [batch_size].
+    int*             token_counts_buf_  = nullptr;
+    bool*            prompt_tokens_buf_ = nullptr;
+    std::vector<int> token_counts_steps_;
+
     virtual void runSampling(std::vector<fastertransformer::Tensor>*       output_tensors,
                              const std::vector<fastertransformer::Tensor>* input_tensors)  = 0;
     virtual void runSampling(std::unordered_map<std::string, Tensor>*       output_tensors,
                              const std::unordered_map<std::string, Tensor>* input_tensors) = 0;
 
+    // Writes output_top_logprobs and output_top_logprob_ids when requested. logits are the logits the layer samples
+    // from, or their probabilities when is_probs.
+    void computeTopLogProbs(std::unordered_map<std::string, Tensor>*       output_tensors,
+                            const std::unordered_map<std::string, Tensor>* input_tensors,
+                            const T*                                       logits,
+                            const bool                                     is_probs);
+
+    // Applies the repetition, presence and frequency penalties from the token count table.
+    void applyPenalties(T*                                             logits,
+                        std::unordered_map<std::string, Tensor>*       output_tensors,
+                        const std::unordered_map<std::string, Tensor>* input_tensors);
+
     virtual void freeBuffer();
     virtual void allocateBuffer() = 0;
     virtual void allocateBuffer(size_t batch_size, Tensor top_k, Tensor top_p);
@@ -106,6 +106,7 @@ void TopKSamplingLayer<T>::allocateBuffer(size_t batch_size, Tensor top_k, Tenso
                           nullptr,
                           nullptr,
                           nullptr,
+                          nullptr,
                           max_top_k,
                           1.0f,
                           vocab_size_padded_,
@@ -241,6 +242,7 @@ void TopKSamplingLayer<T>::runSampling(std::unordered_map<std::string, Tensor>*
     //      max_input_length [1] on cpu
     //      input_lengths [local_batch_size]
     //      ite [1] on cpu
+    //      num_top_logprobs [local_batch_size], optional, int
 
     // output_tensors:
     //      output_ids [max_seq_len, batch_size]
@@ -250,6 +252,9 @@ void TopKSamplingLayer<T>::runSampling(std::unordered_map<std::string, Tensor>*
     //          The cumultative log probability of generated tokens.
     //      output_log_probs [local_batch_size], must be float*, optional
     //          The log probs at the current step.
+    //      output_top_logprobs [local_batch_size, num_top_logprobs], must be float*, optional
+    //      output_top_logprob_ids [local_batch_size, num_top_logprobs], must be int*, optional
+    //          The most likely tokens at the current step and their log probs.
 
     FT_LOG_DEBUG(__PRETTY_FUNCTION__);
     FT_CHECK(input_tensors->size() >= 6);
@@ -288,6 +293,9 @@ void TopKSamplingLayer<T>::runSampling(std::unordered_map<std::string, Tensor>*
                              stream_);
         sync_check_cuda_error();
     }
+    // the logits are probabilities when the log probs are computed
+    this->computeTopLogProbs(
+        output_tensors, input_tensors, logits, cum_log_probs != nullptr || output_log_probs != nullptr);
 
     invokeBatchTopKSampling(
         sampling_workspace_,
@@ -298,7 +306,8 @@ void TopKSamplingLayer<T>::runSampling(std::unordered_map<std::string, Tensor>*
         output_tensors->at("finished").getPtr<bool>(),
         cum_log_probs,
         output_log_probs,
-        curandstate_buf_ + ite * local_batch_size,
+        random_seeds_buf_ + ite * local_batch_size,
+        random_steps_buf_ + ite * local_batch_size,
         (int)runtime_max_top_k_,  // useless because runtime_top_k_buf_ is never nullptr. Keep for legacy.
         (int*)(runtime_top_k_buf_ + ite * local_batch_size),
         1.0f,  // useless because runtime_top_p_buf_ is never nullptr. Keep for legacy.
@@ -43,7 +43,8 @@ void TopKTopPSamplingLayer<T>::allocateBuffer(size_t batch_size, Tensor top_k, T
                            nullptr,      // finished_buf
                            nullptr,      // cum_log_probs
                            nullptr,      // output_log_probs
-                           nullptr,      // curandstate
+                           nullptr,      // random_seeds
+                           nullptr,      // random_steps
                            batch_size,
                            static_cast<int>(top_k.max<uint>()),
                            top_p.max<float>(),
@@ -188,7 +189,8 @@ void TopKTopPSamplingLayer<T>::runSampling(std::unordered_map<std::string, Tenso
                            (bool*)output_tensors->at("finished").data,
                            cum_log_probs,
                            output_log_probs,
-                           curandstate_buf_ + ite * local_batch_size,
+                           random_seeds_buf_ + ite * local_batch_size,
+                           random_steps_buf_ + ite * local_batch_size,
                            local_batch_size,
                            runtime_top_k,
                            runtime_top_p,
@@ -39,8 +39,8 @@ private:
 
     using BaseSamplingLayer<T>::sampling_workspace_size_;
     using BaseSamplingLayer<T>::sampling_workspace_;
-    using BaseSamplingLayer<T>::curandstate_buf_;
     using BaseSamplingLayer<T>::random_seeds_buf_;
+    using BaseSamplingLayer<T>::random_steps_buf_;
 
     using BaseSamplingLayer<T>::stream_;
     using BaseSamplingLayer<T>::allocator_;
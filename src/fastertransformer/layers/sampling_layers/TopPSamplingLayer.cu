@@ -87,7 +87,8 @@ void TopPSamplingLayer<T>::allocateBuffer(size_t batch_size, Tensor top_k, Tenso
                           topp_id_vals_buf_,
                           topp_offset_buf_,
                           begin_topp_offset_buf_,
-                          curandstate_buf_,
+                          random_seeds_buf_,
+                          random_steps_buf_,
                           batch_size,
                           vocab_size_padded_,
                           nullptr,
@@ -234,6 +235,7 @@ void TopPSamplingLayer<T>::runSampling(std::unordered_map<std::string, Tensor>*
     //      max_input_length [1] on cpu
     //      input_lengths [local_batch_size]
     //      ite [1] on cpu
+    //      num_top_logprobs [local_batch_size], optional, int
 
     // output_tensors:
     //      output_ids [max_seq_len, batch_size]
@@ -243,6 +245,9 @@ void TopPSamplingLayer<T>::runSampling(std::unordered_map<std::string, Tensor>*
     //          The cumultative log probability of generated tokens.
     //      output_log_probs [local_batch_size], must be float*, optional
     //          The log probs at the current step.
+    //      output_top_logprobs [local_batch_size, num_top_logprobs], must be float*, optional
+    //      output_top_logprob_ids [local_batch_size, num_top_logprobs], must be int*, optional
+    //          The most likely tokens at the current step and their log probs.
 
     FT_CHECK(input_tensors->size() >= 6);
     FT_CHECK(output_tensors->size() >= 3);
@@ -273,6 +278,7 @@ void TopPSamplingLayer<T>::runSampling(std::unordered_map<std::string, Tensor>*
         output_tensors->count("cum_log_probs") ? output_tensors->at("cum_log_probs").getPtr<float>() : nullptr;
     float* output_log_probs =
         output_tensors->count("output_log_probs") ? output_tensors->at("output_log_probs").getPtr<float>() : nullptr;
+    this->computeTopLogProbs(output_tensors, input_tensors, logits, true);
 
     invokeBatchTopPSampling<T>(
         sampling_workspace_,
@@ -287,7 +293,8 @@ void TopPSamplingLayer<T>::runSampling(std::unordered_map<std::string, Tensor>*
         topp_id_vals_buf_,
         topp_offset_buf_,
         begin_topp_offset_buf_,
-        curandstate_buf_ + ite * local_batch_size,
+        random_seeds_buf_ + ite * local_batch_size,
+        random_steps_buf_ + ite * local_batch_size,
         local_batch_size,
         vocab_size_padded_,
         input_tensors->at("end_id").getPtr<int>(),
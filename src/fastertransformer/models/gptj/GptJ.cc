@@ -18,6 +18,7 @@
 #include "src/fastertransformer/kernels/bert_preprocess_kernels.h"
 #include "src/fastertransformer/kernels/decoding_kernels.h"
 #include "src/fastertransformer/kernels/gpt_kernels.h"
+#include "src/fastertransformer/kernels/unfused_attention_kernels.h"
 #include "src/fastertransformer/layers/beam_search_layers/BaseBeamSearchLayer.h"
 #include <algorithm>
 
@@ -83,9 +84,13 @@ void GptJ<T>::allocateBuffer(
     size_t batch_size, size_t beam_width, size_t max_seq_len, size_t max_cache_seq_len, size_t max_input_len)
 {
     FT_LOG_DEBUG(__PRETTY_FUNCTION__);
-    const size_t batchxbeam      = batch_size * beam_width;
-    const size_t self_cache_size = (num_layer_ / pipeline_para_.world_size_) * batchxbeam * max_cache_seq_len
-                                   * hidden_units_ / tensor_para_.world_size_;
+    AllocatorTagScope allocator_tag("GptJ");
+    const size_t batchxbeam = batch_size * beam_width;
+    // the paged cache holds kv_num_blocks_ blocks instead of a max_cache_seq_len row per sequence
+    const size_t cache_tokens =
+        kv_block_size_ > 0 ? kv_num_blocks_ * kv_block_size_ : batchxbeam * max_cache_seq_len;
+    const size_t self_cache_size =
+        (num_layer_ / pipeline_para_.world_size_) * cache_tokens * hidden_units_ / tensor_para_.world_size_;
 
     if (vocab_size_ != vocab_size_padded_) {
         padded_embedding_kernel_ =
@@ -112,6 +117,7 @@ void GptJ<T>::allocateBuffer(
     finished_buf_     = (bool*)(allocator_->reMalloc(finished_buf_, sizeof(bool) * batchxbeam, false));
     sequence_lengths_ = (int*)(allocator_->reMalloc(sequence_lengths_, sizeof(int) * batchxbeam, false));
     masked_tokens_ = (bool*)(allocator_->reMalloc(masked_tokens_, sizeof(bool) * batchxbeam * max_cache_seq_len, true));
+    cancel_statuses_buf_ = (int*)(allocator_->reMalloc(cancel_statuses_buf_, sizeof(int) * batch_size, false));
 
     h_finished_buf_ = new bool[batchxbeam];
 
@@ -122,6 +128,11 @@ void GptJ<T>::allocateBuffer(
             cache_indirections_[0], sizeof(int) * batchxbeam * max_cache_seq_len * 2, true));
         cache_indirections_[1] = cache_indirections_[0] + batchxbeam * max_cache_seq_len;
     }
+    if (kv_block_size_ > 0) {
+        block_tables_buf_ =
+            (int*)(allocator_->reMalloc(block_tables_buf_, sizeof(int) * batchxbeam * max_blocks_per_seq_, true));
+        kv_block_copies_buf_ = (int*)(allocator_->reMalloc(kv_block_copies_buf_, sizeof(int) * batchxbeam * 2, false));
+    }
     tiled_total_padding_count_ =
         (int*)allocator_->reMalloc(tiled_total_padding_count_, batchxbeam * sizeof(int), false);
 
@@ -179,11 +190,14 @@ void GptJ<T>::freeBuffer()
         allocator_->free((void**)(&sequence_lengths_));
         allocator_->free((void**)(&finished_buf_));
         delete[] h_finished_buf_;
+        allocator_->free((void**)(&cancel_statuses_buf_));
 
         allocator_->free((void**)(&key_cache_));
         if (cache_indirections_[0] != nullptr) {
             allocator_->free((void**)(&cache_indirections_)[0]);
         }
+        allocator_->free((void**)(&block_tables_buf_));
+        allocator_->free((void**)(&kv_block_copies_buf_));
 
         allocator_->free((void**)(&prompt_learning_weight_batch_));
         allocator_->free((void**)(&tiled_prompt_lengths_buf_));
@@ -205,6 +219,12 @@ void GptJ<T>::freeBuffer()
         allocator_->free((void**)(&context_decoder_output_buf_));
         allocator_->free((void**)(&output_log_probs_buf_));
 
+        allocator_->free((void**)(&spec_prefix_kv_));
+        allocator_->free((void**)(&spec_prefix_kv_batch_));
+        allocator_->free((void**)(&spec_normed_hidden_buf_));
+        allocator_->free((void**)(&spec_logits_buf_));
+        allocator_->free((void**)(&spec_nccl_logits_buf_));
+
         cudaFreeHost(generation_should_stop_);
 
         is_allocate_buffer_ = false;
@@ -371,6 +391,176 @@ void GptJ<T>::unRegisterCallback()
     token_generated_ctx_ = nullptr;
 }
 
+template<typename T>
+void GptJ<T>::registerCancellation(RequestCancellation* cancellation)
+{
+    cancellation_ = cancellation;
+}
+
+template<typename T>
+void GptJ<T>::unRegisterCancellation()
+{
+    cancellation_ = nullptr;
+}
+
+template<typename T>
+void GptJ<T>::preparePagedKVCache(const size_t num_rows, const size_t num_tokens)
+{
+    FT_CHECK(kv_block_manager_ != nullptr && num_tokens <= max_blocks_per_seq_ * kv_block_size_);
+    std::vector<uint64_t> seq_ids(num_rows);
+    for (size_t i = 0; i < num_rows; i++) {
+        seq_ids[i] = i;
+        FT_CHECK_WITH_INFO(kv_block_manager_->reserveTokens(i, num_tokens),
+                           fmtstr("The paged KV cache is full: %ld blocks of %ld tokens cannot hold %ld tokens for "
+                                  "each of the %ld sequences, increase kv_cache_num_blocks.",
+                                  kv_num_blocks_,
+                                  kv_block_size_,
+                                  num_tokens,
+                                  num_rows));
+    }
+
+    const std::vector<KVBlockCopy> copies = kv_block_manager_->popPendingCopies();
+    if (!copies.empty()) {
+        FT_CHECK(copies.size() <= num_rows);
+        std::vector<int> h_copies;
+        h_copies.reserve(copies.size() * 2);
+        for (const KVBlockCopy& copy : copies) {
+            h_copies.push_back(copy.src_block);
+            h_copies.push_back(copy.dst_block);
+        }
+        cudaAutoCpy(kv_block_copies_buf_, h_copies.data(), h_copies.size(), stream_);
+        invokeCopyKVCacheBlocks(key_cache_,
+                                value_cache_,
+                                kv_block_copies_buf_,
+                                (int)copies.size(),
+                                (int)(num_layer_ / pipeline_para_.world_size_),
+                                (int)kv_num_blocks_,
+                                (int)kv_block_size_,
+                                (int)size_per_head_,
+                                (int)local_head_num_,
+                                stream_);
+        sync_check_cuda_error();
+    }
+
+    std::vector<int> h_block_tables(num_rows * max_blocks_per_seq_);
+    kv_block_manager_->fillBlockTables(seq_ids, max_blocks_per_seq_, h_block_tables.data());
+    cudaAutoCpy(block_tables_buf_, h_block_tables.data(), h_block_tables.size(), stream_);
+    // the host tables are released on return
+    check_cuda_error(cudaStreamSynchronize(stream_));
+}
+
+template<typename T>
+void GptJ<T>::reorderPagedKVCacheBeams(const size_t batch_size, const size_t beam_width, const int step)
+{
+    const size_t     batchxbeam = batch_size * beam_width;
+    std::vector<int> h_parent_ids(batchxbeam);
+    cudaAutoCpy(h_parent_ids.data(), parent_ids_buf_ + step * batchxbeam, batchxbeam, stream_);
+    check_cuda_error(cudaStreamSynchronize(stream_));
+
+    std::vector<uint64_t> seq_ids(batchxbeam);
+    std::vector<int>      parents(batchxbeam);
+    for (size_t i = 0; i < batchxbeam; i++) {
+        // parent_ids are beam indices within the batch entry
+        seq_ids[i] = i;
+        parents[i] = (int)((i / beam_width) * beam_width) + h_parent_ids[i];
+    }
+    kv_block_manager_->reorderSequences(seq_ids, parents);
+}
+
+template<typename T>
+void GptJ<T>::setPaddedEmbedding(const GptJWeight<T>* gpt_weights)
+{
+    if (vocab_size_ == vocab_size_padded_) {
+        padded_embedding_kernel_ptr_ = gpt_weights->post_decoder_embedding.kernel;
+        padded_embedding_bias_ptr_   = gpt_weights->post_decoder_embedding.bias;
+    }
+    else {
+        cudaMemcpyAsync(padded_embedding_kernel_,
+                        gpt_weights->post_decoder_embedding.kernel,
+                        sizeof(T) * vocab_size_ * hidden_units_,
+                        cudaMemcpyDeviceToDevice,
+                        stream_);
+        cudaMemcpyAsync(padded_embedding_bias_,
+                        gpt_weights->post_decoder_embedding.bias,
+                        sizeof(T) * vocab_size_,
+                        cudaMemcpyDeviceToDevice,
+                        stream_);
+        sync_check_cuda_error();
+    }
+}
+
+template<typename T>
+void GptJ<T>::computeLogits(float*               logits,
+                            float*               nccl_logits,
+                            T*                   normed_hidden_states,
+                            const T*             hidden_states,
+                            const size_t         num_rows,
+                            const GptJWeight<T>* gpt_weights)
+{
+    const cudaDataType_t gemm_data_type = getCudaDataType<T>();
+    invokeGeneralLayerNorm(normed_hidden_states,
+                           hidden_states,
+                           gpt_weights->post_decoder_layernorm.gamma,
+                           gpt_weights->post_decoder_layernorm.beta,
+                           layernorm_eps_,
+                           num_rows,
+                           hidden_units_,
+                           stream_);
+    sync_check_cuda_error();
+
+    if (tensor_para_.world_size_ == 1) {
+        float alpha = 1.0f;
+        float beta  = 0.0f;
+        cublas_wrapper_->Gemm(CUBLAS_OP_T,
+                              CUBLAS_OP_N,
+                              vocab_size_padded_,  // n
+                              num_rows,
+                              hidden_units_,  // k
+                              &alpha,
+                              padded_embedding_kernel_ptr_,
+                              gemm_data_type,
+                              hidden_units_,  // k
+                              normed_hidden_states,
+                              gemm_data_type,
+                              hidden_units_,  // k
+                              &beta,
+                              logits,
+                              CUDA_R_32F,
+                              vocab_size_padded_, /* n */
+                              CUDA_R_32F,
+                              cublasGemmAlgo_t(-1));
+    }
+    else {
+        FT_CHECK(vocab_size_padded_ % tensor_para_.world_size_ == 0);
+        const int local_vocab_size = vocab_size_padded_ / tensor_para_.world_size_;
+        float     alpha            = 1.0f;
+        float     beta             = 0.0f;
+        cublas_wrapper_->Gemm(CUBLAS_OP_T,
+                              CUBLAS_OP_N,
+                              local_vocab_size,  // n
+                              num_rows,
+                              hidden_units_,  // k
+                              &alpha,
+                              padded_embedding_kernel_ptr_ + tensor_para_.rank_ * local_vocab_size * hidden_units_,
+                              gemm_data_type,
+                              hidden_units_,  // k
+                              normed_hidden_states,
+                              gemm_data_type,
+                              hidden_units_,  // k
+                              &beta,
+                              nccl_logits + tensor_para_.rank_ * num_rows * local_vocab_size,
+                              CUDA_R_32F,
+                              local_vocab_size, /* n */
+                              CUDA_R_32F,
+                              cublasGemmAlgo_t(-1));
+        ftNcclAllGather(
+            nccl_logits, nccl_logits, num_rows * local_vocab_size, tensor_para_.rank_, tensor_para_, stream_);
+        invokeTransposeAxis01(logits, nccl_logits, tensor_para_.world_size_, num_rows, local_vocab_size, stream_);
+    }
+
+    invokeAddBias(logits, padded_embedding_bias_ptr_, num_rows, vocab_size_padded_, stream_);
+}
+
 template<typename T>
 void GptJ<T>::forward(std::vector<Tensor>*       output_tensors,
                       const std::vector<Tensor>* input_tensors,
@@ -399,11 +589,22 @@ void GptJ<T>::forward(std::unordered_map<std::string, Tensor>*       output_tens
     //      temperature [1] or [batch_size] on cpu, optional, float.
     //      len_penalty [1] or [batch_size] on cpu, optional, float.
     //      repetition_penalty [1] or [batch_size] on cpu, optional, float.
+    //      presence_penalty [1] or [batch_size] on cpu, optional, float. Sampling only.
+    //      frequency_penalty [1] or [batch_size] on cpu, optional, float. Sampling only.
+    //      no_repeat_ngram_size [1] on cpu, optional, int.
+    //      bad_words_trie [2, bad_words_length] on cpu, optional, int. Banned token sequences.
+    //      allowed_words_trie [2, allowed_words_length] on cpu, optional, int. Only these sequences are generated.
+    //      allowed_words_repeat [1] on cpu, optional, bool.
+    //      num_top_logprobs [1] or [batch_size] on cpu, optional, int.
     //      random_seed [1] or [batch_size] on cpu, optional, unsigned long long int.
     //      request_prompt_lengths [batch_size], optional
     //      request_prompt_embedding [batch_size, max_prompt_length, hidden_units], float, optional
     //      requst_prompt_type [batch_size], int, optional
     //      memory_len [1] on cpu, uint32, optional
+    //      kv_cache_block_size [1] on cpu, uint32, optional. Tokens per block of a paged KV cache. The pool is shared
+    //          by the sequences, which only take the blocks they fill.
+    //      kv_cache_num_blocks [1] on cpu, uint32, optional. Blocks of the paged KV cache, by default enough for
+    //          every sequence to reach memory_len plus the prefix prompt.
 
     // output_tensors:
     //      output_ids [batch_size, beam_width, max_output_seq_len]
@@ -412,6 +613,12 @@ void GptJ<T>::forward(std::unordered_map<std::string, Tensor>*       output_tens
     //          optional. It leads to additional computing cost. If we don't need this result, don't put it.
     //      cum_log_probs [batch_size, beam], optional, must be float*.
     //          optional. It leads to additional computing cost. If we don't need this result, don't put it.
+    //      output_top_logprobs [request_output_seq_len, batch_size * beam_width, N], must be float*. optional.
+    //          The log probs of the N most likely tokens of each generated step. Only supported in sampling.
+    //      output_top_logprob_ids [request_output_seq_len, batch_size * beam_width, N], must be int*.
+    //          Necessary with output_top_logprobs, the ids of these tokens.
+    //      cancel_status [batch_size] on cpu, must be int32_t*. optional.
+    //          The CancelStatus of each request, NOT_CANCELLED when no cancellation is registered.
 
     // Step is from max_input_length ~ max_output_seq_len,
     // When step = k,  we put output ids and caches at step k, and the sequence_length would be k - 1 before
@@ -522,7 +729,24 @@ void GptJ<T>::forward(std::unordered_map<std::string, Tensor>*       output_tens
                        fmtstr("Memory size too low (%d) vs. input length (%d)", memory_len, max_input_length));
 
     // max cache seq len should include max prefix prompt length as it has k/v states
-    const size_t max_cache_seq_len = memory_len + max_prefix_prompt_length;
+    size_t max_cache_seq_len = memory_len + max_prefix_prompt_length;
+
+    kv_block_size_ =
+        input_tensors->count("kv_cache_block_size") ? input_tensors->at("kv_cache_block_size").getVal<uint32_t>() : 0;
+    kv_block_manager_.reset();
+    const bool is_paged_kv_cache = kv_block_size_ > 0;
+    if (is_paged_kv_cache) {
+        // the paged cache has no circular buffer, every token keeps its KV
+        FT_CHECK_WITH_INFO(
+            memory_len >= max_seq_len,
+            fmtstr("The paged KV cache needs memory_len (%d) >= max_seq_len (%d).", memory_len, max_seq_len));
+        max_blocks_per_seq_ = (max_cache_seq_len + kv_block_size_ - 1) / kv_block_size_;
+        max_cache_seq_len   = max_blocks_per_seq_ * kv_block_size_;
+        kv_num_blocks_      = input_tensors->count("kv_cache_num_blocks") ?
+                                  input_tensors->at("kv_cache_num_blocks").getVal<uint32_t>() :
+                                  batch_size * beam_width * max_blocks_per_seq_;
+        kv_block_manager_.reset(new KVBlockManager(kv_num_blocks_, kv_block_size_));
+    }
 
     if (max_cache_seq_len < max_seq_len) {
         FT_LOG_WARNING("max_cache_seq_len (%d) is less than max_seq_len (%d). "
@@ -543,24 +767,23 @@ void GptJ<T>::forward(std::unordered_map<std::string, Tensor>*       output_tens
 
     setSeqLimitLen(seq_limit_len_, input_tensors->at("output_seq_len"), limit_len_offset, batch_size);
 
-    const DataType       data_type      = getTensorType<T>();
-    const cudaDataType_t gemm_data_type = getCudaDataType<T>();
+    const DataType data_type = getTensorType<T>();
 
     dynamic_decode_layer_->setup(batch_size, beam_width, input_tensors);
     handleOptArg(input_tensors, "start_id", start_ids_buf_, start_id_, batch_size);
     handleOptArg(input_tensors, "end_id", end_ids_buf_, end_id_, batch_size);
 
+    // the paged cache is [num_layer, kv_num_blocks_, local_head_num, ..., kv_block_size_, ...]
+    const size_t              cache_rows         = is_paged_kv_cache ? kv_num_blocks_ : batch_size * beam_width;
+    const size_t              cache_len          = is_paged_kv_cache ? kv_block_size_ : max_cache_seq_len;
     const std::vector<size_t> self_k_cache_shape = {num_layer_ / pipeline_para_.world_size_,
-                                                    batch_size * beam_width,
+                                                    cache_rows,
                                                     local_head_num_,
                                                     size_per_head_ / (16 / sizeof(T)),
-                                                    max_cache_seq_len,
+                                                    cache_len,
                                                     16 / sizeof(T)};
-    const std::vector<size_t> self_v_cache_shape = {num_layer_ / pipeline_para_.world_size_,
-                                                    batch_size * beam_width,
-                                                    local_head_num_,
-                                                    max_cache_seq_len,
-                                                    size_per_head_};
+    const std::vector<size_t> self_v_cache_shape = {
+        num_layer_ / pipeline_para_.world_size_, cache_rows, local_head_num_, cache_len, size_per_head_};
 
     // initialize the output ids and parent ids
     cudaMemsetAsync(output_ids_buf_, 0, sizeof(int) * batch_size * beam_width * max_seq_len, stream_);
@@ -671,6 +894,12 @@ void GptJ<T>::forward(std::unordered_map<std::string, Tensor>*       output_tens
                     TYPE_INT32,
                     {batch_size * beam_width},
                     has_prefix_prompt_ ? tiled_prompt_lengths_buf_ : nullptr}}};
+        if (is_paged_kv_cache) {
+            preparePagedKVCache(batch_size * beam_width, max_input_length + max_prefix_prompt_length);
+            decoder_input_tensors.insert(
+                {"block_table",
+                 Tensor{MEMORY_GPU, TYPE_INT32, {batch_size * beam_width, max_blocks_per_seq_}, block_tables_buf_}});
+        }
 
         std::unordered_map<std::string, Tensor> decoder_output_tensors{
             {"decoder_output",
@@ -748,23 +977,7 @@ void GptJ<T>::forward(std::unordered_map<std::string, Tensor>*       output_tens
                         stream_);
     }
 
-    if (vocab_size_ == vocab_size_padded_) {
-        padded_embedding_kernel_ptr_ = gpt_weights->post_decoder_embedding.kernel;
-        padded_embedding_bias_ptr_   = gpt_weights->post_decoder_embedding.bias;
-    }
-    else {
-        cudaMemcpyAsync(padded_embedding_kernel_,
-                        gpt_weights->post_decoder_embedding.kernel,
-                        sizeof(T) * vocab_size_ * hidden_units_,
-                        cudaMemcpyDeviceToDevice,
-                        stream_);
-        cudaMemcpyAsync(padded_embedding_bias_,
-                        gpt_weights->post_decoder_embedding.bias,
-                        sizeof(T) * vocab_size_,
-                        cudaMemcpyDeviceToDevice,
-                        stream_);
-        sync_check_cuda_error();
-    }
+    setPaddedEmbedding(gpt_weights);
 
     invokeMaskPaddingTokens(masked_tokens_,
                             (const int*)(input_tensors->at("input_lengths").data),  // not_tiled
@@ -777,6 +990,17 @@ void GptJ<T>::forward(std::unordered_map<std::string, Tensor>*       output_tens
                             stream_);
 
     for (int step = max_input_length; step < (int)max_output_seq_len; step++) {
+        if (cancellation_ != nullptr
+            && applyRequestCancellation(cancellation_,
+                                        finished_buf_,
+                                        cancel_statuses_buf_,
+                                        batch_size,
+                                        beam_width,
+                                        tensor_para_,
+                                        pipeline_para_,
+                                        stream_)) {
+            break;
+        }
         const int src_indir_idx = (step - max_input_length) % 2;
         const int tgt_indir_idx = 1 - src_indir_idx;
 
@@ -784,6 +1008,10 @@ void GptJ<T>::forward(std::unordered_map<std::string, Tensor>*       output_tens
         FT_CHECK(batch_size % local_batch_size == 0);
         const size_t iteration_num = batch_size / local_batch_size;
         *generation_should_stop_   = true;
+        if (is_paged_kv_cache) {
+            // the decoder writes the KV of token step - 1, after the prefix prompt
+            preparePagedKVCache(batch_size * beam_width, step + max_prefix_prompt_length);
+        }
 
         for (uint ite = 0; ite < iteration_num; ++ite) {
             const int id_offset               = ite * local_batch_size * beam_width;
@@ -835,8 +1063,9 @@ void GptJ<T>::forward(std::unordered_map<std::string, Tensor>*       output_tens
                      Tensor{MEMORY_GPU,
                             TYPE_INT32,
                             {local_batch_size, beam_width, max_output_seq_len},
-                            beam_width > 1 ? cache_indirections_[src_indir_idx] + id_offset * max_output_seq_len :
-                                             nullptr}},
+                            beam_width > 1 && !is_paged_kv_cache ?
+                                cache_indirections_[src_indir_idx] + id_offset * max_output_seq_len :
+                                nullptr}},
                     {"masked_tokens",
                      Tensor{MEMORY_GPU,
                             TYPE_BOOL,
@@ -850,87 +1079,26 @@ void GptJ<T>::forward(std::unordered_map<std::string, Tensor>*       output_tens
                             decoder_output_buf_ + hidden_units_offset}},
                     {"key_cache", Tensor{MEMORY_GPU, data_type, self_k_cache_shape, key_cache_}},
                     {"value_cache", Tensor{MEMORY_GPU, data_type, self_v_cache_shape, value_cache_}}};
+                if (is_paged_kv_cache) {
+                    // the decoder takes the rows of its sub-batch
+                    decoder_input_tensors.insert(
+                        {"block_table",
+                         Tensor{MEMORY_GPU,
+                                TYPE_INT32,
+                                {batch_size * beam_width, max_blocks_per_seq_},
+                                block_tables_buf_}});
+                }
                 gpt_decoder_->forward(
                     &decoder_output_tensors, &decoder_input_tensors, &gpt_weights->decoder_layer_weights);
             }
 
             if (pipeline_para_.rank_ == pipeline_para_.world_size_ - 1) {
-                invokeGeneralLayerNorm(normed_decoder_output_buf_ + hidden_units_offset,
-                                       decoder_output_buf_ + hidden_units_offset,
-                                       gpt_weights->post_decoder_layernorm.gamma,
-                                       gpt_weights->post_decoder_layernorm.beta,
-                                       layernorm_eps_,
-                                       local_batch_size * beam_width,
-                                       hidden_units_,
-                                       stream_);
-                sync_check_cuda_error();
-
-                if (tensor_para_.world_size_ == 1) {
-                    float alpha = 1.0f;
-                    float beta  = 0.0f;
-                    cublas_wrapper_->Gemm(CUBLAS_OP_T,
-                                          CUBLAS_OP_N,
-                                          vocab_size_padded_,  // n
-                                          local_batch_size * beam_width,
-                                          hidden_units_,  // k
-                                          &alpha,
-                                          padded_embedding_kernel_ptr_,
-                                          gemm_data_type,
-                                          hidden_units_,  // k
-                                          normed_decoder_output_buf_ + hidden_units_offset,
-                                          gemm_data_type,
-                                          hidden_units_,  // k
-                                          &beta,
-                                          logits_buf_ + vocab_size_units_offset,
-                                          CUDA_R_32F,
-                                          vocab_size_padded_, /* n */
-                                          CUDA_R_32F,
-                                          cublasGemmAlgo_t(-1));
-                }
-                else {
-                    FT_CHECK(vocab_size_padded_ % tensor_para_.world_size_ == 0);
-                    const int local_vocab_size = vocab_size_padded_ / tensor_para_.world_size_;
-                    float     alpha            = 1.0f;
-                    float     beta             = 0.0f;
-                    cublas_wrapper_->Gemm(CUBLAS_OP_T,
-                                          CUBLAS_OP_N,
-                                          local_vocab_size,  // n
-                                          local_batch_size * beam_width,
-                                          hidden_units_,  // k
-                                          &alpha,
-                                          padded_embedding_kernel_ptr_
-                                              + tensor_para_.rank_ * local_vocab_size * hidden_units_,
-                                          gemm_data_type,
-                                          hidden_units_,  // k
-                                          normed_decoder_output_buf_ + hidden_units_offset,
-                                          gemm_data_type,
-                                          hidden_units_,  // k
-                                          &beta,
-                                          nccl_logits_buf_ + vocab_size_units_offset
-                                              + tensor_para_.rank_ * local_batch_size * beam_width * local_vocab_size,
-                                          CUDA_R_32F,
-                                          local_vocab_size, /* n */
-                                          CUDA_R_32F,
-                                          cublasGemmAlgo_t(-1));
-                    ftNcclAllGather(nccl_logits_buf_ + vocab_size_units_offset,
-                                    nccl_logits_buf_ + vocab_size_units_offset,
-                                    local_batch_size * beam_width * local_vocab_size,
-                                    tensor_para_.rank_,
-                                    tensor_para_,
-                                    stream_);
-                    invokeTransposeAxis01(logits_buf_ + vocab_size_units_offset,
-                                          nccl_logits_buf_ + vocab_size_units_offset,
-                                          tensor_para_.world_size_,
-                                          local_batch_size * beam_width,
-                                          local_vocab_size,
-                                          stream_);
-                }
-
-                invokeAddBias(logits_buf_ + vocab_size_units_offset,
-                              padded_embedding_bias_ptr_,
+                computeLogits(logits_buf_ + vocab_size_units_offset,
+                              nccl_logits_buf_ + vocab_size_units_offset,
+                              normed_decoder_output_buf_ + hidden_units_offset,
+                              decoder_output_buf_ + hidden_units_offset,
                               local_batch_size * beam_width,
-                              vocab_size_padded_,
-                              stream_);
+                              gpt_weights);
 
                 int                                     tmp_local_batch_size       = local_batch_size;
                 bool                                    is_initialize_random_table = step == max_input_length;
@@ -1025,12 +1193,23 @@ void GptJ<T>::forward(std::unordered_map<std::string, Tensor>*       output_tens
                                 pipeline_para_,
                                 stream_);
             }
+            if (beam_width > 1 && is_paged_kv_cache) {
+                ftNcclBroadCast(parent_ids_buf_ + step * batch_size * beam_width,
+                                batch_size * beam_width,
+                                pipeline_para_.world_size_ - 1,
+                                pipeline_para_,
+                                stream_);
+            }
             ftNcclGroupEnd();
             // throw errors when detected
             ftNcclStreamSynchronize(tensor_para_, pipeline_para_, stream_);
             sync_check_cuda_error();
         }
 
+        if (is_paged_kv_cache && beam_width > 1) {
+            reorderPagedKVCacheBeams(batch_size, beam_width, step);
+        }
+
         if (*generation_should_stop_) {
             break;
         }
@@ -1057,10 +1236,267 @@ void GptJ<T>::forward(std::unordered_map<std::string, Tensor>*       output_tens
                                      stream_);
         }
     }
+
+    if (output_tensors->count("cancel_status")) {
+        FT_CHECK(output_tensors->at("cancel_status").where == MEMORY_CPU);
+        int32_t* cancel_status = output_tensors->at("cancel_status").getPtr<int32_t>();
+        if (cancellation_ != nullptr) {
+            std::copy(cancellation_->getStatuses(), cancellation_->getStatuses() + batch_size, cancel_status);
+        }
+        else {
+            std::fill(cancel_status, cancel_status + batch_size, (int32_t)NOT_CANCELLED);
+        }
+    }
     setOutputTensors(output_tensors, input_tensors, max_output_seq_len);
     sendTensorsToFirstPipelineNode(output_tensors, input_tensors);
 }
 
+template<typename T>
+void GptJ<T>::forwardSpeculative(std::unordered_map<std::string, Tensor>*       output_tensors,
+                                 const std::unordered_map<std::string, Tensor>* input_tensors,
+                                 const GptJWeight<T>*                           gpt_weights,
+                                 GptJ<T>*                                       draft,
+                                 const GptJWeight<T>*                           draft_weights,
+                                 const size_t                                   num_draft_tokens)
+{
+    // input_tensors:
+    //      input_ids [1, max_input_length]
+    //      input_lengths [1]
+    //      output_seq_len [1] on cpu
+    //      end_id [1] on cpu, optional
+    //      temperature [1] on cpu, optional, float. The tokens are sampled from the full distributions at this
+    //          temperature, and greedily when it is absent or 0.
+    //      random_seed [1] on cpu, optional, unsigned long long int.
+
+    // output_tensors:
+    //      output_ids [1, 1, max_output_seq_len]
+    //      sequence_length [1, 1]
+
+    FT_CHECK(output_tensors->at("output_ids").shape.size() == 3);
+    FT_CHECK_WITH_INFO(output_tensors->at("output_ids").shape[0] == 1 && output_tensors->at("output_ids").shape[1] == 1,
+                       "Speculative decoding only supports batch_size 1 and beam_width 1.");
+    FT_CHECK_WITH_INFO(draft != nullptr && draft->vocab_size_ == vocab_size_,
+                       "The draft model must share the vocabulary of the target model.");
+    FT_CHECK_WITH_INFO(num_draft_tokens > 0, "num_draft_tokens must be positive.");
+
+    int input_length = 0;
+    cudaAutoCpy(&input_length, input_tensors->at("input_lengths").getPtr<int>(), 1, stream_);
+    check_cuda_error(cudaStreamSynchronize(stream_));
+    std::vector<int> input_ids(input_length);
+    cudaAutoCpy(input_ids.data(), input_tensors->at("input_ids").getPtr<int>(), input_length, stream_);
+    check_cuda_error(cudaStreamSynchronize(stream_));
+
+    SpeculativeGenerationParam param;
+    param.num_draft_tokens  = num_draft_tokens;
+    param.max_seq_len       = input_tensors->at("output_seq_len").getVal<uint32_t>();
+    param.vocab_size        = vocab_size_;
+    param.vocab_size_padded = vocab_size_padded_;
+    param.temperature = input_tensors->count("temperature") ? input_tensors->at("temperature").getVal<float>() : 0.0f;
+    param.random_seed =
+        input_tensors->count("random_seed") ? input_tensors->at("random_seed").getVal<unsigned long long>() : 0;
+    FT_CHECK_WITH_INFO(param.max_seq_len <= output_tensors->at("output_ids").shape[2],
+                       "output_ids cannot hold output_seq_len tokens.");
+    const int end_id = input_tensors->count("end_id") ? input_tensors->at("end_id").getVal<int>() : end_id_;
+
+    // the verification pass runs the last committed token and the drafts
+    const size_t max_tokens = std::max((size_t)input_length, num_draft_tokens + 1);
+    prepareSpeculativeDecoding(param.max_seq_len, max_tokens, num_draft_tokens + 1, gpt_weights);
+    draft->prepareSpeculativeDecoding(param.max_seq_len, std::max((size_t)input_length, (size_t)2), 1, draft_weights);
+
+    SpeculativeVerifier    verifier(end_id);
+    const std::vector<int> tokens = verifier.generate(
+        input_ids,
+        param,
+        [&](const int* token_ids, size_t num_tokens, size_t start, size_t num_logits, float* logits) {
+            speculativeForward(token_ids, num_tokens, start, num_logits, logits, gpt_weights);
+        },
+        [&](const int* token_ids, size_t num_tokens, size_t start, size_t num_logits, float* logits) {
+            draft->speculativeForward(token_ids, num_tokens, start, num_logits, logits, draft_weights);
+        });
+    speculative_stats_ += verifier.getStats();
+
+    // like forward, the sequence is padded with the end id
+    std::vector<int> output_ids(output_tensors->at("output_ids").shape[2], end_id);
+    std::copy(tokens.begin(), tokens.end(), output_ids.begin());
+    const int sequence_length = tokens.size();
+    cudaAutoCpy(output_tensors->at("output_ids").getPtr<int>(), output_ids.data(), output_ids.size(), stream_);
+    cudaAutoCpy(output_tensors->at("sequence_length").getPtr<int>(), &sequence_length, 1, stream_);
+    check_cuda_error(cudaStreamSynchronize(stream_));
+}
+
+template<typename T>
+SpeculativeDecodingStats GptJ<T>::getSpeculativeStats() const
+{
+    return speculative_stats_;
+}
+
+template<typename T>
+void GptJ<T>::resetSpeculativeStats()
+{
+    speculative_stats_ = SpeculativeDecodingStats();
+}
+
+template<typename T>
+void GptJ<T>::prepareSpeculativeDecoding(const size_t         max_seq_len,
+                                         const size_t         max_tokens,
+                                         const size_t         max_logits,
+                                         const GptJWeight<T>* gpt_weights)
+{
+    FT_CHECK_WITH_INFO(pipeline_para_.world_size_ == 1, "Speculative decoding does not support pipeline parallelism.");
+    kv_block_size_ = 0;
+    kv_block_manager_.reset();
+    has_prefix_prompt_      = false;
+    has_prefix_soft_prompt_ = false;
+    spec_max_seq_len_       = max_seq_len;
+
+    allocateBuffer(1, 1, max_seq_len, max_seq_len, max_tokens);
+    spec_prefix_kv_ = (T*)(allocator_->reMalloc(
+        spec_prefix_kv_, sizeof(T) * num_layer_ * 2 * local_head_num_ * max_seq_len * size_per_head_, false));
+    spec_prefix_kv_batch_ = (const T**)(allocator_->reMalloc(spec_prefix_kv_batch_, sizeof(T*), false));
+    spec_normed_hidden_buf_ =
+        (T*)(allocator_->reMalloc(spec_normed_hidden_buf_, sizeof(T) * max_logits * hidden_units_, false));
+    spec_logits_buf_ =
+        (float*)(allocator_->reMalloc(spec_logits_buf_, sizeof(float) * max_logits * vocab_size_padded_, false));
+    spec_nccl_logits_buf_ =
+        (float*)(allocator_->reMalloc(spec_nccl_logits_buf_, sizeof(float) * max_logits * vocab_size_padded_, false));
+    setPaddedEmbedding(gpt_weights);
+
+    cudaMemsetAsync(finished_buf_, false, sizeof(bool), stream_);
+    cudaMemsetAsync(masked_tokens_, false, sizeof(bool) * max_seq_len, stream_);
+    cudaMemsetAsync(tiled_total_padding_count_, 0, sizeof(int), stream_);
+    sync_check_cuda_error();
+}
+
+template<typename T>
+void GptJ<T>::speculativeForward(const int*           token_ids,
+                                 const size_t         num_tokens,
+                                 const size_t         start,
+                                 const size_t         num_logits,
+                                 float*               logits,
+                                 const GptJWeight<T>* gpt_weights)
+{
+    const DataType            data_type          = getTensorType<T>();
+    const std::vector<size_t> self_k_cache_shape = {
+        num_layer_, 1, local_head_num_, size_per_head_ / (16 / sizeof(T)), spec_max_seq_len_, 16 / sizeof(T)};
+    const std::vector<size_t> self_v_cache_shape = {num_layer_, 1, local_head_num_, spec_max_seq_len_, size_per_head_};
+
+    T* hidden_states = nullptr;  // [num_tokens, hidden_units_]
+    if (num_tokens == 1 && start > 0) {
+        // a single token goes through the decoder, which reads the cache in place
+        int step             = start + 1;
+        int sequence_length  = start;
+        int max_input_length = start;
+        int max_prefix_len   = 0;
+        int ite              = 0;
+        cudaAutoCpy(output_ids_buf_ + start, token_ids, 1, stream_);
+        cudaAutoCpy(sequence_lengths_, &sequence_length, 1, stream_);
+        invokeEmbeddingLookupPosEncodingPadCount(decoder_input_buf_,
+                                                 gpt_weights->pre_decoder_embedding_table,
+                                                 gpt_weights->position_encoding_table,
+                                                 output_ids_buf_,
+                                                 tiled_total_padding_count_,
+                                                 1,
+                                                 hidden_units_,
+                                                 (T)(1.0f),
+                                                 start,
+                                                 1,
+                                                 0,
+                                                 stream_);
+        sync_check_cuda_error();
+
+        std::unordered_map<std::string, Tensor> decoder_input_tensors{
+            {"decoder_input", Tensor{MEMORY_GPU, data_type, {1, hidden_units_}, decoder_input_buf_}},
+            {"finished", Tensor{MEMORY_GPU, TYPE_BOOL, {1}, finished_buf_}},
+            {"sequence_lengths", Tensor{MEMORY_GPU, TYPE_INT32, {1}, sequence_lengths_}},
+            {"total_padding_tokens", Tensor{MEMORY_GPU, TYPE_INT32, {1}, tiled_total_padding_count_}},
+            {"d_prefix_prompt_lengths", Tensor{MEMORY_GPU, TYPE_INT32, {1}, nullptr}},
+            {"max_prefix_prompt_length", Tensor{MEMORY_CPU, TYPE_INT32, {1}, &max_prefix_len}},
+            {"max_input_length", Tensor{MEMORY_CPU, TYPE_INT32, {1}, &max_input_length}},
+            {"step", Tensor{MEMORY_CPU, TYPE_INT32, {1}, &step}},
+            {"ite", Tensor{MEMORY_CPU, TYPE_INT32, {1}, &ite}},
+            {"cache_indirection", Tensor{MEMORY_GPU, TYPE_INT32, {1, 1, spec_max_seq_len_}, nullptr}},
+            {"masked_tokens", Tensor{MEMORY_GPU, TYPE_BOOL, {1, spec_max_seq_len_}, masked_tokens_}}};
+        std::unordered_map<std::string, Tensor> decoder_output_tensors{
+            {"decoder_output", Tensor{MEMORY_GPU, data_type, {1, hidden_units_}, decoder_output_buf_}},
+            {"key_cache", Tensor{MEMORY_GPU, data_type, self_k_cache_shape, key_cache_}},
+            {"value_cache", Tensor{MEMORY_GPU, data_type, self_v_cache_shape, value_cache_}}};
+        gpt_decoder_->forward(&decoder_output_tensors, &decoder_input_tensors, &gpt_weights->decoder_layer_weights);
+        hidden_states = decoder_output_buf_;
+    }
+    else {
+        // the context decoder takes the KV of the positions before start as a prefix prompt
+        const int lengths[2] = {(int)num_tokens, (int)start};
+        cudaAutoCpy(tiled_input_ids_buf_, token_ids, num_tokens, stream_);
+        cudaAutoCpy(tiled_input_lengths_buf_, lengths, 1, stream_);
+        cudaAutoCpy(tiled_prompt_lengths_buf_, lengths + 1, 1, stream_);
+        invokeInputIdsEmbeddingLookupPosEncoding(context_decoder_input_buf_,
+                                                 output_ids_buf_ + start,
+                                                 gpt_weights->pre_decoder_embedding_table,
+                                                 gpt_weights->position_encoding_table,
+                                                 pPromptTuningParam<T>{},
+                                                 tiled_input_ids_buf_,
+                                                 start + 1,
+                                                 num_tokens,
+                                                 num_tokens,
+                                                 1,
+                                                 hidden_units_,
+                                                 stream_);
+        invokeGatherPrefixKVFromCache(spec_prefix_kv_,
+                                      spec_prefix_kv_batch_,
+                                      key_cache_,
+                                      value_cache_,
+                                      tiled_prompt_lengths_buf_,
+                                      1,
+                                      start,
+                                      num_layer_,
+                                      0,
+                                      num_layer_,
+                                      local_head_num_,
+                                      spec_max_seq_len_,
+                                      size_per_head_,
+                                      stream_);
+        invokeBuildDecoderAttentionMask(input_attention_mask_,
+                                        tiled_input_lengths_buf_,
+                                        tiled_prompt_lengths_buf_,
+                                        1,
+                                        num_tokens,
+                                        start,
+                                        stream_);
+        sync_check_cuda_error();
+
+        std::unordered_map<std::string, Tensor> decoder_input_tensors{
+            {"decoder_input",
+             Tensor{MEMORY_GPU, data_type, {1, num_tokens, hidden_units_}, context_decoder_input_buf_}},
+            {"attention_mask",
+             Tensor{MEMORY_GPU, data_type, {1, 1, num_tokens, start + num_tokens}, input_attention_mask_}},
+            {"input_lengths", Tensor{MEMORY_GPU, TYPE_INT32, {1}, tiled_input_lengths_buf_}},
+            {"d_prefix_prompt_batch", Tensor{MEMORY_GPU, data_type, {1}, start > 0 ? spec_prefix_kv_batch_ : nullptr}},
+            {"d_prefix_prompt_lengths",
+             Tensor{MEMORY_GPU, TYPE_INT32, {1}, start > 0 ? tiled_prompt_lengths_buf_ : nullptr}}};
+        std::unordered_map<std::string, Tensor> decoder_output_tensors{
+            {"decoder_output",
+             Tensor{MEMORY_GPU, data_type, {1, num_tokens, hidden_units_}, context_decoder_output_buf_}},
+            {"key_cache", Tensor{MEMORY_GPU, data_type, self_k_cache_shape, key_cache_}},
+            {"value_cache", Tensor{MEMORY_GPU, data_type, self_v_cache_shape, value_cache_}},
+            {"last_token_hidden_units", Tensor{MEMORY_GPU, data_type, {1, hidden_units_}, decoder_output_buf_}}};
+        gpt_context_decoder_->forward(
+            &decoder_output_tensors, &decoder_input_tensors, &gpt_weights->decoder_layer_weights);
+        hidden_states = context_decoder_output_buf_;
+    }
+    sync_check_cuda_error();
+
+    if (num_logits > 0) {
+        computeLogits(spec_logits_buf_,
+                      spec_nccl_logits_buf_,
+                      spec_normed_hidden_buf_,
+                      hidden_states + (num_tokens - num_logits) * hidden_units_,
+                      num_logits,
+                      gpt_weights);
+        cudaAutoCpy(logits, spec_logits_buf_, num_logits * vocab_size_padded_, stream_);
+    }
+    check_cuda_error(cudaStreamSynchronize(stream_));
+}
+
 template<typename T>
 void GptJ<T>::sendTensorsToFirstPipelineNode(std::unordered_map<std::string, Tensor>*       output_tensors,
                                              const std::unordered_map<std::string, Tensor>* input_tensors)
@@ -1075,7 +1511,8 @@ void GptJ<T>::sendTensorsToFirstPipelineNode(std::unordered_map<std::string, Ten
 
     ftNcclGroupStart();
     for (auto const& it : *output_tensors) {
-        if (it.second.data == nullptr) {
+        // the host outputs, such as cancel_status, are already set on every rank
+        if (it.second.data == nullptr || it.second.where == MEMORY_CPU) {
             continue;
         }
 
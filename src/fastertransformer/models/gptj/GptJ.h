@@ -17,6 +17,7 @@
 #pragma once
 
 #include <cstddef>
+#include <memory>
 #include <vector>
 
 #include "src/fastertransformer/layers/DynamicDecodeLayer.h"
@@ -24,6 +25,9 @@
 #include "src/fastertransformer/models/gptj/GptJDecoder.h"
 #include "src/fastertransformer/models/gptj/GptJWeight.h"
 #include "src/fastertransformer/utils/custom_ar_comm.h"
+#include "src/fastertransformer/utils/kv_block_manager.h"
+#include "src/fastertransformer/utils/request_cancellation_utils.h"
+#include "src/fastertransformer/utils/speculative_decoding.h"
 
 namespace fastertransformer {
 
@@ -96,6 +100,41 @@ protected:
     T*   value_cache_;
     int* cache_indirections_[2] = {nullptr, nullptr};
 
+    // paged KV cache: key_cache_ / value_cache_ are a pool of kv_num_blocks_ blocks of kv_block_size_ tokens and row
+    // i of the batch is sequence i of kv_block_manager_. Disabled when kv_block_size_ is 0.
+    size_t                          kv_block_size_       = 0;
+    size_t                          kv_num_blocks_       = 0;
+    size_t                          max_blocks_per_seq_  = 0;
+    std::unique_ptr<KVBlockManager> kv_block_manager_;
+    int*                            block_tables_buf_    = nullptr;  // [batch_size * beam_width, max_blocks_per_seq_]
+    int*                            kv_block_copies_buf_ = nullptr;  // [batch_size * beam_width, 2]
+
+    // Grows the first num_rows sequences to num_tokens tokens, applies the copy-on-writes and uploads the block tables.
+    void preparePagedKVCache(const size_t num_rows, const size_t num_tokens);
+    // Makes every beam continue the blocks of its parent at `step`, the paged counterpart of the cache indirections.
+    void reorderPagedKVCacheBeams(const size_t batch_size, const size_t beam_width, const int step);
+
+    // speculative decoding: the committed tokens are in output_ids_buf_ and their KV in the cache of a single sequence
+    size_t                   spec_max_seq_len_       = 0;
+    T*                       spec_prefix_kv_         = nullptr;  // the KV cache laid out as a prefix prompt
+    const T**                spec_prefix_kv_batch_   = nullptr;
+    T*                       spec_normed_hidden_buf_ = nullptr;  // [num_draft_tokens + 1, hidden_units_]
+    float*                   spec_logits_buf_        = nullptr;  // [num_draft_tokens + 1, vocab_size_padded_]
+    float*                   spec_nccl_logits_buf_   = nullptr;
+    SpeculativeDecodingStats speculative_stats_;
+
+    void prepareSpeculativeDecoding(const size_t         max_seq_len,
+                                    const size_t         max_tokens,
+                                    const size_t         max_logits,
+                                    const GptJWeight<T>* gpt_weights);
+    // The SpeculativeForwardFn of the model: one token goes through the decoder, more through the context decoder.
+    void speculativeForward(const int*           token_ids,
+                            const size_t         num_tokens,
+                            const size_t         start,
+                            const size_t         num_logits,
+                            float*               logits,
+                            const GptJWeight<T>* gpt_weights);
+
     // prompt_learning weight_batch ptrs
     const T** prompt_learning_weight_batch_;
     int*      tiled_prompt_lengths_buf_;  // only needed by prefix prompts
@@ -122,6 +161,19 @@ protected:
     callback_sig* token_generated_cb_  = nullptr;
     void*         token_generated_ctx_ = nullptr;
 
+    // request cancellation
+    RequestCancellation* cancellation_        = nullptr;
+    int*                 cancel_statuses_buf_ = nullptr;  // [batch_size], to broadcast the statuses of rank 0
+
+    void setPaddedEmbedding(const GptJWeight<T>* gpt_weights);
+    // Final layernorm and logits of num_rows hidden states, gathered over the tensor parallel ranks.
+    void computeLogits(float*               logits,
+                       float*               nccl_logits,
+                       T*                   normed_hidden_states,
+                       const T*             hidden_states,
+                       const size_t         num_rows,
+                       const GptJWeight<T>* gpt_weights);
+
     void setOutputTensors(std::unordered_map<std::string, Tensor>*       output_tensors,
                           const std::unordered_map<std::string, Tensor>* input_tensors,
                           size_t                                         max_seq_len);
@@ -201,6 +253,21 @@ public:
                  const std::unordered_map<std::string, Tensor>* input_tensors,
                  const GptJWeight<T>*                           gpt_weights);
 
+    // Speculative decoding: `draft`, a smaller model sharing the vocabulary, proposes num_draft_tokens tokens one at a
+    // time and this model verifies them in a single context decoder pass that attends to its KV cache, so that a step
+    // commits up to num_draft_tokens + 1 tokens (see SpeculativeVerifier). Rejected drafts are rolled back by rewinding
+    // the sequence length of both caches. Only batch_size and beam_width 1, without pipeline parallelism, prompts or
+    // paged KV cache.
+    void forwardSpeculative(std::unordered_map<std::string, Tensor>*       output_tensors,
+                            const std::unordered_map<std::string, Tensor>* input_tensors,
+                            const GptJWeight<T>*                           gpt_weights,
+                            GptJ<T>*                                       draft,
+                            const GptJWeight<T>*                           draft_weights,
+                            const size_t                                   num_draft_tokens);
+    // Acceptance rate and tokens per step of the forwardSpeculative calls.
+    SpeculativeDecodingStats getSpeculativeStats() const;
+    void                     resetSpeculativeStats();
+
     size_t getPipelineParallelRank();
     size_t getPipelineParallelSize();
     size_t getTensorParallelRank();
@@ -209,6 +276,12 @@ public:
 
     void registerCallback(callback_sig* fn, void* ctx);
     void unRegisterCallback();
+
+    // Checks the cancellation at the beginning of every step: the sequences of the requests it stops are marked
+    // finished, and the generation ends once all its requests are stopped. With tensor or pipeline parallelism, the
+    // statuses polled by the first rank are applied by all the ranks.
+    void registerCancellation(RequestCancellation* cancellation);
+    void unRegisterCancellation();
 };
 
 }  // namespace fastertransformer
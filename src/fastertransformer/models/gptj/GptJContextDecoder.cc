@@ -15,6 +15,7 @@
  */
 
 #include "src/fastertransformer/models/gptj/GptJContextDecoder.h"
+#include "src/fastertransformer/kernels/bert_preprocess_kernels.h"
 #include "src/fastertransformer/kernels/gpt_kernels.h"
 
 #include "src/fastertransformer/layers/TensorParallelGeluFfnLayer.h"
@@ -69,6 +70,7 @@ void GptJContextDecoder<T>::allocateBuffer()
 template<typename T>
 void GptJContextDecoder<T>::allocateBuffer(size_t batch_size, size_t seq_len)
 {
+    AllocatorTagScope allocator_tag("GptJContextDecoder");
     decoder_normed_input_ = reinterpret_cast<T*>(
         allocator_->reMalloc(decoder_normed_input_, sizeof(T) * batch_size * seq_len * hidden_units_, false));
     self_attn_output_ = reinterpret_cast<T*>(
@@ -77,6 +79,9 @@ void GptJContextDecoder<T>::allocateBuffer(size_t batch_size, size_t seq_len)
         allocator_->reMalloc(ffn_output_, sizeof(T) * batch_size * seq_len * hidden_units_, false));
     decoder_layer_output_ = reinterpret_cast<T*>(
         allocator_->reMalloc(decoder_layer_output_, sizeof(T) * batch_size * seq_len * hidden_units_, false));
+    token_num_ = reinterpret_cast<size_t*>(allocator_->reMalloc(token_num_, sizeof(size_t) * 1, false));
+    padding_offset_ =
+        reinterpret_cast<int*>(allocator_->reMalloc(padding_offset_, sizeof(int) * batch_size * seq_len, false));
     is_allocate_buffer_ = true;
 }
 
@@ -88,6 +93,8 @@ void GptJContextDecoder<T>::freeBuffer()
         allocator_->free((void**)(&self_attn_output_));
         allocator_->free((void**)(&ffn_output_));
         allocator_->free((void**)(&decoder_layer_output_));
+        allocator_->free((void**)(&token_num_));
+        allocator_->free((void**)(&padding_offset_));
         is_allocate_buffer_ = false;
     }
 }
@@ -139,7 +146,8 @@ GptJContextDecoder<T>::GptJContextDecoder(size_t                              ma
                                           bool                                is_free_buffer_after_forward,
                                           bool                                is_qk_buf_float,
                                           std::shared_ptr<AbstractCustomComm> custom_all_reduce_comm,
-                                          int                                 enable_custom_all_reduce):
+                                          int                                 enable_custom_all_reduce,
+                                          bool                                remove_padding):
     BaseLayer(stream, cublas_wrapper, allocator, is_free_buffer_after_forward),
     max_batch_size_(max_batch_size),
     max_seq_len_(max_seq_len),
@@ -155,7 +163,8 @@ GptJContextDecoder<T>::GptJContextDecoder(size_t                              ma
     pipeline_para_(pipeline_para),
     is_qk_buf_float_(is_qk_buf_float),
     custom_all_reduce_comm_(custom_all_reduce_comm),
-    enable_custom_all_reduce_(enable_custom_all_reduce)
+    enable_custom_all_reduce_(enable_custom_all_reduce),
+    remove_padding_(remove_padding)
 {
     initialize();
 }
@@ -176,7 +185,8 @@ GptJContextDecoder<T>::GptJContextDecoder(GptJContextDecoder<T> const& decoder):
     pipeline_para_(decoder.pipeline_para_),
     is_qk_buf_float_(decoder.is_qk_buf_float_),
     custom_all_reduce_comm_(decoder.custom_all_reduce_comm_),
-    enable_custom_all_reduce_(decoder.enable_custom_all_reduce_)
+    enable_custom_all_reduce_(decoder.enable_custom_all_reduce_),
+    remove_padding_(decoder.remove_padding_)
 {
     initialize();
 }
@@ -217,18 +227,21 @@ void GptJContextDecoder<T>::forward(std::unordered_map<std::string, Tensor>*
     //      d_prefix_prompt_batch [batch_size],
     //          each element contains ptr with buffer shape[2, local_head_num_, prompt_length, size_per_head]
     //      prefix_prompt_lengths [batch size]
+    //      block_table [batch_size, max_blocks_per_seq] (optional, paged cache)
 
     // output tensors:
     //      decoder_output [batch_size, seq_len, hidden_dimension],
     //      key_cache [num_layer, batch, local_head_num, size_per_head // x, max_seq_len, x]
+    //                or [num_layer, num_blocks, local_head_num, size_per_head // x, block_size, x] when paged
     //      value_cache [num_layer, batch, local_head_num, max_seq_len, size_per_head]
+    //                  or [num_layer, num_blocks, local_head_num, block_size, size_per_head] when paged
     //      last_token_hidden_units [batch_size, hidden_dimension]
 
     // To use layer/pipeline parallelism, we view the shape of 'batch_size' to 'ite * local_batch_size'.
     // For example, the shape of decoder_input becomes [ite, batch_size, seq_len, hidden_dimension] during
     // computing.
 
-    FT_CHECK(input_tensors->size() == 5);
+    FT_CHECK(input_tensors->size() == 5 || input_tensors->size() == 6);
     FT_CHECK(output_tensors->size() == 4);
 
     const int batch_size = input_tensors->at("decoder_input").shape[0];
@@ -243,6 +256,10 @@ void GptJContextDecoder<T>::forward(std::unordered_map<std::string, Tensor>*
     const T*   attention_mask          = (const T*)input_tensors->at("attention_mask").data;
     const T**  d_prefix_prompt_batch   = (const T**)input_tensors->at("d_prefix_prompt_batch").data;
     const int* d_prefix_prompt_lengths = (const int*)input_tensors->at("d_prefix_prompt_lengths").data;
+    const int* input_lengths           = (const int*)input_tensors->at("input_lengths").data;
+    const int* block_table =
+        input_tensors->count("block_table") ? input_tensors->at("block_table").getPtr<int>() : nullptr;
+    const size_t max_blocks_per_seq = block_table != nullptr ? input_tensors->at("block_table").shape[1] : 0;
 
     const int local_batch_size = getLocalBatchSize(batch_size, seq_len, pipeline_para_.world_size_);
     FT_CHECK(batch_size % local_batch_size == 0);
@@ -251,30 +268,55 @@ void GptJContextDecoder<T>::forward(std::unordered_map<std::string, Tensor>*
     Tensor&             k_cache = output_tensors->at("key_cache");
     Tensor&             v_cache = output_tensors->at("value_cache");
     std::vector<size_t> self_k_cache_size;
-    self_k_cache_size.push_back(local_batch_size);
+    self_k_cache_size.push_back(block_table != nullptr ? k_cache.shape[1] : (size_t)local_batch_size);
     for (auto t = k_cache.shape.begin() + 2; t != k_cache.shape.end(); ++t) {
         self_k_cache_size.push_back(*t);
     }
     std::vector<size_t> self_v_cache_size;
-    self_v_cache_size.push_back(local_batch_size);
+    self_v_cache_size.push_back(block_table != nullptr ? v_cache.shape[1] : (size_t)local_batch_size);
     for (auto t = v_cache.shape.begin() + 2; t != v_cache.shape.end(); ++t) {
         self_v_cache_size.push_back(*t);
     }
 
     for (int ite = 0; ite < iteration_num; ite++) {
+        size_t h_token_num = local_batch_size * seq_len;
+        if (remove_padding_) {
+            invokeGetPaddingOffset(&h_token_num,
+                                   token_num_,
+                                   padding_offset_,
+                                   input_lengths + ite * local_batch_size,
+                                   local_batch_size,
+                                   seq_len,
+                                   stream_);
+        }
+
         for (int l = 0; l < num_layer_; l++) {
             if (isValidLayerParallelId(l) == false) {
                 continue;
             }
 
+            if (l == 0 && remove_padding_) {
+                invokeRemovePadding(decoder_layer_output_,
+                                    decoder_input + ite * local_batch_size * seq_len * hidden_units_,
+                                    padding_offset_,
+                                    h_token_num,
+                                    hidden_units_,
+                                    stream_);
+            }
+
             const bool is_final = false;  // TODO(bhsueh) remove this flag
-            T*         layer_input =
-                ((l == 0) ? decoder_input : decoder_layer_output_) + ite * local_batch_size * seq_len * hidden_units_;
-            T* layer_output = ((l == num_layer_ - 1) ? decoder_output : decoder_layer_output_)
-                              + ite * local_batch_size * seq_len * hidden_units_;
+            // without padding, the tokens of the iteration stay packed in decoder_layer_output_ through the layers
+            T* layer_input  = decoder_layer_output_;
+            T* layer_output = decoder_layer_output_;
+            if (!remove_padding_) {
+                layer_input  = ((l == 0) ? decoder_input : decoder_layer_output_)
+                               + ite * local_batch_size * seq_len * hidden_units_;
+                layer_output = ((l == num_layer_ - 1) ? decoder_output : decoder_layer_output_)
+                               + ite * local_batch_size * seq_len * hidden_units_;
+            }
 
             if (isFirstLayerParallelId(l) && pipeline_para_.rank_ != 0 && pipeline_para_.world_size_ > 1) {
-                int data_size = local_batch_size * seq_len * hidden_units_ / tensor_para_.world_size_;
+                int data_size = h_token_num * hidden_units_ / tensor_para_.world_size_;
                 ftNcclRecv(layer_input + data_size * tensor_para_.rank_,
                            data_size,
                            pipeline_para_.rank_ - 1,
@@ -290,7 +332,7 @@ void GptJContextDecoder<T>::forward(std::unordered_map<std::string, Tensor>*
                                    gpt_decoder_layer_weight->at(l).pre_layernorm_weights.gamma,
                                    gpt_decoder_layer_weight->at(l).pre_layernorm_weights.beta,
                                    layernorm_eps_,
-                                   local_batch_size * seq_len,
+                                   h_token_num,
                                    hidden_units_,
                                    stream_);
             sync_check_cuda_error();
@@ -298,7 +340,7 @@ void GptJContextDecoder<T>::forward(std::unordered_map<std::string, Tensor>*
             std::vector<Tensor> self_attention_input_tensors{
                 Tensor{MEMORY_GPU,
                        data_type,
-                       {(size_t)(local_batch_size * seq_len), (size_t)hidden_units_},
+                       {h_token_num, (size_t)hidden_units_},
                        decoder_normed_input_},
                 Tensor{MEMORY_GPU,
                        data_type,
@@ -313,14 +355,23 @@ void GptJContextDecoder<T>::forward(std::unordered_map<std::string, Tensor>*
                        TYPE_INT32,
                        {(size_t)local_batch_size},
                        d_prefix_prompt_lengths != nullptr ? d_prefix_prompt_lengths + ite * local_batch_size : nullptr},
-                Tensor{MEMORY_CPU, TYPE_INT32, {(size_t)1}, &l}};  // layer_id
+                Tensor{MEMORY_CPU, TYPE_INT32, {(size_t)1}, &l},  // layer_id
+                Tensor{MEMORY_GPU, TYPE_INT32, {h_token_num}, remove_padding_ ? padding_offset_ : nullptr}};
+            if (block_table != nullptr) {
+                self_attention_input_tensors.push_back(
+                    Tensor{MEMORY_GPU,
+                           TYPE_INT32,
+                           {(size_t)local_batch_size, max_blocks_per_seq},
+                           block_table + ite * local_batch_size * max_blocks_per_seq});
+            }
 
             // NOTE: cache offer for specific layer
             size_t cache_offset = l - getFirstLayerParallelId();
             for (auto t = k_cache.shape.begin() + 1; t != k_cache.shape.end(); ++t) {
                 cache_offset *= *t;
             };
-            size_t ite_cache_offset = ite * local_batch_size;
+            // the block tables index the whole pool
+            size_t ite_cache_offset = block_table != nullptr ? 0 : ite * local_batch_size;
             for (auto t = k_cache.shape.begin() + 2; t != k_cache.shape.end(); ++t) {
                 ite_cache_offset *= *t;
             }
@@ -329,7 +380,7 @@ void GptJContextDecoder<T>::forward(std::unordered_map<std::string, Tensor>*
             std::vector<Tensor> self_attention_output_tensors{
                 Tensor{MEMORY_GPU,
                        data_type,
-                       {(size_t)(local_batch_size * seq_len), (size_t)hidden_units_},
+                       {h_token_num, (size_t)hidden_units_},
                        self_attn_output_},
                 Tensor{MEMORY_GPU, data_type, self_k_cache_size, ((const T*)k_cache.data) + cache_offset},
                 Tensor{MEMORY_GPU, data_type, self_v_cache_size, ((const T*)v_cache.data) + cache_offset}};
@@ -342,10 +393,10 @@ void GptJContextDecoder<T>::forward(std::unordered_map<std::string, Tensor>*
                 std::vector<Tensor> ffn_input_tensors{
                     Tensor{MEMORY_GPU,
                            data_type,
-                           {(size_t)(local_batch_size * seq_len), (size_t)hidden_units_},
+                           {h_token_num, (size_t)hidden_units_},
                            decoder_normed_input_}};
-                std::vector<Tensor> ffn_output_tensors{Tensor{
-                    MEMORY_GPU, data_type, {(size_t)(local_batch_size * seq_len), (size_t)hidden_units_}, ffn_output_}};
+                std::vector<Tensor> ffn_output_tensors{
+                    Tensor{MEMORY_GPU, data_type, {h_token_num, (size_t)hidden_units_}, ffn_output_}};
                 ffn_layer_->forward(
                     &ffn_output_tensors, &ffn_input_tensors, &gpt_decoder_layer_weight->at(l).ffn_weights);
 
@@ -354,14 +405,14 @@ void GptJContextDecoder<T>::forward(std::unordered_map<std::string, Tensor>*
                                                   self_attn_output_,
                                                   layer_input,
                                                   gpt_decoder_layer_weight->at(l).ffn_weights.output_weight.bias,
-                                                  local_batch_size * seq_len,
+                                                  h_token_num,
                                                   hidden_units_,
                                                   stream_);
                 sync_check_cuda_error();
 
                 if (isLastLayerParallelId(l) && pipeline_para_.rank_ != pipeline_para_.world_size_ - 1
                     && pipeline_para_.world_size_ > 1) {
-                    int data_size = local_batch_size * seq_len * hidden_units_ / tensor_para_.world_size_;
+                    int data_size = h_token_num * hidden_units_ / tensor_para_.world_size_;
                     ftNcclSend(layer_output + data_size * tensor_para_.rank_,
                                data_size,
                                pipeline_para_.rank_ + 1,
@@ -369,6 +420,15 @@ void GptJContextDecoder<T>::forward(std::unordered_map<std::string, Tensor>*
                                stream_);
                 }
             }
+
+            if (l == num_layer_ - 1 && remove_padding_) {
+                invokeRebuildPadding(decoder_output + ite * local_batch_size * seq_len * hidden_units_,
+                                     decoder_layer_output_,
+                                     padding_offset_,
+                                     h_token_num,
+                                     hidden_units_,
+                                     stream_);
+            }
         }
     }
 
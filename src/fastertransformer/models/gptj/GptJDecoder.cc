@@ -66,6 +66,7 @@ void GptJDecoder<T>::allocateBuffer()
 template<typename T>
 void GptJDecoder<T>::allocateBuffer(size_t batch_size)
 {
+    AllocatorTagScope allocator_tag("GptJDecoder");
     decoder_normed_input_ = reinterpret_cast<T*>(
         allocator_->reMalloc(decoder_normed_input_, sizeof(T) * batch_size * hidden_units_, false));
     self_attn_output_ =
@@ -207,13 +208,16 @@ void GptJDecoder<T>::forward(std::unordered_map<std::string, Tensor>*       outp
     //              Here, local_batch_size contains the beam_width, so local_batch_size / beam_width
     //              is real local_batch_size.
     //      masked_tokens[local_batch_size, memory_len]
+    //      block_table [batch_size, max_blocks_per_seq] (optional, paged cache), the rows of sub-batch ite are used
 
     // output tensors:
     //      decoder_output [local_batch_size, hidden_dimension],
     //      key_cache [num_layer, batch_size, head_num, size_per_head // x, memory_len, x]
+    //                or [num_layer, num_blocks, head_num, size_per_head // x, block_size, x] when paged
     //      value_cache [num_layer, batch_size, head_num, memory_len, size_per_head]
+    //                  or [num_layer, num_blocks, head_num, block_size, size_per_head] when paged
 
-    FT_CHECK(input_tensors->size() == 11);
+    FT_CHECK(input_tensors->size() == 11 || input_tensors->size() == 12);
     FT_CHECK(output_tensors->size() == 3);
 
     const DataType data_type        = getTensorType<T>();
@@ -224,15 +228,18 @@ void GptJDecoder<T>::forward(std::unordered_map<std::string, Tensor>*       outp
     T* decoder_input  = (T*)input_tensors->at("decoder_input").data;
     T* decoder_output = (T*)output_tensors->at("decoder_output").data;
 
+    // the block tables index the whole pool, the local batch only selects their rows
+    const bool is_paged = input_tensors->count("block_table") && input_tensors->at("block_table").data != nullptr;
+
     Tensor&             k_cache = output_tensors->at("key_cache");
     Tensor&             v_cache = output_tensors->at("value_cache");
     std::vector<size_t> self_k_cache_size;
-    self_k_cache_size.push_back(local_batch_size);
+    self_k_cache_size.push_back(is_paged ? k_cache.shape[1] : local_batch_size);
     for (auto t = k_cache.shape.begin() + 2; t != k_cache.shape.end(); ++t) {
         self_k_cache_size.push_back(*t);
     }
     std::vector<size_t> self_v_cache_size;
-    self_v_cache_size.push_back(local_batch_size);
+    self_v_cache_size.push_back(is_paged ? v_cache.shape[1] : local_batch_size);
     for (auto t = v_cache.shape.begin() + 2; t != v_cache.shape.end(); ++t) {
         self_v_cache_size.push_back(*t);
     }
@@ -280,12 +287,21 @@ void GptJDecoder<T>::forward(std::unordered_map<std::string, Tensor>*       outp
             input_tensors->at("step"),
             input_tensors->at("cache_indirection"),
             input_tensors->at("masked_tokens")};
+        if (is_paged) {
+            const Tensor& block_table = input_tensors->at("block_table");
+            self_attention_input_tensors.push_back(Tensor{MEMORY_GPU, data_type, {1, 1, 1, 1}, nullptr});
+            self_attention_input_tensors.push_back(
+                Tensor{MEMORY_GPU,
+                       TYPE_INT32,
+                       {local_batch_size, block_table.shape[1]},
+                       block_table.getPtr<int>() + ite * local_batch_size * block_table.shape[1]});
+        }
 
         size_t cache_offset = l - getFirstLayerParallelId();
         for (auto t = k_cache.shape.begin() + 1; t != k_cache.shape.end(); ++t) {
             cache_offset *= *t;
         };
-        size_t ite_cache_offset = ite * local_batch_size;
+        size_t ite_cache_offset = is_paged ? 0 : ite * local_batch_size;
         for (auto t = k_cache.shape.begin() + 2; t != k_cache.shape.end(); ++t) {
             ite_cache_offset *= *t;
         }
@@ -15,6 +15,7 @@
  */
 
 #include "src/fastertransformer/models/gptj/GptJWeight.h"
+#include "src/fastertransformer/utils/packed_checkpoint.h"
 
 namespace fastertransformer {
 
@@ -238,6 +239,8 @@ void GptJWeight<T>::loadModel(std::string dir_path)
 {
     FtCudaDataType model_file_type = getModelFileType(dir_path + "/config.ini", "gptj");
     FT_CHECK(is_maintain_buffer == true);
+    // resolve the weights in dir_path/model.ftpack first when the checkpoint has been packed
+    PackedCheckpointScope packed_checkpoint(dir_path);
 
     loadWeightFromBin<T>(
         weights_ptr[0], {(size_t)(vocab_size_ * hidden_units_)}, dir_path + "/model.wte.bin", model_file_type);
@@ -273,9 +276,9 @@ void GptJWeight<T>::loadModel(std::string dir_path)
         }
     }
 
-    for (int l = 0; l < num_layer_; l++) {
+    loadLayersInParallel(num_layer_, [&](int l) {
         decoder_layer_weights[l].loadModel(dir_path + "/model.layers." + std::to_string(l), model_file_type);
-    }
+    });
 }
 
 template<typename T>
@@ -284,9 +284,9 @@ void GptJWeightINT8<T>::loadModelX(std::string dir_path)
         }
     }
 
-    for (int l = 0; l < num_layer_; l++) {
+    loadLayersInParallel(num_layer_, [&](int l) {
         decoder_layer_weights[l].loadModel(dir_path + "/model.layers." + std::to_string(l), model_file_type);
-    }
+    });
 }
 
 template<typename T>
@@ -329,9 +329,9 @@ void GptJWeightINT8<T>::loadModel(std::string dir_path)
         }
     }
 
-    for (int l = 0; l < num_layer_; l++) {
+    loadLayersInParallel(num_layer_, [&](int l) {
         decoder_layer_weights[l].loadModel(dir_path + "/model.layers." + std::to_string(l), model_file_type);
-    }
+    });
 }
 
 template<typename T>
@@ -15,6 +15,7 @@
  */
 
 #include "src/fastertransformer/models/gptneox/GptNeoXContextDecoder.h"
+#include "src/fastertransformer/kernels/bert_preprocess_kernels.h"
 #include "src/fastertransformer/kernels/gpt_kernels.h"
 
 #include "src/fastertransformer/layers/TensorParallelGeluFfnLayer.h"
@@ -77,6 +78,9 @@ void GptNeoXContextDecoder<T>::allocateBuffer(size_t batch_size, size_t seq_len)
         allocator_->reMalloc(ffn_output_, sizeof(T) * batch_size * seq_len * hidden_units_, false));
     decoder_layer_output_ = reinterpret_cast<T*>(
         allocator_->reMalloc(decoder_layer_output_, sizeof(T) * batch_size * seq_len * hidden_units_, false));
+    token_num_ = reinterpret_cast<size_t*>(allocator_->reMalloc(token_num_, sizeof(size_t) * 1, false));
+    padding_offset_ =
+        reinterpret_cast<int*>(allocator_->reMalloc(padding_offset_, sizeof(int) * batch_size * seq_len, false));
     is_allocate_buffer_ = true;
 }
 
@@ -88,6 +92,8 @@ void GptNeoXContextDecoder<T>::freeBuffer()
         allocator_->free((void**)(&self_attn_output_));
         allocator_->free((void**)(&ffn_output_));
         allocator_->free((void**)(&decoder_layer_output_));
+        allocator_->free((void**)(&token_num_));
+        allocator_->free((void**)(&padding_offset_));
         is_allocate_buffer_ = false;
     }
 }
@@ -138,7 +144,8 @@ GptNeoXContextDecoder<T>::GptNeoXContextDecoder(size_t
                                                 bool                                is_free_buffer_after_forward,
                                                 bool                                is_qk_buf_float,
                                                 std::shared_ptr<AbstractCustomComm> custom_all_reduce_comm,
-                                                int                                 enable_custom_all_reduce):
+                                                int                                 enable_custom_all_reduce,
+                                                bool                                remove_padding):
     BaseLayer(stream, cublas_wrapper, allocator, is_free_buffer_after_forward),
     head_num_(head_num),
     size_per_head_(size_per_head),
@@ -153,7 +160,8 @@ GptNeoXContextDecoder<T>::GptNeoXContextDecoder(size_t
     pipeline_para_(pipeline_para),
     is_qk_buf_float_(is_qk_buf_float),
     custom_all_reduce_comm_(custom_all_reduce_comm),
-    enable_custom_all_reduce_(enable_custom_all_reduce)
+    enable_custom_all_reduce_(enable_custom_all_reduce),
+    remove_padding_(remove_padding)
 {
     initialize();
 }
@@ -174,7 +182,8 @@ GptNeoXContextDecoder<T>::GptNeoXContextDecoder(GptNeoXContextDecoder<T> const&
     pipeline_para_(decoder.pipeline_para_),
     is_qk_buf_float_(decoder.is_qk_buf_float_),
     custom_all_reduce_comm_(decoder.custom_all_reduce_comm_),
-    enable_custom_all_reduce_(decoder.enable_custom_all_reduce_)
+    enable_custom_all_reduce_(decoder.enable_custom_all_reduce_),
+    remove_padding_(decoder.remove_padding_)
 {
     initialize();
 }
@@ -241,6 +250,7 @@ void GptNeoXContextDecoder<T>::forward(std::unordered_map<std::string, Tensor>*
     const T*   attention_mask          = (const T*)input_tensors->at("attention_mask").data;
     const T**  d_prefix_prompt_batch   = (const T**)input_tensors->at("d_prefix_prompt_batch").data;
     const int* d_prefix_prompt_lengths = (const int*)input_tensors->at("d_prefix_prompt_lengths").data;
+    const int* input_lengths           = (const int*)input_tensors->at("input_lengths").data;
 
     const int local_batch_size = getLocalBatchSize(batch_size, seq_len, pipeline_para_.world_size_);
     FT_CHECK(batch_size % local_batch_size == 0);
@@ -260,19 +270,44 @@ void GptNeoXContextDecoder<T>::forward(std::unordered_map<std::string, Tensor>*
     }
 
     for (int ite = 0; ite < iteration_num; ite++) {
+        size_t h_token_num = local_batch_size * seq_len;
+        if (remove_padding_) {
+            invokeGetPaddingOffset(&h_token_num,
+                                   token_num_,
+                                   padding_offset_,
+                                   input_lengths + ite * local_batch_size,
+                                   local_batch_size,
+                                   seq_len,
+                                   stream_);
+        }
+
         for (int l = 0; l < num_layer_; l++) {
             if (isValidLayerParallelId(l) == false) {
                 continue;
             }
 
+            if (l == 0 && remove_padding_) {
+                invokeRemovePadding(decoder_layer_output_,
+                                    decoder_input + ite * local_batch_size * seq_len * hidden_units_,
+                                    padding_offset_,
+                                    h_token_num,
+                                    hidden_units_,
+                                    stream_);
+            }
+
             const bool is_final = false;  // TODO(bhsueh) remove this flag
-            T*         layer_input =
-                ((l == 0) ? decoder_input : decoder_layer_output_) + ite * local_batch_size * seq_len * hidden_units_;
-            T* layer_output = ((l == num_layer_ - 1) ? decoder_output : decoder_layer_output_)
-                              + ite * local_batch_size * seq_len * hidden_units_;
+            // without padding, the tokens of the iteration stay packed in decoder_layer_output_ through the layers
+            T* layer_input  = decoder_layer_output_;
+            T* layer_output = decoder_layer_output_;
+            if (!remove_padding_) {
+                layer_input  = ((l == 0) ? decoder_input : decoder_layer_output_)
+                               + ite * local_batch_size * seq_len * hidden_units_;
+                layer_output = ((l == num_layer_ - 1) ? decoder_output : decoder_layer_output_)
+                               + ite * local_batch_size * seq_len * hidden_units_;
+            }
 
             if (isFirstLayerParallelId(l) && pipeline_para_.rank_ != 0 && pipeline_para_.world_size_ > 1) {
-                int data_size = local_batch_size * seq_len * hidden_units_ / tensor_para_.world_size_;
+                int data_size = h_token_num * hidden_units_ / tensor_para_.world_size_;
                 ftNcclRecv(layer_input + data_size * tensor_para_.rank_,
                            data_size,
                            pipeline_para_.rank_ - 1,
@@ -288,7 +323,7 @@ void GptNeoXContextDecoder<T>::forward(std::unordered_map<std::string, Tensor>*
                                    gpt_decoder_layer_weight->at(l)->pre_layernorm_weights.gamma,
                                    gpt_decoder_layer_weight->at(l)->pre_layernorm_weights.beta,
                                    layernorm_eps_,
-                                   local_batch_size * seq_len,
+                                   h_token_num,
                                    hidden_units_,
                                    stream_);
             sync_check_cuda_error();
@@ -296,7 +331,7 @@ void GptNeoXContextDecoder<T>::forward(std::unordered_map<std::string, Tensor>*
             std::vector<Tensor> self_attention_input_tensors{
                 Tensor{MEMORY_GPU,
                        data_type,
-                       {(size_t)(local_batch_size * seq_len), (size_t)hidden_units_},
+                       {h_token_num, (size_t)hidden_units_},
                        decoder_normed_input_},
                 Tensor{MEMORY_GPU,
                        data_type,
@@ -311,7 +346,8 @@ void GptNeoXContextDecoder<T>::forward(std::unordered_map<std::string, Tensor>*
                        TYPE_INT32,
                        {(size_t)local_batch_size},
                        d_prefix_prompt_lengths != nullptr ? d_prefix_prompt_lengths + ite * local_batch_size : nullptr},
-                Tensor{MEMORY_CPU, TYPE_INT32, {(size_t)1}, &l}};
+                Tensor{MEMORY_CPU, TYPE_INT32, {(size_t)1}, &l},
+                Tensor{MEMORY_GPU, TYPE_INT32, {h_token_num}, remove_padding_ ? padding_offset_ : nullptr}};
 
             size_t cache_offset = l - getFirstLayerParallelId();
             for (auto t = k_cache.shape.begin() + 1; t != k_cache.shape.end(); ++t) {
@@ -326,7 +362,7 @@ void GptNeoXContextDecoder<T>::forward(std::unordered_map<std::string, Tensor>*
             std::vector<Tensor> self_attention_output_tensors{
                 Tensor{MEMORY_GPU,
                        data_type,
-                       {(size_t)(local_batch_size * seq_len), (size_t)hidden_units_},
+                       {h_token_num, (size_t)hidden_units_},
                        self_attn_output_},
                 Tensor{MEMORY_GPU, data_type, self_k_cache_size, ((const T*)k_cache.data) + cache_offset},
                 Tensor{MEMORY_GPU, data_type, self_v_cache_size, ((const T*)v_cache.data) + cache_offset}};
@@ -342,7 +378,7 @@ void GptNeoXContextDecoder<T>::forward(std::unordered_map<std::string, Tensor>*
                                            gpt_decoder_layer_weight->at(l)->post_attention_layernorm_weights.gamma,
                                            gpt_decoder_layer_weight->at(l)->post_attention_layernorm_weights.beta,
                                            layernorm_eps_,
-                                           local_batch_size * seq_len,
+                                           h_token_num,
                                            hidden_units_,
                                            stream_);
                 }
@@ -355,7 +391,7 @@ void GptNeoXContextDecoder<T>::forward(std::unordered_map<std::string, Tensor>*
                         gpt_decoder_layer_weight->at(l)->post_attention_layernorm_weights.beta,
                         gpt_decoder_layer_weight->at(l)->self_attention_weights.attention_output_weight.bias,
                         layernorm_eps_,
-                        local_batch_size * seq_len,
+                        h_token_num,
                         hidden_units_,
                         stream_);
                 }
@@ -363,12 +399,12 @@ void GptNeoXContextDecoder<T>::forward(std::unordered_map<std::string, Tensor>*
                 std::vector<Tensor> ffn_input_tensors{
                     Tensor{MEMORY_GPU,
                            data_type,
-                           {(size_t)(local_batch_size * seq_len), (size_t)hidden_units_},
+                           {h_token_num, (size_t)hidden_units_},
                            decoder_normed_input_}};
                 std::vector<Tensor> ffn_output_tensors{
                     Tensor{MEMORY_GPU,
                            data_type,
-                           {(size_t)(local_batch_size * seq_len), (size_t)hidden_units_},
+                           {h_token_num, (size_t)hidden_units_},
                            use_gptj_residual_ ? ffn_output_ : layer_output}};
                 ffn_layer_->forward(
                     &ffn_output_tensors, &ffn_input_tensors, &gpt_decoder_layer_weight->at(l)->ffn_weights);
@@ -386,14 +422,14 @@ void GptNeoXContextDecoder<T>::forward(std::unordered_map<std::string, Tensor>*
                                                       self_attn_output_,
                                                       layer_input,
                                                       gpt_decoder_layer_weight->at(l)->ffn_weights.output_weight.bias,
-                                                      local_batch_size * seq_len,
+                                                      h_token_num,
                                                       hidden_units_,
                                                       tensor_para_.world_size_,
                                                       stream_);
                     if (tensor_para_.world_size_ > 1) {
                         ftNcclAllReduceSum(layer_output,
                                            layer_output,
-                                           local_batch_size * seq_len * hidden_units_,
+                                           h_token_num * hidden_units_,
                                            tensor_para_,
                                            stream_);
                     }
@@ -402,7 +438,7 @@ void GptNeoXContextDecoder<T>::forward(std::unordered_map<std::string, Tensor>*
                     invokeAddBiasResidual(layer_output,
                                           self_attn_output_,
                                           gpt_decoder_layer_weight->at(l)->ffn_weights.output_weight.bias,
-                                          local_batch_size * seq_len,
+                                          h_token_num,
                                           hidden_units_,
                                           stream_);
                 }
@@ -411,7 +447,7 @@ void GptNeoXContextDecoder<T>::forward(std::unordered_map<std::string, Tensor>*
 
                 if (isLastLayerParallelId(l) && pipeline_para_.rank_ != pipeline_para_.world_size_ - 1
                     && pipeline_para_.world_size_ > 1) {
-                    int data_size = local_batch_size * seq_len * hidden_units_ / tensor_para_.world_size_;
+                    int data_size = h_token_num * hidden_units_ / tensor_para_.world_size_;
                     ftNcclSend(layer_output + data_size * tensor_para_.rank_,
                                data_size,
                                pipeline_para_.rank_ + 1,
@@ -419,6 +455,15 @@ void GptNeoXContextDecoder<T>::forward(std::unordered_map<std::string, Tensor>*
                                stream_);
                 }
             }
+
+            if (l == num_layer_ - 1 && remove_padding_) {
+                invokeRebuildPadding(decoder_output + ite * local_batch_size * seq_len * hidden_units_,
+                                     decoder_layer_output_,
+                                     padding_offset_,
+                                     h_token_num,
+                                     hidden_units_,
+                                     stream_);
+            }
         }
     }
 
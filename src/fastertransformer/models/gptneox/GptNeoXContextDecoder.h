@@ -56,6 +56,10 @@ private:
 
     bool is_qk_buf_float_;
 
+    // run the context phase on the sum(input_lengths) tokens of the batch packed together instead of the padded
+    // [batch_size, seq_len] tokens, the attention finds the tokens of each sequence by their padding offsets
+    bool remove_padding_;
+
     BaseAttentionLayer<T>* self_attention_layer_;
     FfnLayer<T>*           ffn_layer_;
 
@@ -76,6 +80,9 @@ protected:
     T* ffn_output_           = nullptr;
     T* decoder_layer_output_ = nullptr;
 
+    size_t* token_num_      = nullptr;
+    int*    padding_offset_ = nullptr;
+
 public:
     GptNeoXContextDecoder(size_t                              head_num,
                           size_t                              size_per_head,
@@ -93,7 +100,8 @@ public:
                           bool                                is_free_buffer_after_forward,
                           bool                                is_qk_buf_float,
                           std::shared_ptr<AbstractCustomComm> custom_all_reduce_comm    = nullptr,
-                          int                                 enable_custom_all_reduce_ = 0);
+                          int                                 enable_custom_all_reduce_ = 0,
+                          bool                                remove_padding            = true);
 
     GptNeoXContextDecoder(GptNeoXContextDecoder<T> const& decoder);
 
@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/fastertransformer/models/multi_gpu_gpt/ContinuousBatchScheduler.h"
+#include "src/fastertransformer/utils/cuda_utils.h"
+#include <algorithm>
+
+namespace fastertransformer {
+
+ContinuousBatchScheduler::ContinuousBatchScheduler(const ContinuousBatchSchedulerConfig& config):
+    config_(config), slots_(config.max_batch_size)
+{
+    FT_CHECK_WITH_INFO(config_.max_batch_size > 0, "max_batch_size must be positive.");
+    FT_CHECK_WITH_INFO(config_.max_session_len > 1, "max_session_len must hold an input and a generated token.");
+}
+
+void ContinuousBatchScheduler::enqueue(GenerationRequest request)
+{
+    FT_CHECK_WITH_INFO(!request.input_ids.empty(),
+                       fmtstr("Request %lu has an empty input.", (unsigned long)request.request_id));
+    FT_CHECK_WITH_INFO(request.max_new_tokens > 0,
+                       fmtstr("Request %lu asks for no token.", (unsigned long)request.request_id));
+    FT_CHECK_WITH_INFO(request.input_ids.size() < config_.max_session_len,
+                       fmtstr("Input of request %lu (%lu tokens) does not fit in max_session_len %lu.",
+                              (unsigned long)request.request_id,
+                              request.input_ids.size(),
+                              config_.max_session_len));
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    queue_.push_back(QueuedRequest{std::move(request), step_});
+}
+
+void ContinuousBatchScheduler::admit(ScheduledBatch* batch)
+{
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    if (!config_.in_flight && getNumActive() > 0) {
+        return;
+    }
+    size_t context_tokens = 0;
+    for (size_t slot = 0; slot < slots_.size() && !queue_.empty(); slot++) {
+        if (slots_[slot].active) {
+            continue;
+        }
+        const size_t input_len = queue_.front().request.input_ids.size();
+        // requests are admitted in order, a long one is never overtaken by the shorter ones behind it
+        if (config_.max_context_tokens_per_step > 0 && context_tokens > 0
+            && context_tokens + input_len > config_.max_context_tokens_per_step) {
+            break;
+        }
+        context_tokens += input_len;
+
+        Slot& s                = slots_[slot];
+        s.active               = true;
+        s.request              = std::move(queue_.front().request);
+        s.result.request_id    = s.request.request_id;
+        s.result.output_ids    = {};
+        s.result.enqueue_step  = queue_.front().enqueue_step;
+        s.result.admit_step    = step_;
+        s.result.finish_step   = step_;
+        s.result.finish_reason = GenerationFinishReason::LENGTH;
+        queue_.pop_front();
+
+        batch->context_slots.push_back(slot);
+        stats_.num_admitted++;
+    }
+    stats_.num_context_tokens += context_tokens;
+}
+
+ScheduledBatch ContinuousBatchScheduler::schedule()
+{
+    FT_CHECK_WITH_INFO(!waiting_update_, "update() must be called for the previous batch before schedule().");
+    ScheduledBatch batch;
+    batch.step = step_;
+    for (size_t slot = 0; slot < slots_.size(); slot++) {
+        if (slots_[slot].active) {
+            batch.decode_slots.push_back(slot);
+        }
+    }
+    admit(&batch);
+
+    if (!batch.empty()) {
+        stats_.num_steps++;
+        stats_.num_busy_slot_steps += batch.context_slots.size() + batch.decode_slots.size();
+        last_batch_     = batch;
+        waiting_update_ = true;
+    }
+    return batch;
+}
+
+void ContinuousBatchScheduler::update(const std::vector<int>& tokens)
+{
+    FT_CHECK_WITH_INFO(waiting_update_, "update() is called without a scheduled batch.");
+    FT_CHECK_WITH_INFO(tokens.size() == slots_.size(),
+                       fmtstr("Expect one token per slot (%lu), got %lu.", slots_.size(), tokens.size()));
+    for (const std::vector<size_t>* slots : {&last_batch_.context_slots, &last_batch_.decode_slots}) {
+        for (size_t slot : *slots) {
+            Slot& s = slots_[slot];
+            s.result.output_ids.push_back(tokens[slot]);
+            stats_.num_generated++;
+            if (s.request.end_id >= 0 && tokens[slot] == s.request.end_id) {
+                finish(slot, GenerationFinishReason::END_ID);
+            }
+            else if (s.result.output_ids.size() >= s.request.max_new_tokens) {
+                finish(slot, GenerationFinishReason::LENGTH);
+            }
+            else if (s.request.input_ids.size() + s.result.output_ids.size() >= config_.max_session_len) {
+                finish(slot, GenerationFinishReason::SESSION_LENGTH);
+            }
+        }
+    }
+    waiting_update_ = false;
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    step_++;
+}
+
+void ContinuousBatchScheduler::finish(size_t slot, GenerationFinishReason reason)
+{
+    Slot& s                = slots_[slot];
+    s.result.finish_reason = reason;
+    s.result.finish_step   = last_batch_.step;
+    finished_.push_back(std::move(s.result));
+    s.active  = false;
+    s.request = GenerationRequest();
+    s.result  = GenerationResult();
+    stats_.num_finished++;
+}
+
+std::vector<GenerationResult> ContinuousBatchScheduler::popFinished()
+{
+    std::vector<GenerationResult> finished;
+    finished.swap(finished_);
+    return finished;
+}
+
+bool ContinuousBatchScheduler::hasPendingWork() const
+{
+    return getNumActive() > 0 || getNumQueued() > 0;
+}
+
+size_t ContinuousBatchScheduler::getNumQueued() const
+{
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    return queue_.size();
+}
+
+size_t ContinuousBatchScheduler::getNumActive() const
+{
+    size_t num_active = 0;
+    for (const Slot& slot : slots_) {
+        num_active += slot.active ? 1 : 0;
+    }
+    return num_active;
+}
+
+bool ContinuousBatchScheduler::getSlotRequest(size_t slot, uint64_t* request_id) const
+{
+    FT_CHECK(slot < slots_.size());
+    if (!slots_[slot].active) {
+        return false;
+    }
+    *request_id = slots_[slot].request.request_id;
+    return true;
+}
+
+const std::vector<int>& ContinuousBatchScheduler::getSlotInputIds(size_t slot) const
+{
+    FT_CHECK(slot < slots_.size());
+    return slots_[slot].request.input_ids;
+}
+
+size_t ContinuousBatchScheduler::getSlotSequenceLength(size_t slot) const
+{
+    FT_CHECK(slot < slots_.size());
+    const Slot& s = slots_[slot];
+    return s.active ? s.request.input_ids.size() + s.result.output_ids.size() : 0;
+}
+
+int ContinuousBatchScheduler::getDecodeInputs(const ScheduledBatch& batch,
+                                              int*                  positions,
+                                              int*                  padding_counts,
+                                              int*                  token_ids) const
+{
+    std::fill(positions, positions + slots_.size(), 0);
+    std::fill(padding_counts, padding_counts + slots_.size(), 0);
+    std::fill(token_ids, token_ids + slots_.size(), 0);
+    int max_position = 0;
+    for (size_t slot : batch.decode_slots) {
+        const Slot& s = slots_[slot];
+        FT_CHECK_WITH_INFO(s.active && !s.result.output_ids.empty(),
+                           fmtstr("Slot %lu has no generated token to decode.", slot));
+        positions[slot] = (int)getSlotSequenceLength(slot) - 1;
+        token_ids[slot] = s.result.output_ids.back();
+        max_position    = std::max(max_position, positions[slot]);
+    }
+    for (size_t slot : batch.decode_slots) {
+        padding_counts[slot] = max_position - positions[slot];
+    }
+    return max_position + 1;
+}
+
+void ContinuousBatchScheduler::getSamplingInputs(const ScheduledBatch& batch,
+                                                 unsigned long long*   random_seeds,
+                                                 int*                  random_steps) const
+{
+    std::fill(random_seeds, random_seeds + slots_.size(), 0ULL);
+    std::fill(random_steps, random_steps + slots_.size(), 0);
+    for (const std::vector<size_t>* slots : {&batch.context_slots, &batch.decode_slots}) {
+        for (size_t slot : *slots) {
+            const Slot& s = slots_[slot];
+            FT_CHECK_WITH_INFO(s.active, fmtstr("Slot %lu is scheduled without a request.", slot));
+            random_seeds[slot] = s.request.random_seed;
+            random_steps[slot] = (int)s.result.output_ids.size();
+        }
+    }
+}
+
+ContinuousBatchSchedulerStats ContinuousBatchScheduler::getStats() const
+{
+    return stats_;
+}
+
+}  // namespace fastertransformer
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * Iteration-level (continuous) batching
+ *
+ * The batch is a fixed set of slots; slot i owns row i of the KV cache and of the per-sequence buffers. Every
+ * generation step the model asks schedule() what to run:
+ *   - context_slots: requests admitted into free slots at this step boundary. The model runs their context phase,
+ *     writes their KV into the slot and samples their first token from the context logits.
+ *   - decode_slots: slots already generating, which produce one token each.
+ * The model then reports the token of every scheduled slot with update(). Sequences reaching their end id or their
+ * length limit are evicted right away, so the next schedule() can admit queued requests into the freed slots
+ * instead of waiting for the longest sequence of the batch.
+ *
+ * The scheduler is host-only bookkeeping: enqueue() may be called from any thread, schedule() and update() from the
+ * thread driving the model.
+ **/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace fastertransformer {
+
+struct GenerationRequest {
+    uint64_t         request_id;
+    std::vector<int> input_ids;
+    size_t           max_new_tokens;
+    int              end_id = -1;  // -1 to only stop on max_new_tokens
+    // Seed of the sampled tokens. With its generation steps it keys the random numbers of the request, which then
+    // samples the same tokens whatever its slot and the step it is admitted at.
+    unsigned long long random_seed = 0;
+};
+
+enum class GenerationFinishReason {
+    END_ID,          // the end id was generated
+    LENGTH,          // max_new_tokens tokens were generated
+    SESSION_LENGTH,  // the slot is full (max_session_len)
+};
+
+struct GenerationResult {
+    uint64_t               request_id;
+    std::vector<int>       output_ids;  // generated tokens, the end id included
+    GenerationFinishReason finish_reason;
+    size_t                 enqueue_step;  // step at which the request was enqueued
+    size_t                 admit_step;    // step at which its context phase ran
+    size_t                 finish_step;   // step at which its last token was generated
+};
+
+struct ScheduledBatch {
+    size_t              step;
+    std::vector<size_t> context_slots;  // run the context phase, then sample the first token
+    std::vector<size_t> decode_slots;   // generate one token
+
+    bool empty() const
+    {
+        return context_slots.empty() && decode_slots.empty();
+    }
+};
+
+struct ContinuousBatchSchedulerConfig {
+    size_t max_batch_size  = 1;  // number of slots
+    size_t max_session_len = 0;  // tokens a slot holds, input included
+    // Upper bound on the context tokens admitted per step, bounding the stall of the running sequences. 0 means no
+    // bound. A request longer than the bound is still admitted when it is the first one of its step.
+    size_t max_context_tokens_per_step = 0;
+    // false gives static batching: requests are only admitted once every slot is free.
+    bool in_flight = true;
+};
+
+struct ContinuousBatchSchedulerStats {
+    size_t num_steps           = 0;
+    size_t num_admitted        = 0;
+    size_t num_finished        = 0;
+    size_t num_context_tokens  = 0;
+    size_t num_generated       = 0;
+    size_t num_busy_slot_steps = 0;  // sum over the steps of the slots holding a request
+
+    // Fraction of the slot-steps doing useful work.
+    double slotUtilization(size_t max_batch_size) const
+    {
+        return num_steps == 0 ? 0.0 : (double)num_busy_slot_steps / (num_steps * max_batch_size);
+    }
+};
+
+class ContinuousBatchScheduler {
+public:
+    explicit ContinuousBatchScheduler(const ContinuousBatchSchedulerConfig& config);
+
+    // Queues a request. Throws if it can never fit in a slot.
+    void enqueue(GenerationRequest request);
+
+    // Admits queued requests into free slots and returns the work of the next step.
+    ScheduledBatch schedule();
+
+    // Reports the tokens of the last scheduled batch; tokens[i] belongs to slot i, other entries are ignored.
+    void update(const std::vector<int>& tokens);
+
+    // Returns and clears the results of the finished requests.
+    std::vector<GenerationResult> popFinished();
+
+    bool   hasPendingWork() const;
+    size_t getNumQueued() const;
+    size_t getNumActive() const;
+
+    // Request in `slot`, or false if the slot is free.
+    bool getSlotRequest(size_t slot, uint64_t* request_id) const;
+    // Input of the request in `slot`, to run its context phase.
+    const std::vector<int>& getSlotInputIds(size_t slot) const;
+    // Tokens held by `slot`: the input and the tokens generated so far.
+    size_t getSlotSequenceLength(size_t slot) const;
+
+    // Inputs of the decode slots of `batch` for a decoder that runs every slot at one shared step, with
+    // [max_batch_size] arrays: positions[i] is the position of the token decoded by slot i (the tokens already in its
+    // KV cache), token_ids[i] that token (the last one generated) and padding_counts[i] = step - 1 - positions[i], its
+    // offset from the shared step. Returns the step, the largest position + 1. Other slots get 0 and must be masked
+    // out.
+    int getDecodeInputs(const ScheduledBatch& batch, int* positions, int* padding_counts, int* token_ids) const;
+
+    // Sampling inputs of the scheduled slots of `batch`, with [max_batch_size] arrays: random_seeds[i] is the seed of
+    // the request in slot i and random_steps[i] its generation step, the number of tokens it has generated so far.
+    // Other slots get 0.
+    void getSamplingInputs(const ScheduledBatch& batch, unsigned long long* random_seeds, int* random_steps) const;
+
+    const ContinuousBatchSchedulerConfig& getConfig() const
+    {
+        return config_;
+    }
+    ContinuousBatchSchedulerStats getStats() const;
+
+private:
+    struct QueuedRequest {
+        GenerationRequest request;
+        size_t            enqueue_step;
+    };
+
+    struct Slot {
+        bool              active = false;
+        GenerationRequest request;
+        GenerationResult  result;
+    };
+
+    void admit(ScheduledBatch* batch);
+    void finish(size_t slot, GenerationFinishReason reason);
+
+    const ContinuousBatchSchedulerConfig config_;
+
+    mutable std::mutex        queue_mutex_;
+    std::deque<QueuedRequest> queue_;
+
+    std::vector<Slot>             slots_;
+    std::vector<GenerationResult> finished_;
+    ScheduledBatch                last_batch_;
+    bool                          waiting_update_ = false;
+    size_t                        step_           = 0;
+    ContinuousBatchSchedulerStats stats_;
+};
+
+}  // namespace fastertransformer
@@ -21,8 +21,11 @@
 #include "src/fastertransformer/kernels/decoding_kernels.h"
 #include "src/fastertransformer/kernels/gpt_kernels.h"
 #include "src/fastertransformer/kernels/logprob_kernels.h"
+#include "src/fastertransformer/kernels/unfused_attention_kernels.h"
 #include "src/fastertransformer/layers/beam_search_layers/BaseBeamSearchLayer.h"
 #include "src/fastertransformer/utils/logger.h"
+#include <algorithm>
+#include <thread>
 
 namespace fastertransformer {
 
@@ -92,91 +95,153 @@ void ParallelGpt<T>::allocateBuffer(size_t batch_size,
                                     bool   is_return_context_cum_log_probs)
 {
     FT_LOG_DEBUG(__PRETTY_FUNCTION__);
+    AllocatorTagScope allocator_tag("ParallelGpt");
     const size_t batchxbeam = batch_size * beam_width;
-    const size_t self_cache_size =
-        (num_layer_ / pipeline_para_.world_size_) * batchxbeam * memory_len * hidden_units_ / tensor_para_.world_size_;
+    // The buffer list of the activation memory plan is the single source of the sizes, so that the plan accounts
+    // for every buffer allocated here.
+    MemoryPlanner plan;
+    addParallelGptActivationBuffers(&plan,
+                                    getActivationMemoryPlanParams(batch_size,
+                                                                  beam_width,
+                                                                  max_session_len,
+                                                                  memory_len,
+                                                                  max_input_len,
+                                                                  is_return_context_cum_log_probs));
+    auto reMalloc = [&](void* ptr, const char* name, bool is_set_zero) {
+        return allocator_->reMalloc(ptr, plan.getSize(name), is_set_zero);
+    };
 
     if (vocab_size_ != vocab_size_padded_) {
-        padded_embedding_kernel_ =
-            (T*)(allocator_->reMalloc(padded_embedding_kernel_, sizeof(T) * hidden_units_ * vocab_size_padded_, true));
+        padded_embedding_kernel_     = (T*)reMalloc(padded_embedding_kernel_, "padded_embedding_kernel", true);
         padded_embedding_kernel_ptr_ = padded_embedding_kernel_;
     }
 
-    input_attention_mask_ = (T*)(allocator_->reMalloc(
-        input_attention_mask_, sizeof(T) * batchxbeam * max_input_len * max_input_len, false));
-    decoder_input_buf_ = (T*)(allocator_->reMalloc(decoder_input_buf_, sizeof(T) * batchxbeam * hidden_units_, false));
-    decoder_output_buf_ =
-        (T*)(allocator_->reMalloc(decoder_output_buf_, sizeof(T) * batchxbeam * hidden_units_, false));
-    normed_decoder_output_buf_ =
-        (T*)(allocator_->reMalloc(normed_decoder_output_buf_, sizeof(T) * batchxbeam * hidden_units_, false));
-    logits_buf_ = (float*)(allocator_->reMalloc(logits_buf_, sizeof(float) * batchxbeam * vocab_size_padded_, false));
-    nccl_logits_buf_ =
-        (float*)(allocator_->reMalloc(nccl_logits_buf_, sizeof(float) * batchxbeam * vocab_size_padded_, false));
-    cum_log_probs_    = (float*)(allocator_->reMalloc(cum_log_probs_, sizeof(float) * batchxbeam, false));
-    finished_buf_     = (bool*)(allocator_->reMalloc(finished_buf_, sizeof(bool) * batchxbeam, false));
-    h_finished_buf_   = new bool[batchxbeam];
-    sequence_lengths_ = (int*)(allocator_->reMalloc(sequence_lengths_, sizeof(int) * batchxbeam, false));
-
-    key_cache_   = (T*)(allocator_->reMalloc(key_cache_, sizeof(T) * self_cache_size * 2, true));
-    value_cache_ = key_cache_ + self_cache_size;
+    input_attention_mask_      = (T*)reMalloc(input_attention_mask_, "input_attention_mask", false);
+    decoder_input_buf_         = (T*)reMalloc(decoder_input_buf_, "decoder_input_buf", false);
+    decoder_output_buf_        = (T*)reMalloc(decoder_output_buf_, "decoder_output_buf", false);
+    normed_decoder_output_buf_ = (T*)reMalloc(normed_decoder_output_buf_, "normed_decoder_output_buf", false);
+    logits_buf_                = (float*)reMalloc(logits_buf_, "logits_buf", false);
+    nccl_logits_buf_           = (float*)reMalloc(nccl_logits_buf_, "nccl_logits_buf", false);
+    cum_log_probs_             = (float*)reMalloc(cum_log_probs_, "cum_log_probs", false);
+    finished_buf_              = (bool*)reMalloc(finished_buf_, "finished_buf", false);
+    h_finished_buf_            = new bool[batchxbeam];
+    sequence_lengths_          = (int*)reMalloc(sequence_lengths_, "sequence_lengths", false);
+
+    key_cache_   = (T*)reMalloc(key_cache_, "key_value_cache", true);
+    value_cache_ = key_cache_ + plan.getSize("key_value_cache") / sizeof(T) / 2;
     if (beam_width > 1) {
-        cache_indirections_[0] =
-            (int*)(allocator_->reMalloc(cache_indirections_[0], sizeof(int) * batchxbeam * memory_len * 2, true));
+        cache_indirections_[0] = (int*)reMalloc(cache_indirections_[0], "cache_indirections", true);
         cache_indirections_[1] = cache_indirections_[0] + batchxbeam * memory_len;
     }
+    if (beam_width > 1) {
+        compact_rows_buf_            = (int*)reMalloc(compact_rows_buf_, "compact_rows_buf", false);
+        live_compact_to_batch_       = compact_rows_buf_;
+        live_batch_to_compact_       = compact_rows_buf_ + batchxbeam;
+        compact_sequence_lengths_    = compact_rows_buf_ + 2 * batchxbeam;
+        compact_total_padding_count_ = compact_rows_buf_ + 3 * batchxbeam;
+        compact_cache_indirection_   = compact_rows_buf_ + 4 * batchxbeam;
+        compact_masks_buf_           = (bool*)reMalloc(compact_masks_buf_, "compact_masks_buf", false);
+        is_done_buf_                 = compact_masks_buf_;
+        compact_finished_            = compact_masks_buf_ + batch_size;
+        compact_masked_tokens_       = compact_masks_buf_ + batch_size + batchxbeam;
+        compact_decoder_input_       = (T*)reMalloc(compact_decoder_input_, "compact_decoder_buf", false);
+        compact_decoder_output_      = compact_decoder_input_ + batchxbeam * hidden_units_;
+    }
+    if (kv_block_size_ > 0) {
+        block_tables_buf_    = (int*)reMalloc(block_tables_buf_, "block_tables_buf", true);
+        kv_block_copies_buf_ = (int*)reMalloc(kv_block_copies_buf_, "kv_block_copies_buf", false);
+    }
 
-    tiled_input_ids_buf_ =
-        (int*)(allocator_->reMalloc(tiled_input_ids_buf_, sizeof(int) * batchxbeam * max_session_len, true));
-    tiled_input_lengths_buf_ = (int*)(allocator_->reMalloc(tiled_input_lengths_buf_, sizeof(int) * batchxbeam, true));
+    tiled_input_ids_buf_     = (int*)reMalloc(tiled_input_ids_buf_, "tiled_input_ids_buf", true);
+    tiled_input_lengths_buf_ = (int*)reMalloc(tiled_input_lengths_buf_, "tiled_input_lengths_buf", true);
 
     // prompt_learning weight batch ptrs
     prompt_learning_weight_batch_ =
-        (const T**)(allocator_->reMalloc(prompt_learning_weight_batch_, sizeof(T*) * batchxbeam, false));
-    tiled_prompt_lengths_buf_ =
-        (int*)(allocator_->reMalloc(tiled_prompt_lengths_buf_, sizeof(int) * batchxbeam, false));
-
-    start_ids_buf_ = (int*)(allocator_->reMalloc(start_ids_buf_, sizeof(int) * batch_size, false));
-    end_ids_buf_   = (int*)(allocator_->reMalloc(end_ids_buf_, sizeof(int) * batch_size, false));
-
-    transposed_output_ids_buf_ =
-        (int*)(allocator_->reMalloc(transposed_output_ids_buf_, sizeof(int) * batchxbeam * max_session_len, true));
-    output_ids_buf_ = (int*)(allocator_->reMalloc(output_ids_buf_, sizeof(int) * batchxbeam * max_session_len, true));
-    parent_ids_buf_ = (int*)(allocator_->reMalloc(parent_ids_buf_, sizeof(int) * batchxbeam * max_session_len, true));
-    seq_limit_len_  = (uint32_t*)(allocator_->reMalloc(seq_limit_len_, sizeof(uint32_t) * batch_size, false));
-    masked_tokens_  = (bool*)(allocator_->reMalloc(masked_tokens_, sizeof(bool) * batchxbeam * memory_len, true));
-
-    context_decoder_input_buf_  = (T*)(allocator_->reMalloc(
-        context_decoder_input_buf_, sizeof(T) * batchxbeam * max_input_len * hidden_units_, false));
-    context_decoder_output_buf_ = (T*)(allocator_->reMalloc(
-        context_decoder_output_buf_, sizeof(T) * batchxbeam * max_input_len * hidden_units_, false));
-    output_log_probs_buf_ =
-        (float*)(allocator_->reMalloc(output_log_probs_buf_, sizeof(float) * batchxbeam * max_session_len, false));
+        (const T**)reMalloc(prompt_learning_weight_batch_, "prompt_learning_weight_batch", false);
+    tiled_prompt_lengths_buf_ = (int*)reMalloc(tiled_prompt_lengths_buf_, "tiled_prompt_lengths_buf", false);
+
+    start_ids_buf_ = (int*)reMalloc(start_ids_buf_, "start_ids_buf", false);
+    end_ids_buf_   = (int*)reMalloc(end_ids_buf_, "end_ids_buf", false);
+
+    transposed_output_ids_buf_ = (int*)reMalloc(transposed_output_ids_buf_, "transposed_output_ids_buf", true);
+    output_ids_buf_            = (int*)reMalloc(output_ids_buf_, "output_ids_buf", true);
+    parent_ids_buf_            = (int*)reMalloc(parent_ids_buf_, "parent_ids_buf", true);
+    seq_limit_len_             = (uint32_t*)reMalloc(seq_limit_len_, "seq_limit_len", false);
+    masked_tokens_             = (bool*)reMalloc(masked_tokens_, "masked_tokens", true);
+
+    context_decoder_input_buf_  = (T*)reMalloc(context_decoder_input_buf_, "context_decoder_input_buf", false);
+    context_decoder_output_buf_ = (T*)reMalloc(context_decoder_output_buf_, "context_decoder_output_buf", false);
+    output_log_probs_buf_       = (float*)reMalloc(output_log_probs_buf_, "output_log_probs_buf", false);
 
     if (is_return_context_cum_log_probs) {
-        lp_normed_decoder_output_buf_ = (T*)allocator_->reMalloc(
-            lp_normed_decoder_output_buf_, sizeof(T) * batchxbeam * max_input_len * hidden_units_);
-        lp_logits_buf_      = (float*)allocator_->reMalloc(lp_logits_buf_,
-                                                      sizeof(float) * batchxbeam * max_input_len * vocab_size_padded_);
-        lp_nccl_logits_buf_ = (float*)allocator_->reMalloc(
-            lp_nccl_logits_buf_, sizeof(float) * batchxbeam * max_input_len * vocab_size_padded_);
-        lp_logprob_buf_ = (float*)allocator_->reMalloc(lp_logprob_buf_, sizeof(float) * batchxbeam * max_input_len);
+        lp_normed_decoder_output_buf_ =
+            (T*)reMalloc(lp_normed_decoder_output_buf_, "lp_normed_decoder_output_buf", true);
+        lp_logits_buf_      = (float*)reMalloc(lp_logits_buf_, "lp_logits_buf", true);
+        lp_nccl_logits_buf_ = (float*)reMalloc(lp_nccl_logits_buf_, "lp_nccl_logits_buf", true);
+        lp_logprob_buf_     = (float*)reMalloc(lp_logprob_buf_, "lp_logprob_buf", true);
     }
     if (shared_contexts_ratio_ > 0.0f) {
-        shared_contexts_idx_  = (int*)allocator_->reMalloc(shared_contexts_idx_, 3 * batch_size * sizeof(int), false);
+        shared_contexts_idx_  = (int*)reMalloc(shared_contexts_idx_, "shared_contexts_idx", false);
         batch_to_compact_idx_ = shared_contexts_idx_ + batch_size;
         compact_idx_          = shared_contexts_idx_ + 2 * batch_size;
-        compact_size_         = (int*)allocator_->reMalloc(compact_size_, sizeof(int), false);
+        compact_size_         = (int*)reMalloc(compact_size_, "compact_size", false);
     }
 
     if (generation_should_stop_ == nullptr) {
         cudaMallocHost(&generation_should_stop_, 1 * sizeof(bool));
     }
-    tiled_total_padding_count_ =
-        (int*)allocator_->reMalloc(tiled_total_padding_count_, batchxbeam * sizeof(int), false);
+    tiled_total_padding_count_ = (int*)reMalloc(tiled_total_padding_count_, "tiled_total_padding_count", false);
+    cancel_statuses_buf_       = (int*)reMalloc(cancel_statuses_buf_, "cancel_statuses_buf", false);
 
     is_allocate_buffer_ = true;
 }
 
+template<typename T>
+ParallelGptMemoryPlanParams ParallelGpt<T>::getActivationMemoryPlanParams(size_t batch_size,
+                                                                          size_t beam_width,
+                                                                          size_t max_session_len,
+                                                                          size_t memory_len,
+                                                                          size_t max_input_len,
+                                                                          bool   is_return_context_cum_log_probs) const
+{
+    ParallelGptMemoryPlanParams params;
+    params.batch_size                      = batch_size;
+    params.beam_width                      = beam_width;
+    params.max_input_len                   = max_input_len;
+    params.max_session_len                 = max_session_len;
+    params.memory_len                      = memory_len;
+    params.head_num                        = head_num_;
+    params.size_per_head                   = size_per_head_;
+    params.inter_size                      = inter_size_;
+    params.num_layer                       = num_layer_;
+    params.vocab_size                      = vocab_size_;
+    params.vocab_size_padded               = vocab_size_padded_;
+    params.tensor_para_size                = tensor_para_.world_size_;
+    params.pipeline_para_size              = pipeline_para_.world_size_;
+    params.data_type_size                  = sizeof(T);
+    params.use_gated_activation            = isGatedActivation(gpt_variant_params_.activation_type);
+    params.has_adapters                    = gpt_variant_params_.has_adapters;
+    params.adapter_inter_size              = gpt_variant_params_.adapter_inter_size;
+    params.is_context_qk_buf_float         = is_context_qk_buf_float_;
+    params.use_shared_contexts             = shared_contexts_ratio_ > 0.0f;
+    params.is_return_context_cum_log_probs = is_return_context_cum_log_probs;
+    params.kv_block_size                   = kv_block_size_;
+    params.kv_num_blocks                   = kv_num_blocks_;
+    return params;
+}
+
+template<typename T>
+MemoryPlanner ParallelGpt<T>::getActivationMemoryPlan(size_t batch_size,
+                                                      size_t beam_width,
+                                                      size_t max_session_len,
+                                                      size_t memory_len,
+                                                      size_t max_input_len,
+                                                      bool   is_return_context_cum_log_probs) const
+{
+    return planParallelGptActivationMemory(getActivationMemoryPlanParams(
+        batch_size, beam_width, max_session_len, memory_len, max_input_len, is_return_context_cum_log_probs));
+}
+
 template<typename T>
 void ParallelGpt<T>::freeBuffer()
 {
@@ -196,11 +261,17 @@ void ParallelGpt<T>::freeBuffer()
         allocator_->free((void**)(&finished_buf_));
         delete[] h_finished_buf_;
         allocator_->free((void**)(&sequence_lengths_));
+        allocator_->free((void**)(&cancel_statuses_buf_));
 
         allocator_->free((void**)(&key_cache_));
         if (cache_indirections_[0] != nullptr) {
             allocator_->free((void**)(&cache_indirections_)[0]);
         }
+        allocator_->free((void**)(&compact_rows_buf_));
+        allocator_->free((void**)(&compact_masks_buf_));
+        allocator_->free((void**)(&compact_decoder_input_));
+        allocator_->free((void**)(&block_tables_buf_));
+        allocator_->free((void**)(&kv_block_copies_buf_));
 
         allocator_->free((void**)(&tiled_input_ids_buf_));
         allocator_->free((void**)(&tiled_input_lengths_buf_));
@@ -221,12 +292,20 @@ void ParallelGpt<T>::freeBuffer()
         allocator_->free((void**)(&context_decoder_input_buf_));
         allocator_->free((void**)(&context_decoder_output_buf_));
         allocator_->free((void**)(&output_log_probs_buf_));
+        allocator_->free((void**)(&context_key_cache_));
+        context_value_cache_ = nullptr;
+        allocator_->free((void**)(&slot_to_context_idx_));
 
         allocator_->free((void**)(&lp_normed_decoder_output_buf_));
         allocator_->free((void**)(&lp_logits_buf_));
         allocator_->free((void**)(&lp_nccl_logits_buf_));
         allocator_->free((void**)(&lp_logprob_buf_));
 
+        allocator_->free((void**)(&prefix_kv_));
+        allocator_->free((void**)(&prefix_kv_batch_));
+        allocator_->free((void**)(&prefix_block_tables_));
+        allocator_->free((void**)(&prefix_store_buf_));
+
         cudaFreeHost(generation_should_stop_);
 
         if (shared_contexts_ratio_ > 0.0f) {
@@ -353,6 +432,7 @@ ParallelGpt<T>::~ParallelGpt()
     delete gpt_context_decoder_;
     delete dynamic_decode_layer_;
     freeBuffer();
+    disablePrefixCache();
 }
 
 template<typename T>
@@ -482,6 +562,467 @@ void ParallelGpt<T>::unRegisterCallback()
     token_generated_ctx_ = nullptr;
 }
 
+template<typename T>
+void ParallelGpt<T>::registerTokenStream(TokenRingBuffer* ring)
+{
+    token_ring_ = ring;
+}
+
+template<typename T>
+void ParallelGpt<T>::unRegisterTokenStream()
+{
+    token_ring_ = nullptr;
+}
+
+template<typename T>
+void ParallelGpt<T>::registerCancellation(RequestCancellation* cancellation)
+{
+    cancellation_ = cancellation;
+}
+
+template<typename T>
+void ParallelGpt<T>::unRegisterCancellation()
+{
+    cancellation_ = nullptr;
+}
+
+template<typename T>
+void ParallelGpt<T>::enablePrefixCache(size_t block_size, size_t max_bytes)
+{
+    disablePrefixCache();
+    FT_CHECK_WITH_INFO(block_size > 0, "The prefix cache needs a positive block size.");
+    const size_t bytes_per_block =
+        (num_layer_ / pipeline_para_.world_size_) * 2 * local_head_num_ * block_size * size_per_head_ * sizeof(T);
+    prefix_num_blocks_ = max_bytes / bytes_per_block;
+    FT_CHECK_WITH_INFO(prefix_num_blocks_ > 0,
+                       fmtstr("The prefix cache of %ld bytes cannot hold a block of %ld bytes.",
+                              max_bytes,
+                              bytes_per_block));
+
+    AllocatorTagScope allocator_tag("ParallelGpt");
+    prefix_kv_pool_ =
+        (T*)allocator_->reMalloc(prefix_kv_pool_, prefix_num_blocks_ * bytes_per_block, false);
+    prefix_cache_.reset(new PrefixCache(block_size, bytes_per_block, prefix_num_blocks_ * bytes_per_block));
+    prefix_free_blocks_.resize(prefix_num_blocks_);
+    for (size_t i = 0; i < prefix_num_blocks_; i++) {
+        // popped from the back, lower blocks first
+        prefix_free_blocks_[i] = (int)(prefix_num_blocks_ - 1 - i);
+    }
+}
+
+template<typename T>
+void ParallelGpt<T>::disablePrefixCache()
+{
+    prefix_cache_.reset();
+    prefix_free_blocks_.clear();
+    prefix_num_blocks_ = 0;
+    allocator_->free((void**)(&prefix_kv_pool_));
+}
+
+template<typename T>
+PrefixCacheStats ParallelGpt<T>::getPrefixCacheStats() const
+{
+    return prefix_cache_ != nullptr ? prefix_cache_->getStats() : PrefixCacheStats();
+}
+
+template<typename T>
+size_t ParallelGpt<T>::matchPrefixCache(const size_t                   batch_size,
+                                        const size_t                   beam_width,
+                                        const size_t                   max_input_length,
+                                        const std::vector<int>&        h_input_ids,
+                                        const std::vector<int>&        h_input_lengths,
+                                        std::vector<PrefixCacheMatch>* matches)
+{
+    const size_t block_size = prefix_cache_->getBlockSize();
+    size_t       prefix_len = SIZE_MAX;
+    for (size_t i = 0; i < batch_size; i++) {
+        const std::vector<int> tokens(h_input_ids.begin() + i * max_input_length,
+                                      h_input_ids.begin() + i * max_input_length + h_input_lengths[i]);
+        // the context phase keeps at least the last token, its hidden state gives the first logits
+        matches->push_back(prefix_cache_->match(tokens, tokens.empty() ? 0 : tokens.size() - 1));
+        prefix_len = std::min(prefix_len, matches->back().num_tokens);
+    }
+    if (prefix_len == 0) {
+        return 0;
+    }
+
+    // the sequences share the prefix length so that the rest of the inputs keeps one shape
+    const size_t     batchxbeam        = batch_size * beam_width;
+    const size_t     num_prefix_blocks = prefix_len / block_size;
+    std::vector<int> h_block_tables(batchxbeam * num_prefix_blocks);
+    for (size_t i = 0; i < batchxbeam; i++) {
+        const std::vector<int>& blocks = matches->at(i / beam_width).blocks;
+        std::copy(blocks.begin(), blocks.begin() + num_prefix_blocks, h_block_tables.begin() + i * num_prefix_blocks);
+    }
+
+    const size_t local_num_layer = num_layer_ / pipeline_para_.world_size_;
+    prefix_kv_                   = (T*)allocator_->reMalloc(
+        prefix_kv_, sizeof(T) * batchxbeam * num_layer_ * 2 * local_head_num_ * prefix_len * size_per_head_, false);
+    prefix_kv_batch_ = (const T**)allocator_->reMalloc(prefix_kv_batch_, sizeof(T*) * batchxbeam, false);
+    prefix_block_tables_ =
+        (int*)allocator_->reMalloc(prefix_block_tables_, sizeof(int) * h_block_tables.size(), false);
+    cudaAutoCpy(prefix_block_tables_, h_block_tables.data(), h_block_tables.size(), stream_);
+    deviceFill(tiled_prompt_lengths_buf_, (int)batchxbeam, (int)prefix_len, stream_);
+    invokeGatherPrefixKV(prefix_kv_,
+                         prefix_kv_batch_,
+                         prefix_kv_pool_,
+                         prefix_block_tables_,
+                         tiled_prompt_lengths_buf_,
+                         batchxbeam,
+                         num_prefix_blocks,
+                         prefix_len,
+                         num_layer_,
+                         local_num_layer * pipeline_para_.rank_,
+                         local_num_layer,
+                         local_head_num_,
+                         block_size,
+                         size_per_head_,
+                         stream_);
+    check_cuda_error(cudaStreamSynchronize(stream_));
+    return prefix_len;
+}
+
+template<typename T>
+void ParallelGpt<T>::insertPrefixCache(const size_t                         batch_size,
+                                       const size_t                         beam_width,
+                                       const size_t                         max_input_length,
+                                       const size_t                         memory_len,
+                                       const std::vector<int>&              h_input_ids,
+                                       const std::vector<int>&              h_input_lengths,
+                                       const std::vector<PrefixCacheMatch>& matches)
+{
+    const size_t block_size      = prefix_cache_->getBlockSize();
+    const size_t bytes_per_block = prefix_cache_->getMaxBytes() / prefix_num_blocks_;
+    // the blocks adopted by the cache, with the row of the KV cache and the first token they are stored from
+    std::vector<int> h_blocks, h_rows, h_start_tokens;
+
+    // blocks dropped by the eviction go back to the pool, without the copies queued into them
+    auto reclaim_evicted_blocks = [&]() {
+        for (const int block : prefix_cache_->popEvictedBlocks()) {
+            for (size_t j = 0; j < h_blocks.size(); j++) {
+                if (h_blocks[j] == block) {
+                    h_blocks.erase(h_blocks.begin() + j);
+                    h_rows.erase(h_rows.begin() + j);
+                    h_start_tokens.erase(h_start_tokens.begin() + j);
+                    break;
+                }
+            }
+            prefix_free_blocks_.push_back(block);
+        }
+    };
+
+    for (size_t i = 0; i < batch_size; i++) {
+        std::vector<int> tokens(h_input_ids.begin() + i * max_input_length,
+                                h_input_ids.begin() + i * max_input_length + h_input_lengths[i]);
+        const size_t     num_blocks = tokens.size() / block_size;
+        // the matched blocks are locked, they are still cached
+        const size_t num_cached = std::min(matches[i].num_tokens / block_size, num_blocks);
+        if (num_blocks == num_cached) {
+            continue;
+        }
+        const size_t num_needed = std::min(num_blocks - num_cached, prefix_num_blocks_);
+        if (prefix_free_blocks_.size() < num_needed) {
+            prefix_cache_->evict((prefix_num_blocks_ - num_needed) * bytes_per_block);
+            reclaim_evicted_blocks();
+        }
+
+        const size_t     num_new = std::min(num_needed, prefix_free_blocks_.size());
+        std::vector<int> blocks(num_cached, -1);
+        blocks.insert(blocks.end(), prefix_free_blocks_.end() - num_new, prefix_free_blocks_.end());
+        prefix_free_blocks_.resize(prefix_free_blocks_.size() - num_new);
+        tokens.resize(blocks.size() * block_size);
+
+        const PrefixCacheInsertion insertion = prefix_cache_->insert(tokens, blocks);
+        FT_CHECK(insertion.num_cached >= num_cached);
+        for (size_t b = num_cached; b < blocks.size(); b++) {
+            if (b >= insertion.num_cached && b < insertion.num_cached + insertion.num_inserted) {
+                h_blocks.push_back(blocks[b]);
+                h_rows.push_back((int)(i * beam_width));
+                h_start_tokens.push_back((int)(b * block_size));
+            }
+            else {
+                prefix_free_blocks_.push_back(blocks[b]);
+            }
+        }
+        reclaim_evicted_blocks();
+    }
+
+    if (!h_blocks.empty()) {
+        const size_t num_stored = h_blocks.size();
+        prefix_store_buf_ = (int*)allocator_->reMalloc(prefix_store_buf_, sizeof(int) * 3 * num_stored, false);
+        cudaAutoCpy(prefix_store_buf_, h_blocks.data(), num_stored, stream_);
+        cudaAutoCpy(prefix_store_buf_ + num_stored, h_rows.data(), num_stored, stream_);
+        cudaAutoCpy(prefix_store_buf_ + 2 * num_stored, h_start_tokens.data(), num_stored, stream_);
+        invokeStorePrefixKV(prefix_kv_pool_,
+                            key_cache_,
+                            value_cache_,
+                            prefix_store_buf_,
+                            prefix_store_buf_ + num_stored,
+                            prefix_store_buf_ + 2 * num_stored,
+                            num_stored,
+                            num_layer_ / pipeline_para_.world_size_,
+                            batch_size * beam_width,
+                            local_head_num_,
+                            memory_len,
+                            block_size,
+                            size_per_head_,
+                            stream_);
+        check_cuda_error(cudaStreamSynchronize(stream_));
+    }
+    for (const PrefixCacheMatch& match : matches) {
+        prefix_cache_->release(match);
+    }
+}
+
+template<typename T>
+void ParallelGpt<T>::publishGeneratedTokens(const size_t batch_size, const size_t beam_width, const size_t gen_len)
+{
+    // Only the tokens of this step are copied, not the whole output_ids
+    const size_t batchxbeam = batch_size * beam_width;
+    h_step_ids_.resize(batchxbeam);
+    check_cuda_error(cudaMemcpyAsync(h_step_ids_.data(),
+                                     output_ids_buf_ + step_ * batchxbeam,
+                                     sizeof(int) * batchxbeam,
+                                     cudaMemcpyDeviceToHost,
+                                     stream_));
+    check_cuda_error(
+        cudaMemcpyAsync(h_finished_buf_, finished_buf_, sizeof(bool) * batchxbeam, cudaMemcpyDeviceToHost, stream_));
+    check_cuda_error(cudaStreamSynchronize(stream_));
+
+    bool stalled = false;
+    for (size_t i = 0; i < batchxbeam; i++) {
+        if (token_ring_done_[i]) {
+            continue;
+        }
+        GeneratedToken token;
+        token.batch_idx = i / beam_width;
+        token.beam_idx  = i % beam_width;
+        token.step      = step_;
+        token.token_id  = h_step_ids_[i];
+        token.finished  = h_finished_buf_[i] || step_ + 1 == (int)gen_len;
+        while (!token_ring_->tryPush(token)) {
+            stalled = true;
+            std::this_thread::yield();
+        }
+        token_ring_done_[i] = token.finished;
+    }
+    if (stalled) {
+        FT_LOG_WARNING("The token ring of capacity %ld was full at step %d, the decoding waited for its consumers.",
+                       token_ring_->capacity(),
+                       step_);
+    }
+}
+
+template<typename T>
+void ParallelGpt<T>::preparePagedKVCache(const size_t num_rows, const size_t num_tokens)
+{
+    FT_CHECK(kv_block_manager_ != nullptr && num_tokens <= max_blocks_per_seq_ * kv_block_size_);
+    std::vector<uint64_t> seq_ids(num_rows);
+    for (size_t i = 0; i < num_rows; i++) {
+        seq_ids[i] = i;
+        FT_CHECK_WITH_INFO(kv_block_manager_->reserveTokens(i, num_tokens),
+                           fmtstr("The paged KV cache is full: %ld blocks of %ld tokens cannot hold %ld tokens for "
+                                  "each of the %ld sequences, increase kv_cache_num_blocks.",
+                                  kv_num_blocks_,
+                                  kv_block_size_,
+                                  num_tokens,
+                                  num_rows));
+    }
+
+    const std::vector<KVBlockCopy> copies = kv_block_manager_->popPendingCopies();
+    if (!copies.empty()) {
+        FT_CHECK(copies.size() <= num_rows);
+        std::vector<int> h_copies;
+        h_copies.reserve(copies.size() * 2);
+        for (const KVBlockCopy& copy : copies) {
+            h_copies.push_back(copy.src_block);
+            h_copies.push_back(copy.dst_block);
+        }
+        cudaAutoCpy(kv_block_copies_buf_, h_copies.data(), h_copies.size(), stream_);
+        invokeCopyKVCacheBlocks(key_cache_,
+                                value_cache_,
+                                kv_block_copies_buf_,
+                                (int)copies.size(),
+                                (int)(num_layer_ / pipeline_para_.world_size_),
+                                (int)kv_num_blocks_,
+                                (int)kv_block_size_,
+                                (int)size_per_head_,
+                                (int)local_head_num_,
+                                stream_);
+        sync_check_cuda_error();
+    }
+
+    std::vector<int> h_block_tables(num_rows * max_blocks_per_seq_);
+    kv_block_manager_->fillBlockTables(seq_ids, max_blocks_per_seq_, h_block_tables.data());
+    cudaAutoCpy(block_tables_buf_, h_block_tables.data(), h_block_tables.size(), stream_);
+    // the host tables are released on return
+    check_cuda_error(cudaStreamSynchronize(stream_));
+}
+
+template<typename T>
+void ParallelGpt<T>::reorderPagedKVCacheBeams(const size_t batch_size, const size_t beam_width, const int step)
+{
+    const size_t     batchxbeam = batch_size * beam_width;
+    std::vector<int> h_parent_ids(batchxbeam);
+    cudaAutoCpy(h_parent_ids.data(), parent_ids_buf_ + step * batchxbeam, batchxbeam, stream_);
+    check_cuda_error(cudaStreamSynchronize(stream_));
+
+    std::vector<uint64_t> seq_ids(batchxbeam);
+    std::vector<int>      parents(batchxbeam);
+    for (size_t i = 0; i < batchxbeam; i++) {
+        // parent_ids are beam indices within the batch entry
+        seq_ids[i] = i;
+        parents[i] = (int)((i / beam_width) * beam_width) + h_parent_ids[i];
+    }
+    kv_block_manager_->reorderSequences(seq_ids, parents);
+}
+
+template<typename T>
+void ParallelGpt<T>::setLiveRows(LiveRowIndex live_rows)
+{
+    live_rows_ = std::move(live_rows);
+    cudaAutoCpy(live_compact_to_batch_, live_rows_.compact_to_batch.data(), live_rows_.size(), stream_);
+    cudaAutoCpy(
+        live_batch_to_compact_, live_rows_.batch_to_compact.data(), live_rows_.batch_to_compact.size(), stream_);
+}
+
+template<typename T>
+size_t ParallelGpt<T>::compactLiveRows(const size_t               batch_size,
+                                       const size_t               beam_width,
+                                       const size_t               memory_len,
+                                       const int                  src_indir_idx,
+                                       const std::vector<size_t>& self_k_cache_shape)
+{
+    std::unique_ptr<bool[]> h_is_done(new bool[batch_size]);
+    cudaAutoCpy(h_is_done.get(), is_done_buf_, batch_size, stream_);
+    check_cuda_error(cudaStreamSynchronize(stream_));
+
+    LiveRowIndex live_rows = getLiveRowIndex(h_is_done.get(), batch_size, beam_width);
+    if (live_rows.size() != live_rows_.size()) {
+        std::vector<int> dst_rows;
+        std::vector<int> src_rows;
+        getCompactRowMoves(&dst_rows, &src_rows, live_rows_, live_rows);
+        // a row of K and of V holds the same number of elements
+        size_t row_size = 1;
+        for (size_t i = 2; i < self_k_cache_shape.size(); i++) {
+            row_size *= self_k_cache_shape[i];
+        }
+        for (T* cache : {key_cache_, value_cache_}) {
+            invokeMoveCacheRows(cache,
+                                dst_rows.data(),
+                                src_rows.data(),
+                                dst_rows.size(),
+                                self_k_cache_shape[0],
+                                self_k_cache_shape[1],
+                                row_size,
+                                stream_);
+        }
+        setLiveRows(std::move(live_rows));
+    }
+
+    const size_t num_rows = live_rows_.size();
+    invokeCompactRows(
+        compact_decoder_input_, decoder_input_buf_, live_compact_to_batch_, num_rows, hidden_units_, stream_);
+    invokeCompactRows(compact_finished_, finished_buf_, live_compact_to_batch_, num_rows, 1, stream_);
+    invokeCompactRows(compact_sequence_lengths_, sequence_lengths_, live_compact_to_batch_, num_rows, 1, stream_);
+    invokeCompactRows(
+        compact_total_padding_count_, tiled_total_padding_count_, live_compact_to_batch_, num_rows, 1, stream_);
+    invokeCompactRows(compact_cache_indirection_,
+                      cache_indirections_[src_indir_idx],
+                      live_compact_to_batch_,
+                      num_rows,
+                      memory_len,
+                      stream_);
+    invokeCompactRows(compact_masked_tokens_, masked_tokens_, live_compact_to_batch_, num_rows, memory_len, stream_);
+    sync_check_cuda_error();
+    return num_rows;
+}
+
+template<typename T>
+void ParallelGpt<T>::computeLogits(const size_t                num_rows,
+                                   const size_t                row_offset,
+                                   const ParallelGptWeight<T>* gpt_weights)
+{
+    const size_t         hidden_units_offset     = row_offset * hidden_units_;
+    const size_t         vocab_size_units_offset = row_offset * vocab_size_padded_;
+    const cudaDataType_t gemm_data_type          = getCudaDataType<T>();
+
+    // OPT
+    T* decoder_output_final_buf =
+        gpt_variant_params_.has_post_decoder_layernorm ? normed_decoder_output_buf_ : decoder_output_buf_;
+    if (gpt_variant_params_.has_post_decoder_layernorm) {
+        invokeGeneralLayerNorm(normed_decoder_output_buf_ + hidden_units_offset,
+                               decoder_output_buf_ + hidden_units_offset,
+                               gpt_weights->post_decoder_layernorm.gamma,
+                               gpt_weights->post_decoder_layernorm.beta,
+                               layernorm_eps_,
+                               num_rows,
+                               hidden_units_,
+                               stream_);
+    }
+    sync_check_cuda_error();
+
+    if (tensor_para_.world_size_ == 1) {
+        float alpha = 1.0f;
+        float beta  = 0.0f;
+        cublas_wrapper_->Gemm(CUBLAS_OP_T,
+                              CUBLAS_OP_N,
+                              vocab_size_padded_,  // n
+                              num_rows,
+                              hidden_units_,  // k
+                              &alpha,
+                              padded_embedding_kernel_ptr_,
+                              gemm_data_type,
+                              hidden_units_,                                   // k
+                              decoder_output_final_buf + hidden_units_offset,  // OPT: no final layer norm
+                              gemm_data_type,
+                              hidden_units_,  // k
+                              &beta,
+                              logits_buf_ + vocab_size_units_offset,
+                              CUDA_R_32F,
+                              vocab_size_padded_, /* n */
+                              CUDA_R_32F,
+                              cublasGemmAlgo_t(-1));
+    }
+    else {
+        FT_CHECK(vocab_size_padded_ % tensor_para_.world_size_ == 0);
+        const int local_vocab_size = vocab_size_padded_ / tensor_para_.world_size_;
+        float     alpha            = 1.0f;
+        float     beta             = 0.0f;
+        cublas_wrapper_->Gemm(CUBLAS_OP_T,
+                              CUBLAS_OP_N,
+                              local_vocab_size,  // n
+                              num_rows,
+                              hidden_units_,  // k
+                              &alpha,
+                              padded_embedding_kernel_ptr_ + tensor_para_.rank_ * local_vocab_size * hidden_units_,
+                              gemm_data_type,
+                              hidden_units_,                                   // k
+                              decoder_output_final_buf + hidden_units_offset,  // OPT: no final layer norm
+                              gemm_data_type,
+                              hidden_units_,  // k
+                              &beta,
+                              nccl_logits_buf_ + vocab_size_units_offset
+                                  + tensor_para_.rank_ * num_rows * local_vocab_size,
+                              CUDA_R_32F,
+                              local_vocab_size, /* n */
+                              CUDA_R_32F,
+                              cublasGemmAlgo_t(-1));
+        ftNcclAllGather(nccl_logits_buf_ + vocab_size_units_offset,
+                        nccl_logits_buf_ + vocab_size_units_offset,
+                        num_rows * local_vocab_size,
+                        tensor_para_.rank_,
+                        tensor_para_,
+                        stream_);
+        invokeTransposeAxis01(logits_buf_ + vocab_size_units_offset,
+                              nccl_logits_buf_ + vocab_size_units_offset,
+                              tensor_para_.world_size_,
+                              num_rows,
+                              local_vocab_size,
+                              stream_);
+    }
+}
+
 template<typename T>
 void ParallelGpt<T>::forward(std::vector<Tensor>*        output_tensors,
                              const std::vector<Tensor>*  input_tensors,
@@ -542,6 +1083,13 @@ void ParallelGpt<T>::forward(std::unordered_map<std::string, Tensor>*       outp
     //      temperature [1] or [batch_size] on cpu, optional, float.
     //      len_penalty [1] or [batch_size] on cpu, optional, float.
     //      repetition_penalty [1] or [batch_size] on cpu, optional, float.
+    //      presence_penalty [1] or [batch_size] on cpu, optional, float. Sampling only.
+    //      frequency_penalty [1] or [batch_size] on cpu, optional, float. Sampling only.
+    //      no_repeat_ngram_size [1] on cpu, optional, int.
+    //      bad_words_trie [2, bad_words_length] on cpu, optional, int. Banned token sequences.
+    //      allowed_words_trie [2, allowed_words_length] on cpu, optional, int. Only these sequences are generated.
+    //      allowed_words_repeat [1] on cpu, optional, bool.
+    //      num_top_logprobs [1] or [batch_size] on cpu, optional, int.
     //      random_seed [1] or [batch_size] on cpu, optional, unsigned long long int.
     //      request_prompt_lengths [batch_size], optional
     //      request_prompt_embedding [batch_size, max_prompt_length, hidden_units], float, optional
@@ -550,6 +1098,13 @@ void ParallelGpt<T>::forward(std::unordered_map<std::string, Tensor>*       outp
     //      session_len [1] on cpu, uint32, optional
     //      memory_len [1] on cpu, uint32, optional
     //      continue_gen [1] on cpu, bool, optional
+    //      kv_cache_block_size [1] on cpu, uint32, optional. Tokens per block of a paged KV cache, read in the
+    //          first round. The pool is shared by the sequences, which only take the blocks they fill.
+    //      kv_cache_num_blocks [1] on cpu, uint32, optional. Blocks of the paged KV cache, by default enough for
+    //          every sequence to reach memory_len.
+    //      beam_widths [batch_size] on cpu, optional, int. The beam width of each request, 1 for sampling, to serve
+    //          beam search and sampling requests in one batch. beam_width is then the largest of them (see
+    //          forwardMixed).
 
     // output_tensors:
     //      output_ids [batch_size, beam_width, max_output_seq_len]
@@ -558,6 +1113,12 @@ void ParallelGpt<T>::forward(std::unordered_map<std::string, Tensor>*       outp
     //          optional. It leads to additional computing cost. If we don't need this result, don't put it.
     //      cum_log_probs [batch_size, beam_width], must be float*. optional.
     //          The cumulative log probability of generated sequences. It may lead to additional computing cost.
+    //      output_top_logprobs [request_output_seq_len, batch_size * beam_width, N], must be float*. optional.
+    //          The log probs of the N most likely tokens of each generated step. Only supported in sampling.
+    //      output_top_logprob_ids [request_output_seq_len, batch_size * beam_width, N], must be int*.
+    //          Necessary with output_top_logprobs, the ids of these tokens.
+    //      cancel_status [batch_size] on cpu, must be int32_t*. optional.
+    //          The CancelStatus of each request, NOT_CANCELLED when no cancellation is registered.
 
     // Step is from max_input_length ~ max_output_seq_len,
     // When step = k,  we put output ids and caches at step k, and the sequence_length would be k - 1 before
@@ -575,6 +1136,10 @@ void ParallelGpt<T>::forward(std::unordered_map<std::string, Tensor>*       outp
     FT_CHECK(output_tensors->at("sequence_length").shape.size() == 2);
     FT_CHECK_WITH_INFO(input_tensors->at("input_ids").shape[0] == output_tensors->at("output_ids").shape[0],
                        "input_tensors->at(\"input_ids\").shape[0] == output_tensors->at(\"output_ids\").shape[0]");
+    if (input_tensors->count("beam_widths")) {
+        forwardMixed(output_tensors, input_tensors, gpt_weights);
+        return;
+    }
 
     // Used when inputs do not contain random_seed
     const size_t batch_size = output_tensors->at("output_ids").shape[0];
@@ -670,7 +1235,27 @@ void ParallelGpt<T>::forward(std::unordered_map<std::string, Tensor>*       outp
     else {
         memory_len = session_len;  // When the interactive generation mode is disabled.
     }
-    memory_len_ = memory_len;
+    if (!continue_gen) {
+        kv_block_size_ = input_tensors->count("kv_cache_block_size") ?
+                             input_tensors->at("kv_cache_block_size").getVal<uint32_t>() :
+                             0;
+        kv_block_manager_.reset();
+        if (kv_block_size_ > 0) {
+            // the paged cache has no circular buffer, every token keeps its KV
+            FT_CHECK_WITH_INFO(memory_len >= session_len,
+                               fmtstr("The paged KV cache needs memory_len (%d) >= session_len (%d).",
+                                      memory_len,
+                                      session_len));
+            max_blocks_per_seq_ = (memory_len + kv_block_size_ - 1) / kv_block_size_;
+            memory_len          = max_blocks_per_seq_ * kv_block_size_;
+            kv_num_blocks_      = input_tensors->count("kv_cache_num_blocks") ?
+                                      input_tensors->at("kv_cache_num_blocks").getVal<uint32_t>() :
+                                      batch_size * beam_width * max_blocks_per_seq_;
+            kv_block_manager_.reset(new KVBlockManager(kv_num_blocks_, kv_block_size_));
+        }
+    }
+    const bool is_paged_kv_cache = kv_block_size_ > 0;
+    memory_len_                  = memory_len;
     /* TODO: could remove this constraint by changing how context decoder operates */
     FT_CHECK_WITH_INFO(max_input_length <= memory_len,
                        fmtstr("Memory size too low (%d) vs. input length (%d)", memory_len, max_input_length));
@@ -718,17 +1303,19 @@ void ParallelGpt<T>::forward(std::unordered_map<std::string, Tensor>*       outp
 
     setSeqLimitLen(seq_limit_len_, input_tensors->at("output_seq_len"), limit_len_offset, batch_size);
 
-    const DataType       data_type      = getTensorType<T>();
-    const cudaDataType_t gemm_data_type = getCudaDataType<T>();
+    const DataType data_type = getTensorType<T>();
 
+    // the paged cache is [num_layer, kv_num_blocks_, local_head_num, ..., kv_block_size_, ...]
+    const size_t              cache_rows         = is_paged_kv_cache ? kv_num_blocks_ : batch_size * beam_width;
+    const size_t              cache_len          = is_paged_kv_cache ? kv_block_size_ : memory_len;
     const std::vector<size_t> self_k_cache_shape = {num_layer_ / pipeline_para_.world_size_,
-                                                    batch_size * beam_width,
+                                                    cache_rows,
                                                     local_head_num_,
                                                     size_per_head_ / (16 / sizeof(T)),
-                                                    memory_len,
+                                                    cache_len,
                                                     16 / sizeof(T)};
     const std::vector<size_t> self_v_cache_shape = {
-        num_layer_ / pipeline_para_.world_size_, batch_size * beam_width, local_head_num_, memory_len, size_per_head_};
+        num_layer_ / pipeline_para_.world_size_, cache_rows, local_head_num_, cache_len, size_per_head_};
 
     dynamic_decode_layer_->setup(batch_size, beam_width, input_tensors);
     handleOptArg(input_tensors, "start_id", start_ids_buf_, start_id_, batch_size);
@@ -784,8 +1371,29 @@ void ParallelGpt<T>::forward(std::unordered_map<std::string, Tensor>*       outp
             sync_check_cuda_error();
         }
 
+        // the context phase starts after the prefix of the inputs found in the prefix cache, the prefix KV is read
+        // like a prefix prompt
+        const bool use_prefix_cache = prefix_cache_ != nullptr && max_input_length > 1 && !has_p_prompt_tuning_
+                                      && !has_prefix_prompt_ && !has_prefix_soft_prompt_
+                                      && !is_return_context_cum_log_probs && !is_paged_kv_cache;
+        std::vector<int>              h_input_ids;
+        std::vector<int>              h_input_lengths;
+        std::vector<PrefixCacheMatch> prefix_matches;
+        size_t                        prefix_len = 0;
+        if (use_prefix_cache) {
+            h_input_ids.resize(batch_size * max_input_length);
+            h_input_lengths.resize(batch_size);
+            cudaAutoCpy(h_input_ids.data(), input_tensors->at("input_ids").getPtr<int>(), h_input_ids.size(), stream_);
+            cudaAutoCpy(h_input_lengths.data(), input_tensors->at("input_lengths").getPtr<int>(), batch_size, stream_);
+            check_cuda_error(cudaStreamSynchronize(stream_));
+            prefix_len = matchPrefixCache(
+                batch_size, beam_width, max_input_length, h_input_ids, h_input_lengths, &prefix_matches);
+        }
+
         int  compact_size;
-        bool use_shared_contexts = (shared_contexts_ratio_ > 0.0f) && (max_input_length >= 1) && (batch_size > 1);
+        // the shared contexts write the KV of a compact batch, the paged context attention needs a block table per row
+        bool use_shared_contexts = (shared_contexts_ratio_ > 0.0f) && (max_input_length >= 1) && (batch_size > 1)
+                                   && !is_paged_kv_cache && prefix_len == 0;
         if (use_shared_contexts) {
             invokeFindContextDups(shared_contexts_idx_,
                                   batch_to_compact_idx_,
@@ -881,14 +1489,19 @@ void ParallelGpt<T>::forward(std::unordered_map<std::string, Tensor>*       outp
                     use_request_p_prompt_embedding,
                     use_request_p_prompt_embedding ? input_tensors->at("request_prompt_embedding").getPtr<T>() :
                                                      nullptr};
+                if (prefix_len > 0) {
+                    // only the tokens after the cached prefix are embedded, at their positions
+                    invokeTransposeAxis01(
+                        output_ids_buf_, tiled_input_ids_buf_, batch_size * beam_width, max_input_length, 1, stream_);
+                }
                 invokeInputIdsEmbeddingLookupPosEncoding(context_decoder_input_buf_,
-                                                         output_ids_buf_,
+                                                         prefix_len > 0 ? nullptr : output_ids_buf_,
                                                          gpt_weights->pre_decoder_embedding_table,
                                                          gpt_weights->position_encoding_table,
                                                          prompt_param,
-                                                         tiled_input_ids_buf_,
-                                                         1,
-                                                         max_input_length,
+                                                         tiled_input_ids_buf_ + prefix_len,
+                                                         1 + prefix_len,
+                                                         max_input_length - prefix_len,
                                                          max_input_length,
                                                          batch_size * beam_width,
                                                          hidden_units_,
@@ -896,23 +1509,28 @@ void ParallelGpt<T>::forward(std::unordered_map<std::string, Tensor>*       outp
                 sync_check_cuda_error();
             }
 
+            // the context decoder runs the tokens after the prefix
+            const size_t context_len = max_input_length - prefix_len;
+            if (prefix_len > 0) {
+                invokePlusScalar(tiled_input_lengths_buf_, -(int)prefix_len, batch_size * beam_width, stream_);
+            }
             invokeBuildDecoderAttentionMask(input_attention_mask_,
                                             tiled_input_lengths_buf_,
-                                            nullptr,
+                                            prefix_len > 0 ? tiled_prompt_lengths_buf_ : nullptr,
                                             batch_size * beam_width,
-                                            max_input_length,
-                                            0,
+                                            context_len,
+                                            prefix_len,
                                             stream_);
             sync_check_cuda_error();
 
             std::vector<Tensor> decoder_input_tensors{
                 Tensor{MEMORY_GPU,
                        data_type,
-                       {batch_size * beam_width, (size_t)max_input_length, hidden_units_},
+                       {batch_size * beam_width, context_len, hidden_units_},
                        context_decoder_input_buf_},
                 Tensor{MEMORY_GPU,
                        data_type,
-                       {batch_size * beam_width, 1, (size_t)max_input_length, (size_t)max_input_length},
+                       {batch_size * beam_width, 1, context_len, (size_t)max_input_length},
                        input_attention_mask_},
                 Tensor{MEMORY_GPU, TYPE_INT32, {batch_size * beam_width}, tiled_input_lengths_buf_}};
 
@@ -920,11 +1538,27 @@ void ParallelGpt<T>::forward(std::unordered_map<std::string, Tensor>*       outp
                 decoder_input_tensors.push_back({MEMORY_GPU, TYPE_INT32, {(size_t)compact_size}, compact_idx_});
                 decoder_input_tensors.push_back({MEMORY_GPU, TYPE_INT32, {batch_size}, batch_to_compact_idx_});
             }
+            else if (prefix_len > 0) {
+                decoder_input_tensors.push_back(Tensor{MEMORY_GPU, TYPE_INT32, {0}, nullptr});
+                decoder_input_tensors.push_back(Tensor{MEMORY_GPU, TYPE_INT32, {0}, nullptr});
+                decoder_input_tensors.push_back(
+                    Tensor{MEMORY_GPU, data_type, {batch_size * beam_width}, prefix_kv_batch_});
+                decoder_input_tensors.push_back(
+                    Tensor{MEMORY_GPU, TYPE_INT32, {batch_size * beam_width}, tiled_prompt_lengths_buf_});
+            }
+            else if (is_paged_kv_cache) {
+                preparePagedKVCache(batch_size * beam_width, max_input_length);
+                for (int i = 3; i < 7; i++) {
+                    decoder_input_tensors.push_back(Tensor{MEMORY_GPU, TYPE_INT32, {0}, nullptr});
+                }
+                decoder_input_tensors.push_back(Tensor{
+                    MEMORY_GPU, TYPE_INT32, {batch_size * beam_width, max_blocks_per_seq_}, block_tables_buf_});
+            }
 
             std::vector<Tensor> decoder_output_tensors{
                 Tensor{MEMORY_GPU,
                        data_type,
-                       {batch_size * beam_width, (size_t)max_input_length, hidden_units_},
+                       {batch_size * beam_width, context_len, hidden_units_},
                        context_decoder_output_buf_},
                 Tensor{MEMORY_GPU, data_type, self_k_cache_shape, key_cache_},
                 Tensor{MEMORY_GPU, data_type, self_v_cache_shape, value_cache_},
@@ -933,6 +1567,19 @@ void ParallelGpt<T>::forward(std::unordered_map<std::string, Tensor>*       outp
             gpt_context_decoder_->forward(
                 &decoder_output_tensors, &decoder_input_tensors, &gpt_weights->decoder_layer_weights);
 
+            if (prefix_len > 0) {
+                invokePlusScalar(tiled_input_lengths_buf_, (int)prefix_len, batch_size * beam_width, stream_);
+            }
+            if (use_prefix_cache) {
+                insertPrefixCache(batch_size,
+                                  beam_width,
+                                  max_input_length,
+                                  memory_len,
+                                  h_input_ids,
+                                  h_input_lengths,
+                                  prefix_matches);
+            }
+
             invokeDecodingInitialize(finished_buf_,
                                      sequence_lengths_,
                                      nullptr,
@@ -1010,7 +1657,31 @@ void ParallelGpt<T>::forward(std::unordered_map<std::string, Tensor>*       outp
 
     // If continue, we restart from initial_step because last token hasn't been processed in decoder
     const int step_start = continue_gen ? initial_step : max_input_length;
+    // Beam search with early stopping only runs the decoder on the requests not done yet. Their caches are moved to the
+    // first rows, so an interactive generation, which keeps the caches for the next call, runs every row.
+    const bool compact_live_rows = beam_width > 1 && input_tensors->count("early_stopping") && !continue_gen
+                                   && input_tensors->count("session_len") == 0 && !is_paged_kv_cache
+                                   && pipeline_para_.world_size_ == 1;
+    if (compact_live_rows) {
+        cudaMemsetAsync(is_done_buf_, 0, sizeof(bool) * batch_size, stream_);
+        std::unique_ptr<bool[]> none_done(new bool[batch_size]());
+        setLiveRows(getLiveRowIndex(none_done.get(), batch_size, beam_width));
+    }
+    if (token_ring_ != nullptr) {
+        token_ring_done_.assign(batch_size * beam_width, false);
+    }
     for (step_ = step_start; step_ < (int)gen_len; step_++) {
+        if (cancellation_ != nullptr
+            && applyRequestCancellation(cancellation_,
+                                        finished_buf_,
+                                        cancel_statuses_buf_,
+                                        batch_size,
+                                        beam_width,
+                                        tensor_para_,
+                                        pipeline_para_,
+                                        stream_)) {
+            break;
+        }
         // Loop body produces Nth token by embedding && encoding token (N-1)
         // if necessary.
         const bool fill_caches_only = continue_gen && (step_ < max_context_len);
@@ -1021,11 +1692,14 @@ void ParallelGpt<T>::forward(std::unordered_map<std::string, Tensor>*       outp
         FT_CHECK(batch_size % local_batch_size == 0);
         const size_t iteration_num = batch_size / local_batch_size;
         *generation_should_stop_   = !fill_caches_only;
+        if (is_paged_kv_cache) {
+            // the decoder writes the KV of token step_ - 1
+            preparePagedKVCache(batch_size * beam_width, step_);
+        }
 
         for (uint ite = 0; ite < iteration_num; ++ite) {
-            const int id_offset               = ite * local_batch_size * beam_width;
-            const int hidden_units_offset     = id_offset * hidden_units_;
-            const int vocab_size_units_offset = id_offset * vocab_size_padded_;
+            const int id_offset           = ite * local_batch_size * beam_width;
+            const int hidden_units_offset = id_offset * hidden_units_;
 
             if ((max_input_length <= 1) || (step_ > step_start) || continue_gen) {
                 if (pipeline_para_.rank_ == 0) {
@@ -1044,116 +1718,69 @@ void ParallelGpt<T>::forward(std::unordered_map<std::string, Tensor>*       outp
                     sync_check_cuda_error();
                 }
 
+                size_t decoder_rows            = local_batch_size * beam_width;
+                T*     decoder_input           = decoder_input_buf_ + hidden_units_offset;
+                T*     decoder_output          = decoder_output_buf_ + hidden_units_offset;
+                bool*  decoder_finished        = finished_buf_ + id_offset;
+                int*   decoder_sequence_length = sequence_lengths_ + id_offset;
+                int*   decoder_padding_count   = tiled_total_padding_count_ + id_offset;
+                int*   decoder_cache_indir     = beam_width > 1 && !is_paged_kv_cache ?
+                                                     cache_indirections_[src_indir_idx] + id_offset * memory_len :
+                                                     nullptr;
+                bool*  decoder_masked_tokens   = masked_tokens_ + id_offset * memory_len;
+                if (compact_live_rows) {
+                    decoder_rows =
+                        compactLiveRows(batch_size, beam_width, memory_len, src_indir_idx, self_k_cache_shape);
+                    decoder_input           = compact_decoder_input_;
+                    decoder_output          = compact_decoder_output_;
+                    decoder_finished        = compact_finished_;
+                    decoder_sequence_length = compact_sequence_lengths_;
+                    decoder_padding_count   = compact_total_padding_count_;
+                    decoder_cache_indir     = compact_cache_indirection_;
+                    decoder_masked_tokens   = compact_masked_tokens_;
+                }
+
                 std::vector<Tensor> decoder_input_tensors{
-                    Tensor{MEMORY_GPU,
-                           data_type,
-                           {local_batch_size * beam_width, hidden_units_},
-                           decoder_input_buf_ + hidden_units_offset},
-                    Tensor{MEMORY_GPU, TYPE_BOOL, {local_batch_size * beam_width}, finished_buf_ + id_offset},
-                    Tensor{MEMORY_GPU, TYPE_INT32, {local_batch_size * beam_width}, sequence_lengths_ + id_offset},
-                    Tensor{MEMORY_GPU,
-                           TYPE_INT32,
-                           {local_batch_size * beam_width},
-                           tiled_total_padding_count_ + id_offset},
+                    Tensor{MEMORY_GPU, data_type, {decoder_rows, hidden_units_}, decoder_input},
+                    Tensor{MEMORY_GPU, TYPE_BOOL, {decoder_rows}, decoder_finished},
+                    Tensor{MEMORY_GPU, TYPE_INT32, {decoder_rows}, decoder_sequence_length},
+                    Tensor{MEMORY_GPU, TYPE_INT32, {decoder_rows}, decoder_padding_count},
                     Tensor{MEMORY_CPU, TYPE_INT32, {1}, &max_context_len},
                     Tensor{MEMORY_CPU, TYPE_INT32, {1}, &step_},
                     Tensor{MEMORY_CPU, TYPE_INT32, {1}, &ite},
                     Tensor{MEMORY_GPU,
                            TYPE_INT32,
-                           {local_batch_size, beam_width, memory_len},
-                           beam_width > 1 ? cache_indirections_[src_indir_idx] + id_offset * memory_len : nullptr},
-                    Tensor{MEMORY_GPU,
-                           TYPE_BOOL,
-                           {local_batch_size * beam_width, memory_len},
-                           masked_tokens_ + id_offset * memory_len}};
+                           {decoder_rows / beam_width, beam_width, memory_len},
+                           decoder_cache_indir},
+                    Tensor{MEMORY_GPU, TYPE_BOOL, {decoder_rows, memory_len}, decoder_masked_tokens}};
+                if (is_paged_kv_cache) {
+                    // the decoder takes the rows of its sub-batch
+                    decoder_input_tensors.push_back(Tensor{
+                        MEMORY_GPU, TYPE_INT32, {batch_size * beam_width, max_blocks_per_seq_}, block_tables_buf_});
+                }
 
                 std::vector<Tensor> decoder_output_tensors{
-                    Tensor{MEMORY_GPU,
-                           data_type,
-                           {local_batch_size * beam_width, hidden_units_},
-                           decoder_output_buf_ + hidden_units_offset},
+                    Tensor{MEMORY_GPU, data_type, {decoder_rows, hidden_units_}, decoder_output},
                     Tensor{MEMORY_GPU, data_type, self_k_cache_shape, key_cache_},
                     Tensor{MEMORY_GPU, data_type, self_v_cache_shape, value_cache_}};
-                gpt_decoder_->forward(
-                    &decoder_output_tensors, &decoder_input_tensors, &gpt_weights->decoder_layer_weights);
-            }
-
-            if (!fill_caches_only && pipeline_para_.rank_ == pipeline_para_.world_size_ - 1) {
-                // OPT
-                T* decoder_output_final_buf =
-                    gpt_variant_params_.has_post_decoder_layernorm ? normed_decoder_output_buf_ : decoder_output_buf_;
-                if (gpt_variant_params_.has_post_decoder_layernorm) {
-                    invokeGeneralLayerNorm(normed_decoder_output_buf_ + hidden_units_offset,
-                                           decoder_output_buf_ + hidden_units_offset,
-                                           gpt_weights->post_decoder_layernorm.gamma,
-                                           gpt_weights->post_decoder_layernorm.beta,
-                                           layernorm_eps_,
-                                           local_batch_size * beam_width,
+                if (decoder_rows > 0) {
+                    gpt_decoder_->forward(
+                        &decoder_output_tensors, &decoder_input_tensors, &gpt_weights->decoder_layer_weights);
+                }
+                if (compact_live_rows) {
+                    // the rows of the done requests keep their last output, their logits being ignored
+                    invokeUnCompactOutputs(decoder_output_buf_,
+                                           compact_decoder_output_,
+                                           live_batch_to_compact_,
+                                           batch_size * beam_width,
                                            hidden_units_,
                                            stream_);
+                    sync_check_cuda_error();
                 }
-                sync_check_cuda_error();
+            }
 
-                if (tensor_para_.world_size_ == 1) {
-                    float alpha = 1.0f;
-                    float beta  = 0.0f;
-                    cublas_wrapper_->Gemm(CUBLAS_OP_T,
-                                          CUBLAS_OP_N,
-                                          vocab_size_padded_,  // n
-                                          local_batch_size * beam_width,
-                                          hidden_units_,  // k
-                                          &alpha,
-                                          padded_embedding_kernel_ptr_,
-                                          gemm_data_type,
-                                          hidden_units_,                                   // k
-                                          decoder_output_final_buf + hidden_units_offset,  // OPT: no final layer norm
-                                          gemm_data_type,
-                                          hidden_units_,  // k
-                                          &beta,
-                                          logits_buf_ + vocab_size_units_offset,
-                                          CUDA_R_32F,
-                                          vocab_size_padded_, /* n */
-                                          CUDA_R_32F,
-                                          cublasGemmAlgo_t(-1));
-                }
-                else {
-                    FT_CHECK(vocab_size_padded_ % tensor_para_.world_size_ == 0);
-                    const int local_vocab_size = vocab_size_padded_ / tensor_para_.world_size_;
-                    float     alpha            = 1.0f;
-                    float     beta             = 0.0f;
-                    cublas_wrapper_->Gemm(CUBLAS_OP_T,
-                                          CUBLAS_OP_N,
-                                          local_vocab_size,  // n
-                                          local_batch_size * beam_width,
-                                          hidden_units_,  // k
-                                          &alpha,
-                                          padded_embedding_kernel_ptr_
-                                              + tensor_para_.rank_ * local_vocab_size * hidden_units_,
-                                          gemm_data_type,
-                                          hidden_units_,                                   // k
-                                          decoder_output_final_buf + hidden_units_offset,  // OPT: no final layer norm
-                                          gemm_data_type,
-                                          hidden_units_,  // k
-                                          &beta,
-                                          nccl_logits_buf_ + vocab_size_units_offset
-                                              + tensor_para_.rank_ * local_batch_size * beam_width * local_vocab_size,
-                                          CUDA_R_32F,
-                                          local_vocab_size, /* n */
-                                          CUDA_R_32F,
-                                          cublasGemmAlgo_t(-1));
-                    ftNcclAllGather(nccl_logits_buf_ + vocab_size_units_offset,
-                                    nccl_logits_buf_ + vocab_size_units_offset,
-                                    local_batch_size * beam_width * local_vocab_size,
-                                    tensor_para_.rank_,
-                                    tensor_para_,
-                                    stream_);
-                    invokeTransposeAxis01(logits_buf_ + vocab_size_units_offset,
-                                          nccl_logits_buf_ + vocab_size_units_offset,
-                                          tensor_para_.world_size_,
-                                          local_batch_size * beam_width,
-                                          local_vocab_size,
-                                          stream_);
-                }
+            if (!fill_caches_only && pipeline_para_.rank_ == pipeline_para_.world_size_ - 1) {
+                computeLogits(local_batch_size * beam_width, id_offset, gpt_weights);
 
                 int                                     tmp_local_batch_size       = local_batch_size;
                 bool                                    is_initialize_random_table = step_ == max_context_len;
@@ -1212,6 +1839,10 @@ void ParallelGpt<T>::forward(std::unordered_map<std::string, Tensor>*       outp
                             {local_batch_size, beam_width, memory_len},
                             cache_indirections_[tgt_indir_idx] + id_offset * memory_len}},
                     {"should_stop", Tensor{MEMORY_CPU, TYPE_BOOL, {1}, &subbatch_should_stop}}};
+                if (compact_live_rows) {
+                    dynamic_decode_output_tensors.insert(
+                        {"is_done", Tensor{MEMORY_GPU, TYPE_BOOL, {batch_size}, is_done_buf_}});
+                }
                 for (auto t = output_tensors->begin(); t != output_tensors->end(); ++t) {
                     // Handle exceptions.
                     if (t->first == "cum_log_probs" || t->first == "output_log_probs") {
@@ -1241,6 +1872,11 @@ void ParallelGpt<T>::forward(std::unordered_map<std::string, Tensor>*       outp
 
             ftNcclBroadCast(generation_should_stop_, 1, pipeline_para_.world_size_ - 1, pipeline_para_, stream_);
 
+            if (token_ring_ != nullptr) {
+                ftNcclBroadCast(
+                    finished_buf_, batch_size * beam_width, pipeline_para_.world_size_ - 1, pipeline_para_, stream_);
+            }
+
             if (beam_width > 1) {
                 ftNcclBroadCast(cache_indirections_[tgt_indir_idx],
                                 batch_size * beam_width * memory_len,
@@ -1248,12 +1884,27 @@ void ParallelGpt<T>::forward(std::unordered_map<std::string, Tensor>*       outp
                                 pipeline_para_,
                                 stream_);
             }
+            if (beam_width > 1 && is_paged_kv_cache) {
+                ftNcclBroadCast(parent_ids_buf_ + step_ * batch_size * beam_width,
+                                batch_size * beam_width,
+                                pipeline_para_.world_size_ - 1,
+                                pipeline_para_,
+                                stream_);
+            }
             ftNcclGroupEnd();
             // throw errors when detected
             ftNcclStreamSynchronize(tensor_para_, pipeline_para_, stream_);
             sync_check_cuda_error();
         }
 
+        if (token_ring_ != nullptr && !fill_caches_only && pipeline_para_.rank_ == 0 && tensor_para_.rank_ == 0) {
+            publishGeneratedTokens(batch_size, beam_width, gen_len);
+        }
+
+        if (is_paged_kv_cache && beam_width > 1 && !fill_caches_only) {
+            reorderPagedKVCacheBeams(batch_size, beam_width, step_);
+        }
+
         if (*generation_should_stop_) {
             break;
         }
@@ -1278,10 +1929,674 @@ void ParallelGpt<T>::forward(std::unordered_map<std::string, Tensor>*       outp
                                      stream_);
         }
     }
+
+    if (output_tensors->count("cancel_status")) {
+        FT_CHECK(output_tensors->at("cancel_status").where == MEMORY_CPU);
+        int32_t* cancel_status = output_tensors->at("cancel_status").getPtr<int32_t>();
+        if (cancellation_ != nullptr) {
+            std::copy(cancellation_->getStatuses(), cancellation_->getStatuses() + batch_size, cancel_status);
+        }
+        else {
+            std::fill(cancel_status, cancel_status + batch_size, (int32_t)NOT_CANCELLED);
+        }
+    }
     setOutputTensors(output_tensors, input_tensors, gen_len, session_len, max_context_len);
     sendTensorsToFirstPipelineNode(output_tensors, input_tensors);
 }
 
+template<typename T>
+void ParallelGpt<T>::forwardMixed(std::unordered_map<std::string, Tensor>*       output_tensors,
+                                  const std::unordered_map<std::string, Tensor>* input_tensors,
+                                  const ParallelGptWeight<T>*                    gpt_weights)
+{
+    // The attention kernels and the caches take a uniform beam width, so each group of MixedDecodeBatch, the sampling
+    // requests then the requests of each beam width, is generated as a batch of its own: the per-request inputs
+    // [batch_size, ...] of its requests are gathered, and its outputs are copied to the rows of its requests. The beams
+    // past the width of a request are padding, with end ids and a sequence length of 0.
+    FT_LOG_DEBUG(__PRETTY_FUNCTION__);
+    const size_t batch_size     = output_tensors->at("output_ids").shape[0];
+    const size_t max_beam_width = output_tensors->at("output_ids").shape[1];
+    const Tensor beam_widths    = input_tensors->at("beam_widths");
+    FT_CHECK_WITH_INFO(beam_widths.where == MEMORY_CPU && beam_widths.type == TYPE_INT32
+                           && beam_widths.size() == batch_size,
+                       fmtstr("beam_widths must be [batch_size(%ld)] int on cpu, got %s",
+                              batch_size,
+                              beam_widths.toString().c_str()));
+    const MixedDecodeBatch batch(beam_widths.getPtr<const int>(), batch_size);
+    FT_LOG_DEBUG("%s", batch.toString().c_str());
+    FT_CHECK_WITH_INFO(
+        (size_t)*std::max_element(batch.getBeamWidths().begin(), batch.getBeamWidths().end()) <= max_beam_width,
+        fmtstr("output_ids (beam_width %ld) cannot hold the beams of the widest request.", max_beam_width));
+
+    const bool continue_gen =
+        (input_tensors->count("continue_gen") && input_tensors->at("continue_gen").getVal<bool>())
+        || (input_tensors->count("START") && input_tensors->at("START").getVal<int32_t>() == 0);
+    FT_CHECK_WITH_INFO(!continue_gen && cancellation_ == nullptr && token_generated_cb_ == nullptr
+                           && token_ring_ == nullptr,
+                       "Interactive generation, cancellation and streaming are not supported with beam_widths.");
+    const std::vector<std::string> beam_outputs = {
+        "output_ids", "sequence_length", "cum_log_probs", "output_log_probs"};
+    for (const auto& output : *output_tensors) {
+        FT_CHECK_WITH_INFO(output.first == "cancel_status"
+                               || std::find(beam_outputs.begin(), beam_outputs.end(), output.first)
+                                      != beam_outputs.end(),
+                           fmtstr("The output %s is not supported with beam_widths.", output.first.c_str()));
+        FT_CHECK_WITH_INFO(output.first == "cancel_status" || output.second.where == MEMORY_GPU,
+                           fmtstr("The output %s must be on gpu with beam_widths.", output.first.c_str()));
+    }
+
+    deviceFill(
+        output_tensors->at("output_ids").getPtr<int>(), output_tensors->at("output_ids").size(), end_id_, stream_);
+    for (const char* name : {"sequence_length", "cum_log_probs", "output_log_probs"}) {
+        if (output_tensors->count(name)) {
+            cudaMemsetAsync((void*)output_tensors->at(name).data, 0, output_tensors->at(name).sizeBytes(), stream_);
+        }
+    }
+    if (output_tensors->count("cancel_status")) {
+        int32_t* cancel_status = output_tensors->at("cancel_status").getPtr<int32_t>();
+        std::fill(cancel_status, cancel_status + batch_size, (int32_t)NOT_CANCELLED);
+    }
+
+    for (const MixedDecodeGroup& group : batch.getGroups()) {
+        const size_t num_requests = group.requests.size();
+        const size_t beam_width   = group.beam_width;
+
+        std::vector<std::vector<char>>          host_bufs;
+        std::vector<void*>                      device_bufs;
+        std::unordered_map<std::string, Tensor> group_inputs;
+        for (const auto& input : *input_tensors) {
+            const std::string& name   = input.first;
+            const Tensor&      tensor = input.second;
+            // bad and stop words lists of shape [2, len] are shared by the batch
+            const bool is_shared_words_list =
+                (name == "bad_words_list" || name == "stop_words_list") && tensor.shape.size() == 2;
+            if (name == "beam_widths") {
+                continue;
+            }
+            if (tensor.shape.empty() || tensor.shape[0] != batch_size || is_shared_words_list) {
+                group_inputs.insert(input);
+                continue;
+            }
+            const size_t row_bytes = tensor.sizeBytes() / batch_size;
+            char*        buf;
+            if (tensor.where == MEMORY_CPU) {
+                host_bufs.emplace_back(num_requests * row_bytes);
+                buf = host_bufs.back().data();
+            }
+            else {
+                device_bufs.push_back(allocator_->malloc(num_requests * row_bytes, false));
+                buf = (char*)device_bufs.back();
+            }
+            for (size_t j = 0; j < num_requests; j++) {
+                const char* row = (const char*)tensor.data + group.requests[j] * row_bytes;
+                if (tensor.where == MEMORY_CPU) {
+                    memcpy(buf + j * row_bytes, row, row_bytes);
+                }
+                else {
+                    cudaAutoCpy(buf + j * row_bytes, row, row_bytes, stream_);
+                }
+            }
+            std::vector<size_t> shape = tensor.shape;
+            shape[0]                  = num_requests;
+            group_inputs.insert({name, Tensor{tensor.where, tensor.type, shape, buf}});
+        }
+
+        // [batch_size, max_beam_width, ...] outputs become [num_requests, beam_width, ...]
+        std::unordered_map<std::string, Tensor> group_outputs;
+        for (const std::string& name : beam_outputs) {
+            if (output_tensors->count(name) == 0) {
+                continue;
+            }
+            const Tensor&       tensor    = output_tensors->at(name);
+            const size_t        beam_size = tensor.sizeBytes() / (batch_size * max_beam_width);
+            std::vector<size_t> shape     = tensor.shape;
+            shape[0]                      = num_requests;
+            shape[1]                      = beam_width;
+            device_bufs.push_back(allocator_->malloc(num_requests * beam_width * beam_size, false));
+            group_outputs.insert({name, Tensor{MEMORY_GPU, tensor.type, shape, device_bufs.back()}});
+        }
+        sync_check_cuda_error();
+
+        forward(&group_outputs, &group_inputs, gpt_weights);
+
+        for (const std::string& name : beam_outputs) {
+            if (output_tensors->count(name) == 0) {
+                continue;
+            }
+            const Tensor& tensor    = output_tensors->at(name);
+            const size_t  beam_size = tensor.sizeBytes() / (batch_size * max_beam_width);
+            for (size_t j = 0; j < num_requests; j++) {
+                cudaAutoCpy((char*)tensor.data + group.requests[j] * max_beam_width * beam_size,
+                            (const char*)group_outputs.at(name).data + j * beam_width * beam_size,
+                            beam_width * beam_size,
+                            stream_);
+            }
+        }
+        // the gathered inputs and the group outputs are released before the next group
+        check_cuda_error(cudaStreamSynchronize(stream_));
+        for (void*& buf : device_bufs) {
+            allocator_->free(&buf);
+        }
+    }
+}
+
+template<typename T>
+void ParallelGpt<T>::forward(ContinuousBatchScheduler*                      scheduler,
+                             const std::unordered_map<std::string, Tensor>* runtime_args,
+                             const ParallelGptWeight<T>*                    gpt_weights)
+{
+    // Every step decodes all the slots together at one shared step, the largest position of the decoding slots + 1.
+    // A slot at position p gets sequence_length p, so that its attention covers its own p cached tokens, and a padding
+    // count of step - 1 - p, so that its position embedding and its rotary position are p. The free slots and the
+    // slots admitted at this step are marked finished for the decoder, which leaves their KV cache untouched.
+    FT_CHECK_WITH_INFO(pipeline_para_.world_size_ == 1, "In-flight batching does not support pipeline parallelism.");
+    const std::unordered_map<std::string, Tensor> no_runtime_args;
+    if (runtime_args == nullptr) {
+        runtime_args = &no_runtime_args;
+    }
+    for (const auto& arg : *runtime_args) {
+        FT_CHECK_WITH_INFO(arg.first == "runtime_top_k" || arg.first == "runtime_top_p" || arg.first == "temperature",
+                           fmtstr("In-flight batching does not support the runtime argument %s.", arg.first.c_str()));
+    }
+
+    const ContinuousBatchSchedulerConfig& config      = scheduler->getConfig();
+    const size_t                          batch_size  = config.max_batch_size;
+    const size_t                          session_len = config.max_session_len;
+    FT_CHECK_WITH_INFO(session_len <= gpt_weights->getMaxSeqLen(),
+                       fmtstr("max_session_len (%ld) is longer than max_seq_len (%ld) of the embedding table.",
+                              session_len,
+                              gpt_weights->getMaxSeqLen()));
+    session_len_ = session_len;
+    memory_len_  = session_len;
+    // the slots own dense cache rows, they are scattered by invokeUnCompactCaches
+    kv_block_size_ = 0;
+    kv_block_manager_.reset();
+
+    allocateBuffer(batch_size, 1, session_len, session_len, 1, false);
+    slot_to_context_idx_ = (int*)allocator_->reMalloc(slot_to_context_idx_, sizeof(int) * batch_size, false);
+    sync_check_cuda_error();
+
+    if (vocab_size_ == vocab_size_padded_) {
+        padded_embedding_kernel_ptr_ = gpt_weights->post_decoder_embedding.kernel;
+    }
+    else {
+        cudaAutoCpy(
+            padded_embedding_kernel_, gpt_weights->post_decoder_embedding.kernel, vocab_size_ * hidden_units_, stream_);
+    }
+    cudaMemsetAsync(masked_tokens_, false, sizeof(bool) * batch_size * session_len, stream_);
+    deviceFill(end_ids_buf_, batch_size, end_id_, stream_);
+    sync_check_cuda_error();
+
+    const DataType            data_type          = getTensorType<T>();
+    const std::vector<size_t> self_k_cache_shape = {num_layer_ / pipeline_para_.world_size_,
+                                                    batch_size,
+                                                    local_head_num_,
+                                                    size_per_head_ / (16 / sizeof(T)),
+                                                    session_len,
+                                                    16 / sizeof(T)};
+    const std::vector<size_t> self_v_cache_shape = {
+        num_layer_ / pipeline_para_.world_size_, batch_size, local_head_num_, session_len, size_per_head_};
+
+    std::vector<int> h_positions(batch_size);
+    std::vector<int> h_padding_counts(batch_size);
+    std::vector<int> h_token_ids(batch_size);
+    std::vector<int> h_step_ids(batch_size);
+    // every slot samples with the seed of its request at its own generation step, so that the tokens of a request do
+    // not depend on its slot nor on the step it is admitted at
+    std::vector<unsigned long long>         h_random_seeds(batch_size);
+    std::vector<int>                        h_random_steps(batch_size);
+    std::unordered_map<std::string, Tensor> sampling_args(*runtime_args);
+    sampling_args.insert({"random_seed", Tensor{MEMORY_CPU, TYPE_UINT64, {batch_size}, h_random_seeds.data()}});
+    while (scheduler->hasPendingWork()) {
+        const ScheduledBatch batch = scheduler->schedule();
+        if (batch.empty()) {
+            break;
+        }
+        // the slots admitted at this step sample their first token at the same step as the others
+        int step = scheduler->getDecodeInputs(batch, h_positions.data(), h_padding_counts.data(), h_token_ids.data());
+
+        if (!batch.decode_slots.empty()) {
+            std::fill(h_finished_buf_, h_finished_buf_ + batch_size, true);
+            for (size_t slot : batch.decode_slots) {
+                h_finished_buf_[slot] = false;
+            }
+            cudaAutoCpy(finished_buf_, h_finished_buf_, batch_size, stream_);
+            cudaAutoCpy(sequence_lengths_, h_positions.data(), batch_size, stream_);
+            cudaAutoCpy(tiled_total_padding_count_, h_padding_counts.data(), batch_size, stream_);
+            cudaAutoCpy(output_ids_buf_ + (step - 1) * batch_size, h_token_ids.data(), batch_size, stream_);
+            invokeEmbeddingLookupPosEncodingPadCount(decoder_input_buf_,
+                                                     gpt_weights->pre_decoder_embedding_table,
+                                                     gpt_weights->position_encoding_table,
+                                                     output_ids_buf_,
+                                                     tiled_total_padding_count_,
+                                                     batch_size,
+                                                     hidden_units_,
+                                                     (T)(1.0f),
+                                                     step - 1,
+                                                     batch_size,
+                                                     0,
+                                                     stream_);
+            sync_check_cuda_error();
+
+            int                 ite = 0;
+            std::vector<Tensor> decoder_input_tensors{
+                Tensor{MEMORY_GPU, data_type, {batch_size, hidden_units_}, decoder_input_buf_},
+                Tensor{MEMORY_GPU, TYPE_BOOL, {batch_size}, finished_buf_},
+                Tensor{MEMORY_GPU, TYPE_INT32, {batch_size}, sequence_lengths_},
+                Tensor{MEMORY_GPU, TYPE_INT32, {batch_size}, tiled_total_padding_count_},
+                Tensor{MEMORY_CPU, TYPE_INT32, {1}, &step},
+                Tensor{MEMORY_CPU, TYPE_INT32, {1}, &step},
+                Tensor{MEMORY_CPU, TYPE_INT32, {1}, &ite},
+                Tensor{MEMORY_GPU, TYPE_INT32, {batch_size, 1, session_len}, nullptr},
+                Tensor{MEMORY_GPU, TYPE_BOOL, {batch_size, session_len}, masked_tokens_}};
+            std::vector<Tensor> decoder_output_tensors{
+                Tensor{MEMORY_GPU, data_type, {batch_size, hidden_units_}, decoder_output_buf_},
+                Tensor{MEMORY_GPU, data_type, self_k_cache_shape, key_cache_},
+                Tensor{MEMORY_GPU, data_type, self_v_cache_shape, value_cache_}};
+            gpt_decoder_->forward(&decoder_output_tensors, &decoder_input_tensors, &gpt_weights->decoder_layer_weights);
+        }
+
+        if (!batch.context_slots.empty()) {
+            runInFlightContextPhase(batch.context_slots, *scheduler, gpt_weights);
+        }
+
+        computeLogits(batch_size, 0, gpt_weights);
+
+        std::fill(h_finished_buf_, h_finished_buf_ + batch_size, true);
+        for (const std::vector<size_t>* slots : {&batch.context_slots, &batch.decode_slots}) {
+            for (size_t slot : *slots) {
+                h_finished_buf_[slot] = false;
+            }
+        }
+        cudaAutoCpy(finished_buf_, h_finished_buf_, batch_size, stream_);
+
+        scheduler->getSamplingInputs(batch, h_random_seeds.data(), h_random_steps.data());
+        if (!batch.context_slots.empty()) {
+            // the admitted slots bring the seeds of their requests
+            dynamic_decode_layer_->setup(batch_size, 1, &sampling_args);
+        }
+
+        int          max_input_length = step - (int)batch.step;
+        uint         ite              = 0;
+        int          local_batch_size = batch_size;
+        const size_t gen_len          = session_len;
+        std::unordered_map<std::string, Tensor> dynamic_decode_input_tensors{
+            {"logits", Tensor{MEMORY_GPU, TYPE_FP32, {batch_size, 1, vocab_size_padded_}, logits_buf_}},
+            {"embedding_bias", Tensor{MEMORY_GPU, data_type, {vocab_size_padded_}, nullptr}},
+            {"step", Tensor{MEMORY_CPU, TYPE_INT32, {1}, &step}},
+            {"max_input_length", Tensor{MEMORY_CPU, TYPE_INT32, {1}, &max_input_length}},
+            {"end_id", Tensor{MEMORY_GPU, TYPE_INT32, {batch_size}, end_ids_buf_}},
+            {"input_lengths", Tensor{MEMORY_GPU, TYPE_INT32, {batch_size, 1}, tiled_input_lengths_buf_}},
+            {"ite", Tensor{MEMORY_CPU, TYPE_UINT32, {1}, &ite}},
+            {"local_batch_size", Tensor{MEMORY_CPU, TYPE_INT32, {1}, &local_batch_size}},
+            {"random_steps", Tensor{MEMORY_CPU, TYPE_INT32, {batch_size}, h_random_steps.data()}}};
+        std::unordered_map<std::string, Tensor> dynamic_decode_output_tensors{
+            {"output_ids", Tensor{MEMORY_GPU, TYPE_INT32, {gen_len, batch_size, 1}, output_ids_buf_}},
+            {"finished", Tensor{MEMORY_GPU, TYPE_BOOL, {batch_size}, finished_buf_}},
+            {"sequence_length", Tensor{MEMORY_GPU, TYPE_INT32, {batch_size}, sequence_lengths_}},
+            {"parent_ids", Tensor{MEMORY_GPU, TYPE_INT32, {gen_len, batch_size, 1}, parent_ids_buf_}}};
+        dynamic_decode_layer_->forward(&dynamic_decode_output_tensors, &dynamic_decode_input_tensors);
+
+        cudaAutoCpy(h_step_ids.data(), output_ids_buf_ + step * batch_size, batch_size, stream_);
+        check_cuda_error(cudaStreamSynchronize(stream_));
+        scheduler->update(h_step_ids);
+    }
+}
+
+template<typename T>
+void ParallelGpt<T>::runInFlightContextPhase(const std::vector<size_t>&      context_slots,
+                                             const ContinuousBatchScheduler& scheduler,
+                                             const ParallelGptWeight<T>*     gpt_weights)
+{
+    // Runs the context decoder on the inputs of the admitted slots, packed in a batch of their own, then scatters their
+    // KV cache into their slots of key_cache_ / value_cache_ and their last hidden state into decoder_output_buf_.
+    const size_t batch_size  = scheduler.getConfig().max_batch_size;
+    const size_t session_len = session_len_;
+    const size_t ctx_size    = context_slots.size();
+    size_t       max_ctx_len = 0;
+    for (size_t slot : context_slots) {
+        max_ctx_len = std::max(max_ctx_len, scheduler.getSlotInputIds(slot).size());
+    }
+
+    std::vector<int> h_input_ids(ctx_size * max_ctx_len, end_id_);
+    std::vector<int> h_input_lengths(ctx_size);
+    std::vector<int> h_slot_to_context_idx(batch_size, -1);
+    for (size_t i = 0; i < ctx_size; i++) {
+        const std::vector<int>& input_ids = scheduler.getSlotInputIds(context_slots[i]);
+        std::copy(input_ids.begin(), input_ids.end(), h_input_ids.begin() + i * max_ctx_len);
+        h_input_lengths[i]                      = input_ids.size();
+        h_slot_to_context_idx[context_slots[i]] = i;
+    }
+
+    const size_t local_num_layer   = num_layer_ / pipeline_para_.world_size_;
+    const size_t local_hidden      = hidden_units_ / tensor_para_.world_size_;
+    const size_t context_cache_len = local_num_layer * ctx_size * max_ctx_len * local_hidden;
+    input_attention_mask_          = (T*)allocator_->reMalloc(
+        input_attention_mask_, sizeof(T) * ctx_size * max_ctx_len * max_ctx_len, false);
+    context_decoder_input_buf_ = (T*)allocator_->reMalloc(
+        context_decoder_input_buf_, sizeof(T) * ctx_size * max_ctx_len * hidden_units_, false);
+    context_decoder_output_buf_ = (T*)allocator_->reMalloc(
+        context_decoder_output_buf_, sizeof(T) * ctx_size * max_ctx_len * hidden_units_, false);
+    context_key_cache_   = (T*)allocator_->reMalloc(context_key_cache_, sizeof(T) * context_cache_len * 2, false);
+    context_value_cache_ = context_key_cache_ + context_cache_len;
+
+    cudaAutoCpy(tiled_input_ids_buf_, h_input_ids.data(), ctx_size * max_ctx_len, stream_);
+    cudaAutoCpy(tiled_input_lengths_buf_, h_input_lengths.data(), ctx_size, stream_);
+    cudaAutoCpy(slot_to_context_idx_, h_slot_to_context_idx.data(), batch_size, stream_);
+
+    invokeInputIdsEmbeddingLookupPosEncoding(context_decoder_input_buf_,
+                                             transposed_output_ids_buf_,
+                                             gpt_weights->pre_decoder_embedding_table,
+                                             gpt_weights->position_encoding_table,
+                                             pPromptTuningParam<T>{},
+                                             tiled_input_ids_buf_,
+                                             1,
+                                             max_ctx_len,
+                                             max_ctx_len,
+                                             ctx_size,
+                                             hidden_units_,
+                                             stream_);
+    invokeBuildDecoderAttentionMask(
+        input_attention_mask_, tiled_input_lengths_buf_, nullptr, ctx_size, max_ctx_len, 0, stream_);
+    sync_check_cuda_error();
+
+    const DataType      data_type = getTensorType<T>();
+    std::vector<Tensor> decoder_input_tensors{
+        Tensor{MEMORY_GPU, data_type, {ctx_size, max_ctx_len, hidden_units_}, context_decoder_input_buf_},
+        Tensor{MEMORY_GPU, data_type, {ctx_size, 1, max_ctx_len, max_ctx_len}, input_attention_mask_},
+        Tensor{MEMORY_GPU, TYPE_INT32, {ctx_size}, tiled_input_lengths_buf_}};
+    std::vector<Tensor> decoder_output_tensors{
+        Tensor{MEMORY_GPU, data_type, {ctx_size, max_ctx_len, hidden_units_}, context_decoder_output_buf_},
+        Tensor{MEMORY_GPU,
+               data_type,
+               {local_num_layer,
+                ctx_size,
+                local_head_num_,
+                size_per_head_ / (16 / sizeof(T)),
+                max_ctx_len,
+                16 / sizeof(T)},
+               context_key_cache_},
+        Tensor{MEMORY_GPU,
+               data_type,
+               {local_num_layer, ctx_size, local_head_num_, max_ctx_len, size_per_head_},
+               context_value_cache_},
+        Tensor{MEMORY_GPU, data_type, {ctx_size, hidden_units_}, decoder_input_buf_}};
+    gpt_context_decoder_->forward(&decoder_output_tensors, &decoder_input_tensors, &gpt_weights->decoder_layer_weights);
+
+    for (size_t l = 0; l < local_num_layer; l++) {
+        invokeUnCompactCaches(key_cache_ + l * batch_size * session_len * local_hidden,
+                              value_cache_ + l * batch_size * session_len * local_hidden,
+                              context_key_cache_ + l * ctx_size * max_ctx_len * local_hidden,
+                              context_value_cache_ + l * ctx_size * max_ctx_len * local_hidden,
+                              slot_to_context_idx_,
+                              batch_size,
+                              local_head_num_,
+                              session_len,
+                              max_ctx_len,
+                              size_per_head_,
+                              ctx_size,
+                              0,
+                              stream_);
+    }
+    invokeUnCompactOutputs(
+        decoder_output_buf_, decoder_input_buf_, slot_to_context_idx_, batch_size, hidden_units_, stream_);
+    sync_check_cuda_error();
+}
+
+template<typename T>
+void ParallelGpt<T>::forwardSpeculative(std::unordered_map<std::string, Tensor>*       output_tensors,
+                                        const std::unordered_map<std::string, Tensor>* input_tensors,
+                                        const ParallelGptWeight<T>*                    gpt_weights,
+                                        ParallelGpt<T>*                                draft,
+                                        const ParallelGptWeight<T>*                    draft_weights,
+                                        const size_t                                   num_draft_tokens)
+{
+    // input_tensors:
+    //      input_ids [1, max_input_length]
+    //      input_lengths [1]
+    //      output_seq_len [1] on cpu
+    //      end_id [1] on cpu, optional
+    //      temperature [1] on cpu, optional, float. The tokens are sampled from the full distributions at this
+    //          temperature, and greedily when it is absent or 0.
+    //      random_seed [1] on cpu, optional, unsigned long long int.
+
+    // output_tensors:
+    //      output_ids [1, 1, max_output_seq_len]
+    //      sequence_length [1, 1]
+
+    FT_CHECK(output_tensors->at("output_ids").shape.size() == 3);
+    FT_CHECK_WITH_INFO(output_tensors->at("output_ids").shape[0] == 1 && output_tensors->at("output_ids").shape[1] == 1,
+                       "Speculative decoding only supports batch_size 1 and beam_width 1.");
+    FT_CHECK_WITH_INFO(draft != nullptr && draft->vocab_size_ == vocab_size_,
+                       "The draft model must share the vocabulary of the target model.");
+    FT_CHECK_WITH_INFO(num_draft_tokens > 0, "num_draft_tokens must be positive.");
+
+    int input_length = 0;
+    cudaAutoCpy(&input_length, input_tensors->at("input_lengths").getPtr<int>(), 1, stream_);
+    check_cuda_error(cudaStreamSynchronize(stream_));
+    std::vector<int> input_ids(input_length);
+    cudaAutoCpy(input_ids.data(), input_tensors->at("input_ids").getPtr<int>(), input_length, stream_);
+    check_cuda_error(cudaStreamSynchronize(stream_));
+
+    SpeculativeGenerationParam param;
+    param.num_draft_tokens  = num_draft_tokens;
+    param.max_seq_len       = input_tensors->at("output_seq_len").getVal<uint32_t>();
+    param.vocab_size        = vocab_size_;
+    param.vocab_size_padded = vocab_size_padded_;
+    param.temperature = input_tensors->count("temperature") ? input_tensors->at("temperature").getVal<float>() : 0.0f;
+    param.random_seed =
+        input_tensors->count("random_seed") ? input_tensors->at("random_seed").getVal<unsigned long long>() : 0;
+    FT_CHECK_WITH_INFO(param.max_seq_len <= output_tensors->at("output_ids").shape[2],
+                       "output_ids cannot hold output_seq_len tokens.");
+    FT_CHECK_WITH_INFO(param.max_seq_len <= gpt_weights->getMaxSeqLen()
+                           && param.max_seq_len <= draft_weights->getMaxSeqLen(),
+                       fmtstr("output_seq_len (%ld) is longer than max_seq_len of the embedding tables.",
+                              param.max_seq_len));
+    const int end_id = input_tensors->count("end_id") ? input_tensors->at("end_id").getVal<int>() : end_id_;
+
+    // the verification pass runs the last committed token and the drafts
+    const size_t max_tokens = std::max((size_t)input_length, num_draft_tokens + 1);
+    prepareSpeculativeDecoding(param.max_seq_len, max_tokens, num_draft_tokens + 1, gpt_weights);
+    draft->prepareSpeculativeDecoding(param.max_seq_len, std::max((size_t)input_length, (size_t)2), 1, draft_weights);
+
+    SpeculativeVerifier    verifier(end_id);
+    const std::vector<int> tokens = verifier.generate(
+        input_ids,
+        param,
+        [&](const int* token_ids, size_t num_tokens, size_t start, size_t num_logits, float* logits) {
+            speculativeForward(token_ids, num_tokens, start, num_logits, logits, gpt_weights);
+        },
+        [&](const int* token_ids, size_t num_tokens, size_t start, size_t num_logits, float* logits) {
+            draft->speculativeForward(token_ids, num_tokens, start, num_logits, logits, draft_weights);
+        });
+    speculative_stats_ += verifier.getStats();
+
+    // like forward, the sequence is padded with the end id
+    std::vector<int> output_ids(output_tensors->at("output_ids").shape[2], end_id);
+    std::copy(tokens.begin(), tokens.end(), output_ids.begin());
+    const int sequence_length = tokens.size();
+    cudaAutoCpy(output_tensors->at("output_ids").getPtr<int>(), output_ids.data(), output_ids.size(), stream_);
+    cudaAutoCpy(output_tensors->at("sequence_length").getPtr<int>(), &sequence_length, 1, stream_);
+    check_cuda_error(cudaStreamSynchronize(stream_));
+}
+
+template<typename T>
+SpeculativeDecodingStats ParallelGpt<T>::getSpeculativeStats() const
+{
+    return speculative_stats_;
+}
+
+template<typename T>
+void ParallelGpt<T>::resetSpeculativeStats()
+{
+    speculative_stats_ = SpeculativeDecodingStats();
+}
+
+template<typename T>
+void ParallelGpt<T>::prepareSpeculativeDecoding(const size_t                max_seq_len,
+                                                const size_t                max_tokens,
+                                                const size_t                max_logits,
+                                                const ParallelGptWeight<T>* gpt_weights)
+{
+    FT_CHECK_WITH_INFO(pipeline_para_.world_size_ == 1, "Speculative decoding does not support pipeline parallelism.");
+    kv_block_size_ = 0;
+    kv_block_manager_.reset();
+    session_len_      = max_seq_len;
+    memory_len_       = max_seq_len;
+    spec_max_seq_len_ = max_seq_len;
+
+    allocateBuffer(1, 1, max_seq_len, max_seq_len, max_tokens, false);
+    // the verification pass attends to the whole sequence and needs the logits of every token it runs
+    input_attention_mask_ =
+        (T*)allocator_->reMalloc(input_attention_mask_, sizeof(T) * max_tokens * max_seq_len, false);
+    decoder_output_buf_ =
+        (T*)allocator_->reMalloc(decoder_output_buf_, sizeof(T) * max_logits * hidden_units_, false);
+    normed_decoder_output_buf_ =
+        (T*)allocator_->reMalloc(normed_decoder_output_buf_, sizeof(T) * max_logits * hidden_units_, false);
+    logits_buf_ = (float*)allocator_->reMalloc(logits_buf_, sizeof(float) * max_logits * vocab_size_padded_, false);
+    nccl_logits_buf_ =
+        (float*)allocator_->reMalloc(nccl_logits_buf_, sizeof(float) * max_logits * vocab_size_padded_, false);
+    // the committed tokens laid out as a prefix prompt, in the buffers of the prefix cache
+    prefix_kv_ = (T*)allocator_->reMalloc(
+        prefix_kv_, sizeof(T) * num_layer_ * 2 * local_head_num_ * max_seq_len * size_per_head_, false);
+    prefix_kv_batch_ = (const T**)allocator_->reMalloc(prefix_kv_batch_, sizeof(T*), false);
+
+    if (vocab_size_ == vocab_size_padded_) {
+        padded_embedding_kernel_ptr_ = gpt_weights->post_decoder_embedding.kernel;
+    }
+    else {
+        cudaAutoCpy(
+            padded_embedding_kernel_, gpt_weights->post_decoder_embedding.kernel, vocab_size_ * hidden_units_, stream_);
+    }
+    cudaMemsetAsync(finished_buf_, false, sizeof(bool), stream_);
+    cudaMemsetAsync(masked_tokens_, false, sizeof(bool) * max_seq_len, stream_);
+    cudaMemsetAsync(tiled_total_padding_count_, 0, sizeof(int), stream_);
+    sync_check_cuda_error();
+}
+
+template<typename T>
+void ParallelGpt<T>::speculativeForward(const int*                  token_ids,
+                                        const size_t                num_tokens,
+                                        const size_t                start,
+                                        const size_t                num_logits,
+                                        float*                      logits,
+                                        const ParallelGptWeight<T>* gpt_weights)
+{
+    const DataType            data_type          = getTensorType<T>();
+    const std::vector<size_t> self_k_cache_shape = {
+        num_layer_, 1, local_head_num_, size_per_head_ / (16 / sizeof(T)), spec_max_seq_len_, 16 / sizeof(T)};
+    const std::vector<size_t> self_v_cache_shape = {num_layer_, 1, local_head_num_, spec_max_seq_len_, size_per_head_};
+
+    if (num_tokens == 1 && start > 0) {
+        // a single token goes through the decoder, which reads the cache in place
+        int step            = start + 1;
+        int sequence_length = start;
+        int ite             = 0;
+        cudaAutoCpy(output_ids_buf_ + start, token_ids, 1, stream_);
+        cudaAutoCpy(sequence_lengths_, &sequence_length, 1, stream_);
+        invokeEmbeddingLookupPosEncodingPadCount(decoder_input_buf_,
+                                                 gpt_weights->pre_decoder_embedding_table,
+                                                 gpt_weights->position_encoding_table,
+                                                 output_ids_buf_,
+                                                 tiled_total_padding_count_,
+                                                 1,
+                                                 hidden_units_,
+                                                 (T)(1.0f),
+                                                 start,
+                                                 1,
+                                                 0,
+                                                 stream_);
+        sync_check_cuda_error();
+
+        std::vector<Tensor> decoder_input_tensors{
+            Tensor{MEMORY_GPU, data_type, {1, hidden_units_}, decoder_input_buf_},
+            Tensor{MEMORY_GPU, TYPE_BOOL, {1}, finished_buf_},
+            Tensor{MEMORY_GPU, TYPE_INT32, {1}, sequence_lengths_},
+            Tensor{MEMORY_GPU, TYPE_INT32, {1}, tiled_total_padding_count_},
+            Tensor{MEMORY_CPU, TYPE_INT32, {1}, &sequence_length},
+            Tensor{MEMORY_CPU, TYPE_INT32, {1}, &step},
+            Tensor{MEMORY_CPU, TYPE_INT32, {1}, &ite},
+            Tensor{MEMORY_GPU, TYPE_INT32, {1, 1, spec_max_seq_len_}, nullptr},
+            Tensor{MEMORY_GPU, TYPE_BOOL, {1, spec_max_seq_len_}, masked_tokens_}};
+        std::vector<Tensor> decoder_output_tensors{
+            Tensor{MEMORY_GPU, data_type, {1, hidden_units_}, decoder_output_buf_},
+            Tensor{MEMORY_GPU, data_type, self_k_cache_shape, key_cache_},
+            Tensor{MEMORY_GPU, data_type, self_v_cache_shape, value_cache_}};
+        gpt_decoder_->forward(&decoder_output_tensors, &decoder_input_tensors, &gpt_weights->decoder_layer_weights);
+    }
+    else {
+        // the context decoder takes the KV of the positions before start as a prefix prompt
+        const int lengths[2] = {(int)num_tokens, (int)start};
+        cudaAutoCpy(tiled_input_ids_buf_, token_ids, num_tokens, stream_);
+        cudaAutoCpy(tiled_input_lengths_buf_, lengths, 1, stream_);
+        cudaAutoCpy(tiled_prompt_lengths_buf_, lengths + 1, 1, stream_);
+        invokeInputIdsEmbeddingLookupPosEncoding(context_decoder_input_buf_,
+                                                 output_ids_buf_ + start,
+                                                 gpt_weights->pre_decoder_embedding_table,
+                                                 gpt_weights->position_encoding_table,
+                                                 pPromptTuningParam<T>{},
+                                                 tiled_input_ids_buf_,
+                                                 start + 1,
+                                                 num_tokens,
+                                                 num_tokens,
+                                                 1,
+                                                 hidden_units_,
+                                                 stream_);
+        invokeGatherPrefixKVFromCache(prefix_kv_,
+                                      prefix_kv_batch_,
+                                      key_cache_,
+                                      value_cache_,
+                                      tiled_prompt_lengths_buf_,
+                                      1,
+                                      start,
+                                      num_layer_,
+                                      0,
+                                      num_layer_,
+                                      local_head_num_,
+                                      spec_max_seq_len_,
+                                      size_per_head_,
+                                      stream_);
+        invokeBuildDecoderAttentionMask(input_attention_mask_,
+                                        tiled_input_lengths_buf_,
+                                        tiled_prompt_lengths_buf_,
+                                        1,
+                                        num_tokens,
+                                        start,
+                                        stream_);
+        sync_check_cuda_error();
+
+        std::vector<Tensor> decoder_input_tensors{
+            Tensor{MEMORY_GPU, data_type, {1, num_tokens, hidden_units_}, context_decoder_input_buf_},
+            Tensor{MEMORY_GPU, data_type, {1, 1, num_tokens, start + num_tokens}, input_attention_mask_},
+            Tensor{MEMORY_GPU, TYPE_INT32, {1}, tiled_input_lengths_buf_},
+            Tensor{MEMORY_GPU, TYPE_INT32, {0}, nullptr},
+            Tensor{MEMORY_GPU, TYPE_INT32, {0}, nullptr},
+            Tensor{MEMORY_GPU, data_type, {1}, start > 0 ? prefix_kv_batch_ : nullptr},
+            Tensor{MEMORY_GPU, TYPE_INT32, {1}, start > 0 ? tiled_prompt_lengths_buf_ : nullptr}};
+        std::vector<Tensor> decoder_output_tensors{
+            Tensor{MEMORY_GPU, data_type, {1, num_tokens, hidden_units_}, context_decoder_output_buf_},
+            Tensor{MEMORY_GPU, data_type, self_k_cache_shape, key_cache_},
+            Tensor{MEMORY_GPU, data_type, self_v_cache_shape, value_cache_},
+            Tensor{MEMORY_GPU, data_type, {1, hidden_units_}, decoder_output_buf_}};
+        gpt_context_decoder_->forward(
+            &decoder_output_tensors, &decoder_input_tensors, &gpt_weights->decoder_layer_weights);
+        // computeLogits reads decoder_output_buf_
+        if (num_logits > 0) {
+            cudaAutoCpy(decoder_output_buf_,
+                        context_decoder_output_buf_ + (num_tokens - num_logits) * hidden_units_,
+                        num_logits * hidden_units_,
+                        stream_);
+        }
+    }
+    sync_check_cuda_error();
+
+    if (num_logits > 0) {
+        computeLogits(num_logits, 0, gpt_weights);
+        cudaAutoCpy(logits, logits_buf_, num_logits * vocab_size_padded_, stream_);
+    }
+    check_cuda_error(cudaStreamSynchronize(stream_));
+}
+
 template<typename T>
 void ParallelGpt<T>::sendTensorsToFirstPipelineNode(std::unordered_map<std::string, Tensor>*       output_tensors,
                                                     const std::unordered_map<std::string, Tensor>* input_tensors)
@@ -1296,7 +2611,8 @@ void ParallelGpt<T>::sendTensorsToFirstPipelineNode(std::unordered_map<std::stri
 
     ftNcclGroupStart();
     for (auto const& it : *output_tensors) {
-        if (it.second.data == nullptr) {
+        // the host outputs, such as cancel_status, are already set on every rank
+        if (it.second.data == nullptr || it.second.where == MEMORY_CPU) {
             continue;
         }
 
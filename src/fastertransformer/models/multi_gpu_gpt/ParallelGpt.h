@@ -18,13 +18,23 @@
 #pragma once
 
 #include <cstddef>
+#include <memory>
 #include <vector>
 
 #include "src/fastertransformer/layers/DynamicDecodeLayer.h"
+#include "src/fastertransformer/models/multi_gpu_gpt/ContinuousBatchScheduler.h"
 #include "src/fastertransformer/models/multi_gpu_gpt/ParallelGptContextDecoder.h"
 #include "src/fastertransformer/models/multi_gpu_gpt/ParallelGptDecoder.h"
+#include "src/fastertransformer/models/multi_gpu_gpt/ParallelGptMemoryPlan.h"
 #include "src/fastertransformer/models/multi_gpu_gpt/ParallelGptWeight.h"
+#include "src/fastertransformer/utils/beam_hypotheses.h"
 #include "src/fastertransformer/utils/custom_ar_comm.h"
+#include "src/fastertransformer/utils/kv_block_manager.h"
+#include "src/fastertransformer/utils/mixed_decode_batch.h"
+#include "src/fastertransformer/utils/prefix_cache.h"
+#include "src/fastertransformer/utils/request_cancellation_utils.h"
+#include "src/fastertransformer/utils/speculative_decoding.h"
+#include "src/fastertransformer/utils/token_ring_buffer.h"
 
 namespace fastertransformer {
 
@@ -89,6 +99,13 @@ private:
                         size_t max_input_len,
                         bool   is_return_context_cum_log_probs);
     void freeBuffer() override;
+    // Sizes of a forward, allocateBuffer() taking the sizes of its buffers from their plan.
+    ParallelGptMemoryPlanParams getActivationMemoryPlanParams(size_t batch_size,
+                                                              size_t beam_width,
+                                                              size_t max_session_len,
+                                                              size_t memory_len,
+                                                              size_t max_input_len,
+                                                              bool   is_return_context_cum_log_probs) const;
 
     void initialize();
 
@@ -135,6 +152,91 @@ protected:
     T*   value_cache_;
     int* cache_indirections_[2] = {nullptr, nullptr};
 
+    // beam search with early stopping: the decoder only runs the live rows, the requests not done yet. Their caches
+    // are moved to the first rows of key_cache_ / value_cache_ and their inputs gathered into the compact buffers.
+    LiveRowIndex live_rows_;
+    int*         compact_rows_buf_            = nullptr;
+    int*         live_compact_to_batch_       = nullptr;  // [batch_size * beam_width]
+    int*         live_batch_to_compact_       = nullptr;  // [batch_size * beam_width]
+    int*         compact_sequence_lengths_    = nullptr;  // [batch_size * beam_width]
+    int*         compact_total_padding_count_ = nullptr;  // [batch_size * beam_width]
+    int*         compact_cache_indirection_   = nullptr;  // [batch_size * beam_width, memory_len]
+    bool*        compact_masks_buf_           = nullptr;
+    bool*        is_done_buf_                 = nullptr;  // [batch_size], from DynamicDecodeLayer
+    bool*        compact_finished_            = nullptr;  // [batch_size * beam_width]
+    bool*        compact_masked_tokens_       = nullptr;  // [batch_size * beam_width, memory_len]
+    T*           compact_decoder_input_       = nullptr;  // [batch_size * beam_width, hidden_units_]
+    T*           compact_decoder_output_      = nullptr;  // [batch_size * beam_width, hidden_units_]
+
+    // Sets live_rows_ and uploads it to live_compact_to_batch_ / live_batch_to_compact_.
+    void setLiveRows(LiveRowIndex live_rows);
+    // Builds the live rows from is_done_buf_, moves the cache rows of the requests that got done since the last step
+    // and gathers the decoder inputs of the step. Returns the number of live rows.
+    size_t compactLiveRows(const size_t               batch_size,
+                           const size_t               beam_width,
+                           const size_t               memory_len,
+                           const int                  src_indir_idx,
+                           const std::vector<size_t>& self_k_cache_shape);
+
+    // paged KV cache: key_cache_ / value_cache_ are a pool of kv_num_blocks_ blocks of kv_block_size_ tokens and row
+    // i of the batch is sequence i of kv_block_manager_. Disabled when kv_block_size_ is 0.
+    size_t                          kv_block_size_       = 0;
+    size_t                          kv_num_blocks_       = 0;
+    size_t                          max_blocks_per_seq_  = 0;
+    std::unique_ptr<KVBlockManager> kv_block_manager_;
+    int*                            block_tables_buf_    = nullptr;  // [batch_size * beam_width, max_blocks_per_seq_]
+    int*                            kv_block_copies_buf_ = nullptr;  // [batch_size * beam_width, 2]
+
+    // Grows the first num_rows sequences to num_tokens tokens, applies the copy-on-writes and uploads the block tables.
+    void preparePagedKVCache(const size_t num_rows, const size_t num_tokens);
+    // Makes every beam continue the blocks of its parent at `step`, the paged counterpart of the cache indirections.
+    void reorderPagedKVCacheBeams(const size_t batch_size, const size_t beam_width, const int step);
+
+    // cross-request prompt prefix cache, see enablePrefixCache
+    std::unique_ptr<PrefixCache> prefix_cache_;
+    T*                           prefix_kv_pool_        = nullptr;  // [num_blocks, local_num_layer, 2, H, block, Dh]
+    size_t                       prefix_num_blocks_     = 0;
+    std::vector<int>             prefix_free_blocks_;
+    T*                           prefix_kv_             = nullptr;  // the matched prefixes laid out as prefix prompts
+    const T**                    prefix_kv_batch_       = nullptr;  // [batch_size * beam_width]
+    int*                         prefix_block_tables_   = nullptr;  // [batch_size * beam_width, prefix blocks]
+    int*                         prefix_store_buf_      = nullptr;  // blocks, rows and first tokens to store
+
+    // Longest prefix of the inputs, in whole blocks, that every sequence of the batch finds in the cache; 0 when one
+    // of them misses. Its KV is gathered into prefix_kv_ and tiled_prompt_lengths_buf_ holds its length. The matches
+    // stay locked until insertPrefixCache.
+    size_t matchPrefixCache(const size_t                   batch_size,
+                            const size_t                   beam_width,
+                            const size_t                   max_input_length,
+                            const std::vector<int>&        h_input_ids,
+                            const std::vector<int>&        h_input_lengths,
+                            std::vector<PrefixCacheMatch>* matches);
+    // Caches the full blocks of the inputs from the KV cache written by the context phase and releases the matches.
+    void insertPrefixCache(const size_t                         batch_size,
+                           const size_t                         beam_width,
+                           const size_t                         max_input_length,
+                           const size_t                         memory_len,
+                           const std::vector<int>&              h_input_ids,
+                           const std::vector<int>&              h_input_lengths,
+                           const std::vector<PrefixCacheMatch>& matches);
+
+    // speculative decoding: the committed tokens are in output_ids_buf_ and their KV in the cache of a single sequence,
+    // laid out in prefix_kv_ for the verification pass
+    size_t                   spec_max_seq_len_ = 0;
+    SpeculativeDecodingStats speculative_stats_;
+
+    void prepareSpeculativeDecoding(const size_t                max_seq_len,
+                                    const size_t                max_tokens,
+                                    const size_t                max_logits,
+                                    const ParallelGptWeight<T>* gpt_weights);
+    // The SpeculativeForwardFn of the model: one token goes through the decoder, more through the context decoder.
+    void speculativeForward(const int*                  token_ids,
+                            const size_t                num_tokens,
+                            const size_t                start,
+                            const size_t                num_logits,
+                            float*                      logits,
+                            const ParallelGptWeight<T>* gpt_weights);
+
     int* start_ids_buf_;
     int* end_ids_buf_;
 
@@ -154,6 +256,11 @@ protected:
     T*     context_decoder_output_buf_;
     float* output_log_probs_buf_;
 
+    // in-flight batching: the KV of the requests admitted at a step, before it is scattered into their slots
+    T*   context_key_cache_   = nullptr;
+    T*   context_value_cache_ = nullptr;
+    int* slot_to_context_idx_ = nullptr;  // [batch_size], the row of each admitted slot in the context batch, or -1
+
     // buffers dedicated to log prob computation
     T*     lp_normed_decoder_output_buf_ = nullptr;
     float* lp_logits_buf_                = nullptr;
@@ -165,6 +272,29 @@ protected:
     callback_sig* token_generated_cb_  = nullptr;
     void*         token_generated_ctx_ = nullptr;
 
+    // generated tokens streaming
+    TokenRingBuffer*  token_ring_ = nullptr;
+    std::vector<int>  h_step_ids_;       // [batch_size, beam_width], the tokens of the step
+    std::vector<bool> token_ring_done_;  // [batch_size, beam_width], the sequences published to the end
+
+    void publishGeneratedTokens(const size_t batch_size, const size_t beam_width, const size_t gen_len);
+
+    // request cancellation
+    RequestCancellation* cancellation_        = nullptr;
+    int*                 cancel_statuses_buf_ = nullptr;  // [batch_size], to broadcast the statuses of rank 0
+
+    // forward() of a batch with beam_widths, one uniform batch per group of MixedDecodeBatch.
+    void forwardMixed(std::unordered_map<std::string, Tensor>*       output_tensors,
+                      const std::unordered_map<std::string, Tensor>* input_tensors,
+                      const ParallelGptWeight<T>*                    gpt_weights);
+
+    // logits_buf_ [num_rows, vocab_size_padded_] from the rows row_offset ~ row_offset + num_rows of
+    // decoder_output_buf_, on the last pipeline rank.
+    void computeLogits(const size_t num_rows, const size_t row_offset, const ParallelGptWeight<T>* gpt_weights);
+    void runInFlightContextPhase(const std::vector<size_t>&      context_slots,
+                                 const ContinuousBatchScheduler& scheduler,
+                                 const ParallelGptWeight<T>*     gpt_weights);
+
     void setOutputTensors(std::unordered_map<std::string, Tensor>*       output_tensors,
                           const std::unordered_map<std::string, Tensor>* input_tensors,
                           const size_t                                   gen_len,
@@ -221,14 +351,69 @@ public:
                  const std::unordered_map<std::string, Tensor>* input_tensors,
                  const ParallelGptWeight<T>*                    gpt_weights);
 
+    // In-flight batching: generates the requests of `scheduler` until none is left. Slot i of the scheduler owns row i
+    // of the KV cache; the requests it admits at a step boundary run their context phase into the slots freed by the
+    // finished ones while the other slots keep decoding. The results are popped from the scheduler, which may be fed
+    // from other threads meanwhile. Sampling only, without pipeline parallelism; with tensor parallelism every rank
+    // drives its own scheduler with the same requests.
+    // runtime_args: runtime_top_k, runtime_top_p, temperature, [1] on cpu, all optional. The seeds are the random_seed
+    // of the requests.
+    void forward(ContinuousBatchScheduler*                      scheduler,
+                 const std::unordered_map<std::string, Tensor>* runtime_args,
+                 const ParallelGptWeight<T>*                    gpt_weights);
+
+    // Speculative decoding: `draft`, a smaller model sharing the vocabulary, proposes num_draft_tokens tokens one at a
+    // time and this model verifies them in a single context decoder pass that attends to its KV cache, so that a step
+    // commits up to num_draft_tokens + 1 tokens (see SpeculativeVerifier). Rejected drafts are rolled back by rewinding
+    // the sequence length of both caches. Only batch_size and beam_width 1, without pipeline parallelism, prompts or
+    // paged KV cache.
+    void forwardSpeculative(std::unordered_map<std::string, Tensor>*       output_tensors,
+                            const std::unordered_map<std::string, Tensor>* input_tensors,
+                            const ParallelGptWeight<T>*                    gpt_weights,
+                            ParallelGpt<T>*                                draft,
+                            const ParallelGptWeight<T>*                    draft_weights,
+                            const size_t                                   num_draft_tokens);
+    // Acceptance rate and tokens per step of the forwardSpeculative calls.
+    SpeculativeDecodingStats getSpeculativeStats() const;
+    void                     resetSpeculativeStats();
+
     size_t getPipelineParallelRank();
     size_t getPipelineParallelSize();
     size_t getTensorParallelRank();
     size_t getTensorParallelSize();
     bool*  getFinishBuffer();
 
+    // Plans the activation buffers of a forward with these sizes without allocating anything.
+    MemoryPlanner getActivationMemoryPlan(size_t batch_size,
+                                          size_t beam_width,
+                                          size_t max_session_len,
+                                          size_t memory_len,
+                                          size_t max_input_len,
+                                          bool   is_return_context_cum_log_probs = false) const;
+
     void registerCallback(callback_sig* fn, void* ctx);
     void unRegisterCallback();
+
+    // Publishes the tokens of each step into the ring, one entry per sequence until its last token. Only the first
+    // rank of the pipeline and tensor parallel groups publishes. With beam search, the tokens of a step are those of
+    // the beams of the step, before the final beams are gathered. The entries are not dropped: the decoding loop waits
+    // for room when the ring is full, so it should hold a few steps of the batch.
+    void registerTokenStream(TokenRingBuffer* ring);
+    void unRegisterTokenStream();
+
+    // Checks the cancellation at the beginning of every step: the sequences of the requests it stops are marked
+    // finished, and the generation ends once all its requests are stopped. With tensor or pipeline parallelism, the
+    // statuses polled by the first rank are applied by all the ranks.
+    void registerCancellation(RequestCancellation* cancellation);
+    void unRegisterCancellation();
+
+    // Keeps the KV of the prompts across forwards in a pool of max_bytes of blocks of block_size tokens per rank. The
+    // context phase of a batch then starts after the longest cached prefix shared by all its sequences, e.g. a common
+    // system prompt, and the least recently used prefixes are evicted when the pool is full. Only used by the first
+    // round of a forward without prompt learning, paged cache, or context log probs.
+    void enablePrefixCache(size_t block_size, size_t max_bytes);
+    void disablePrefixCache();
+    PrefixCacheStats getPrefixCacheStats() const;
 };
 
 }  // namespace fastertransformer
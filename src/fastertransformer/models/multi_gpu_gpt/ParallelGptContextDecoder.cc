@@ -89,6 +89,7 @@ template<typename T>
 void ParallelGptContextDecoder<T>::allocateBuffer(size_t batch_size, size_t seq_len, bool use_shared_contexts)
 {
     FT_LOG_DEBUG(__PRETTY_FUNCTION__);
+    AllocatorTagScope allocator_tag("ParallelGptContextDecoder");
     decoder_normed_input_ = reinterpret_cast<T*>(
         allocator_->reMalloc(decoder_normed_input_, sizeof(T) * batch_size * seq_len * hidden_units_, false));
     self_attn_output_ = reinterpret_cast<T*>(
@@ -257,15 +258,21 @@ void ParallelGptContextDecoder<T>::forward(
 {
     // input tensors:
     //      decoder_input [batch_size, seq_len, hidden_dimension],
-    //      attention_mask [batch_size, 1, seq_len, seq_len]
+    //      attention_mask [batch_size, 1, seq_len, seq_len + max_prefix_kv_length]
     //      input_lengths [batch_size]
-    //      compact_idx [compact_size] // optional
-    //      batch_to_compact_idx [batch_size] // optional
+    //      compact_idx [compact_size] // optional, may be empty when the prefix KV is given
+    //      batch_to_compact_idx [batch_size] // optional, may be empty when the prefix KV is given
+    //      d_prefix_kv_batch [batch_size] // optional, cached KV of the prefix of each sequence, laid out as a
+    //                                     // prefix prompt (see invokeGatherPrefixKV)
+    //      prefix_kv_lengths [batch_size] // optional
+    //      block_table [batch_size, max_blocks_per_seq] // optional, paged cache, inputs 3 ~ 6 may then be empty
 
     // output tensors:
     //      decoder_output [batch_size, seq_len, hidden_dimension],
     //      key_cache [num_layer, batch, local_head_num, size_per_head // x, max_seq_len, x]
+    //                or [num_layer, num_blocks, local_head_num, size_per_head // x, block_size, x] when paged
     //      value_cache [num_layer, batch, local_head_num, max_seq_len, size_per_head]
+    //                  or [num_layer, num_blocks, local_head_num, block_size, size_per_head] when paged
     //      last_token_hidden_units [batch_size, hidden_dimension]
 
     // To use layer/pipeline parallelism, we view the shape of 'batch_size' to 'ite * local_batch_size'.
@@ -275,8 +282,20 @@ void ParallelGptContextDecoder<T>::forward(
     FT_LOG_DEBUG(__PRETTY_FUNCTION__);
     FT_CHECK(output_tensors->size() == 4);
 
-    FT_CHECK(input_tensors->size() == 3 || input_tensors->size() == 5);
-    const bool use_shared_contexts = input_tensors->size() == 5;
+    FT_CHECK(input_tensors->size() == 3 || input_tensors->size() == 5 || input_tensors->size() == 7
+             || input_tensors->size() == 8);
+    const bool use_shared_contexts = input_tensors->size() >= 5 && input_tensors->at(3).data != nullptr;
+    // the tokens of a cached prefix are not recomputed, the attention reads their KV like a prefix prompt
+    const T**    d_prefix_kv_batch = input_tensors->size() >= 7 ? (const T**)input_tensors->at(5).data : nullptr;
+    const int*   prefix_kv_lengths = input_tensors->size() >= 7 ? input_tensors->at(6).getPtr<int>() : nullptr;
+    const int*   block_table       = input_tensors->size() == 8 ? input_tensors->at(7).getPtr<int>() : nullptr;
+    const size_t max_prefix_kv_length = input_tensors->at(1).shape[3] - input_tensors->at(1).shape[2];
+    FT_CHECK_WITH_INFO(max_prefix_kv_length == 0 || d_prefix_kv_batch != nullptr,
+                       "The attention mask covers a prefix but no prefix KV is given.");
+    FT_CHECK_WITH_INFO(!(use_shared_contexts && max_prefix_kv_length > 0),
+                       "Shared contexts and cached prefixes cannot be combined.");
+    FT_CHECK_WITH_INFO(!(use_shared_contexts && block_table != nullptr),
+                       "Shared contexts and the paged KV cache cannot be combined.");
 
     const size_t batch_size =
         use_shared_contexts ? input_tensors->at(3).shape[0] : (size_t)input_tensors->at(0).shape[0];
@@ -304,13 +323,14 @@ void ParallelGptContextDecoder<T>::forward(
     FT_CHECK(batch_size % local_batch_size == 0);
     const size_t iteration_num = batch_size / local_batch_size;
 
+    // the block tables index the whole pool, the local batch only selects their rows
     std::vector<size_t> self_k_cache_size;
-    self_k_cache_size.push_back(local_batch_size);
+    self_k_cache_size.push_back(block_table != nullptr ? output_tensors->at(1).shape[1] : local_batch_size);
     for (auto t = output_tensors->at(1).shape.begin() + 2; t != output_tensors->at(1).shape.end(); ++t) {
         self_k_cache_size.push_back(*t);
     }
     std::vector<size_t> self_v_cache_size;
-    self_v_cache_size.push_back(local_batch_size);
+    self_v_cache_size.push_back(block_table != nullptr ? output_tensors->at(2).shape[1] : local_batch_size);
     for (auto t = output_tensors->at(2).shape.begin() + 2; t != output_tensors->at(2).shape.end(); ++t) {
         self_v_cache_size.push_back(*t);
     }
@@ -398,16 +418,29 @@ void ParallelGptContextDecoder<T>::forward(
                        layernorm_type_ == LayerNormType::pre_layernorm ? decoder_normed_input_ : decoder_input},
                 Tensor{MEMORY_GPU,
                        data_type,
-                       {local_batch_size, 1, seq_len, seq_len},
-                       attention_ptr + local_batch_size * ite * seq_len * seq_len},
+                       {local_batch_size, 1, seq_len, seq_len + max_prefix_kv_length},
+                       attention_ptr + local_batch_size * ite * seq_len * (seq_len + max_prefix_kv_length)},
                 Tensor{MEMORY_CPU, TYPE_BOOL, {1}, &is_final},
                 Tensor{MEMORY_GPU,
                        data_type,
-                       {(size_t)local_batch_size, (size_t)l},
-                       nullptr},                                                      // prefix prompt weight batch
-                Tensor{MEMORY_GPU, TYPE_INT32, {(size_t)local_batch_size}, nullptr},  // prefix prompt lengths
+                       {(size_t)local_batch_size},
+                       d_prefix_kv_batch != nullptr ? d_prefix_kv_batch + ite * local_batch_size :
+                                                      nullptr},  // prefix prompt weight batch
+                Tensor{MEMORY_GPU,
+                       TYPE_INT32,
+                       {(size_t)local_batch_size},
+                       prefix_kv_lengths != nullptr ? prefix_kv_lengths + ite * local_batch_size :
+                                                      nullptr},  // prefix prompt lengths
                 Tensor{MEMORY_CPU, TYPE_INT32, {(size_t)1}, &l},                      // layer_id
                 Tensor{MEMORY_GPU, TYPE_INT32, {h_token_num}, (remove_padding_ ? padding_offset_ : nullptr)}};
+            if (block_table != nullptr) {
+                const size_t max_blocks_per_seq = input_tensors->at(7).shape[1];
+                self_attention_input_tensors.push_back(
+                    Tensor{MEMORY_GPU,
+                           TYPE_INT32,
+                           {local_batch_size, max_blocks_per_seq},
+                           block_table + ite * local_batch_size * max_blocks_per_seq});
+            }
 
             size_t cache_stride_batch = 1;
             for (auto it = output_tensors->at(1).shape.begin() + 2; it != output_tensors->at(1).shape.end(); ++it) {
@@ -416,7 +449,8 @@ void ParallelGptContextDecoder<T>::forward(
 
             const size_t cache_layer_offset =
                 (l - getFirstLayerParallelId()) * output_tensors->at(1).shape[1] * cache_stride_batch;
-            const size_t ite_cache_offset = ite * local_batch_size * cache_stride_batch;
+            const size_t ite_cache_offset =
+                block_table != nullptr ? 0 : ite * local_batch_size * cache_stride_batch;
             const size_t cache_offset     = cache_layer_offset + ite_cache_offset;
 
             T* k_cache_ptr = use_shared_contexts ? k_cache_layer_ : output_tensors->at(1).getPtr<T>() + cache_offset;
@@ -153,6 +153,7 @@ template<typename T>
 void ParallelGptDecoder<T>::allocateBuffer(size_t batch_size)
 {
     FT_LOG_DEBUG(__PRETTY_FUNCTION__);
+    AllocatorTagScope allocator_tag("ParallelGptDecoder");
     decoder_layer_output_ = reinterpret_cast<T*>(
         allocator_->reMalloc(decoder_layer_output_, sizeof(T) * batch_size * hidden_units_, false));
     decoder_normed_input_ = reinterpret_cast<T*>(
@@ -238,28 +239,33 @@ void ParallelGptDecoder<T>::forward(std::vector<Tensor>*
     //              Here, local_batch_size contains the beam_width, so local_batch_size / beam_width
     //              is real local_batch_size.
     //      masked_tokens [local_batch_size, memory_len]
+    //      block_table [batch_size, max_blocks_per_seq] (optional, paged cache), the rows of sub-batch ite are used
 
     // output tensors:
     //      decoder_output [local_batch_size, hidden_dimension],
     //      key_cache [num_layer, batch_size, head_num, size_per_head // x, memory_len, x]
+    //                or [num_layer, num_blocks, head_num, size_per_head // x, block_size, x] when paged
     //      value_cache [num_layer, batch_size, head_num, memory_len, size_per_head]
+    //                  or [num_layer, num_blocks, head_num, block_size, size_per_head] when paged
 
     FT_LOG_DEBUG(__PRETTY_FUNCTION__);
-    FT_CHECK(input_tensors->size() == 9);
+    FT_CHECK(input_tensors->size() == 9 || input_tensors->size() == 10);
     FT_CHECK(output_tensors->size() == 3);
     const size_t local_batch_size = input_tensors->at(0).shape[0];
     allocateBuffer(local_batch_size);
 
     const DataType data_type = getTensorType<T>();
     const int      ite       = *((int*)(input_tensors->at(6).data));
+    // the block tables index the whole pool, the local batch only selects their rows
+    const bool is_paged = input_tensors->size() > 9 && input_tensors->at(9).data != nullptr;
 
     std::vector<size_t> self_k_cache_size;
-    self_k_cache_size.push_back(local_batch_size);
+    self_k_cache_size.push_back(is_paged ? output_tensors->at(1).shape[1] : local_batch_size);
     for (auto t = output_tensors->at(1).shape.begin() + 2; t != output_tensors->at(1).shape.end(); ++t) {
         self_k_cache_size.push_back(*t);
     }
     std::vector<size_t> self_v_cache_size;
-    self_v_cache_size.push_back(local_batch_size);
+    self_v_cache_size.push_back(is_paged ? output_tensors->at(2).shape[1] : local_batch_size);
     for (auto t = output_tensors->at(2).shape.begin() + 2; t != output_tensors->at(2).shape.end(); ++t) {
         self_v_cache_size.push_back(*t);
     }
@@ -294,7 +300,7 @@ void ParallelGptDecoder<T>::forward(std::vector<Tensor>*
         for (auto t = output_tensors->at(1).shape.begin() + 1; t != output_tensors->at(1).shape.end(); ++t) {
             cache_offset *= *t;
         };
-        size_t ite_cache_offset = ite * local_batch_size;
+        size_t ite_cache_offset = is_paged ? 0 : ite * local_batch_size;
         for (auto t = output_tensors->at(1).shape.begin() + 2; t != output_tensors->at(1).shape.end(); ++t) {
             ite_cache_offset *= *t;
         }
@@ -328,6 +334,15 @@ void ParallelGptDecoder<T>::forward(std::vector<Tensor>*
             input_tensors->at(5),
             input_tensors->at(7),
             input_tensors->at(8)};
+        if (is_paged) {
+            const size_t max_blocks_per_seq = input_tensors->at(9).shape[1];
+            self_attention_input_tensors.push_back(Tensor{MEMORY_GPU, data_type, {1, 1, 1, 1}, nullptr});
+            self_attention_input_tensors.push_back(
+                Tensor{MEMORY_GPU,
+                       TYPE_INT32,
+                       {local_batch_size, max_blocks_per_seq},
+                       input_tensors->at(9).getPtr<int>() + ite * local_batch_size * max_blocks_per_seq});
+        }
 
         std::vector<Tensor> self_attention_output_tensors{
             Tensor{MEMORY_GPU, data_type, {local_batch_size, hidden_units_}, self_attn_output_},
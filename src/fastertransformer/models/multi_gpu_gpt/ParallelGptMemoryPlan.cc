@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/fastertransformer/models/multi_gpu_gpt/ParallelGptMemoryPlan.h"
+#include "src/fastertransformer/utils/cuda_utils.h"
+
+#include <algorithm>
+
+namespace fastertransformer {
+
+void addParallelGptActivationBuffers(MemoryPlanner* planner, const ParallelGptMemoryPlanParams& params)
+{
+    FT_CHECK(params.tensor_para_size > 0 && params.pipeline_para_size > 0);
+    FT_CHECK(params.head_num % params.tensor_para_size == 0);
+
+    const int setup    = (int)GptForwardStep::SETUP;
+    const int ctx_attn = (int)GptForwardStep::CONTEXT_ATTENTION;
+    const int ctx_ffn  = (int)GptForwardStep::CONTEXT_FFN;
+    const int ctx_out  = (int)GptForwardStep::CONTEXT_OUTPUT;
+    const int gen_attn = (int)GptForwardStep::GENERATION_ATTENTION;
+    const int gen_ffn  = (int)GptForwardStep::GENERATION_FFN;
+    const int gen_out  = (int)GptForwardStep::GENERATION_OUTPUT;
+    const int finalize = (int)GptForwardStep::FINALIZE;
+
+    const size_t t                  = params.data_type_size;
+    const size_t batch_size         = params.batch_size;
+    const size_t batchxbeam         = params.batch_size * params.beam_width;
+    const size_t seq_len            = params.max_input_len;
+    const size_t session_len        = params.max_session_len;
+    const size_t memory_len         = params.memory_len > 0 ? params.memory_len : params.max_session_len;
+    const size_t hidden_units       = params.head_num * params.size_per_head;
+    const size_t local_head_num     = params.head_num / params.tensor_para_size;
+    const size_t local_hidden_units = hidden_units / params.tensor_para_size;
+    const size_t max_inter_size =
+        params.has_adapters ? std::max(params.inter_size, params.adapter_inter_size) : params.inter_size;
+    const size_t local_inter_size = max_inter_size / params.tensor_para_size;
+    const size_t vocab            = params.vocab_size_padded;
+    const size_t cache_tokens =
+        params.kv_block_size > 0 ? params.kv_num_blocks * params.kv_block_size : batchxbeam * memory_len;
+    const size_t self_cache_size = (params.num_layer / params.pipeline_para_size) * cache_tokens * local_hidden_units;
+
+    // ParallelGpt, alive for the whole forward
+    if (params.vocab_size > 0 && params.vocab_size != vocab) {
+        planner->addBuffer("padded_embedding_kernel", t * hidden_units * vocab, setup, finalize);
+    }
+    planner->addBuffer("key_value_cache", t * self_cache_size * 2, setup, finalize);
+    if (params.beam_width > 1) {
+        planner->addBuffer("cache_indirections", sizeof(int) * batchxbeam * memory_len * 2, setup, finalize);
+    }
+    if (params.kv_block_size > 0) {
+        const size_t max_blocks_per_seq = (memory_len + params.kv_block_size - 1) / params.kv_block_size;
+        planner->addBuffer("block_tables_buf", sizeof(int) * batchxbeam * max_blocks_per_seq, setup, finalize);
+        planner->addBuffer("kv_block_copies_buf", sizeof(int) * batchxbeam * 2, setup, finalize);
+    }
+    planner->addBuffer("cum_log_probs", sizeof(float) * batchxbeam, setup, finalize);
+    planner->addBuffer("finished_buf", sizeof(bool) * batchxbeam, setup, finalize);
+    planner->addBuffer("cancel_statuses_buf", sizeof(int) * batch_size, setup, finalize);
+    planner->addBuffer("sequence_lengths", sizeof(int) * batchxbeam, setup, finalize);
+    planner->addBuffer("tiled_input_lengths_buf", sizeof(int) * batchxbeam, setup, finalize);
+    planner->addBuffer("prompt_learning_weight_batch", sizeof(void*) * batchxbeam, setup, finalize);
+    planner->addBuffer("tiled_prompt_lengths_buf", sizeof(int) * batchxbeam, setup, finalize);
+    planner->addBuffer("start_ids_buf", sizeof(int) * batch_size, setup, finalize);
+    planner->addBuffer("end_ids_buf", sizeof(int) * batch_size, setup, finalize);
+    planner->addBuffer("output_ids_buf", sizeof(int) * batchxbeam * session_len, setup, finalize);
+    planner->addBuffer("parent_ids_buf", sizeof(int) * batchxbeam * session_len, setup, finalize);
+    planner->addBuffer("seq_limit_len", sizeof(uint32_t) * batch_size, setup, finalize);
+    planner->addBuffer("masked_tokens", sizeof(bool) * batchxbeam * memory_len, setup, finalize);
+    planner->addBuffer("output_log_probs_buf", sizeof(float) * batchxbeam * session_len, setup, finalize);
+    planner->addBuffer("tiled_total_padding_count", sizeof(int) * batchxbeam, setup, finalize);
+    if (params.use_shared_contexts) {
+        planner->addBuffer("shared_contexts_idx", sizeof(int) * 3 * batch_size, setup, finalize);
+        planner->addBuffer("compact_size", sizeof(int), setup, finalize);
+    }
+
+    // ParallelGpt, context phase
+    planner->addBuffer("tiled_input_ids_buf", sizeof(int) * batchxbeam * session_len, setup, ctx_out);
+    planner->addBuffer("input_attention_mask", t * batchxbeam * seq_len * seq_len, setup, ctx_ffn);
+    planner->addBuffer("context_decoder_input_buf", t * batchxbeam * seq_len * hidden_units, setup, ctx_ffn);
+    planner->addBuffer("context_decoder_output_buf", t * batchxbeam * seq_len * hidden_units, ctx_attn, ctx_out);
+    if (params.is_return_context_cum_log_probs) {
+        planner->addBuffer("lp_normed_decoder_output_buf", t * batchxbeam * seq_len * hidden_units, ctx_out, ctx_out);
+        planner->addBuffer("lp_logits_buf", sizeof(float) * batchxbeam * seq_len * vocab, ctx_out, ctx_out);
+        planner->addBuffer("lp_nccl_logits_buf", sizeof(float) * batchxbeam * seq_len * vocab, ctx_out, ctx_out);
+        planner->addBuffer("lp_logprob_buf", sizeof(float) * batchxbeam * seq_len, ctx_out, ctx_out);
+    }
+
+    // ParallelGptContextDecoder, carried from layer to layer
+    const size_t ctx_features = t * batchxbeam * seq_len * hidden_units;
+    planner->addBuffer("context_decoder.decoder_normed_input", ctx_features, ctx_attn, ctx_ffn);
+    planner->addBuffer("context_decoder.self_attn_output", ctx_features, ctx_attn, ctx_ffn);
+    if (params.has_adapters) {
+        planner->addBuffer("context_decoder.after_adapter_attn_output", ctx_features, ctx_attn, ctx_ffn);
+    }
+    planner->addBuffer("context_decoder.decoder_layer_output", ctx_features, ctx_attn, ctx_ffn);
+    planner->addBuffer("context_decoder.token_num", sizeof(size_t), ctx_attn, ctx_ffn);
+    planner->addBuffer("context_decoder.padding_offset", sizeof(int) * batchxbeam * seq_len, ctx_attn, ctx_ffn);
+    if (params.use_shared_contexts) {
+        planner->addBuffer("context_decoder.compact_decoder_features", ctx_features, ctx_attn, ctx_ffn);
+        planner->addBuffer(
+            "context_decoder.compact_attention_mask", t * batchxbeam * seq_len * seq_len, ctx_attn, ctx_ffn);
+        planner->addBuffer("context_decoder.compact_input_lengths", sizeof(int) * batchxbeam, ctx_attn, ctx_ffn);
+        planner->addBuffer("context_decoder.k_cache_layer", ctx_features, ctx_attn, ctx_ffn);
+        planner->addBuffer("context_decoder.v_cache_layer", ctx_features, ctx_attn, ctx_ffn);
+    }
+
+    // GptContextAttentionLayer and FfnLayer, scratch of a single layer
+    const size_t ctx_local_features = t * batchxbeam * seq_len * local_hidden_units;
+    const size_t qk_elements        = batchxbeam * local_head_num * seq_len * seq_len;
+    planner->addBuffer("context_attention.qkv_buf", 3 * ctx_local_features, ctx_attn, ctx_attn);
+    planner->addBuffer("context_attention.q_buf_2", 3 * ctx_local_features, ctx_attn, ctx_attn);
+    planner->addBuffer("context_attention.qk_buf", t * qk_elements, ctx_attn, ctx_attn);
+    planner->addBuffer("context_attention.qkv_buf_2", ctx_local_features, ctx_attn, ctx_attn);
+    planner->addBuffer("context_attention.qkv_buf_3", ctx_local_features, ctx_attn, ctx_attn);
+    if (params.is_context_qk_buf_float) {
+        planner->addBuffer("context_attention.qk_buf_float", sizeof(float) * qk_elements, ctx_attn, ctx_attn);
+    }
+    planner->addBuffer("context_ffn.inter_buf", t * batchxbeam * seq_len * local_inter_size, ctx_ffn, ctx_ffn);
+    if (params.use_gated_activation) {
+        planner->addBuffer("context_ffn.inter_buf_2", t * batchxbeam * seq_len * local_inter_size, ctx_ffn, ctx_ffn);
+    }
+
+    // ParallelGpt, generation phase
+    planner->addBuffer("decoder_input_buf", t * batchxbeam * hidden_units, ctx_out, gen_ffn);
+    planner->addBuffer("decoder_output_buf", t * batchxbeam * hidden_units, gen_attn, gen_out);
+    planner->addBuffer("normed_decoder_output_buf", t * batchxbeam * hidden_units, gen_out, gen_out);
+    planner->addBuffer("logits_buf", sizeof(float) * batchxbeam * vocab, gen_out, gen_out);
+    planner->addBuffer("nccl_logits_buf", sizeof(float) * batchxbeam * vocab, gen_out, gen_out);
+    if (params.beam_width > 1) {
+        // live rows of early stopping: index, sequence lengths, padding counts and cache indirection, then is_done,
+        // finished and masked tokens, then the decoder input and output
+        planner->addBuffer("compact_rows_buf", sizeof(int) * batchxbeam * (4 + memory_len), ctx_out, gen_out);
+        planner->addBuffer(
+            "compact_masks_buf", sizeof(bool) * (batch_size + batchxbeam * (1 + memory_len)), ctx_out, gen_out);
+        planner->addBuffer("compact_decoder_buf", t * batchxbeam * hidden_units * 2, gen_attn, gen_out);
+    }
+
+    // ParallelGptDecoder, carried from layer to layer
+    const size_t gen_features = t * batchxbeam * hidden_units;
+    planner->addBuffer("decoder.decoder_layer_output", gen_features, gen_attn, gen_ffn);
+    planner->addBuffer("decoder.decoder_normed_input", gen_features, gen_attn, gen_ffn);
+    planner->addBuffer("decoder.self_attn_output", gen_features, gen_attn, gen_ffn);
+    planner->addBuffer("decoder.normed_self_attn_output", gen_features, gen_attn, gen_ffn);
+    if (params.has_adapters) {
+        planner->addBuffer("decoder.after_adapter_attn_output", gen_features, gen_attn, gen_ffn);
+    }
+
+    // DecoderSelfAttentionLayer and FfnLayer, scratch of a single layer
+    planner->addBuffer("decoder_attention.qkv_buf", t * batchxbeam * 3 * local_hidden_units, gen_attn, gen_attn);
+    planner->addBuffer("decoder_attention.context_buf", t * batchxbeam * local_hidden_units, gen_attn, gen_attn);
+    planner->addBuffer("decoder_ffn.inter_buf", t * batchxbeam * local_inter_size, gen_ffn, gen_ffn);
+    if (params.use_gated_activation) {
+        planner->addBuffer("decoder_ffn.inter_buf_2", t * batchxbeam * local_inter_size, gen_ffn, gen_ffn);
+    }
+
+    planner->addBuffer("transposed_output_ids_buf", sizeof(int) * batchxbeam * session_len, finalize, finalize);
+}
+
+MemoryPlanner planParallelGptActivationMemory(const ParallelGptMemoryPlanParams& params, size_t alignment)
+{
+    MemoryPlanner planner(alignment);
+    addParallelGptActivationBuffers(&planner, params);
+    planner.plan();
+    return planner;
+}
+
+size_t getMaxParallelGptBatchSize(ParallelGptMemoryPlanParams params, size_t budget_bytes, size_t alignment)
+{
+    auto fits = [&](size_t batch_size) {
+        params.batch_size = batch_size;
+        return planParallelGptActivationMemory(params, alignment).getArenaBytes() <= budget_bytes;
+    };
+    if (!fits(1)) {
+        return 0;
+    }
+    // the arena grows with the batch size: double until it does not fit, then bisect
+    size_t low  = 1;
+    size_t high = 2;
+    while (fits(high)) {
+        low = high;
+        high *= 2;
+        FT_CHECK_WITH_INFO(high <= ((size_t)1 << 32), "The budget does not bound the batch size.");
+    }
+    while (high - low > 1) {
+        const size_t mid = low + (high - low) / 2;
+        if (fits(mid)) {
+            low = mid;
+        }
+        else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+}  // namespace fastertransformer
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+#include "src/fastertransformer/utils/memory_planner.h"
+
+namespace fastertransformer {
+
+// Steps of a ParallelGpt forward, used as buffer lifetimes. The context steps repeat for every layer and the
+// generation steps for every layer of every generated token, so a buffer carried from one iteration to the next is
+// live over the whole loop.
+enum class GptForwardStep : int {
+    SETUP                = 0,  // tiling of the inputs and the attention mask
+    CONTEXT_ATTENTION    = 1,
+    CONTEXT_FFN          = 2,
+    CONTEXT_OUTPUT       = 3,  // context cum log probs, first decoder input
+    GENERATION_ATTENTION = 4,
+    GENERATION_FFN       = 5,
+    GENERATION_OUTPUT    = 6,  // logits and dynamic decoding
+    FINALIZE             = 7   // output transposes and gathering
+};
+
+struct ParallelGptMemoryPlanParams {
+    size_t batch_size      = 1;
+    size_t beam_width      = 1;
+    size_t max_input_len   = 1;
+    size_t max_session_len = 1;
+    size_t memory_len      = 0;  // 0 means max_session_len
+
+    size_t head_num          = 0;
+    size_t size_per_head     = 0;
+    size_t inter_size        = 0;
+    size_t num_layer         = 0;
+    size_t vocab_size        = 0;  // 0 means vocab_size_padded
+    size_t vocab_size_padded = 0;
+
+    size_t tensor_para_size   = 1;
+    size_t pipeline_para_size = 1;
+    size_t data_type_size     = 2;  // sizeof(T)
+
+    bool   use_gated_activation            = false;
+    bool   has_adapters                    = false;
+    size_t adapter_inter_size              = 0;
+    bool   is_context_qk_buf_float         = true;
+    bool   use_shared_contexts             = false;
+    bool   is_return_context_cum_log_probs = false;
+
+    size_t kv_block_size = 0;  // paged KV cache, 0 for a cache of memory_len tokens per sequence
+    size_t kv_num_blocks = 0;
+};
+
+// Adds the buffers allocated by ParallelGpt::allocateBuffer, which takes their sizes from here, and by the
+// allocateBuffer of its decoders and layers, whose sizes follow those functions.
+void addParallelGptActivationBuffers(MemoryPlanner* planner, const ParallelGptMemoryPlanParams& params);
+
+// Plans the buffers of one forward, see MemoryPlanner.
+MemoryPlanner planParallelGptActivationMemory(const ParallelGptMemoryPlanParams& params, size_t alignment = 256);
+
+// Largest batch size whose planned arena fits in `budget_bytes`, 0 if even a single request does not fit.
+size_t getMaxParallelGptBatchSize(ParallelGptMemoryPlanParams params, size_t budget_bytes, size_t alignment = 256);
+
+}  // namespace fastertransformer
@@ -15,6 +15,7 @@
  */
 
 #include "src/fastertransformer/models/multi_gpu_gpt/ParallelGptWeight.h"
+#include "src/fastertransformer/utils/packed_checkpoint.h"
 
 namespace fastertransformer {
 
@@ -250,6 +251,8 @@ void ParallelGptWeight<T>::loadModel(std::string dir_path)
 {
     FtCudaDataType model_file_type = getModelFileType(dir_path + "/config.ini", "gpt");
     FT_CHECK(is_maintain_buffer == true);
+    // resolve the weights in dir_path/model.ftpack first when the checkpoint has been packed
+    PackedCheckpointScope packed_checkpoint(dir_path);
     loadWeightFromBin<T>(weights_ptr[0], {max_seq_len_, hidden_units_}, dir_path + "/model.wpe.bin", model_file_type);
     loadWeightFromBin<T>(weights_ptr[1], {vocab_size_ * hidden_units_}, dir_path + "/model.wte.bin", model_file_type);
     if (gpt_variant_params_.has_post_decoder_layernorm) {
@@ -258,7 +261,7 @@ void ParallelGptWeight<T>::loadModel(std::string dir_path)
         loadWeightFromBin<T>(
             weights_ptr[3], {hidden_units_}, dir_path + "/model.final_layernorm.weight.bin", model_file_type);
     }
-    if (checkIfFileExist(dir_path + "/model.lm_head.weight.bin")) {
+    if (checkIfWeightExist(dir_path + "/model.lm_head.weight.bin")) {
         loadWeightFromBin<T>(
             weights_ptr[4], {vocab_size_ * hidden_units_}, dir_path + "/model.lm_head.weight.bin", model_file_type);
     }
@@ -289,11 +292,11 @@ void ParallelGptWeight<T>::loadModel(std::string dir_path)
         }
     }
 
-    for (int l = 0; l < num_layer_; l++) {
+    loadLayersInParallel(num_layer_, [&](int l) {
         if (isValidLayerParallelId(l)) {
             decoder_layer_weights[l]->loadModel(dir_path + "/model.layers." + std::to_string(l), model_file_type);
         }
-    }
+    });
 }
 
 template<typename T>
@@ -108,6 +108,23 @@ void T5Decoding<T>::allocateBuffer(
             cache_indirections_[0], sizeof(int) * batchxbeam * (max_seq_len + 1) * 2, true));
         cache_indirections_[1] = cache_indirections_[0] + batchxbeam * (max_seq_len + 1);
     }
+    if (beam_width > 1) {
+        const size_t rows_buf_size  = sizeof(int) * batchxbeam * (4 + max_seq_len + 1);
+        const size_t masks_buf_size = sizeof(bool) * (batch_size + batchxbeam);
+
+        compact_rows_buf_                = (int*)(allocator_->reMalloc(compact_rows_buf_, rows_buf_size, false));
+        live_compact_to_batch_           = compact_rows_buf_;
+        live_batch_to_compact_           = compact_rows_buf_ + batchxbeam;
+        compact_sequence_lengths_        = compact_rows_buf_ + 2 * batchxbeam;
+        compact_encoder_sequence_length_ = compact_rows_buf_ + 3 * batchxbeam;
+        compact_cache_indirection_       = compact_rows_buf_ + 4 * batchxbeam;
+        compact_masks_buf_               = (bool*)(allocator_->reMalloc(compact_masks_buf_, masks_buf_size, false));
+        is_done_buf_                     = compact_masks_buf_;
+        compact_finished_                = compact_masks_buf_ + batch_size;
+        compact_decoder_input_           = (T*)(allocator_->reMalloc(
+            compact_decoder_input_, sizeof(T) * 2 * batchxbeam * d_model_, false));
+        compact_decoder_output_          = compact_decoder_input_ + batchxbeam * d_model_;
+    }
     tiled_encoder_output_ = (T*)(allocator_->reMalloc(
         tiled_encoder_output_, sizeof(T) * batchxbeam * max_mem_seq_len * encoder_d_model, false));
     tiled_encoder_sequence_length_ =
@@ -156,6 +173,10 @@ void T5Decoding<T>::freeBuffer()
             allocator_->free((void**)(&cache_indirections_)[0]);
         }
 
+        allocator_->free((void**)(&compact_rows_buf_));
+        allocator_->free((void**)(&compact_masks_buf_));
+        allocator_->free((void**)(&compact_decoder_input_));
+
         allocator_->free((void**)(&tiled_encoder_output_));
         allocator_->free((void**)(&tiled_encoder_sequence_length_));
 
@@ -170,6 +191,82 @@ void T5Decoding<T>::freeBuffer()
     }
 }
 
+template<typename T>
+void T5Decoding<T>::setLiveRows(LiveRowIndex live_rows)
+{
+    live_rows_ = std::move(live_rows);
+    cudaAutoCpy(live_compact_to_batch_, live_rows_.compact_to_batch.data(), live_rows_.size(), stream_);
+    cudaAutoCpy(
+        live_batch_to_compact_, live_rows_.batch_to_compact.data(), live_rows_.batch_to_compact.size(), stream_);
+}
+
+template<typename T>
+size_t T5Decoding<T>::compactLiveRows(const size_t               batch_size,
+                                      const size_t               beam_width,
+                                      const size_t               max_seq_len,
+                                      const int                  src_indir_idx,
+                                      const int*                 sequence_lengths,
+                                      const std::vector<size_t>& self_k_cache_shape,
+                                      const std::vector<size_t>& mem_cache_shape)
+{
+    std::unique_ptr<bool[]> h_is_done(new bool[batch_size]);
+    cudaAutoCpy(h_is_done.get(), is_done_buf_, batch_size, stream_);
+    check_cuda_error(cudaStreamSynchronize(stream_));
+
+    LiveRowIndex live_rows = getLiveRowIndex(h_is_done.get(), batch_size, beam_width);
+    if (live_rows.size() != live_rows_.size()) {
+        std::vector<int> dst_rows;
+        std::vector<int> src_rows;
+        getCompactRowMoves(&dst_rows, &src_rows, live_rows_, live_rows);
+        // the self caches [layer, rows, ...] hold rows of the same number of elements, as do the memory caches
+        size_t self_row_size = 1;
+        for (size_t i = 2; i < self_k_cache_shape.size(); i++) {
+            self_row_size *= self_k_cache_shape[i];
+        }
+        const size_t mem_row_size = mem_cache_shape[2] * mem_cache_shape[3];
+        for (T* cache : {key_cache_, value_cache_}) {
+            invokeMoveCacheRows(cache,
+                                dst_rows.data(),
+                                src_rows.data(),
+                                dst_rows.size(),
+                                self_k_cache_shape[0],
+                                self_k_cache_shape[1],
+                                self_row_size,
+                                stream_);
+        }
+        for (T* cache : {key_mem_cache_, value_mem_cache_}) {
+            invokeMoveCacheRows(cache,
+                                dst_rows.data(),
+                                src_rows.data(),
+                                dst_rows.size(),
+                                mem_cache_shape[0],
+                                mem_cache_shape[1],
+                                mem_row_size,
+                                stream_);
+        }
+        setLiveRows(std::move(live_rows));
+    }
+
+    const size_t num_rows = live_rows_.size();
+    invokeCompactRows(compact_decoder_input_, decoder_input_buf_, live_compact_to_batch_, num_rows, d_model_, stream_);
+    invokeCompactRows(compact_finished_, finished_buf_, live_compact_to_batch_, num_rows, 1, stream_);
+    invokeCompactRows(compact_sequence_lengths_, sequence_lengths, live_compact_to_batch_, num_rows, 1, stream_);
+    invokeCompactRows(compact_encoder_sequence_length_,
+                      encoder_sequence_length_ptr_,
+                      live_compact_to_batch_,
+                      num_rows,
+                      1,
+                      stream_);
+    invokeCompactRows(compact_cache_indirection_,
+                      cache_indirections_[src_indir_idx],
+                      live_compact_to_batch_,
+                      num_rows,
+                      max_seq_len + 1,
+                      stream_);
+    sync_check_cuda_error();
+    return num_rows;
+}
+
 template<typename T>
 void T5Decoding<T>::setStream(cudaStream_t stream)
 {
@@ -329,6 +426,7 @@ void T5Decoding<T>::forward(std::unordered_map<std::string, Tensor>*       outpu
     //      len_penalty [1] or [batch_size] on cpu, optional, float.
     //      repetition_penalty [1] or [batch_size] on cpu, optional, float.
     //      random_seed [1] or [batch_size] on cpu, optional, unsigned long long int.
+    //      early_stopping [1] on cpu, optional, int, beam search early stopping, see DynamicDecodeLayer.
 
     // output_tensors:
     //      output_ids [batch_size, beam, max_seq_len]
@@ -451,6 +549,16 @@ void T5Decoding<T>::forward(std::unordered_map<std::string, Tensor>*       outpu
     const size_t local_batch_size = getLocalBatchSize(batch_size, 1, pipeline_para_.world_size_);
     FT_CHECK(batch_size % local_batch_size == 0);
     const size_t iteration_num = batch_size / local_batch_size;
+    // Beam search with early stopping only runs the decoder on the requests not done yet. The cross attentions are
+    // written per row, so they keep every row.
+    const bool compact_live_rows = beam_width > 1 && input_tensors->count("early_stopping")
+                                   && output_tensors->count("cross_attentions") == 0
+                                   && pipeline_para_.world_size_ == 1;
+    if (compact_live_rows) {
+        cudaMemsetAsync(is_done_buf_, 0, sizeof(bool) * batch_size, stream_);
+        std::unique_ptr<bool[]> none_done(new bool[batch_size]());
+        setLiveRows(getLiveRowIndex(none_done.get(), batch_size, beam_width));
+    }
     for (int step = max_input_length; step <= (int)max_seq_len; step++) {
         const int src_indir_idx = beam_width > 1 ? (step - 1) & 0x1 : 0;
         const int tgt_indir_idx = 1 - src_indir_idx;
@@ -479,24 +587,45 @@ void T5Decoding<T>::forward(std::unordered_map<std::string, Tensor>*       outpu
                 sync_check_cuda_error();
             }
 
+            size_t     decoder_rows            = local_batch_size * beam_width;
+            T*         decoder_input           = decoder_input_buf_ + d_model_offset;
+            T*         decoder_output          = decoder_output_buf_ + d_model_offset;
+            const int* decoder_memory_length   = encoder_sequence_length_ptr_ + id_offset;
+            bool*      decoder_finished        = finished_buf_ + id_offset;
+            int*       decoder_sequence_length = sequence_lengths + id_offset;
+            int*       decoder_cache_indir =
+                beam_width > 1 ? cache_indirections_[src_indir_idx] + id_offset * (max_seq_len + 1) : nullptr;
+            if (compact_live_rows) {
+                // the encoder output is only read at step 1, where all the rows are live
+                decoder_rows            = compactLiveRows(batch_size,
+                                                          beam_width,
+                                                          max_seq_len,
+                                                          src_indir_idx,
+                                                          sequence_lengths,
+                                                          self_k_cache_shape,
+                                                          mem_cache_shape);
+                decoder_input           = compact_decoder_input_;
+                decoder_output          = compact_decoder_output_;
+                decoder_memory_length   = compact_encoder_sequence_length_;
+                decoder_finished        = compact_finished_;
+                decoder_sequence_length = compact_sequence_lengths_;
+                decoder_cache_indir     = compact_cache_indirection_;
+            }
+
             std::vector<Tensor> decoder_input_tensors{
+                Tensor{MEMORY_GPU, data_type, {decoder_rows, d_model_}, decoder_input},
                 Tensor{MEMORY_GPU,
                        data_type,
-                       {local_batch_size * beam_width, d_model_},
-                       decoder_input_buf_ + d_model_offset},
-                Tensor{MEMORY_GPU,
-                       data_type,
-                       {local_batch_size * beam_width,
+                       {decoder_rows,
                         input_tensors->at("encoder_output").shape[1],
                         input_tensors->at("encoder_output").shape[2]},
                        encoder_output_ptr_
                            + id_offset * input_tensors->at("encoder_output").shape[1]
                                  * input_tensors->at("encoder_output").shape[2]},
-                Tensor{
-                    MEMORY_GPU, TYPE_INT32, {local_batch_size * beam_width}, encoder_sequence_length_ptr_ + id_offset},
-                Tensor{MEMORY_GPU, TYPE_BOOL, {local_batch_size * beam_width}, finished_buf_ + id_offset},
+                Tensor{MEMORY_GPU, TYPE_INT32, {decoder_rows}, decoder_memory_length},
+                Tensor{MEMORY_GPU, TYPE_BOOL, {decoder_rows}, decoder_finished},
                 Tensor{MEMORY_CPU, TYPE_INT32, {1}, &step},
-                Tensor{MEMORY_GPU, TYPE_INT32, {local_batch_size * beam_width}, sequence_lengths + id_offset},
+                Tensor{MEMORY_GPU, TYPE_INT32, {decoder_rows}, decoder_sequence_length},
                 Tensor{MEMORY_GPU,
                        data_type,
                        {1, head_num_, max_seq_len + 1, max_seq_len + 1},
@@ -506,14 +635,11 @@ void T5Decoding<T>::forward(std::unordered_map<std::string, Tensor>*       outpu
                 Tensor{MEMORY_CPU, TYPE_UINT32, {1}, &ite},
                 Tensor{MEMORY_GPU,
                        TYPE_INT32,
-                       {local_batch_size, beam_width, max_seq_len + 1},
-                       beam_width > 1 ? cache_indirections_[src_indir_idx] + id_offset * (max_seq_len + 1) : nullptr}};
+                       {decoder_rows / beam_width, beam_width, max_seq_len + 1},
+                       decoder_cache_indir}};
 
             std::vector<Tensor> decoder_output_tensors{
-                Tensor{MEMORY_GPU,
-                       data_type,
-                       {local_batch_size * beam_width, d_model_},
-                       decoder_output_buf_ + d_model_offset},
+                Tensor{MEMORY_GPU, data_type, {decoder_rows, d_model_}, decoder_output},
                 Tensor{MEMORY_GPU, data_type, self_k_cache_shape, key_cache_},
                 Tensor{MEMORY_GPU, data_type, self_v_cache_shape, value_cache_},
                 Tensor{MEMORY_GPU, data_type, mem_cache_shape, key_mem_cache_},
@@ -529,8 +655,20 @@ void T5Decoding<T>::forward(std::unordered_map<std::string, Tensor>*       outpu
                      batch_size * beam_width * head_num_ / tensor_para_.world_size_ * max_seq_len * mem_max_seq_len}});
             }
 
-            decoder_->forward(
-                &decoder_output_tensors, &decoder_input_tensors, &decoding_weights->decoder_layer_weights);
+            if (decoder_rows > 0) {
+                decoder_->forward(
+                    &decoder_output_tensors, &decoder_input_tensors, &decoding_weights->decoder_layer_weights);
+            }
+            if (compact_live_rows) {
+                // the rows of the done requests keep their last output, their logits being ignored
+                invokeUnCompactOutputs(decoder_output_buf_,
+                                       compact_decoder_output_,
+                                       live_batch_to_compact_,
+                                       batch_size * beam_width,
+                                       d_model_,
+                                       stream_);
+                sync_check_cuda_error();
+            }
 
             bool t5_with_bias = decoding_weights->t5_with_bias;
 
@@ -719,6 +857,10 @@ void T5Decoding<T>::forward(std::unordered_map<std::string, Tensor>*       outpu
                             TYPE_INT32,
                             {local_batch_size, beam_width, (max_seq_len + 1)},
                             cache_indirections_[tgt_indir_idx] + id_offset * (max_seq_len + 1)}}};
+                if (compact_live_rows) {
+                    dynamic_decode_output_tensors.insert(
+                        {"is_done", Tensor{MEMORY_GPU, TYPE_BOOL, {batch_size}, is_done_buf_}});
+                }
 
                 for (auto t = output_tensors->begin(); t != output_tensors->end(); ++t) {
                     // Handle exceptions.
@@ -23,6 +23,7 @@
 #include "src/fastertransformer/layers/DynamicDecodeLayer.h"
 #include "src/fastertransformer/models/t5/T5Decoder.h"
 #include "src/fastertransformer/models/t5/T5DecodingWeight.h"
+#include "src/fastertransformer/utils/beam_hypotheses.h"
 #include "src/fastertransformer/utils/custom_ar_comm.h"
 
 namespace fastertransformer {
@@ -124,6 +125,33 @@ protected:
     const T*   encoder_output_ptr_          = nullptr;
     const int* encoder_sequence_length_ptr_ = nullptr;
 
+    // beam search with early stopping: the decoder only runs the live rows, the requests not done yet. Their caches
+    // are moved to the first rows of the caches and their inputs gathered into the compact buffers.
+    LiveRowIndex live_rows_;
+    int*         compact_rows_buf_                = nullptr;
+    int*         live_compact_to_batch_           = nullptr;  // [batch_size * beam_width]
+    int*         live_batch_to_compact_           = nullptr;  // [batch_size * beam_width]
+    int*         compact_sequence_lengths_        = nullptr;  // [batch_size * beam_width]
+    int*         compact_encoder_sequence_length_ = nullptr;  // [batch_size * beam_width]
+    int*         compact_cache_indirection_       = nullptr;  // [batch_size * beam_width, max_seq_len + 1]
+    bool*        compact_masks_buf_               = nullptr;
+    bool*        is_done_buf_                     = nullptr;  // [batch_size], from DynamicDecodeLayer
+    bool*        compact_finished_                = nullptr;  // [batch_size * beam_width]
+    T*           compact_decoder_input_           = nullptr;  // [batch_size * beam_width, d_model_]
+    T*           compact_decoder_output_          = nullptr;  // [batch_size * beam_width, d_model_]
+
+    // Sets live_rows_ and uploads it to live_compact_to_batch_ / live_batch_to_compact_.
+    void setLiveRows(LiveRowIndex live_rows);
+    // Builds the live rows from is_done_buf_, moves the cache rows of the requests that got done since the last step
+    // and gathers the decoder inputs of the step. Returns the number of live rows.
+    size_t compactLiveRows(const size_t               batch_size,
+                           const size_t               beam_width,
+                           const size_t               max_seq_len,
+                           const int                  src_indir_idx,
+                           const int*                 sequence_lengths,
+                           const std::vector<size_t>& self_k_cache_shape,
+                           const std::vector<size_t>& mem_cache_shape);
+
 public:
     T5Decoding(size_t                              max_batch_size,
                size_t                              max_seq_len,
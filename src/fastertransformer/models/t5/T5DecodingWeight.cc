@@ -242,12 +242,12 @@ void T5DecodingWeight<T>::loadModel(std::string dir_path)
         loadWeightFromBin<T>(weights_ptr[5], {(size_t)weights_size[5]}, dir_path + "/shared.bias.bin");
     }
 
-    for (int l = 0; l < num_layer_; l++) {
+    loadLayersInParallel(num_layer_, [&](int l) {
         if (isValidLayerParallelId(l)) {
             decoder_layer_weights[l]->loadModel(dir_path + "/decoder.block." + std::to_string(l) + ".",
                                                 model_file_type);
         }
-    }
+    });
     FT_LOG_DEBUG("T5DecodingWeight " + std::string(__func__) + " end");
 }
 
@@ -236,12 +236,12 @@ void T5EncoderWeight<T>::loadModel(std::string dir_path)
                              model_file_type);
     }
 
-    for (int l = 0; l < num_layer_; l++) {
+    loadLayersInParallel(num_layer_, [&](int l) {
         if (isValidLayerParallelId(l)) {
             t5_encoder_layer_weights[l]->loadModel(dir_path + "/encoder.block." + std::to_string(l) + ".",
                                                    model_file_type);
         }
-    }
+    });
     FT_LOG_DEBUG("T5EncoderWeight " + std::string(__func__) + " end");
 }
 
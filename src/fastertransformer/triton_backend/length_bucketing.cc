@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/fastertransformer/triton_backend/length_bucketing.h"
+#include "src/fastertransformer/utils/cuda_utils.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace fastertransformer {
+
+static float
+getBatchCost(size_t batch_size, size_t max_input_len, size_t max_output_len, const LengthBucketingConfig& config)
+{
+    return batch_size * max_input_len * config.context_token_cost
+           + max_output_len * (config.decode_step_cost + batch_size * config.decode_token_cost);
+}
+
+PaddingMetrics getPaddingMetrics(const std::vector<BucketingRequest>& requests,
+                                 const std::vector<size_t>&           batch,
+                                 const LengthBucketingConfig&         config)
+{
+    PaddingMetrics metrics;
+    if (batch.empty()) {
+        return metrics;
+    }
+    size_t max_input_len  = 0;
+    size_t max_output_len = 0;
+    for (const size_t i : batch) {
+        max_input_len  = std::max(max_input_len, requests[i].input_len);
+        max_output_len = std::max(max_output_len, requests[i].output_len);
+    }
+    for (const size_t i : batch) {
+        metrics.useful_tokens += requests[i].input_len + requests[i].output_len;
+        metrics.padded_tokens += max_input_len - requests[i].input_len + max_output_len - requests[i].output_len;
+    }
+    metrics.estimated_cost = getBatchCost(batch.size(), max_input_len, max_output_len, config);
+    return metrics;
+}
+
+LengthBucketingPlan planLengthBuckets(const std::vector<BucketingRequest>& requests,
+                                      const LengthBucketingConfig&         config)
+{
+    FT_CHECK_WITH_INFO(config.max_latency_ratio >= 1.0f,
+                       fmtstr("max_latency_ratio (%f) must be at least 1", config.max_latency_ratio));
+    LengthBucketingPlan plan;
+    const size_t        n = requests.size();
+    if (n == 0) {
+        return plan;
+    }
+
+    std::vector<size_t> all(n);
+    for (size_t i = 0; i < n; i++) {
+        all[i] = i;
+    }
+    plan.baseline = getPaddingMetrics(requests, all, config);
+
+    const size_t max_size = config.max_sub_batch_size == 0 ? n : std::min(config.max_sub_batch_size, n);
+    const size_t min_k    = (n + max_size - 1) / max_size;
+    const size_t max_k    = std::min(std::max(config.max_sub_batches, min_k), n);
+
+    // requests sorted by input length then output length, the sub-batches are contiguous ranges of them
+    std::vector<size_t> order = all;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return requests[a].input_len < requests[b].input_len
+               || (requests[a].input_len == requests[b].input_len && requests[a].output_len < requests[b].output_len);
+    });
+
+    std::vector<double> input_sums(n + 1, 0.0);
+    std::vector<double> output_sums(n + 1, 0.0);
+    for (size_t i = 0; i < n; i++) {
+        input_sums[i + 1]  = input_sums[i] + requests[order[i]].input_len;
+        output_sums[i + 1] = output_sums[i] + requests[order[i]].output_len;
+    }
+
+    // padding[k][j]: least weighted padding of the first j sorted requests cut into k sub-batches, from[k][j]: where
+    // its last sub-batch begins
+    const double                     inf = std::numeric_limits<double>::infinity();
+    std::vector<std::vector<double>> padding(max_k + 1, std::vector<double>(n + 1, inf));
+    std::vector<std::vector<size_t>> from(max_k + 1, std::vector<size_t>(n + 1, 0));
+    padding[0][0] = 0.0;
+    for (size_t k = 1; k <= max_k; k++) {
+        for (size_t j = k; j <= n; j++) {
+            const size_t max_input_len  = requests[order[j - 1]].input_len;
+            size_t       max_output_len = 0;
+            for (size_t i = j; i-- > k - 1 && j - i <= max_size;) {
+                max_output_len = std::max(max_output_len, requests[order[i]].output_len);
+                if (padding[k - 1][i] == inf) {
+                    continue;
+                }
+                const double input_padding  = (j - i) * (double)max_input_len - (input_sums[j] - input_sums[i]);
+                const double output_padding = (j - i) * (double)max_output_len - (output_sums[j] - output_sums[i]);
+                const double total          = padding[k - 1][i] + input_padding * config.context_token_cost
+                                     + output_padding * config.decode_token_cost;
+                if (total < padding[k][j]) {
+                    padding[k][j] = total;
+                    from[k][j]    = i;
+                }
+            }
+        }
+    }
+
+    auto getSubBatches = [&](size_t k) {
+        std::vector<std::vector<size_t>> sub_batches(k);
+        for (size_t j = n; k > 0; k--) {
+            const size_t i = from[k][j];
+            sub_batches[k - 1].assign(order.begin() + i, order.begin() + j);
+            std::sort(sub_batches[k - 1].begin(), sub_batches[k - 1].end());
+            j = i;
+        }
+        return sub_batches;
+    };
+    auto getMetrics = [&](const std::vector<std::vector<size_t>>& sub_batches) {
+        PaddingMetrics metrics;
+        for (const auto& sub_batch : sub_batches) {
+            const PaddingMetrics sub_batch_metrics = getPaddingMetrics(requests, sub_batch, config);
+            metrics.useful_tokens += sub_batch_metrics.useful_tokens;
+            metrics.padded_tokens += sub_batch_metrics.padded_tokens;
+            metrics.estimated_cost += sub_batch_metrics.estimated_cost;
+        }
+        return metrics;
+    };
+
+    plan.sub_batches   = getSubBatches(min_k);
+    plan.metrics       = getMetrics(plan.sub_batches);
+    const float budget = plan.metrics.estimated_cost * config.max_latency_ratio;
+    for (size_t k = min_k + 1; k <= max_k; k++) {
+        if (padding[k][n] == inf) {
+            continue;
+        }
+        std::vector<std::vector<size_t>> sub_batches = getSubBatches(k);
+        const PaddingMetrics             metrics     = getMetrics(sub_batches);
+        if (metrics.estimated_cost <= budget && metrics.padded_tokens < plan.metrics.padded_tokens) {
+            plan.sub_batches = std::move(sub_batches);
+            plan.metrics     = metrics;
+        }
+    }
+    return plan;
+}
+
+void LengthBucketingStats::add(const LengthBucketingPlan& plan)
+{
+    num_batches++;
+    num_sub_batches += plan.sub_batches.size();
+    useful_tokens += plan.metrics.useful_tokens;
+    padded_tokens += plan.metrics.padded_tokens;
+    baseline_padded_tokens += plan.baseline.padded_tokens;
+}
+
+double LengthBucketingStats::efficiency() const
+{
+    return useful_tokens + padded_tokens == 0 ? 1.0 : (double)useful_tokens / (useful_tokens + padded_tokens);
+}
+
+double LengthBucketingStats::baselineEfficiency() const
+{
+    return useful_tokens + baseline_padded_tokens == 0 ?
+               1.0 :
+               (double)useful_tokens / (useful_tokens + baseline_padded_tokens);
+}
+
+}  // namespace fastertransformer
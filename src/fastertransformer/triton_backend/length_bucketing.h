@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * Length bucketing of the batches of the Triton backend
+ *
+ * A batch is padded to its longest input and decoded until its longest requested output, so a few long requests make
+ * the short ones pay for tokens which are thrown away. The pre-scheduler splits a batch into sub-batches of requests
+ * of similar lengths, run one after another, to cut the padded tokens.
+ *
+ * Splitting is not free: each sub-batch decodes its own steps, and a decoding step costs about as much for one
+ * sequence as for a few. Batches are planned with a cost model, in arbitrary units:
+ *   context phase:  context_token_cost per padded input token, batch_size * max_input_len
+ *   decoding phase: (decode_step_cost + decode_token_cost * batch_size) per step, max_output_len steps
+ * The requests are sorted by input length, then requested output length, and cut into contiguous sub-batches
+ * minimizing the cost of their padded tokens (dynamic programming, for each number of sub-batches). The plan with the
+ * least padding whose estimated cost stays within max_latency_ratio of the plan with the fewest sub-batches is kept.
+ **/
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace fastertransformer {
+
+struct BucketingRequest {
+    size_t input_len;
+    size_t output_len;  // requested output tokens
+};
+
+struct LengthBucketingConfig {
+    size_t max_sub_batches    = 4;  // 1 disables the splitting
+    size_t max_sub_batch_size = 0;  // 0 means no limit
+    // bound of the estimated cost of the sub-batches, relative to the plan with the fewest sub-batches
+    float max_latency_ratio = 1.25f;
+
+    float context_token_cost = 1.0f;
+    float decode_step_cost   = 64.0f;
+    float decode_token_cost  = 1.0f;
+};
+
+struct PaddingMetrics {
+    size_t useful_tokens  = 0;  // input and requested output tokens of the requests
+    size_t padded_tokens  = 0;  // input padding and decoding steps of sequences past their requested output
+    float  estimated_cost = 0.0f;
+
+    // Fraction of the processed tokens which are useful.
+    double efficiency() const
+    {
+        return useful_tokens + padded_tokens == 0 ? 1.0 : (double)useful_tokens / (useful_tokens + padded_tokens);
+    }
+};
+
+struct LengthBucketingPlan {
+    std::vector<std::vector<size_t>> sub_batches;  // indices of the requests of each sub-batch, in ascending order
+    PaddingMetrics                   metrics;      // of the plan
+    PaddingMetrics                   baseline;     // of the batch run as a whole
+};
+
+LengthBucketingPlan planLengthBuckets(const std::vector<BucketingRequest>& requests,
+                                      const LengthBucketingConfig&         config);
+
+// Padding of the requests run as one batch.
+PaddingMetrics getPaddingMetrics(const std::vector<BucketingRequest>& requests,
+                                 const std::vector<size_t>&           batch,
+                                 const LengthBucketingConfig&         config);
+
+// Accumulated over the planned batches, to report.
+struct LengthBucketingStats {
+    size_t num_batches            = 0;
+    size_t num_sub_batches        = 0;
+    size_t useful_tokens          = 0;
+    size_t padded_tokens          = 0;
+    size_t baseline_padded_tokens = 0;
+
+    void add(const LengthBucketingPlan& plan);
+
+    double efficiency() const;
+    double baselineEfficiency() const;
+};
+
+}  // namespace fastertransformer
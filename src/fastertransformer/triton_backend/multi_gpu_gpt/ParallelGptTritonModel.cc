@@ -230,6 +230,30 @@ ParallelGptTritonModel<T>::ParallelGptTritonModel(size_t      tensor_para_size,
         const int   prompt_length    = reader.GetInteger(config_task_name, "prompt_length", 0);
         prompt_learning_table_pair_.insert({task_name, {task_name_id, prompt_length}});
     }
+
+    /* Length Bucketing Examples, see length_bucketing.h
+    [length_bucketing]
+    enabled=1
+    max_sub_batches=4
+    max_sub_batch_size=0 ; no limit
+    max_latency_ratio=1.25
+    context_token_cost=1.0
+    decode_step_cost=64.0
+    decode_token_cost=1.0
+    */
+    length_bucketing_ = reader.GetBoolean("length_bucketing", "enabled", false);
+    length_bucketing_config_.max_sub_batches =
+        reader.GetInteger("length_bucketing", "max_sub_batches", length_bucketing_config_.max_sub_batches);
+    length_bucketing_config_.max_sub_batch_size =
+        reader.GetInteger("length_bucketing", "max_sub_batch_size", length_bucketing_config_.max_sub_batch_size);
+    length_bucketing_config_.max_latency_ratio =
+        reader.GetFloat("length_bucketing", "max_latency_ratio", length_bucketing_config_.max_latency_ratio);
+    length_bucketing_config_.context_token_cost =
+        reader.GetFloat("length_bucketing", "context_token_cost", length_bucketing_config_.context_token_cost);
+    length_bucketing_config_.decode_step_cost =
+        reader.GetFloat("length_bucketing", "decode_step_cost", length_bucketing_config_.decode_step_cost);
+    length_bucketing_config_.decode_token_cost =
+        reader.GetFloat("length_bucketing", "decode_token_cost", length_bucketing_config_.decode_token_cost);
 }
 
 template<typename T>
@@ -353,7 +377,7 @@ std::unique_ptr<AbstractTransformerModelInstance> ParallelGptTritonModel<T>::cre
                                              custom_all_reduce_comm,
                                              enable_custom_all_reduce_);
 
-    return std::unique_ptr<ParallelGptTritonModelInstance<T>>(
+    std::unique_ptr<ParallelGptTritonModelInstance<T>> instance(
         new ParallelGptTritonModelInstance<T>(std::move(gpt),
                                               shared_weights_[device_id],
                                               std::move(allocator),
@@ -361,6 +385,10 @@ std::unique_ptr<AbstractTransformerModelInstance> ParallelGptTritonModel<T>::cre
                                               std::move(cublas_wrapper_mutex),
                                               std::move(cublas_wrapper),
                                               std::move(cuda_device_prop_ptr)));
+    if (length_bucketing_) {
+        instance->setLengthBucketing(length_bucketing_config_, end_id_);
+    }
+    return instance;
 }
 
 template<typename T>
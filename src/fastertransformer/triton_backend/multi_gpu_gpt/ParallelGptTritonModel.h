@@ -19,6 +19,7 @@
 #include <cuda_fp16.h>
 
 #include "src/fastertransformer/models/multi_gpu_gpt/ParallelGpt.h"
+#include "src/fastertransformer/triton_backend/length_bucketing.h"
 #include "src/fastertransformer/triton_backend/transformer_triton_backend.hpp"
 #include "src/fastertransformer/utils/cuda_utils.h"
 #include "src/fastertransformer/utils/custom_ar_comm.h"
@@ -97,4 +98,8 @@ private:
     int                                        prompt_learning_start_id_   = 0;
     ft::PromptLearningType                     prompt_learning_type_       = ft::PromptLearningType::no_prompt;
     std::map<std::string, std::pair<int, int>> prompt_learning_table_pair_ = {};
+
+    // length bucketing of the batches of the instances
+    bool                      length_bucketing_ = false;
+    ft::LengthBucketingConfig length_bucketing_config_;
 };
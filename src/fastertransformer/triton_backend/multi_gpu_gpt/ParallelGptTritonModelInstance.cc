@@ -18,7 +18,10 @@
 #include "src/fastertransformer/triton_backend/transformer_triton_backend.hpp"
 #include "src/fastertransformer/triton_backend/triton_utils.hpp"
 #include "src/fastertransformer/utils/Tensor.h"
+#include "src/fastertransformer/utils/memory_utils.h"
 #include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <functional>
 #include <numeric>
 #include <vector>
@@ -70,7 +73,8 @@ std::unordered_map<std::string, ft::Tensor> ParallelGptTritonModelInstance<T>::c
     move_tensor_H2D(input_tensors->at("input_lengths"), d_input_lengths_, &allocator_);
 
     const int input_data_len = input_tensors->at("input_ids").shape[1];
-    h_total_output_lengths_  = reinterpret_cast<uint32_t*>(malloc(request_batch_size * sizeof(uint32_t)));
+    free(h_total_output_lengths_);
+    h_total_output_lengths_ = reinterpret_cast<uint32_t*>(malloc(request_batch_size * sizeof(uint32_t)));
     for (int i = 0; i < request_batch_size; ++i) {
         h_total_output_lengths_[i] =
             reinterpret_cast<const uint32_t*>(input_tensors->at("request_output_len").data)[i] + input_data_len;
@@ -137,9 +141,42 @@ ParallelGptTritonModelInstance<T>::convert_outputs(const std::unordered_map<std:
     return std::shared_ptr<std::unordered_map<std::string, triton::Tensor>>(outputs_mapping);
 }
 
+// Beam width of each request, from beam_width [1] or [request_batch_size, 1]. Invalid widths fall back to sampling.
+static std::vector<int> getBeamWidths(const std::unordered_map<std::string, triton::Tensor>& input_tensors)
+{
+    const size_t     request_batch_size = input_tensors.at("input_ids").shape[0];
+    std::vector<int> beam_widths(request_batch_size, 1);
+    if (input_tensors.count("beam_width") == 0) {
+        return beam_widths;
+    }
+    const triton::Tensor& tensor = input_tensors.at("beam_width");
+    const uint32_t*       data   = reinterpret_cast<const uint32_t*>(tensor.data);
+    const bool            shared = tensor.shape.empty() || tensor.shape[0] != request_batch_size;
+    for (size_t i = 0; i < request_batch_size; i++) {
+        const size_t beam_width = data[shared ? 0 : i];
+        if (beam_width != 1 && beam_width != 2 && beam_width != 3 && beam_width != 4 && beam_width != 8
+            && beam_width != 16 && beam_width != 32) {
+            FT_LOG_WARNING("beam_width = %ld is invalid. Set it to 1 to use sampling by default.", beam_width);
+            continue;
+        }
+        beam_widths[i] = beam_width;
+    }
+    return beam_widths;
+}
+
 template<typename T>
 std::shared_ptr<std::unordered_map<std::string, triton::Tensor>> ParallelGptTritonModelInstance<T>::forward(
     std::shared_ptr<std::unordered_map<std::string, triton::Tensor>> input_tensors)
+{
+    if (isLengthBucketingApplicable(*input_tensors)) {
+        return forwardBucketed(input_tensors);
+    }
+    return convert_outputs(forwardBatch(input_tensors));
+}
+
+template<typename T>
+std::unordered_map<std::string, ft::Tensor> ParallelGptTritonModelInstance<T>::forwardBatch(
+    std::shared_ptr<std::unordered_map<std::string, triton::Tensor>> input_tensors)
 {
     ft::FT_CHECK_WITH_INFO(input_tensors->at("input_ids").shape.size() == 2,
                            "input_tensors->at(\"input_ids\").shape.size() == 2");
@@ -149,17 +186,20 @@ std::shared_ptr<std::unordered_map<std::string, triton::Tensor>> ParallelGptTrit
     size_t max_request_output_len = (size_t)*std::max_element(
         (int*)input_tensors->at("request_output_len").data,
         (int*)input_tensors->at("request_output_len").data + input_tensors->at("request_output_len").shape[0]);
-    size_t beam_width = input_tensors->count("beam_width") ? (size_t)(*(uint*)input_tensors->at("beam_width").data) : 1;
+    // Beam search and sampling requests batched together are generated group by group (ParallelGpt::forwardMixed),
+    // the outputs holding the beams of the widest request.
+    std::vector<int> beam_widths = getBeamWidths(*input_tensors);
+    const size_t     beam_width  = *std::max_element(beam_widths.begin(), beam_widths.end());
+    const bool       is_mixed_beam_width =
+        std::any_of(beam_widths.begin(), beam_widths.end(), [&](int w) { return w != beam_widths[0]; });
 
     size_t total_length = max_request_output_len + input_tensors->at("input_ids").shape[1];
 
-    if (beam_width != 1 && beam_width != 2 && beam_width != 3 && beam_width != 4 && beam_width != 8 && beam_width != 16
-        && beam_width != 32) {
-        FT_LOG_WARNING("beam_width = %ld is invalid. Set it to 1 to use sampling by default.", beam_width);
-        beam_width = 1;
-    }
-
     std::unordered_map<std::string, ft::Tensor> ft_input_tensors = convert_inputs(input_tensors);
+    if (is_mixed_beam_width) {
+        ft_input_tensors.insert(
+            {"beam_widths", ft::Tensor{ft::MEMORY_CPU, ft::TYPE_INT32, {request_batch_size}, beam_widths.data()}});
+    }
     // If input_tensors don't contain "START" flag, then it is non-interactive generation, allocate buffer directly.
     // If input_tensors contains "START" flag, then only allocate buffer when "START == 1".
     if (ft_input_tensors.count("START") == 0
@@ -203,23 +243,359 @@ std::shared_ptr<std::unordered_map<std::string, triton::Tensor>> ParallelGptTrit
                                           d_cum_log_probs_}});
     }
 
-    if (stream_cb_ != nullptr) {
+    if (is_mixed_beam_width && (token_ring_ != nullptr || stream_cb_ != nullptr)) {
+        FT_LOG_WARNING("A batch mixing beam widths is not streamed, its outputs are returned at the end.");
+    }
+    else if (token_ring_ != nullptr) {
+        gpt_->registerTokenStream(token_ring_);
+    }
+    else if (stream_cb_ != nullptr && isStreamRingApplicable(*input_tensors, beam_width)) {
+        forwardStreamed(&output_tensors, &ft_input_tensors, total_length);
+        return output_tensors;
+    }
+    else if (stream_cb_ != nullptr) {
         gpt_->registerCallback(triton_stream_callback<T>, this);
     }
 
     gpt_->forward(&output_tensors, &ft_input_tensors, gpt_weight_.get());
 
-    if (stream_cb_ != nullptr) {
-        gpt_->unRegisterCallback();
+    gpt_->unRegisterTokenStream();
+    gpt_->unRegisterCallback();
+
+    return output_tensors;
+}
+
+template<typename T>
+void ParallelGptTritonModelInstance<T>::forwardStreamed(std::unordered_map<std::string, ft::Tensor>* output_tensors,
+                                                        std::unordered_map<std::string, ft::Tensor>* ft_input_tensors,
+                                                        size_t                                       total_length)
+{
+    const size_t        request_batch_size = ft_input_tensors->at("input_ids").shape[0];
+    ft::TokenRingBuffer ring(std::max((size_t)4096, 4 * request_batch_size));
+    startStreamConsumer(*ft_input_tensors, total_length, &ring);
+    gpt_->registerTokenStream(&ring);
+    try {
+        gpt_->forward(output_tensors, ft_input_tensors, gpt_weight_.get());
+    }
+    catch (...) {
+        stopStreamConsumer();
+        gpt_->unRegisterTokenStream();
+        throw;
+    }
+    stopStreamConsumer();
+    gpt_->unRegisterTokenStream();
+}
+
+template<typename T>
+bool ParallelGptTritonModelInstance<T>::isStreamRingApplicable(
+    const std::unordered_map<std::string, triton::Tensor>& input_tensors, size_t beam_width) const
+{
+    // The ring carries the sampled token of each step, while the beams of beam search are reordered, and the
+    // interactive generation and the prompts shift the outputs, so those go through the whole outputs.
+    return beam_width == 1 && input_tensors.count("START") == 0 && input_tensors.count("session_len") == 0
+           && input_tensors.count("request_prompt_embedding") == 0
+           && !(input_tensors.count("is_return_log_probs") && *((bool*)input_tensors.at("is_return_log_probs").data));
+}
+
+template<typename T>
+void ParallelGptTritonModelInstance<T>::startStreamConsumer(
+    const std::unordered_map<std::string, ft::Tensor>& ft_input_tensors, size_t total_length, ft::TokenRingBuffer* ring)
+{
+    const ft::Tensor& input_ids          = ft_input_tensors.at("input_ids");
+    const size_t      request_batch_size = input_ids.shape[0];
+    const size_t      max_input_length   = input_ids.shape[1];
+
+    // The host outputs start from the unpadded inputs, the tokens being appended after them.
+    std::vector<int> h_input_ids(request_batch_size * max_input_length);
+    h_stream_input_lengths_.resize(request_batch_size);
+    ft::check_cuda_error(cudaStreamSynchronize(allocator_->returnStream()));
+    ft::cudaD2Hcpy(h_input_ids.data(), input_ids.getPtr<int>(), h_input_ids.size());
+    ft::cudaD2Hcpy(h_stream_input_lengths_.data(),
+                   ft_input_tensors.at("input_lengths").getPtr<int>(),
+                   h_stream_input_lengths_.size());
+
+    stream_total_length_ = total_length;
+    h_stream_output_ids_.assign(request_batch_size * total_length, 0);
+    h_stream_sequence_lengths_.resize(request_batch_size);
+    for (size_t i = 0; i < request_batch_size; i++) {
+        std::copy(h_input_ids.begin() + i * max_input_length,
+                  h_input_ids.begin() + i * max_input_length + h_stream_input_lengths_[i],
+                  h_stream_output_ids_.begin() + i * total_length);
+        h_stream_sequence_lengths_[i] = h_stream_input_lengths_[i];
     }
 
-    return convert_outputs(output_tensors);
+    stream_ring_         = ring;
+    stream_forward_done_ = false;
+    stream_consumer_     = std::thread(&ParallelGptTritonModelInstance<T>::consumeStreamRing, this);
+}
+
+template<typename T>
+void ParallelGptTritonModelInstance<T>::stopStreamConsumer()
+{
+    stream_forward_done_ = true;
+    stream_consumer_.join();
+    stream_ring_ = nullptr;
+}
+
+template<typename T>
+void ParallelGptTritonModelInstance<T>::consumeStreamRing()
+{
+    const size_t request_batch_size = h_stream_sequence_lengths_.size();
+    while (true) {
+        // Read before draining, so the tokens pushed before the end of the forward are all drained.
+        const bool         is_done    = stream_forward_done_;
+        bool               has_tokens = false;
+        ft::GeneratedToken token;
+        while (stream_ring_->tryPop(&token)) {
+            int& sequence_length = h_stream_sequence_lengths_[token.batch_idx];
+            if ((size_t)sequence_length < stream_total_length_) {
+                h_stream_output_ids_[token.batch_idx * stream_total_length_ + sequence_length] = token.token_id;
+                sequence_length++;
+            }
+            has_tokens = true;
+        }
+        if (has_tokens) {
+            // The callback reads the host outputs before returning, they are only updated by this thread.
+            auto result = std::make_shared<std::unordered_map<std::string, triton::Tensor>>(
+                std::unordered_map<std::string, triton::Tensor>{
+                    {"output_ids",
+                     triton::Tensor{triton::MEMORY_CPU,
+                                    triton::TYPE_INT32,
+                                    std::vector<size_t>{request_batch_size, 1, stream_total_length_},
+                                    h_stream_output_ids_.data()}},
+                    {"sequence_length",
+                     triton::Tensor{triton::MEMORY_CPU,
+                                    triton::TYPE_INT32,
+                                    std::vector<size_t>{request_batch_size, 1},
+                                    h_stream_sequence_lengths_.data()}}});
+            stream_cb_(result, stream_ctx_);
+        }
+        else if (is_done) {
+            break;
+        }
+        else {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+}
+
+template<typename T>
+bool ParallelGptTritonModelInstance<T>::isLengthBucketingApplicable(
+    const std::unordered_map<std::string, triton::Tensor>& input_tensors) const
+{
+    // Interactive generation keeps the caches of the batch between calls, and streaming reports the steps of a
+    // single batch, so they are not split.
+    if (!length_bucketing_ || input_tensors.at("input_ids").shape[0] <= 1 || input_tensors.count("START")
+        || input_tensors.count("session_len") || stream_cb_ != nullptr || token_ring_ != nullptr) {
+        return false;
+    }
+    // The inputs are sliced on the host.
+    for (const auto& t : input_tensors) {
+        if (t.second.where == triton::MEMORY_GPU) {
+            return false;
+        }
+    }
+    // The sub-batches are merged with a single beam width.
+    const std::vector<int> beam_widths = getBeamWidths(input_tensors);
+    return std::all_of(beam_widths.begin(), beam_widths.end(), [&](int w) { return w == beam_widths[0]; });
+}
+
+template<typename T>
+std::shared_ptr<std::unordered_map<std::string, triton::Tensor>> ParallelGptTritonModelInstance<T>::sliceInputs(
+    const std::unordered_map<std::string, triton::Tensor>& input_tensors,
+    const std::vector<size_t>&                             sub_batch,
+    std::vector<std::vector<char>>*                        buffers)
+{
+    const size_t    request_batch_size = input_tensors.at("input_ids").shape[0];
+    const uint32_t* input_lengths      = reinterpret_cast<const uint32_t*>(input_tensors.at("input_lengths").data);
+    size_t          max_input_len      = 0;
+    for (const size_t i : sub_batch) {
+        max_input_len = std::max(max_input_len, (size_t)input_lengths[i]);
+    }
+
+    auto sub_inputs = std::make_shared<std::unordered_map<std::string, triton::Tensor>>();
+    for (const auto& t : input_tensors) {
+        const triton::Tensor& tensor = t.second;
+        // bad and stop words lists of shape [2, len] are shared by the batch
+        const bool is_shared_words_list =
+            (t.first == "bad_words_list" || t.first == "stop_words_list") && tensor.shape.size() != 3;
+        if (tensor.shape.empty() || tensor.shape[0] != request_batch_size || is_shared_words_list) {
+            sub_inputs->insert({t.first, tensor});
+            continue;
+        }
+
+        const size_t type_size = ft::Tensor::getTypeSize(triton::Tensor::convertTritonTypeToFt(tensor.type));
+        size_t       row_size  = type_size;
+        for (size_t d = 1; d < tensor.shape.size(); d++) {
+            row_size *= tensor.shape[d];
+        }
+        std::vector<size_t> shape        = tensor.shape;
+        size_t              sub_row_size = row_size;
+        shape[0]                         = sub_batch.size();
+        if (t.first == "input_ids") {
+            // drop the padding past the longest input of the sub-batch
+            shape[1]     = max_input_len;
+            sub_row_size = type_size * max_input_len;
+        }
+
+        buffers->emplace_back(sub_batch.size() * sub_row_size);
+        char* data = buffers->back().data();
+        for (size_t j = 0; j < sub_batch.size(); j++) {
+            memcpy(data + j * sub_row_size, (const char*)tensor.data + sub_batch[j] * row_size, sub_row_size);
+        }
+        sub_inputs->insert({t.first, triton::Tensor{tensor.where, tensor.type, shape, data}});
+    }
+    return sub_inputs;
+}
+
+template<typename T>
+std::shared_ptr<std::unordered_map<std::string, triton::Tensor>> ParallelGptTritonModelInstance<T>::forwardBucketed(
+    std::shared_ptr<std::unordered_map<std::string, triton::Tensor>> input_tensors)
+{
+    const size_t    request_batch_size = input_tensors->at("input_ids").shape[0];
+    const uint32_t* input_lengths      = reinterpret_cast<const uint32_t*>(input_tensors->at("input_lengths").data);
+    const uint32_t* request_output_lengths =
+        reinterpret_cast<const uint32_t*>(input_tensors->at("request_output_len").data);
+
+    std::vector<ft::BucketingRequest> requests(request_batch_size);
+    for (size_t i = 0; i < request_batch_size; i++) {
+        requests[i] = {input_lengths[i], request_output_lengths[i]};
+    }
+    // Every rank plans the same sub-batches from the same inputs.
+    const ft::LengthBucketingPlan plan = ft::planLengthBuckets(requests, length_bucketing_config_);
+    length_bucketing_stats_.add(plan);
+    FT_LOG_DEBUG("length bucketing: %ld requests in %ld sub-batches, padding efficiency %.3f (%.3f unbucketed)",
+                 request_batch_size,
+                 plan.sub_batches.size(),
+                 plan.metrics.efficiency(),
+                 plan.baseline.efficiency());
+    if (plan.sub_batches.size() == 1) {
+        return convert_outputs(forwardBatch(input_tensors));
+    }
+
+    const size_t max_request_output_len =
+        *std::max_element(request_output_lengths, request_output_lengths + request_batch_size);
+    size_t max_prefix_soft_prompt_length = 0;
+    if (input_tensors->count("request_prompt_lengths")) {
+        max_prefix_soft_prompt_length =
+            (size_t)*std::max_element((int*)input_tensors->at("request_prompt_lengths").data,
+                                      (int*)input_tensors->at("request_prompt_lengths").data + request_batch_size);
+    }
+    const size_t total_length =
+        max_request_output_len + input_tensors->at("input_ids").shape[1] + max_prefix_soft_prompt_length;
+    cudaStream_t stream = allocator_->returnStream();
+
+    std::unordered_map<std::string, ft::Tensor> merged_outputs;
+    for (const auto& sub_batch : plan.sub_batches) {
+        std::vector<std::vector<char>>                    buffers;
+        const std::unordered_map<std::string, ft::Tensor> outputs =
+            forwardBatch(sliceInputs(*input_tensors, sub_batch, &buffers));
+        const size_t beam_width        = outputs.at("output_ids").shape[1];
+        const size_t sub_total_length  = outputs.at("output_ids").shape[2];
+        const bool   return_log_probs  = outputs.count("output_log_probs") > 0;
+        const size_t sub_output_length = return_log_probs ? outputs.at("output_log_probs").shape[2] : 0;
+
+        if (merged_outputs.empty()) {
+            const size_t batchxbeam = request_batch_size * beam_width;
+            d_bucketed_output_ids_  = (int*)(allocator_->reMalloc(
+                d_bucketed_output_ids_, sizeof(int) * batchxbeam * total_length, false));
+            d_bucketed_sequence_lengths_ =
+                (int*)(allocator_->reMalloc(d_bucketed_sequence_lengths_, sizeof(int) * batchxbeam, false));
+            ft::deviceFill(d_bucketed_output_ids_, batchxbeam * total_length, end_id_, stream);
+            merged_outputs.insert({"output_ids",
+                                   ft::Tensor{ft::MEMORY_GPU,
+                                              ft::TYPE_UINT32,
+                                              std::vector<size_t>{request_batch_size, beam_width, total_length},
+                                              d_bucketed_output_ids_}});
+            merged_outputs.insert({"sequence_length",
+                                   ft::Tensor{ft::MEMORY_GPU,
+                                              ft::TYPE_INT32,
+                                              std::vector<size_t>{request_batch_size, beam_width},
+                                              d_bucketed_sequence_lengths_}});
+            if (return_log_probs) {
+                d_bucketed_output_log_probs_ = (float*)(allocator_->reMalloc(
+                    d_bucketed_output_log_probs_, sizeof(float) * batchxbeam * max_request_output_len, true));
+                d_bucketed_cum_log_probs_ =
+                    (float*)(allocator_->reMalloc(d_bucketed_cum_log_probs_, sizeof(float) * batchxbeam, false));
+                merged_outputs.insert(
+                    {"output_log_probs",
+                     ft::Tensor{ft::MEMORY_GPU,
+                                ft::TYPE_FP32,
+                                std::vector<size_t>{request_batch_size, beam_width, max_request_output_len},
+                                d_bucketed_output_log_probs_}});
+                merged_outputs.insert({"cum_log_probs",
+                                       ft::Tensor{ft::MEMORY_GPU,
+                                                  ft::TYPE_FP32,
+                                                  std::vector<size_t>{request_batch_size, beam_width},
+                                                  d_bucketed_cum_log_probs_}});
+            }
+        }
+
+        // the rows of a sub-batch are shorter than the merged ones, which keep their padding
+        for (size_t j = 0; j < sub_batch.size(); j++) {
+            const size_t i = sub_batch[j];
+            ft::check_cuda_error(cudaMemcpy2DAsync(d_bucketed_output_ids_ + i * beam_width * total_length,
+                                                   sizeof(int) * total_length,
+                                                   d_output_ids_ + j * beam_width * sub_total_length,
+                                                   sizeof(int) * sub_total_length,
+                                                   sizeof(int) * sub_total_length,
+                                                   beam_width,
+                                                   cudaMemcpyDeviceToDevice,
+                                                   stream));
+            ft::check_cuda_error(cudaMemcpyAsync(d_bucketed_sequence_lengths_ + i * beam_width,
+                                                 d_sequence_lengths_ + j * beam_width,
+                                                 sizeof(int) * beam_width,
+                                                 cudaMemcpyDeviceToDevice,
+                                                 stream));
+            if (return_log_probs) {
+                ft::check_cuda_error(
+                    cudaMemcpy2DAsync(d_bucketed_output_log_probs_ + i * beam_width * max_request_output_len,
+                                      sizeof(float) * max_request_output_len,
+                                      d_output_log_probs_ + j * beam_width * sub_output_length,
+                                      sizeof(float) * sub_output_length,
+                                      sizeof(float) * sub_output_length,
+                                      beam_width,
+                                      cudaMemcpyDeviceToDevice,
+                                      stream));
+                ft::check_cuda_error(cudaMemcpyAsync(d_bucketed_cum_log_probs_ + i * beam_width,
+                                                     d_cum_log_probs_ + j * beam_width,
+                                                     sizeof(float) * beam_width,
+                                                     cudaMemcpyDeviceToDevice,
+                                                     stream));
+            }
+        }
+        // the next sub-batch reuses the output buffers, and the host inputs are freed with buffers
+        ft::check_cuda_error(cudaStreamSynchronize(stream));
+    }
+    return convert_outputs(merged_outputs);
+}
+
+template<typename T>
+void ParallelGptTritonModelInstance<T>::registerTokenStream(ft::TokenRingBuffer* ring)
+{
+    token_ring_ = ring;
+}
+
+template<typename T>
+void ParallelGptTritonModelInstance<T>::setLengthBucketing(const ft::LengthBucketingConfig& config, int end_id)
+{
+    length_bucketing_        = true;
+    length_bucketing_config_ = config;
+    end_id_                  = end_id;
 }
 
 template<typename T>
 ParallelGptTritonModelInstance<T>::~ParallelGptTritonModelInstance()
 {
+    if (length_bucketing_stats_.num_batches > 0) {
+        FT_LOG_INFO("length bucketing: %ld batches in %ld sub-batches, padding efficiency %.3f (%.3f unbucketed)",
+                    length_bucketing_stats_.num_batches,
+                    length_bucketing_stats_.num_sub_batches,
+                    length_bucketing_stats_.efficiency(),
+                    length_bucketing_stats_.baselineEfficiency());
+    }
     freeBuffer();
+    free(h_total_output_lengths_);
 }
 
 template<typename T>
@@ -245,6 +621,10 @@ void ParallelGptTritonModelInstance<T>::freeBuffer()
     allocator_->free((void**)(&d_sequence_lengths_));
     allocator_->free((void**)(&d_output_log_probs_));
     allocator_->free((void**)(&d_cum_log_probs_));
+    allocator_->free((void**)(&d_bucketed_output_ids_));
+    allocator_->free((void**)(&d_bucketed_sequence_lengths_));
+    allocator_->free((void**)(&d_bucketed_output_log_probs_));
+    allocator_->free((void**)(&d_bucketed_cum_log_probs_));
 }
 
 template struct ParallelGptTritonModelInstance<float>;
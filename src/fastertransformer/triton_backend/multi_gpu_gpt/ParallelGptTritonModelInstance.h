@@ -17,9 +17,12 @@
 #pragma once
 
 #include "src/fastertransformer/models/multi_gpu_gpt/ParallelGpt.h"
+#include "src/fastertransformer/triton_backend/length_bucketing.h"
 #include "src/fastertransformer/triton_backend/multi_gpu_gpt/ParallelGptTritonModel.h"
 #include "src/fastertransformer/triton_backend/transformer_triton_backend.hpp"
+#include <atomic>
 #include <memory>
+#include <thread>
 
 namespace ft = fastertransformer;
 
@@ -44,6 +47,13 @@ struct ParallelGptTritonModelInstance: AbstractTransformerModelInstance {
     static std::shared_ptr<std::unordered_map<std::string, triton::Tensor>>
     convert_outputs(const std::unordered_map<std::string, ft::Tensor>& output_tensors);
 
+    // Streams the new tokens of each step into the ring instead of the whole outputs through the stream callback.
+    void registerTokenStream(ft::TokenRingBuffer* ring) override;
+
+    // Splits the batches into sub-batches of requests of similar lengths, see length_bucketing.h. end_id pads the
+    // merged output_ids.
+    void setLengthBucketing(const ft::LengthBucketingConfig& config, int end_id);
+
 private:
     const std::unique_ptr<ft::ParallelGpt<T>>                     gpt_;
     const std::shared_ptr<ft::ParallelGptWeight<T>>               gpt_weight_;
@@ -62,6 +72,18 @@ private:
                         const size_t request_output_len);
     void freeBuffer();
 
+    std::unordered_map<std::string, ft::Tensor>
+    forwardBatch(std::shared_ptr<std::unordered_map<std::string, triton::Tensor>> input_tensors);
+
+    bool isLengthBucketingApplicable(const std::unordered_map<std::string, triton::Tensor>& input_tensors) const;
+    std::shared_ptr<std::unordered_map<std::string, triton::Tensor>>
+    forwardBucketed(std::shared_ptr<std::unordered_map<std::string, triton::Tensor>> input_tensors);
+    // Rows sub_batch of the inputs, copied into buffers.
+    std::shared_ptr<std::unordered_map<std::string, triton::Tensor>>
+    sliceInputs(const std::unordered_map<std::string, triton::Tensor>& input_tensors,
+                const std::vector<size_t>&                             sub_batch,
+                std::vector<std::vector<char>>*                        buffers);
+
     int* d_input_ids_                = nullptr;
     int* d_input_lengths_            = nullptr;
     int* d_request_prompt_lengths_   = nullptr;
@@ -75,4 +97,37 @@ private:
     float* d_cum_log_probs_    = nullptr;
 
     uint32_t* h_total_output_lengths_ = nullptr;
+
+    // Streaming through the stream callback without a registered ring: the tokens of each step go through a ring to
+    // a consumer thread, which appends them to host copies of output_ids and sequence_length and passes those to the
+    // callback, instead of the whole device outputs after each step.
+    bool isStreamRingApplicable(const std::unordered_map<std::string, triton::Tensor>& input_tensors,
+                                size_t                                                 beam_width) const;
+    void forwardStreamed(std::unordered_map<std::string, ft::Tensor>* output_tensors,
+                         std::unordered_map<std::string, ft::Tensor>* ft_input_tensors,
+                         size_t                                       total_length);
+    void startStreamConsumer(const std::unordered_map<std::string, ft::Tensor>& ft_input_tensors,
+                             size_t                                             total_length,
+                             ft::TokenRingBuffer*                               ring);
+    void stopStreamConsumer();
+    void consumeStreamRing();
+
+    ft::TokenRingBuffer* stream_ring_ = nullptr;
+    std::thread          stream_consumer_;
+    std::atomic<bool>    stream_forward_done_{false};
+    size_t               stream_total_length_ = 0;
+    std::vector<int>     h_stream_input_lengths_;
+    std::vector<int>     h_stream_output_ids_;        // [request_batch_size, 1, total_length]
+    std::vector<int>     h_stream_sequence_lengths_;  // [request_batch_size, 1]
+
+    bool                      length_bucketing_ = false;
+    ft::LengthBucketingConfig length_bucketing_config_;
+    ft::LengthBucketingStats  length_bucketing_stats_;
+    int                       end_id_ = 0;
+
+    // outputs of the whole batch, merged from its sub-batches
+    int*   d_bucketed_output_ids_       = nullptr;
+    int*   d_bucketed_sequence_lengths_ = nullptr;
+    float* d_bucketed_output_log_probs_ = nullptr;
+    float* d_bucketed_cum_log_probs_    = nullptr;
 };
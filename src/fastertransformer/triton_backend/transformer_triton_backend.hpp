@@ -25,6 +25,7 @@
 #include "src/fastertransformer/utils/custom_ar_comm.h"
 #include "src/fastertransformer/utils/mpi_utils.h"
 #include "src/fastertransformer/utils/nccl_utils.h"
+#include "src/fastertransformer/utils/token_ring_buffer.h"
 
 namespace ft = fastertransformer;
 
@@ -255,8 +256,21 @@ struct AbstractTransformerModelInstance {
         stream_ctx_ = nullptr;
     }
 
-    triton_stream_cb_t* stream_cb_  = nullptr;
-    void*               stream_ctx_ = nullptr;
+    // Streams the tokens of each step into the ring, drained by the caller's threads, instead of the whole outputs
+    // through the stream callback. Only supported by the models overriding it.
+    virtual void registerTokenStream(ft::TokenRingBuffer* ring)
+    {
+        ft::FT_CHECK_WITH_INFO(ring == nullptr, "The token stream is not supported by this model.");
+    }
+
+    void unRegisterTokenStream()
+    {
+        token_ring_ = nullptr;
+    }
+
+    triton_stream_cb_t*  stream_cb_  = nullptr;
+    void*                stream_ctx_ = nullptr;
+    ft::TokenRingBuffer* token_ring_ = nullptr;
 };
 
 struct AbstractTransformerModel {
@@ -20,6 +20,8 @@
 #pragma once
 
 #include "cuda_utils.h"
+#include "src/fastertransformer/utils/caching_allocator.h"
+#include <cstdlib>
 #include <cuda_runtime.h>
 #include <unordered_map>
 #include <vector>
@@ -51,6 +53,7 @@ namespace fastertransformer {
 
 enum class AllocatorType {
     CUDA,
+    CPU,
     TF,
     TH
 };
@@ -72,11 +75,10 @@ public:
     void* reMalloc(T* ptr, size_t size, const bool is_set_zero = true)
     {
         FT_LOG_DEBUG(__PRETTY_FUNCTION__);
-        size                    = ((size + 31) / 32) * 32;  // make the buffer align with 32 bytes
-        void*       void_ptr    = (void*)ptr;
-        std::string ptr_address = getAddress(void_ptr);
-        if (isExist(ptr_address)) {
-            ReallocType realloc_type = isReMalloc(ptr_address, size);
+        size           = ((size + 31) / 32) * 32;  // make the buffer align with 32 bytes
+        void* void_ptr = (void*)ptr;
+        if (isExist(void_ptr)) {
+            ReallocType realloc_type = isReMalloc(void_ptr, size);
             if (realloc_type == ReallocType::INCREASE) {
                 FT_LOG_DEBUG("ReMalloc the buffer %p since it is too small.", void_ptr);
                 free((void**)(&void_ptr));
@@ -85,12 +87,13 @@ public:
 #if !defined(CUDA_MEMORY_POOL_DISABLED)
             else if (realloc_type == ReallocType::DECREASE) {
                 FT_LOG_DEBUG("ReMalloc the buffer %p to release unused memory to memory pools.", void_ptr);
-                free((void**)(&void_ptr));
+                release((void**)(&void_ptr));
                 return malloc(size, is_set_zero);
             }
 #endif
             else {
                 FT_LOG_DEBUG("Reuse original buffer %p and do nothing for reMalloc.", void_ptr);
+                reuse(void_ptr, size);
                 return void_ptr;
             }
         }
@@ -101,51 +104,109 @@ public:
     }
 
 protected:
-    virtual bool        isExist(std::string address) const                 = 0;
-    virtual ReallocType isReMalloc(std::string address, size_t size) const = 0;
+    virtual bool        isExist(void* ptr) const                 = 0;
+    virtual ReallocType isReMalloc(void* ptr, size_t size) const = 0;
 
-    std::string getAddress(void* ptr) const
+    // Frees a buffer shrunk by reMalloc. Allocators caching freed buffers give its memory back instead.
+    virtual void release(void** ptr)
     {
-        FT_LOG_DEBUG(__PRETTY_FUNCTION__);
-        char address[256];
-        sprintf(address, "%p", ptr);
-        return std::string(address);
+        free(ptr);
     }
+    // Called when reMalloc keeps `ptr` for a request of `size` bytes.
+    virtual void reuse(void* ptr, size_t size) {}
 };
 
+// FT_ALLOCATOR_CACHING=0 makes the CUDA and CPU allocators return freed buffers to the backend right away.
+inline bool isAllocatorCachingEnabled()
+{
+    static const bool enabled = [] {
+        const char* caching = std::getenv("FT_ALLOCATOR_CACHING");
+        return caching == nullptr || std::string(caching) != "0";
+    }();
+    return enabled;
+}
+
 template<AllocatorType AllocType_>
 class Allocator;
 
 template<>
 class Allocator<AllocatorType::CUDA>: public IAllocator {
 private:
-    const int                                                  device_id_;
-    cudaStream_t                                               stream_ = 0;  // initialize as default stream
-    std::unordered_map<std::string, std::pair<void*, size_t>>* pointer_mapping_;
+    const int         device_id_;
+    cudaStream_t      stream_ = 0;  // initialize as default stream
+    CachingAllocator* cache_;
 
-    bool isExist(std::string address) const
+    bool isExist(void* ptr) const
     {
-        return pointer_mapping_->count(address) > 0;
+        return cache_->contains(ptr);
     }
-    ReallocType isReMalloc(std::string address, size_t size) const
+    ReallocType isReMalloc(void* ptr, size_t size) const
     {
-        FT_CHECK(isExist(address));
-        if (pointer_mapping_->at(address).second < size) {
-            return ReallocType::INCREASE;
-        }
-        else if (pointer_mapping_->at(address).second == size) {
+        FT_CHECK(isExist(ptr));
+        const size_t buffer_size = cache_->getSize(ptr);
+        if (buffer_size == size
+            || (cache_->isCachingEnabled() && CachingAllocator::getSizeClass(size) == cache_->getCapacity(ptr))) {
             return ReallocType::REUSE;
         }
+        else if (buffer_size < size) {
+            return ReallocType::INCREASE;
+        }
         else {
             return ReallocType::DECREASE;
         }
     }
 
+    void release(void** ptr)
+    {
+        if (*ptr != nullptr && !cache_->release(*ptr)) {
+            FT_LOG_WARNING("Allocator does not have information of ptr at %p.", *ptr);
+        }
+        *ptr = nullptr;
+    }
+
+    void reuse(void* ptr, size_t size)
+    {
+        cache_->resize(ptr, size);
+    }
+
+    void* backendMalloc(size_t size)
+    {
+        void* ptr      = nullptr;
+        int   o_device = 0;
+        check_cuda_error(getSetDevice(device_id_, &o_device));
+#if defined(CUDA_MEMORY_POOL_DISABLED)
+        cudaError_t result = cudaMalloc(&ptr, size);
+#else
+        cudaError_t result = cudaMallocAsync(&ptr, size, stream_);
+#endif
+        check_cuda_error(getSetDevice(o_device));
+        if (result != cudaSuccess) {
+            // clear the error so that the caching allocator can release its cache and retry
+            cudaGetLastError();
+            return nullptr;
+        }
+        return ptr;
+    }
+
+    void backendFree(void* ptr)
+    {
+        int o_device = 0;
+        check_cuda_error(getSetDevice(device_id_, &o_device));
+#if defined(CUDA_MEMORY_POOL_DISABLED)
+        check_cuda_error(cudaFree(ptr));
+#else
+        check_cuda_error(cudaFreeAsync(ptr, stream_));
+#endif
+        check_cuda_error(getSetDevice(o_device));
+    }
+
 public:
     Allocator(int device_id): device_id_(device_id)
     {
         FT_LOG_DEBUG(__PRETTY_FUNCTION__);
-        pointer_mapping_ = new std::unordered_map<std::string, std::pair<void*, size_t>>();
+        cache_ = new CachingAllocator([this](size_t size) { return backendMalloc(size); },
+                                      [this](void* ptr) { backendFree(ptr); },
+                                      isAllocatorCachingEnabled());
 #if defined(CUDA_MEMORY_POOL_DISABLED)
         FT_LOG_WARNING(
             "Async cudaMalloc/Free is not supported before CUDA 11.2. Using Sync cudaMalloc/Free."
@@ -181,14 +242,17 @@ public:
     virtual ~Allocator()
     {
         FT_LOG_DEBUG(__PRETTY_FUNCTION__);
-        while (!pointer_mapping_->empty()) {
-            free((void**)(&pointer_mapping_->begin()->second.first));
-        }
-        delete pointer_mapping_;
+        FT_LOG_DEBUG("Allocator of device %d: %s", device_id_, cache_->getStats().toString().c_str());
+        cache_->freeAll();
+        delete cache_;
     }
 
     void setStream(cudaStream_t stream)
     {
+        if (stream != stream_) {
+            // the cached buffers may still be used by work queued on the previous stream
+            cache_->releaseCache();
+        }
         stream_ = stream;
     }
 
@@ -203,47 +267,145 @@ public:
         if (size == 0) {
             return nullptr;
         }
-        void* ptr      = nullptr;
-        int   o_device = 0;
-
-        check_cuda_error(getSetDevice(device_id_, &o_device));
-#if defined(CUDA_MEMORY_POOL_DISABLED)
-        check_cuda_error(cudaMalloc(&ptr, (size_t)(ceil(size / 32.)) * 32));
-#else
-        check_cuda_error(cudaMallocAsync(&ptr, (size_t)(ceil(size / 32.)) * 32, stream_));
-#endif
-        check_cuda_error(getSetDevice(o_device));
+        void* ptr = cache_->malloc((size_t)(ceil(size / 32.)) * 32);
         FT_LOG_DEBUG("malloc buffer %p with size %ld", ptr, size);
-
-        pointer_mapping_->insert({getAddress(ptr), {ptr, size}});
-
         return ptr;
     }
 
     void free(void** ptr) const
     {
         FT_LOG_DEBUG(__PRETTY_FUNCTION__);
-        std::string address = getAddress(*ptr);
         if (*ptr != nullptr) {
-            int o_device = 0;
-            if (pointer_mapping_->count(address)) {
-                FT_LOG_DEBUG("Free buffer %s", address.c_str());
-                check_cuda_error(getSetDevice(device_id_, &o_device));
-#if defined(CUDA_MEMORY_POOL_DISABLED)
-                check_cuda_error(cudaFree(*ptr));
-#else
-                check_cuda_error(cudaFreeAsync(*ptr, stream_));
-#endif
-                check_cuda_error(getSetDevice(o_device));
-                pointer_mapping_->erase(address);
+            if (cache_->free(*ptr)) {
+                FT_LOG_DEBUG("Free buffer %p", *ptr);
             }
             else {
-                FT_LOG_WARNING("pointer_mapping_ does not have information of ptr at %s.", address.c_str());
+                FT_LOG_WARNING("Allocator does not have information of ptr at %p.", *ptr);
             }
         }
         *ptr = nullptr;
         return;
     }
+
+    AllocatorStats getStats() const
+    {
+        return cache_->getStats();
+    }
+
+    void resetPeakStats()
+    {
+        cache_->resetPeakStats();
+    }
+
+    // Returns the cached free buffers to the CUDA memory pool.
+    void releaseCache()
+    {
+        cache_->releaseCache();
+    }
+};
+
+// Host memory allocator with the same caching and statistics as Allocator<AllocatorType::CUDA>.
+template<>
+class Allocator<AllocatorType::CPU>: public IAllocator {
+private:
+    CachingAllocator* cache_;
+
+    bool isExist(void* ptr) const
+    {
+        return cache_->contains(ptr);
+    }
+    ReallocType isReMalloc(void* ptr, size_t size) const
+    {
+        FT_CHECK(isExist(ptr));
+        const size_t buffer_size = cache_->getSize(ptr);
+        if (buffer_size == size
+            || (cache_->isCachingEnabled() && CachingAllocator::getSizeClass(size) == cache_->getCapacity(ptr))) {
+            return ReallocType::REUSE;
+        }
+        else if (buffer_size < size) {
+            return ReallocType::INCREASE;
+        }
+        else {
+            return ReallocType::DECREASE;
+        }
+    }
+
+    void release(void** ptr)
+    {
+        if (*ptr != nullptr && !cache_->release(*ptr)) {
+            FT_LOG_WARNING("Allocator does not have information of ptr at %p.", *ptr);
+        }
+        *ptr = nullptr;
+    }
+
+    void reuse(void* ptr, size_t size)
+    {
+        cache_->resize(ptr, size);
+    }
+
+public:
+    Allocator()
+    {
+        FT_LOG_DEBUG(__PRETTY_FUNCTION__);
+        cache_ = new CachingAllocator([](size_t size) { return std::malloc(size); },
+                                      [](void* ptr) { std::free(ptr); },
+                                      isAllocatorCachingEnabled());
+    }
+
+    virtual ~Allocator()
+    {
+        FT_LOG_DEBUG(__PRETTY_FUNCTION__);
+        cache_->freeAll();
+        delete cache_;
+    }
+
+    void setStream(cudaStream_t stream)
+    {
+        // nothing to do here;
+    }
+
+    cudaStream_t returnStream()
+    {
+        // nothing to do here;
+        return 0;
+    };
+
+    void* malloc(size_t size, const bool is_set_zero = true)
+    {
+        FT_LOG_DEBUG(__PRETTY_FUNCTION__);
+        if (size == 0) {
+            return nullptr;
+        }
+        void* ptr = cache_->malloc((size_t)(ceil(size / 32.)) * 32);
+        if (is_set_zero) {
+            memset(ptr, 0, size);
+        }
+        return ptr;
+    }
+
+    void free(void** ptr) const
+    {
+        FT_LOG_DEBUG(__PRETTY_FUNCTION__);
+        if (*ptr != nullptr && !cache_->free(*ptr)) {
+            FT_LOG_WARNING("Allocator does not have information of ptr at %p.", *ptr);
+        }
+        *ptr = nullptr;
+    }
+
+    AllocatorStats getStats() const
+    {
+        return cache_->getStats();
+    }
+
+    void resetPeakStats()
+    {
+        cache_->resetPeakStats();
+    }
+
+    void releaseCache()
+    {
+        cache_->releaseCache();
+    }
 };
 
 #ifdef GOOGLE_CUDA
@@ -251,19 +413,19 @@ using namespace tensorflow;
 template<>
 class Allocator<AllocatorType::TF>: public IAllocator {
     OpKernelContext*                                     context_;
-    std::unordered_map<std::string, tensorflow::Tensor>* pointer_mapping_;
+    std::unordered_map<void*, tensorflow::Tensor>* pointer_mapping_;
     cudaStream_t                                         stream_;
 
-    bool isExist(std::string address) const
+    bool isExist(void* ptr) const
     {
-        return pointer_mapping_->count(address) > 0;
+        return pointer_mapping_->count(ptr) > 0;
     }
-    ReallocType isReMalloc(std::string address, size_t size) const
+    ReallocType isReMalloc(void* ptr, size_t size) const
     {
-        FT_CHECK(isExist(address));
+        FT_CHECK(isExist(ptr));
         size_t current_buffer_size = 1;
-        for (int i = 0; i < pointer_mapping_->at(address).dims(); i++) {
-            current_buffer_size *= pointer_mapping_->at(address).dim_size(i);
+        for (int i = 0; i < pointer_mapping_->at(ptr).dims(); i++) {
+            current_buffer_size *= pointer_mapping_->at(ptr).dim_size(i);
         }
         FT_LOG_DEBUG("current_buffer_size: %d, new buffer: %d", current_buffer_size, size);
         if (current_buffer_size < size) {
@@ -280,7 +442,7 @@ class Allocator<AllocatorType::TF>: public IAllocator {
 public:
     Allocator(OpKernelContext* context, cudaStream_t stream): context_(context), stream_(stream)
     {
-        pointer_mapping_ = new std::unordered_map<std::string, tensorflow::Tensor>();
+        pointer_mapping_ = new std::unordered_map<void*, tensorflow::Tensor>();
     }
 
     void setStream(cudaStream_t stream)
@@ -309,7 +471,7 @@ public:
         if (is_set_zero == true) {
             cudaMemsetAsync(ptr, 0, buf_size, stream_);
         }
-        pointer_mapping_->insert({getAddress(ptr), buf});
+        pointer_mapping_->insert({ptr, buf});
 
         return ptr;
     }
@@ -317,8 +479,7 @@ public:
     void free(void** ptr) const
     {
         FT_LOG_DEBUG(__PRETTY_FUNCTION__);
-        std::string address = getAddress(*ptr);
-        pointer_mapping_->erase(address);
+        pointer_mapping_->erase(*ptr);
         *ptr = nullptr;
         return;
     }
@@ -338,21 +499,21 @@ public:
 #ifdef TORCH_CUDA
 template<>
 class Allocator<AllocatorType::TH>: public IAllocator {
-    std::unordered_map<std::string, torch::Tensor>* pointer_mapping_;
+    std::unordered_map<void*, torch::Tensor>* pointer_mapping_;
 
-    bool isExist(std::string address) const
+    bool isExist(void* ptr) const
     {
-        return pointer_mapping_->count(address) > 0;
+        return pointer_mapping_->count(ptr) > 0;
     }
-    ReallocType isReMalloc(std::string address, size_t size) const
+    ReallocType isReMalloc(void* ptr, size_t size) const
     {
-        FT_CHECK(isExist(address));
+        FT_CHECK(isExist(ptr));
         size_t current_buffer_size = 1;
-        for (int i = 0; i < pointer_mapping_->at(address).dim(); i++) {
-            current_buffer_size *= pointer_mapping_->at(address).size(i);
+        for (int i = 0; i < pointer_mapping_->at(ptr).dim(); i++) {
+            current_buffer_size *= pointer_mapping_->at(ptr).size(i);
         }
         FT_LOG_DEBUG(
-            "current_buffer_size: %d, original buffer: %p, new buffer: %d", current_buffer_size, address, size);
+            "current_buffer_size: %d, original buffer: %p, new buffer: %d", current_buffer_size, ptr, size);
         if (current_buffer_size < size) {
             return ReallocType::INCREASE;
         }
@@ -367,7 +528,7 @@ class Allocator<AllocatorType::TH>: public IAllocator {
 public:
     Allocator()
     {
-        pointer_mapping_ = new std::unordered_map<std::string, torch::Tensor>();
+        pointer_mapping_ = new std::unordered_map<void*, torch::Tensor>();
     }
 
     void setStream(cudaStream_t stream)
@@ -392,15 +553,14 @@ public:
         torch::Tensor buf = torch::empty({buf_size}, torch::dtype(torch::kUInt8).device(torch::kCUDA));
         void*         ptr = buf.data_ptr();
         FT_LOG_DEBUG("malloc buffer %p with size %ld", ptr, buf_size);
-        pointer_mapping_->insert({getAddress(ptr), buf});
+        pointer_mapping_->insert({ptr, buf});
         return ptr;
     }
 
     void free(void** ptr) const
     {
         FT_LOG_DEBUG(__PRETTY_FUNCTION__);
-        std::string address = getAddress(*ptr);
-        pointer_mapping_->erase(address);
+        pointer_mapping_->erase(*ptr);
         *ptr = nullptr;
         return;
     }
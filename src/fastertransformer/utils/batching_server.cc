@@ -0,0 +1,519 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/fastertransformer/utils/batching_server.h"
+#include "src/fastertransformer/utils/cuda_utils.h"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace fastertransformer {
+
+namespace {
+
+const size_t kServerFrameHeaderSize = 4;
+// Bound on the tokens of a response frame, against garbage on the stream.
+const size_t kMaxResponseTokens = 1 << 24;
+
+bool sendAll(int fd, const void* data, size_t size)
+{
+    const char* ptr = (const char*)data;
+    while (size > 0) {
+        const ssize_t sent = ::send(fd, ptr, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        ptr += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+bool recvAll(int fd, void* data, size_t size)
+{
+    char* ptr = (char*)data;
+    while (size > 0) {
+        const ssize_t received = ::recv(fd, ptr, size, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return false;
+        }
+        ptr += received;
+        size -= received;
+    }
+    return true;
+}
+
+// The frames are sent with a single call, so frames written from several threads under a lock never interleave.
+bool sendFrame(int fd, const uint32_t (&header)[kServerFrameHeaderSize], const std::vector<int>& payload)
+{
+    std::vector<uint32_t> frame(header, header + kServerFrameHeaderSize);
+    frame.insert(frame.end(), payload.begin(), payload.end());
+    return sendAll(fd, frame.data(), frame.size() * sizeof(uint32_t));
+}
+
+void parseAddress(const std::string& address, std::string* unix_path, int* tcp_port)
+{
+    if (address.compare(0, 5, "unix:") == 0) {
+        *unix_path = address.substr(5);
+        FT_CHECK_WITH_INFO(!unix_path->empty() && unix_path->size() < sizeof(sockaddr_un::sun_path),
+                           fmtstr("Invalid socket path in '%s'.", address.c_str()));
+        *tcp_port = -1;
+        return;
+    }
+    if (address.compare(0, 4, "tcp:") == 0) {
+        char*      end  = nullptr;
+        const long port = strtol(address.c_str() + 4, &end, 10);
+        FT_CHECK_WITH_INFO(address.size() > 4 && *end == '\0' && port > 0 && port < 65536,
+                           fmtstr("Invalid port in '%s'.", address.c_str()));
+        unix_path->clear();
+        *tcp_port = (int)port;
+        return;
+    }
+    FT_CHECK_WITH_INFO(false, fmtstr("Server address '%s' is neither unix:<path> nor tcp:<port>.", address.c_str()));
+}
+
+int openSocket(const std::string& address, bool listening)
+{
+    std::string unix_path;
+    int         tcp_port = -1;
+    parseAddress(address, &unix_path, &tcp_port);
+
+    sockaddr_un unix_addr = {};
+    sockaddr_in tcp_addr  = {};
+    sockaddr*   addr;
+    socklen_t   addr_len;
+    if (tcp_port < 0) {
+        unix_addr.sun_family = AF_UNIX;
+        strncpy(unix_addr.sun_path, unix_path.c_str(), sizeof(unix_addr.sun_path) - 1);
+        addr     = (sockaddr*)&unix_addr;
+        addr_len = sizeof(unix_addr);
+    }
+    else {
+        tcp_addr.sin_family      = AF_INET;
+        tcp_addr.sin_port        = htons((uint16_t)tcp_port);
+        tcp_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr                     = (sockaddr*)&tcp_addr;
+        addr_len                 = sizeof(tcp_addr);
+    }
+
+    const int fd = ::socket(addr->sa_family, SOCK_STREAM, 0);
+    FT_CHECK_WITH_INFO(fd >= 0, fmtstr("Cannot create a socket for '%s': %s", address.c_str(), strerror(errno)));
+    bool ok;
+    if (listening) {
+        if (tcp_port < 0) {
+            // a socket file left by a previous server
+            ::unlink(unix_path.c_str());
+        }
+        else {
+            const int reuse = 1;
+            ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        }
+        ok = ::bind(fd, addr, addr_len) == 0 && ::listen(fd, SOMAXCONN) == 0;
+    }
+    else {
+        ok = ::connect(fd, addr, addr_len) == 0;
+    }
+    if (!ok) {
+        const int error = errno;
+        ::close(fd);
+        FT_CHECK_WITH_INFO(false,
+                           fmtstr("Cannot %s '%s': %s",
+                                  listening ? "listen on" : "connect to",
+                                  address.c_str(),
+                                  strerror(error)));
+    }
+    return fd;
+}
+
+}  // namespace
+
+bool writeServerRequest(int fd, const ServerRequest& request)
+{
+    const uint32_t header[kServerFrameHeaderSize] = {
+        kServerRequestMagic, request.request_id, request.max_new_tokens, (uint32_t)request.input_ids.size()};
+    return sendFrame(fd, header, request.input_ids);
+}
+
+bool readServerRequest(int fd, ServerRequest* request, size_t max_input_ids)
+{
+    uint32_t header[kServerFrameHeaderSize];
+    if (!recvAll(fd, header, sizeof(header)) || header[0] != kServerRequestMagic || header[3] > max_input_ids) {
+        return false;
+    }
+    request->request_id     = header[1];
+    request->max_new_tokens = header[2];
+    request->input_ids.resize(header[3]);
+    return recvAll(fd, request->input_ids.data(), header[3] * sizeof(int));
+}
+
+bool writeServerResponse(int fd, const ServerResponse& response)
+{
+    const uint32_t header[kServerFrameHeaderSize] = {
+        kServerResponseMagic, response.request_id, response.flags, (uint32_t)response.tokens.size()};
+    return sendFrame(fd, header, response.tokens);
+}
+
+bool readServerResponse(int fd, ServerResponse* response)
+{
+    uint32_t header[kServerFrameHeaderSize];
+    if (!recvAll(fd, header, sizeof(header)) || header[0] != kServerResponseMagic || header[3] > kMaxResponseTokens) {
+        return false;
+    }
+    response->request_id = header[1];
+    response->flags      = header[2];
+    response->tokens.resize(header[3]);
+    return recvAll(fd, response->tokens.data(), header[3] * sizeof(int));
+}
+
+int listenServerSocket(const std::string& address)
+{
+    return openSocket(address, true);
+}
+
+int connectServerSocket(const std::string& address)
+{
+    return openSocket(address, false);
+}
+
+ServerRequestQueue::ServerRequestQueue(size_t max_batch_size, int max_wait_ms):
+    max_batch_size_(max_batch_size), max_wait_(max_wait_ms)
+{
+    FT_CHECK_WITH_INFO(max_batch_size_ > 0, "max_batch_size must be positive.");
+    FT_CHECK_WITH_INFO(max_wait_ms >= 0, "max_wait_ms must not be negative.");
+}
+
+bool ServerRequestQueue::push(QueuedServerRequest& request)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (closed_) {
+            return false;
+        }
+        request.enqueue_time = std::chrono::steady_clock::now();
+        queue_.push_back(std::move(request));
+    }
+    cond_.notify_one();
+    return true;
+}
+
+std::vector<QueuedServerRequest> ServerRequestQueue::popBatch()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!closed_ && queue_.size() < max_batch_size_) {
+        if (queue_.empty()) {
+            cond_.wait(lock);
+            continue;
+        }
+        // the oldest request bounds the wait of the whole batch
+        const std::chrono::steady_clock::time_point deadline = queue_.front().enqueue_time + max_wait_;
+        if (std::chrono::steady_clock::now() >= deadline) {
+            break;
+        }
+        cond_.wait_until(lock, deadline);
+    }
+
+    const size_t                     batch_size = std::min(queue_.size(), max_batch_size_);
+    std::vector<QueuedServerRequest> batch;
+    batch.reserve(batch_size);
+    for (size_t i = 0; i < batch_size; i++) {
+        batch.push_back(std::move(queue_.front()));
+        queue_.pop_front();
+    }
+    return batch;
+}
+
+void ServerRequestQueue::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+    }
+    cond_.notify_all();
+}
+
+size_t ServerRequestQueue::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queue_.size();
+}
+
+struct BatchingServer::Connection {
+    explicit Connection(int fd): fd(fd) {}
+    ~Connection()
+    {
+        ::close(fd);
+    }
+
+    // Failures are ignored: the client is gone and its remaining responses are dropped.
+    void send(const ServerResponse& response)
+    {
+        std::lock_guard<std::mutex> lock(write_mutex);
+        writeServerResponse(fd, response);
+    }
+
+    const int  fd;
+    std::mutex write_mutex;
+};
+
+BatchingServer::BatchingServer(const BatchingServerConfig& config, BatchGenerator* generator):
+    config_(config), generator_(generator), queue_(config.max_batch_size, config.max_wait_ms)
+{
+    FT_CHECK(generator_ != nullptr);
+    FT_CHECK_WITH_INFO(config_.default_max_new_tokens > 0, "default_max_new_tokens must be positive.");
+}
+
+BatchingServer::~BatchingServer()
+{
+    stop();
+    if (accept_thread_.joinable()) {
+        accept_thread_.join();
+    }
+    {
+        std::unique_lock<std::mutex> lock(clients_mutex_);
+        clients_cond_.wait(lock, [this] { return num_clients_ == 0; });
+    }
+    if (listen_fd_ >= 0) {
+        ::close(listen_fd_);
+    }
+    if (!unix_path_.empty()) {
+        ::unlink(unix_path_.c_str());
+    }
+}
+
+void BatchingServer::listen(const std::string& address)
+{
+    FT_CHECK_WITH_INFO(listen_fd_ < 0, "The server already listens.");
+    listen_fd_ = listenServerSocket(address);
+    if (address.compare(0, 5, "unix:") == 0) {
+        unix_path_ = address.substr(5);
+    }
+    accept_thread_ = std::thread(&BatchingServer::acceptClients, this);
+    FT_LOG_INFO("Batching server listening on %s (max_batch_size %lu, max_wait_ms %d)",
+                address.c_str(),
+                config_.max_batch_size,
+                config_.max_wait_ms);
+}
+
+void BatchingServer::acceptClients()
+{
+    while (true) {
+        const int fd = ::accept(listen_fd_, nullptr, nullptr);
+        if (fd < 0 && errno == EINTR) {
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(clients_mutex_);
+        if (fd < 0 || stopped_) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            else if (!stopped_) {
+                FT_LOG_ERROR("Batching server stops accepting clients: %s", strerror(errno));
+            }
+            return;
+        }
+        std::shared_ptr<Connection> connection = std::make_shared<Connection>(fd);
+        for (size_t i = 0; i < connections_.size(); i++) {
+            if (connections_[i].expired()) {
+                connections_[i] = connections_.back();
+                connections_.pop_back();
+                i--;
+            }
+        }
+        connections_.push_back(connection);
+        num_clients_++;
+        std::thread(&BatchingServer::serveClient, this, std::move(connection)).detach();
+    }
+}
+
+void BatchingServer::serveClient(std::shared_ptr<Connection> connection)
+{
+    const size_t  max_input_ids = config_.max_seq_len > 0 ? config_.max_seq_len : kMaxResponseTokens;
+    ServerRequest request;
+    // Stops at the end of the stream or at a malformed frame. The responses of the requests already read still go
+    // out, the queued callbacks keeping the connection open.
+    while (readServerRequest(connection->fd, &request, max_input_ids)) {
+        submit(std::move(request), [connection](const ServerResponse& response) { connection->send(response); });
+        request = ServerRequest();
+    }
+    ::shutdown(connection->fd, SHUT_RD);
+    connection.reset();
+
+    std::lock_guard<std::mutex> lock(clients_mutex_);
+    num_clients_--;
+    clients_cond_.notify_all();
+}
+
+void BatchingServer::submit(ServerRequest request, ServerResponseCallback respond)
+{
+    if (request.max_new_tokens == 0) {
+        request.max_new_tokens = config_.default_max_new_tokens;
+    }
+    std::string error;
+    if (request.input_ids.empty()) {
+        error = "empty input";
+    }
+    else if (config_.max_new_tokens > 0 && request.max_new_tokens > config_.max_new_tokens) {
+        error = fmtstr("max_new_tokens %u exceeds %lu", request.max_new_tokens, config_.max_new_tokens);
+    }
+    else if (config_.max_seq_len > 0 && request.input_ids.size() + request.max_new_tokens > config_.max_seq_len) {
+        error = fmtstr("%lu input and %u new tokens exceed max_seq_len %lu",
+                       request.input_ids.size(),
+                       request.max_new_tokens,
+                       config_.max_seq_len);
+    }
+
+    const uint32_t      request_id = request.request_id;
+    QueuedServerRequest queued     = {std::move(request), std::move(respond), {}};
+    if (error.empty() && !queue_.push(queued)) {
+        error = "the server is stopping";
+    }
+    if (!error.empty()) {
+        FT_LOG_WARNING("Batching server rejects request %u: %s", request_id, error.c_str());
+        queued.respond(ServerResponse{request_id, SERVER_RESPONSE_FINISHED | SERVER_RESPONSE_ERROR, {}});
+    }
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    (error.empty() ? stats_.num_requests : stats_.num_rejected)++;
+}
+
+namespace {
+
+// Turns the tokens of a batch into responses, dropping what comes after the end of a request.
+class BatchResponseStream: public TokenStream {
+public:
+    explicit BatchResponseStream(std::vector<QueuedServerRequest>& batch): batch_(batch), finished_(batch.size()) {}
+
+    void push(size_t index, const int* tokens, size_t num_tokens) override
+    {
+        if (index >= batch_.size() || finished_[index] || num_tokens == 0) {
+            return;
+        }
+        batch_[index].respond(ServerResponse{batch_[index].request.request_id, 0, {tokens, tokens + num_tokens}});
+        num_generated_ += num_tokens;
+    }
+
+    void finish(size_t index) override
+    {
+        finish(index, SERVER_RESPONSE_FINISHED);
+    }
+
+    // Finishes the requests still running, returns how many.
+    size_t finishAll(uint32_t flags)
+    {
+        size_t num_finished = 0;
+        for (size_t i = 0; i < batch_.size(); i++) {
+            num_finished += finish(i, flags);
+        }
+        return num_finished;
+    }
+
+    size_t getNumGenerated() const
+    {
+        return num_generated_;
+    }
+
+private:
+    bool finish(size_t index, uint32_t flags)
+    {
+        if (index >= batch_.size() || finished_[index]) {
+            return false;
+        }
+        finished_[index] = true;
+        batch_[index].respond(ServerResponse{batch_[index].request.request_id, flags, {}});
+        return true;
+    }
+
+    std::vector<QueuedServerRequest>& batch_;
+    std::vector<bool>                 finished_;
+    size_t                            num_generated_ = 0;
+};
+
+}  // namespace
+
+void BatchingServer::generateBatch(std::vector<QueuedServerRequest>& batch)
+{
+    std::vector<const ServerRequest*> requests;
+    for (const QueuedServerRequest& queued : batch) {
+        requests.push_back(&queued.request);
+    }
+    FT_LOG_DEBUG("Batching server generates a batch of %lu requests", requests.size());
+
+    BatchResponseStream stream(batch);
+    size_t              num_failed = 0;
+    try {
+        generator_->generate(requests, &stream);
+        stream.finishAll(SERVER_RESPONSE_FINISHED);
+    }
+    catch (const std::exception& e) {
+        FT_LOG_ERROR("Batching server failed to generate a batch of %lu requests: %s", requests.size(), e.what());
+        num_failed = stream.finishAll(SERVER_RESPONSE_FINISHED | SERVER_RESPONSE_ERROR);
+    }
+
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.num_batches++;
+    stats_.num_batched += batch.size();
+    stats_.num_generated += stream.getNumGenerated();
+    stats_.num_failed += num_failed;
+}
+
+void BatchingServer::run()
+{
+    while (true) {
+        std::vector<QueuedServerRequest> batch = queue_.popBatch();
+        if (batch.empty()) {
+            // closed and drained
+            return;
+        }
+        generateBatch(batch);
+    }
+}
+
+void BatchingServer::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(clients_mutex_);
+        stopped_ = true;
+        if (listen_fd_ >= 0) {
+            // wakes up accept()
+            ::shutdown(listen_fd_, SHUT_RDWR);
+        }
+        for (const std::weak_ptr<Connection>& weak_connection : connections_) {
+            std::shared_ptr<Connection> connection = weak_connection.lock();
+            if (connection != nullptr) {
+                ::shutdown(connection->fd, SHUT_RD);
+            }
+        }
+    }
+    queue_.close();
+}
+
+BatchingServerStats BatchingServer::getStats() const
+{
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    return stats_;
+}
+
+}  // namespace fastertransformer
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * Batching inference server
+ *
+ * A long-running server generating tokens for several clients at once. Clients connect over a Unix domain socket
+ * ("unix:<path>") or a local TCP port ("tcp:<port>", bound to 127.0.0.1) and send requests; the server queues them,
+ * forms batches and hands each batch to a BatchGenerator (the model), which streams the tokens back as the steps
+ * complete.
+ *
+ * Batch formation: a batch is formed as soon as the queue holds max_batch_size requests, or when its oldest request
+ * has waited max_wait_ms, whichever comes first. A batch is generated to completion before the next one is formed.
+ *
+ * Wire protocol, made of 32-bit integers in host byte order (the server is local):
+ *   request  (client -> server): kServerRequestMagic, request_id, max_new_tokens, num_input_ids, input_ids...
+ *   response (server -> client): kServerResponseMagic, request_id, flags, num_tokens, tokens...
+ * A client may send several requests on one connection; request ids are chosen by the client and tag the responses
+ * on its connection. max_new_tokens = 0 asks for the default of the server. The server sends a response with the new
+ * tokens of a request after each step, then a last one flagged SERVER_RESPONSE_FINISHED, possibly without tokens. A
+ * rejected request only gets a response flagged SERVER_RESPONSE_FINISHED | SERVER_RESPONSE_ERROR. A malformed frame
+ * closes the connection.
+ *
+ * The batching logic does not depend on the transport: submit() takes in-process requests, as the sockets do.
+ **/
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fastertransformer {
+
+const uint32_t kServerRequestMagic  = 0x51525446;  // "FTRQ"
+const uint32_t kServerResponseMagic = 0x53525446;  // "FTRS"
+
+enum ServerResponseFlags : uint32_t {
+    SERVER_RESPONSE_FINISHED = 1,
+    SERVER_RESPONSE_ERROR    = 2
+};
+
+struct ServerRequest {
+    uint32_t         request_id     = 0;
+    uint32_t         max_new_tokens = 0;
+    std::vector<int> input_ids;
+};
+
+struct ServerResponse {
+    uint32_t         request_id = 0;
+    uint32_t         flags      = 0;
+    std::vector<int> tokens;
+};
+
+// Frames over a socket. The readers return false at the end of the stream or on a malformed frame, request frames
+// with more than max_input_ids ids being malformed.
+bool writeServerRequest(int fd, const ServerRequest& request);
+bool readServerRequest(int fd, ServerRequest* request, size_t max_input_ids);
+bool writeServerResponse(int fd, const ServerResponse& response);
+bool readServerResponse(int fd, ServerResponse* response);
+
+// Sockets of an address "unix:<path>" or "tcp:<port>". Throw on failure.
+int listenServerSocket(const std::string& address);
+int connectServerSocket(const std::string& address);
+
+// Receives the tokens of a batch as they are generated.
+class TokenStream {
+public:
+    virtual ~TokenStream() = default;
+    // New tokens of the request `index` of the batch.
+    virtual void push(size_t index, const int* tokens, size_t num_tokens) = 0;
+    // The request `index` generated its last token. Later tokens of the request are dropped.
+    virtual void finish(size_t index) = 0;
+};
+
+// The model behind the server, called from the thread running BatchingServer::run().
+class BatchGenerator {
+public:
+    virtual ~BatchGenerator() = default;
+    // Generates at most max_new_tokens tokens for each request of the batch, streaming them as the steps complete.
+    // max_new_tokens is resolved by the server. The requests not finished on return are finished by the server.
+    virtual void generate(const std::vector<const ServerRequest*>& batch, TokenStream* stream) = 0;
+};
+
+using ServerResponseCallback = std::function<void(const ServerResponse&)>;
+
+struct QueuedServerRequest {
+    ServerRequest                         request;
+    ServerResponseCallback                respond;
+    std::chrono::steady_clock::time_point enqueue_time;
+};
+
+// The queue of the server and its batch formation. push() may be called from any thread, popBatch() from one.
+class ServerRequestQueue {
+public:
+    ServerRequestQueue(size_t max_batch_size, int max_wait_ms);
+
+    // Returns false, leaving the request, if the queue is closed.
+    bool push(QueuedServerRequest& request);
+    // Blocks until a batch is formed and returns it, in arrival order. Once the queue is closed, returns the remaining
+    // requests without waiting, then empty batches.
+    std::vector<QueuedServerRequest> popBatch();
+    void                             close();
+
+    size_t size() const;
+
+private:
+    const size_t                    max_batch_size_;
+    const std::chrono::milliseconds max_wait_;
+    mutable std::mutex              mutex_;
+    std::condition_variable         cond_;
+    std::deque<QueuedServerRequest> queue_;
+    bool                            closed_ = false;
+};
+
+struct BatchingServerConfig {
+    size_t max_batch_size         = 8;
+    int    max_wait_ms            = 10;
+    size_t default_max_new_tokens = 64;
+    size_t max_new_tokens         = 0;  // upper bound of a request, 0 means no bound
+    size_t max_seq_len            = 0;  // upper bound of input + new tokens of a request, 0 means no bound
+};
+
+struct BatchingServerStats {
+    size_t num_requests  = 0;  // accepted requests
+    size_t num_rejected  = 0;
+    size_t num_batches   = 0;
+    size_t num_batched   = 0;  // requests of the generated batches
+    size_t num_generated = 0;  // streamed tokens
+    size_t num_failed    = 0;  // requests of the batches whose generation threw
+
+    double meanBatchSize() const
+    {
+        return num_batches == 0 ? 0.0 : (double)num_batched / num_batches;
+    }
+};
+
+class BatchingServer {
+public:
+    BatchingServer(const BatchingServerConfig& config, BatchGenerator* generator);
+    ~BatchingServer();
+
+    // Accepts clients on `address` in the background, until stop().
+    void listen(const std::string& address);
+    // Queues a request; respond is called with its responses, from the thread running run(). A rejected request is
+    // answered right away.
+    void submit(ServerRequest request, ServerResponseCallback respond);
+    // Forms and generates batches on the calling thread until stop(), then generates the requests still queued.
+    void run();
+    // Stops accepting clients and requests, and lets run() return. May be called from any thread.
+    void stop();
+
+    BatchingServerStats getStats() const;
+
+private:
+    struct Connection;
+
+    void acceptClients();
+    void serveClient(std::shared_ptr<Connection> connection);
+    void generateBatch(std::vector<QueuedServerRequest>& batch);
+
+    const BatchingServerConfig config_;
+    BatchGenerator*            generator_;
+    ServerRequestQueue         queue_;
+
+    int                                    listen_fd_ = -1;
+    std::string                            unix_path_;
+    std::thread                            accept_thread_;
+    std::mutex                             clients_mutex_;
+    std::condition_variable                clients_cond_;
+    size_t                                 num_clients_ = 0;  // running serveClient() threads
+    std::vector<std::weak_ptr<Connection>> connections_;
+    bool                                   stopped_ = false;
+
+    mutable std::mutex  stats_mutex_;
+    BatchingServerStats stats_;
+};
+
+}  // namespace fastertransformer
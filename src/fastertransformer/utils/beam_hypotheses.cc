@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/fastertransformer/utils/beam_hypotheses.h"
+#include "src/fastertransformer/utils/cuda_utils.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace fastertransformer {
+
+BeamEarlyStopping getBeamEarlyStopping(int early_stopping)
+{
+    FT_CHECK_WITH_INFO(early_stopping >= 0 && early_stopping <= 2,
+                       fmtstr("early_stopping must be 0 (heuristic), 1 (true) or 2 (never), got %d.", early_stopping));
+    return static_cast<BeamEarlyStopping>(early_stopping);
+}
+
+float getBeamScore(float cum_log_prob, int length, float length_penalty)
+{
+    return cum_log_prob / powf((float)length, length_penalty);
+}
+
+BeamHypotheses::BeamHypotheses(int beam_width, float length_penalty, BeamEarlyStopping early_stopping):
+    beam_width_(beam_width), length_penalty_(length_penalty), early_stopping_(early_stopping)
+{
+    FT_CHECK_WITH_INFO(beam_width_ > 0, "The beam width must be positive.");
+}
+
+void BeamHypotheses::add(float cum_log_prob, int length, int step, int token, int parent_beam)
+{
+    const BeamHypothesis hypothesis{
+        getBeamScore(cum_log_prob, length, length_penalty_), cum_log_prob, length, step, token, parent_beam};
+    if ((int)hypotheses_.size() < beam_width_) {
+        hypotheses_.push_back(hypothesis);
+        return;
+    }
+    // replaces the first worst hypothesis
+    auto worst = std::min_element(hypotheses_.begin(),
+                                  hypotheses_.end(),
+                                  [](const BeamHypothesis& a, const BeamHypothesis& b) { return a.score < b.score; });
+    if (hypothesis.score > worst->score) {
+        *worst = hypothesis;
+    }
+}
+
+float BeamHypotheses::getWorstScore() const
+{
+    float worst = INFINITY;
+    for (const BeamHypothesis& hypothesis : hypotheses_) {
+        worst = std::min(worst, hypothesis.score);
+    }
+    return worst;
+}
+
+bool BeamHypotheses::isDone(float best_cum_log_prob, int cur_length, int max_length) const
+{
+    if ((int)hypotheses_.size() < beam_width_) {
+        return false;
+    }
+    if (early_stopping_ == BeamEarlyStopping::ALWAYS) {
+        return true;
+    }
+    // with a positive length penalty, a longer sequence scores better for the same cum_log_prob
+    const int length = early_stopping_ == BeamEarlyStopping::NEVER && length_penalty_ > 0.0f ? max_length : cur_length;
+    return getWorstScore() >= getBeamScore(best_cum_log_prob, length, length_penalty_);
+}
+
+bool BeamHypotheses::process(const int*   candidate_beams,
+                             const int*   candidate_tokens,
+                             const float* candidate_cum_log_probs,
+                             size_t       num_candidates,
+                             const int*   lengths,
+                             int          end_id,
+                             int          step,
+                             int          max_step,
+                             int*         beams,
+                             int*         tokens,
+                             float*       cum_log_probs)
+{
+    FT_CHECK_WITH_INFO(!is_done_, "The request is done.");
+    FT_CHECK(num_candidates >= 2 * (size_t)beam_width_);
+    int num_beams = 0;
+    for (size_t rank = 0; rank < num_candidates && num_beams < beam_width_; rank++) {
+        const int beam = candidate_beams[rank];
+        if (candidate_tokens[rank] == end_id) {
+            if ((int)rank < beam_width_) {
+                add(candidate_cum_log_probs[rank], lengths[beam] + 1, step, end_id, beam);
+            }
+            continue;
+        }
+        beams[num_beams]         = beam;
+        tokens[num_beams]        = candidate_tokens[rank];
+        cum_log_probs[num_beams] = candidate_cum_log_probs[rank];
+        num_beams++;
+    }
+    // a beam proposes the end token once, so at most beam_width of the candidates end
+    FT_CHECK(num_beams == beam_width_);
+
+    const int cur_length = lengths[candidate_beams[0]] + 1;
+    if (isDone(candidate_cum_log_probs[0], cur_length, cur_length + max_step - step)) {
+        is_done_ = true;
+    }
+    else if (step >= max_step) {
+        for (int i = 0; i < beam_width_; i++) {
+            add(cum_log_probs[i], lengths[beams[i]] + 1, step, tokens[i], beams[i]);
+        }
+        is_done_ = true;
+    }
+    return is_done_;
+}
+
+std::vector<BeamHypothesis> BeamHypotheses::getSorted() const
+{
+    std::vector<BeamHypothesis> sorted = hypotheses_;
+    std::stable_sort(sorted.begin(), sorted.end(), [](const BeamHypothesis& a, const BeamHypothesis& b) {
+        return a.score > b.score;
+    });
+    return sorted;
+}
+
+void backtrackBeam(int*       tokens,
+                   const int* output_ids,
+                   const int* parent_ids,
+                   size_t     num_rows,
+                   size_t     row_offset,
+                   int        first_step,
+                   int        step,
+                   int        token,
+                   int        parent_beam)
+{
+    tokens[step] = token;
+    int beam     = parent_beam;
+    for (int u = step - 1; u >= first_step; u--) {
+        const size_t row = u * num_rows + row_offset + beam;
+        tokens[u]        = output_ids[row];
+        beam             = parent_ids[row];
+    }
+}
+
+LiveRowIndex getLiveRowIndex(const bool* is_done, size_t batch_size, size_t beam_width)
+{
+    LiveRowIndex index;
+    index.batch_to_compact.assign(batch_size * beam_width, -1);
+    for (size_t i = 0; i < batch_size; i++) {
+        if (is_done[i]) {
+            continue;
+        }
+        for (size_t j = 0; j < beam_width; j++) {
+            index.batch_to_compact[i * beam_width + j] = index.compact_to_batch.size();
+            index.compact_to_batch.push_back(i * beam_width + j);
+        }
+    }
+    return index;
+}
+
+void getCompactRowMoves(std::vector<int>*   dst_rows,
+                        std::vector<int>*   src_rows,
+                        const LiveRowIndex& prev,
+                        const LiveRowIndex& next)
+{
+    dst_rows->clear();
+    src_rows->clear();
+    for (size_t i = 0; i < next.size(); i++) {
+        const int src = prev.batch_to_compact[next.compact_to_batch[i]];
+        FT_CHECK_WITH_INFO(src >= 0, "A row done in the previous index cannot be live again.");
+        if (src != (int)i) {
+            dst_rows->push_back(i);
+            src_rows->push_back(src);
+        }
+    }
+}
+
+}  // namespace fastertransformer
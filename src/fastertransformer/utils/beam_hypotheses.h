@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * Finished hypotheses of beam search with early stopping (as in HuggingFace transformers)
+ *
+ * Without early stopping, a beam that generates the end token keeps its slot until the end and only proposes the end
+ * token again, so a request runs until its beams all finish or it reaches its length limit. With early stopping, each
+ * step ranks the 2 * beam_width best candidates of a request:
+ *   - a candidate ending with the end token among the first beam_width is a hypothesis, kept in a buffer of the
+ *     beam_width best (by cum_log_prob / length^length_penalty); end candidates of lower rank are dropped,
+ *   - the other candidates fill the beam_width slots, in order, so the slots only hold running beams.
+ * The request is done when no running beam can improve the buffer any more:
+ *   - ALWAYS (early_stopping=True):  as soon as the buffer holds beam_width hypotheses,
+ *   - HEURISTIC (early_stopping=False): when the best candidate of the step, at its current length, scores no better
+ *     than the worst hypothesis,
+ *   - NEVER (early_stopping="never"): when the best candidate cannot beat the worst hypothesis at any length up to the
+ *     limit. Only differs from HEURISTIC with a positive length penalty, which favours longer sequences.
+ * A request reaching its length limit adds its running beams to the buffer. The final beams are the hypotheses, best
+ * first.
+ *
+ * BeamHypotheses is the host reference of one request. invokeUpdateBeamHypotheses runs the same steps on the GPU, from
+ * the candidates of either beam search layer.
+ **/
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace fastertransformer {
+
+enum class BeamEarlyStopping {
+    HEURISTIC,
+    ALWAYS,
+    NEVER
+};
+
+// From the early_stopping input: 0 for HEURISTIC (early_stopping=False), 1 for ALWAYS (True), 2 for NEVER.
+BeamEarlyStopping getBeamEarlyStopping(int early_stopping);
+
+// Length-normalized score of a sequence, score = cum_log_prob / length^length_penalty.
+float getBeamScore(float cum_log_prob, int length, float length_penalty);
+
+struct BeamHypothesis {
+    float score;
+    float cum_log_prob;
+    int   length;       // sequence length, the last token included
+    int   step;         // step of the last token
+    int   token;        // last token, the end token unless a running beam added at the last step
+    int   parent_beam;  // beam continued by the last token, at step - 1
+};
+
+class BeamHypotheses {
+public:
+    BeamHypotheses(int beam_width, float length_penalty, BeamEarlyStopping early_stopping);
+
+    // Adds a hypothesis, kept while it is among the beam_width best.
+    void add(float cum_log_prob, int length, int step, int token, int parent_beam);
+
+    // Whether the running beams cannot improve the hypotheses any more, best_cum_log_prob being the best candidate of
+    // the step and cur_length its length. max_length bounds the length of the sequences for NEVER.
+    bool isDone(float best_cum_log_prob, int cur_length, int max_length) const;
+
+    // One step: candidates (beam, token, cum_log_prob) sorted by decreasing rank, at least 2 * beam_width of them. The
+    // end candidates are added to the hypotheses, the others fill the slots: beams, tokens and cum_log_probs
+    // [beam_width]. lengths [beam_width] are the lengths of the running beams before the step. Returns whether the
+    // request is done: isDone(), or its last step (step >= max_step) where the running beams are added as well.
+    bool process(const int*   candidate_beams,
+                 const int*   candidate_tokens,
+                 const float* candidate_cum_log_probs,
+                 size_t       num_candidates,
+                 const int*   lengths,
+                 int          end_id,
+                 int          step,
+                 int          max_step,
+                 int*         beams,
+                 int*         tokens,
+                 float*       cum_log_probs);
+
+    // The hypotheses, best first.
+    std::vector<BeamHypothesis> getSorted() const;
+
+    size_t size() const
+    {
+        return hypotheses_.size();
+    }
+    float getWorstScore() const;
+    bool  isDone() const
+    {
+        return is_done_;
+    }
+
+private:
+    const int                   beam_width_;
+    const float                 length_penalty_;
+    const BeamEarlyStopping     early_stopping_;
+    std::vector<BeamHypothesis> hypotheses_;
+    bool                        is_done_ = false;
+};
+
+// Tokens of a beam of one request, from the output_ids and parent_ids histories [max_seq_len, num_rows] where the beams
+// of the request are the rows [row_offset, row_offset + beam_width). The beam ends with token at step and continues
+// parent_beam at step - 1. tokens[u] is written for u in [first_step, step].
+void backtrackBeam(int*       tokens,
+                   const int* output_ids,
+                   const int* parent_ids,
+                   size_t     num_rows,
+                   size_t     row_offset,
+                   int        first_step,
+                   int        step,
+                   int        token,
+                   int        parent_beam);
+
+// Decoder rows of the requests not done yet, the beam_width beams of a request being consecutive rows. The decoder
+// only runs the live rows, gathered in their order into the first rows of its buffers (the compact rows).
+struct LiveRowIndex {
+    std::vector<int> compact_to_batch;  // [num_live_rows], the row of each compact row
+    std::vector<int> batch_to_compact;  // [batch_size * beam_width], the compact row of each row, -1 once done
+
+    size_t size() const
+    {
+        return compact_to_batch.size();
+    }
+};
+
+// The live rows from the is_done flags [batch_size] of the hypotheses.
+LiveRowIndex getLiveRowIndex(const bool* is_done, size_t batch_size, size_t beam_width);
+
+// The moves of the compact rows (of a cache for instance) from the index prev to next, whose live rows are some of
+// those of prev: compact row dst_rows[i] takes compact row src_rows[i] of prev. The rows keep their order, so
+// dst_rows[i] < src_rows[i] and the moves done in order never overwrite a row still to be moved.
+void getCompactRowMoves(std::vector<int>*   dst_rows,
+                        std::vector<int>*   src_rows,
+                        const LiveRowIndex& prev,
+                        const LiveRowIndex& next);
+
+}  // namespace fastertransformer
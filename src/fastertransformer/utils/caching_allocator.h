@@ -0,0 +1,358 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * Size-class caching allocator
+ *
+ * Requests are rounded up to a size class (4 classes per power of two, at least 512 bytes). Freed blocks are kept on
+ * a free list per size class and handed out again to the next request of the same class, so that buffers allocated
+ * and freed around every forward do not reach the underlying allocator after the first one. Blocks are tracked by
+ * pointer. The backend (cudaMallocAsync, malloc, ...) is given as a pair of functions, so the same cache serves
+ * device and host memory.
+ *
+ * Cached blocks are returned to the backend by releaseCache(), when the backend runs out of memory, and block by
+ * block by release(). Allocator<CUDA> and Allocator<CPU> release a buffer that reMalloc shrinks to a smaller size
+ * class, and the whole cache when the stream changes.
+ **/
+
+#pragma once
+
+#include "src/fastertransformer/utils/cuda_utils.h"
+
+#include <functional>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace fastertransformer {
+
+// Tag of the allocations made by the current thread, see AllocatorTagScope. Tags must be string literals.
+inline const char*& currentAllocatorTag()
+{
+    static thread_local const char* tag = nullptr;
+    return tag;
+}
+
+// Attributes the allocations made in its lifetime on this thread to `tag` in AllocatorStats::tags.
+class AllocatorTagScope {
+public:
+    explicit AllocatorTagScope(const char* tag): prev_tag_(currentAllocatorTag())
+    {
+        currentAllocatorTag() = tag;
+    }
+    ~AllocatorTagScope()
+    {
+        currentAllocatorTag() = prev_tag_;
+    }
+
+private:
+    const char* prev_tag_;
+};
+
+struct AllocatorTagStats {
+    size_t live_bytes      = 0;
+    size_t peak_live_bytes = 0;
+    size_t num_allocs      = 0;
+};
+
+struct AllocatorStats {
+    size_t live_bytes         = 0;  // bytes requested by the blocks in use
+    size_t peak_live_bytes    = 0;  // high-water mark of live_bytes
+    size_t reserved_bytes     = 0;  // bytes held from the backend, in use or cached
+    size_t cached_bytes       = 0;  // bytes held on the free lists
+    size_t num_allocs         = 0;
+    size_t num_cache_hits     = 0;
+    size_t num_frees          = 0;
+    size_t num_backend_allocs = 0;
+
+    std::map<std::string, AllocatorTagStats> tags;
+
+    double hitRate() const
+    {
+        return num_allocs == 0 ? 0.0 : (double)num_cache_hits / num_allocs;
+    }
+
+    std::string toString() const
+    {
+        std::string str = fmtstr("live %lu bytes (peak %lu), reserved %lu bytes, cached %lu bytes, "
+                                 "%lu allocs, hit rate %.2f%%, %lu backend allocs",
+                                 live_bytes,
+                                 peak_live_bytes,
+                                 reserved_bytes,
+                                 cached_bytes,
+                                 num_allocs,
+                                 hitRate() * 100.0,
+                                 num_backend_allocs);
+        for (const auto& tag : tags) {
+            str += fmtstr("\n  %s: live %lu bytes (peak %lu), %lu allocs",
+                          tag.first.c_str(),
+                          tag.second.live_bytes,
+                          tag.second.peak_live_bytes,
+                          tag.second.num_allocs);
+        }
+        return str;
+    }
+};
+
+class CachingAllocator {
+public:
+    // backend_malloc returns nullptr on failure; the cache is then released and the allocation retried once.
+    using BackendMalloc = std::function<void*(size_t)>;
+    using BackendFree   = std::function<void(void*)>;
+
+    CachingAllocator(BackendMalloc backend_malloc,
+                     BackendFree   backend_free,
+                     bool          enable_caching   = true,
+                     size_t        max_cached_bytes = std::numeric_limits<size_t>::max()):
+        backend_malloc_(backend_malloc),
+        backend_free_(backend_free),
+        enable_caching_(enable_caching),
+        max_cached_bytes_(max_cached_bytes)
+    {
+    }
+
+    CachingAllocator(const CachingAllocator&) = delete;
+    CachingAllocator& operator=(const CachingAllocator&) = delete;
+
+    ~CachingAllocator()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& block : blocks_) {
+            backend_free_(block.first);
+        }
+        blocks_.clear();
+        releaseCacheLocked();
+    }
+
+    static size_t getSizeClass(size_t size)
+    {
+        if (size <= 512) {
+            return 512;
+        }
+        size_t power = 512;
+        while (power * 2 <= size && power * 2 > power) {
+            power *= 2;
+        }
+        const size_t step = power / 4;
+        return (size + step - 1) / step * step;
+    }
+
+    void* malloc(size_t size)
+    {
+        if (size == 0) {
+            return nullptr;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        const size_t class_size = enable_caching_ ? getSizeClass(size) : size;
+        void*        ptr        = nullptr;
+        stats_.num_allocs++;
+
+        auto free_list = free_lists_.find(class_size);
+        if (free_list != free_lists_.end() && !free_list->second.empty()) {
+            ptr = free_list->second.back();
+            free_list->second.pop_back();
+            stats_.cached_bytes -= class_size;
+            stats_.num_cache_hits++;
+        }
+        else {
+            ptr = backend_malloc_(class_size);
+            if (ptr == nullptr && stats_.cached_bytes > 0) {
+                FT_LOG_DEBUG("Backend allocation of %lu bytes failed, release %lu cached bytes and retry.",
+                             class_size,
+                             stats_.cached_bytes);
+                releaseCacheLocked();
+                ptr = backend_malloc_(class_size);
+            }
+            FT_CHECK_WITH_INFO(ptr != nullptr, fmtstr("Fail to allocate %lu bytes.", class_size));
+            stats_.reserved_bytes += class_size;
+            stats_.num_backend_allocs++;
+        }
+
+        const char* tag = currentAllocatorTag();
+        blocks_[ptr]    = Block{size, class_size, tag};
+        stats_.live_bytes += size;
+        stats_.peak_live_bytes = std::max(stats_.peak_live_bytes, stats_.live_bytes);
+        AllocatorTagStats& tag_stats = tags_[tag];
+        tag_stats.live_bytes += size;
+        tag_stats.peak_live_bytes = std::max(tag_stats.peak_live_bytes, tag_stats.live_bytes);
+        tag_stats.num_allocs++;
+        return ptr;
+    }
+
+    // Returns false if `ptr` was not allocated by this allocator.
+    bool free(void* ptr)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return freeLocked(ptr, enable_caching_);
+    }
+
+    // Same as free(), but the block goes back to the backend instead of the free lists, e.g. when a buffer shrinks
+    // and its memory should be given back.
+    bool release(void* ptr)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return freeLocked(ptr, false);
+    }
+
+    // Records that `ptr`, whose size class fits `size`, now serves a request of `size` bytes. Returns false if
+    // `ptr` was not allocated by this allocator.
+    bool resize(void* ptr, size_t size)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto                        block = blocks_.find(ptr);
+        if (block == blocks_.end()) {
+            return false;
+        }
+        Block& info = block->second;
+        FT_CHECK_WITH_INFO(size <= info.class_size,
+                           fmtstr("Cannot resize a block of %lu bytes to %lu bytes.", info.class_size, size));
+        AllocatorTagStats& tag_stats = tags_[info.tag];
+        stats_.live_bytes            = stats_.live_bytes - info.size + size;
+        tag_stats.live_bytes         = tag_stats.live_bytes - info.size + size;
+        stats_.peak_live_bytes       = std::max(stats_.peak_live_bytes, stats_.live_bytes);
+        tag_stats.peak_live_bytes    = std::max(tag_stats.peak_live_bytes, tag_stats.live_bytes);
+        info.size                    = size;
+        return true;
+    }
+
+    bool contains(const void* ptr) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return blocks_.count(const_cast<void*>(ptr)) > 0;
+    }
+
+    // Size requested for `ptr`, 0 if `ptr` is not allocated by this allocator.
+    size_t getSize(const void* ptr) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto                        block = blocks_.find(const_cast<void*>(ptr));
+        return block == blocks_.end() ? 0 : block->second.size;
+    }
+
+    // Size class backing `ptr`, 0 if `ptr` is not allocated by this allocator.
+    size_t getCapacity(const void* ptr) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto                        block = blocks_.find(const_cast<void*>(ptr));
+        return block == blocks_.end() ? 0 : block->second.class_size;
+    }
+
+    bool isCachingEnabled() const
+    {
+        return enable_caching_;
+    }
+
+    // Returns the cached blocks to the backend.
+    void releaseCache()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        releaseCacheLocked();
+    }
+
+    // Frees every block in use, e.g. when the owner of the memory goes away.
+    void freeAll()
+    {
+        std::vector<void*> ptrs;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto& block : blocks_) {
+                ptrs.push_back(block.first);
+            }
+        }
+        for (void* ptr : ptrs) {
+            free(ptr);
+        }
+    }
+
+    AllocatorStats getStats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        AllocatorStats              stats = stats_;
+        for (const auto& tag : tags_) {
+            AllocatorTagStats& merged = stats.tags[tag.first == nullptr ? "untagged" : tag.first];
+            merged.live_bytes += tag.second.live_bytes;
+            merged.peak_live_bytes += tag.second.peak_live_bytes;
+            merged.num_allocs += tag.second.num_allocs;
+        }
+        return stats;
+    }
+
+    void resetPeakStats()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.peak_live_bytes = stats_.live_bytes;
+        for (auto& tag : tags_) {
+            tag.second.peak_live_bytes = tag.second.live_bytes;
+        }
+    }
+
+private:
+    struct Block {
+        size_t      size;
+        size_t      class_size;
+        const char* tag;
+    };
+
+    bool freeLocked(void* ptr, bool cache)
+    {
+        auto block = blocks_.find(ptr);
+        if (block == blocks_.end()) {
+            return false;
+        }
+        const Block info = block->second;
+        blocks_.erase(block);
+        stats_.live_bytes -= info.size;
+        tags_[info.tag].live_bytes -= info.size;
+        stats_.num_frees++;
+
+        if (cache && stats_.cached_bytes + info.class_size <= max_cached_bytes_) {
+            free_lists_[info.class_size].push_back(ptr);
+            stats_.cached_bytes += info.class_size;
+        }
+        else {
+            backend_free_(ptr);
+            stats_.reserved_bytes -= info.class_size;
+        }
+        return true;
+    }
+
+    void releaseCacheLocked()
+    {
+        for (auto& free_list : free_lists_) {
+            for (void* ptr : free_list.second) {
+                backend_free_(ptr);
+                stats_.reserved_bytes -= free_list.first;
+            }
+            free_list.second.clear();
+        }
+        stats_.cached_bytes = 0;
+    }
+
+    BackendMalloc backend_malloc_;
+    BackendFree   backend_free_;
+    const bool    enable_caching_;
+    const size_t  max_cached_bytes_;
+
+    mutable std::mutex                                 mutex_;
+    std::unordered_map<void*, Block>                   blocks_;
+    std::unordered_map<size_t, std::vector<void*>>     free_lists_;
+    std::unordered_map<const char*, AllocatorTagStats> tags_;
+    AllocatorStats                                     stats_;
+};
+
+}  // namespace fastertransformer
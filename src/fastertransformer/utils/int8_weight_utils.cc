@@ -0,0 +1,423 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/fastertransformer/utils/int8_weight_utils.h"
+#include "src/fastertransformer/utils/weight_loader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define FT_INT8_WEIGHT_X86_SIMD
+#endif
+
+namespace fastertransformer {
+
+static const char INT8_WEIGHT_FILE_MAGIC[8] = {'F', 'T', 'I', 'N', 'T', '8', 'W', '\0'};
+
+template<typename T_IN>
+void calibrateInt8WeightRows(const T_IN* weight, size_t dim0, size_t dim1, float* scales)
+{
+    for (size_t i = 0; i < dim0; i++) {
+        const T_IN* row  = weight + i * dim1;
+        T_IN        maxi = row[0];
+        T_IN        mini = row[0];
+        for (size_t j = 0; j < dim1; j++) {
+            if ((float)row[j] > (float)maxi) {
+                maxi = row[j];
+            }
+            if ((float)row[j] < (float)mini) {
+                mini = row[j];
+            }
+        }
+        assert((float)mini < 0.0f);
+        scales[i] = (float)std::max((double)(float)maxi / 127.0, (double)(float)mini / 128.0);
+    }
+}
+
+// Same as cvt.rni.sat.s8.f32: round half to even, saturate to [-128, 127], NaN to 0.
+static inline int8_t float_to_int8_rn_sat(float x)
+{
+    if (std::isnan(x)) {
+        return 0;
+    }
+    float r = std::nearbyint(x);
+    r       = std::min(std::max(r, -128.0f), 127.0f);
+    return (int8_t)r;
+}
+
+static inline float getInverseScale(float scale)
+{
+    return scale == 0.0f ? 0.0f : 1.0f / scale;
+}
+
+template<typename T_IN>
+void quantizeInt8WeightRows(const T_IN* weight, size_t dim0, size_t dim1, const float* scales, int8_t* int8_weight)
+{
+    for (size_t i = 0; i < dim0; i++) {
+        const float inv_scale = getInverseScale(scales[i]);
+        for (size_t j = 0; j < dim1; j++) {
+            int8_weight[i * dim1 + j] = float_to_int8_rn_sat((float)weight[i * dim1 + j] * inv_scale);
+        }
+    }
+}
+
+template<typename T_IN>
+void transposeInt8WeightSource(const T_IN* weight, size_t dim0, size_t dim1, T_IN* transposed)
+{
+    // tiles keep both the reads and the writes within a few cache lines
+    const size_t tile = 32;
+    for (size_t i0 = 0; i0 < dim0; i0 += tile) {
+        const size_t i1 = std::min(dim0, i0 + tile);
+        for (size_t j0 = 0; j0 < dim1; j0 += tile) {
+            const size_t j1 = std::min(dim1, j0 + tile);
+            for (size_t i = i0; i < i1; i++) {
+                for (size_t j = j0; j < j1; j++) {
+                    transposed[j * dim0 + i] = weight[i * dim1 + j];
+                }
+            }
+        }
+    }
+}
+
+template void calibrateInt8WeightRows(const float* weight, size_t dim0, size_t dim1, float* scales);
+template void calibrateInt8WeightRows(const half* weight, size_t dim0, size_t dim1, float* scales);
+template void
+quantizeInt8WeightRows(const float* weight, size_t dim0, size_t dim1, const float* scales, int8_t* int8_weight);
+template void
+quantizeInt8WeightRows(const half* weight, size_t dim0, size_t dim1, const float* scales, int8_t* int8_weight);
+template void transposeInt8WeightSource(const float* weight, size_t dim0, size_t dim1, float* transposed);
+template void transposeInt8WeightSource(const half* weight, size_t dim0, size_t dim1, half* transposed);
+
+static bool cpuSupportsAvx2F16c()
+{
+#ifdef FT_INT8_WEIGHT_X86_SIMD
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c");
+#else
+    return false;
+#endif
+}
+
+static std::atomic<bool>& int8WeightSimdEnabled()
+{
+    static std::atomic<bool> enabled(cpuSupportsAvx2F16c());
+    return enabled;
+}
+
+void setInt8WeightSimdEnabled(bool enabled)
+{
+    int8WeightSimdEnabled() = enabled && cpuSupportsAvx2F16c();
+}
+
+bool isInt8WeightSimdEnabled()
+{
+    return int8WeightSimdEnabled();
+}
+
+// Min and max of the columns [c0, c0 + width) of a [dim0, dim1] weight, scanned in the same order as
+// calibrateInt8WeightRows scans the rows of the transposed weight.
+template<typename T_IN>
+static void
+findColumnMinMax(const T_IN* weight, size_t dim0, size_t dim1, size_t c0, size_t width, float* maxi, float* mini)
+{
+    for (size_t c = 0; c < width; c++) {
+        maxi[c] = (float)weight[c0 + c];
+        mini[c] = maxi[c];
+    }
+    for (size_t r = 1; r < dim0; r++) {
+        const T_IN* row = weight + r * dim1 + c0;
+        for (size_t c = 0; c < width; c++) {
+            const float x = (float)row[c];
+            maxi[c]       = x > maxi[c] ? x : maxi[c];
+            mini[c]       = x < mini[c] ? x : mini[c];
+        }
+    }
+}
+
+// int8_tile[r][c] for the rows [r0, r0 + num_rows) and the columns [c0, c0 + width).
+template<typename T_IN>
+static void quantizeColumnTile(const T_IN*  weight,
+                               size_t       dim1,
+                               size_t       r0,
+                               size_t       num_rows,
+                               size_t       c0,
+                               size_t       width,
+                               const float* inv_scales,
+                               int8_t*      int8_tile)
+{
+    for (size_t r = 0; r < num_rows; r++) {
+        const T_IN* row = weight + (r0 + r) * dim1 + c0;
+        for (size_t c = 0; c < width; c++) {
+            int8_tile[r * width + c] = float_to_int8_rn_sat((float)row[c] * inv_scales[c]);
+        }
+    }
+}
+
+#ifdef FT_INT8_WEIGHT_X86_SIMD
+__attribute__((target("avx2,f16c"))) static inline __m256 loadFloat8(const float* ptr)
+{
+    return _mm256_loadu_ps(ptr);
+}
+
+__attribute__((target("avx2,f16c"))) static inline __m256 loadFloat8(const half* ptr)
+{
+    return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr)));
+}
+
+// Every lane follows one column down the rows, so the result is the one of the scalar scan, NaNs and signed zeros
+// included: max_ps(x, m) and min_ps(x, m) return m unless x is strictly greater, resp. smaller.
+template<typename T_IN>
+__attribute__((target("avx2,f16c"))) static void findColumnMinMaxAvx2(
+    const T_IN* weight, size_t dim0, size_t dim1, size_t c0, size_t width, float* maxi, float* mini)
+{
+    const size_t vec_width = width / 8 * 8;
+    for (size_t c = 0; c < vec_width; c += 8) {
+        const __m256 x = loadFloat8(weight + c0 + c);
+        _mm256_storeu_ps(maxi + c, x);
+        _mm256_storeu_ps(mini + c, x);
+    }
+    for (size_t r = 1; r < dim0; r++) {
+        const T_IN* row = weight + r * dim1 + c0;
+        for (size_t c = 0; c < vec_width; c += 8) {
+            const __m256 x = loadFloat8(row + c);
+            _mm256_storeu_ps(maxi + c, _mm256_max_ps(x, _mm256_loadu_ps(maxi + c)));
+            _mm256_storeu_ps(mini + c, _mm256_min_ps(x, _mm256_loadu_ps(mini + c)));
+        }
+    }
+    if (vec_width < width) {
+        findColumnMinMax(weight, dim0, dim1, c0 + vec_width, width - vec_width, maxi + vec_width, mini + vec_width);
+    }
+}
+
+template<typename T_IN>
+__attribute__((target("avx2,f16c"))) static void quantizeColumnTileAvx2(const T_IN*  weight,
+                                                                        size_t       dim1,
+                                                                        size_t       r0,
+                                                                        size_t       num_rows,
+                                                                        size_t       c0,
+                                                                        size_t       width,
+                                                                        const float* inv_scales,
+                                                                        int8_t*      int8_tile)
+{
+    const size_t vec_width = width / 8 * 8;
+    const __m256 vlow      = _mm256_set1_ps(-128.0f);
+    const __m256 vhigh     = _mm256_set1_ps(127.0f);
+    for (size_t r = 0; r < num_rows; r++) {
+        const T_IN* row      = weight + (r0 + r) * dim1 + c0;
+        int8_t*     int8_row = int8_tile + r * width;
+        for (size_t c = 0; c < vec_width; c += 8) {
+            __m256 v = _mm256_mul_ps(loadFloat8(row + c), _mm256_loadu_ps(inv_scales + c));
+            v        = _mm256_round_ps(v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+            // NaN -> 0 before clamping, max_ps would turn it into -128
+            v                 = _mm256_and_ps(v, _mm256_cmp_ps(v, v, _CMP_ORD_Q));
+            v                 = _mm256_min_ps(_mm256_max_ps(v, vlow), vhigh);
+            const __m256i i32 = _mm256_cvtps_epi32(v);
+            const __m128i i16 = _mm_packs_epi32(_mm256_castsi256_si128(i32), _mm256_extracti128_si256(i32, 1));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(int8_row + c), _mm_packs_epi16(i16, i16));
+        }
+        for (size_t c = vec_width; c < width; c++) {
+            int8_row[c] = float_to_int8_rn_sat((float)row[c] * inv_scales[c]);
+        }
+    }
+}
+#endif
+
+template<typename T_IN>
+void calibrateAndQuantizeInt8WeightColumns(
+    const T_IN* weight, size_t dim0, size_t dim1, float* scales, int8_t* int8_weight, int num_threads)
+{
+    if (dim0 == 0 || dim1 == 0) {
+        return;
+    }
+    if (num_threads <= 0) {
+        num_threads = std::max(1, (int)std::thread::hardware_concurrency() / getWeightLoadThreads());
+    }
+    const bool use_simd = isInt8WeightSimdEnabled();
+    // a few blocks of columns per thread, each one a multiple of the vector width and small enough for its min/max
+    // and its tile of int8 rows to stay in the L1/L2 caches
+    const size_t max_cols_per_block = 256;
+    const size_t rows_per_tile      = 64;
+    size_t       cols_per_block     = (dim1 + (size_t)num_threads * 4 - 1) / ((size_t)num_threads * 4);
+    cols_per_block                  = std::min(max_cols_per_block, (cols_per_block + 7) / 8 * 8);
+    const size_t num_blocks         = (dim1 + cols_per_block - 1) / cols_per_block;
+
+    ParallelWeightLoader pool(num_threads);
+    pool.run(num_blocks, [&](size_t block) {
+        const size_t        c0    = block * cols_per_block;
+        const size_t        width = std::min(dim1, c0 + cols_per_block) - c0;
+        std::vector<float>  maxi(width);
+        std::vector<float>  mini(width);
+        std::vector<float>  inv_scales(width);
+        std::vector<int8_t> int8_tile(rows_per_tile * width);
+#ifdef FT_INT8_WEIGHT_X86_SIMD
+        if (use_simd) {
+            findColumnMinMaxAvx2(weight, dim0, dim1, c0, width, maxi.data(), mini.data());
+        }
+        else
+#endif
+        {
+            findColumnMinMax(weight, dim0, dim1, c0, width, maxi.data(), mini.data());
+        }
+        for (size_t c = 0; c < width; c++) {
+            assert(mini[c] < 0.0f);
+            scales[c0 + c] = (float)std::max((double)maxi[c] / 127.0, (double)mini[c] / 128.0);
+            inv_scales[c]  = getInverseScale(scales[c0 + c]);
+        }
+
+        // quantize a tile of rows, then write it transposed: every output channel receives num_rows contiguous bytes
+        for (size_t r0 = 0; r0 < dim0; r0 += rows_per_tile) {
+            const size_t num_rows = std::min(rows_per_tile, dim0 - r0);
+#ifdef FT_INT8_WEIGHT_X86_SIMD
+            if (use_simd) {
+                quantizeColumnTileAvx2(weight, dim1, r0, num_rows, c0, width, inv_scales.data(), int8_tile.data());
+            }
+            else
+#endif
+            {
+                quantizeColumnTile(weight, dim1, r0, num_rows, c0, width, inv_scales.data(), int8_tile.data());
+            }
+            for (size_t c = 0; c < width; c++) {
+                int8_t* int8_channel = int8_weight + (c0 + c) * dim0 + r0;
+                for (size_t r = 0; r < num_rows; r++) {
+                    int8_channel[r] = int8_tile[r * width + c];
+                }
+            }
+        }
+    });
+}
+
+template void calibrateAndQuantizeInt8WeightColumns(
+    const float* weight, size_t dim0, size_t dim1, float* scales, int8_t* int8_weight, int num_threads);
+template void calibrateAndQuantizeInt8WeightColumns(
+    const half* weight, size_t dim0, size_t dim1, float* scales, int8_t* int8_weight, int num_threads);
+
+std::string getInt8WeightFileName(const std::string& filename)
+{
+    if (filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".bin") == 0) {
+        return filename.substr(0, filename.size() - 4) + ".int8";
+    }
+    return filename + ".int8";
+}
+
+bool writeInt8WeightFile(const std::string& filename,
+                         size_t             dim0,
+                         size_t             dim1,
+                         FtCudaDataType     source_data_type,
+                         size_t             source_size_in_bytes,
+                         const float*       scales,
+                         const int8_t*      int8_weight)
+{
+    Int8WeightFileHeader header;
+    memcpy(header.magic, INT8_WEIGHT_FILE_MAGIC, sizeof(header.magic));
+    header.version              = INT8_WEIGHT_FILE_VERSION;
+    header.source_data_type     = (uint32_t)source_data_type;
+    header.dim0                 = dim0;
+    header.dim1                 = dim1;
+    header.source_size_in_bytes = source_size_in_bytes;
+
+    // write to a temporary file first so that an interrupted run never leaves a truncated file behind
+    const std::string tmp_filename = filename + ".tmp";
+    std::ofstream     out(tmp_filename, std::ios::out | std::ios::binary);
+    if (!out.is_open()) {
+        FT_LOG_WARNING("file %s cannot be opened for writing", tmp_filename.c_str());
+        return false;
+    }
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)scales, sizeof(float) * dim1);
+    out.write((const char*)int8_weight, sizeof(int8_t) * dim0 * dim1);
+    out.close();
+    if (!out.good() || rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+        FT_LOG_WARNING("failed to write %s", filename.c_str());
+        remove(tmp_filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool Int8WeightFileReader::open(const std::string& filename,
+                                size_t             dim0,
+                                size_t             dim1,
+                                FtCudaDataType     source_data_type,
+                                const std::string& source_filename)
+{
+    scales_      = nullptr;
+    int8_weight_ = nullptr;
+    if (!mapping_.open(filename, true)) {
+        return false;
+    }
+    const size_t expected_size = sizeof(Int8WeightFileHeader) + sizeof(float) * dim1 + sizeof(int8_t) * dim1 * dim0;
+    if (mapping_.size() < sizeof(Int8WeightFileHeader)) {
+        FT_LOG_WARNING("%s is not a pre-quantized weight file", filename.c_str());
+        mapping_.close();
+        return false;
+    }
+    Int8WeightFileHeader header;
+    memcpy(&header, mapping_.data(), sizeof(header));
+    if (memcmp(header.magic, INT8_WEIGHT_FILE_MAGIC, sizeof(header.magic)) != 0) {
+        FT_LOG_WARNING("%s is not a pre-quantized weight file", filename.c_str());
+        mapping_.close();
+        return false;
+    }
+    if (header.version != INT8_WEIGHT_FILE_VERSION) {
+        FT_LOG_WARNING("%s has version %u, but version %u is required", filename.c_str(), header.version,
+                       INT8_WEIGHT_FILE_VERSION);
+        mapping_.close();
+        return false;
+    }
+    if (header.dim0 != dim0 || header.dim1 != dim1 || header.source_data_type != (uint32_t)source_data_type) {
+        FT_LOG_WARNING("%s holds a [%lu, %lu] weight of data type %u, but a [%lu, %lu] weight of data type %d is "
+                       "requested",
+                       filename.c_str(),
+                       header.dim0,
+                       header.dim1,
+                       header.source_data_type,
+                       dim0,
+                       dim1,
+                       source_data_type);
+        mapping_.close();
+        return false;
+    }
+    struct stat source_stat;
+    if (stat(source_filename.c_str(), &source_stat) == 0 && (size_t)source_stat.st_size != header.source_size_in_bytes) {
+        FT_LOG_WARNING("%s was quantized from a %lu bytes weight, but %s has %ld bytes",
+                       filename.c_str(),
+                       header.source_size_in_bytes,
+                       source_filename.c_str(),
+                       (long)source_stat.st_size);
+        mapping_.close();
+        return false;
+    }
+    if (mapping_.size() != expected_size) {
+        FT_LOG_WARNING("%s has %lu bytes, but %lu bytes are expected", filename.c_str(), mapping_.size(), expected_size);
+        mapping_.close();
+        return false;
+    }
+    const char* payload = mapping_.data() + sizeof(Int8WeightFileHeader);
+    scales_             = reinterpret_cast<const float*>(payload);
+    int8_weight_        = reinterpret_cast<const int8_t*>(payload + sizeof(float) * dim1);
+    return true;
+}
+
+}  // namespace fastertransformer
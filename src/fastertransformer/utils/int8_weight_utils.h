@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Host-side per-row INT8 weight quantization and the pre-quantized weight file read by loadWeightFromBinQ.
+ *
+ * A [dim0, dim1] weight (k inputs, n output channels, as used by the GEMM) is quantized per output channel for
+ * int8WeightPerChannelLdkMultiplication, which reads the int8 weight as its [dim1, dim0] transpose with one scale per
+ * row. The rows quantized here are therefore the rows of the transposed weight.
+ *
+ * Pre-quantized weight file, stored next to the source weight as "<name>.int8" for "<name>.bin" (little endian):
+ *   header : char magic[8] = "FTINT8W\0", uint32 version, uint32 source_data_type (FtCudaDataType),
+ *            uint64 dim0, uint64 dim1, uint64 source_size_in_bytes
+ *   scales : float[dim1], one per output channel
+ *   kernel : int8_t[dim1 * dim0], output channel major
+ *
+ * The file is only used when every header field matches the request, so files written for another shape, another
+ * source data type, another quantization rule (version) or another source weight (size) are rejected.
+ **/
+
+#pragma once
+
+#include "src/fastertransformer/utils/cuda_utils.h"
+#include "src/fastertransformer/utils/mmap_utils.h"
+
+#include <string>
+
+namespace fastertransformer {
+
+// Bump when the scale rule, the rounding of quantizeInt8WeightRows or the layout changes.
+static const uint32_t INT8_WEIGHT_FILE_VERSION = 2;
+
+struct Int8WeightFileHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t source_data_type;
+    uint64_t dim0;
+    uint64_t dim1;
+    uint64_t source_size_in_bytes;
+};
+
+// Per-row scale of a [dim0, dim1] weight: scale[i] = max(max(row_i) / 127, min(row_i) / 128).
+template<typename T_IN>
+void calibrateInt8WeightRows(const T_IN* weight, size_t dim0, size_t dim1, float* scales);
+
+// Host equivalent of invokeQuantization applied row by row with the inverse of the scales of
+// calibrateInt8WeightRows, so that int8_weight[i][j] * scales[i] approximates weight[i][j]:
+// int8_weight[i][j] = round_half_even_saturate(weight[i][j] * (1 / scales[i])), bit-identical to the device kernel.
+// A zero scale quantizes its row to zeros.
+template<typename T_IN>
+void quantizeInt8WeightRows(const T_IN* weight, size_t dim0, size_t dim1, const float* scales, int8_t* int8_weight);
+
+// transposed[j][i] = weight[i][j], turns a [dim0, dim1] weight into the output channel major layout.
+template<typename T_IN>
+void transposeInt8WeightSource(const T_IN* weight, size_t dim0, size_t dim1, T_IN* transposed);
+
+// Quantizes a [dim0, dim1] weight per output channel straight from its source layout: scales [dim1] and
+// int8_weight [dim1, dim0], bit-identical to transposeInt8WeightSource followed by calibrateInt8WeightRows and
+// quantizeInt8WeightRows on the transposed weight, without the transposed copy. Blocks of columns are split over
+// `num_threads` threads (0: the hardware threads divided by getWeightLoadThreads()), and scanned with AVX2/F16C
+// when the CPU supports them.
+template<typename T_IN>
+void calibrateAndQuantizeInt8WeightColumns(
+    const T_IN* weight, size_t dim0, size_t dim1, float* scales, int8_t* int8_weight, int num_threads = 0);
+
+// Enables the AVX2/F16C path of calibrateAndQuantizeInt8WeightColumns when the CPU supports it (default).
+void setInt8WeightSimdEnabled(bool enabled);
+bool isInt8WeightSimdEnabled();
+
+// "<dir>/model.layers.0.attention.query_key_value.weight.0.bin" -> "<dir>/model.layers.0.attention.query_key_value.weight.0.int8"
+std::string getInt8WeightFileName(const std::string& filename);
+
+// Writes the quantized [dim0, dim1] source weight: scales [dim1] and int8_weight [dim1, dim0].
+bool writeInt8WeightFile(const std::string& filename,
+                         size_t             dim0,
+                         size_t             dim1,
+                         FtCudaDataType     source_data_type,
+                         size_t             source_size_in_bytes,
+                         const float*       scales,
+                         const int8_t*      int8_weight);
+
+class Int8WeightFileReader {
+public:
+    // Maps `filename` and validates its header. When `source_filename` exists, its size must match the size
+    // recorded in the header. Returns false, with a warning, if the file is missing, truncated or stale.
+    bool open(const std::string& filename,
+              size_t             dim0,
+              size_t             dim1,
+              FtCudaDataType     source_data_type,
+              const std::string& source_filename);
+
+    // [dim1]
+    const float* scales() const
+    {
+        return scales_;
+    }
+    // [dim1, dim0]
+    const int8_t* int8Weight() const
+    {
+        return int8_weight_;
+    }
+
+private:
+    MmapFile      mapping_;
+    const float*  scales_      = nullptr;
+    const int8_t* int8_weight_ = nullptr;
+};
+
+}  // namespace fastertransformer
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/fastertransformer/utils/kv_block_manager.h"
+#include "src/fastertransformer/utils/cuda_utils.h"
+
+#include <algorithm>
+
+namespace fastertransformer {
+
+KVBlockManager::KVBlockManager(size_t num_blocks, size_t block_size): block_size_(block_size), ref_counts_(num_blocks)
+{
+    FT_CHECK_WITH_INFO(block_size_ > 0, "block_size must be positive.");
+    // blocks are handed out from the back, lowest ids first
+    free_blocks_.reserve(num_blocks);
+    for (size_t i = num_blocks; i > 0; i--) {
+        free_blocks_.push_back((int)(i - 1));
+    }
+}
+
+int KVBlockManager::takeFreeBlock()
+{
+    FT_CHECK(!free_blocks_.empty());
+    const int block = free_blocks_.back();
+    free_blocks_.pop_back();
+    ref_counts_[block] = 1;
+    return block;
+}
+
+void KVBlockManager::releaseBlock(int block)
+{
+    FT_CHECK(ref_counts_[block] > 0);
+    if (--ref_counts_[block] == 0) {
+        free_blocks_.push_back(block);
+    }
+}
+
+bool KVBlockManager::canAllocate(size_t num_tokens) const
+{
+    return getNumBlocksForTokens(num_tokens) <= free_blocks_.size();
+}
+
+bool KVBlockManager::allocateSequence(uint64_t seq_id, size_t num_tokens)
+{
+    FT_CHECK_WITH_INFO(sequences_.count(seq_id) == 0,
+                       fmtstr("Sequence %lu is already allocated.", (unsigned long)seq_id));
+    if (!canAllocate(num_tokens)) {
+        return false;
+    }
+    Sequence& sequence = sequences_[seq_id];
+    sequence.length    = num_tokens;
+    for (size_t i = 0; i < getNumBlocksForTokens(num_tokens); i++) {
+        sequence.block_table.push_back(takeFreeBlock());
+    }
+    return true;
+}
+
+bool KVBlockManager::appendTokens(uint64_t seq_id, size_t num_tokens)
+{
+    auto it = sequences_.find(seq_id);
+    FT_CHECK_WITH_INFO(it != sequences_.end(), fmtstr("Sequence %lu is not allocated.", (unsigned long)seq_id));
+    Sequence& sequence = it->second;
+
+    // the last block is written to if it is partially filled, it needs its own copy when shared
+    const bool   writes_last_block = num_tokens > 0 && sequence.length % block_size_ != 0;
+    const bool   copy_last_block   = writes_last_block && ref_counts_[sequence.block_table.back()] > 1;
+    const size_t new_blocks =
+        getNumBlocksForTokens(sequence.length + num_tokens) - sequence.block_table.size() + (copy_last_block ? 1 : 0);
+    if (new_blocks > free_blocks_.size()) {
+        return false;
+    }
+
+    if (copy_last_block) {
+        const int shared_block = sequence.block_table.back();
+        const int own_block    = takeFreeBlock();
+        releaseBlock(shared_block);
+        sequence.block_table.back() = own_block;
+        pending_copies_.push_back(KVBlockCopy{shared_block, own_block});
+    }
+    sequence.length += num_tokens;
+    while (sequence.block_table.size() < getNumBlocksForTokens(sequence.length)) {
+        sequence.block_table.push_back(takeFreeBlock());
+    }
+    return true;
+}
+
+bool KVBlockManager::reserveTokens(uint64_t seq_id, size_t num_tokens)
+{
+    auto it = sequences_.find(seq_id);
+    if (it == sequences_.end()) {
+        return allocateSequence(seq_id, num_tokens);
+    }
+    return num_tokens <= it->second.length || appendTokens(seq_id, num_tokens - it->second.length);
+}
+
+void KVBlockManager::truncateSequence(uint64_t seq_id, size_t num_tokens)
+{
+    auto it = sequences_.find(seq_id);
+    FT_CHECK_WITH_INFO(it != sequences_.end(), fmtstr("Sequence %lu is not allocated.", (unsigned long)seq_id));
+    Sequence& sequence = it->second;
+    FT_CHECK_WITH_INFO(num_tokens <= sequence.length,
+                       fmtstr("Cannot truncate sequence %lu of %lu tokens to %lu tokens.",
+                              (unsigned long)seq_id,
+                              sequence.length,
+                              num_tokens));
+    // a kept partial block that is shared is copied by the next append, as any shared last block
+    sequence.length = num_tokens;
+    while (sequence.block_table.size() > getNumBlocksForTokens(num_tokens)) {
+        releaseBlock(sequence.block_table.back());
+        sequence.block_table.pop_back();
+    }
+}
+
+void KVBlockManager::forkSequence(uint64_t src_seq_id, uint64_t dst_seq_id)
+{
+    auto src = sequences_.find(src_seq_id);
+    FT_CHECK_WITH_INFO(src != sequences_.end(), fmtstr("Sequence %lu is not allocated.", (unsigned long)src_seq_id));
+    if (src_seq_id == dst_seq_id) {
+        return;
+    }
+    // take the references before dropping the old ones, the two sequences may share blocks
+    for (int block : src->second.block_table) {
+        ref_counts_[block]++;
+    }
+    Sequence copy = src->second;
+    freeSequence(dst_seq_id);
+    sequences_[dst_seq_id] = std::move(copy);
+}
+
+void KVBlockManager::reorderSequences(const std::vector<uint64_t>& seq_ids, const std::vector<int>& parents)
+{
+    FT_CHECK(parents.size() == seq_ids.size());
+    std::vector<Sequence> forked;
+    forked.reserve(seq_ids.size());
+    for (int parent : parents) {
+        FT_CHECK_WITH_INFO(parent >= 0 && (size_t)parent < seq_ids.size(), fmtstr("Invalid parent %d.", parent));
+        auto src = sequences_.find(seq_ids[parent]);
+        FT_CHECK_WITH_INFO(src != sequences_.end(),
+                           fmtstr("Sequence %lu is not allocated.", (unsigned long)seq_ids[parent]));
+        for (int block : src->second.block_table) {
+            ref_counts_[block]++;
+        }
+        forked.push_back(src->second);
+    }
+    for (size_t i = 0; i < seq_ids.size(); i++) {
+        freeSequence(seq_ids[i]);
+    }
+    for (size_t i = 0; i < seq_ids.size(); i++) {
+        sequences_[seq_ids[i]] = std::move(forked[i]);
+    }
+}
+
+void KVBlockManager::freeSequence(uint64_t seq_id)
+{
+    auto it = sequences_.find(seq_id);
+    if (it == sequences_.end()) {
+        return;
+    }
+    for (int block : it->second.block_table) {
+        releaseBlock(block);
+    }
+    sequences_.erase(it);
+}
+
+bool KVBlockManager::hasSequence(uint64_t seq_id) const
+{
+    return sequences_.count(seq_id) > 0;
+}
+
+size_t KVBlockManager::getSequenceLength(uint64_t seq_id) const
+{
+    auto it = sequences_.find(seq_id);
+    FT_CHECK_WITH_INFO(it != sequences_.end(), fmtstr("Sequence %lu is not allocated.", (unsigned long)seq_id));
+    return it->second.length;
+}
+
+const std::vector<int>& KVBlockManager::getBlockTable(uint64_t seq_id) const
+{
+    auto it = sequences_.find(seq_id);
+    FT_CHECK_WITH_INFO(it != sequences_.end(), fmtstr("Sequence %lu is not allocated.", (unsigned long)seq_id));
+    return it->second.block_table;
+}
+
+int KVBlockManager::getRefCount(int block) const
+{
+    FT_CHECK(block >= 0 && (size_t)block < ref_counts_.size());
+    return ref_counts_[block];
+}
+
+std::vector<KVBlockCopy> KVBlockManager::popPendingCopies()
+{
+    std::vector<KVBlockCopy> copies;
+    copies.swap(pending_copies_);
+    return copies;
+}
+
+void KVBlockManager::fillBlockTables(const std::vector<uint64_t>& seq_ids,
+                                     size_t                       max_blocks_per_seq,
+                                     int*                         block_tables) const
+{
+    std::fill(block_tables, block_tables + seq_ids.size() * max_blocks_per_seq, 0);
+    for (size_t i = 0; i < seq_ids.size(); i++) {
+        const std::vector<int>& block_table = getBlockTable(seq_ids[i]);
+        FT_CHECK_WITH_INFO(block_table.size() <= max_blocks_per_seq,
+                           fmtstr("Sequence %lu holds %lu blocks, more than max_blocks_per_seq %lu.",
+                                  (unsigned long)seq_ids[i],
+                                  block_table.size(),
+                                  max_blocks_per_seq));
+        std::copy(block_table.begin(), block_table.end(), block_tables + i * max_blocks_per_seq);
+    }
+}
+
+}  // namespace fastertransformer
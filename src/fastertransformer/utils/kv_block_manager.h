@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * Block manager of a paged KV cache
+ *
+ * The cache is a pool of fixed-size blocks of block_size tokens. Every sequence owns a block table, the list of the
+ * blocks holding its tokens in order: token t of a sequence lives in block_table[t / block_size] at position
+ * t % block_size. Blocks are reference counted so that beams forked from the same parent share their common prefix.
+ * When a sequence appends to a block it shares with another sequence, the block is copied first (copy-on-write); the
+ * copies are queued and must be applied on the device (invokeCopyKVCacheBlocks) before the next write to the cache.
+ *
+ * The manager is host-only and not thread safe, it is driven by the thread running the model.
+ **/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace fastertransformer {
+
+struct KVBlockCopy {
+    int src_block;
+    int dst_block;
+};
+
+class KVBlockManager {
+public:
+    KVBlockManager(size_t num_blocks, size_t block_size);
+
+    size_t getNumBlocks() const
+    {
+        return ref_counts_.size();
+    }
+    size_t getBlockSize() const
+    {
+        return block_size_;
+    }
+    size_t getNumFreeBlocks() const
+    {
+        return free_blocks_.size();
+    }
+    size_t getNumBlocksForTokens(size_t num_tokens) const
+    {
+        return (num_tokens + block_size_ - 1) / block_size_;
+    }
+
+    // Whether a new sequence of `num_tokens` tokens fits in the free blocks.
+    bool canAllocate(size_t num_tokens) const;
+    // Creates sequence `seq_id` holding `num_tokens` tokens. Returns false, allocating nothing, when the free blocks
+    // do not suffice.
+    bool allocateSequence(uint64_t seq_id, size_t num_tokens);
+    // Grows sequence `seq_id` by `num_tokens` tokens, copying its last block first if it is shared. Returns false,
+    // changing nothing, when the free blocks do not suffice.
+    bool appendTokens(uint64_t seq_id, size_t num_tokens = 1);
+    // Grows sequence `seq_id` to at least `num_tokens` tokens, creating it when it does not exist. Returns false,
+    // changing nothing, when the free blocks do not suffice.
+    bool reserveTokens(uint64_t seq_id, size_t num_tokens);
+    // Shrinks sequence `seq_id` to its first `num_tokens` tokens, e.g. to drop rejected speculative tokens. Blocks
+    // past the new end are released.
+    void truncateSequence(uint64_t seq_id, size_t num_tokens);
+    // Makes `dst_seq_id` a copy of `src_seq_id` sharing all its blocks, e.g. for a beam taking over its parent. A
+    // previous `dst_seq_id` is freed.
+    void forkSequence(uint64_t src_seq_id, uint64_t dst_seq_id);
+    // Makes every seq_ids[i] a copy of seq_ids[parents[i]] at once, all of them forked from the sequences as they
+    // were before the call, e.g. for the beams of a step continuing the beams given by parent_ids.
+    void reorderSequences(const std::vector<uint64_t>& seq_ids, const std::vector<int>& parents);
+    // Releases the blocks of `seq_id`; blocks return to the pool when no other sequence references them.
+    void freeSequence(uint64_t seq_id);
+
+    bool                    hasSequence(uint64_t seq_id) const;
+    size_t                  getSequenceLength(uint64_t seq_id) const;
+    const std::vector<int>& getBlockTable(uint64_t seq_id) const;
+    int                     getRefCount(int block) const;
+
+    // Returns and clears the copies queued by the copy-on-writes.
+    std::vector<KVBlockCopy> popPendingCopies();
+
+    // Writes the block tables of `seq_ids` as a [seq_ids.size(), max_blocks_per_seq] matrix, the layout the paged
+    // attention kernels consume. Entries past the end of a sequence are 0.
+    void fillBlockTables(const std::vector<uint64_t>& seq_ids, size_t max_blocks_per_seq, int* block_tables) const;
+
+private:
+    struct Sequence {
+        size_t           length = 0;
+        std::vector<int> block_table;
+    };
+
+    int  takeFreeBlock();
+    void releaseBlock(int block);
+
+    const size_t                           block_size_;
+    std::vector<int>                       ref_counts_;
+    std::vector<int>                       free_blocks_;
+    std::unordered_map<uint64_t, Sequence> sequences_;
+    std::vector<KVBlockCopy>               pending_copies_;
+};
+
+}  // namespace fastertransformer
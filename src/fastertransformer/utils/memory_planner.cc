@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/fastertransformer/utils/memory_planner.h"
+#include "src/fastertransformer/utils/cuda_utils.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace fastertransformer {
+
+MemoryPlanner::MemoryPlanner(size_t alignment): alignment_(alignment)
+{
+    FT_CHECK_WITH_INFO(alignment_ > 0 && (alignment_ & (alignment_ - 1)) == 0,
+                       fmtstr("Alignment must be a power of two, got %lu.", alignment_));
+}
+
+size_t MemoryPlanner::alignedSize(size_t size) const
+{
+    return (size + alignment_ - 1) / alignment_ * alignment_;
+}
+
+void MemoryPlanner::addBuffer(const std::string& name, size_t size, int first_step, int last_step)
+{
+    FT_CHECK_WITH_INFO(first_step <= last_step,
+                       fmtstr("Buffer %s ends (%d) before it starts (%d).", name.c_str(), last_step, first_step));
+    FT_CHECK_WITH_INFO(indices_.count(name) == 0, fmtstr("Buffer %s is added twice.", name.c_str()));
+    indices_[name] = buffers_.size();
+    buffers_.push_back(PlannedBuffer{name, size, first_step, last_step, 0});
+    is_planned_ = false;
+}
+
+size_t MemoryPlanner::plan()
+{
+    std::vector<size_t> order(buffers_.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    // stable, so that equal sizes keep the order in which they were added and plans are reproducible
+    std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+        return alignedSize(buffers_[a].size) > alignedSize(buffers_[b].size);
+    });
+
+    struct Range {
+        size_t begin;
+        size_t end;
+    };
+    std::vector<size_t> placed;
+    std::vector<Range>  conflicts;
+    arena_bytes_ = 0;
+    for (size_t index : order) {
+        PlannedBuffer& buffer = buffers_[index];
+        const size_t   size   = alignedSize(buffer.size);
+        buffer.offset         = 0;
+        if (size == 0) {
+            continue;
+        }
+
+        conflicts.clear();
+        for (size_t other_index : placed) {
+            const PlannedBuffer& other = buffers_[other_index];
+            if (other.first_step <= buffer.last_step && buffer.first_step <= other.last_step) {
+                conflicts.push_back(Range{other.offset, other.offset + alignedSize(other.size)});
+            }
+        }
+        std::sort(conflicts.begin(), conflicts.end(), [](const Range& a, const Range& b) {
+            return a.begin < b.begin;
+        });
+
+        // smallest gap between the conflicting buffers that fits, otherwise after the last one
+        size_t best_offset = std::numeric_limits<size_t>::max();
+        size_t best_gap    = std::numeric_limits<size_t>::max();
+        size_t gap_begin   = 0;
+        for (const Range& range : conflicts) {
+            if (range.begin > gap_begin) {
+                const size_t gap = range.begin - gap_begin;
+                if (gap >= size && gap < best_gap) {
+                    best_gap    = gap;
+                    best_offset = gap_begin;
+                }
+            }
+            gap_begin = std::max(gap_begin, range.end);
+        }
+        buffer.offset = best_offset != std::numeric_limits<size_t>::max() ? best_offset : gap_begin;
+        arena_bytes_  = std::max(arena_bytes_, buffer.offset + size);
+        placed.push_back(index);
+    }
+    is_planned_ = true;
+    return arena_bytes_;
+}
+
+size_t MemoryPlanner::getArenaBytes() const
+{
+    FT_CHECK_WITH_INFO(is_planned_, "plan() must be called before getArenaBytes().");
+    return arena_bytes_;
+}
+
+size_t MemoryPlanner::getNaiveBytes() const
+{
+    size_t total = 0;
+    for (const PlannedBuffer& buffer : buffers_) {
+        total += alignedSize(buffer.size);
+    }
+    return total;
+}
+
+size_t MemoryPlanner::getLowerBoundBytes() const
+{
+    // the live sum only changes where a lifetime starts, so those steps are enough
+    size_t lower_bound = 0;
+    for (const PlannedBuffer& step_buffer : buffers_) {
+        const int step = step_buffer.first_step;
+        size_t    live = 0;
+        for (const PlannedBuffer& buffer : buffers_) {
+            if (buffer.first_step <= step && step <= buffer.last_step) {
+                live += alignedSize(buffer.size);
+            }
+        }
+        lower_bound = std::max(lower_bound, live);
+    }
+    return lower_bound;
+}
+
+size_t MemoryPlanner::getIndex(const std::string& name) const
+{
+    auto index = indices_.find(name);
+    FT_CHECK_WITH_INFO(index != indices_.end(), fmtstr("Buffer %s is not in the plan.", name.c_str()));
+    return index->second;
+}
+
+bool MemoryPlanner::hasBuffer(const std::string& name) const
+{
+    return indices_.count(name) > 0;
+}
+
+size_t MemoryPlanner::getOffset(const std::string& name) const
+{
+    FT_CHECK_WITH_INFO(is_planned_, "plan() must be called before getOffset().");
+    return buffers_[getIndex(name)].offset;
+}
+
+size_t MemoryPlanner::getSize(const std::string& name) const
+{
+    return buffers_[getIndex(name)].size;
+}
+
+bool MemoryPlanner::verify() const
+{
+    if (!is_planned_) {
+        return false;
+    }
+    for (size_t i = 0; i < buffers_.size(); i++) {
+        const PlannedBuffer& a = buffers_[i];
+        if (a.offset % alignment_ != 0 || a.offset + alignedSize(a.size) > arena_bytes_) {
+            return false;
+        }
+        for (size_t j = i + 1; j < buffers_.size(); j++) {
+            const PlannedBuffer& b = buffers_[j];
+            if (a.size == 0 || b.size == 0 || a.last_step < b.first_step || b.last_step < a.first_step) {
+                continue;
+            }
+            if (a.offset < b.offset + alignedSize(b.size) && b.offset < a.offset + alignedSize(a.size)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+std::string MemoryPlanner::toString() const
+{
+    std::string str = fmtstr("%lu buffers, naive %lu bytes, lower bound %lu bytes",
+                             buffers_.size(),
+                             getNaiveBytes(),
+                             getLowerBoundBytes());
+    if (is_planned_) {
+        str += fmtstr(", arena %lu bytes", arena_bytes_);
+        for (const PlannedBuffer& buffer : buffers_) {
+            str += fmtstr("\n  %-40s offset %12lu size %12lu steps [%d, %d]",
+                          buffer.name.c_str(),
+                          buffer.offset,
+                          buffer.size,
+                          buffer.first_step,
+                          buffer.last_step);
+        }
+    }
+    return str;
+}
+
+}  // namespace fastertransformer
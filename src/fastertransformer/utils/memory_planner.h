@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * Static activation memory planner
+ *
+ * Buffers are described by their size and their lifetime, an inclusive range of steps of the forward pass. plan()
+ * assigns every buffer an offset into a single arena such that two buffers whose lifetimes overlap never overlap in
+ * memory. Buffers are placed from the largest to the smallest, each one into the smallest gap left between the
+ * already placed buffers that are live at the same time (greedy by size, best fit).
+ *
+ * The planner is pure host code: the arena size of a configuration is known before anything is allocated.
+ **/
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace fastertransformer {
+
+struct PlannedBuffer {
+    std::string name;
+    size_t      size;        // requested bytes
+    int         first_step;  // first step using the buffer
+    int         last_step;   // last step using the buffer, inclusive
+    size_t      offset;      // offset into the arena, valid after plan()
+};
+
+class MemoryPlanner {
+public:
+    explicit MemoryPlanner(size_t alignment = 256);
+
+    // Registers a buffer of `size` bytes live from `first_step` to `last_step` (inclusive). Names must be unique.
+    void addBuffer(const std::string& name, size_t size, int first_step, int last_step);
+
+    // Assigns the offsets and returns the arena size in bytes.
+    size_t plan();
+
+    bool isPlanned() const
+    {
+        return is_planned_;
+    }
+    size_t getAlignment() const
+    {
+        return alignment_;
+    }
+    // Arena size of the plan.
+    size_t getArenaBytes() const;
+    // Bytes needed if every buffer had its own allocation, i.e. the sum of the aligned sizes.
+    size_t getNaiveBytes() const;
+    // Largest sum of the aligned sizes of the buffers live at the same step; no plan can be smaller.
+    size_t getLowerBoundBytes() const;
+
+    bool   hasBuffer(const std::string& name) const;
+    size_t getOffset(const std::string& name) const;
+    size_t getSize(const std::string& name) const;
+
+    const std::vector<PlannedBuffer>& getBuffers() const
+    {
+        return buffers_;
+    }
+
+    // Checks that no two buffers live at the same step overlap in the arena and that all fit in it.
+    bool verify() const;
+
+    std::string toString() const;
+
+private:
+    size_t alignedSize(size_t size) const;
+    size_t getIndex(const std::string& name) const;
+
+    const size_t                            alignment_;
+    std::vector<PlannedBuffer>              buffers_;
+    std::unordered_map<std::string, size_t> indices_;
+    size_t                                  arena_bytes_ = 0;
+    bool                                    is_planned_  = false;
+};
+
+}  // namespace fastertransformer
@@ -16,9 +16,10 @@
 
 #include "src/fastertransformer/utils/logger.h"
 #include "src/fastertransformer/utils/memory_utils.h"
-#include "src/fastertransformer/kernels/quantization_int8_kernels.h"
+#include "src/fastertransformer/utils/int8_weight_utils.h"
 #include <curand_kernel.h>
 #include <cassert>
+#include <chrono>
 #include <type_traits>
 
 namespace fastertransformer {
@@ -92,6 +93,7 @@ template void deviceFill(__nv_bfloat16* devptr, int size, __nv_bfloat16 value, c
 #endif
 template void deviceFill(int* devptr, int size, int value, cudaStream_t stream);
 template void deviceFill(bool* devptr, int size, bool value, cudaStream_t stream);
+template void deviceFill(unsigned long long* devptr, int size, unsigned long long value, cudaStream_t stream);
 
 template<typename T>
 void cudaD2Hcpy(T* tgt, const T* src, const int size)
@@ -124,6 +126,7 @@ template void cudaH2Dcpy(int* tgt, const int* src, int size);
 template void cudaH2Dcpy(bool* tgt, const bool* src, int size);
 template void cudaH2Dcpy(unsigned long long* tgt, const unsigned long long* src, int size);
 template void cudaH2Dcpy(unsigned int* tgt, const unsigned int* src, int size);
+template void cudaH2Dcpy(int8_t* tgt, const int8_t* src, int size);
 
 template<typename T>
 void cudaD2Dcpy(T* tgt, const T* src, const int size)
@@ -275,44 +278,54 @@ int loadWeightFromBinFunc(T* ptr, std::vector<size_t> shape, std::string filenam
         FT_LOG_WARNING("shape is zero, skip loading weight from file %s \n", filename.c_str());
         return 0;
     }
-    std::vector<T_IN> host_array(size);
-    std::ifstream     in(filename, std::ios::in | std::ios::binary);
-    if (!in.is_open()) {
-        FT_LOG_WARNING("file %s cannot be opened, loading model fails! \n", filename.c_str());
-        return 0;
-    }
-
-    size_t loaded_data_size = sizeof(T_IN) * size;
-    in.seekg(0, in.end);
-    in.seekg(0, in.beg);
-
-    FT_LOG_DEBUG("Read " + std::to_string(loaded_data_size) + " bytes from " + filename);
-    in.read((char*)host_array.data(), loaded_data_size);
-
-    size_t in_get_size = in.gcount();
-    if (in_get_size != loaded_data_size) {
-        FT_LOG_WARNING("file %s only has %ld, but request %ld, loading model fails! \n",
-                       filename.c_str(),
-                       in_get_size,
-                       loaded_data_size);
+    std::vector<T_IN> host_array;
+    MmapFile          mapping;
+    const T_IN*       host_ptr = readWeightToHost(filename, size, host_array, mapping);
+    if (host_ptr == nullptr) {
         return 0;
     }
 
     if (std::is_same<T, T_IN>::value == true) {
-        cudaH2Dcpy(ptr, (T*)host_array.data(), size);
+        WeightLoadPhaseTimer timer(WeightLoadPhase::UPLOAD, sizeof(T) * size);
+        cudaH2Dcpy(ptr, (const T*)host_ptr, size);
     }
     else {
         T_IN* ptr_2 = nullptr;
         deviceMalloc(&ptr_2, size, false);
-        cudaH2Dcpy(ptr_2, host_array.data(), size);
-        invokeCudaD2DcpyConvert(ptr, ptr_2, size);
-        deviceFree(ptr_2);
+        {
+            WeightLoadPhaseTimer timer(WeightLoadPhase::UPLOAD, sizeof(T_IN) * size);
+            cudaH2Dcpy(ptr_2, host_ptr, size);
+        }
+        {
+            // deviceFree synchronizes, so the conversion kernel is included
+            WeightLoadPhaseTimer timer(WeightLoadPhase::CONVERT);
+            invokeCudaD2DcpyConvert(ptr, ptr_2, size);
+            deviceFree(ptr_2);
+        }
     }
-    in.close();
     return 0;
 }
 
 
+// int8_weight [dim1, dim0] and scales [dim1] of a [dim0, dim1] weight: int8WeightPerChannelLdkMultiplication reads
+// one scale per output channel, n = dim1.
+template<typename T>
+static void
+uploadInt8Weight(DenseWeight<T>& weight, const int8_t* int8_weight, const float* scales, size_t dim0, size_t dim1)
+{
+    int8_t* d_int8_weight;
+    float*  d_scale;
+    deviceMalloc(&d_int8_weight, dim0 * dim1, false);
+    deviceMalloc(&d_scale, dim1, false);
+    {
+        WeightLoadPhaseTimer timer(WeightLoadPhase::UPLOAD, sizeof(int8_t) * dim0 * dim1 + sizeof(float) * dim1);
+        cudaH2Dcpy(d_int8_weight, int8_weight, dim0 * dim1);
+        cudaH2Dcpy(d_scale, scales, dim1);
+    }
+    weight.int8_kernel = d_int8_weight;
+    weight.scale       = d_scale;
+}
+
 template<typename T, typename T_IN>
 int loadWeightFromBinFuncQ(DenseWeight<T> &weight, std::vector<size_t> shape, std::string filename)
 {
@@ -329,66 +342,28 @@ int loadWeightFromBinFuncQ(DenseWeight<T> &weight, std::vector<size_t> shape, st
         FT_LOG_WARNING("shape is zero, skip loading weight from file %s \n", filename.c_str());
         return 0;
     }
-    std::vector<T_IN> host_array(size);
-    std::ifstream     in(filename, std::ios::in | std::ios::binary);
-    if (!in.is_open()) {
-        FT_LOG_WARNING("file %s cannot be opened, loading model fails! \n", filename.c_str());
+    // a pre-quantized weight written by quantize_int8_weights skips the calibration and the quantization
+    Int8WeightFileReader int8_reader;
+    if (int8_reader.open(getInt8WeightFileName(filename), dim0, dim1, getFtCudaDataType<T_IN>(), filename)) {
+        FT_LOG_DEBUG("Load pre-quantized weight of " + filename);
+        uploadInt8Weight(weight, int8_reader.int8Weight(), int8_reader.scales(), dim0, dim1);
         return 0;
     }
 
-    size_t loaded_data_size = sizeof(T_IN) * size;
-    in.seekg(0, in.end);
-    in.seekg(0, in.beg);
-
-    FT_LOG_DEBUG("Read " + std::to_string(loaded_data_size) + " bytes from " + filename);
-    in.read((char*)host_array.data(), loaded_data_size);
-
-    size_t in_get_size = in.gcount();
-    if (in_get_size != loaded_data_size) {
-        FT_LOG_WARNING("file %s only has %ld, but request %ld, loading model fails! \n",
-                       filename.c_str(),
-                       in_get_size,
-                       loaded_data_size);
+    std::vector<T_IN> host_array;
+    MmapFile          mapping;
+    const T_IN*       host_ptr = readWeightToHost(filename, size, host_array, mapping);
+    if (host_ptr == nullptr) {
         return 0;
     }
-    auto scales = std::make_unique<float[]>(dim0);
-    auto invscales = std::make_unique<float[]>(dim0);
-    for(int i = 0; i < dim0; i++){
-        T_IN maxi = ((T_IN*)host_array.data())[i*dim1];
-        T_IN mini = ((T_IN*)host_array.data())[i*dim1];
-        for(int j = 0; j < dim1; j++){
-            T_IN data_i = *((T_IN*)host_array.data() + i*dim1 + j);
-            if((float)data_i > (float)maxi) maxi = data_i;
-            if((float)data_i < (float)mini) mini = data_i;
-        }
-        
-        assert(mini < (T_IN) 0);
-        float scale = (float)std::max((double)maxi / 127.0, (double)mini / 128.0);
-        float invs = 1.0f / scale;
-        scales[i] = scale;
-        invscales[i] = invs;
-        // FT_LOG_INFO("MAX: %f, MIN: %f", maxi, mini);
-    }
-
-    T_IN* d_data;
-    float* d_invscale;
-    int8_t* ikr;
-    float* d_scale;
-    deviceMalloc(&d_data, size, false);
-    deviceMalloc(&d_invscale, size, false);
-    deviceMalloc(&d_scale, size, false);
-    deviceMalloc(&ikr, size, false);
-    cudaH2Dcpy(d_invscale, invscales.get(), dim0);
-    cudaH2Dcpy(d_data, (T_IN*)host_array.data(), size);
-    cudaH2Dcpy(d_scale, scales.get(), dim0);
-    for(int i = 0; i < dim0; i++){
-        invokeQuantization((int8_t*)(ikr + dim1 * i), d_data + dim1 * i, dim1, d_scale + i, 0);
+    // quantize on the host so that the device only receives the int8 weight and the scales, one per output channel
+    std::vector<float>  scales(dim1);
+    std::vector<int8_t> int8_weight(size);
+    {
+        WeightLoadPhaseTimer timer(WeightLoadPhase::QUANTIZE);
+        calibrateAndQuantizeInt8WeightColumns(host_ptr, dim0, dim1, scales.data(), int8_weight.data());
     }
-    weight.int8_kernel = ikr;
-    weight.scale = d_scale;
-    deviceFree(d_data);
-    deviceFree(d_invscale);
-    in.close();
+    uploadInt8Weight(weight, int8_weight.data(), scales.data(), dim0, dim1);
     return 0;
 }
 
@@ -488,6 +463,23 @@ template int
 loadWeightFromBinQ(DenseWeight<__nv_bfloat16> &weight, std::vector<size_t> shape, std::string filename, FtCudaDataType model_file_type);
 #endif
 
+void loadLayersInParallel(int num_layer, const std::function<void(int)>& load_layer)
+{
+    ParallelWeightLoader loader;
+    const int            device = getDevice();
+    auto                 start  = std::chrono::steady_clock::now();
+    loader.run(
+        (size_t)num_layer,
+        [&load_layer](size_t l) { load_layer((int)l); },
+        [device]() { check_cuda_error(cudaSetDevice(device)); });
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    FT_LOG_INFO("Load %d layers with %d threads in %.2f ms, accumulated phases: %s",
+                num_layer,
+                loader.getNumThreads(),
+                std::chrono::duration<double, std::milli>(elapsed).count(),
+                getWeightLoadStats().toString().c_str());
+}
+
 template<typename T_IN, typename T_OUT>
 __global__ void cudaD2DcpyConvert(T_OUT* dst, const T_IN* src, const int size)
 {
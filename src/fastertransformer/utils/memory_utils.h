@@ -18,6 +18,7 @@
 
 #include "src/fastertransformer/utils/cuda_utils.h"
 #include "src/fastertransformer/layers/DenseWeight.h"
+#include "src/fastertransformer/utils/weight_loader.h"
 
 namespace fastertransformer {
 
@@ -60,6 +61,10 @@ int loadWeightFromBinQ(DenseWeight<T>                  &weight,
                       std::string         filename,
                       FtCudaDataType      model_file_type = FtCudaDataType::FP32);
 
+// Runs load_layer(l) for every l in [0, num_layer) on the weight loading thread pool (see setWeightLoadThreads).
+// The CUDA device of the calling thread is selected on every worker thread.
+void loadLayersInParallel(int num_layer, const std::function<void(int)>& load_layer);
+
 void invokeCudaD2DcpyHalf2Float(float* dst, half* src, const int size, cudaStream_t stream);
 void invokeCudaD2DcpyFloat2Half(half* dst, float* src, const int size, cudaStream_t stream);
 
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/fastertransformer/utils/mixed_decode_batch.h"
+#include "src/fastertransformer/utils/cuda_utils.h"
+
+#include <map>
+
+namespace fastertransformer {
+
+MixedDecodeBatch::MixedDecodeBatch(const int* beam_widths, size_t batch_size):
+    MixedDecodeBatch(std::vector<int>(beam_widths, beam_widths + batch_size))
+{
+}
+
+MixedDecodeBatch::MixedDecodeBatch(const std::vector<int>& beam_widths): beam_widths_(beam_widths)
+{
+    // sampling first, then beam search by increasing beam width
+    std::map<int, std::vector<int>> requests_by_width;
+    for (size_t i = 0; i < beam_widths_.size(); i++) {
+        FT_CHECK_WITH_INFO(beam_widths_[i] > 0,
+                           fmtstr("The beam width of request %ld must be positive, got %d.", i, beam_widths_[i]));
+        row_offsets_.push_back(row_offsets_.back() + beam_widths_[i]);
+        requests_by_width[beam_widths_[i]].push_back((int)i);
+    }
+
+    row_groups_.resize(getNumRows());
+    row_group_rows_.resize(getNumRows());
+    for (auto& it : requests_by_width) {
+        MixedDecodeGroup group;
+        group.beam_width = it.first;
+        group.requests   = std::move(it.second);
+        for (int request : group.requests) {
+            for (int row = row_offsets_[request]; row < row_offsets_[request + 1]; row++) {
+                row_groups_[row]     = (int)groups_.size();
+                row_group_rows_[row] = (int)group.rows.size();
+                group.rows.push_back(row);
+            }
+        }
+        groups_.push_back(std::move(group));
+    }
+}
+
+std::string MixedDecodeBatch::toString() const
+{
+    std::string groups;
+    for (const MixedDecodeGroup& group : groups_) {
+        groups += fmtstr("%s%d x %ld", groups.empty() ? "" : ", ", group.beam_width, group.requests.size());
+    }
+    return fmtstr("MixedDecodeBatch[batch_size=%ld, num_rows=%ld, groups (beam_width x requests)=[%s]]",
+                  getBatchSize(),
+                  getNumRows(),
+                  groups.c_str());
+}
+
+}  // namespace fastertransformer
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * Packed layout of a batch mixing beam search and sampling requests
+ *
+ * Each request has its own beam width, 1 for sampling. The rows of the batch (the beams) are packed request by request:
+ * the beams of request i are rows [row_offsets[i], row_offsets[i + 1]), so the batch holds sum(beam_widths) rows and
+ * no padding beams.
+ *
+ * The decoding layers work on a uniform beam width, so the requests are split into groups: one group of sampling
+ * requests, then one group per beam width, each with its requests in batch order. A group is decoded on its own rows,
+ * gathered from the packed batch ([outer, num_rows, inner] tensors such as logits, finished or output_ids) and scattered
+ * back afterwards. Beam indices (parent_ids, cache indirections) are local to a request and stay valid in both layouts.
+ **/
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace fastertransformer {
+
+struct MixedDecodeGroup {
+    int              beam_width;  // 1 for sampling
+    std::vector<int> requests;    // requests of the group, in batch order
+    std::vector<int> rows;        // packed row of each row of the group, the beams of a request being consecutive
+};
+
+class MixedDecodeBatch {
+public:
+    MixedDecodeBatch() = default;
+    explicit MixedDecodeBatch(const std::vector<int>& beam_widths);
+    MixedDecodeBatch(const int* beam_widths, size_t batch_size);
+
+    size_t getBatchSize() const
+    {
+        return beam_widths_.size();
+    }
+    // Number of packed rows, the sum of the beam widths.
+    size_t getNumRows() const
+    {
+        return row_offsets_.back();
+    }
+    int getBeamWidth(size_t request) const
+    {
+        return beam_widths_[request];
+    }
+    const std::vector<int>& getBeamWidths() const
+    {
+        return beam_widths_;
+    }
+    // [batch_size + 1], the beams of request i are rows [row_offsets[i], row_offsets[i + 1]).
+    const std::vector<int>& getRowOffsets() const
+    {
+        return row_offsets_;
+    }
+    const std::vector<MixedDecodeGroup>& getGroups() const
+    {
+        return groups_;
+    }
+    // Group and row in the group of each packed row.
+    const std::vector<int>& getRowGroups() const
+    {
+        return row_groups_;
+    }
+    const std::vector<int>& getRowGroupRows() const
+    {
+        return row_group_rows_;
+    }
+
+    std::string toString() const;
+
+private:
+    std::vector<int>              beam_widths_;
+    std::vector<int>              row_offsets_ = {0};
+    std::vector<MixedDecodeGroup> groups_;
+    std::vector<int>              row_groups_;
+    std::vector<int>              row_group_rows_;
+};
+
+// Host mirrors of invokeGatherRows / invokeScatterRows, for tensors [num_outer, num_rows, row_size]:
+//   gather:  dst[o, i, :] = src[o, indices[i], :], dst having num_indices rows and src num_src_rows rows.
+//   scatter: dst[o, indices[i], :] = src[o, i, :], the inverse, other rows of dst being left untouched.
+template<typename T>
+void gatherRows(T*         dst,
+                const T*   src,
+                const int* indices,
+                size_t     num_indices,
+                size_t     num_outer,
+                size_t     num_src_rows,
+                size_t     row_size)
+{
+    for (size_t o = 0; o < num_outer; o++) {
+        for (size_t i = 0; i < num_indices; i++) {
+            const T* from = src + (o * num_src_rows + indices[i]) * row_size;
+            T*       to   = dst + (o * num_indices + i) * row_size;
+            for (size_t k = 0; k < row_size; k++) {
+                to[k] = from[k];
+            }
+        }
+    }
+}
+
+template<typename T>
+void scatterRows(T*         dst,
+                 const T*   src,
+                 const int* indices,
+                 size_t     num_indices,
+                 size_t     num_outer,
+                 size_t     num_dst_rows,
+                 size_t     row_size)
+{
+    for (size_t o = 0; o < num_outer; o++) {
+        for (size_t i = 0; i < num_indices; i++) {
+            const T* from = src + (o * num_indices + i) * row_size;
+            T*       to   = dst + (o * num_dst_rows + indices[i]) * row_size;
+            for (size_t k = 0; k < row_size; k++) {
+                to[k] = from[k];
+            }
+        }
+    }
+}
+
+}  // namespace fastertransformer
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/fastertransformer/utils/mmap_utils.h"
+#include "src/fastertransformer/utils/logger.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+namespace fastertransformer {
+
+MmapFile::MmapFile(const std::string& filename, bool sequential)
+{
+    open(filename, sequential);
+}
+
+MmapFile::~MmapFile()
+{
+    close();
+}
+
+MmapFile::MmapFile(MmapFile&& other) noexcept:
+    filename_(std::move(other.filename_)), data_(other.data_), size_(other.size_), is_open_(other.is_open_)
+{
+    other.data_    = nullptr;
+    other.size_    = 0;
+    other.is_open_ = false;
+}
+
+MmapFile& MmapFile::operator=(MmapFile&& other) noexcept
+{
+    if (this != &other) {
+        close();
+        filename_      = std::move(other.filename_);
+        data_          = other.data_;
+        size_          = other.size_;
+        is_open_       = other.is_open_;
+        other.data_    = nullptr;
+        other.size_    = 0;
+        other.is_open_ = false;
+    }
+    return *this;
+}
+
+bool MmapFile::open(const std::string& filename, bool sequential)
+{
+    close();
+    filename_ = filename;
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        FT_LOG_DEBUG("file %s cannot be opened for mmap", filename.c_str());
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    size_ = (size_t)st.st_size;
+    if (size_ == 0) {
+        // mmap of an empty file is invalid, but an empty mapping is still a valid (empty) file.
+        ::close(fd);
+        is_open_ = true;
+        return true;
+    }
+
+    void* addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps its own reference to the file, the descriptor is no longer needed.
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        FT_LOG_WARNING("mmap of file %s (%ld bytes) fails", filename.c_str(), size_);
+        size_ = 0;
+        return false;
+    }
+    data_ = reinterpret_cast<char*>(addr);
+    if (sequential) {
+        madvise(data_, size_, MADV_SEQUENTIAL);
+    }
+    is_open_ = true;
+    FT_LOG_DEBUG("mmap %ld bytes from %s", size_, filename.c_str());
+    return true;
+}
+
+void MmapFile::close()
+{
+    if (data_ != nullptr) {
+        munmap(data_, size_);
+    }
+    data_    = nullptr;
+    size_    = 0;
+    is_open_ = false;
+}
+
+static void adviseRange(char* data, size_t size, size_t offset, size_t length, int advice)
+{
+    if (data == nullptr || offset >= size) {
+        return;
+    }
+    // madvise requires a page aligned start address.
+    const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t begin     = offset / page_size * page_size;
+    const size_t end       = std::min(size, offset + length);
+    madvise(data + begin, end - begin, advice);
+}
+
+void MmapFile::adviseWillNeed(size_t offset, size_t length) const
+{
+    adviseRange(data_, size_, offset, length, MADV_WILLNEED);
+}
+
+void MmapFile::adviseDontNeed(size_t offset, size_t length) const
+{
+    adviseRange(data_, size_, offset, length, MADV_DONTNEED);
+}
+
+}  // namespace fastertransformer
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace fastertransformer {
+
+// Read-only mapping of a whole file into the address space. Used by the weight loaders so that
+// tensor payloads can be fed to the copy/convert step straight from the page cache instead of
+// being read into an intermediate heap buffer first.
+class MmapFile {
+public:
+    MmapFile() = default;
+    explicit MmapFile(const std::string& filename, bool sequential = true);
+    ~MmapFile();
+
+    MmapFile(const MmapFile&) = delete;
+    MmapFile& operator=(const MmapFile&) = delete;
+    MmapFile(MmapFile&& other) noexcept;
+    MmapFile& operator=(MmapFile&& other) noexcept;
+
+    // Maps `filename`. When `sequential` is true the kernel is told the pages are read front to
+    // back (MADV_SEQUENTIAL), which enables aggressive read-ahead. Returns false on failure.
+    bool open(const std::string& filename, bool sequential = true);
+    void close();
+
+    bool isOpen() const
+    {
+        return is_open_;
+    }
+    const char* data() const
+    {
+        return data_;
+    }
+    size_t size() const
+    {
+        return size_;
+    }
+    const std::string& filename() const
+    {
+        return filename_;
+    }
+
+    // Hints for a sub-range, e.g. a single tensor of a packed checkpoint.
+    void adviseWillNeed(size_t offset, size_t length) const;
+    void adviseDontNeed(size_t offset, size_t length) const;
+
+private:
+    std::string filename_;
+    char*       data_    = nullptr;
+    size_t      size_    = 0;
+    bool        is_open_ = false;
+};
+
+}  // namespace fastertransformer
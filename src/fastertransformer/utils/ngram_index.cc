@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/fastertransformer/utils/ngram_index.h"
+#include "src/fastertransformer/utils/cuda_utils.h"
+
+#include <algorithm>
+
+namespace fastertransformer {
+
+// odd multiplier of the rolling hash, arithmetic is modulo 2^64
+static const uint64_t kBase = 0x9E3779B97F4A7C15ULL;
+
+NgramIndex::NgramIndex(size_t batch_size, size_t ngram_size): ngram_size_(ngram_size), rows_(batch_size)
+{
+    FT_CHECK_WITH_INFO(ngram_size_ > 0, "The n-gram size must be positive.");
+    leading_power_ = 1;
+    for (size_t i = 2; i < ngram_size_; i++) {
+        leading_power_ *= kBase;
+    }
+}
+
+void NgramIndex::reset()
+{
+    for (size_t row = 0; row < rows_.size(); row++) {
+        reset(row);
+    }
+}
+
+void NgramIndex::reset(size_t row)
+{
+    rows_[row] = Row();
+}
+
+void NgramIndex::add(size_t row_idx, int token)
+{
+    Row&         row    = rows_[row_idx];
+    const size_t prefix = ngram_size_ - 1;
+    const size_t length = row.tokens.size();
+    // the last n - 1 tokens and `token` form an n-gram
+    if (length >= prefix) {
+        row.next_positions[row.suffix_hash].push_back((int)length);
+    }
+
+    row.tokens.push_back(token);
+    if (prefix == 0) {
+        return;
+    }
+    // slide the window: drop the oldest token once the window is full, then append the new one
+    if (length >= prefix) {
+        row.suffix_hash -= leading_power_ * (uint64_t)(uint32_t)row.tokens[length - prefix];
+    }
+    row.suffix_hash = row.suffix_hash * kBase + (uint64_t)(uint32_t)token;
+}
+
+void NgramIndex::update(const int* tokens)
+{
+    for (size_t row = 0; row < rows_.size(); row++) {
+        add(row, tokens[row]);
+    }
+}
+
+void NgramIndex::gather(const int* parent_rows)
+{
+    std::vector<Row> rows(rows_.size());
+    std::vector<int> num_children(rows_.size(), 0);
+    for (size_t row = 0; row < rows_.size(); row++) {
+        FT_CHECK(parent_rows[row] >= 0 && (size_t)parent_rows[row] < rows_.size());
+        num_children[parent_rows[row]]++;
+    }
+    for (size_t row = 0; row < rows_.size(); row++) {
+        // the last child of a parent takes its row, the others copy it
+        const int parent = parent_rows[row];
+        if (--num_children[parent] == 0) {
+            rows[row] = std::move(rows_[parent]);
+        }
+        else {
+            rows[row] = rows_[parent];
+        }
+    }
+    rows_.swap(rows);
+}
+
+bool NgramIndex::matchesSuffix(const Row& row, size_t position) const
+{
+    const size_t prefix = ngram_size_ - 1;
+    const size_t length = row.tokens.size();
+    for (size_t i = 1; i <= prefix; i++) {
+        if (row.tokens[position - i] != row.tokens[length - i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void NgramIndex::getBannedTokens(size_t row_idx, std::vector<int>* tokens) const
+{
+    tokens->clear();
+    const Row& row = rows_[row_idx];
+    if (row.tokens.size() < ngram_size_ - 1) {
+        return;
+    }
+    const auto it = row.next_positions.find(row.suffix_hash);
+    if (it == row.next_positions.end()) {
+        return;
+    }
+    for (int position : it->second) {
+        if (matchesSuffix(row, position)) {
+            tokens->push_back(row.tokens[position]);
+        }
+    }
+    std::sort(tokens->begin(), tokens->end());
+    tokens->erase(std::unique(tokens->begin(), tokens->end()), tokens->end());
+}
+
+}  // namespace fastertransformer
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * N-gram index for no-repeat-n-gram blocking
+ *
+ * A sequence must not contain the same n-gram twice: the next token is banned when, with the last n - 1 tokens, it
+ * would form an n-gram already in the sequence. NgramIndex keeps for each row (each beam) its tokens and a hash table
+ * from the hash of every (n - 1)-gram to the positions where it is followed by a token. The hash of the last n - 1
+ * tokens is a rolling polynomial hash, updated in O(1) per token, so a step costs the number of earlier occurrences
+ * of the current (n - 1)-gram instead of the sequence length. Candidates are compared token by token, so a hash
+ * collision never bans a token.
+ *
+ * gather() follows the beam reordering of beam search (the parent ids that update_indir_cache_kernelLauncher applies
+ * to the KV cache indirection). The index is host-only.
+ **/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace fastertransformer {
+
+class NgramIndex {
+public:
+    NgramIndex(size_t batch_size, size_t ngram_size);
+
+    // Back to an empty sequence.
+    void reset();
+    void reset(size_t row);
+
+    // Appends a token to the row, e.g. the tokens of the prompt and then one generated token per step.
+    void add(size_t row, int token);
+    // Appends the tokens of a step, tokens is [batch_size].
+    void update(const int* tokens);
+    // Reorders the rows after a beam search step: row i continues the sequence of row parent_rows[i].
+    void gather(const int* parent_rows);
+
+    // Tokens that would repeat an n-gram of the row, without duplicates.
+    void getBannedTokens(size_t row, std::vector<int>* tokens) const;
+
+    size_t getBatchSize() const
+    {
+        return rows_.size();
+    }
+    size_t getNgramSize() const
+    {
+        return ngram_size_;
+    }
+    size_t getLength(size_t row) const
+    {
+        return rows_[row].tokens.size();
+    }
+
+private:
+    struct Row {
+        std::vector<int> tokens;
+        // hash of an (n - 1)-gram -> positions of the tokens following it
+        std::unordered_map<uint64_t, std::vector<int>> next_positions;
+        uint64_t                                       suffix_hash = 0;  // hash of the last n - 1 tokens
+    };
+
+    bool matchesSuffix(const Row& row, size_t position) const;
+
+    const size_t     ngram_size_;
+    uint64_t         leading_power_;  // kBase^(n - 2), weight of the oldest token of an (n - 1)-gram
+    std::vector<Row> rows_;
+};
+
+}  // namespace fastertransformer
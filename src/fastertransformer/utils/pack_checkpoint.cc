@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Converts a checkpoint directory of per-tensor .bin files into a single packed checkpoint
+// `<ckpt_dir>/model.ftpack`, which the weight loaders pick up through PackedCheckpointScope.
+// The .bin files carry no shape, so every tensor is recorded as 1-D; the loaders validate the element count.
+
+#include "src/fastertransformer/utils/packed_checkpoint.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <sys/stat.h>
+
+namespace ft = fastertransformer;
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2 && argc != 3 && argc != 4) {
+        printf("[ERROR] pack_checkpoint ckpt_dir [data_type] [alignment]\n");
+        printf("  data_type: data type of the .bin files, 0 FP32 (default), 1 FP16, 2 BF16\n");
+        printf("e.g. ./bin/pack_checkpoint ../models/j6b_ckpt/1-gpu 0 4096\n");
+        return 0;
+    }
+    const std::string        ckpt_dir  = argv[1];
+    const ft::FtCudaDataType data_type = argc > 2 ? static_cast<ft::FtCudaDataType>(atoi(argv[2])) : ft::FP32;
+    const size_t             alignment = argc > 3 ? (size_t)atol(argv[3]) : 4096;
+    const size_t             elem_size = ft::getFtCudaDataTypeSize(data_type);
+
+    DIR* dir = opendir(ckpt_dir.c_str());
+    if (dir == nullptr) {
+        printf("[ERROR] cannot open directory %s\n", ckpt_dir.c_str());
+        return -1;
+    }
+    std::vector<std::string> file_names;
+    for (struct dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".bin") == 0) {
+            file_names.push_back(name);
+        }
+    }
+    closedir(dir);
+    // sort to make the output deterministic
+    std::sort(file_names.begin(), file_names.end());
+
+    ft::PackedCheckpointWriter writer(alignment);
+    size_t                     total_size = 0;
+    for (const auto& name : file_names) {
+        const std::string path = ckpt_dir + "/" + name;
+        struct stat       st;
+        if (stat(path.c_str(), &st) != 0 || st.st_size % elem_size != 0) {
+            printf("[ERROR] %s is not a valid weight file of element size %ld\n", path.c_str(), elem_size);
+            return -1;
+        }
+        writer.addTensor(name.substr(0, name.size() - 4), data_type, {(size_t)st.st_size / elem_size}, path);
+        total_size += st.st_size;
+    }
+
+    const std::string output = ckpt_dir + "/" + ft::PACKED_CHECKPOINT_FILE_NAME;
+    if (!writer.write(output)) {
+        printf("[ERROR] fail to write %s\n", output.c_str());
+        return -1;
+    }
+    printf("[INFO] packed %ld tensors (%ld bytes) into %s\n", file_names.size(), total_size, output.c_str());
+    return 0;
+}
@@ -0,0 +1,349 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/fastertransformer/utils/packed_checkpoint.h"
+#include "src/fastertransformer/utils/memory_utils.h"
+
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+
+namespace fastertransformer {
+
+static const char     PACKED_CHECKPOINT_MAGIC[8]  = {'F', 'T', 'P', 'A', 'C', 'K', '0', '1'};
+static const uint32_t PACKED_CHECKPOINT_VERSION   = 1;
+static const size_t   PACKED_CHECKPOINT_HEADER_SIZE = 8 + 4 + 4 + 8 + 8;
+
+size_t getFtCudaDataTypeSize(FtCudaDataType data_type)
+{
+    switch (data_type) {
+        case FtCudaDataType::FP32:
+            return 4;
+        case FtCudaDataType::FP16:
+        case FtCudaDataType::BF16:
+            return 2;
+        default:
+            FT_CHECK_WITH_INFO(false, "Unknown FtCudaDataType " + std::to_string(data_type));
+    }
+    return 0;
+}
+
+static inline size_t alignTo(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+template<typename T>
+static inline void writeValue(std::ofstream& out, T value)
+{
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+PackedCheckpointWriter::PackedCheckpointWriter(size_t alignment): alignment_(alignment)
+{
+    FT_CHECK_WITH_INFO(alignment_ > 0 && (alignment_ & (alignment_ - 1)) == 0, "alignment must be a power of two");
+}
+
+void PackedCheckpointWriter::addTensor(const std::string&         name,
+                                       FtCudaDataType             data_type,
+                                       const std::vector<size_t>& shape,
+                                       const std::string&         source_file)
+{
+    size_t size_in_bytes = getFtCudaDataTypeSize(data_type);
+    for (size_t dim : shape) {
+        size_in_bytes *= dim;
+    }
+    tensors_.push_back({name, data_type, shape, 0, size_in_bytes});
+    source_files_.push_back(source_file);
+}
+
+bool PackedCheckpointWriter::write(const std::string& filename)
+{
+    size_t index_size = 0;
+    for (const auto& tensor : tensors_) {
+        index_size += 4 + tensor.name.size() + 4 + 4 + 8 * tensor.shape.size() + 8 + 8;
+    }
+    const size_t data_offset = alignTo(PACKED_CHECKPOINT_HEADER_SIZE + index_size, alignment_);
+    size_t       offset      = data_offset;
+    for (auto& tensor : tensors_) {
+        tensor.offset = offset;
+        offset        = alignTo(offset + tensor.size_in_bytes, alignment_);
+    }
+
+    std::ofstream out(filename, std::ios::out | std::ios::binary);
+    if (!out.is_open()) {
+        FT_LOG_ERROR("Fail to open file %s", filename.c_str());
+        return false;
+    }
+    out.write(PACKED_CHECKPOINT_MAGIC, sizeof(PACKED_CHECKPOINT_MAGIC));
+    writeValue<uint32_t>(out, PACKED_CHECKPOINT_VERSION);
+    writeValue<uint32_t>(out, (uint32_t)alignment_);
+    writeValue<uint64_t>(out, (uint64_t)tensors_.size());
+    writeValue<uint64_t>(out, (uint64_t)data_offset);
+    for (const auto& tensor : tensors_) {
+        writeValue<uint32_t>(out, (uint32_t)tensor.name.size());
+        out.write(tensor.name.data(), tensor.name.size());
+        writeValue<uint32_t>(out, (uint32_t)tensor.data_type);
+        writeValue<uint32_t>(out, (uint32_t)tensor.shape.size());
+        for (size_t dim : tensor.shape) {
+            writeValue<uint64_t>(out, (uint64_t)dim);
+        }
+        writeValue<uint64_t>(out, (uint64_t)tensor.offset);
+        writeValue<uint64_t>(out, (uint64_t)tensor.size_in_bytes);
+    }
+
+    std::vector<char> buffer;
+    for (size_t i = 0; i < tensors_.size(); i++) {
+        const PackedTensorInfo& tensor = tensors_[i];
+        // zero padding up to the aligned start of the tensor
+        buffer.assign(tensor.offset - (size_t)out.tellp(), 0);
+        out.write(buffer.data(), buffer.size());
+
+        std::ifstream in(source_files_[i], std::ios::in | std::ios::binary);
+        if (!in.is_open()) {
+            FT_LOG_ERROR("file %s cannot be opened, packing fails!", source_files_[i].c_str());
+            return false;
+        }
+        buffer.resize(tensor.size_in_bytes);
+        in.read(buffer.data(), tensor.size_in_bytes);
+        if ((size_t)in.gcount() != tensor.size_in_bytes) {
+            FT_LOG_ERROR("file %s only has %ld, but request %ld, packing fails!",
+                         source_files_[i].c_str(),
+                         (size_t)in.gcount(),
+                         tensor.size_in_bytes);
+            return false;
+        }
+        out.write(buffer.data(), tensor.size_in_bytes);
+    }
+    return out.good();
+}
+
+PackedCheckpointReader::PackedCheckpointReader(const std::string& filename)
+{
+    open(filename);
+}
+
+template<typename T>
+static inline bool readValue(const char* data, size_t size, size_t& pos, T& value)
+{
+    if (pos + sizeof(T) > size) {
+        return false;
+    }
+    memcpy(&value, data + pos, sizeof(T));
+    pos += sizeof(T);
+    return true;
+}
+
+bool PackedCheckpointReader::open(const std::string& filename)
+{
+    tensors_.clear();
+    index_.clear();
+    if (!mapping_.open(filename, true)) {
+        return false;
+    }
+    const char*  data = mapping_.data();
+    const size_t size = mapping_.size();
+    if (size < PACKED_CHECKPOINT_HEADER_SIZE || memcmp(data, PACKED_CHECKPOINT_MAGIC, 8) != 0) {
+        FT_LOG_ERROR("%s is not a packed checkpoint", filename.c_str());
+        mapping_.close();
+        return false;
+    }
+    size_t   pos         = 8;
+    uint32_t version     = 0;
+    uint32_t alignment   = 0;
+    uint64_t num_tensors = 0;
+    uint64_t data_offset = 0;
+    readValue(data, size, pos, version);
+    readValue(data, size, pos, alignment);
+    readValue(data, size, pos, num_tensors);
+    readValue(data, size, pos, data_offset);
+    if (version != PACKED_CHECKPOINT_VERSION) {
+        FT_LOG_ERROR("%s has packed checkpoint version %u, but %u is expected",
+                     filename.c_str(),
+                     version,
+                     PACKED_CHECKPOINT_VERSION);
+        mapping_.close();
+        return false;
+    }
+    // every index entry takes more than one byte, so a larger count cannot fit in the file
+    if (num_tensors > size) {
+        FT_LOG_ERROR("%s declares %lu tensors, more than its %ld bytes can hold",
+                     filename.c_str(),
+                     (unsigned long)num_tensors,
+                     size);
+        mapping_.close();
+        return false;
+    }
+
+    bool is_valid = true;
+    tensors_.resize(num_tensors);
+    for (size_t i = 0; i < num_tensors && is_valid; i++) {
+        PackedTensorInfo& tensor = tensors_[i];
+        uint32_t          name_len      = 0;
+        uint32_t          data_type     = 0;
+        uint32_t          num_dims      = 0;
+        uint64_t          offset        = 0;
+        uint64_t          size_in_bytes = 0;
+        is_valid = readValue(data, size, pos, name_len) && pos + name_len <= size;
+        if (!is_valid) {
+            break;
+        }
+        tensor.name.assign(data + pos, name_len);
+        pos += name_len;
+        is_valid = readValue(data, size, pos, data_type) && readValue(data, size, pos, num_dims);
+        for (uint32_t d = 0; is_valid && d < num_dims; d++) {
+            uint64_t dim = 0;
+            is_valid     = readValue(data, size, pos, dim);
+            if (!is_valid) {
+                break;
+            }
+            tensor.shape.push_back((size_t)dim);
+        }
+        is_valid = is_valid && readValue(data, size, pos, offset) && readValue(data, size, pos, size_in_bytes)
+                   && offset + size_in_bytes <= size;
+        tensor.data_type     = (FtCudaDataType)data_type;
+        tensor.offset        = (size_t)offset;
+        tensor.size_in_bytes = (size_t)size_in_bytes;
+        index_[tensor.name]  = i;
+    }
+    if (!is_valid) {
+        FT_LOG_ERROR("packed checkpoint %s is truncated or corrupted", filename.c_str());
+        tensors_.clear();
+        index_.clear();
+        mapping_.close();
+        return false;
+    }
+    FT_LOG_DEBUG("open packed checkpoint %s with %ld tensors", filename.c_str(), tensors_.size());
+    return true;
+}
+
+const PackedTensorInfo* PackedCheckpointReader::find(const std::string& name) const
+{
+    auto it = index_.find(name);
+    return it == index_.end() ? nullptr : &tensors_[it->second];
+}
+
+const char* PackedCheckpointReader::data(const PackedTensorInfo& info) const
+{
+    mapping_.adviseWillNeed(info.offset, info.size_in_bytes);
+    return mapping_.data() + info.offset;
+}
+
+// Registry of the packed checkpoints opened by PackedCheckpointScope, keyed by normalized directory.
+struct PackedCheckpointEntry {
+    std::shared_ptr<PackedCheckpointReader> reader;
+    int                                     ref_count;
+};
+
+static std::mutex& packedCheckpointMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+static std::unordered_map<std::string, PackedCheckpointEntry>& packedCheckpointRegistry()
+{
+    static std::unordered_map<std::string, PackedCheckpointEntry> registry;
+    return registry;
+}
+
+// Collapses repeated '/' and strips the trailing one, since callers build paths as dir_path + "/model...".
+static std::string normalizeDir(const std::string& dir_path)
+{
+    std::string dir;
+    for (char c : dir_path) {
+        if (c == '/' && !dir.empty() && dir.back() == '/') {
+            continue;
+        }
+        dir.push_back(c);
+    }
+    while (dir.size() > 1 && dir.back() == '/') {
+        dir.pop_back();
+    }
+    return dir.empty() ? std::string(".") : dir;
+}
+
+PackedCheckpointScope::PackedCheckpointScope(const std::string& dir_path): dir_path_(normalizeDir(dir_path))
+{
+    std::lock_guard<std::mutex> lock(packedCheckpointMutex());
+    auto&                       registry = packedCheckpointRegistry();
+    auto                        it       = registry.find(dir_path_);
+    if (it != registry.end()) {
+        it->second.ref_count++;
+        is_active_ = true;
+        return;
+    }
+    const std::string filename = dir_path_ + "/" + PACKED_CHECKPOINT_FILE_NAME;
+    if (!checkIfFileExist(filename)) {
+        return;
+    }
+    auto reader = std::make_shared<PackedCheckpointReader>(filename);
+    if (!reader->isOpen()) {
+        FT_LOG_WARNING("Fail to open packed checkpoint %s, fall back to .bin files.", filename.c_str());
+        return;
+    }
+    FT_LOG_INFO("Load weights from packed checkpoint %s", filename.c_str());
+    registry[dir_path_] = {reader, 1};
+    is_active_          = true;
+}
+
+PackedCheckpointScope::~PackedCheckpointScope()
+{
+    if (!is_active_) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(packedCheckpointMutex());
+    auto&                       registry = packedCheckpointRegistry();
+    auto                        it       = registry.find(dir_path_);
+    if (it != registry.end() && --it->second.ref_count == 0) {
+        registry.erase(it);
+    }
+}
+
+const char* findPackedTensor(const std::string& filename, const PackedTensorInfo** info)
+{
+    std::lock_guard<std::mutex> lock(packedCheckpointMutex());
+    auto&                       registry = packedCheckpointRegistry();
+    if (registry.empty()) {
+        return nullptr;
+    }
+    const size_t      pos  = filename.find_last_of('/');
+    const std::string dir  = pos == std::string::npos ? std::string(".") : normalizeDir(filename.substr(0, pos));
+    std::string       name = pos == std::string::npos ? filename : filename.substr(pos + 1);
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".bin") == 0) {
+        name.resize(name.size() - 4);
+    }
+
+    auto it = registry.find(dir);
+    if (it == registry.end()) {
+        return nullptr;
+    }
+    const PackedTensorInfo* tensor = it->second.reader->find(name);
+    if (tensor == nullptr) {
+        return nullptr;
+    }
+    *info = tensor;
+    return it->second.reader->data(*tensor);
+}
+
+bool checkIfWeightExist(const std::string& filename)
+{
+    const PackedTensorInfo* info = nullptr;
+    return findPackedTensor(filename, &info) != nullptr || checkIfFileExist(filename);
+}
+
+}  // namespace fastertransformer
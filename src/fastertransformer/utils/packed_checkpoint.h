@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Packed checkpoint: all the per-tensor .bin files of a checkpoint directory in one file.
+ *
+ * Layout (little endian):
+ *   header : char magic[8] = "FTPACK01", uint32 version, uint32 alignment, uint64 num_tensors, uint64 data_offset
+ *   index  : num_tensors x { uint32 name_len, char name[name_len], uint32 data_type (FtCudaDataType),
+ *                            uint32 num_dims, uint64 shape[num_dims], uint64 offset, uint64 size_in_bytes }
+ *   data   : tensor payloads, each one starting at a multiple of `alignment` from the beginning of the file.
+ *
+ * Tensor names are the original file names without the ".bin" suffix, e.g. "model.layers.0.attention.dense.weight.0".
+ **/
+
+#pragma once
+
+#include "src/fastertransformer/utils/cuda_utils.h"
+#include "src/fastertransformer/utils/mmap_utils.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace fastertransformer {
+
+// File name of the packed checkpoint inside a checkpoint directory.
+static const std::string PACKED_CHECKPOINT_FILE_NAME = "model.ftpack";
+
+struct PackedTensorInfo {
+    std::string         name;
+    FtCudaDataType      data_type;
+    std::vector<size_t> shape;
+    size_t              offset;
+    size_t              size_in_bytes;
+};
+
+size_t getFtCudaDataTypeSize(FtCudaDataType data_type);
+
+class PackedCheckpointWriter {
+public:
+    explicit PackedCheckpointWriter(size_t alignment = 4096);
+
+    // Registers the tensor stored in `source_file`. The payload is only read when write() is called.
+    void addTensor(const std::string&         name,
+                   FtCudaDataType             data_type,
+                   const std::vector<size_t>& shape,
+                   const std::string&         source_file);
+
+    // Writes the header, the index and then streams every source file into `filename`.
+    bool write(const std::string& filename);
+
+private:
+    size_t                        alignment_;
+    std::vector<PackedTensorInfo> tensors_;
+    std::vector<std::string>      source_files_;
+};
+
+class PackedCheckpointReader {
+public:
+    PackedCheckpointReader() = default;
+    explicit PackedCheckpointReader(const std::string& filename);
+
+    bool open(const std::string& filename);
+    bool isOpen() const
+    {
+        return mapping_.isOpen();
+    }
+
+    const PackedTensorInfo*              find(const std::string& name) const;
+    const char*                          data(const PackedTensorInfo& info) const;
+    const std::vector<PackedTensorInfo>& tensors() const
+    {
+        return tensors_;
+    }
+
+private:
+    MmapFile                                mapping_;
+    std::vector<PackedTensorInfo>           tensors_;
+    std::unordered_map<std::string, size_t> index_;
+};
+
+// Makes `<dir_path>/model.ftpack`, when it exists, visible to loadWeightFromBin for the lifetime of the object.
+// Weight files of that directory are then resolved in the packed checkpoint first and fall back to the
+// individual .bin files for the tensors it does not hold.
+class PackedCheckpointScope {
+public:
+    explicit PackedCheckpointScope(const std::string& dir_path);
+    ~PackedCheckpointScope();
+
+    PackedCheckpointScope(const PackedCheckpointScope&) = delete;
+    PackedCheckpointScope& operator=(const PackedCheckpointScope&) = delete;
+
+    bool isActive() const
+    {
+        return is_active_;
+    }
+
+private:
+    std::string dir_path_;
+    bool        is_active_ = false;
+};
+
+// Looks `filename` (e.g. "<dir>/model.wte.bin") up in the packed checkpoint registered for its directory.
+// Returns the payload and sets `info`, or returns nullptr if there is no such packed tensor.
+const char* findPackedTensor(const std::string& filename, const PackedTensorInfo** info);
+
+// checkIfFileExist that also accepts tensors held by an active packed checkpoint.
+bool checkIfWeightExist(const std::string& filename);
+
+}  // namespace fastertransformer
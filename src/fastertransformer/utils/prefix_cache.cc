@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/fastertransformer/utils/prefix_cache.h"
+#include "src/fastertransformer/utils/cuda_utils.h"
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <tuple>
+
+namespace fastertransformer {
+
+struct PrefixCacheNode {
+    std::vector<int> tokens;  // tokens of the edge from the parent, whole blocks
+    std::vector<int> blocks;  // one block per block_size tokens of the edge
+    PrefixCacheNode* parent = nullptr;
+    // children by the first block of their edge
+    std::map<std::vector<int>, std::unique_ptr<PrefixCacheNode>> children;
+    int                                                          ref_count   = 0;
+    uint64_t                                                     last_access = 0;
+};
+
+PrefixCache::PrefixCache(size_t block_size, size_t bytes_per_block, size_t max_bytes):
+    block_size_(block_size), bytes_per_block_(bytes_per_block), max_bytes_(max_bytes), root_(new PrefixCacheNode)
+{
+    FT_CHECK_WITH_INFO(block_size_ > 0, "block_size must be positive.");
+    FT_CHECK_WITH_INFO(bytes_per_block_ > 0, "bytes_per_block must be positive.");
+}
+
+PrefixCache::~PrefixCache() = default;
+
+std::vector<int> PrefixCache::getChunk(const std::vector<int>& tokens, size_t block) const
+{
+    return std::vector<int>(tokens.begin() + block * block_size_, tokens.begin() + (block + 1) * block_size_);
+}
+
+PrefixCacheNode* PrefixCache::splitNode(PrefixCacheNode* node, size_t num_blocks)
+{
+    // node keeps its tail below a new node holding its first num_blocks blocks. The new node is on the path of every
+    // match locking node, so it inherits its references.
+    PrefixCacheNode*                 parent = node->parent;
+    const std::vector<int>           key    = getChunk(node->tokens, 0);
+    std::unique_ptr<PrefixCacheNode> lower  = std::move(parent->children[key]);
+    std::unique_ptr<PrefixCacheNode> upper(new PrefixCacheNode);
+
+    upper->tokens.assign(lower->tokens.begin(), lower->tokens.begin() + num_blocks * block_size_);
+    upper->blocks.assign(lower->blocks.begin(), lower->blocks.begin() + num_blocks);
+    upper->parent      = parent;
+    upper->ref_count   = lower->ref_count;
+    upper->last_access = lower->last_access;
+
+    lower->tokens.erase(lower->tokens.begin(), lower->tokens.begin() + num_blocks * block_size_);
+    lower->blocks.erase(lower->blocks.begin(), lower->blocks.begin() + num_blocks);
+    lower->parent                               = upper.get();
+    upper->children[getChunk(lower->tokens, 0)] = std::move(lower);
+
+    PrefixCacheNode* split = upper.get();
+    parent->children[key]  = std::move(upper);
+    return split;
+}
+
+void PrefixCache::lockPath(PrefixCacheNode* node, int delta)
+{
+    for (; node != root_.get(); node = node->parent) {
+        node->ref_count += delta;
+        FT_CHECK(node->ref_count >= 0);
+    }
+}
+
+PrefixCacheNode* PrefixCache::walk(const std::vector<int>& tokens, size_t num_blocks, std::vector<int>* blocks)
+{
+    clock_++;
+    PrefixCacheNode* node    = root_.get();
+    size_t           matched = 0;
+    while (matched < num_blocks) {
+        auto it = node->children.find(getChunk(tokens, matched));
+        if (it == node->children.end()) {
+            break;
+        }
+        PrefixCacheNode* child = it->second.get();
+        // the key holds the first block, compare the next ones
+        size_t length = 1;
+        while (length < child->blocks.size() && matched + length < num_blocks
+               && std::equal(child->tokens.begin() + length * block_size_,
+                             child->tokens.begin() + (length + 1) * block_size_,
+                             tokens.begin() + (matched + length) * block_size_)) {
+            length++;
+        }
+        if (length < child->blocks.size()) {
+            child = splitNode(child, length);
+        }
+        child->last_access = clock_;
+        blocks->insert(blocks->end(), child->blocks.begin(), child->blocks.end());
+        matched += length;
+        node = child;
+    }
+    return node;
+}
+
+PrefixCacheMatch PrefixCache::match(const std::vector<int>& tokens, size_t max_tokens)
+{
+    PrefixCacheMatch result;
+    result.node       = walk(tokens, std::min(tokens.size(), max_tokens) / block_size_, &result.blocks);
+    result.num_tokens = result.blocks.size() * block_size_;
+    lockPath(result.node, 1);
+
+    stats_.num_lookups++;
+    stats_.num_hits += result.num_tokens > 0 ? 1 : 0;
+    stats_.num_tokens += tokens.size();
+    stats_.num_hit_tokens += result.num_tokens;
+    return result;
+}
+
+void PrefixCache::release(const PrefixCacheMatch& match)
+{
+    if (match.node != nullptr) {
+        lockPath(match.node, -1);
+    }
+}
+
+PrefixCacheInsertion PrefixCache::insert(const std::vector<int>& tokens, const std::vector<int>& blocks)
+{
+    const size_t num_blocks = tokens.size() / block_size_;
+    FT_CHECK_WITH_INFO(blocks.size() >= num_blocks,
+                       fmtstr("%lu tokens need %lu full blocks, got %lu.", tokens.size(), num_blocks, blocks.size()));
+
+    std::vector<int>     cached_blocks;
+    PrefixCacheNode*     node = walk(tokens, num_blocks, &cached_blocks);
+    PrefixCacheInsertion result;
+    result.num_cached = cached_blocks.size();
+
+    const size_t num_new = num_blocks - result.num_cached;
+    if (num_new > 0) {
+        // the path stays locked so the eviction does not drop the parent of the new blocks
+        lockPath(node, 1);
+        evict(max_bytes_ - std::min(max_bytes_, num_new * bytes_per_block_));
+        lockPath(node, -1);
+        result.num_inserted = std::min(num_new, (max_bytes_ - std::min(max_bytes_, getBytes())) / bytes_per_block_);
+        stats_.num_rejected += num_new - result.num_inserted;
+    }
+    if (result.num_inserted > 0) {
+        std::unique_ptr<PrefixCacheNode> leaf(new PrefixCacheNode);
+        leaf->tokens.assign(tokens.begin() + result.num_cached * block_size_,
+                            tokens.begin() + (result.num_cached + result.num_inserted) * block_size_);
+        leaf->blocks.assign(blocks.begin() + result.num_cached,
+                            blocks.begin() + result.num_cached + result.num_inserted);
+        leaf->parent                              = node;
+        leaf->last_access                         = clock_;
+        node->children[getChunk(leaf->tokens, 0)] = std::move(leaf);
+        num_blocks_ += result.num_inserted;
+    }
+    return result;
+}
+
+bool PrefixCache::evict(size_t max_bytes)
+{
+    if (getBytes() <= max_bytes) {
+        return true;
+    }
+
+    // least recently used unlocked leaves first, ties broken by block id to stay deterministic
+    using Candidate = std::tuple<uint64_t, int, PrefixCacheNode*>;
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> leaves;
+    std::vector<PrefixCacheNode*>                                                   stack{root_.get()};
+    while (!stack.empty()) {
+        PrefixCacheNode* node = stack.back();
+        stack.pop_back();
+        for (auto& child : node->children) {
+            stack.push_back(child.second.get());
+        }
+        if (node != root_.get() && node->children.empty() && node->ref_count == 0) {
+            leaves.emplace(node->last_access, node->blocks.front(), node);
+        }
+    }
+
+    while (getBytes() > max_bytes && !leaves.empty()) {
+        PrefixCacheNode* leaf = std::get<2>(leaves.top());
+        leaves.pop();
+        evicted_blocks_.insert(evicted_blocks_.end(), leaf->blocks.begin(), leaf->blocks.end());
+        num_blocks_ -= leaf->blocks.size();
+        stats_.num_evicted += leaf->blocks.size();
+
+        PrefixCacheNode* parent = leaf->parent;
+        parent->children.erase(getChunk(leaf->tokens, 0));
+        if (parent != root_.get() && parent->children.empty() && parent->ref_count == 0) {
+            leaves.emplace(parent->last_access, parent->blocks.front(), parent);
+        }
+    }
+    return getBytes() <= max_bytes;
+}
+
+std::vector<int> PrefixCache::popEvictedBlocks()
+{
+    std::vector<int> evicted;
+    evicted.swap(evicted_blocks_);
+    return evicted;
+}
+
+size_t PrefixCache::getNumNodes() const
+{
+    size_t                              num_nodes = 0;
+    std::vector<const PrefixCacheNode*> stack{root_.get()};
+    while (!stack.empty()) {
+        const PrefixCacheNode* node = stack.back();
+        stack.pop_back();
+        for (const auto& child : node->children) {
+            stack.push_back(child.second.get());
+            num_nodes++;
+        }
+    }
+    return num_nodes;
+}
+
+std::string PrefixCache::toString() const
+{
+    return fmtstr("PrefixCache[nodes=%lu, blocks=%lu, bytes=%lu/%lu, lookups=%lu, hits=%lu, hit_tokens=%lu/%lu, "
+                  "evicted=%lu, rejected=%lu]",
+                  getNumNodes(),
+                  num_blocks_,
+                  getBytes(),
+                  max_bytes_,
+                  stats_.num_lookups,
+                  stats_.num_hits,
+                  stats_.num_hit_tokens,
+                  stats_.num_tokens,
+                  stats_.num_evicted,
+                  stats_.num_rejected);
+}
+
+}  // namespace fastertransformer
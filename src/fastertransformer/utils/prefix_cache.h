@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * Cross-request prompt prefix cache
+ *
+ * Maps token prefixes to the blocks holding their KV so that requests sharing a prompt (e.g. a system prompt) only
+ * run the context phase on the tokens after the longest cached prefix. The cache is a radix tree whose edges are runs
+ * of whole blocks of block_size tokens: only full blocks are cached since the last, partial block of a sequence is
+ * still being written to. Edge i * block_size .. (i + 1) * block_size of a node is stored in node.blocks[i].
+ *
+ * The cache owns the blocks it holds and never frees them itself: blocks dropped by the LRU eviction are queued and
+ * returned by popEvictedBlocks(), to be given back to the pool they come from. A match locks its path until release()
+ * so that the blocks a running request reads are never evicted.
+ *
+ * The cache is host-only and not thread safe.
+ **/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace fastertransformer {
+
+struct PrefixCacheNode;
+
+struct PrefixCacheMatch {
+    size_t           num_tokens = 0;  // length of the cached prefix, a multiple of the block size
+    std::vector<int> blocks;          // blocks of the prefix, in order
+    PrefixCacheNode* node = nullptr;  // locked node, to release()
+};
+
+struct PrefixCacheInsertion {
+    size_t num_cached   = 0;  // leading blocks that were already cached, the caller keeps its copies
+    size_t num_inserted = 0;  // following blocks adopted by the cache
+};
+
+struct PrefixCacheStats {
+    size_t num_lookups    = 0;
+    size_t num_hits       = 0;
+    size_t num_tokens     = 0;  // tokens looked up
+    size_t num_hit_tokens = 0;  // tokens found in the cache
+    size_t num_evicted    = 0;  // blocks evicted
+    size_t num_rejected   = 0;  // blocks not inserted for lack of space
+};
+
+class PrefixCache {
+public:
+    PrefixCache(size_t block_size, size_t bytes_per_block, size_t max_bytes);
+    ~PrefixCache();
+
+    PrefixCache(const PrefixCache&) = delete;
+    PrefixCache& operator=(const PrefixCache&) = delete;
+
+    // Longest cached prefix of `tokens`. The prefix is locked against eviction until release(). At most
+    // `max_tokens` tokens are matched, e.g. to keep at least one token for the context phase.
+    PrefixCacheMatch match(const std::vector<int>& tokens, size_t max_tokens = SIZE_MAX);
+    // Unlocks the prefix of a match. Every match is released exactly once.
+    void release(const PrefixCacheMatch& match);
+
+    // Caches the full blocks of `tokens`, blocks[i] holding tokens i * block_size .. (i + 1) * block_size. Blocks
+    // that are already cached are skipped; the cache evicts unlocked prefixes to make room and inserts what fits.
+    PrefixCacheInsertion insert(const std::vector<int>& tokens, const std::vector<int>& blocks);
+
+    // Returns and clears the blocks dropped by the eviction.
+    std::vector<int> popEvictedBlocks();
+    // Evicts unlocked prefixes until at most `max_bytes` bytes are held. Returns whether it succeeded.
+    bool evict(size_t max_bytes);
+
+    size_t getBlockSize() const
+    {
+        return block_size_;
+    }
+    size_t getNumBlocks() const
+    {
+        return num_blocks_;
+    }
+    size_t getBytes() const
+    {
+        return num_blocks_ * bytes_per_block_;
+    }
+    size_t getMaxBytes() const
+    {
+        return max_bytes_;
+    }
+    size_t           getNumNodes() const;
+    PrefixCacheStats getStats() const
+    {
+        return stats_;
+    }
+    std::string toString() const;
+
+private:
+    // Follows the cached blocks of the first `num_blocks` blocks of `tokens`, appending them to `blocks`, and returns
+    // the node where the cached prefix ends. Refreshes the LRU order of the path.
+    PrefixCacheNode* walk(const std::vector<int>& tokens, size_t num_blocks, std::vector<int>* blocks);
+    PrefixCacheNode* splitNode(PrefixCacheNode* node, size_t num_blocks);
+    void             lockPath(PrefixCacheNode* node, int delta);
+    std::vector<int> getChunk(const std::vector<int>& tokens, size_t block) const;
+
+    const size_t block_size_;
+    const size_t bytes_per_block_;
+    const size_t max_bytes_;
+
+    std::unique_ptr<PrefixCacheNode> root_;
+    size_t                           num_blocks_ = 0;
+    uint64_t                         clock_      = 0;
+    std::vector<int>                 evicted_blocks_;
+    PrefixCacheStats                 stats_;
+};
+
+}  // namespace fastertransformer
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Quantizes the INT8 weights of a GPT-J checkpoint offline. For every layer and tensor parallel rank, the
+// attention.query_key_value weight [hidden_units, 3 * hidden_units / tensor_para_size] is calibrated and quantized
+// with the same rule as loadWeightFromBinQ and written to "<name>.int8" next to "<name>.bin".
+// GptJDecoderLayerWeightINT8 then uploads these files directly instead of quantizing at every startup.
+
+#include "src/fastertransformer/utils/int8_weight_utils.h"
+#include "src/fastertransformer/utils/weight_loader.h"
+
+#include <atomic>
+#include <sys/stat.h>
+
+namespace ft = fastertransformer;
+
+int main(int argc, char* argv[])
+{
+    if (argc != 4 && argc != 5) {
+        printf("[ERROR] quantize_int8_weights ckpt_dir num_layer hidden_units [tensor_para_size]\n");
+        printf("e.g. ./bin/quantize_int8_weights ../models/j6b_ckpt/1-gpu 28 4096 1\n");
+        return 0;
+    }
+    const std::string ckpt_dir         = argv[1];
+    const size_t      num_layer        = (size_t)atol(argv[2]);
+    const size_t      hidden_units     = (size_t)atol(argv[3]);
+    const size_t      tensor_para_size = argc > 4 ? (size_t)atol(argv[4]) : 1;
+    const size_t      dim0             = hidden_units;
+    const size_t      dim1             = 3 * hidden_units / tensor_para_size;
+
+    std::atomic<int> num_failed(0);
+    ft::ParallelWeightLoader loader;
+    loader.run(num_layer * tensor_para_size, [&](size_t task) {
+        const std::string filename = ckpt_dir + "/model.layers." + std::to_string(task / tensor_para_size)
+                                     + ".attention.query_key_value.weight." + std::to_string(task % tensor_para_size)
+                                     + ".bin";
+        struct stat source_stat;
+        std::vector<float> weight(dim0 * dim1);
+        if (stat(filename.c_str(), &source_stat) != 0
+            || ft::loadWeightFromBinToHost<float>(weight.data(), {dim0, dim1}, filename) != 0) {
+            printf("[ERROR] cannot load %s\n", filename.c_str());
+            num_failed++;
+            return;
+        }
+        // one scale per output channel
+        std::vector<float>  scales(dim1);
+        std::vector<int8_t> int8_weight(dim0 * dim1);
+        ft::calibrateAndQuantizeInt8WeightColumns(weight.data(), dim0, dim1, scales.data(), int8_weight.data());
+        const std::string int8_filename = ft::getInt8WeightFileName(filename);
+        if (!ft::writeInt8WeightFile(
+                int8_filename, dim0, dim1, ft::FP32, source_stat.st_size, scales.data(), int8_weight.data())) {
+            num_failed++;
+            return;
+        }
+        printf("[INFO] %s -> %s\n", filename.c_str(), int8_filename.c_str());
+    });
+    return num_failed == 0 ? 0 : -1;
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/fastertransformer/utils/request_cancellation.h"
+#include "src/fastertransformer/utils/cuda_utils.h"
+
+#include <algorithm>
+
+namespace fastertransformer {
+
+RequestCancellation::RequestCancellation(size_t batch_size):
+    batch_size_(batch_size),
+    cancelled_(new std::atomic<bool>[batch_size]),
+    deadlines_(batch_size, TimePoint::max()),
+    statuses_(batch_size, NOT_CANCELLED)
+{
+    for (size_t i = 0; i < batch_size_; i++) {
+        cancelled_[i].store(false, std::memory_order_relaxed);
+    }
+}
+
+size_t RequestCancellation::getBatchSize() const
+{
+    return batch_size_;
+}
+
+void RequestCancellation::cancel(size_t batch_idx)
+{
+    FT_CHECK_WITH_INFO(batch_idx < batch_size_, fmtstr("batch_idx %ld out of %ld requests", batch_idx, batch_size_));
+    cancelled_[batch_idx].store(true, std::memory_order_relaxed);
+}
+
+void RequestCancellation::setDeadline(size_t batch_idx, TimePoint deadline)
+{
+    FT_CHECK_WITH_INFO(batch_idx < batch_size_, fmtstr("batch_idx %ld out of %ld requests", batch_idx, batch_size_));
+    deadlines_[batch_idx] = deadline;
+}
+
+void RequestCancellation::reset()
+{
+    for (size_t i = 0; i < batch_size_; i++) {
+        cancelled_[i].store(false, std::memory_order_relaxed);
+    }
+    std::fill(deadlines_.begin(), deadlines_.end(), TimePoint::max());
+    std::fill(statuses_.begin(), statuses_.end(), NOT_CANCELLED);
+    num_stopped_ = 0;
+}
+
+void RequestCancellation::poll(int32_t* statuses, TimePoint now) const
+{
+    for (size_t i = 0; i < batch_size_; i++) {
+        if (statuses_[i] != NOT_CANCELLED) {
+            statuses[i] = statuses_[i];
+        }
+        else if (cancelled_[i].load(std::memory_order_relaxed)) {
+            statuses[i] = CANCELLED;
+        }
+        else if (now >= deadlines_[i]) {
+            statuses[i] = DEADLINE_EXCEEDED;
+        }
+        else {
+            statuses[i] = NOT_CANCELLED;
+        }
+    }
+}
+
+std::vector<size_t> RequestCancellation::commit(const int32_t* statuses)
+{
+    std::vector<size_t> stopped;
+    for (size_t i = 0; i < batch_size_; i++) {
+        if (statuses_[i] == NOT_CANCELLED && statuses[i] != NOT_CANCELLED) {
+            statuses_[i] = statuses[i];
+            stopped.push_back(i);
+        }
+    }
+    num_stopped_ += stopped.size();
+    return stopped;
+}
+
+std::vector<size_t> RequestCancellation::update(TimePoint now)
+{
+    std::vector<int32_t> statuses(batch_size_);
+    poll(statuses.data(), now);
+    return commit(statuses.data());
+}
+
+CancelStatus RequestCancellation::getStatus(size_t batch_idx) const
+{
+    return (CancelStatus)statuses_[batch_idx];
+}
+
+const int32_t* RequestCancellation::getStatuses() const
+{
+    return statuses_.data();
+}
+
+bool RequestCancellation::allStopped() const
+{
+    return num_stopped_ == batch_size_;
+}
+
+}  // namespace fastertransformer
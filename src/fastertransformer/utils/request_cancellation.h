@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * Cancellation of the requests of a batch during its generation
+ *
+ * A request may be cancelled from any thread, e.g. when its client disconnects, or given a deadline before the
+ * generation starts. The decoding loop checks them at the beginning of every step: the sequences of a stopped request
+ * are marked finished, so they are decoded no further and the generation ends once every sequence is finished, and
+ * the status of every request is reported in the outputs.
+ *
+ * Checking is split into poll(), which reads the flags and deadlines, and commit(), which applies statuses, so that
+ * with tensor or pipeline parallelism the statuses polled by the first rank can be broadcast and committed by all.
+ **/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace fastertransformer {
+
+enum CancelStatus : int32_t {
+    NOT_CANCELLED     = 0,
+    CANCELLED         = 1,
+    DEADLINE_EXCEEDED = 2
+};
+
+class RequestCancellation {
+public:
+    using Clock     = std::chrono::steady_clock;
+    using TimePoint = Clock::time_point;
+
+    explicit RequestCancellation(size_t batch_size);
+
+    size_t getBatchSize() const;
+
+    // May be called from any thread, at any time.
+    void cancel(size_t batch_idx);
+    // Called before the generation.
+    void setDeadline(size_t batch_idx, TimePoint deadline);
+    // Clears the flags, deadlines and statuses, to reuse it for another batch.
+    void reset();
+
+    // Writes the statuses of the requests at `now` into statuses [batch_size], without applying them.
+    void poll(int32_t* statuses, TimePoint now = Clock::now()) const;
+    // Applies statuses [batch_size] and returns the requests they stop. A stopped request stays stopped.
+    std::vector<size_t> commit(const int32_t* statuses);
+    // poll() then commit().
+    std::vector<size_t> update(TimePoint now = Clock::now());
+
+    CancelStatus   getStatus(size_t batch_idx) const;
+    const int32_t* getStatuses() const;
+    bool           allStopped() const;
+
+private:
+    const size_t                         batch_size_;
+    std::unique_ptr<std::atomic<bool>[]> cancelled_;
+    std::vector<TimePoint>               deadlines_;
+    std::vector<int32_t>                 statuses_;
+    size_t                               num_stopped_ = 0;
+};
+
+}  // namespace fastertransformer
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/fastertransformer/utils/request_cancellation_utils.h"
+#include "src/fastertransformer/utils/cuda_utils.h"
+#include "src/fastertransformer/utils/memory_utils.h"
+#include <vector>
+
+namespace fastertransformer {
+
+bool applyRequestCancellation(RequestCancellation* cancellation,
+                              bool*                finished,
+                              int*                 cancel_statuses_buf,
+                              const size_t         batch_size,
+                              const size_t         beam_width,
+                              NcclParam            tensor_para,
+                              NcclParam            pipeline_para,
+                              cudaStream_t         stream)
+{
+    FT_CHECK_WITH_INFO(
+        cancellation->getBatchSize() == batch_size,
+        fmtstr("The cancellation has %ld requests, the batch %ld", cancellation->getBatchSize(), batch_size));
+    std::vector<int32_t> statuses(batch_size);
+    cancellation->poll(statuses.data());
+    if (tensor_para.world_size_ > 1 || pipeline_para.world_size_ > 1) {
+        // the flags and clocks of the ranks may differ, rank 0 decides
+        cudaH2Dcpy(cancel_statuses_buf, statuses.data(), batch_size);
+        if (tensor_para.world_size_ > 1) {
+            ftNcclBroadCast(cancel_statuses_buf, batch_size, 0, tensor_para, stream);
+        }
+        if (pipeline_para.world_size_ > 1) {
+            ftNcclBroadCast(cancel_statuses_buf, batch_size, 0, pipeline_para, stream);
+        }
+        ftNcclStreamSynchronize(tensor_para, pipeline_para, stream);
+        cudaD2Hcpy(statuses.data(), cancel_statuses_buf, batch_size);
+    }
+    for (const size_t i : cancellation->commit(statuses.data())) {
+        FT_LOG_DEBUG("request %ld stopped: %s",
+                     i,
+                     statuses[i] == DEADLINE_EXCEEDED ? "deadline exceeded" : "cancelled");
+        check_cuda_error(cudaMemsetAsync(finished + i * beam_width, true, sizeof(bool) * beam_width, stream));
+    }
+    return cancellation->allStopped();
+}
+
+}  // namespace fastertransformer
@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "src/fastertransformer/utils/nccl_utils.h"
+#include "src/fastertransformer/utils/request_cancellation.h"
+#include <cuda_runtime.h>
+
+namespace fastertransformer {
+
+// Checks the cancellation at the beginning of a decoding step. With tensor or pipeline parallelism the statuses polled
+// by rank 0 are broadcast through cancel_statuses_buf [batch_size] on the device, so every rank stops the same
+// requests. The sequences of the requests stopped at this step are marked in finished [batch_size * beam_width].
+// Returns whether every request of the batch is stopped.
+bool applyRequestCancellation(RequestCancellation* cancellation,
+                              bool*                finished,
+                              int*                 cancel_statuses_buf,
+                              const size_t         batch_size,
+                              const size_t         beam_width,
+                              NcclParam            tensor_para,
+                              NcclParam            pipeline_para,
+                              cudaStream_t         stream);
+
+}  // namespace fastertransformer
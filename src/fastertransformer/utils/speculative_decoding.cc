@@ -0,0 +1,266 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/fastertransformer/utils/speculative_decoding.h"
+#include "src/fastertransformer/utils/cuda_utils.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace fastertransformer {
+
+// Samples from the unnormalized weights by inverse transform, skipping zero weights.
+static int sampleFromWeights(const std::vector<float>& weights, float total, CpuCurandState* state)
+{
+    const float rand_num = cpuCurandUniform(state) * total;
+    float       prefix   = 0.0f;
+    int         last     = -1;
+    for (size_t i = 0; i < weights.size(); i++) {
+        if (weights[i] <= 0.0f) {
+            continue;
+        }
+        prefix += weights[i];
+        last = (int)i;
+        if (rand_num <= prefix) {
+            return last;
+        }
+    }
+    // rounding left the prefix sum below rand_num
+    return last;
+}
+
+static int sampleFromProbs(const float* probs, size_t vocab_size, CpuCurandState* state)
+{
+    std::vector<float> weights(probs, probs + vocab_size);
+    float              total = 0.0f;
+    for (float w : weights) {
+        total += std::max(w, 0.0f);
+    }
+    FT_CHECK_WITH_INFO(total > 0.0f, "Cannot sample from an all-zero distribution.");
+    return sampleFromWeights(weights, total, state);
+}
+
+// Distributions over the vocabulary of rows of logits, at `temperature`.
+static void logitsToProbs(const float* logits,
+                          size_t       num_rows,
+                          size_t       vocab_size,
+                          size_t       vocab_size_padded,
+                          float        temperature,
+                          float*       probs)
+{
+    for (size_t r = 0; r < num_rows; r++) {
+        const float* row       = logits + r * vocab_size_padded;
+        float*       p         = probs + r * vocab_size;
+        const float  max_logit = *std::max_element(row, row + vocab_size);
+        float        total     = 0.0f;
+        for (size_t v = 0; v < vocab_size; v++) {
+            p[v] = std::exp((row[v] - max_logit) / temperature);
+            total += p[v];
+        }
+        for (size_t v = 0; v < vocab_size; v++) {
+            p[v] /= total;
+        }
+    }
+}
+
+static int argmax(const float* logits, size_t vocab_size)
+{
+    return (int)(std::max_element(logits, logits + vocab_size) - logits);
+}
+
+SpeculativeVerifier::SpeculativeVerifier(int end_id): end_id_(end_id) {}
+
+SpeculativeStepResult SpeculativeVerifier::commit(size_t                  sequence_length,
+                                                  const std::vector<int>& draft_ids,
+                                                  size_t                  num_accepted,
+                                                  int                     token)
+{
+    SpeculativeStepResult result;
+    result.tokens.assign(draft_ids.begin(), draft_ids.begin() + num_accepted);
+    result.tokens.push_back(token);
+    // nothing is generated after the end id
+    auto end = std::find(result.tokens.begin(), result.tokens.end(), end_id_);
+    if (end_id_ >= 0 && end != result.tokens.end()) {
+        result.tokens.erase(end + 1, result.tokens.end());
+        result.finished = true;
+    }
+    result.num_accepted = std::min(num_accepted, result.tokens.size());
+    // the target pass wrote the KV of the last committed token and of the drafts, the accepted ones stay valid
+    result.cache_length = sequence_length + result.num_accepted;
+
+    stats_.num_steps++;
+    stats_.num_draft_tokens += draft_ids.size();
+    stats_.num_accepted_tokens += result.num_accepted;
+    stats_.num_emitted_tokens += result.tokens.size();
+    return result;
+}
+
+SpeculativeStepResult
+SpeculativeVerifier::verifyGreedy(size_t sequence_length, const std::vector<int>& draft_ids, const int* target_ids)
+{
+    size_t num_accepted = 0;
+    while (num_accepted < draft_ids.size() && draft_ids[num_accepted] == target_ids[num_accepted]) {
+        num_accepted++;
+    }
+    return commit(sequence_length, draft_ids, num_accepted, target_ids[num_accepted]);
+}
+
+SpeculativeStepResult SpeculativeVerifier::verifySampling(size_t                  sequence_length,
+                                                          const std::vector<int>& draft_ids,
+                                                          const float*            draft_probs,
+                                                          const float*            target_probs,
+                                                          size_t                  vocab_size,
+                                                          CpuCurandState*         state)
+{
+    std::vector<float> residual(vocab_size);
+    for (size_t i = 0; i < draft_ids.size(); i++) {
+        const int id = draft_ids[i];
+        FT_CHECK_WITH_INFO(id >= 0 && (size_t)id < vocab_size,
+                           fmtstr("Draft token %d is out of the vocabulary of %lu tokens.", id, vocab_size));
+        const float* p = target_probs + i * vocab_size;
+        const float* q = draft_probs + i * vocab_size;
+
+        // accept with probability min(1, p / q), u in (0, 1]
+        const float u = cpuCurandUniform(state);
+        if (u * q[id] <= p[id] && p[id] > 0.0f) {
+            continue;
+        }
+
+        // rejected: resample from the part of p the draft does not cover
+        float total = 0.0f;
+        for (size_t v = 0; v < vocab_size; v++) {
+            residual[v] = std::max(p[v] - q[v], 0.0f);
+            total += residual[v];
+        }
+        const int token =
+            total > 0.0f ? sampleFromWeights(residual, total, state) : sampleFromProbs(p, vocab_size, state);
+        return commit(sequence_length, draft_ids, i, token);
+    }
+    // every draft accepted: one more token from the target distribution after the last one
+    const size_t num_drafts = draft_ids.size();
+    const int    token      = sampleFromProbs(target_probs + num_drafts * vocab_size, vocab_size, state);
+    return commit(sequence_length, draft_ids, num_drafts, token);
+}
+
+std::vector<int> SpeculativeVerifier::generate(const std::vector<int>&           input_ids,
+                                               const SpeculativeGenerationParam& param,
+                                               const SpeculativeForwardFn&       target,
+                                               const SpeculativeForwardFn&       draft)
+{
+    FT_CHECK_WITH_INFO(!input_ids.empty() && input_ids.size() < param.max_seq_len,
+                       fmtstr("The input (%lu tokens) must be non empty and shorter than max_seq_len (%lu).",
+                              input_ids.size(),
+                              param.max_seq_len));
+    FT_CHECK(param.vocab_size > 0 && param.vocab_size <= param.vocab_size_padded);
+    const bool   greedy            = param.temperature <= 0.0f;
+    const size_t vocab_size        = param.vocab_size;
+    const size_t vocab_size_padded = param.vocab_size_padded;
+
+    std::vector<float> target_logits((param.num_draft_tokens + 1) * vocab_size_padded);
+    std::vector<float> draft_logits(vocab_size_padded);
+    std::vector<float> target_probs(greedy ? 0 : (param.num_draft_tokens + 1) * vocab_size);
+    std::vector<float> draft_probs(greedy ? 0 : param.num_draft_tokens * vocab_size);
+    std::vector<int>   target_ids(param.num_draft_tokens + 1);
+    CpuCurandState     state;
+    cpuCurandInitialize(&state, 1, param.random_seed);
+
+    // the target gives the first token, the draft only fills its cache
+    std::vector<int> tokens = input_ids;
+    target(tokens.data(), tokens.size(), 0, 1, target_logits.data());
+    draft(tokens.data(), tokens.size(), 0, 0, nullptr);
+    size_t draft_cache_length = tokens.size();
+    if (greedy) {
+        tokens.push_back(argmax(target_logits.data(), vocab_size));
+    }
+    else {
+        logitsToProbs(target_logits.data(), 1, vocab_size, vocab_size_padded, param.temperature, target_probs.data());
+        tokens.push_back(sampleFromProbs(target_probs.data(), vocab_size, &state));
+    }
+    bool finished = end_id_ >= 0 && tokens.back() == end_id_;
+
+    std::vector<int> drafts;
+    std::vector<int> step_ids;
+    while (!finished && tokens.size() < param.max_seq_len) {
+        const size_t sequence_length = tokens.size();
+        // leave room for the target token
+        const size_t num_drafts = std::min(param.num_draft_tokens, param.max_seq_len - sequence_length - 1);
+        drafts.clear();
+        if (num_drafts > 0) {
+            // the draft catches up on the committed tokens it has not run, then runs its own proposals
+            draft(tokens.data() + draft_cache_length,
+                  sequence_length - draft_cache_length,
+                  draft_cache_length,
+                  1,
+                  draft_logits.data());
+            for (size_t i = 0; i < num_drafts; i++) {
+                if (i > 0) {
+                    draft(&drafts.back(), 1, sequence_length + i - 1, 1, draft_logits.data());
+                }
+                if (greedy) {
+                    drafts.push_back(argmax(draft_logits.data(), vocab_size));
+                }
+                else {
+                    float* q = draft_probs.data() + i * vocab_size;
+                    logitsToProbs(draft_logits.data(), 1, vocab_size, vocab_size_padded, param.temperature, q);
+                    drafts.push_back(sampleFromProbs(q, vocab_size, &state));
+                }
+            }
+            // the last draft was never run
+            draft_cache_length = sequence_length + num_drafts - 1;
+        }
+
+        step_ids.assign(1, tokens.back());
+        step_ids.insert(step_ids.end(), drafts.begin(), drafts.end());
+        target(step_ids.data(), step_ids.size(), sequence_length - 1, step_ids.size(), target_logits.data());
+
+        SpeculativeStepResult result;
+        if (greedy) {
+            for (size_t i = 0; i <= num_drafts; i++) {
+                target_ids[i] = argmax(target_logits.data() + i * vocab_size_padded, vocab_size);
+            }
+            result = verifyGreedy(sequence_length, drafts, target_ids.data());
+        }
+        else {
+            logitsToProbs(target_logits.data(),
+                          num_drafts + 1,
+                          vocab_size,
+                          vocab_size_padded,
+                          param.temperature,
+                          target_probs.data());
+            result =
+                verifySampling(sequence_length, drafts, draft_probs.data(), target_probs.data(), vocab_size, &state);
+        }
+        // rollback: the KV past cache_length belongs to rejected drafts, the next passes write over it
+        draft_cache_length = std::min(draft_cache_length, result.cache_length);
+        tokens.insert(tokens.end(), result.tokens.begin(), result.tokens.end());
+        finished = result.finished;
+    }
+    return tokens;
+}
+
+std::string SpeculativeVerifier::toString() const
+{
+    return fmtstr("SpeculativeVerifier[steps=%lu, drafted=%lu, accepted=%lu, emitted=%lu, acceptance_rate=%.3f, "
+                  "tokens_per_step=%.3f]",
+                  stats_.num_steps,
+                  stats_.num_draft_tokens,
+                  stats_.num_accepted_tokens,
+                  stats_.num_emitted_tokens,
+                  stats_.acceptanceRate(),
+                  stats_.tokensPerStep());
+}
+
+}  // namespace fastertransformer
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * Speculative decoding
+ *
+ * A small draft model proposes num_draft_tokens tokens d_1 .. d_N after the last committed token x. The target model
+ * then runs a single pass over x, d_1 .. d_N, giving its distributions at the N + 1 positions following them, and the
+ * verifier decides which prefix of the draft is kept:
+ *   - greedy: drafts are accepted while they equal the target argmax, then the target argmax is emitted.
+ *   - sampling: d_i is accepted with probability min(1, p_i(d_i) / q_i(d_i)), p the target and q the draft
+ *     distributions. The first rejected position emits a token sampled from max(0, p_i - q_i), renormalized, which
+ *     makes the emitted tokens follow the target distribution exactly.
+ * When every draft is accepted the target distribution after d_N gives one more token. A step thus emits between 1
+ * and N + 1 tokens.
+ *
+ * The verifier is host code and model agnostic. Callers keep the KV caches consistent with the committed tokens: both
+ * models wrote the KV of the speculated positions, SpeculativeStepResult::cache_length tells how many tokens of the
+ * sequence remain valid, the rest is rolled back (by resetting the sequence length, or KVBlockManager::
+ * truncateSequence for a paged cache). generate() runs the whole loop over two models given as SpeculativeForwardFn,
+ * which is how GptJ::forwardSpeculative and ParallelGpt::forwardSpeculative drive their draft and target models.
+ **/
+
+#pragma once
+
+#include "src/fastertransformer/kernels/cpu_sampling_kernels.h"
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace fastertransformer {
+
+struct SpeculativeStepResult {
+    size_t           num_accepted = 0;      // draft tokens kept
+    std::vector<int> tokens;                // tokens to commit: the accepted drafts and the target token
+    size_t           cache_length = 0;      // tokens of the sequence whose KV stays valid
+    bool             finished     = false;  // tokens ends with the end id
+};
+
+struct SpeculativeDecodingStats {
+    size_t num_steps           = 0;
+    size_t num_draft_tokens    = 0;  // tokens proposed by the draft model
+    size_t num_accepted_tokens = 0;  // proposed tokens kept
+    size_t num_emitted_tokens  = 0;  // tokens committed, target tokens included
+
+    SpeculativeDecodingStats& operator+=(const SpeculativeDecodingStats& other)
+    {
+        num_steps += other.num_steps;
+        num_draft_tokens += other.num_draft_tokens;
+        num_accepted_tokens += other.num_accepted_tokens;
+        num_emitted_tokens += other.num_emitted_tokens;
+        return *this;
+    }
+
+    double acceptanceRate() const
+    {
+        return num_draft_tokens == 0 ? 0.0 : (double)num_accepted_tokens / num_draft_tokens;
+    }
+    // Tokens committed per target model pass; 1 without speculation.
+    double tokensPerStep() const
+    {
+        return num_steps == 0 ? 0.0 : (double)num_emitted_tokens / num_steps;
+    }
+};
+
+// Runs a model over num_tokens tokens at positions start .. start + num_tokens - 1: the pass attends to the KV cache of
+// the positions before start, writes the KV of the tokens and copies the logits of the last num_logits of them to
+// `logits` ([num_logits, vocab_size_padded] on cpu). Positions from start on may hold the KV of rejected drafts, which
+// the pass overwrites.
+using SpeculativeForwardFn =
+    std::function<void(const int* token_ids, size_t num_tokens, size_t start, size_t num_logits, float* logits)>;
+
+struct SpeculativeGenerationParam {
+    size_t             num_draft_tokens  = 4;
+    size_t             max_seq_len       = 0;  // tokens of the sequence, input included
+    size_t             vocab_size        = 0;
+    size_t             vocab_size_padded = 0;     // row stride of the logits
+    float              temperature       = 0.0f;  // sampling from the full distributions, greedy when 0
+    unsigned long long random_seed       = 0;
+};
+
+class SpeculativeVerifier {
+public:
+    // end_id < 0 never finishes a sequence.
+    explicit SpeculativeVerifier(int end_id = -1);
+
+    // Greedy verification. `sequence_length` is the number of committed tokens before the step, the last of which was
+    // fed to the target pass. target_ids[i] is the target argmax after draft_ids[0 .. i - 1], i in [0, N].
+    SpeculativeStepResult
+    verifyGreedy(size_t sequence_length, const std::vector<int>& draft_ids, const int* target_ids);
+
+    // Rejection sampling verification. draft_probs is [N, vocab_size], the distributions draft_ids were sampled from;
+    // target_probs is [N + 1, vocab_size]. The random numbers are drawn from `state`, making a step deterministic.
+    SpeculativeStepResult verifySampling(size_t                  sequence_length,
+                                         const std::vector<int>& draft_ids,
+                                         const float*            draft_probs,
+                                         const float*            target_probs,
+                                         size_t                  vocab_size,
+                                         CpuCurandState*         state);
+
+    // Generates after input_ids until the end id or max_seq_len tokens and returns the sequence, input included. The
+    // target runs the input and gives the first token, then every step the draft proposes up to num_draft_tokens
+    // tokens one at a time and the target verifies them in a single pass.
+    std::vector<int> generate(const std::vector<int>&           input_ids,
+                              const SpeculativeGenerationParam& param,
+                              const SpeculativeForwardFn&       target,
+                              const SpeculativeForwardFn&       draft);
+
+    SpeculativeDecodingStats getStats() const
+    {
+        return stats_;
+    }
+    void resetStats()
+    {
+        stats_ = SpeculativeDecodingStats();
+    }
+    std::string toString() const;
+
+private:
+    SpeculativeStepResult
+    commit(size_t sequence_length, const std::vector<int>& draft_ids, size_t num_accepted, int token);
+
+    const int                end_id_;
+    SpeculativeDecodingStats stats_;
+};
+
+}  // namespace fastertransformer
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/fastertransformer/utils/stop_word_matcher.h"
+#include "src/fastertransformer/utils/cuda_utils.h"
+#include "src/fastertransformer/utils/token_trie.h"
+
+#include <algorithm>
+
+namespace fastertransformer {
+
+const int StopWordAutomaton::kRoot;
+
+StopWordAutomaton::StopWordAutomaton(const std::vector<std::vector<int>>& words)
+{
+    // the trie numbers its states breadth first, so the failure of a state is computed before its children's
+    const TokenTrie trie(words);
+    const size_t    num_states = trie.getNumStates();
+    for (size_t edge = 0; edge + 1 < num_states; edge++) {
+        const int token = trie.getEdgeToken(edge);
+        if (columns_.find(token) == columns_.end()) {
+            columns_.emplace(token, (int)columns_.size());
+        }
+    }
+    alphabet_size_ = columns_.size();
+
+    state_words_.assign(num_states, -1);
+    word_lengths_.resize(words.size());
+    for (size_t i = 0; i < words.size(); i++) {
+        int state = kRoot;
+        for (int token : words[i]) {
+            state = trie.step(state, token);
+        }
+        word_lengths_[i] = words[i].size();
+        if (!words[i].empty() && state_words_[state] < 0) {
+            state_words_[state] = (int)i;
+        }
+    }
+
+    std::vector<int> failures(num_states, kRoot);
+    transitions_.assign(num_states * alphabet_size_, kRoot);
+    match_words_.assign(num_states, -1);
+    output_links_.assign(num_states, -1);
+    for (size_t state = 0; state < num_states; state++) {
+        const int failure = failures[state];
+        if (state != kRoot) {
+            // the failure transitions of a state are the transitions of its failure, already complete
+            std::copy(transitions_.begin() + failure * alphabet_size_,
+                      transitions_.begin() + (failure + 1) * alphabet_size_,
+                      transitions_.begin() + state * alphabet_size_);
+            output_links_[state] = state_words_[failure] >= 0 ? failure : output_links_[failure];
+            match_words_[state]  = state_words_[state] >= 0 ? state_words_[state] : match_words_[failure];
+        }
+        for (int edge = trie.getChildBegin(state); edge < trie.getChildEnd(state); edge++) {
+            const int column = columns_.at(trie.getEdgeToken(edge));
+            const int child  = trie.getEdgeState(edge);
+            failures[child]  = state == kRoot ? kRoot : transitions_[failure * alphabet_size_ + column];
+            // the goto transitions override the ones inherited from the failure
+            transitions_[state * alphabet_size_ + column] = child;
+        }
+    }
+}
+
+StopWordAutomaton StopWordAutomaton::fromWordList(const std::vector<int>& word_list)
+{
+    FT_CHECK_WITH_INFO(word_list.size() % 2 == 0, "The word list must have two rows of the same length.");
+    return fromWordList(word_list.data(), word_list.size() / 2);
+}
+
+StopWordAutomaton StopWordAutomaton::fromWordList(const int* word_list, size_t word_list_len)
+{
+    return StopWordAutomaton(TokenTrie::parseWordList(word_list, word_list_len));
+}
+
+void StopWordAutomaton::getWords(int state, std::vector<int>* words) const
+{
+    words->clear();
+    if (state_words_[state] < 0) {
+        state = output_links_[state];
+    }
+    for (; state >= 0; state = output_links_[state]) {
+        words->push_back(state_words_[state]);
+    }
+}
+
+std::string StopWordAutomaton::toString() const
+{
+    return fmtstr("StopWordAutomaton[words=%lu, states=%lu, alphabet_size=%lu]",
+                  getNumWords(),
+                  getNumStates(),
+                  alphabet_size_);
+}
+
+StopWordMatcher::StopWordMatcher(const StopWordAutomaton* automaton, size_t batch_size):
+    automaton_(automaton), batch_size_(batch_size), states_(batch_size), lengths_(batch_size), matches_(batch_size)
+{
+    FT_CHECK(automaton_ != nullptr);
+    reset();
+}
+
+void StopWordMatcher::reset()
+{
+    for (size_t row = 0; row < batch_size_; row++) {
+        reset(row);
+    }
+}
+
+void StopWordMatcher::reset(size_t row)
+{
+    states_[row]  = StopWordAutomaton::kRoot;
+    lengths_[row] = 0;
+    matches_[row] = StopWordMatch();
+}
+
+bool StopWordMatcher::update(size_t row, int token)
+{
+    states_[row]   = automaton_->next(states_[row], token);
+    const int word = automaton_->getWord(states_[row]);
+    lengths_[row]++;
+    if (word < 0) {
+        return false;
+    }
+    if (matches_[row].word < 0) {
+        matches_[row].word  = word;
+        matches_[row].end   = lengths_[row];
+        matches_[row].start = lengths_[row] - automaton_->getWordLength(word);
+    }
+    return true;
+}
+
+void StopWordMatcher::update(const int* tokens, bool* finished)
+{
+    for (size_t row = 0; row < batch_size_; row++) {
+        if (!finished[row] && update(row, tokens[row])) {
+            finished[row] = true;
+        }
+    }
+}
+
+void StopWordMatcher::gather(const int* parent_rows)
+{
+    std::vector<int>           states(batch_size_);
+    std::vector<size_t>        lengths(batch_size_);
+    std::vector<StopWordMatch> matches(batch_size_);
+    for (size_t row = 0; row < batch_size_; row++) {
+        const int parent = parent_rows[row];
+        FT_CHECK(parent >= 0 && (size_t)parent < batch_size_);
+        states[row]  = states_[parent];
+        lengths[row] = lengths_[parent];
+        matches[row] = matches_[parent];
+    }
+    states_.swap(states);
+    lengths_.swap(lengths);
+    matches_.swap(matches);
+}
+
+}  // namespace fastertransformer
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * Aho-Corasick stop word matcher
+ *
+ * invokeStopWordsCriterion compares every stop word against the tail of every beam at each step. StopWordAutomaton
+ * compiles a stop word list into an Aho-Corasick automaton: the TokenTrie of the words completed with failure
+ * transitions into a dense table [num_states, alphabet_size], the alphabet being the distinct tokens of the list.
+ * Tokens outside the alphabet lead back to the root. Advancing a sequence by one token is a single table lookup, and
+ * the state tells which stop word, if any, ends at that token.
+ *
+ * StopWordMatcher keeps one automaton state per row (per beam) and records the first stop word matched with its
+ * position, so that clients can trim the output. The automaton is host-only; the table holds
+ * num_states * alphabet_size ints, fine for stop lists but not meant for lists spanning the vocabulary.
+ **/
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace fastertransformer {
+
+class StopWordAutomaton {
+public:
+    explicit StopWordAutomaton(const std::vector<std::vector<int>>& words);
+
+    // Builds the automaton from the [2, len] word list of read_word_list.
+    static StopWordAutomaton fromWordList(const std::vector<int>& word_list);
+    static StopWordAutomaton fromWordList(const int* word_list, size_t word_list_len);
+
+    static const int kRoot = 0;
+
+    // State after reading `token` in `state`.
+    int next(int state, int token) const
+    {
+        const auto it = columns_.find(token);
+        return it == columns_.end() ? kRoot : transitions_[state * alphabet_size_ + it->second];
+    }
+    // Longest stop word ending at `state`, -1 if none. Words are numbered in list order.
+    int getWord(int state) const
+    {
+        return match_words_[state];
+    }
+    // Every stop word ending at `state`, longest first.
+    void getWords(int state, std::vector<int>* words) const;
+
+    size_t getWordLength(int word) const
+    {
+        return word_lengths_[word];
+    }
+    size_t getNumWords() const
+    {
+        return word_lengths_.size();
+    }
+    size_t getNumStates() const
+    {
+        return match_words_.size();
+    }
+    size_t getAlphabetSize() const
+    {
+        return alphabet_size_;
+    }
+    std::string toString() const;
+
+private:
+    std::unordered_map<int, int> columns_;       // token -> column of the transition table
+    std::vector<int>             transitions_;   // [num_states, alphabet_size]
+    std::vector<int>             state_words_;   // word spelled by the state, -1 if none
+    std::vector<int>             match_words_;   // longest word that is a suffix of the state, -1 if none
+    std::vector<int>             output_links_;  // longest proper suffix state spelling a word, -1 if none
+    std::vector<size_t>          word_lengths_;
+    size_t                       alphabet_size_ = 0;
+};
+
+struct StopWordMatch {
+    int    word  = -1;  // matched stop word, -1 if none
+    size_t start = 0;   // position of its first token in the sequence fed to the matcher
+    size_t end   = 0;   // position after its last token
+};
+
+class StopWordMatcher {
+public:
+    // `batch_size` rows, i.e. batch_size * beam_width when decoding with beams.
+    StopWordMatcher(const StopWordAutomaton* automaton, size_t batch_size);
+
+    // Back to an empty sequence.
+    void reset();
+    void reset(size_t row);
+
+    // Advances the row by one token. Returns whether a stop word ends at this token; only the first match of a row is
+    // recorded.
+    bool update(size_t row, int token);
+    // Advances every row that is not finished by tokens[row] and sets finished for the rows that hit a stop word, as
+    // invokeStopWordsCriterion does. tokens and finished are [batch_size].
+    void update(const int* tokens, bool* finished);
+    // Reorders the rows after a beam search step: row i continues the sequence of row parent_rows[i].
+    void gather(const int* parent_rows);
+
+    StopWordMatch getMatch(size_t row) const
+    {
+        return matches_[row];
+    }
+    bool isMatched(size_t row) const
+    {
+        return matches_[row].word >= 0;
+    }
+    // Number of tokens fed to the row since the last reset.
+    size_t getLength(size_t row) const
+    {
+        return lengths_[row];
+    }
+
+private:
+    const StopWordAutomaton* automaton_;
+    const size_t             batch_size_;
+
+    std::vector<int>           states_;
+    std::vector<size_t>        lengths_;
+    std::vector<StopWordMatch> matches_;
+};
+
+}  // namespace fastertransformer
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host-only benchmark of the two stop word criteria over a generation of `steps` tokens:
+//   scan:      cpuStopWordsCriterion, the host mirror of invokeStopWordsCriterion, comparing every stop word against
+//              the tail of every row at each step.
+//   automaton: StopWordMatcher, advancing one Aho-Corasick state per row at each step.
+// The generated tokens are random over a small vocabulary so that partial matches are frequent; rows are not finished
+// by a match, so that both criteria do the same work at every step.
+
+#include "src/fastertransformer/kernels/cpu_sampling_kernels.h"
+#include "src/fastertransformer/utils/stop_word_matcher.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace ft = fastertransformer;
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        printf("[ERROR] stop_word_matcher_benchmark num_words [max_word_len] [batch_size] [steps] [vocab_size]\n");
+        printf("e.g. ./bin/stop_word_matcher_benchmark 1000 4 64 256 64\n");
+        return 0;
+    }
+    const int num_words    = atoi(argv[1]);
+    const int max_word_len = argc > 2 ? atoi(argv[2]) : 4;
+    const int batch_size   = argc > 3 ? atoi(argv[3]) : 64;
+    const int steps        = argc > 4 ? atoi(argv[4]) : 256;
+    const int vocab_size   = argc > 5 ? atoi(argv[5]) : 64;
+
+    std::mt19937                       gen(0);
+    std::uniform_int_distribution<int> token_dist(0, vocab_size - 1);
+    std::uniform_int_distribution<int> length_dist(1, max_word_len);
+
+    // [batch_size, 2, stop_words_len], the same list for every row
+    std::vector<int> ids, offsets;
+    for (int i = 0; i < num_words; i++) {
+        const int length = length_dist(gen);
+        for (int j = 0; j < length; j++) {
+            ids.push_back(token_dist(gen));
+        }
+        offsets.push_back((int)ids.size());
+    }
+    offsets.resize(ids.size(), -1);
+    std::vector<int> word_list = ids;
+    word_list.insert(word_list.end(), offsets.begin(), offsets.end());
+    std::vector<int> stop_words;
+    for (int i = 0; i < batch_size; i++) {
+        stop_words.insert(stop_words.end(), word_list.begin(), word_list.end());
+    }
+
+    std::vector<int> output_ids((size_t)steps * batch_size);
+    for (int& id : output_ids) {
+        id = token_dist(gen);
+    }
+
+    auto                        start     = std::chrono::high_resolution_clock::now();
+    const ft::StopWordAutomaton automaton = ft::StopWordAutomaton::fromWordList(word_list);
+    auto                        end       = std::chrono::high_resolution_clock::now();
+    const double                build_ms  = std::chrono::duration<double, std::milli>(end - start).count();
+    printf("[INFO] %s built in %.2f ms\n", automaton.toString().c_str(), build_ms);
+    printf("[INFO] num_words: %d, max_word_len: %d, batch_size: %d, steps: %d, vocab_size: %d\n",
+           num_words,
+           max_word_len,
+           batch_size,
+           steps,
+           vocab_size);
+
+    size_t                  num_matches[2] = {0, 0};
+    std::unique_ptr<bool[]> finished(new bool[batch_size]);
+    const char*             names[2]       = {"scan", "automaton"};
+    for (int mode = 0; mode < 2; mode++) {
+        ft::StopWordMatcher matcher(&automaton, batch_size);
+        start = std::chrono::high_resolution_clock::now();
+        for (int step = 0; step < steps; step++) {
+            std::fill(finished.get(), finished.get() + batch_size, false);
+            if (mode == 0) {
+                ft::cpuStopWordsCriterion(
+                    output_ids.data(), nullptr, stop_words.data(), finished.get(), 0, ids.size(), batch_size, 1, step);
+            }
+            else {
+                matcher.update(output_ids.data() + (size_t)step * batch_size, finished.get());
+            }
+            for (int b = 0; b < batch_size; b++) {
+                num_matches[mode] += finished[b] ? 1 : 0;
+            }
+        }
+        end             = std::chrono::high_resolution_clock::now();
+        const double ms = std::chrono::duration<double, std::milli>(end - start).count();
+        printf("[INFO] %-9s : %10.4f ms total, %8.3f us/step, %lu matches\n",
+               names[mode],
+               ms,
+               ms * 1e3 / steps,
+               num_matches[mode]);
+    }
+    if (num_matches[0] != num_matches[1]) {
+        printf("[ERROR] the criteria disagree\n");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/fastertransformer/utils/token_count_table.h"
+#include "src/fastertransformer/utils/cuda_utils.h"
+
+namespace fastertransformer {
+
+TokenCountTable::TokenCountTable(size_t batch_size): rows_(batch_size) {}
+
+void TokenCountTable::reset()
+{
+    for (size_t row = 0; row < rows_.size(); row++) {
+        reset(row);
+    }
+}
+
+void TokenCountTable::reset(size_t row)
+{
+    rows_[row].tokens.clear();
+    rows_[row].counts.clear();
+    rows_[row].index.clear();
+}
+
+int TokenCountTable::find(Row& row, int token)
+{
+    FT_CHECK_WITH_INFO(token >= 0, fmtstr("Invalid token %d.", token));
+    auto it = row.index.find(token);
+    if (it != row.index.end()) {
+        return it->second;
+    }
+    row.tokens.push_back(token);
+    row.counts.push_back(0);
+    row.index.emplace(token, (int)row.tokens.size() - 1);
+    return (int)row.tokens.size() - 1;
+}
+
+void TokenCountTable::addPrompt(size_t row, const int* tokens, size_t length)
+{
+    for (size_t i = 0; i < length; i++) {
+        find(rows_[row], tokens[i]);
+    }
+}
+
+void TokenCountTable::add(size_t row, int token)
+{
+    rows_[row].counts[find(rows_[row], token)]++;
+}
+
+void TokenCountTable::update(const int* tokens, const bool* finished)
+{
+    for (size_t row = 0; row < rows_.size(); row++) {
+        if (finished == nullptr || !finished[row]) {
+            add(row, tokens[row]);
+        }
+    }
+}
+
+void TokenCountTable::gather(const int* parent_rows)
+{
+    std::vector<Row> rows(rows_.size());
+    for (size_t row = 0; row < rows_.size(); row++) {
+        FT_CHECK(parent_rows[row] >= 0 && (size_t)parent_rows[row] < rows_.size());
+        rows[row] = rows_[parent_rows[row]];
+    }
+    rows_.swap(rows);
+}
+
+int TokenCountTable::getCount(size_t row, int token) const
+{
+    const auto it = rows_[row].index.find(token);
+    return it == rows_[row].index.end() ? 0 : rows_[row].counts[it->second];
+}
+
+void applyTokenCountPenalties(float*                 logits,
+                              const TokenCountTable& table,
+                              const float*           repetition_penalties,
+                              const float*           presence_penalties,
+                              const float*           frequency_penalties,
+                              const int              batch_size,
+                              const int              vocab_size,
+                              const int              vocab_size_padded)
+{
+    FT_CHECK(table.getBatchSize() >= (size_t)batch_size);
+    for (int batch_idx = 0; batch_idx < batch_size; batch_idx++) {
+        const float repetition = repetition_penalties != nullptr ? repetition_penalties[batch_idx] : 1.0f;
+        const float presence   = presence_penalties != nullptr ? presence_penalties[batch_idx] : 0.0f;
+        const float frequency  = frequency_penalties != nullptr ? frequency_penalties[batch_idx] : 0.0f;
+        if (repetition == 1.0f && presence == 0.0f && frequency == 0.0f) {
+            continue;
+        }
+
+        // the tokens are distinct, so every logit is penalized once from its original value
+        float*       row    = logits + batch_idx * vocab_size_padded;
+        const int*   tokens = table.getTokens(batch_idx);
+        const int*   counts = table.getCounts(batch_idx);
+        const size_t size   = table.getNumDistinct(batch_idx);
+        for (size_t i = 0; i < size; i++) {
+            const int token = tokens[i];
+            FT_CHECK_WITH_INFO(token < vocab_size, fmtstr("Token %d is out of the vocabulary.", token));
+            float logit = row[token];
+            if (repetition != 1.0f) {
+                logit = logit < 0.0f ? logit * repetition : logit / repetition;
+            }
+            if (counts[i] > 0) {
+                logit -= presence + frequency * counts[i];
+            }
+            row[token] = logit;
+        }
+    }
+}
+
+}  // namespace fastertransformer
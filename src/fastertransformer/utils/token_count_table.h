@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * Token count table and additive sampling penalties
+ *
+ * invokeBatchApplyRepetitionPenalty scans the whole output_ids history at every step to find the tokens already seen.
+ * TokenCountTable instead keeps, for each sequence, the distinct tokens seen so far with their number of occurrences,
+ * updated by one token per step. Penalties then cost the number of distinct tokens of the sequence, not its length.
+ *
+ * applyTokenCountPenalties applies, per request:
+ *   - the repetition penalty of invokeBatchApplyRepetitionPenalty: the logit of every token of the prompt or of the
+ *     generated tokens is divided by the penalty when positive, multiplied when negative.
+ *   - OpenAI style presence and frequency penalties over the generated tokens:
+ *     logit -= presence_penalty * (count > 0) + frequency_penalty * count.
+ * The repetition penalty is applied first. Each penalty is off at its neutral value (1 for the repetition penalty, 0
+ * for the others), and rows with only neutral values are skipped.
+ *
+ * The table and the penalties are the host reference of the device table of BaseSamplingLayer, see
+ * invokeUpdateTokenCounts and invokeBatchApplyTokenCountPenalty.
+ **/
+
+#pragma once
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+namespace fastertransformer {
+
+class TokenCountTable {
+public:
+    explicit TokenCountTable(size_t batch_size);
+
+    // Back to an empty sequence.
+    void reset();
+    void reset(size_t row);
+
+    // Records the prompt of a row, seen by the repetition penalty only.
+    void addPrompt(size_t row, const int* tokens, size_t length);
+    // Records a generated token.
+    void add(size_t row, int token);
+    // Records the tokens generated at a step, tokens is [batch_size]. Rows with finished set are skipped.
+    void update(const int* tokens, const bool* finished = nullptr);
+    // Reorders the rows after a beam search step: row i continues the sequence of row parent_rows[i].
+    void gather(const int* parent_rows);
+
+    size_t getBatchSize() const
+    {
+        return rows_.size();
+    }
+    // Distinct tokens of the row, prompt included: getTokens(row)[i] was generated getCounts(row)[i] times.
+    size_t getNumDistinct(size_t row) const
+    {
+        return rows_[row].tokens.size();
+    }
+    const int* getTokens(size_t row) const
+    {
+        return rows_[row].tokens.data();
+    }
+    const int* getCounts(size_t row) const
+    {
+        return rows_[row].counts.data();
+    }
+    // Number of times `token` was generated in the row.
+    int getCount(size_t row, int token) const;
+
+private:
+    struct Row {
+        std::vector<int>             tokens;
+        std::vector<int>             counts;  // generated occurrences, 0 for tokens only seen in the prompt
+        std::unordered_map<int, int> index;   // token -> position in tokens
+    };
+
+    // Position of `token` in the row, added with a zero count if new.
+    int find(Row& row, int token);
+
+    std::vector<Row> rows_;
+};
+
+// Applies the penalties to logits [batch_size, vocab_size_padded] from the counts of `table`. Each penalty array is
+// [batch_size] and may be nullptr when the penalty is unused.
+void applyTokenCountPenalties(float*                 logits,
+                              const TokenCountTable& table,
+                              const float*           repetition_penalties,
+                              const float*           presence_penalties,
+                              const float*           frequency_penalties,
+                              const int              batch_size,
+                              const int              vocab_size,
+                              const int              vocab_size_padded);
+
+}  // namespace fastertransformer
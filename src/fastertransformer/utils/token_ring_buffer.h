@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * Streaming of the generated tokens
+ *
+ * The decoding loop publishes the tokens generated at each step into a bounded ring buffer, one entry per sequence,
+ * instead of handing the whole output tensors to a callback. Consumer threads drain the ring at their own pace, so
+ * the per-step cost of the decoding loop is proportional to the batch, not to the length generated so far.
+ *
+ * SpmcRingBuffer is a lock-free bounded queue with a single producer and any number of consumers, each entry being
+ * popped by exactly one consumer. Every cell carries a sequence number telling whether it holds the entry of the
+ * current lap (Vyukov's bounded queue): the producer only touches the head and consumers claim entries by moving the
+ * tail with a compare-and-swap. Neither side ever waits on a lock; a full ring makes tryPush() fail and an empty one
+ * makes tryPop() fail.
+ **/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+
+namespace fastertransformer {
+
+template<typename T>
+class SpmcRingBuffer {
+public:
+    // The capacity is rounded up to a power of 2.
+    explicit SpmcRingBuffer(size_t capacity): mask_(roundUpToPowerOf2(capacity) - 1), cells_(new Cell[mask_ + 1])
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "entries are copied in and out of the cells");
+        for (size_t i = 0; i <= mask_; i++) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    SpmcRingBuffer(const SpmcRingBuffer&) = delete;
+    SpmcRingBuffer& operator=(const SpmcRingBuffer&) = delete;
+
+    // Called by the producer only. Returns false, without waiting, if the ring is full.
+    bool tryPush(const T& value)
+    {
+        const size_t pos  = head_.load(std::memory_order_relaxed);
+        Cell&        cell = cells_[pos & mask_];
+        if (cell.sequence.load(std::memory_order_acquire) != pos) {
+            // the entry of the previous lap is not popped yet
+            return false;
+        }
+        cell.value = value;
+        cell.sequence.store(pos + 1, std::memory_order_release);
+        head_.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // May be called by any consumer. Returns false, without waiting, if the ring is empty.
+    bool tryPop(T* value)
+    {
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        while (true) {
+            Cell&           cell     = cells_[pos & mask_];
+            const size_t    sequence = cell.sequence.load(std::memory_order_acquire);
+            const ptrdiff_t lag      = (ptrdiff_t)(sequence - (pos + 1));
+            if (lag == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    *value = cell.value;
+                    // hands the cell to the producer for its next lap
+                    cell.sequence.store(pos + mask_ + 1, std::memory_order_release);
+                    return true;
+                }
+                // another consumer claimed it, pos holds the new tail
+            }
+            else if (lag < 0) {
+                return false;
+            }
+            else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    size_t capacity() const
+    {
+        return mask_ + 1;
+    }
+
+    // Number of entries pushed and not popped yet, only exact when no thread is pushing or popping.
+    size_t size() const
+    {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        const size_t head = head_.load(std::memory_order_relaxed);
+        return head > tail ? head - tail : 0;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T                   value;
+    };
+
+    static size_t roundUpToPowerOf2(size_t n)
+    {
+        size_t capacity = 1;
+        while (capacity < n) {
+            capacity <<= 1;
+        }
+        return capacity;
+    }
+
+    const size_t            mask_;
+    std::unique_ptr<Cell[]> cells_;
+    // on separate cache lines, the producer writing one and the consumers the other
+    alignas(64) std::atomic<size_t> head_{0};  // next position pushed
+    alignas(64) std::atomic<size_t> tail_{0};  // next position popped
+};
+
+// A token generated by the decoding loop.
+struct GeneratedToken {
+    uint32_t batch_idx;
+    uint32_t beam_idx;
+    int32_t  step;      // decoding step, the position of the token in the output ids of the batch
+    int32_t  token_id;
+    bool     finished;  // last token of the sequence
+};
+
+using TokenRingBuffer = SpmcRingBuffer<GeneratedToken>;
+
+}  // namespace fastertransformer
@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host-only benchmark of the time the decoding loop spends streaming the tokens of a generation, against its length:
+//   callback: the whole-tensor step callback, which copies the whole output_ids [batch, beam, session_len] out of the
+//             outputs at every step, as the Triton stream callback does.
+//   ring:     the token ring, which publishes the batch * beam new tokens of every step while a consumer thread
+//             drains it.
+// Host copies stand in for the device-to-host copies of the real loop, the time of the model itself is left out.
+
+#include "src/fastertransformer/utils/token_ring_buffer.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace ft = fastertransformer;
+
+// Returns a checksum of what the consumer saw, so that the copies are not optimized out.
+static long long streamByCallback(const std::vector<int>& output_ids, size_t batchxbeam, size_t gen_len)
+{
+    long long checksum = 0;
+    for (size_t step = 0; step < gen_len; step++) {
+        std::vector<int> outputs(output_ids.size());
+        memcpy(outputs.data(), output_ids.data(), sizeof(int) * outputs.size());
+        // the consumer reads the last token of each sequence
+        for (size_t i = 0; i < batchxbeam; i++) {
+            checksum += outputs[i * gen_len + step];
+        }
+    }
+    return checksum;
+}
+
+static long long streamByRing(const std::vector<int>& output_ids, size_t batchxbeam, size_t gen_len)
+{
+    ft::TokenRingBuffer    ring(batchxbeam * 4);
+    std::atomic<bool>      produced{false};
+    std::atomic<long long> checksum{0};
+    std::thread            consumer([&] {
+        long long          sum = 0;
+        ft::GeneratedToken token;
+        while (true) {
+            if (ring.tryPop(&token)) {
+                sum += token.token_id;
+            }
+            else if (produced.load()) {
+                while (ring.tryPop(&token)) {
+                    sum += token.token_id;
+                }
+                break;
+            }
+            else {
+                std::this_thread::yield();
+            }
+        }
+        checksum = sum;
+    });
+
+    std::vector<int> step_ids(batchxbeam);
+    for (size_t step = 0; step < gen_len; step++) {
+        for (size_t i = 0; i < batchxbeam; i++) {
+            step_ids[i] = output_ids[i * gen_len + step];
+        }
+        for (size_t i = 0; i < batchxbeam; i++) {
+            ft::GeneratedToken token;
+            token.batch_idx = i;
+            token.beam_idx  = 0;
+            token.step      = step;
+            token.token_id  = step_ids[i];
+            token.finished  = step + 1 == gen_len;
+            while (!ring.tryPush(token)) {
+                std::this_thread::yield();
+            }
+        }
+    }
+    produced.store(true);
+    consumer.join();
+    return checksum;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        printf("[ERROR] token_stream_benchmark batch_size [beam_width] [max_gen_len] [iterations]\n");
+        printf("e.g. ./bin/token_stream_benchmark 32 1 4096 3\n");
+        return 0;
+    }
+    const size_t batch_size  = atol(argv[1]);
+    const size_t beam_width  = argc > 2 ? atol(argv[2]) : 1;
+    const size_t max_gen_len = argc > 3 ? atol(argv[3]) : 4096;
+    const int    iterations  = argc > 4 ? atoi(argv[4]) : 3;
+    const size_t batchxbeam  = batch_size * beam_width;
+
+    printf("[INFO] batch_size: %ld, beam_width: %ld, iterations: %d\n", batch_size, beam_width, iterations);
+    printf("[INFO] %8s %20s %20s %10s\n", "gen_len", "callback (us/step)", "ring (us/step)", "speedup");
+    for (size_t gen_len = 64; gen_len <= max_gen_len; gen_len *= 2) {
+        std::vector<int> output_ids(batchxbeam * gen_len);
+        for (size_t i = 0; i < output_ids.size(); i++) {
+            output_ids[i] = (int)(i * 2654435761u >> 16);
+        }
+
+        double    ms[2]        = {0.0, 0.0};
+        long long checksums[2] = {0, 0};
+        for (int mode = 0; mode < 2; mode++) {
+            for (int i = 0; i < iterations; i++) {
+                auto start = std::chrono::high_resolution_clock::now();
+                checksums[mode] = mode == 0 ? streamByCallback(output_ids, batchxbeam, gen_len) :
+                                              streamByRing(output_ids, batchxbeam, gen_len);
+                auto end = std::chrono::high_resolution_clock::now();
+                ms[mode] += std::chrono::duration<double, std::milli>(end - start).count();
+            }
+        }
+        if (checksums[0] != checksums[1]) {
+            printf("[ERROR] the two paths streamed different tokens\n");
+            return -1;
+        }
+        const double us_per_step[2] = {ms[0] * 1e3 / iterations / gen_len, ms[1] * 1e3 / iterations / gen_len};
+        printf("[INFO] %8ld %20.2f %20.2f %9.1fx\n",
+               gen_len,
+               us_per_step[0],
+               us_per_step[1],
+               us_per_step[0] / us_per_step[1]);
+    }
+    return 0;
+}
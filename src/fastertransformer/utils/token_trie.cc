@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/fastertransformer/utils/token_trie.h"
+#include "src/fastertransformer/utils/cuda_utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+namespace fastertransformer {
+
+const int TokenTrie::kRoot;
+const int TokenTrie::kNoState;
+
+TokenTrie::TokenTrie(): TokenTrie(std::vector<std::vector<int>>()) {}
+
+TokenTrie::TokenTrie(const std::vector<std::vector<int>>& words)
+{
+    // build with maps, then number the states breadth first so that the children of a state are a contiguous range
+    // of edges, already sorted by token
+    std::vector<std::map<int, int>> children(1);
+    std::vector<bool>               terminal(1, false);
+    for (const auto& word : words) {
+        if (word.empty()) {
+            continue;
+        }
+        int state = kRoot;
+        for (int token : word) {
+            FT_CHECK_WITH_INFO(token >= 0, fmtstr("Invalid token %d in the word list.", token));
+            auto it = children[state].find(token);
+            if (it == children[state].end()) {
+                it = children[state].emplace(token, (int)children.size()).first;
+                children.emplace_back();
+                terminal.push_back(false);
+            }
+            state = it->second;
+        }
+        num_words_ += terminal[state] ? 0 : 1;
+        terminal[state]  = true;
+        max_word_length_ = std::max(max_word_length_, word.size());
+    }
+
+    const size_t     num_states = children.size();
+    std::vector<int> order(1, kRoot);
+    std::vector<int> new_id(num_states, 0);
+    order.reserve(num_states);
+    for (size_t i = 0; i < order.size(); i++) {
+        for (const auto& child : children[order[i]]) {
+            new_id[child.second] = (int)order.size();
+            order.push_back(child.second);
+        }
+    }
+
+    child_offsets_.assign(1, 0);
+    terminal_offsets_.assign(1, 0);
+    terminal_.resize(num_states);
+    edge_tokens_.reserve(num_states - 1);
+    edge_states_.reserve(num_states - 1);
+    for (size_t i = 0; i < num_states; i++) {
+        terminal_[i] = terminal[order[i]];
+        for (const auto& child : children[order[i]]) {
+            edge_tokens_.push_back(child.first);
+            edge_states_.push_back(new_id[child.second]);
+            if (terminal[child.second]) {
+                terminal_tokens_.push_back(child.first);
+            }
+        }
+        child_offsets_.push_back((int)edge_tokens_.size());
+        terminal_offsets_.push_back((int)terminal_tokens_.size());
+    }
+}
+
+TokenTrie TokenTrie::fromWordList(const std::vector<int>& word_list)
+{
+    FT_CHECK_WITH_INFO(word_list.size() % 2 == 0, "The word list must have two rows of the same length.");
+    return fromWordList(word_list.data(), word_list.size() / 2);
+}
+
+TokenTrie TokenTrie::fromWordList(const int* word_list, size_t word_list_len)
+{
+    return TokenTrie(parseWordList(word_list, word_list_len));
+}
+
+std::vector<std::vector<int>> TokenTrie::parseWordList(const int* word_list, size_t word_list_len)
+{
+    const int*                    ids     = word_list;
+    const int*                    offsets = word_list + word_list_len;
+    std::vector<std::vector<int>> words;
+    int                           start = 0;
+    for (size_t i = 0; i < word_list_len && offsets[i] >= 0; i++) {
+        FT_CHECK_WITH_INFO(offsets[i] >= start && (size_t)offsets[i] <= word_list_len,
+                           fmtstr("Invalid offset %d of word %lu in the word list.", offsets[i], i));
+        words.emplace_back(ids + start, ids + offsets[i]);
+        start = offsets[i];
+    }
+    return words;
+}
+
+int TokenTrie::step(int state, int token) const
+{
+    const auto begin = edge_tokens_.begin() + child_offsets_[state];
+    const auto end   = edge_tokens_.begin() + child_offsets_[state + 1];
+    const auto it    = std::lower_bound(begin, end, token);
+    return (it != end && *it == token) ? edge_states_[it - edge_tokens_.begin()] : kNoState;
+}
+
+std::string TokenTrie::toString() const
+{
+    return fmtstr("TokenTrie[words=%lu, states=%lu, max_word_length=%lu]",
+                  num_words_,
+                  getNumStates(),
+                  max_word_length_);
+}
+
+TokenTrieMatcher::TokenTrieMatcher(
+    const TokenTrie* trie, TokenTrieMode mode, size_t batch_size, int end_id, bool allow_repeat):
+    trie_(trie),
+    mode_(mode),
+    batch_size_(batch_size),
+    end_id_(end_id),
+    allow_repeat_(allow_repeat),
+    states_(batch_size)
+{
+    FT_CHECK(trie_ != nullptr);
+    buffer_.reserve(trie_->getMaxWordLength());
+    reset();
+}
+
+void TokenTrieMatcher::reset()
+{
+    for (size_t row = 0; row < batch_size_; row++) {
+        reset(row);
+    }
+}
+
+void TokenTrieMatcher::reset(size_t row)
+{
+    states_[row].clear();
+    if (mode_ == TokenTrieMode::ALLOW) {
+        states_[row].push_back(TokenTrie::kRoot);
+    }
+}
+
+void TokenTrieMatcher::update(const int* tokens)
+{
+    for (size_t row = 0; row < batch_size_; row++) {
+        update(row, tokens[row]);
+    }
+}
+
+void TokenTrieMatcher::update(size_t row, int token)
+{
+    std::vector<int>& states = states_[row];
+    if (mode_ == TokenTrieMode::BAN) {
+        // the suffixes matching a prefix of a word are the ones extending a matched suffix, or the new token alone
+        buffer_.clear();
+        for (int state : states) {
+            const int next = trie_->step(state, token);
+            if (next != TokenTrie::kNoState && trie_->getChildBegin(next) != trie_->getChildEnd(next)) {
+                buffer_.push_back(next);
+            }
+        }
+        const int next = trie_->step(TokenTrie::kRoot, token);
+        if (next != TokenTrie::kNoState && trie_->getChildBegin(next) != trie_->getChildEnd(next)) {
+            buffer_.push_back(next);
+        }
+        states.swap(buffer_);
+        return;
+    }
+
+    if (states.empty() || (token == end_id_ && trie_->isTerminal(states[0]))) {
+        return;
+    }
+    int next = trie_->step(states[0], token);
+    if (next == TokenTrie::kNoState && allow_repeat_ && trie_->isTerminal(states[0])) {
+        next = trie_->step(TokenTrie::kRoot, token);
+    }
+    if (next == TokenTrie::kNoState) {
+        states.clear();
+    }
+    else {
+        states[0] = next;
+    }
+}
+
+void TokenTrieMatcher::gather(const int* parent_rows)
+{
+    std::vector<std::vector<int>> states(batch_size_);
+    for (size_t row = 0; row < batch_size_; row++) {
+        FT_CHECK(parent_rows[row] >= 0 && (size_t)parent_rows[row] < batch_size_);
+        states[row] = states_[parent_rows[row]];
+    }
+    states_.swap(states);
+}
+
+void TokenTrieMatcher::getMask(TokenTrieMask* mask) const
+{
+    mask->mode = mode_;
+    mask->offsets.assign(1, 0);
+    mask->tokens.clear();
+    mask->unconstrained.assign(batch_size_, false);
+    for (size_t row = 0; row < batch_size_; row++) {
+        appendRowMask(row, mask);
+        mask->offsets.push_back((int)mask->tokens.size());
+    }
+}
+
+void TokenTrieMatcher::appendRowMask(size_t row, TokenTrieMask* mask) const
+{
+    const std::vector<int>& states = states_[row];
+    std::vector<int>&       tokens = mask->tokens;
+    if (mode_ == TokenTrieMode::BAN) {
+        for (int i = trie_->getTerminalBegin(TokenTrie::kRoot); i < trie_->getTerminalEnd(TokenTrie::kRoot); i++) {
+            tokens.push_back(trie_->getTerminalToken(i));
+        }
+        for (int state : states) {
+            for (int i = trie_->getTerminalBegin(state); i < trie_->getTerminalEnd(state); i++) {
+                tokens.push_back(trie_->getTerminalToken(i));
+            }
+        }
+        return;
+    }
+
+    if (states.empty()) {
+        mask->unconstrained[row] = true;
+        return;
+    }
+    const int state = states[0];
+    for (int i = trie_->getChildBegin(state); i < trie_->getChildEnd(state); i++) {
+        tokens.push_back(trie_->getEdgeToken(i));
+    }
+    if (trie_->isTerminal(state)) {
+        if (end_id_ >= 0) {
+            tokens.push_back(end_id_);
+        }
+        if (allow_repeat_) {
+            for (int i = trie_->getChildBegin(TokenTrie::kRoot); i < trie_->getChildEnd(TokenTrie::kRoot); i++) {
+                tokens.push_back(trie_->getEdgeToken(i));
+            }
+        }
+    }
+}
+
+size_t TokenTrieMatcher::getNumActiveStates() const
+{
+    size_t num_states = mode_ == TokenTrieMode::BAN ? batch_size_ : 0;
+    for (const auto& states : states_) {
+        num_states += states.size();
+    }
+    return num_states;
+}
+
+bool TokenTrieMatcher::isViolated(size_t row) const
+{
+    return mode_ == TokenTrieMode::ALLOW && states_[row].empty();
+}
+
+void applyTokenMask(float* logits, const TokenTrieMask& mask, int vocab_size, int vocab_size_padded)
+{
+    const size_t       batch_size = mask.offsets.size() - 1;
+    std::vector<float> allowed;
+    for (size_t row = 0; row < batch_size; row++) {
+        float* row_logits = logits + row * vocab_size_padded;
+        if (mask.mode == TokenTrieMode::BAN) {
+            for (int i = mask.offsets[row]; i < mask.offsets[row + 1]; i++) {
+                const int token = mask.tokens[i];
+                if (token >= 0 && token < vocab_size) {
+                    row_logits[token] = -INFINITY;
+                }
+            }
+            continue;
+        }
+
+        if (mask.unconstrained[row]) {
+            continue;
+        }
+        // keep the allowed logits aside and mask the whole row
+        allowed.clear();
+        for (int i = mask.offsets[row]; i < mask.offsets[row + 1]; i++) {
+            const int token = mask.tokens[i];
+            allowed.push_back(token >= 0 && token < vocab_size ? row_logits[token] : -INFINITY);
+        }
+        std::fill(row_logits, row_logits + vocab_size, -INFINITY);
+        for (int i = mask.offsets[row]; i < mask.offsets[row + 1]; i++) {
+            const int token = mask.tokens[i];
+            if (token >= 0 && token < vocab_size) {
+                row_logits[token] = allowed[i - mask.offsets[row]];
+            }
+        }
+    }
+}
+
+}  // namespace fastertransformer
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * Token-trie constrained decoding
+ *
+ * invokeBanBadWords compares every word of the list against the tail of every beam at each step, so its cost grows
+ * with the total list length. TokenTrie compiles a word list once into a trie stored as flat arrays (the children of
+ * a node are a sorted range of edges), and TokenTrieMatcher tracks, for each row of the batch, the trie states
+ * reached by the generated tokens. A step costs the number of active states, not the number of words.
+ *
+ * Two modes are supported:
+ *   - BAN: the words must not be generated, as with the bad words list. The active states are the nodes matching a
+ *     suffix of the generated tokens (the root matching the empty suffix); the last token of a word is banned once
+ *     the rest of the word has been generated. There are at most max word length active states per row.
+ *   - ALLOW: the generated tokens must spell words of the list (a forced vocabulary, or the tokenized productions of
+ *     a small grammar). A row has a single state; only its children are allowed. Once a word is complete the end id
+ *     is allowed and, when `allow_repeat` is set, a next word may start.
+ *
+ * The per-step mask is produced as a sparse list of tokens per row (banned tokens, or allowed ones). DynamicDecodeLayer
+ * applies it to the device logits with invokeBanTokens or invokeAllowTokens (bad_words_trie, allowed_words_trie),
+ * applyTokenMask to host logits. The trie and the matcher are host-only and not thread safe.
+ **/
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace fastertransformer {
+
+class TokenTrie {
+public:
+    TokenTrie();
+    explicit TokenTrie(const std::vector<std::vector<int>>& words);
+
+    // Builds the trie from the [2, len] word list of read_word_list: the flattened token ids, then the end offset of
+    // each word, padded with -1.
+    static TokenTrie fromWordList(const std::vector<int>& word_list);
+    static TokenTrie fromWordList(const int* word_list, size_t word_list_len);
+    // Splits a [2, word_list_len] word list into its words.
+    static std::vector<std::vector<int>> parseWordList(const int* word_list, size_t word_list_len);
+
+    static const int kRoot    = 0;
+    static const int kNoState = -1;
+
+    // Child of `state` along `token`, or kNoState.
+    int  step(int state, int token) const;
+    bool isTerminal(int state) const
+    {
+        return terminal_[state];
+    }
+
+    // Children of `state`, sorted by token: edges [getChildBegin(state), getChildEnd(state)).
+    int getChildBegin(int state) const
+    {
+        return child_offsets_[state];
+    }
+    int getChildEnd(int state) const
+    {
+        return child_offsets_[state + 1];
+    }
+    int getEdgeToken(int edge) const
+    {
+        return edge_tokens_[edge];
+    }
+    int getEdgeState(int edge) const
+    {
+        return edge_states_[edge];
+    }
+    // Tokens completing a word from `state`: terminal_tokens_[getTerminalBegin(state) .. getTerminalEnd(state)).
+    int getTerminalBegin(int state) const
+    {
+        return terminal_offsets_[state];
+    }
+    int getTerminalEnd(int state) const
+    {
+        return terminal_offsets_[state + 1];
+    }
+    int getTerminalToken(int index) const
+    {
+        return terminal_tokens_[index];
+    }
+
+    size_t getNumStates() const
+    {
+        return terminal_.size();
+    }
+    size_t getNumWords() const
+    {
+        return num_words_;
+    }
+    size_t getMaxWordLength() const
+    {
+        return max_word_length_;
+    }
+    std::string toString() const;
+
+private:
+    std::vector<int>  child_offsets_;     // [num_states + 1]
+    std::vector<int>  edge_tokens_;       // [num_states - 1]
+    std::vector<int>  edge_states_;       // [num_states - 1]
+    std::vector<bool> terminal_;          // [num_states]
+    std::vector<int>  terminal_offsets_;  // [num_states + 1]
+    std::vector<int>  terminal_tokens_;   // tokens of the edges leading to a terminal state
+    size_t            num_words_       = 0;
+    size_t            max_word_length_ = 0;
+};
+
+enum class TokenTrieMode {
+    BAN,
+    ALLOW
+};
+
+// Sparse logit mask of a step. Row i lists tokens[offsets[i] .. offsets[i + 1]): the banned tokens in BAN mode, the
+// allowed ones in ALLOW mode. An ALLOW row with `unconstrained` set is left untouched.
+struct TokenTrieMask {
+    TokenTrieMode     mode = TokenTrieMode::BAN;
+    std::vector<int>  offsets;        // [batch_size + 1]
+    std::vector<int>  tokens;
+    std::vector<bool> unconstrained;  // [batch_size]
+};
+
+class TokenTrieMatcher {
+public:
+    // `batch_size` rows, i.e. batch_size * beam_width when decoding with beams. end_id < 0 is never allowed
+    // explicitly in ALLOW mode.
+    TokenTrieMatcher(
+        const TokenTrie* trie, TokenTrieMode mode, size_t batch_size, int end_id = -1, bool allow_repeat = false);
+
+    // Back to the state of an empty sequence.
+    void reset();
+    void reset(size_t row);
+
+    // Advances every row by its generated token, tokens is [batch_size].
+    void update(const int* tokens);
+    void update(size_t row, int token);
+    // Reorders the rows after a beam search step: row i continues the sequence of row parent_rows[i].
+    void gather(const int* parent_rows);
+
+    // Mask of the next step.
+    void getMask(TokenTrieMask* mask) const;
+
+    // Number of states tracked over the batch, the cost of update() and getMask().
+    size_t getNumActiveStates() const;
+    // ALLOW mode: whether row left the trie by generating a token that was not allowed.
+    bool isViolated(size_t row) const;
+
+private:
+    void appendRowMask(size_t row, TokenTrieMask* mask) const;
+
+    const TokenTrie*    trie_;
+    const TokenTrieMode mode_;
+    const size_t        batch_size_;
+    const int           end_id_;
+    const bool          allow_repeat_;
+
+    // active states of row i are states_[i], the root excluded in BAN mode
+    std::vector<std::vector<int>> states_;
+    std::vector<int>              buffer_;
+};
+
+// Applies the mask to logits [batch_size, vocab_size_padded]: masked tokens are set to -inf. Tokens out of
+// [0, vocab_size) are ignored.
+void applyTokenMask(float* logits, const TokenTrieMask& mask, int vocab_size, int vocab_size_padded);
+
+}  // namespace fastertransformer
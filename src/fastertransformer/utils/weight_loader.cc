@@ -0,0 +1,358 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/fastertransformer/utils/weight_loader.h"
+#include "src/fastertransformer/utils/packed_checkpoint.h"
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+namespace fastertransformer {
+
+static WeightLoadMode getDefaultWeightLoadMode()
+{
+    char* mode_name = std::getenv("FT_WEIGHT_LOAD_MODE");
+    if (mode_name != nullptr) {
+        std::string mode(mode_name);
+        if (mode == "MMAP") {
+            return WeightLoadMode::MMAP;
+        }
+        else if (mode != "IFSTREAM") {
+            FT_LOG_WARNING("Invalid FT_WEIGHT_LOAD_MODE=%s, use IFSTREAM instead.", mode_name);
+        }
+    }
+    return WeightLoadMode::IFSTREAM;
+}
+
+static WeightLoadMode& weightLoadMode()
+{
+    static WeightLoadMode mode = getDefaultWeightLoadMode();
+    return mode;
+}
+
+void setWeightLoadMode(WeightLoadMode mode)
+{
+    weightLoadMode() = mode;
+}
+
+WeightLoadMode getWeightLoadMode()
+{
+    return weightLoadMode();
+}
+
+template<>
+FtCudaDataType getFtCudaDataType<float>()
+{
+    return FtCudaDataType::FP32;
+}
+
+template<>
+FtCudaDataType getFtCudaDataType<half>()
+{
+    return FtCudaDataType::FP16;
+}
+
+#ifdef ENABLE_BF16
+template<>
+FtCudaDataType getFtCudaDataType<__nv_bfloat16>()
+{
+    return FtCudaDataType::BF16;
+}
+#endif
+
+template<typename T_IN>
+const T_IN* readWeightToHost(const std::string& filename, size_t size, std::vector<T_IN>& buffer, MmapFile& mapping)
+{
+    size_t               loaded_data_size = sizeof(T_IN) * size;
+    WeightLoadPhaseTimer timer(WeightLoadPhase::READ, loaded_data_size);
+
+    const PackedTensorInfo* packed_info = nullptr;
+    const char*             packed_data = findPackedTensor(filename, &packed_info);
+    if (packed_data != nullptr) {
+        if (packed_info->data_type != getFtCudaDataType<T_IN>()) {
+            FT_LOG_WARNING("packed tensor %s has data type %d, but %d is requested, loading model fails! \n",
+                           packed_info->name.c_str(),
+                           packed_info->data_type,
+                           getFtCudaDataType<T_IN>());
+            return nullptr;
+        }
+        if (packed_info->size_in_bytes < loaded_data_size) {
+            FT_LOG_WARNING("packed tensor %s only has %ld, but request %ld, loading model fails! \n",
+                           packed_info->name.c_str(),
+                           packed_info->size_in_bytes,
+                           loaded_data_size);
+            return nullptr;
+        }
+        FT_LOG_DEBUG("Map " + std::to_string(loaded_data_size) + " bytes of " + packed_info->name
+                     + " from packed checkpoint");
+        return reinterpret_cast<const T_IN*>(packed_data);
+    }
+
+    if (getWeightLoadMode() == WeightLoadMode::MMAP) {
+        if (!mapping.open(filename, true)) {
+            FT_LOG_WARNING("file %s cannot be opened, loading model fails! \n", filename.c_str());
+            return nullptr;
+        }
+        if (mapping.size() < loaded_data_size) {
+            FT_LOG_WARNING("file %s only has %ld, but request %ld, loading model fails! \n",
+                           filename.c_str(),
+                           mapping.size(),
+                           loaded_data_size);
+            return nullptr;
+        }
+        FT_LOG_DEBUG("Map " + std::to_string(loaded_data_size) + " bytes from " + filename);
+        return reinterpret_cast<const T_IN*>(mapping.data());
+    }
+
+    buffer.resize(size);
+    std::ifstream in(filename, std::ios::in | std::ios::binary);
+    if (!in.is_open()) {
+        FT_LOG_WARNING("file %s cannot be opened, loading model fails! \n", filename.c_str());
+        return nullptr;
+    }
+
+    FT_LOG_DEBUG("Read " + std::to_string(loaded_data_size) + " bytes from " + filename);
+    in.read((char*)buffer.data(), loaded_data_size);
+
+    size_t in_get_size = in.gcount();
+    if (in_get_size != loaded_data_size) {
+        FT_LOG_WARNING("file %s only has %ld, but request %ld, loading model fails! \n",
+                       filename.c_str(),
+                       in_get_size,
+                       loaded_data_size);
+        return nullptr;
+    }
+    return buffer.data();
+}
+
+template const float*
+readWeightToHost(const std::string& filename, size_t size, std::vector<float>& buffer, MmapFile& mapping);
+template const half*
+readWeightToHost(const std::string& filename, size_t size, std::vector<half>& buffer, MmapFile& mapping);
+#ifdef ENABLE_BF16
+template const __nv_bfloat16* readWeightToHost(const std::string&          filename,
+                                               size_t                      size,
+                                               std::vector<__nv_bfloat16>& buffer,
+                                               MmapFile&                   mapping);
+#endif
+
+void WeightLoadStats::reset()
+{
+    for (int i = 0; i < (int)WeightLoadPhase::NUM_PHASES; i++) {
+        elapsed_ns_[i] = 0;
+        bytes_[i]      = 0;
+    }
+}
+
+void WeightLoadStats::add(WeightLoadPhase phase, int64_t elapsed_ns, size_t bytes)
+{
+    elapsed_ns_[(int)phase] += elapsed_ns;
+    bytes_[(int)phase] += bytes;
+}
+
+double WeightLoadStats::getPhaseMs(WeightLoadPhase phase) const
+{
+    return elapsed_ns_[(int)phase] * 1e-6;
+}
+
+size_t WeightLoadStats::getBytes(WeightLoadPhase phase) const
+{
+    return bytes_[(int)phase];
+}
+
+std::string WeightLoadStats::toString() const
+{
+    return fmtstr("read %.2f ms (%ld bytes), convert %.2f ms, quantize %.2f ms, upload %.2f ms (%ld bytes)",
+                  getPhaseMs(WeightLoadPhase::READ),
+                  getBytes(WeightLoadPhase::READ),
+                  getPhaseMs(WeightLoadPhase::CONVERT),
+                  getPhaseMs(WeightLoadPhase::QUANTIZE),
+                  getPhaseMs(WeightLoadPhase::UPLOAD),
+                  getBytes(WeightLoadPhase::UPLOAD));
+}
+
+WeightLoadStats& getWeightLoadStats()
+{
+    static WeightLoadStats stats;
+    return stats;
+}
+
+static int getDefaultWeightLoadThreads()
+{
+    char* num_threads = std::getenv("FT_WEIGHT_LOAD_THREADS");
+    if (num_threads != nullptr && atoi(num_threads) > 0) {
+        return atoi(num_threads);
+    }
+    return 1;
+}
+
+static int& weightLoadThreads()
+{
+    static int num_threads = getDefaultWeightLoadThreads();
+    return num_threads;
+}
+
+void setWeightLoadThreads(int num_threads)
+{
+    FT_CHECK_WITH_INFO(num_threads > 0, "The number of weight loading threads must be positive.");
+    weightLoadThreads() = num_threads;
+}
+
+int getWeightLoadThreads()
+{
+    return weightLoadThreads();
+}
+
+ParallelWeightLoader::ParallelWeightLoader(int num_threads): num_threads_(std::max(1, num_threads)) {}
+
+void ParallelWeightLoader::run(size_t                             num_tasks,
+                               const std::function<void(size_t)>& task,
+                               const std::function<void()>&       thread_init)
+{
+    if (num_threads_ == 1 || num_tasks <= 1) {
+        for (size_t i = 0; i < num_tasks; i++) {
+            task(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next_task(0);
+    std::atomic<bool>   has_error(false);
+    std::exception_ptr  error;
+    std::mutex          error_mutex;
+
+    auto worker = [&]() {
+        try {
+            if (thread_init) {
+                thread_init();
+            }
+            for (size_t i = next_task++; i < num_tasks && !has_error; i = next_task++) {
+                task(i);
+            }
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!has_error) {
+                error     = std::current_exception();
+                has_error = true;
+            }
+        }
+    };
+
+    const size_t             num_workers = std::min((size_t)num_threads_, num_tasks);
+    std::vector<std::thread> workers;
+    workers.reserve(num_workers);
+    for (size_t i = 0; i < num_workers; i++) {
+        workers.emplace_back(worker);
+    }
+    for (auto& t : workers) {
+        t.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+template<typename T>
+static inline float convertToFloat(T val)
+{
+    return (float)val;
+}
+
+template<typename T>
+static inline T convertFromFloat(float val)
+{
+    return (T)val;
+}
+
+#ifdef ENABLE_BF16
+template<>
+inline float convertToFloat(__nv_bfloat16 val)
+{
+    return __bfloat162float(val);
+}
+
+template<>
+inline __nv_bfloat16 convertFromFloat(float val)
+{
+    return __float2bfloat16(val);
+}
+#endif
+
+template<typename T, typename T_IN>
+static int loadWeightFromBinToHostFunc(T* ptr, std::vector<size_t> shape, std::string filename)
+{
+    FT_CHECK_WITH_INFO(shape.size() <= 2, "shape should have less than two dims");
+    size_t size = shape[0] * (shape.size() == 2 ? shape[1] : 1);
+    if (size == 0) {
+        FT_LOG_WARNING("shape is zero, skip loading weight from file %s \n", filename.c_str());
+        return 0;
+    }
+    std::vector<T_IN> host_array;
+    MmapFile          mapping;
+    const T_IN*       host_ptr = readWeightToHost(filename, size, host_array, mapping);
+    if (host_ptr == nullptr) {
+        return -1;
+    }
+    if (std::is_same<T, T_IN>::value) {
+        WeightLoadPhaseTimer timer(WeightLoadPhase::UPLOAD, sizeof(T) * size);
+        memcpy(ptr, host_ptr, sizeof(T) * size);
+    }
+    else {
+        WeightLoadPhaseTimer timer(WeightLoadPhase::CONVERT);
+        for (size_t i = 0; i < size; i++) {
+            ptr[i] = convertFromFloat<T>(convertToFloat(host_ptr[i]));
+        }
+    }
+    return 0;
+}
+
+template<typename T>
+int loadWeightFromBinToHost(T* ptr, std::vector<size_t> shape, std::string filename, FtCudaDataType model_file_type)
+{
+    switch (model_file_type) {
+        case FtCudaDataType::FP32:
+            return loadWeightFromBinToHostFunc<T, float>(ptr, shape, filename);
+        case FtCudaDataType::FP16:
+            return loadWeightFromBinToHostFunc<T, half>(ptr, shape, filename);
+#ifdef ENABLE_BF16
+        case FtCudaDataType::BF16:
+            return loadWeightFromBinToHostFunc<T, __nv_bfloat16>(ptr, shape, filename);
+#endif
+        default:
+            FT_LOG_ERROR("Does not support FtCudaDataType=%d", model_file_type);
+            FT_CHECK(false);
+    }
+    return -1;
+}
+
+template int
+loadWeightFromBinToHost(float* ptr, std::vector<size_t> shape, std::string filename, FtCudaDataType model_file_type);
+template int
+loadWeightFromBinToHost(half* ptr, std::vector<size_t> shape, std::string filename, FtCudaDataType model_file_type);
+#ifdef ENABLE_BF16
+template int loadWeightFromBinToHost(__nv_bfloat16*      ptr,
+                                     std::vector<size_t> shape,
+                                     std::string         filename,
+                                     FtCudaDataType      model_file_type);
+#endif
+
+}  // namespace fastertransformer
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "src/fastertransformer/utils/cuda_utils.h"
+#include "src/fastertransformer/utils/mmap_utils.h"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace fastertransformer {
+
+// Controls how loadWeightFromBin/loadWeightFromBinQ read the .bin files from disk.
+// IFSTREAM: read each file into a temporary host buffer (default).
+// MMAP:     map each file read-only with sequential read-ahead and copy/convert straight from the mapped pages.
+// The initial value can be set with the environment variable FT_WEIGHT_LOAD_MODE=IFSTREAM|MMAP.
+enum class WeightLoadMode {
+    IFSTREAM,
+    MMAP
+};
+
+void           setWeightLoadMode(WeightLoadMode mode);
+WeightLoadMode getWeightLoadMode();
+
+enum class WeightLoadPhase {
+    READ,      // file -> host memory
+    CONVERT,   // data type conversion
+    QUANTIZE,  // int8 scale calibration and quantization
+    UPLOAD,    // host -> target buffer copy
+    NUM_PHASES
+};
+
+// Accumulated time per weight loading phase. Phases running concurrently on several loader threads are summed,
+// so the total may exceed the wall time of the load.
+class WeightLoadStats {
+public:
+    void   reset();
+    void   add(WeightLoadPhase phase, int64_t elapsed_ns, size_t bytes = 0);
+    double getPhaseMs(WeightLoadPhase phase) const;
+    size_t getBytes(WeightLoadPhase phase) const;
+
+    std::string toString() const;
+
+private:
+    std::atomic<int64_t> elapsed_ns_[(int)WeightLoadPhase::NUM_PHASES] = {};
+    std::atomic<size_t>  bytes_[(int)WeightLoadPhase::NUM_PHASES]      = {};
+};
+
+WeightLoadStats& getWeightLoadStats();
+
+// Adds the lifetime of the object to `phase` of the global WeightLoadStats.
+class WeightLoadPhaseTimer {
+public:
+    explicit WeightLoadPhaseTimer(WeightLoadPhase phase, size_t bytes = 0):
+        phase_(phase), bytes_(bytes), start_(std::chrono::steady_clock::now())
+    {
+    }
+    ~WeightLoadPhaseTimer()
+    {
+        auto elapsed = std::chrono::steady_clock::now() - start_;
+        getWeightLoadStats().add(
+            phase_, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), bytes_);
+    }
+
+private:
+    WeightLoadPhase                       phase_;
+    size_t                                bytes_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Number of threads used by the model weight loaders, 1 (sequential) by default.
+// The initial value can be set with the environment variable FT_WEIGHT_LOAD_THREADS.
+void setWeightLoadThreads(int num_threads);
+int  getWeightLoadThreads();
+
+// Bounded pool running independent loading tasks, typically one per decoder layer. Every task writes its own
+// buffers, so the result does not depend on the number of threads or on the scheduling order.
+class ParallelWeightLoader {
+public:
+    explicit ParallelWeightLoader(int num_threads = getWeightLoadThreads());
+
+    // Runs task(0) ... task(num_tasks - 1) on at most num_threads threads. `thread_init` is called once on every
+    // worker thread before its first task, e.g. to select the CUDA device of the caller. The first exception thrown
+    // by a task is rethrown after all the workers are joined.
+    void run(size_t                             num_tasks,
+             const std::function<void(size_t)>& task,
+             const std::function<void()>&       thread_init = nullptr);
+
+    int getNumThreads() const
+    {
+        return num_threads_;
+    }
+
+private:
+    int num_threads_;
+};
+
+template<typename T>
+FtCudaDataType getFtCudaDataType();
+
+// Fetches `size` elements of type T_IN from `filename` into host memory. Tensors held by an active packed
+// checkpoint (see PackedCheckpointScope) are served from its mapping. Otherwise, with WeightLoadMode::MMAP the
+// returned pointer aliases the pages of `mapping`, so no intermediate heap copy is made, and with
+// WeightLoadMode::IFSTREAM the file is read into `buffer`. Returns nullptr when the file is missing or too short.
+template<typename T_IN>
+const T_IN* readWeightToHost(const std::string& filename, size_t size, std::vector<T_IN>& buffer, MmapFile& mapping);
+
+// Host-side variant of loadWeightFromBin writing into a CPU buffer, converting from `model_file_type` to T.
+// Returns 0 on success and -1 if the file is missing or too short.
+template<typename T>
+int loadWeightFromBinToHost(T*                  ptr,
+                            std::vector<size_t> shape,
+                            std::string         filename,
+                            FtCudaDataType      model_file_type = FtCudaDataType::FP32);
+
+}  // namespace fastertransformer
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host-only benchmark of the two weight file reading paths of loadWeightFromBin:
+//   ifstream: read the whole file into a std::vector, then copy it to the target buffer.
+//   mmap:     map the file with MADV_SEQUENTIAL and copy to the target buffer straight from the mapping.
+// The copy into a host target buffer stands in for the cudaMemcpy/convert step of the real loader.
+
+#include "src/fastertransformer/utils/mmap_utils.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace ft = fastertransformer;
+
+// Evicts the file from the page cache so that every iteration measures a cold read.
+static void dropPageCache(const std::string& filename)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+static size_t loadByIfstream(const std::string& filename, std::vector<char>& target)
+{
+    std::ifstream in(filename, std::ios::in | std::ios::binary);
+    if (!in.is_open()) {
+        return 0;
+    }
+    in.seekg(0, in.end);
+    size_t size = in.tellg();
+    in.seekg(0, in.beg);
+    std::vector<char> host_array(size);
+    in.read(host_array.data(), size);
+    target.resize(size);
+    memcpy(target.data(), host_array.data(), size);
+    return size;
+}
+
+static size_t loadByMmap(const std::string& filename, std::vector<char>& target)
+{
+    ft::MmapFile mapping(filename, true);
+    if (!mapping.isOpen()) {
+        return 0;
+    }
+    target.resize(mapping.size());
+    memcpy(target.data(), mapping.data(), mapping.size());
+    return mapping.size();
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        printf("[ERROR] weight_loading_benchmark file_size_in_mb [iterations] [cold(0/1)] [file_path]\n");
+        printf("e.g. ./bin/weight_loading_benchmark 512 5 1\n");
+        return 0;
+    }
+    const size_t file_size  = (size_t)atol(argv[1]) * 1024 * 1024;
+    const int    iterations = argc > 2 ? atoi(argv[2]) : 5;
+    const bool   cold       = argc > 3 ? atoi(argv[3]) != 0 : false;
+    std::string  filename   = argc > 4 ? std::string(argv[4]) : std::string("weight_loading_benchmark.bin");
+    const bool   is_tmp     = argc <= 4;
+
+    if (is_tmp) {
+        std::vector<char> data(file_size);
+        for (size_t i = 0; i < file_size; i++) {
+            data[i] = (char)(i * 2654435761u >> 24);
+        }
+        std::ofstream out(filename, std::ios::out | std::ios::binary);
+        out.write(data.data(), file_size);
+    }
+    else if (!ft::MmapFile(filename).isOpen()) {
+        printf("[ERROR] file %s cannot be opened\n", filename.c_str());
+        return -1;
+    }
+
+    printf("[INFO] file: %s, iterations: %d, cold: %s\n", filename.c_str(), iterations, cold ? "true" : "false");
+
+    std::vector<char> target;
+    const char*       names[2] = {"ifstream", "mmap"};
+    for (int mode = 0; mode < 2; mode++) {
+        double total_ms    = 0.0;
+        size_t total_bytes = 0;
+        for (int i = 0; i < iterations; i++) {
+            if (cold) {
+                dropPageCache(filename);
+            }
+            auto start = std::chrono::high_resolution_clock::now();
+            total_bytes += mode == 0 ? loadByIfstream(filename, target) : loadByMmap(filename, target);
+            auto end = std::chrono::high_resolution_clock::now();
+            total_ms += std::chrono::duration<double, std::milli>(end - start).count();
+        }
+        printf("[INFO] %-8s : %8.2f ms/iter, %6.2f GB/s\n",
+               names[mode],
+               total_ms / iterations,
+               total_bytes / (total_ms * 1e-3) / 1e9);
+    }
+
+    if (is_tmp) {
+        remove(filename.c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,327 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "src/fastertransformer/utils/batching_server.h"
+#include "src/fastertransformer/utils/cuda_utils.h"
+#include "tests/unittests/unittest_host_utils.h"
+
+using namespace fastertransformer;
+
+// Token t (from 1) of a request generated by MockGenerator.
+static int mockToken(const ServerRequest& request, size_t t) {
+    return request.input_ids.back() * 100 + (int)t;
+}
+
+// Stands in for the model: one token per step for every request of the batch. It finishes the requests with an even
+// id itself and leaves the others to the server. An input id of -1 makes the batch fail.
+class MockGenerator: public BatchGenerator {
+public:
+    void generate(const std::vector<const ServerRequest*>& batch, TokenStream* stream) override {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            batch_sizes.push_back(batch.size());
+        }
+        size_t max_new_tokens = 0;
+        for (const ServerRequest* request : batch) {
+            EXPECT_TRUE(request->max_new_tokens > 0);
+            max_new_tokens = std::max<size_t>(max_new_tokens, request->max_new_tokens);
+        }
+        for (size_t t = 1; t <= max_new_tokens; t++) {
+            for (size_t i = 0; i < batch.size(); i++) {
+                if (batch[i]->input_ids.back() == -1) {
+                    throw std::runtime_error("mock failure");
+                }
+                if (t <= batch[i]->max_new_tokens) {
+                    const int token = mockToken(*batch[i], t);
+                    stream->push(i, &token, 1);
+                }
+                if (t == batch[i]->max_new_tokens && batch[i]->request_id % 2 == 0) {
+                    stream->finish(i);
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    std::vector<size_t> getBatchSizes() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return batch_sizes;
+    }
+
+private:
+    std::mutex          mutex;
+    std::vector<size_t> batch_sizes;
+};
+
+// Gathers the responses of the requests, from any thread.
+struct ResponseCollector {
+    std::mutex                           mutex;
+    std::condition_variable              cond;
+    std::map<uint32_t, std::vector<int>> tokens;
+    std::map<uint32_t, uint32_t>         flags;
+    std::map<uint32_t, size_t>           num_responses;
+
+    void add(const ServerResponse& response) {
+        std::lock_guard<std::mutex> lock(mutex);
+        EXPECT_TRUE((flags[response.request_id] & SERVER_RESPONSE_FINISHED) == 0);
+        tokens[response.request_id].insert(
+            tokens[response.request_id].end(), response.tokens.begin(), response.tokens.end());
+        flags[response.request_id] |= response.flags;
+        num_responses[response.request_id]++;
+        cond.notify_all();
+    }
+
+    ServerResponseCallback callback() {
+        return [this](const ServerResponse& response) { add(response); };
+    }
+
+    bool waitFinished(size_t num_requests) {
+        std::unique_lock<std::mutex> lock(mutex);
+        return cond.wait_for(lock, std::chrono::seconds(10), [&] {
+            size_t num_finished = 0;
+            for (const auto& it : flags) {
+                num_finished += (it.second & SERVER_RESPONSE_FINISHED) != 0;
+            }
+            return num_finished == num_requests;
+        });
+    }
+};
+
+static ServerRequest makeRequest(uint32_t request_id, std::vector<int> input_ids, uint32_t max_new_tokens) {
+    ServerRequest request;
+    request.request_id     = request_id;
+    request.input_ids      = std::move(input_ids);
+    request.max_new_tokens = max_new_tokens;
+    return request;
+}
+
+static std::vector<int> expectedTokens(const ServerRequest& request) {
+    std::vector<int> tokens;
+    for (size_t t = 1; t <= request.max_new_tokens; t++) {
+        tokens.push_back(mockToken(request, t));
+    }
+    return tokens;
+}
+
+static double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool pushRequest(ServerRequestQueue& queue, uint32_t request_id) {
+    QueuedServerRequest queued = {makeRequest(request_id, {1}, 1), nullptr, {}};
+    return queue.push(queued);
+}
+
+void testRequestQueue() {
+    ServerRequestQueue queue(3, 40);
+
+    // a full batch goes right away, in arrival order
+    for (uint32_t i = 0; i < 4; i++) {
+        EXPECT_TRUE(pushRequest(queue, i));
+    }
+    std::vector<QueuedServerRequest> batch = queue.popBatch();
+    EXPECT_TRUE(batch.size() == 3);
+    for (uint32_t i = 0; i < 3; i++) {
+        EXPECT_TRUE(batch[i].request.request_id == i);
+    }
+
+    // a partial batch waits max_wait_ms from its oldest request
+    const auto start = std::chrono::steady_clock::now();
+    EXPECT_TRUE(pushRequest(queue, 4));
+    batch = queue.popBatch();
+    EXPECT_TRUE(elapsedMs(start) >= 39.0);
+    EXPECT_TRUE(batch.size() == 2 && batch[0].request.request_id == 3 && batch[1].request.request_id == 4);
+
+    // closing flushes the queue without waiting, then refuses requests
+    EXPECT_TRUE(pushRequest(queue, 5));
+    queue.close();
+    batch = queue.popBatch();
+    EXPECT_TRUE(batch.size() == 1 && batch[0].request.request_id == 5);
+    EXPECT_TRUE(queue.popBatch().empty());
+    EXPECT_FALSE(pushRequest(queue, 6));
+    EXPECT_TRUE(queue.size() == 0);
+
+    // requests arriving during the wait complete the batch before the timeout
+    ServerRequestQueue patient_queue(3, 60 * 1000);
+    EXPECT_TRUE(pushRequest(patient_queue, 0));
+    std::thread producer([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        pushRequest(patient_queue, 1);
+        pushRequest(patient_queue, 2);
+    });
+    batch = patient_queue.popBatch();
+    producer.join();
+    EXPECT_TRUE(batch.size() == 3);
+}
+
+void testServerBatching() {
+    BatchingServerConfig config;
+    config.max_batch_size         = 4;
+    config.max_wait_ms            = 50;
+    config.default_max_new_tokens = 3;
+    config.max_new_tokens         = 16;
+    config.max_seq_len            = 20;
+    MockGenerator     generator;
+    BatchingServer    server(config, &generator);
+    ResponseCollector collector;
+    std::thread       worker([&] { server.run(); });
+
+    // concurrent clients are batched together
+    std::vector<ServerRequest> requests;
+    for (uint32_t i = 0; i < 6; i++) {
+        requests.push_back(makeRequest(i, {(int)i, (int)i + 1}, 2 + i));
+    }
+    requests[5].max_new_tokens = 0;  // default of the server
+    std::vector<std::thread> clients;
+    for (const ServerRequest& request : requests) {
+        clients.push_back(std::thread([&, request] { server.submit(request, collector.callback()); }));
+    }
+    for (std::thread& client : clients) {
+        client.join();
+    }
+    EXPECT_TRUE(collector.waitFinished(requests.size()));
+
+    requests[5].max_new_tokens = config.default_max_new_tokens;
+    for (const ServerRequest& request : requests) {
+        EXPECT_TRUE(collector.flags[request.request_id] == SERVER_RESPONSE_FINISHED);
+        EXPECT_TRUE(collector.tokens[request.request_id] == expectedTokens(request));
+        // streamed step by step, then finished
+        EXPECT_TRUE(collector.num_responses[request.request_id] == request.max_new_tokens + 1);
+    }
+    const std::vector<size_t> batch_sizes = generator.getBatchSizes();
+    size_t                    num_batched = 0, max_batch_size = 0;
+    for (size_t batch_size : batch_sizes) {
+        num_batched += batch_size;
+        max_batch_size = std::max(max_batch_size, batch_size);
+    }
+    EXPECT_TRUE(num_batched == requests.size());
+    EXPECT_TRUE(max_batch_size == config.max_batch_size);
+
+    // invalid requests are answered right away
+    server.submit(makeRequest(10, {}, 2), collector.callback());
+    server.submit(makeRequest(11, {1}, 17), collector.callback());
+    server.submit(makeRequest(12, {1, 2, 3, 4, 5}, 16), collector.callback());
+    for (uint32_t request_id = 10; request_id <= 12; request_id++) {
+        EXPECT_TRUE(collector.flags[request_id] == (SERVER_RESPONSE_FINISHED | SERVER_RESPONSE_ERROR));
+        EXPECT_TRUE(collector.tokens[request_id].empty());
+    }
+
+    // a failing batch fails its requests only
+    server.submit(makeRequest(20, {-1}, 2), collector.callback());
+    EXPECT_TRUE(collector.waitFinished(requests.size() + 4));
+    server.submit(makeRequest(21, {5}, 2), collector.callback());
+    EXPECT_TRUE(collector.waitFinished(requests.size() + 5));
+    EXPECT_TRUE(collector.flags[20] == (SERVER_RESPONSE_FINISHED | SERVER_RESPONSE_ERROR));
+    EXPECT_TRUE(collector.flags[21] == SERVER_RESPONSE_FINISHED);
+
+    server.stop();
+    worker.join();
+    server.submit(makeRequest(30, {1}, 1), collector.callback());
+    EXPECT_TRUE(collector.flags[30] == (SERVER_RESPONSE_FINISHED | SERVER_RESPONSE_ERROR));
+
+    const BatchingServerStats stats = server.getStats();
+    EXPECT_TRUE(stats.num_requests == requests.size() + 2);
+    EXPECT_TRUE(stats.num_rejected == 4);
+    EXPECT_TRUE(stats.num_batched == stats.num_requests);
+    EXPECT_TRUE(stats.num_failed == 1);
+    EXPECT_TRUE(stats.meanBatchSize() > 1.0);
+}
+
+// Sends the requests on a connection, then reads the responses until they are all finished.
+static void runClient(const std::string& address, const std::vector<ServerRequest>& requests, ResponseCollector* out) {
+    const int fd = connectServerSocket(address);
+    for (const ServerRequest& request : requests) {
+        EXPECT_TRUE(writeServerRequest(fd, request));
+    }
+    size_t         num_finished = 0;
+    ServerResponse response;
+    while (num_finished < requests.size() && readServerResponse(fd, &response)) {
+        out->add(response);
+        num_finished += (response.flags & SERVER_RESPONSE_FINISHED) != 0;
+    }
+    ::close(fd);
+    EXPECT_TRUE(num_finished == requests.size());
+}
+
+void testSocketClients() {
+    const std::string address = fmtstr("unix:/tmp/test_batching_server_%d.sock", (int)getpid());
+    BatchingServerConfig config;
+    config.max_batch_size = 8;
+    config.max_wait_ms    = 20;
+    MockGenerator  generator;
+    BatchingServer server(config, &generator);
+    server.listen(address);
+    std::thread worker([&] { server.run(); });
+
+    // two clients, several requests each; request ids are per connection
+    std::vector<ServerRequest> requests_a = {makeRequest(0, {3}, 4), makeRequest(1, {4, 5}, 2), makeRequest(2, {6}, 5)};
+    std::vector<ServerRequest> requests_b = {makeRequest(0, {7}, 3), makeRequest(1, {8, 9, 10}, 1)};
+    ResponseCollector          responses_a, responses_b;
+    std::thread                client_a(runClient, address, std::cref(requests_a), &responses_a);
+    std::thread                client_b(runClient, address, std::cref(requests_b), &responses_b);
+    client_a.join();
+    client_b.join();
+    for (const ServerRequest& request : requests_a) {
+        EXPECT_TRUE(responses_a.tokens[request.request_id] == expectedTokens(request));
+        EXPECT_TRUE(responses_a.flags[request.request_id] == SERVER_RESPONSE_FINISHED);
+    }
+    for (const ServerRequest& request : requests_b) {
+        EXPECT_TRUE(responses_b.tokens[request.request_id] == expectedTokens(request));
+        EXPECT_TRUE(responses_b.flags[request.request_id] == SERVER_RESPONSE_FINISHED);
+    }
+
+    // a malformed frame ends the connection
+    const int      fd         = connectServerSocket(address);
+    const uint32_t garbage[4] = {0xdeadbeef, 0, 0, 0};
+    EXPECT_TRUE(::send(fd, garbage, sizeof(garbage), MSG_NOSIGNAL) == sizeof(garbage));
+    ServerResponse response;
+    EXPECT_FALSE(readServerResponse(fd, &response));
+    ::close(fd);
+
+    // a client still connected does not hold up the shutdown
+    const int idle_fd = connectServerSocket(address);
+    server.stop();
+    worker.join();
+    ::close(idle_fd);
+    EXPECT_TRUE(server.getStats().num_requests == requests_a.size() + requests_b.size());
+
+    bool thrown = false;
+    try {
+        connectServerSocket("tcp:notaport");
+    }
+    catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    EXPECT_TRUE(thrown);
+}
+
+int main(int argc, char* argv[]) {
+    testRequestQueue();
+    testServerBatching();
+    testSocketClients();
+    FT_LOG_INFO("Test Done");
+    return 0;
+}
@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "src/fastertransformer/utils/cuda_utils.h"
+#include "src/fastertransformer/utils/beam_hypotheses.h"
+#include "tests/unittests/unittest_host_utils.h"
+
+using namespace fastertransformer;
+
+void testAddKeepsBest() {
+    BeamHypotheses hyps(2, 1.0f, BeamEarlyStopping::HEURISTIC);
+    hyps.add(-4.0f, 2, 1, 9, 0);  // score -2
+    hyps.add(-3.0f, 3, 2, 9, 1);  // score -1
+    EXPECT_TRUE(hyps.size() == 2);
+    EXPECT_TRUE(hyps.getWorstScore() == -2.0f);
+
+    hyps.add(-8.0f, 2, 2, 9, 0);  // score -4, dropped
+    EXPECT_TRUE(hyps.getWorstScore() == -2.0f);
+    hyps.add(-6.0f, 4, 3, 9, 1);  // score -1.5, replaces the worst
+    EXPECT_TRUE(hyps.size() == 2);
+    EXPECT_TRUE(hyps.getWorstScore() == -1.5f);
+
+    const std::vector<BeamHypothesis> sorted = hyps.getSorted();
+    EXPECT_TRUE(sorted[0].score == -1.0f && sorted[0].step == 2);
+    EXPECT_TRUE(sorted[1].score == -1.5f && sorted[1].step == 3);
+}
+
+void testIsDone() {
+    // fewer hypotheses than beams: never done
+    BeamHypotheses always(2, 1.0f, BeamEarlyStopping::ALWAYS);
+    always.add(-1.0f, 1, 1, 9, 0);
+    EXPECT_FALSE(always.isDone(-100.0f, 2, 10));
+    always.add(-1.0f, 1, 1, 9, 1);
+    EXPECT_TRUE(always.isDone(0.0f, 2, 10));
+
+    // worst score -2 at length 2
+    BeamHypotheses heuristic(2, 1.0f, BeamEarlyStopping::HEURISTIC);
+    BeamHypotheses never(2, 1.0f, BeamEarlyStopping::NEVER);
+    for (BeamHypotheses* hyps : {&heuristic, &never}) {
+        hyps->add(-4.0f, 2, 1, 9, 0);
+        hyps->add(-2.0f, 2, 1, 9, 1);
+    }
+    // best running beam -9 at length 4 scores -2.25, but -0.9 at length 10
+    EXPECT_TRUE(heuristic.isDone(-9.0f, 4, 10));
+    EXPECT_FALSE(never.isDone(-9.0f, 4, 10));
+    EXPECT_TRUE(never.isDone(-30.0f, 4, 10));
+    EXPECT_FALSE(heuristic.isDone(-7.0f, 4, 10));
+
+    // without a positive length penalty, a longer sequence cannot score better: NEVER is HEURISTIC
+    BeamHypotheses never_no_penalty(1, 0.0f, BeamEarlyStopping::NEVER);
+    never_no_penalty.add(-2.0f, 2, 1, 9, 0);
+    EXPECT_TRUE(never_no_penalty.isDone(-3.0f, 3, 100));
+    EXPECT_FALSE(never_no_penalty.isDone(-1.0f, 3, 100));
+}
+
+void testProcess() {
+    const int      end_id     = 0;
+    const int      lengths[2] = {3, 3};
+    BeamHypotheses hyps(2, 0.0f, BeamEarlyStopping::HEURISTIC);
+
+    // rank 1 ends and is kept, rank 3 ends but is below the beam width and is dropped
+    const int   beams_0[4]  = {0, 1, 1, 0};
+    const int   tokens_0[4] = {5, end_id, 7, end_id};
+    const float cum_0[4]    = {-1.0f, -2.0f, -3.0f, -4.0f};
+    int         beams[2], tokens[2];
+    float       cum_log_probs[2];
+    EXPECT_FALSE(hyps.process(beams_0, tokens_0, cum_0, 4, lengths, end_id, 5, 10, beams, tokens, cum_log_probs));
+    EXPECT_TRUE(hyps.size() == 1);
+    EXPECT_TRUE(beams[0] == 0 && tokens[0] == 5 && cum_log_probs[0] == -1.0f);
+    EXPECT_TRUE(beams[1] == 1 && tokens[1] == 7 && cum_log_probs[1] == -3.0f);
+    const BeamHypothesis hyp = hyps.getSorted()[0];
+    EXPECT_TRUE(hyp.cum_log_prob == -2.0f && hyp.length == 4 && hyp.step == 5 && hyp.token == end_id);
+    EXPECT_TRUE(hyp.parent_beam == 1);
+
+    // a second hypothesis fills the buffer, and the best candidate of the step (-2) cannot beat the worst (-2)
+    const int   beams_1[4]  = {0, 0, 1, 1};
+    const int   tokens_1[4] = {end_id, 4, 6, 8};
+    const float cum_1[4]    = {-2.0f, -2.5f, -3.5f, -4.5f};
+    EXPECT_TRUE(hyps.process(beams_1, tokens_1, cum_1, 4, lengths, end_id, 6, 10, beams, tokens, cum_log_probs));
+    EXPECT_TRUE(hyps.isDone());
+    // ties keep their order
+    EXPECT_TRUE(hyps.getSorted()[0].step == 5);
+    EXPECT_TRUE(hyps.getSorted()[1].step == 6);
+}
+
+void testProcessLastStep() {
+    const int      lengths[2] = {4, 6};
+    BeamHypotheses hyps(2, 1.0f, BeamEarlyStopping::HEURISTIC);
+    const int      cand_beams[4]  = {1, 0, 0, 1};
+    const int      cand_tokens[4] = {3, 4, 5, 6};
+    const float    cand_cum[4]    = {-7.0f, -10.0f, -11.0f, -12.0f};
+    int            beams[2], tokens[2];
+    float          cum_log_probs[2];
+    // no hypothesis yet, the running beams become the hypotheses at the last step
+    EXPECT_TRUE(hyps.process(cand_beams, cand_tokens, cand_cum, 4, lengths, 0, 9, 9, beams, tokens, cum_log_probs));
+    const std::vector<BeamHypothesis> sorted = hyps.getSorted();
+    EXPECT_TRUE(sorted.size() == 2);
+    EXPECT_TRUE(sorted[0].token == 3 && sorted[0].parent_beam == 1);
+    EXPECT_TRUE(sorted[0].length == 7 && sorted[0].score == -1.0f);
+    EXPECT_TRUE(sorted[1].token == 4 && sorted[1].parent_beam == 0);
+    EXPECT_TRUE(sorted[1].length == 5 && sorted[1].score == -2.0f);
+}
+
+void testBacktrackBeam() {
+    // 2 requests of 2 beams, steps 1 to 3, request 1 being rows 2 and 3
+    const size_t     num_rows   = 4;
+    const int        first_step = 1;
+    std::vector<int> output_ids(4 * num_rows, -1);
+    std::vector<int> parent_ids(4 * num_rows, -1);
+    auto set = [&](int step, int beam, int token, int parent) {
+        output_ids[step * num_rows + 2 + beam] = token;
+        parent_ids[step * num_rows + 2 + beam] = parent;
+    };
+    set(1, 0, 10, 0);
+    set(1, 1, 11, 0);
+    set(2, 0, 20, 1);
+    set(2, 1, 21, 0);
+    set(3, 0, 30, 0);
+    set(3, 1, 31, 0);
+
+    std::vector<int> tokens(5, -1);
+    // ends with 40 at step 4 after beam 0 of step 3: 30, then 20 (beam 0), 11 (beam 1)
+    backtrackBeam(tokens.data(), output_ids.data(), parent_ids.data(), num_rows, 2, first_step, 4, 40, 0);
+    EXPECT_TRUE((tokens == std::vector<int>{-1, 11, 20, 30, 40}));
+    // ends at step 3 after beam 1 of step 2: 21, then 10 (beam 0)
+    std::fill(tokens.begin(), tokens.end(), -1);
+    backtrackBeam(tokens.data(), output_ids.data(), parent_ids.data(), num_rows, 2, first_step, 3, 0, 1);
+    EXPECT_TRUE((tokens == std::vector<int>{-1, 10, 21, 0, -1}));
+}
+
+void testGetBeamEarlyStopping() {
+    EXPECT_TRUE(getBeamEarlyStopping(0) == BeamEarlyStopping::HEURISTIC);
+    EXPECT_TRUE(getBeamEarlyStopping(1) == BeamEarlyStopping::ALWAYS);
+    EXPECT_TRUE(getBeamEarlyStopping(2) == BeamEarlyStopping::NEVER);
+    bool thrown = false;
+    try {
+        getBeamEarlyStopping(3);
+    }
+    catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    EXPECT_TRUE(thrown);
+}
+
+void testLiveRowIndex() {
+    // 4 requests of 2 beams, requests 1 and 3 done
+    const bool   is_done[4] = {false, true, false, true};
+    LiveRowIndex index      = getLiveRowIndex(is_done, 4, 2);
+    EXPECT_TRUE(index.size() == 4);
+    EXPECT_TRUE((index.compact_to_batch == std::vector<int>{0, 1, 4, 5}));
+    EXPECT_TRUE((index.batch_to_compact == std::vector<int>{0, 1, -1, -1, 2, 3, -1, -1}));
+
+    const bool all_done[4] = {true, true, true, true};
+    index                  = getLiveRowIndex(all_done, 4, 2);
+    EXPECT_TRUE(index.size() == 0);
+    EXPECT_TRUE((index.batch_to_compact == std::vector<int>(8, -1)));
+}
+
+void testCompactRowMoves() {
+    const bool   none_done[4] = {false, false, false, false};
+    const bool   one_done[4]  = {false, true, false, false};
+    const bool   two_done[4]  = {false, true, false, true};
+    LiveRowIndex all          = getLiveRowIndex(none_done, 4, 2);
+    LiveRowIndex first        = getLiveRowIndex(one_done, 4, 2);
+    LiveRowIndex second       = getLiveRowIndex(two_done, 4, 2);
+
+    std::vector<int> dst_rows;
+    std::vector<int> src_rows;
+    // request 1 done: requests 2 and 3 move up by a request
+    getCompactRowMoves(&dst_rows, &src_rows, all, first);
+    EXPECT_TRUE((dst_rows == std::vector<int>{2, 3, 4, 5}));
+    EXPECT_TRUE((src_rows == std::vector<int>{4, 5, 6, 7}));
+    // request 3 done, at compact rows 4 and 5: nothing moves
+    getCompactRowMoves(&dst_rows, &src_rows, first, second);
+    EXPECT_TRUE(dst_rows.empty() && src_rows.empty());
+    // both at once
+    getCompactRowMoves(&dst_rows, &src_rows, all, second);
+    EXPECT_TRUE((dst_rows == std::vector<int>{2, 3}));
+    EXPECT_TRUE((src_rows == std::vector<int>{4, 5}));
+
+    // moving the rows in order gives the compact layout of the new index
+    std::vector<int> rows = all.compact_to_batch;
+    getCompactRowMoves(&dst_rows, &src_rows, all, second);
+    for (size_t i = 0; i < dst_rows.size(); i++) {
+        EXPECT_TRUE(dst_rows[i] < src_rows[i]);
+        rows[dst_rows[i]] = rows[src_rows[i]];
+    }
+    rows.resize(second.size());
+    EXPECT_TRUE(rows == second.compact_to_batch);
+
+    // a done request cannot come back
+    bool thrown = false;
+    try {
+        getCompactRowMoves(&dst_rows, &src_rows, second, all);
+    }
+    catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    EXPECT_TRUE(thrown);
+}
+
+int main(int argc, char* argv[]) {
+    testAddKeepsBest();
+    testIsDone();
+    testProcess();
+    testProcessLastStep();
+    testBacktrackBeam();
+    testGetBeamEarlyStopping();
+    testLiveRowIndex();
+    testCompactRowMoves();
+    FT_LOG_INFO("Test Done");
+    return 0;
+}
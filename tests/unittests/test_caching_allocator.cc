@@ -0,0 +1,266 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "src/fastertransformer/utils/allocator.h"
+#include "src/fastertransformer/utils/caching_allocator.h"
+#include "tests/unittests/unittest_host_utils.h"
+
+using namespace fastertransformer;
+
+// Host backend that counts calls and can be limited to emulate an out of memory device.
+struct CountingBackend {
+    size_t num_mallocs = 0;
+    size_t num_frees   = 0;
+    size_t used_bytes  = 0;
+    size_t limit_bytes = SIZE_MAX;
+    std::unordered_map<void*, size_t> sizes;
+
+    CachingAllocator::BackendMalloc mallocFunc() {
+        return [this](size_t size) -> void* {
+            if (used_bytes + size > limit_bytes) {
+                return nullptr;
+            }
+            void* ptr = std::malloc(size);
+            num_mallocs++;
+            used_bytes += size;
+            sizes[ptr] = size;
+            return ptr;
+        };
+    }
+    CachingAllocator::BackendFree freeFunc() {
+        return [this](void* ptr) {
+            num_frees++;
+            used_bytes -= sizes[ptr];
+            sizes.erase(ptr);
+            std::free(ptr);
+        };
+    }
+};
+
+void testSizeClass() {
+    EXPECT_TRUE(CachingAllocator::getSizeClass(1) == 512);
+    EXPECT_TRUE(CachingAllocator::getSizeClass(512) == 512);
+    EXPECT_TRUE(CachingAllocator::getSizeClass(513) == 640);
+    EXPECT_TRUE(CachingAllocator::getSizeClass(1000) == 1024);
+    EXPECT_TRUE(CachingAllocator::getSizeClass(1025) == 1280);
+    EXPECT_TRUE(CachingAllocator::getSizeClass(4096) == 4096);
+    size_t prev = 0;
+    for (size_t size = 1; size < (1 << 22); size = size * 5 / 4 + 1) {
+        size_t class_size = CachingAllocator::getSizeClass(size);
+        EXPECT_TRUE(class_size >= size);
+        EXPECT_TRUE(class_size >= prev);
+        EXPECT_TRUE(size <= 512 || class_size - size < size / 4);
+        EXPECT_TRUE(CachingAllocator::getSizeClass(class_size) == class_size);
+        prev = class_size;
+    }
+}
+
+void testReuseAndStats() {
+    CountingBackend  backend;
+    CachingAllocator allocator(backend.mallocFunc(), backend.freeFunc());
+
+    void* a = allocator.malloc(1000);
+    void* b = allocator.malloc(3000);
+    EXPECT_TRUE(allocator.contains(a) && allocator.getSize(a) == 1000 && allocator.getCapacity(a) == 1024);
+    AllocatorStats stats = allocator.getStats();
+    EXPECT_TRUE(stats.live_bytes == 4000 && stats.peak_live_bytes == 4000);
+    EXPECT_TRUE(stats.reserved_bytes == 1024 + 3072 && stats.cached_bytes == 0);
+
+    EXPECT_TRUE(allocator.free(a));
+    EXPECT_FALSE(allocator.free(a));
+    EXPECT_FALSE(allocator.contains(a));
+    stats = allocator.getStats();
+    EXPECT_TRUE(stats.live_bytes == 3000 && stats.peak_live_bytes == 4000 && stats.cached_bytes == 1024);
+
+    // same size class is served from the free list
+    void* c = allocator.malloc(900);
+    EXPECT_TRUE(c == a);
+    stats = allocator.getStats();
+    EXPECT_TRUE(stats.num_allocs == 3 && stats.num_cache_hits == 1 && backend.num_mallocs == 2);
+    EXPECT_TRUE(stats.hitRate() > 0.33 && stats.hitRate() < 0.34);
+
+    // steady state: a forward-like loop never reaches the backend again
+    allocator.free(b);
+    allocator.free(c);
+    for (int i = 0; i < 100; i++) {
+        void* x = allocator.malloc(1000);
+        void* y = allocator.malloc(3000);
+        allocator.free(x);
+        allocator.free(y);
+    }
+    EXPECT_TRUE(backend.num_mallocs == 2 && backend.num_frees == 0);
+
+    allocator.releaseCache();
+    stats = allocator.getStats();
+    EXPECT_TRUE(stats.reserved_bytes == 0 && stats.cached_bytes == 0 && backend.num_frees == 2);
+    EXPECT_TRUE(allocator.malloc(0) == nullptr);
+}
+
+void testCachingDisabled() {
+    CountingBackend  backend;
+    CachingAllocator allocator(backend.mallocFunc(), backend.freeFunc(), false);
+    void*            a = allocator.malloc(1000);
+    EXPECT_TRUE(allocator.getCapacity(a) == 1000);
+    allocator.free(a);
+    EXPECT_TRUE(backend.num_frees == 1 && allocator.getStats().reserved_bytes == 0);
+    allocator.free(allocator.malloc(1000));
+    EXPECT_TRUE(backend.num_mallocs == 2 && allocator.getStats().num_cache_hits == 0);
+}
+
+void testMaxCachedBytes() {
+    CountingBackend  backend;
+    CachingAllocator allocator(backend.mallocFunc(), backend.freeFunc(), true, 2048);
+    void*            a = allocator.malloc(1024);
+    void*            b = allocator.malloc(1024);
+    void*            c = allocator.malloc(1024);
+    allocator.free(a);
+    allocator.free(b);
+    allocator.free(c);
+    EXPECT_TRUE(allocator.getStats().cached_bytes == 2048 && backend.num_frees == 1);
+}
+
+void testReleaseCacheOnBackendFailure() {
+    CountingBackend backend;
+    backend.limit_bytes = 4096;
+    CachingAllocator allocator(backend.mallocFunc(), backend.freeFunc());
+    allocator.free(allocator.malloc(3072));
+    // 3072 bytes are cached, a 2048 bytes block only fits after releasing them
+    void* a = allocator.malloc(2048);
+    EXPECT_TRUE(a != nullptr && allocator.getStats().cached_bytes == 0 && backend.used_bytes == 2048);
+    bool failed = false;
+    try {
+        allocator.malloc(4096);
+    } catch (std::runtime_error&) {
+        failed = true;
+    }
+    EXPECT_TRUE(failed);
+}
+
+void testTags() {
+    CountingBackend  backend;
+    CachingAllocator allocator(backend.mallocFunc(), backend.freeFunc());
+    void*            untagged = allocator.malloc(100);
+    void*            a;
+    void*            b;
+    {
+        AllocatorTagScope tag("decoder");
+        a = allocator.malloc(1000);
+        {
+            AllocatorTagScope inner_tag("attention");
+            b = allocator.malloc(2000);
+        }
+        allocator.free(allocator.malloc(500));
+    }
+    AllocatorStats stats = allocator.getStats();
+    EXPECT_TRUE(stats.tags.size() == 3);
+    EXPECT_TRUE(stats.tags["untagged"].live_bytes == 100);
+    EXPECT_TRUE(stats.tags["decoder"].live_bytes == 1000 && stats.tags["decoder"].peak_live_bytes == 1500);
+    EXPECT_TRUE(stats.tags["decoder"].num_allocs == 2);
+    EXPECT_TRUE(stats.tags["attention"].live_bytes == 2000);
+    allocator.free(a);
+    allocator.free(b);
+    allocator.free(untagged);
+    FT_LOG_INFO(allocator.getStats().toString());
+}
+
+void testCpuAllocatorReMalloc() {
+    Allocator<AllocatorType::CPU> allocator;
+    int* buf = (int*)allocator.reMalloc((int*)nullptr, sizeof(int) * 200, true);
+    for (int i = 0; i < 200; i++) {
+        EXPECT_TRUE(buf[i] == 0);
+    }
+    // same size class: the buffer is reused, and serves the new size
+    int* same = (int*)allocator.reMalloc(buf, sizeof(int) * 210, false);
+    EXPECT_TRUE(same == buf);
+    EXPECT_TRUE(allocator.getStats().live_bytes == sizeof(int) * 216);  // rounded up to 32 bytes
+    same = (int*)allocator.reMalloc(same, sizeof(int) * 200, false);
+    EXPECT_TRUE(same == buf && allocator.getStats().live_bytes == sizeof(int) * 200);
+    // larger: a new buffer replaces the old one, which is cached
+    int* larger = (int*)allocator.reMalloc(same, sizeof(int) * 2000, false);
+    EXPECT_TRUE(allocator.getStats().live_bytes == sizeof(int) * 2000);
+    EXPECT_TRUE(allocator.getStats().cached_bytes == CachingAllocator::getSizeClass(sizeof(int) * 200));
+#if !defined(CUDA_MEMORY_POOL_DISABLED)
+    // smaller size class: the larger buffer goes back to the backend instead of the cache
+    // and the cached buffer of the same size class is handed out
+    int*           smaller = (int*)allocator.reMalloc(larger, sizeof(int) * 210, false);
+    AllocatorStats stats   = allocator.getStats();
+    EXPECT_TRUE(smaller == buf && stats.live_bytes == sizeof(int) * 216 && stats.cached_bytes == 0);
+    EXPECT_TRUE(stats.reserved_bytes == CachingAllocator::getSizeClass(sizeof(int) * 210));
+#else
+    // without memory pools a shrunk buffer is kept
+    int* smaller = (int*)allocator.reMalloc(larger, sizeof(int) * 210, false);
+    EXPECT_TRUE(smaller == larger && allocator.getStats().live_bytes == sizeof(int) * 216);
+#endif
+    allocator.free((void**)&smaller);
+    EXPECT_TRUE(smaller == nullptr);
+    EXPECT_TRUE(allocator.getStats().live_bytes == 0);
+}
+
+void testResizeAndRelease() {
+    CountingBackend  backend;
+    CachingAllocator allocator(backend.mallocFunc(), backend.freeFunc());
+    void*            a = allocator.malloc(1000);
+    EXPECT_TRUE(allocator.resize(a, 900));
+    EXPECT_TRUE(allocator.getSize(a) == 900 && allocator.getStats().live_bytes == 900);
+    EXPECT_TRUE(allocator.resize(a, 1024));
+    EXPECT_TRUE(allocator.getStats().live_bytes == 1024 && allocator.getStats().peak_live_bytes == 1024);
+    EXPECT_TRUE(allocator.release(a));
+    EXPECT_FALSE(allocator.release(a));
+    EXPECT_FALSE(allocator.resize(a, 100));
+    AllocatorStats stats = allocator.getStats();
+    EXPECT_TRUE(stats.reserved_bytes == 0 && stats.cached_bytes == 0 && backend.num_frees == 1);
+}
+
+void benchmarkAllocatorOverhead() {
+    Allocator<AllocatorType::CPU> allocator;
+    const int                     num_iters = 10000;
+    std::vector<void*>            ptrs(16, nullptr);
+    auto                          start = std::chrono::steady_clock::now();
+    for (int i = 0; i < num_iters; i++) {
+        for (size_t j = 0; j < ptrs.size(); j++) {
+            ptrs[j] = allocator.malloc((j + 1) * 4096, false);
+        }
+        for (size_t j = 0; j < ptrs.size(); j++) {
+            allocator.free(&ptrs[j]);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    FT_LOG_INFO("%.1f ns per malloc/free pair, %s",
+                std::chrono::duration<double, std::nano>(end - start).count() / (num_iters * ptrs.size()),
+                allocator.getStats().toString().c_str());
+    EXPECT_TRUE(allocator.getStats().hitRate() > 0.99);
+}
+
+int main() {
+    testSizeClass();
+    testReuseAndStats();
+    testCachingDisabled();
+    testMaxCachedBytes();
+    testReleaseCacheOnBackendFailure();
+    testTags();
+    testCpuAllocatorReMalloc();
+    testResizeAndRelease();
+    benchmarkAllocatorOverhead();
+    FT_LOG_INFO("Test Done");
+    return 0;
+}
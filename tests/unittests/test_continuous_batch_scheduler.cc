@@ -0,0 +1,442 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "src/fastertransformer/kernels/cpu_sampling_kernels.h"
+#include "src/fastertransformer/models/multi_gpu_gpt/ContinuousBatchScheduler.h"
+#include "src/fastertransformer/utils/cuda_utils.h"
+#include "tests/unittests/unittest_host_utils.h"
+
+using namespace fastertransformer;
+
+// Next token of a sequence: a deterministic function of the whole sequence, so a token only comes out right if the
+// slot holds exactly the request's input and its own previous tokens.
+static int nextToken(const std::vector<int>& sequence) {
+    unsigned int hash = 2166136261u;
+    for (int token : sequence) {
+        hash = (hash ^ (unsigned int)token) * 16777619u;
+    }
+    return (int)(hash % 50);
+}
+
+// Stands in for ParallelGpt: one KV "cache" row per slot.
+struct FakeModel {
+    std::vector<std::vector<int>> kv_cache;
+    size_t                        num_context_runs = 0;
+
+    explicit FakeModel(size_t max_batch_size): kv_cache(max_batch_size) {}
+
+    std::vector<int> step(const ContinuousBatchScheduler& scheduler, const ScheduledBatch& batch) {
+        std::vector<int> tokens(kv_cache.size(), -1);
+        for (size_t slot : batch.context_slots) {
+            kv_cache[slot] = scheduler.getSlotInputIds(slot);
+            num_context_runs++;
+        }
+        for (const std::vector<size_t>* slots : {&batch.context_slots, &batch.decode_slots}) {
+            for (size_t slot : *slots) {
+                tokens[slot] = nextToken(kv_cache[slot]);
+                kv_cache[slot].push_back(tokens[slot]);
+            }
+        }
+        return tokens;
+    }
+};
+
+// Stands in for ParallelGpt with sampling: the slots sample their next token together with the reference of the
+// top-k sampling kernel, from logits that depend on their sequence, with the sampling inputs of the scheduler.
+struct SamplingModel {
+    static const int              vocab_size = 16;
+    std::vector<std::vector<int>> kv_cache;
+
+    explicit SamplingModel(size_t max_batch_size): kv_cache(max_batch_size) {}
+
+    std::vector<int> step(const ContinuousBatchScheduler& scheduler, const ScheduledBatch& batch) {
+        const size_t       batch_size = kv_cache.size();
+        std::vector<float> logits(batch_size * vocab_size, 0.0f);
+        for (size_t slot : batch.context_slots) {
+            kv_cache[slot] = scheduler.getSlotInputIds(slot);
+        }
+        for (const std::vector<size_t>* slots : {&batch.context_slots, &batch.decode_slots}) {
+            for (size_t slot : *slots) {
+                const int hash = nextToken(kv_cache[slot]);
+                for (int i = 0; i < vocab_size; i++) {
+                    logits[slot * vocab_size + i] = 0.25f * ((hash + 3 * i) % 5);
+                }
+            }
+        }
+        std::vector<unsigned long long> random_seeds(batch_size);
+        std::vector<int>                random_steps(batch_size);
+        scheduler.getSamplingInputs(batch, random_seeds.data(), random_steps.data());
+        const std::vector<int>   top_ks(batch_size, vocab_size);
+        const std::vector<float> top_ps(batch_size, 1.0f);
+        const std::vector<int>   end_ids(batch_size, -1);
+        std::vector<int>         tokens(batch_size, -1);
+        cpuBatchTopKSampling(logits.data(),
+                             random_seeds.data(),
+                             random_steps.data(),
+                             tokens.data(),
+                             nullptr,
+                             nullptr,
+                             nullptr,
+                             nullptr,
+                             top_ks.data(),
+                             top_ps.data(),
+                             vocab_size,
+                             end_ids.data(),
+                             batch_size,
+                             nullptr);
+        for (const std::vector<size_t>* slots : {&batch.context_slots, &batch.decode_slots}) {
+            for (size_t slot : *slots) {
+                kv_cache[slot].push_back(tokens[slot]);
+            }
+        }
+        return tokens;
+    }
+};
+
+static std::vector<int> generateAlone(const GenerationRequest& request, size_t max_session_len) {
+    std::vector<int> sequence = request.input_ids;
+    std::vector<int> output;
+    while (true) {
+        const int token = nextToken(sequence);
+        sequence.push_back(token);
+        output.push_back(token);
+        if (token == request.end_id || output.size() >= request.max_new_tokens
+            || sequence.size() >= max_session_len) {
+            return output;
+        }
+    }
+}
+
+static std::vector<GenerationRequest> makeRequests(size_t num_requests, unsigned int seed) {
+    std::mt19937                   gen(seed);
+    std::vector<GenerationRequest> requests;
+    for (size_t i = 0; i < num_requests; i++) {
+        GenerationRequest request;
+        request.request_id = i;
+        request.input_ids.resize(1 + gen() % 20);
+        for (int& token : request.input_ids) {
+            token = gen() % 50;
+        }
+        // a mix of short and long generations, some stopping on the end id
+        request.max_new_tokens = i % 4 == 0 ? 64 : 1 + gen() % 8;
+        request.end_id         = i % 3 == 0 ? 7 : -1;
+        requests.push_back(request);
+    }
+    return requests;
+}
+
+static std::map<uint64_t, GenerationResult> runAll(ContinuousBatchScheduler*             scheduler,
+                                                   const std::vector<GenerationRequest>& requests) {
+    FakeModel model(scheduler->getConfig().max_batch_size);
+    for (const GenerationRequest& request : requests) {
+        scheduler->enqueue(request);
+    }
+    std::map<uint64_t, GenerationResult> results;
+    while (scheduler->hasPendingWork()) {
+        ScheduledBatch batch = scheduler->schedule();
+        EXPECT_FALSE(batch.empty());
+        scheduler->update(model.step(*scheduler, batch));
+        for (GenerationResult& result : scheduler->popFinished()) {
+            EXPECT_TRUE(results.count(result.request_id) == 0);
+            results[result.request_id] = result;
+        }
+    }
+    EXPECT_TRUE(model.num_context_runs == requests.size());
+    return results;
+}
+
+void testOutputsMatchAlone() {
+    ContinuousBatchSchedulerConfig config;
+    config.max_batch_size  = 4;
+    config.max_session_len = 48;
+    std::vector<GenerationRequest> requests = makeRequests(40, 1);
+    ContinuousBatchScheduler       scheduler(config);
+    auto                           results = runAll(&scheduler, requests);
+    EXPECT_TRUE(results.size() == requests.size());
+    for (const GenerationRequest& request : requests) {
+        const GenerationResult& result = results[request.request_id];
+        EXPECT_TRUE(result.output_ids == generateAlone(request, config.max_session_len));
+        EXPECT_TRUE(result.admit_step >= result.enqueue_step && result.finish_step >= result.admit_step);
+        EXPECT_TRUE(result.finish_step - result.admit_step + 1 == result.output_ids.size());
+        if (result.finish_reason == GenerationFinishReason::END_ID) {
+            EXPECT_TRUE(result.output_ids.back() == request.end_id);
+        }
+        else if (result.finish_reason == GenerationFinishReason::SESSION_LENGTH) {
+            EXPECT_TRUE(request.input_ids.size() + result.output_ids.size() == config.max_session_len);
+        }
+    }
+    ContinuousBatchSchedulerStats stats = scheduler.getStats();
+    EXPECT_TRUE(stats.num_admitted == requests.size() && stats.num_finished == requests.size());
+}
+
+void testInFlightBeatsStaticBatching() {
+    ContinuousBatchSchedulerConfig config;
+    config.max_batch_size  = 8;
+    config.max_session_len = 128;
+    std::vector<GenerationRequest> requests = makeRequests(64, 2);
+
+    ContinuousBatchScheduler in_flight(config);
+    auto                     in_flight_results = runAll(&in_flight, requests);
+    config.in_flight = false;
+    ContinuousBatchScheduler static_batching(config);
+    auto                     static_results = runAll(&static_batching, requests);
+
+    for (const GenerationRequest& request : requests) {
+        EXPECT_TRUE(in_flight_results[request.request_id].output_ids
+                    == static_results[request.request_id].output_ids);
+    }
+    const ContinuousBatchSchedulerStats in_flight_stats = in_flight.getStats();
+    const ContinuousBatchSchedulerStats static_stats    = static_batching.getStats();
+    EXPECT_TRUE(in_flight_stats.num_generated == static_stats.num_generated);
+    EXPECT_TRUE(in_flight_stats.num_steps < static_stats.num_steps);
+    FT_LOG_INFO("in-flight batching: %lu steps, slot utilization %.2f; static batching: %lu steps, %.2f",
+                in_flight_stats.num_steps,
+                in_flight_stats.slotUtilization(config.max_batch_size),
+                static_stats.num_steps,
+                static_stats.slotUtilization(config.max_batch_size));
+}
+
+void testSlotReuseAtStepBoundary() {
+    ContinuousBatchSchedulerConfig config;
+    config.max_batch_size  = 2;
+    config.max_session_len = 64;
+    ContinuousBatchScheduler scheduler(config);
+    FakeModel                model(config.max_batch_size);
+    scheduler.enqueue(GenerationRequest{10, {1, 2, 3}, 1});
+    scheduler.enqueue(GenerationRequest{11, {4, 5}, 5});
+    scheduler.enqueue(GenerationRequest{12, {6}, 2});
+
+    ScheduledBatch batch = scheduler.schedule();
+    EXPECT_TRUE(batch.context_slots.size() == 2 && batch.decode_slots.empty());
+    EXPECT_TRUE(scheduler.getNumQueued() == 1);
+    scheduler.update(model.step(scheduler, batch));
+    // request 10 is done after its first token, request 12 takes its slot at the next step
+    std::vector<GenerationResult> finished = scheduler.popFinished();
+    EXPECT_TRUE(finished.size() == 1 && finished[0].request_id == 10);
+
+    batch = scheduler.schedule();
+    uint64_t request_id;
+    EXPECT_TRUE(batch.context_slots.size() == 1 && batch.context_slots[0] == 0);
+    EXPECT_TRUE(batch.decode_slots.size() == 1 && batch.decode_slots[0] == 1);
+    EXPECT_TRUE(scheduler.getSlotRequest(0, &request_id) && request_id == 12);
+    EXPECT_TRUE(scheduler.getSlotSequenceLength(0) == 1 && scheduler.getSlotSequenceLength(1) == 3);
+    scheduler.update(model.step(scheduler, batch));
+
+    // update() is required between two schedule()
+    batch       = scheduler.schedule();
+    bool failed = false;
+    try {
+        scheduler.schedule();
+    } catch (std::runtime_error&) {
+        failed = true;
+    }
+    EXPECT_TRUE(failed);
+    scheduler.update(model.step(scheduler, batch));
+}
+
+void testContextTokenBudget() {
+    ContinuousBatchSchedulerConfig config;
+    config.max_batch_size              = 4;
+    config.max_session_len             = 64;
+    config.max_context_tokens_per_step = 10;
+    ContinuousBatchScheduler scheduler(config);
+    scheduler.enqueue(GenerationRequest{0, std::vector<int>(6, 1), 8});
+    scheduler.enqueue(GenerationRequest{1, std::vector<int>(6, 1), 8});
+    scheduler.enqueue(GenerationRequest{2, std::vector<int>(20, 1), 8});
+    scheduler.enqueue(GenerationRequest{3, std::vector<int>(2, 1), 8});
+    FakeModel model(config.max_batch_size);
+
+    std::vector<size_t> num_admitted;
+    for (int i = 0; i < 3; i++) {
+        ScheduledBatch batch = scheduler.schedule();
+        num_admitted.push_back(batch.context_slots.size());
+        scheduler.update(model.step(scheduler, batch));
+    }
+    // 6 | 6, a request over the budget alone, then the one behind it
+    EXPECT_TRUE((num_admitted == std::vector<size_t>{1, 1, 1}));
+    EXPECT_TRUE(scheduler.getNumQueued() == 1);
+    ScheduledBatch batch = scheduler.schedule();
+    EXPECT_TRUE(batch.context_slots.size() == 1 && scheduler.getNumQueued() == 0);
+    scheduler.update(model.step(scheduler, batch));
+}
+
+void testInvalidRequests() {
+    ContinuousBatchSchedulerConfig config;
+    config.max_batch_size  = 1;
+    config.max_session_len = 4;
+    ContinuousBatchScheduler scheduler(config);
+    int                      num_failed = 0;
+    for (const GenerationRequest& request : {GenerationRequest{0, {}, 1},
+                                             GenerationRequest{1, {1}, 0},
+                                             GenerationRequest{2, {1, 2, 3, 4}, 1}}) {
+        try {
+            scheduler.enqueue(request);
+        } catch (std::runtime_error&) {
+            num_failed++;
+        }
+    }
+    EXPECT_TRUE(num_failed == 3);
+    EXPECT_FALSE(scheduler.hasPendingWork());
+    EXPECT_TRUE(scheduler.schedule().empty());
+}
+
+void testConcurrentEnqueue() {
+    ContinuousBatchSchedulerConfig config;
+    config.max_batch_size  = 4;
+    config.max_session_len = 64;
+    ContinuousBatchScheduler       scheduler(config);
+    std::vector<GenerationRequest> requests = makeRequests(200, 3);
+    std::thread                    producer([&]() {
+        for (const GenerationRequest& request : requests) {
+            scheduler.enqueue(request);
+        }
+    });
+    FakeModel                            model(config.max_batch_size);
+    std::map<uint64_t, GenerationResult> results;
+    while (results.size() < requests.size()) {
+        ScheduledBatch batch = scheduler.schedule();
+        if (batch.empty()) {
+            std::this_thread::yield();
+            continue;
+        }
+        scheduler.update(model.step(scheduler, batch));
+        for (GenerationResult& result : scheduler.popFinished()) {
+            results[result.request_id] = result;
+        }
+    }
+    producer.join();
+    for (const GenerationRequest& request : requests) {
+        EXPECT_TRUE(results[request.request_id].output_ids == generateAlone(request, config.max_session_len));
+    }
+}
+
+void testDecodeInputs() {
+    ContinuousBatchSchedulerConfig config;
+    config.max_batch_size  = 4;
+    config.max_session_len = 48;
+    ContinuousBatchScheduler       scheduler(config);
+    std::vector<GenerationRequest> requests = makeRequests(40, 5);
+    for (const GenerationRequest& request : requests) {
+        scheduler.enqueue(request);
+    }
+    FakeModel        model(config.max_batch_size);
+    std::vector<int> positions(config.max_batch_size);
+    std::vector<int> padding_counts(config.max_batch_size);
+    std::vector<int> token_ids(config.max_batch_size);
+    size_t           num_mixed_steps = 0;
+    while (scheduler.hasPendingWork()) {
+        ScheduledBatch batch = scheduler.schedule();
+        const int      step =
+            scheduler.getDecodeInputs(batch, positions.data(), padding_counts.data(), token_ids.data());
+        int max_position = 0;
+        for (size_t slot : batch.decode_slots) {
+            // the fake cache also holds the token to decode, which a real cache only gets at this step
+            EXPECT_TRUE(positions[slot] == (int)model.kv_cache[slot].size() - 1);
+            EXPECT_TRUE(token_ids[slot] == model.kv_cache[slot].back());
+            EXPECT_TRUE(padding_counts[slot] >= 0 && step - 1 - padding_counts[slot] == positions[slot]);
+            max_position = std::max(max_position, positions[slot]);
+        }
+        EXPECT_TRUE(step == max_position + 1);
+        for (size_t slot : batch.context_slots) {
+            EXPECT_TRUE(positions[slot] == 0 && padding_counts[slot] == 0 && token_ids[slot] == 0);
+        }
+        num_mixed_steps += !batch.context_slots.empty() && !batch.decode_slots.empty() ? 1 : 0;
+        scheduler.update(model.step(scheduler, batch));
+        scheduler.popFinished();
+    }
+    // slots at different positions share steps
+    EXPECT_TRUE(num_mixed_steps > 0);
+}
+
+// Runs `others` then `request`, the others taking the first slots and steps, and returns the tokens of `request`.
+static std::vector<int> runSampled(const GenerationRequest&              request,
+                                   const std::vector<GenerationRequest>& others,
+                                   size_t*                               admit_slot,
+                                   size_t*                               admit_step) {
+    ContinuousBatchSchedulerConfig config;
+    config.max_batch_size  = 3;
+    config.max_session_len = 48;
+    ContinuousBatchScheduler scheduler(config);
+    SamplingModel            model(config.max_batch_size);
+    for (const GenerationRequest& other : others) {
+        scheduler.enqueue(other);
+    }
+    scheduler.enqueue(request);
+    std::vector<int> output_ids;
+    while (scheduler.hasPendingWork()) {
+        ScheduledBatch batch = scheduler.schedule();
+        for (size_t slot : batch.context_slots) {
+            uint64_t request_id;
+            if (scheduler.getSlotRequest(slot, &request_id) && request_id == request.request_id) {
+                *admit_slot = slot;
+                *admit_step = batch.step;
+            }
+        }
+        scheduler.update(model.step(scheduler, batch));
+        for (GenerationResult& result : scheduler.popFinished()) {
+            if (result.request_id == request.request_id) {
+                output_ids = result.output_ids;
+            }
+        }
+    }
+    return output_ids;
+}
+
+void testSeededSampling() {
+    GenerationRequest request{100, {3, 1, 4, 1, 5}, 24};
+    request.random_seed = 42;
+    size_t                 alone_slot = 0, alone_step = 0;
+    const std::vector<int> alone      = runSampled(request, {}, &alone_slot, &alone_step);
+    EXPECT_TRUE(alone.size() == request.max_new_tokens);
+
+    // two long requests hold slots 0 and 1, the request takes slot 2 once the short one in it is done
+    std::vector<GenerationRequest> others = {GenerationRequest{0, {2, 7}, 30},
+                                             GenerationRequest{1, {1, 8, 2, 8}, 30},
+                                             GenerationRequest{2, {6}, 3}};
+    for (GenerationRequest& other : others) {
+        other.random_seed = 7 + other.request_id;
+    }
+    size_t                 slot = 0, step = 0;
+    const std::vector<int> batched = runSampled(request, others, &slot, &step);
+    EXPECT_TRUE(alone_slot == 0 && alone_step == 0);
+    EXPECT_TRUE(slot == 2 && step == 3);
+    EXPECT_TRUE(batched == alone);
+
+    // the seed drives the sampled tokens
+    request.random_seed = 43;
+    EXPECT_TRUE(runSampled(request, {}, &slot, &step) != alone);
+}
+
+int main() {
+    testOutputsMatchAlone();
+    testInFlightBeatsStaticBatching();
+    testSlotReuseAtStepBoundary();
+    testContextTokenBudget();
+    testInvalidRequests();
+    testConcurrentEnqueue();
+    testDecodeInputs();
+    testSeededSampling();
+    FT_LOG_INFO("Test Done");
+    return 0;
+}
@@ -0,0 +1,492 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "src/fastertransformer/kernels/cpu_sampling_kernels.h"
+#include "src/fastertransformer/utils/cuda_utils.h"
+#include "tests/unittests/unittest_host_utils.h"
+
+using namespace fastertransformer;
+
+#define EXPECT_NEAR(a, b, tol) EXPECT_TRUE(std::fabs((a) - (b)) <= (tol))
+
+void testCurand()
+{
+    const size_t   batch_size = 4;
+    CpuCurandState states[batch_size];
+    cpuCurandInitialize(states, batch_size, 42);
+
+    // every row starts the same stream, as invokeCurandInitialize
+    std::vector<uint32_t> first;
+    for (size_t i = 0; i < 8; i++) {
+        first.push_back(cpuCurand(&states[0]));
+    }
+    for (size_t b = 1; b < batch_size; b++) {
+        for (size_t i = 0; i < first.size(); i++) {
+            EXPECT_TRUE(cpuCurand(&states[b]) == first[i]);
+        }
+    }
+
+    // the batch initialization seeds each row on its own
+    unsigned long long seeds[batch_size] = {42, 7, 42, 1ULL << 40};
+    cpuCurandBatchInitialize(states, batch_size, seeds);
+    std::vector<uint32_t> rows[batch_size];
+    for (size_t b = 0; b < batch_size; b++) {
+        for (size_t i = 0; i < first.size(); i++) {
+            rows[b].push_back(cpuCurand(&states[b]));
+        }
+    }
+    EXPECT_TRUE(rows[0] == first);
+    EXPECT_TRUE(rows[2] == first);
+    EXPECT_FALSE(rows[1] == first);
+    EXPECT_FALSE(rows[3] == first);
+
+    // curand_uniform is in (0, 1] with mean 1/2
+    CpuCurandState state;
+    cpuCurandInitialize(&state, 1, 0);
+    double sum = 0.0;
+    for (int i = 0; i < 100000; i++) {
+        const float u = cpuCurandUniform(&state);
+        EXPECT_TRUE(u > 0.0f && u <= 1.0f);
+        sum += u;
+    }
+    EXPECT_NEAR(sum / 100000, 0.5, 0.01);
+}
+
+void testPenalties()
+{
+    const int          batch_size = 2, vocab_size = 5, vocab_size_padded = 8;
+    std::vector<float> logits = {1, -2, 3, 4, 5, 0, 0, 0, 2, 2, -2, -4, 6, 0, 0, 0};
+    const float        bias[vocab_size_padded] = {1, 1, 1, 1, 1, 0, 0, 0};
+    const float        temperatures[batch_size] = {0.5f, 2.0f};
+
+    cpuBatchApplyTemperaturePenalty(logits.data(), bias, temperatures, batch_size, vocab_size, vocab_size_padded);
+    EXPECT_NEAR(logits[0], 4.0f, 1e-6f);
+    EXPECT_NEAR(logits[1], -2.0f, 1e-6f);
+    EXPECT_NEAR(logits[8 + 3], -1.5f, 1e-6f);
+    EXPECT_TRUE(logits[5] == -FLT_MAX && logits[8 + 7] == -FLT_MAX);
+
+    // output_ids [step, batch]: row 0 repeats id 2, row 1 has a padded input token (id 4) that is not penalized
+    std::vector<float> penalized(batch_size * vocab_size, 0.0f);
+    for (int i = 0; i < vocab_size; i++) {
+        penalized[i]              = i - 2.0f;
+        penalized[vocab_size + i] = i - 2.0f;
+    }
+    const int   output_ids[4 * batch_size] = {2, 0, 4, 4, 2, 1, 2, 3};
+    const int   input_lengths[batch_size]  = {2, 1};
+    const float penalties[batch_size]      = {2.0f, 2.0f};
+    cpuBatchApplyRepetitionPenalty(
+        penalized.data(), penalties, output_ids, batch_size, batch_size, vocab_size, input_lengths, 2, 4);
+    EXPECT_NEAR(penalized[0], -2.0f, 1e-6f);  // id 0 was never generated by row 0
+    EXPECT_NEAR(penalized[2], 0.0f, 1e-6f);
+    EXPECT_NEAR(penalized[4], 1.0f, 1e-6f);  // penalized once although generated twice
+    EXPECT_NEAR(penalized[vocab_size + 0], -4.0f, 1e-6f);
+    EXPECT_NEAR(penalized[vocab_size + 3], 0.5f, 1e-6f);
+    EXPECT_NEAR(penalized[vocab_size + 4], 2.0f, 1e-6f);  // padding of the input is skipped
+}
+
+void testBanBadWords()
+{
+    const int          batch_size = 2, vocab_size_padded = 8;
+    std::vector<float> logits(batch_size * vocab_size_padded, 1.0f);
+    // the words {5} and {1, 2, 3} as [ids, offsets]
+    const int bad_words[2 * 4] = {5, 1, 2, 3, 1, 4, -1, -1};
+    // output_ids [step, batch], step 2 is being sampled
+    const int output_ids[3 * batch_size] = {1, 1, 2, 4, 0, 0};
+    cpuBanBadWords(
+        logits.data(), output_ids, nullptr, batch_size, batch_size, 1, bad_words, true, 4, 0, vocab_size_padded, 2);
+    EXPECT_TRUE(std::isinf(logits[5]) && std::isinf(logits[vocab_size_padded + 5]));
+    EXPECT_TRUE(std::isinf(logits[3]));                  // row 0 generated 1, 2
+    EXPECT_TRUE(logits[vocab_size_padded + 3] == 1.0f);  // row 1 generated 1, 4
+    EXPECT_TRUE(logits[1] == 1.0f && logits[2] == 1.0f);
+}
+
+void testTopKSampling()
+{
+    const int                vocab_size_padded      = 8;
+    const float              row[vocab_size_padded] = {0.5f, 2.0f, -1.0f, 2.0f, 1.0f, 0.0f, -FLT_MAX, -FLT_MAX};
+    const int                end_id                 = 7;
+    const float              top_p                  = 1.0f;
+    const unsigned long long seed                   = 1234;
+
+    // k = 1 is greedy, equal logits go to the lower id
+    int top_k = 1, id = -1, step = 0;
+    cpuBatchTopKSampling(row, &seed, &step, &id, nullptr, nullptr, nullptr, nullptr, &top_k, &top_p, vocab_size_padded,
+                         &end_id, 1, nullptr);
+    EXPECT_TRUE(id == 1);
+
+    // the frequencies over the steps follow the softmax over the top-k logits
+    top_k                      = 3;
+    const int        num_draws = 30000;
+    std::vector<int> counts(vocab_size_padded, 0);
+    for (int i = 0; i < num_draws; i++) {
+        cpuBatchTopKSampling(row, &seed, &i, &id, nullptr, nullptr, nullptr, nullptr, &top_k, &top_p, vocab_size_padded,
+                             &end_id, 1, nullptr);
+        counts[id]++;
+    }
+    const float sum = 2 * std::exp(2.0f) + std::exp(1.0f);
+    EXPECT_NEAR(counts[1] / (float)num_draws, std::exp(2.0f) / sum, 0.015f);
+    EXPECT_NEAR(counts[3] / (float)num_draws, std::exp(2.0f) / sum, 0.015f);
+    EXPECT_NEAR(counts[4] / (float)num_draws, std::exp(1.0f) / sum, 0.015f);
+    EXPECT_TRUE(counts[1] + counts[3] + counts[4] == num_draws);
+
+    // finished rows emit end_id; log probs are conditioned on the top-k set
+    std::vector<float> probs(row, row + vocab_size_padded);
+    bool               finished[2]         = {true, false};
+    int                ids[2]              = {-1, -1};
+    int                sequence_length[2]  = {3, 3};
+    float              cum_log_probs[2]    = {0.0f, -1.0f};
+    float              output_log_probs[2] = {0.0f, 0.0f};
+    int                top_ks[2]           = {1, 1};
+    float              top_ps[2]           = {1.0f, 1.0f};
+    int                end_ids[2]          = {end_id, end_id};
+    probs.insert(probs.end(), row, row + vocab_size_padded);
+    cpuAddBiasSoftMax(probs.data(), nullptr, end_ids, nullptr, 2, vocab_size_padded, 6);
+    const unsigned long long seeds[2] = {1, 1};
+    const int                steps[2] = {0, 0};
+    cpuBatchTopKSampling(probs.data(), seeds, steps, ids, sequence_length, finished, cum_log_probs, output_log_probs,
+                         top_ks, top_ps, vocab_size_padded, end_ids, 2, nullptr);
+    EXPECT_TRUE(ids[0] == end_id && sequence_length[0] == 3 && finished[0]);
+    EXPECT_TRUE(ids[1] == 1 && sequence_length[1] == 4 && !finished[1]);
+    EXPECT_NEAR(cum_log_probs[1], -1.0f + std::log(probs[vocab_size_padded + 1]), 1e-5f);
+    EXPECT_NEAR(output_log_probs[1], 0.0f, 1e-6f);
+}
+
+void testTopPSampling()
+{
+    const int                batch_size = 3, vocab_size_padded = 4;
+    std::vector<float>       probs = {0.1f, 0.4f, 0.2f, 0.3f, 0.1f, 0.6f, 0.2f, 0.1f, 0.25f, 0.25f, 0.25f, 0.25f};
+    const float              top_ps[batch_size]      = {0.7f, 0.5f, 0.9f};
+    const bool               skip_decode[batch_size] = {false, false, true};
+    const int                end_ids[batch_size]     = {0, 0, 0};
+    const unsigned long long seeds[batch_size]       = {99, 99, 99};
+
+    const int        num_draws = 30000;
+    std::vector<int> counts(vocab_size_padded, 0);
+    int              ids[batch_size] = {-1, -1, -1};
+    for (int i = 0; i < num_draws; i++) {
+        const int steps[batch_size] = {i, i, i};
+        cpuBatchTopPSampling(probs.data(), seeds, steps, ids, nullptr, nullptr, nullptr, nullptr, top_ps,
+                             vocab_size_padded, end_ids, batch_size, skip_decode);
+        counts[ids[0]]++;
+        // the most likely token alone covers top_p
+        EXPECT_TRUE(ids[1] == 1);
+    }
+    // the nucleus of row 0 is {1, 3}
+    EXPECT_NEAR(counts[1] / (float)num_draws, 0.4f / 0.7f, 0.015f);
+    EXPECT_NEAR(counts[3] / (float)num_draws, 0.3f / 0.7f, 0.015f);
+    EXPECT_TRUE(counts[1] + counts[3] == num_draws);
+
+    // skipped rows are untouched
+    EXPECT_TRUE(ids[2] == -1);
+}
+
+void testStopCriteria()
+{
+    const int batch_size = 2;
+    // row 0 stops on {3, 4}, row 1 on {4}; output_ids [step, batch]
+    const int stop_words[batch_size * 2 * 2] = {3, 4, 2, -1, 4, 0, 1, -1};
+    const int output_ids[3 * batch_size]     = {1, 1, 3, 3, 4, 5};
+    bool      finished[batch_size]           = {false, false};
+    cpuStopWordsCriterion(output_ids, nullptr, stop_words, finished, 0, 2, batch_size, 1, 2);
+    EXPECT_TRUE(finished[0]);
+    EXPECT_FALSE(finished[1]);
+
+    const uint32_t limits[batch_size] = {5, 3};
+    bool           should_stop        = false;
+    cpuLengthCriterion(finished, &should_stop, limits, batch_size, 1, 2);
+    EXPECT_FALSE(finished[1] || should_stop);
+    cpuLengthCriterion(finished, &should_stop, limits, batch_size, 1, 3);
+    EXPECT_TRUE(finished[1] && should_stop);
+}
+
+void testLogProbFromLogits()
+{
+    const size_t       batch_size = 2, max_input_length = 3, vocab_size = 3, vocab_size_padded = 4;
+    std::vector<float> logits(max_input_length * batch_size * vocab_size_padded);
+    for (size_t i = 0; i < logits.size(); i++) {
+        logits[i] = std::sin((float)i);
+    }
+    // [max_input_length, batch_size]
+    const int input_ids[max_input_length * batch_size] = {0, 1, 2, 0, 1, 2};
+    const int input_lengths[batch_size]                = {3, 2};
+    float     cum_log_probs[batch_size];
+    cpuLogProbFromLogits(cum_log_probs, logits.data(), input_ids, input_lengths, max_input_length, batch_size,
+                         vocab_size, vocab_size_padded);
+
+    for (size_t b = 0; b < batch_size; b++) {
+        double expected = 0.0;
+        for (int step = 0; step < input_lengths[b] - 1; step++) {
+            const float* row     = logits.data() + (step * batch_size + b) * vocab_size_padded;
+            double       sum_exp = 0.0;
+            for (size_t i = 0; i < vocab_size; i++) {
+                sum_exp += std::exp((double)row[i]);
+            }
+            expected += row[input_ids[(step + 1) * batch_size + b]] - std::log(sum_exp);
+        }
+        EXPECT_NEAR(cum_log_probs[b], expected, 1e-5);
+    }
+}
+
+// Runs `num_steps` decode steps from the same seed and returns the output ids [step, batch].
+void testTopLogProbs()
+{
+    const int          batch_size = 4, vocab_size = 50, vocab_size_padded = 56, max_num = 8;
+    std::vector<float> logits(batch_size * vocab_size_padded, 0.0f);
+    for (int b = 0; b < batch_size; b++) {
+        for (int i = 0; i < vocab_size; i++) {
+            logits[b * vocab_size_padded + i] = std::sin(0.37f * (i + 1) * (b + 2)) * 4.0f;
+        }
+    }
+    // rows 0 and 3 have a tie, broken by token id
+    logits[3 * vocab_size_padded + 10] = 9.0f;
+    logits[3 * vocab_size_padded + 4]  = 9.0f;
+    const std::vector<int> num = {3, 0, 8, 8};
+
+    std::vector<int>   ids(batch_size * max_num);
+    std::vector<float> log_probs(batch_size * max_num);
+    cpuTopLogProbs(ids.data(),
+                   log_probs.data(),
+                   logits.data(),
+                   num.data(),
+                   nullptr,
+                   max_num,
+                   batch_size,
+                   vocab_size,
+                   vocab_size_padded,
+                   false);
+    for (int b = 0; b < batch_size; b++) {
+        const float* row       = logits.data() + b * vocab_size_padded;
+        const float  max_logit = *std::max_element(row, row + vocab_size);
+        float        sum_exp   = 0.0f;
+        for (int i = 0; i < vocab_size; i++) {
+            sum_exp += std::exp(row[i] - max_logit);
+        }
+        for (int i = 0; i < max_num; i++) {
+            const int   id       = ids[b * max_num + i];
+            const float log_prob = log_probs[b * max_num + i];
+            if (i >= num[b]) {
+                EXPECT_TRUE(id == -1 && std::isinf(log_prob) && log_prob < 0.0f);
+                continue;
+            }
+            EXPECT_TRUE(0 <= id && id < vocab_size);
+            EXPECT_NEAR(log_prob, row[id] - max_logit - std::log(sum_exp), 1e-5f);
+            // no other token is more likely than the i-th one unless it is listed before
+            int num_greater = 0;
+            for (int j = 0; j < vocab_size; j++) {
+                num_greater += row[j] > row[id] || (row[j] == row[id] && j < id);
+            }
+            EXPECT_TRUE(num_greater == i);
+        }
+    }
+    EXPECT_TRUE(ids[3 * max_num + 0] == 4 && ids[3 * max_num + 1] == 10);
+
+    // the same alternatives from the probabilities of the sampling softmax
+    std::vector<float>      probs = logits;
+    std::unique_ptr<bool[]> finished(new bool[batch_size]());
+    std::vector<int>        end_ids(batch_size, 0);
+    cpuAddBiasSoftMax(
+        probs.data(), nullptr, end_ids.data(), finished.get(), batch_size, vocab_size_padded, vocab_size);
+    std::vector<int>   prob_ids(batch_size * max_num);
+    std::vector<float> prob_log_probs(batch_size * max_num);
+    cpuTopLogProbs(prob_ids.data(),
+                   prob_log_probs.data(),
+                   probs.data(),
+                   num.data(),
+                   nullptr,
+                   max_num,
+                   batch_size,
+                   vocab_size,
+                   vocab_size_padded,
+                   true);
+    EXPECT_TRUE(prob_ids == ids);
+    for (int i = 0; i < batch_size * max_num; i++) {
+        EXPECT_TRUE(ids[i] == -1 || std::fabs(prob_log_probs[i] - log_probs[i]) <= 1e-4f);
+    }
+
+    // skipped rows are left to the other sampling layer
+    std::unique_ptr<bool[]> skip_decode(new bool[batch_size]());
+    skip_decode[2] = true;
+    std::vector<int>   skipped_ids(batch_size * max_num, 7);
+    std::vector<float> skipped_log_probs(batch_size * max_num);
+    cpuTopLogProbs(skipped_ids.data(),
+                   skipped_log_probs.data(),
+                   logits.data(),
+                   nullptr,
+                   skip_decode.get(),
+                   max_num,
+                   batch_size,
+                   vocab_size,
+                   vocab_size_padded,
+                   false);
+    for (int i = 0; i < max_num; i++) {
+        EXPECT_TRUE(skipped_ids[2 * max_num + i] == 7);
+        EXPECT_TRUE(i >= num[0] || skipped_ids[i] == ids[i]);
+    }
+    EXPECT_TRUE(std::equal(skipped_ids.begin() + 3 * max_num, skipped_ids.end(), ids.begin() + 3 * max_num));
+
+    // fewer tokens than alternatives
+    const std::vector<float> small = {0.5f, 2.0f, 1.0f, 0.0f};
+    std::vector<int>         small_ids(max_num);
+    std::vector<float>       small_log_probs(max_num);
+    cpuTopLogProbs(
+        small_ids.data(), small_log_probs.data(), small.data(), nullptr, nullptr, max_num, 1, 3, 4, false);
+    EXPECT_TRUE(small_ids[0] == 1 && small_ids[1] == 2 && small_ids[2] == 0 && small_ids[3] == -1);
+
+    // in a decode step, from both sampling layers: row 0 is greedy (top-k), row 1 is top-p
+    const std::vector<uint32_t>           top_ks = {1, 0};
+    const std::vector<float>              top_ps = {0.0f, 0.9f};
+    const std::vector<unsigned long long> seeds(2, 7);
+    std::vector<int>                      output_ids(2 * 2, 0);
+    std::vector<int>                      sequence_length(2, 1);
+    std::vector<float> step_logits(logits.begin(), logits.begin() + 2 * vocab_size_padded);
+    std::vector<int>   step_ids(2 * max_num);
+    std::vector<float> step_log_probs(2 * max_num);
+
+    CpuDynamicDecodeOutputs outputs;
+    outputs.output_ids            = output_ids.data();
+    outputs.finished              = finished.get();
+    outputs.sequence_length       = sequence_length.data();
+    outputs.top_log_prob_ids      = step_ids.data();
+    outputs.top_log_probs         = step_log_probs.data();
+    outputs.max_num_top_log_probs = max_num;
+    CpuDynamicDecodeInputs inputs;
+    inputs.logits        = step_logits.data();
+    inputs.step          = 1;
+    inputs.end_ids       = end_ids.data();
+    inputs.runtime_top_k = top_ks.data();
+    inputs.runtime_top_p = top_ps.data();
+    cpuDynamicDecode(&outputs, inputs, seeds.data(), 2, vocab_size, vocab_size_padded);
+    EXPECT_TRUE(step_ids[0] == output_ids[2 + 0]);
+    for (int i = 0; i < 2 * max_num; i++) {
+        EXPECT_TRUE(step_ids[i] == skipped_ids[i]);
+        EXPECT_NEAR(step_log_probs[i], skipped_log_probs[i], 1e-4f);
+    }
+}
+
+static std::vector<int> runDecode(const std::vector<uint32_t>& top_ks,
+                                  const std::vector<float>&    top_ps,
+                                  const std::vector<float>&    temperatures,
+                                  int                          num_steps,
+                                  std::vector<bool>*           finished_out = nullptr,
+                                  bool*                        should_stop  = nullptr)
+{
+    const int batch_size = top_ks.size(), vocab_size = 6, vocab_size_padded = 8, max_input_length = 1;
+    const int max_seq_len = max_input_length + num_steps;
+
+    std::vector<int>                      output_ids(max_seq_len * batch_size, 1);
+    std::vector<int>                      end_ids(batch_size, 0);
+    std::vector<int>                      sequence_length(batch_size, max_input_length);
+    std::vector<uint32_t>                 limits(batch_size, max_seq_len - 1);
+    std::unique_ptr<bool[]>               finished(new bool[batch_size]());
+    std::vector<float>                    cum_log_probs(batch_size, 0.0f);
+    const std::vector<unsigned long long> seeds(batch_size, 2022);
+
+    CpuDynamicDecodeOutputs outputs;
+    outputs.output_ids      = output_ids.data();
+    outputs.finished        = finished.get();
+    outputs.sequence_length = sequence_length.data();
+    outputs.cum_log_probs   = cum_log_probs.data();
+
+    std::vector<float> logits(batch_size * vocab_size_padded);
+    for (int step = max_input_length; step < max_seq_len; step++) {
+        for (int b = 0; b < batch_size; b++) {
+            for (int i = 0; i < vocab_size_padded; i++) {
+                logits[b * vocab_size_padded + i] = std::cos(0.7f * (i + 1) * (step + 1));
+            }
+        }
+        CpuDynamicDecodeInputs inputs;
+        inputs.logits                = logits.data();
+        inputs.step                  = step;
+        inputs.max_input_length      = max_input_length;
+        inputs.end_ids               = end_ids.data();
+        inputs.runtime_top_k         = top_ks.data();
+        inputs.runtime_top_p         = top_ps.data();
+        inputs.temperature           = temperatures.data();
+        inputs.sequence_limit_length = limits.data();
+        cpuDynamicDecode(&outputs, inputs, seeds.data(), batch_size, vocab_size, vocab_size_padded);
+    }
+    if (finished_out != nullptr) {
+        finished_out->assign(finished.get(), finished.get() + batch_size);
+    }
+    if (should_stop != nullptr) {
+        *should_stop = outputs.should_stop;
+    }
+    return output_ids;
+}
+
+void testDynamicDecode()
+{
+    const int              num_steps = 12;
+    std::vector<uint32_t>  top_ks    = {2, 0, 0, 4};
+    std::vector<float>     top_ps    = {0.0f, 0.9f, 0.0f, 0.5f};
+    std::vector<float>     temps     = {1.0f, 0.7f, 1.0f, 1.3f};
+    std::vector<bool>      finished;
+    bool                   should_stop = false;
+    const std::vector<int> ids         = runDecode(top_ks, top_ps, temps, num_steps, &finished, &should_stop);
+    const int              batch_size  = top_ks.size();
+
+    // reproducible from the seed
+    EXPECT_TRUE(ids == runDecode(top_ks, top_ps, temps, num_steps));
+
+    // top_k = top_p = 0 decodes greedily, until end_id = 0 is generated
+    for (int step = 1; step <= num_steps; step++) {
+        int greedy = 0;
+        for (int i = 1; i < 6; i++) {
+            if (std::cos(0.7f * (i + 1) * (step + 1)) > std::cos(0.7f * (greedy + 1) * (step + 1))) {
+                greedy = i;
+            }
+        }
+        EXPECT_TRUE(ids[step * batch_size + 2] == greedy || ids[(step - 1) * batch_size + 2] == 0);
+    }
+
+    // a row only depends on its own arguments and random stream
+    std::vector<uint32_t>  other_top_ks = {2, 3, 0, 4};
+    std::vector<float>     other_temps  = {1.0f, 0.7f, 1.0f, 2.0f};
+    const std::vector<int> other_ids    = runDecode(other_top_ks, top_ps, other_temps, num_steps);
+    for (int step = 0; step <= num_steps; step++) {
+        EXPECT_TRUE(ids[step * batch_size + 0] == other_ids[step * batch_size + 0]);
+        EXPECT_TRUE(ids[step * batch_size + 2] == other_ids[step * batch_size + 2]);
+    }
+
+    // the length limit stops every sequence
+    EXPECT_TRUE(should_stop);
+    for (int b = 0; b < batch_size; b++) {
+        EXPECT_TRUE(finished[b]);
+    }
+}
+
+int main()
+{
+    testCurand();
+    testPenalties();
+    testBanBadWords();
+    testTopKSampling();
+    testTopPSampling();
+    testStopCriteria();
+    testLogProbFromLogits();
+    testTopLogProbs();
+    testDynamicDecode();
+    FT_LOG_INFO("Test Done");
+    return 0;
+}
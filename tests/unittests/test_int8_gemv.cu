@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Loads a GPT-J QKV weight with loadWeightFromBinQ and multiplies it with int8WeightPerChannelLdkMultiplicationLauncher
+// as DecoderSelfAttentionLayer does, n = 3 * hidden_units / tensor_para_size and k = hidden_units, against a host
+// GEMM of the source weight.
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "src/fastertransformer/kernels/matrix_vector_multiplication.h"
+#include "src/fastertransformer/layers/DenseWeight.h"
+#include "src/fastertransformer/utils/cuda_utils.h"
+#include "src/fastertransformer/utils/memory_utils.h"
+
+using namespace fastertransformer;
+
+static const std::string WEIGHT_FILE = "test_int8_gemv.query_key_value.weight.bin";
+
+void testQkvGemv(size_t hidden_units, size_t tensor_para_size, int m)
+{
+    const size_t k = hidden_units;
+    const size_t n = 3 * hidden_units / tensor_para_size;
+
+    std::mt19937                          gen((unsigned int)(hidden_units + tensor_para_size + m));
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    std::vector<float>                    weight(k * n);
+    std::vector<float>                    input(m * k);
+    for (auto& x : weight) {
+        x = dist(gen);
+    }
+    for (size_t c = 0; c < n; c++) {
+        // the largest magnitude of every output channel is positive, so that the max / 127 scale does not saturate
+        weight[c] = 2.0f;
+    }
+    for (auto& x : input) {
+        x = dist(gen);
+    }
+    {
+        std::ofstream out(WEIGHT_FILE, std::ios::out | std::ios::binary);
+        out.write((char*)weight.data(), sizeof(float) * weight.size());
+    }
+
+    DenseWeight<float> qkv_weight;
+    loadWeightFromBinQ<float>(qkv_weight, {k, n}, WEIGHT_FILE);
+    FT_CHECK(qkv_weight.int8_kernel != nullptr && qkv_weight.scale != nullptr);
+
+    float* d_input;
+    float* d_output;
+    deviceMalloc(&d_input, m * k, false);
+    deviceMalloc(&d_output, m * n, false);
+    cudaH2Dcpy(d_input, input.data(), m * k);
+    int8WeightPerChannelLdkMultiplicationLauncher(
+        qkv_weight.int8_kernel, d_input, qkv_weight.scale, d_output, m, (int)n, (int)k, 0);
+    std::vector<float> output(m * n);
+    std::vector<float> scales(n);
+    cudaD2Hcpy(output.data(), d_output, m * n);
+    cudaD2Hcpy(scales.data(), qkv_weight.scale, n);
+    check_cuda_error(cudaDeviceSynchronize());
+
+    for (int m_i = 0; m_i < m; m_i++) {
+        for (size_t c = 0; c < n; c++) {
+            double ref       = 0.0;
+            double tolerance = 1e-3;
+            for (size_t r = 0; r < k; r++) {
+                ref += (double)input[m_i * k + r] * weight[r * n + c];
+                // rounding error of half a quantization step per weight
+                tolerance += std::fabs(input[m_i * k + r]) * scales[c] * 0.5;
+            }
+            FT_CHECK_WITH_INFO(std::fabs(output[m_i * n + c] - ref) <= tolerance,
+                               fmtstr("hidden_units=%ld, tensor_para_size=%ld, m=%d: output[%d][%ld] = %f, expect %f",
+                                      hidden_units,
+                                      tensor_para_size,
+                                      m,
+                                      m_i,
+                                      c,
+                                      output[m_i * n + c],
+                                      ref));
+        }
+    }
+
+    deviceFree(d_input);
+    deviceFree(d_output);
+    int8_t* int8_kernel = const_cast<int8_t*>(qkv_weight.int8_kernel);
+    float*  scale       = const_cast<float*>(qkv_weight.scale);
+    deviceFree(int8_kernel);
+    deviceFree(scale);
+    remove(WEIGHT_FILE.c_str());
+}
+
+int main()
+{
+    // the INT8 GEMV is only used for batch sizes up to 2
+    for (size_t hidden_units : {256, 1024}) {
+        for (size_t tensor_para_size : {1, 2}) {
+            for (int m : {1, 2}) {
+                testQkvGemv(hidden_units, tensor_para_size, m);
+            }
+        }
+    }
+    FT_LOG_INFO("Test Done");
+    return 0;
+}
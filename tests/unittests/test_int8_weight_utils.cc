@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "src/fastertransformer/utils/int8_weight_utils.h"
+#include "tests/unittests/unittest_host_utils.h"
+
+using namespace fastertransformer;
+
+static const std::string SOURCE_FILE = "test_int8_weight_utils.weight.bin";
+
+static std::vector<float> makeWeight(size_t dim0, size_t dim1) {
+    std::vector<float> weight(dim0 * dim1);
+    for (size_t i = 0; i < weight.size(); i++) {
+        weight[i] = (float)((i * 2654435761u) % 4001) / 1000.0f - 2.0f;
+    }
+    return weight;
+}
+
+void testScaleRule() {
+    const float weight[2 * 4] = {-1.0f, 0.5f, 2.54f, -0.25f,
+                                 -3.0f, 0.1f, 0.2f,  0.3f};
+    float scales[2];
+    calibrateInt8WeightRows(weight, 2, 4, scales);
+    EXPECT_TRUE(scales[0] == (float)std::max(2.54 / 127.0, -1.0 / 128.0));
+    EXPECT_TRUE(scales[1] == (float)std::max(0.3 / 127.0, -3.0 / 128.0));
+}
+
+void testRoundHalfEvenAndSaturate() {
+    const float weight[8] = {0.5f, 1.5f, 2.5f, -0.5f, -2.5f, 200.0f, -200.0f, -128.4f};
+    const float scale     = 1.0f;
+    int8_t      out[8];
+    quantizeInt8WeightRows(weight, 1, 8, &scale, out);
+    const int8_t expected[8] = {0, 2, 2, 0, -2, 127, -128, -128};
+    EXPECT_TRUE(memcmp(out, expected, sizeof(out)) == 0);
+
+    // the weight is divided by its scale, so that int8 * scale, as computed by the GEMV kernel, gives it back
+    const float scales[2]    = {0.5f, 0.0f};
+    const float weight2[2 * 2] = {1.0f, -64.0f, 3.0f, -3.0f};
+    int8_t      out2[4];
+    quantizeInt8WeightRows(weight2, 2, 2, scales, out2);
+    EXPECT_TRUE(out2[0] == 2 && out2[1] == -128 && out2[2] == 0 && out2[3] == 0);
+}
+
+void testFileRoundTrip() {
+    const size_t       dim0 = 16, dim1 = 12;
+    std::vector<float> weight = makeWeight(dim0, dim1);
+    {
+        std::ofstream out(SOURCE_FILE, std::ios::out | std::ios::binary);
+        out.write((char*)weight.data(), sizeof(float) * weight.size());
+    }
+    // one scale per output channel, dim1
+    std::vector<float> transposed(dim0 * dim1);
+    transposeInt8WeightSource(weight.data(), dim0, dim1, transposed.data());
+    EXPECT_TRUE(transposed[5 * dim0 + 3] == weight[3 * dim1 + 5]);
+    std::vector<float>  scales(dim1);
+    std::vector<int8_t> int8_weight(dim0 * dim1);
+    calibrateInt8WeightRows(transposed.data(), dim1, dim0, scales.data());
+    quantizeInt8WeightRows(transposed.data(), dim1, dim0, scales.data(), int8_weight.data());
+
+    const std::string int8_file = getInt8WeightFileName(SOURCE_FILE);
+    EXPECT_TRUE(int8_file == "test_int8_weight_utils.weight.int8");
+    EXPECT_TRUE(writeInt8WeightFile(
+        int8_file, dim0, dim1, FP32, sizeof(float) * weight.size(), scales.data(), int8_weight.data()));
+
+    Int8WeightFileReader reader;
+    EXPECT_TRUE(reader.open(int8_file, dim0, dim1, FP32, SOURCE_FILE));
+    EXPECT_TRUE(memcmp(reader.scales(), scales.data(), sizeof(float) * dim1) == 0);
+    EXPECT_TRUE(memcmp(reader.int8Weight(), int8_weight.data(), dim0 * dim1) == 0);
+
+    // stale files are rejected
+    EXPECT_FALSE(reader.open(int8_file, dim0, dim1 + 4, FP32, SOURCE_FILE));
+    EXPECT_FALSE(reader.open(int8_file, dim0 * 2, dim1 / 2, FP32, SOURCE_FILE));
+    EXPECT_FALSE(reader.open(int8_file, dim0, dim1, FP16, SOURCE_FILE));
+    {
+        std::ofstream out(SOURCE_FILE, std::ios::out | std::ios::binary | std::ios::app);
+        out.write((char*)weight.data(), sizeof(float));
+    }
+    EXPECT_FALSE(reader.open(int8_file, dim0, dim1, FP32, SOURCE_FILE));
+    remove(SOURCE_FILE.c_str());
+    // without the source weight, only the header is checked
+    EXPECT_TRUE(reader.open(int8_file, dim0, dim1, FP32, SOURCE_FILE));
+
+    {
+        std::fstream io(int8_file, std::ios::in | std::ios::out | std::ios::binary);
+        Int8WeightFileHeader header;
+        io.read((char*)&header, sizeof(header));
+        header.version = INT8_WEIGHT_FILE_VERSION + 1;
+        io.seekp(0);
+        io.write((char*)&header, sizeof(header));
+    }
+    EXPECT_FALSE(reader.open(int8_file, dim0, dim1, FP32, SOURCE_FILE));
+    EXPECT_FALSE(reader.open("test_int8_weight_utils.none.int8", dim0, dim1, FP32, SOURCE_FILE));
+    remove(int8_file.c_str());
+}
+
+template<typename T_IN>
+static std::vector<T_IN> makeRandomWeight(size_t dim0, size_t dim1, unsigned int seed) {
+    std::mt19937                          gen(seed);
+    std::uniform_real_distribution<float> dist(-2.0f, 2.0f);
+    std::vector<T_IN>                     weight(dim0 * dim1);
+    for (size_t i = 0; i < weight.size(); i++) {
+        weight[i] = (T_IN)dist(gen);
+    }
+    return weight;
+}
+
+// The reference: the scalar functions on the transposed weight.
+template<typename T_IN>
+static void checkSameAsScalar(const std::vector<T_IN>& weight, size_t dim0, size_t dim1, int num_threads) {
+    std::vector<T_IN> transposed(dim0 * dim1);
+    transposeInt8WeightSource(weight.data(), dim0, dim1, transposed.data());
+    std::vector<float>  ref_scales(dim1);
+    std::vector<int8_t> ref_int8_weight(dim1 * dim0);
+    calibrateInt8WeightRows(transposed.data(), dim1, dim0, ref_scales.data());
+    quantizeInt8WeightRows(transposed.data(), dim1, dim0, ref_scales.data(), ref_int8_weight.data());
+
+    std::vector<float>  scales(dim1);
+    std::vector<int8_t> int8_weight(dim1 * dim0);
+    calibrateAndQuantizeInt8WeightColumns(weight.data(), dim0, dim1, scales.data(), int8_weight.data(), num_threads);
+    EXPECT_TRUE(memcmp(scales.data(), ref_scales.data(), sizeof(float) * dim1) == 0);
+    EXPECT_TRUE(memcmp(int8_weight.data(), ref_int8_weight.data(), dim1 * dim0) == 0);
+}
+
+template<typename T_IN>
+void testFusedMatchesScalar() {
+    // dim1 values cover the vector body only, the scalar tail only and both, dim0 values one and several row tiles
+    const size_t shapes[][2] = {{8, 1}, {5, 3}, {64, 7}, {37, 16}, {96, 33}, {130, 77}, {1000, 64}, {20, 2000}};
+    for (bool simd : {false, true}) {
+        setInt8WeightSimdEnabled(simd);
+        for (auto& shape : shapes) {
+            std::vector<T_IN> weight = makeRandomWeight<T_IN>(shape[0], shape[1], (unsigned int)(shape[0] * shape[1]));
+            for (int num_threads : {1, 3, 8}) {
+                checkSameAsScalar(weight, shape[0], shape[1], num_threads);
+            }
+        }
+    }
+    setInt8WeightSimdEnabled(true);
+}
+
+void testFusedSpecialValues() {
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const float inf = std::numeric_limits<float>::infinity();
+    const size_t dim0 = 20, dim1 = 14;
+    std::vector<float> weight = makeRandomWeight<float>(dim0, dim1, 7);
+    weight[9 * dim1 + 0]  = nan;  // NaNs are skipped by the min/max scan
+    weight[17 * dim1 + 9] = nan;  // ... also in the scalar tail columns
+    for (size_t r = 0; r < dim0; r++) {
+        weight[r * dim1 + 2] = -(float)r;  // max is 0
+        weight[r * dim1 + 5] = r % 2 ? 1e-30f : -1e-30f;  // tiny values
+    }
+    weight[3 * dim1 + 2]  = -0.0f;
+    weight[4 * dim1 + 3]  = inf;
+    weight[0 * dim1 + 4]  = -inf;
+    weight[6 * dim1 + 10] = 1e30f;  // saturates
+    for (bool simd : {false, true}) {
+        setInt8WeightSimdEnabled(simd);
+        checkSameAsScalar(weight, dim0, dim1, 2);
+    }
+    setInt8WeightSimdEnabled(true);
+}
+
+// Host model of int8WeightPerChannelLdkMultiplication, with the indexing of the kernel: block b handles the output
+// channels [b * N_PER_THREAD, (b + 1) * N_PER_THREAD) and reads their scales as one array from scale_list + b.
+// Out of bound reads throw.
+static std::vector<float> int8GemvModel(const std::vector<int8_t>& weight,
+                                        const std::vector<float>&  input,
+                                        const std::vector<float>&  scale_list,
+                                        int                        m,
+                                        int                        n,
+                                        int                        k) {
+    const int          N_PER_THREAD = 2;  // nPerThread of int8WeightPerChannelLdkMultiplicationLauncher
+    std::vector<float> output(m * n, 0.0f);
+    for (int bidx = 0; bidx < n / N_PER_THREAD; bidx++) {
+        for (int i = 0; i < N_PER_THREAD; i++) {
+            const int   row   = bidx * N_PER_THREAD + i;
+            const float scale = scale_list.at(bidx * N_PER_THREAD + i);
+            for (int m_i = 0; m_i < m; m_i++) {
+                float sum = 0.0f;
+                for (int k_idx = 0; k_idx < k; k_idx++) {
+                    sum += (float)weight.at((size_t)row * k + k_idx) * input.at(m_i * k + k_idx) * scale;
+                }
+                output.at(m_i * n + row) = sum;
+            }
+        }
+    }
+    return output;
+}
+
+// The QKV weight of GPT-J, {hidden_units, 3 * hidden_units / tensor_para_size}, quantized as by loadWeightFromBinQ
+// and multiplied as by DecoderSelfAttentionLayer: n = 3 * local_hidden_units, k = hidden_units.
+void testQkvGemvShape() {
+    const size_t hidden_units = 64;
+    const int    m            = 2;
+    for (size_t tensor_para_size : {1, 2, 4}) {
+        const size_t       dim0   = hidden_units;
+        const size_t       dim1   = 3 * hidden_units / tensor_para_size;
+        std::vector<float> weight = makeRandomWeight<float>(dim0, dim1, (unsigned int)tensor_para_size);
+        for (size_t c = 0; c < dim1; c++) {
+            // the largest magnitude of every column is positive, so that the max / 127 scale does not saturate
+            weight[c] = 2.0f;
+        }
+        std::vector<float> input = makeRandomWeight<float>(m, dim0, 11);
+
+        std::vector<float>  scales(dim1);
+        std::vector<int8_t> int8_weight(dim1 * dim0);
+        calibrateAndQuantizeInt8WeightColumns(weight.data(), dim0, dim1, scales.data(), int8_weight.data());
+        std::vector<float> output = int8GemvModel(int8_weight, input, scales, m, (int)dim1, (int)dim0);
+
+        for (int m_i = 0; m_i < m; m_i++) {
+            for (size_t c = 0; c < dim1; c++) {
+                double ref       = 0.0;
+                double tolerance = 1e-4;
+                for (size_t r = 0; r < dim0; r++) {
+                    ref += (double)input[m_i * dim0 + r] * weight[r * dim1 + c];
+                    // rounding error of half a quantization step per weight
+                    tolerance += std::fabs(input[m_i * dim0 + r]) * scales[c] * 0.5;
+                }
+                EXPECT_TRUE(std::fabs(output[m_i * dim1 + c] - ref) <= tolerance);
+            }
+        }
+    }
+}
+
+int main() {
+    testScaleRule();
+    testRoundHalfEvenAndSaturate();
+    testFileRoundTrip();
+    testFusedMatchesScalar<float>();
+    testFusedMatchesScalar<half>();
+    testFusedSpecialValues();
+    testQkvGemvShape();
+    FT_LOG_INFO("Test Done");
+    return 0;
+}
@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "src/fastertransformer/utils/cuda_utils.h"
+#include "src/fastertransformer/utils/kv_block_manager.h"
+#include "tests/unittests/unittest_host_utils.h"
+
+using namespace fastertransformer;
+
+void testAllocateAndAppend() {
+    KVBlockManager manager(8, 4);
+    EXPECT_TRUE(manager.allocateSequence(0, 5));
+    EXPECT_TRUE((manager.getBlockTable(0) == std::vector<int>{0, 1}));
+    EXPECT_TRUE(manager.getNumFreeBlocks() == 6);
+    // fills the second block, then starts a third one
+    EXPECT_TRUE(manager.appendTokens(0, 3));
+    EXPECT_TRUE(manager.getBlockTable(0).size() == 2 && manager.getSequenceLength(0) == 8);
+    EXPECT_TRUE(manager.appendTokens(0));
+    EXPECT_TRUE(manager.getBlockTable(0).size() == 3 && manager.getSequenceLength(0) == 9);
+    EXPECT_TRUE(manager.popPendingCopies().empty());
+
+    manager.freeSequence(0);
+    EXPECT_FALSE(manager.hasSequence(0));
+    EXPECT_TRUE(manager.getNumFreeBlocks() == 8);
+    manager.freeSequence(0);  // no-op
+}
+
+void testOutOfBlocksChangesNothing() {
+    KVBlockManager manager(3, 4);
+    EXPECT_FALSE(manager.canAllocate(13));
+    EXPECT_FALSE(manager.allocateSequence(0, 13));
+    EXPECT_FALSE(manager.hasSequence(0));
+    EXPECT_TRUE(manager.allocateSequence(0, 10));
+    EXPECT_FALSE(manager.appendTokens(0, 3));
+    EXPECT_TRUE(manager.getSequenceLength(0) == 10 && manager.getNumFreeBlocks() == 0);
+    EXPECT_TRUE(manager.appendTokens(0, 2));
+    EXPECT_FALSE(manager.appendTokens(0));
+
+    bool failed = false;
+    try {
+        manager.allocateSequence(0, 1);
+    } catch (std::runtime_error&) {
+        failed = true;
+    }
+    EXPECT_TRUE(failed);
+}
+
+void testForkAndCopyOnWrite() {
+    KVBlockManager manager(8, 4);
+    EXPECT_TRUE(manager.allocateSequence(0, 6));
+    manager.forkSequence(0, 1);
+    EXPECT_TRUE(manager.getBlockTable(1) == manager.getBlockTable(0));
+    EXPECT_TRUE(manager.getRefCount(0) == 2 && manager.getRefCount(1) == 2);
+    EXPECT_TRUE(manager.getNumFreeBlocks() == 6);
+
+    // the shared last block is half full: appending copies it
+    EXPECT_TRUE(manager.appendTokens(1));
+    std::vector<KVBlockCopy> copies = manager.popPendingCopies();
+    EXPECT_TRUE(copies.size() == 1 && copies[0].src_block == 1 && copies[0].dst_block == 2);
+    EXPECT_TRUE((manager.getBlockTable(1) == std::vector<int>{0, 2}));
+    EXPECT_TRUE(manager.getRefCount(0) == 2 && manager.getRefCount(1) == 1 && manager.getRefCount(2) == 1);
+    // the original owner now writes in place
+    EXPECT_TRUE(manager.appendTokens(0));
+    EXPECT_TRUE(manager.popPendingCopies().empty());
+
+    // full shared blocks are never copied
+    EXPECT_TRUE(manager.appendTokens(0) && manager.appendTokens(1));
+    manager.forkSequence(0, 2);
+    EXPECT_TRUE(manager.appendTokens(2));
+    EXPECT_TRUE(manager.popPendingCopies().empty());
+    EXPECT_TRUE(manager.getRefCount(manager.getBlockTable(2)[1]) == 2);
+
+    // fork over an existing sequence releases its blocks
+    const size_t free_blocks = manager.getNumFreeBlocks();
+    manager.forkSequence(0, 1);
+    EXPECT_TRUE(manager.getNumFreeBlocks() == free_blocks + 1);
+    manager.freeSequence(0);
+    manager.freeSequence(1);
+    manager.freeSequence(2);
+    EXPECT_TRUE(manager.getNumFreeBlocks() == 8);
+}
+
+void testTruncate() {
+    KVBlockManager manager(8, 4);
+    EXPECT_TRUE(manager.allocateSequence(0, 5));
+    // speculative tokens appended, then rejected
+    EXPECT_TRUE(manager.appendTokens(0, 6));
+    EXPECT_TRUE(manager.getBlockTable(0).size() == 3);
+    manager.truncateSequence(0, 6);
+    EXPECT_TRUE(manager.getSequenceLength(0) == 6);
+    EXPECT_TRUE((manager.getBlockTable(0) == std::vector<int>{0, 1}));
+    EXPECT_TRUE(manager.getNumFreeBlocks() == 6);
+
+    // a kept shared block is copied by the next append
+    manager.forkSequence(0, 1);
+    manager.truncateSequence(1, 5);
+    EXPECT_TRUE(manager.getRefCount(1) == 2);
+    EXPECT_TRUE(manager.appendTokens(1));
+    std::vector<KVBlockCopy> copies = manager.popPendingCopies();
+    EXPECT_TRUE(copies.size() == 1 && copies[0].src_block == 1);
+    EXPECT_TRUE(manager.getSequenceLength(0) == 6 && manager.getRefCount(1) == 1);
+
+    manager.truncateSequence(1, 0);
+    EXPECT_TRUE(manager.getBlockTable(1).empty());
+    EXPECT_TRUE(manager.appendTokens(1, 3) && manager.getBlockTable(1).size() == 1);
+}
+
+void testFillBlockTables() {
+    KVBlockManager manager(8, 2);
+    manager.allocateSequence(7, 3);
+    manager.allocateSequence(9, 1);
+    std::vector<int> tables(2 * 3, -1);
+    manager.fillBlockTables({9, 7}, 3, tables.data());
+    EXPECT_TRUE((tables == std::vector<int>{2, 0, 0, 0, 1, 0}));
+}
+
+void testReserveAndReorder() {
+    KVBlockManager manager(8, 4);
+    EXPECT_TRUE(manager.reserveTokens(0, 5));
+    EXPECT_TRUE(manager.getSequenceLength(0) == 5 && manager.getBlockTable(0).size() == 2);
+    // reserving fewer tokens than held changes nothing
+    EXPECT_TRUE(manager.reserveTokens(0, 3) && manager.getSequenceLength(0) == 5);
+    EXPECT_TRUE(manager.reserveTokens(0, 9) && manager.getBlockTable(0).size() == 3);
+    EXPECT_TRUE(manager.reserveTokens(1, 2));
+    EXPECT_FALSE(manager.reserveTokens(2, 17));
+    EXPECT_FALSE(manager.hasSequence(2));
+
+    // swap the two sequences, then make both copies of the first one
+    const std::vector<int> table_0 = manager.getBlockTable(0);
+    const std::vector<int> table_1 = manager.getBlockTable(1);
+    manager.reorderSequences({0, 1}, {1, 0});
+    EXPECT_TRUE(manager.getBlockTable(0) == table_1 && manager.getBlockTable(1) == table_0);
+    EXPECT_TRUE(manager.getSequenceLength(0) == 2 && manager.getSequenceLength(1) == 9);
+    manager.reorderSequences({0, 1}, {0, 0});
+    EXPECT_TRUE(manager.getBlockTable(1) == table_1 && manager.getRefCount(table_1[0]) == 2);
+    EXPECT_TRUE(manager.getNumFreeBlocks() == 7);
+    manager.freeSequence(0);
+    manager.freeSequence(1);
+    EXPECT_TRUE(manager.getNumFreeBlocks() == 8);
+}
+
+// Beam-search-like random workload on a pool of token values: every sequence must read back exactly its own tokens
+// through its block table once the pending copies are applied.
+void testRandomBeamWorkload() {
+    const size_t     num_blocks = 64, block_size = 4, num_beams = 6;
+    KVBlockManager   manager(num_blocks, block_size);
+    std::vector<int> pool(num_blocks * block_size, -1);
+    std::mt19937     gen(5);
+
+    std::map<uint64_t, std::vector<int>> expected;
+    for (uint64_t beam = 0; beam < num_beams; beam++) {
+        if (beam == 0) {
+            EXPECT_TRUE(manager.allocateSequence(0, 7));
+            expected[0] = {};
+            for (size_t t = 0; t < 7; t++) {
+                expected[0].push_back((int)t);
+                pool[manager.getBlockTable(0)[t / block_size] * block_size + t % block_size] = (int)t;
+            }
+        }
+        else {
+            manager.forkSequence(0, beam);
+            expected[beam] = expected[0];
+        }
+    }
+
+    for (int step = 0; step < 40; step++) {
+        // every beam picks a parent, then appends one token
+        std::vector<uint64_t> parents(num_beams);
+        for (auto& parent : parents) {
+            parent = gen() % num_beams;
+        }
+        // fork through temporaries so that beams reading their old parents see them unchanged
+        for (uint64_t beam = 0; beam < num_beams; beam++) {
+            manager.forkSequence(parents[beam], 100 + beam);
+        }
+        std::map<uint64_t, std::vector<int>> next;
+        for (uint64_t beam = 0; beam < num_beams; beam++) {
+            manager.forkSequence(100 + beam, beam);
+            manager.freeSequence(100 + beam);
+            next[beam] = expected[parents[beam]];
+        }
+        expected = next;
+
+        for (uint64_t beam = 0; beam < num_beams; beam++) {
+            EXPECT_TRUE(manager.appendTokens(beam));
+            for (const KVBlockCopy& copy : manager.popPendingCopies()) {
+                std::copy(pool.begin() + copy.src_block * block_size,
+                          pool.begin() + (copy.src_block + 1) * block_size,
+                          pool.begin() + copy.dst_block * block_size);
+            }
+            const size_t t     = manager.getSequenceLength(beam) - 1;
+            const int    token = 1000 * step + (int)beam;
+            pool[manager.getBlockTable(beam)[t / block_size] * block_size + t % block_size] = token;
+            expected[beam].push_back(token);
+        }
+
+        for (uint64_t beam = 0; beam < num_beams; beam++) {
+            const std::vector<int>& table = manager.getBlockTable(beam);
+            for (size_t t = 0; t < expected[beam].size(); t++) {
+                EXPECT_TRUE(pool[table[t / block_size] * block_size + t % block_size] == expected[beam][t]);
+            }
+        }
+    }
+    // shared prefixes keep the footprint below one private copy per beam
+    EXPECT_TRUE(num_blocks - manager.getNumFreeBlocks()
+                < num_beams * manager.getNumBlocksForTokens(manager.getSequenceLength(0)));
+    for (uint64_t beam = 0; beam < num_beams; beam++) {
+        manager.freeSequence(beam);
+    }
+    EXPECT_TRUE(manager.getNumFreeBlocks() == num_blocks);
+}
+
+int main() {
+    testAllocateAndAppend();
+    testOutOfBlocksChangesNothing();
+    testForkAndCopyOnWrite();
+    testTruncate();
+    testFillBlockTables();
+    testReserveAndReorder();
+    testRandomBeamWorkload();
+    FT_LOG_INFO("Test Done");
+    return 0;
+}
@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "src/fastertransformer/triton_backend/length_bucketing.h"
+#include "src/fastertransformer/utils/logger.h"
+#include "tests/unittests/unittest_host_utils.h"
+
+using namespace fastertransformer;
+
+std::vector<BucketingRequest> makeRequests(std::vector<std::pair<size_t, size_t>> lengths)
+{
+    std::vector<BucketingRequest> requests;
+    for (const auto& length : lengths) {
+        requests.push_back({length.first, length.second});
+    }
+    return requests;
+}
+
+// Every request is in exactly one sub-batch, in ascending order, and the metrics add up.
+bool isValidPlan(const std::vector<BucketingRequest>& requests,
+                 const LengthBucketingPlan&           plan,
+                 const LengthBucketingConfig&         config)
+{
+    std::vector<int> seen(requests.size(), 0);
+    PaddingMetrics   metrics;
+    for (const auto& sub_batch : plan.sub_batches) {
+        if (sub_batch.empty() || !std::is_sorted(sub_batch.begin(), sub_batch.end())
+            || (config.max_sub_batch_size > 0 && sub_batch.size() > config.max_sub_batch_size)) {
+            return false;
+        }
+        for (const size_t i : sub_batch) {
+            seen[i]++;
+        }
+        const PaddingMetrics sub_batch_metrics = getPaddingMetrics(requests, sub_batch, config);
+        metrics.useful_tokens += sub_batch_metrics.useful_tokens;
+        metrics.padded_tokens += sub_batch_metrics.padded_tokens;
+    }
+    return std::all_of(seen.begin(), seen.end(), [](int count) { return count == 1; })
+           && metrics.useful_tokens == plan.metrics.useful_tokens
+           && metrics.padded_tokens == plan.metrics.padded_tokens
+           && plan.metrics.useful_tokens == plan.baseline.useful_tokens;
+}
+
+void testUniformLengthsAreNotSplit()
+{
+    LengthBucketingConfig               config;
+    const std::vector<BucketingRequest> requests = makeRequests({{32, 64}, {32, 64}, {32, 64}, {32, 64}});
+    LengthBucketingPlan                 plan     = planLengthBuckets(requests, config);
+    EXPECT_TRUE(isValidPlan(requests, plan, config));
+    EXPECT_TRUE(plan.sub_batches.size() == 1);
+    EXPECT_TRUE(plan.metrics.padded_tokens == 0);
+    EXPECT_TRUE(plan.metrics.efficiency() == 1.0);
+
+    EXPECT_TRUE(planLengthBuckets({}, config).sub_batches.empty());
+}
+
+void testLongRequestsAreSplitOff()
+{
+    LengthBucketingConfig config;
+    // two long requests in the middle of short ones
+    const std::vector<BucketingRequest> requests = makeRequests(
+        {{16, 16}, {16, 16}, {16, 16}, {512, 512}, {16, 16}, {16, 16}, {512, 512}, {16, 16}, {16, 16}, {16, 16}});
+    LengthBucketingPlan plan = planLengthBuckets(requests, config);
+    EXPECT_TRUE(isValidPlan(requests, plan, config));
+    EXPECT_TRUE(plan.baseline.useful_tokens == 8 * 32 + 2 * 1024);
+    EXPECT_TRUE(plan.baseline.padded_tokens == 8 * (496 + 496));
+    EXPECT_TRUE(plan.sub_batches.size() == 2);
+    EXPECT_TRUE(plan.sub_batches[0] == std::vector<size_t>({0, 1, 2, 4, 5, 7, 8, 9}));
+    EXPECT_TRUE(plan.sub_batches[1] == std::vector<size_t>({3, 6}));
+    EXPECT_TRUE(plan.metrics.padded_tokens == 0);
+    // the short requests no longer wait for 512 steps
+    EXPECT_TRUE(plan.metrics.estimated_cost < plan.baseline.estimated_cost);
+
+    // max_sub_batches 1 disables the splitting
+    config.max_sub_batches = 1;
+    plan                   = planLengthBuckets(requests, config);
+    EXPECT_TRUE(plan.sub_batches.size() == 1 && plan.sub_batches[0].size() == requests.size());
+    EXPECT_TRUE(plan.metrics.padded_tokens == plan.baseline.padded_tokens);
+}
+
+void testLatencyBound()
+{
+    LengthBucketingConfig config;
+    // splitting saves the padding of the inputs, but decodes the 512 steps twice
+    const std::vector<BucketingRequest> requests =
+        makeRequests({{16, 512}, {16, 512}, {16, 512}, {16, 512}, {32, 512}, {32, 512}});
+    LengthBucketingPlan plan = planLengthBuckets(requests, config);
+    EXPECT_TRUE(isValidPlan(requests, plan, config));
+    EXPECT_TRUE(plan.sub_batches.size() == 1);
+    EXPECT_TRUE(plan.metrics.padded_tokens == 4 * 16);
+
+    // unless the latency bound allows it
+    config.max_latency_ratio = 2.0f;
+    plan                     = planLengthBuckets(requests, config);
+    EXPECT_TRUE(isValidPlan(requests, plan, config));
+    EXPECT_TRUE(plan.sub_batches.size() == 2);
+    EXPECT_TRUE(plan.metrics.padded_tokens == 0);
+    EXPECT_TRUE(plan.metrics.estimated_cost <= plan.baseline.estimated_cost * config.max_latency_ratio);
+
+    // when a step costs much more than a token, even the long requests are not split off
+    const std::vector<BucketingRequest> mixed =
+        makeRequests({{16, 16}, {16, 16}, {16, 16}, {512, 512}, {16, 16}, {512, 512}});
+    config.max_latency_ratio = 1.01f;
+    config.decode_step_cost  = 10000.0f;
+    plan                     = planLengthBuckets(mixed, config);
+    EXPECT_TRUE(plan.sub_batches.size() == 1);
+}
+
+void testMaxSubBatchSize()
+{
+    LengthBucketingConfig config;
+    config.max_sub_batch_size                    = 3;
+    const std::vector<BucketingRequest> requests = makeRequests({{8, 8}, {64, 64}, {8, 8}, {64, 64}, {8, 8}, {64, 64}});
+    LengthBucketingPlan                 plan     = planLengthBuckets(requests, config);
+    EXPECT_TRUE(isValidPlan(requests, plan, config));
+    EXPECT_TRUE(plan.sub_batches.size() == 2);
+    EXPECT_TRUE(plan.sub_batches[0] == std::vector<size_t>({0, 2, 4}));
+    EXPECT_TRUE(plan.metrics.padded_tokens == 0);
+
+    // the sub-batches are bounded even if it takes more than max_sub_batches of them
+    config.max_sub_batch_size = 1;
+    config.max_sub_batches    = 2;
+    plan                      = planLengthBuckets(requests, config);
+    EXPECT_TRUE(isValidPlan(requests, plan, config));
+    EXPECT_TRUE(plan.sub_batches.size() == requests.size());
+}
+
+// Against every cut of the sorted requests into two sub-batches.
+void testTwoSubBatchesAreOptimal()
+{
+    std::mt19937                          rng(20221018);
+    std::uniform_int_distribution<size_t> length(1, 256);
+    LengthBucketingConfig                 config;
+    config.max_sub_batches   = 2;
+    config.max_latency_ratio = 100.0f;
+    for (int iter = 0; iter < 100; iter++) {
+        std::vector<BucketingRequest> requests(2 + iter % 15);
+        for (auto& request : requests) {
+            request = {length(rng), iter % 2 == 0 ? 32 : length(rng)};
+        }
+        const LengthBucketingPlan plan = planLengthBuckets(requests, config);
+        EXPECT_TRUE(isValidPlan(requests, plan, config));
+        EXPECT_TRUE(plan.metrics.padded_tokens <= plan.baseline.padded_tokens);
+
+        std::vector<size_t> order(requests.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return requests[a].input_len < requests[b].input_len
+                   || (requests[a].input_len == requests[b].input_len
+                       && requests[a].output_len < requests[b].output_len);
+        });
+        size_t best = plan.baseline.padded_tokens;
+        for (size_t cut = 1; cut < order.size(); cut++) {
+            const std::vector<size_t> first(order.begin(), order.begin() + cut);
+            const std::vector<size_t> second(order.begin() + cut, order.end());
+            best = std::min(best,
+                            getPaddingMetrics(requests, first, config).padded_tokens
+                                + getPaddingMetrics(requests, second, config).padded_tokens);
+        }
+        EXPECT_TRUE(plan.metrics.padded_tokens == best);
+    }
+}
+
+void testStats()
+{
+    LengthBucketingConfig               config;
+    const std::vector<BucketingRequest> requests = makeRequests({{16, 16}, {512, 512}, {16, 16}, {512, 512}});
+    LengthBucketingStats                stats;
+    EXPECT_TRUE(stats.efficiency() == 1.0);
+    stats.add(planLengthBuckets(requests, config));
+    stats.add(planLengthBuckets(makeRequests({{32, 32}}), config));
+    EXPECT_TRUE(stats.num_batches == 2);
+    EXPECT_TRUE(stats.num_sub_batches == 3);
+    EXPECT_TRUE(stats.useful_tokens == 2 * 32 + 2 * 1024 + 64);
+    EXPECT_TRUE(stats.padded_tokens == 0);
+    EXPECT_TRUE(stats.baseline_padded_tokens == 2 * (496 + 496));
+    EXPECT_TRUE(stats.efficiency() == 1.0);
+    EXPECT_TRUE(stats.baselineEfficiency() < 0.6);
+}
+
+int main(int argc, char** argv)
+{
+    testUniformLengthsAreNotSplit();
+    testLongRequestsAreSplitOff();
+    testLatencyBound();
+    testMaxSubBatchSize();
+    testTwoSubBatchesAreOptimal();
+    testStats();
+    FT_LOG_INFO("Test Done");
+    return 0;
+}
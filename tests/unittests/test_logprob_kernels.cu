@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <assert.h>
 #include <math.h>
 #include <float.h>
@@ -297,6 +298,147 @@ void testBatchFirstCumLogProbCorrectness(TestCase tc) {
     check_cuda_error(cudaStreamDestroy(stream));
 }
 
+template<typename T>
+void computeTopLogProbs(int* top_ids,
+                        float* top_log_probs,
+                        const T* logits,
+                        const int* num_top_log_probs,
+                        const size_t max_num_top_log_probs,
+                        const size_t batch_size,
+                        const size_t vocab_size,
+                        const size_t vocab_size_padded)
+{
+    for (size_t i = 0; i < batch_size; ++i) {
+        const T* vec = logits + i * vocab_size_padded;
+        float max_logits = -FLT_MAX;
+        for (size_t v = 0; v < vocab_size; ++v) {
+            max_logits = std::max(max_logits, static_cast<float>(vec[v]));
+        }
+        float sum = 0.0f;
+        for (size_t v = 0; v < vocab_size; ++v) {
+            sum += expf(static_cast<float>(vec[v]) - max_logits);
+        }
+        std::vector<int> ids(vocab_size);
+        for (size_t v = 0; v < vocab_size; ++v) {
+            ids[v] = v;
+        }
+        std::sort(ids.begin(), ids.end(), [vec](int a, int b) {
+            return (float)vec[a] > (float)vec[b] || ((float)vec[a] == (float)vec[b] && a < b);
+        });
+        for (size_t k = 0; k < max_num_top_log_probs; ++k) {
+            const bool valid = (int)k < num_top_log_probs[i] && k < vocab_size;
+            top_ids[i * max_num_top_log_probs + k] = valid ? ids[k] : -1;
+            top_log_probs[i * max_num_top_log_probs + k] =
+                valid ? static_cast<float>(vec[ids[k]]) - max_logits - log(sum) : -INFINITY;
+        }
+    }
+}
+
+template<typename T>
+void testTopLogProbsCorrectness(TestCase tc, size_t max_num_top_log_probs) {
+    size_t batchxbeam = tc.batch_size * tc.beam_width;
+    size_t vocab_size = tc.vocab_size;
+    size_t vocab_size_padded = static_cast<size_t>(ceil(vocab_size / 8.f) * 8);
+    size_t top_size = batchxbeam * max_num_top_log_probs;
+
+    cudaStream_t stream;
+    check_cuda_error(cudaStreamCreate(&stream));
+    Allocator<AllocatorType::CUDA> allocator(getDevice());
+
+    T* h_logits = new T[batchxbeam * vocab_size_padded];
+    int* h_num_top_log_probs = new int[batchxbeam];
+    int* expected_ids = new int[top_size];
+    float* expected_log_probs = new float[top_size];
+    int* h_ids = new int[top_size];
+    float* h_log_probs = new float[top_size];
+    float* h_probs = new float[batchxbeam * vocab_size_padded];
+
+    initRandom(h_logits, batchxbeam * vocab_size_padded, -10.0f, 10.0f);
+    initRandomInt(h_num_top_log_probs, batchxbeam, 0, max_num_top_log_probs + 1);
+    computeTopLogProbs(expected_ids,
+                       expected_log_probs,
+                       h_logits,
+                       h_num_top_log_probs,
+                       max_num_top_log_probs,
+                       batchxbeam,
+                       vocab_size,
+                       vocab_size_padded);
+
+    T* d_logits = reinterpret_cast<T*>(allocator.malloc(sizeof(T) * batchxbeam * vocab_size_padded));
+    float* d_probs = reinterpret_cast<float*>(allocator.malloc(sizeof(float) * batchxbeam * vocab_size_padded));
+    int* d_num_top_log_probs = reinterpret_cast<int*>(allocator.malloc(sizeof(int) * batchxbeam));
+    int* d_ids = reinterpret_cast<int*>(allocator.malloc(sizeof(int) * top_size));
+    float* d_log_probs = reinterpret_cast<float*>(allocator.malloc(sizeof(float) * top_size));
+    cudaH2Dcpy(d_logits, h_logits, batchxbeam * vocab_size_padded);
+    cudaH2Dcpy(d_num_top_log_probs, h_num_top_log_probs, batchxbeam);
+
+    // the probabilities of a sampling softmax give the same alternatives
+    for (size_t i = 0; i < batchxbeam; ++i) {
+        const T* vec = h_logits + i * vocab_size_padded;
+        float max_logits = -FLT_MAX;
+        for (size_t v = 0; v < vocab_size; ++v) {
+            max_logits = std::max(max_logits, static_cast<float>(vec[v]));
+        }
+        float sum = 0.0f;
+        for (size_t v = 0; v < vocab_size; ++v) {
+            sum += expf(static_cast<float>(vec[v]) - max_logits);
+        }
+        for (size_t v = 0; v < vocab_size_padded; ++v) {
+            h_probs[i * vocab_size_padded + v] =
+                v < vocab_size ? expf(static_cast<float>(vec[v]) - max_logits) / sum : 0.0f;
+        }
+    }
+    cudaH2Dcpy(d_probs, h_probs, batchxbeam * vocab_size_padded);
+
+    for (int is_probs = 0; is_probs < 2; ++is_probs) {
+        if (is_probs) {
+            invokeTopLogProbs(d_ids, d_log_probs, d_probs, d_num_top_log_probs, (const bool*)nullptr,
+                              max_num_top_log_probs, batchxbeam, vocab_size, vocab_size_padded, true, stream);
+        }
+        else {
+            invokeTopLogProbs(d_ids, d_log_probs, d_logits, d_num_top_log_probs, (const bool*)nullptr,
+                              max_num_top_log_probs, batchxbeam, vocab_size, vocab_size_padded, false, stream);
+        }
+        cudaD2Hcpy(h_ids, d_ids, top_size);
+        cudaD2Hcpy(h_log_probs, d_log_probs, top_size);
+
+        size_t failures = 0;
+        for (size_t i = 0; i < top_size; ++i) {
+            if (expected_ids[i] == -1) {
+                failures += h_ids[i] != -1 || !(std::isinf(h_log_probs[i]) && h_log_probs[i] < 0.0f);
+            }
+            else {
+                // equal values may be ordered differently in half, so check the value of the returned id
+                const T* vec = h_logits + (i / max_num_top_log_probs) * vocab_size_padded;
+                failures += h_ids[i] < 0
+                            || (h_ids[i] != expected_ids[i] && (float)vec[h_ids[i]] != (float)vec[expected_ids[i]]);
+                failures += !almostEqual(h_log_probs[i], expected_log_probs[i], 1e-4f, 1e-3f);
+            }
+        }
+        std::string tag = tc.toString() + (std::is_same<T, float>::value ? " (fp32)" : " (fp16)")
+                          + (is_probs ? " from probs" : " from logits");
+        FT_LOG_INFO("check...%6s : %s (failures: %lu)", failures == 0 ? "....OK" : "FAILED", tag.c_str(), failures);
+        EXPECT_TRUE(failures == 0);
+    }
+
+    FT_LOG_DEBUG("free host buffers");
+    delete[] h_probs;
+    delete[] h_log_probs;
+    delete[] h_ids;
+    delete[] expected_log_probs;
+    delete[] expected_ids;
+    delete[] h_num_top_log_probs;
+    delete[] h_logits;
+
+    FT_LOG_DEBUG("free device buffers");
+    allocator.free((void**)(&d_log_probs));
+    allocator.free((void**)(&d_ids));
+    allocator.free((void**)(&d_num_top_log_probs));
+    allocator.free((void**)(&d_probs));
+    allocator.free((void**)(&d_logits));
+    check_cuda_error(cudaStreamDestroy(stream));
+}
+
 int main(int argc, char* argv[]) {
     std::vector<TestCase> test_cases {
         // TC: name / max_input_seq / batch / vocab / beam
@@ -320,5 +462,14 @@ int main(int argc, char* argv[]) {
     }
     FT_LOG_INFO("Test Done");
 
+    for (auto &tc : test_cases) {
+        tc.name = "top logprobs test";
+        for (size_t n : {1, 5, 20, 32}) {
+            testTopLogProbsCorrectness<float>(tc, n);
+            testTopLogProbsCorrectness<half>(tc, n);
+        }
+    }
+    FT_LOG_INFO("Test Done");
+
     return 0;
 }
@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "src/fastertransformer/models/multi_gpu_gpt/ParallelGptMemoryPlan.h"
+#include "src/fastertransformer/utils/cuda_utils.h"
+#include "src/fastertransformer/utils/memory_planner.h"
+#include "tests/unittests/unittest_host_utils.h"
+
+using namespace fastertransformer;
+
+void testDisjointLifetimesShareMemory() {
+    MemoryPlanner planner(256);
+    planner.addBuffer("a", 1000, 0, 1);
+    planner.addBuffer("b", 1000, 2, 3);
+    planner.addBuffer("c", 500, 1, 2);
+    EXPECT_TRUE(planner.getNaiveBytes() == 1024 + 1024 + 512);
+    EXPECT_TRUE(planner.getLowerBoundBytes() == 1024 + 512);
+    EXPECT_TRUE(planner.plan() == 1024 + 512);
+    EXPECT_TRUE(planner.getOffset("a") == planner.getOffset("b"));
+    EXPECT_TRUE(planner.getOffset("c") == 1024);
+    EXPECT_TRUE(planner.getSize("c") == 500);
+    EXPECT_TRUE(planner.verify());
+}
+
+void testBestFitGap() {
+    MemoryPlanner planner(1);
+    planner.addBuffer("big", 100, 0, 0);
+    planner.addBuffer("mid", 60, 1, 2);
+    planner.addBuffer("small", 30, 1, 1);
+    planner.addBuffer("late", 40, 2, 2);
+    planner.plan();
+    // "small" and "late" are never live together, both fit next to "mid" in the memory of "big"
+    EXPECT_TRUE(planner.getArenaBytes() == 100);
+    EXPECT_TRUE(planner.verify());
+}
+
+void testEmptyAndZeroSized() {
+    MemoryPlanner empty;
+    EXPECT_TRUE(empty.plan() == 0);
+    EXPECT_TRUE(empty.verify());
+
+    MemoryPlanner planner;
+    planner.addBuffer("zero", 0, 0, 5);
+    planner.addBuffer("one", 1, 0, 5);
+    EXPECT_TRUE(planner.plan() == 256);
+    EXPECT_TRUE(planner.getOffset("zero") == 0 && planner.getOffset("one") == 0);
+    EXPECT_TRUE(planner.verify());
+    EXPECT_TRUE(planner.hasBuffer("one") && !planner.hasBuffer("two"));
+}
+
+void testInvalidBuffers() {
+    MemoryPlanner planner;
+    planner.addBuffer("a", 16, 0, 0);
+    bool failed = false;
+    try {
+        planner.addBuffer("a", 16, 1, 1);
+    } catch (std::runtime_error&) {
+        failed = true;
+    }
+    EXPECT_TRUE(failed);
+    failed = false;
+    try {
+        planner.addBuffer("b", 16, 2, 1);
+    } catch (std::runtime_error&) {
+        failed = true;
+    }
+    EXPECT_TRUE(failed);
+    EXPECT_FALSE(planner.verify());  // not planned yet
+}
+
+void testRandomPlans() {
+    std::mt19937 gen(42);
+    for (int trial = 0; trial < 200; trial++) {
+        MemoryPlanner planner(64);
+        const int     num_buffers = 1 + gen() % 40;
+        for (int i = 0; i < num_buffers; i++) {
+            const int first = gen() % 16;
+            const int last  = first + gen() % 6;
+            planner.addBuffer(std::to_string(i), gen() % 100000, first, last);
+        }
+        const size_t arena = planner.plan();
+        EXPECT_TRUE(planner.verify());
+        EXPECT_TRUE(arena >= planner.getLowerBoundBytes());
+        EXPECT_TRUE(arena <= planner.getNaiveBytes());
+    }
+}
+
+static ParallelGptMemoryPlanParams getGptParams() {
+    // 1.3B-like model
+    ParallelGptMemoryPlanParams params;
+    params.batch_size        = 8;
+    params.beam_width        = 1;
+    params.max_input_len     = 512;
+    params.max_session_len   = 1024;
+    params.head_num          = 32;
+    params.size_per_head     = 64;
+    params.inter_size        = 4 * 2048;
+    params.num_layer         = 24;
+    params.vocab_size_padded = 50304;
+    return params;
+}
+
+void testParallelGptPlan() {
+    ParallelGptMemoryPlanParams params  = getGptParams();
+    MemoryPlanner               planner = planParallelGptActivationMemory(params);
+    EXPECT_TRUE(planner.verify());
+    EXPECT_TRUE(planner.getArenaBytes() < planner.getNaiveBytes());
+
+    // sizes mirror the allocateBuffer functions
+    const size_t batchxbeam = params.batch_size * params.beam_width;
+    EXPECT_TRUE(planner.getSize("key_value_cache") == 2 * 2 * 24 * batchxbeam * 1024 * 2048);
+    EXPECT_TRUE(planner.getSize("logits_buf") == sizeof(float) * batchxbeam * params.vocab_size_padded);
+    EXPECT_TRUE(planner.getSize("context_attention.qk_buf_float") == sizeof(float) * batchxbeam * 32 * 512 * 512);
+    EXPECT_TRUE(planner.getSize("context_ffn.inter_buf") == 2 * batchxbeam * 512 * 8192);
+    EXPECT_FALSE(planner.hasBuffer("cache_indirections") || planner.hasBuffer("context_ffn.inter_buf_2"));
+    EXPECT_TRUE(planner.getSize("cancel_statuses_buf") == sizeof(int) * params.batch_size);
+    EXPECT_FALSE(planner.hasBuffer("padded_embedding_kernel"));
+
+    // the context attention scratch and the logits are never live at the same time
+    const size_t qk_offset     = planner.getOffset("context_attention.qk_buf_float");
+    const size_t qk_size       = planner.getSize("context_attention.qk_buf_float");
+    const size_t logits_offset = planner.getOffset("logits_buf");
+    EXPECT_TRUE(logits_offset >= qk_offset && logits_offset < qk_offset + qk_size);
+
+    // tensor parallelism splits the per-rank buffers
+    params.tensor_para_size                = 2;
+    params.beam_width                      = 4;
+    params.use_gated_activation            = true;
+    params.is_return_context_cum_log_probs = true;
+    MemoryPlanner tp_planner               = planParallelGptActivationMemory(params);
+    EXPECT_TRUE(tp_planner.verify());
+    EXPECT_TRUE(tp_planner.hasBuffer("cache_indirections") && tp_planner.hasBuffer("context_ffn.inter_buf_2"));
+    EXPECT_TRUE(tp_planner.getSize("context_ffn.inter_buf") == 2 * 32 * 512 * 4096);
+    FT_LOG_INFO("ParallelGpt plan: %s", planner.toString().substr(0, planner.toString().find('\n')).c_str());
+}
+
+void testPaddedEmbeddingPlan() {
+    // allocateBuffer pads the embedding table when the vocabulary is padded
+    ParallelGptMemoryPlanParams params = getGptParams();
+    params.vocab_size                  = 50257;
+    MemoryPlanner planner              = planParallelGptActivationMemory(params);
+    EXPECT_TRUE(planner.verify());
+    EXPECT_TRUE(planner.getSize("padded_embedding_kernel") == 2 * 2048 * params.vocab_size_padded);
+
+    params.vocab_size = params.vocab_size_padded;
+    EXPECT_FALSE(planParallelGptActivationMemory(params).hasBuffer("padded_embedding_kernel"));
+}
+
+void testMaxBatchSize() {
+    ParallelGptMemoryPlanParams params = getGptParams();
+    params.batch_size                  = 1;
+    const size_t one_request           = planParallelGptActivationMemory(params).getArenaBytes();
+    EXPECT_TRUE(getMaxParallelGptBatchSize(params, one_request - 1) == 0);
+    EXPECT_TRUE(getMaxParallelGptBatchSize(params, one_request) >= 1);
+
+    const size_t budget     = (size_t)16 << 30;
+    const size_t batch_size = getMaxParallelGptBatchSize(params, budget);
+    params.batch_size       = batch_size;
+    EXPECT_TRUE(planParallelGptActivationMemory(params).getArenaBytes() <= budget);
+    params.batch_size = batch_size + 1;
+    EXPECT_TRUE(planParallelGptActivationMemory(params).getArenaBytes() > budget);
+    FT_LOG_INFO("Max batch size of a 1.3B GPT with 16 GB of activations: %lu", batch_size);
+}
+
+int main() {
+    testDisjointLifetimesShareMemory();
+    testBestFitGap();
+    testEmptyAndZeroSized();
+    testInvalidBuffers();
+    testRandomPlans();
+    testParallelGptPlan();
+    testPaddedEmbeddingPlan();
+    testMaxBatchSize();
+    FT_LOG_INFO("Test Done");
+    return 0;
+}
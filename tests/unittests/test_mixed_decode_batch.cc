@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "src/fastertransformer/utils/cuda_utils.h"
+#include "src/fastertransformer/utils/mixed_decode_batch.h"
+#include "tests/unittests/unittest_host_utils.h"
+
+using namespace fastertransformer;
+
+void testGroups() {
+    // requests 0 and 3 sample, 1 and 4 use 4 beams, 2 uses 2 beams
+    MixedDecodeBatch batch({1, 4, 2, 1, 4});
+    EXPECT_TRUE(batch.getBatchSize() == 5);
+    EXPECT_TRUE(batch.getNumRows() == 12);
+    EXPECT_TRUE((batch.getRowOffsets() == std::vector<int>{0, 1, 5, 7, 8, 12}));
+
+    const std::vector<MixedDecodeGroup>& groups = batch.getGroups();
+    EXPECT_TRUE(groups.size() == 3);
+    EXPECT_TRUE(groups[0].beam_width == 1);
+    EXPECT_TRUE((groups[0].requests == std::vector<int>{0, 3}));
+    EXPECT_TRUE((groups[0].rows == std::vector<int>{0, 7}));
+    EXPECT_TRUE(groups[1].beam_width == 2);
+    EXPECT_TRUE((groups[1].requests == std::vector<int>{2}));
+    EXPECT_TRUE((groups[1].rows == std::vector<int>{5, 6}));
+    EXPECT_TRUE(groups[2].beam_width == 4);
+    EXPECT_TRUE((groups[2].requests == std::vector<int>{1, 4}));
+    EXPECT_TRUE((groups[2].rows == std::vector<int>{1, 2, 3, 4, 8, 9, 10, 11}));
+
+    // every packed row belongs to exactly one group
+    for (size_t row = 0; row < batch.getNumRows(); row++) {
+        const MixedDecodeGroup& group = groups[batch.getRowGroups()[row]];
+        EXPECT_TRUE(group.rows[batch.getRowGroupRows()[row]] == (int)row);
+    }
+
+    // a uniform batch is a single group over all rows
+    MixedDecodeBatch uniform({3, 3});
+    EXPECT_TRUE(uniform.getGroups().size() == 1);
+    EXPECT_TRUE((uniform.getGroups()[0].rows == std::vector<int>{0, 1, 2, 3, 4, 5}));
+}
+
+void testGatherScatter() {
+    MixedDecodeBatch batch({2, 1, 3});
+    const size_t     num_outer = 3;
+    const size_t     num_rows  = batch.getNumRows();
+    const size_t     row_size  = 4;
+    std::vector<int> packed(num_outer * num_rows * row_size);
+    std::iota(packed.begin(), packed.end(), 0);
+
+    std::vector<int> round_trip(packed.size(), -1);
+    for (const MixedDecodeGroup& group : batch.getGroups()) {
+        const size_t     group_rows = group.rows.size();
+        std::vector<int> gathered(num_outer * group_rows * row_size);
+        gatherRows(gathered.data(), packed.data(), group.rows.data(), group_rows, num_outer, num_rows, row_size);
+        for (size_t o = 0; o < num_outer; o++) {
+            for (size_t i = 0; i < group_rows; i++) {
+                for (size_t k = 0; k < row_size; k++) {
+                    EXPECT_TRUE(gathered[(o * group_rows + i) * row_size + k]
+                                == packed[(o * num_rows + group.rows[i]) * row_size + k]);
+                }
+            }
+        }
+        scatterRows(round_trip.data(), gathered.data(), group.rows.data(), group_rows, num_outer, num_rows, row_size);
+    }
+    EXPECT_TRUE(round_trip == packed);
+}
+
+// Decodes each group on its own rows as DynamicDecodeLayer does: every packed row must be written once, by its group,
+// and a beam must only see the beams of its own request.
+void testGroupDecode() {
+    MixedDecodeBatch batch({3, 1, 1, 2, 3, 1});
+    const size_t     num_rows = batch.getNumRows();
+    std::vector<int> output_ids(num_rows, -1);
+    std::vector<int> parent_ids(num_rows, -1);
+
+    for (const MixedDecodeGroup& group : batch.getGroups()) {
+        const size_t     group_rows = group.rows.size();
+        std::vector<int> group_ids(group_rows);
+        std::vector<int> group_parents(group_rows);
+        for (size_t i = 0; i < group_rows; i++) {
+            // the token of a row is its request, and each beam takes the last beam of its request as parent
+            const size_t request = i / group.beam_width;
+            group_ids[i]         = group.requests[request] * 100 + (int)(i % group.beam_width);
+            group_parents[i]     = group.beam_width - 1;
+        }
+        scatterRows(output_ids.data(), group_ids.data(), group.rows.data(), group_rows, 1, num_rows, 1);
+        scatterRows(parent_ids.data(), group_parents.data(), group.rows.data(), group_rows, 1, num_rows, 1);
+    }
+
+    for (size_t request = 0; request < batch.getBatchSize(); request++) {
+        const int beam_width = batch.getBeamWidth(request);
+        for (int beam = 0; beam < beam_width; beam++) {
+            const int row = batch.getRowOffsets()[request] + beam;
+            EXPECT_TRUE(output_ids[row] == (int)request * 100 + beam);
+            EXPECT_TRUE(parent_ids[row] == beam_width - 1);
+        }
+    }
+}
+
+void testInvalidBeamWidth() {
+    bool thrown = false;
+    try {
+        MixedDecodeBatch batch({1, 0});
+    }
+    catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    EXPECT_TRUE(thrown);
+}
+
+int main(int argc, char* argv[]) {
+    testGroups();
+    testGatherScatter();
+    testGroupDecode();
+    testInvalidBeamWidth();
+    FT_LOG_INFO("Test Done");
+    return 0;
+}
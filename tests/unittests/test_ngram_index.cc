@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "src/fastertransformer/utils/cuda_utils.h"
+#include "src/fastertransformer/utils/ngram_index.h"
+#include "tests/unittests/unittest_host_utils.h"
+
+using namespace fastertransformer;
+
+// Tokens completing an n-gram already in `tokens`, by brute force.
+std::vector<int> getBannedTokensReference(const std::vector<int>& tokens, size_t ngram_size) {
+    std::vector<int> banned;
+    const size_t     prefix = ngram_size - 1;
+    if (tokens.size() < prefix) {
+        return banned;
+    }
+    for (size_t start = 0; start + ngram_size <= tokens.size(); start++) {
+        if (std::equal(tokens.begin() + start, tokens.begin() + start + prefix, tokens.end() - prefix)) {
+            banned.push_back(tokens[start + prefix]);
+        }
+    }
+    std::sort(banned.begin(), banned.end());
+    banned.erase(std::unique(banned.begin(), banned.end()), banned.end());
+    return banned;
+}
+
+void testBigram() {
+    NgramIndex       index(1, 2);
+    std::vector<int> banned;
+    for (int token : {5, 6, 7, 5}) {
+        index.add(0, token);
+    }
+    // "5 6" was seen
+    index.getBannedTokens(0, &banned);
+    EXPECT_TRUE((banned == std::vector<int>{6}));
+
+    // "7 5" was seen
+    index.add(0, 7);
+    index.getBannedTokens(0, &banned);
+    EXPECT_TRUE((banned == std::vector<int>{5}));
+    index.add(0, 5);
+    index.getBannedTokens(0, &banned);
+    EXPECT_TRUE((banned == std::vector<int>{6, 7}));
+    EXPECT_TRUE(index.getLength(0) == 6);
+
+    index.reset(0);
+    index.getBannedTokens(0, &banned);
+    EXPECT_TRUE(banned.empty() && index.getLength(0) == 0);
+}
+
+void testUnigram() {
+    // n = 1 bans every token already generated
+    NgramIndex       index(1, 1);
+    std::vector<int> banned;
+    index.getBannedTokens(0, &banned);
+    EXPECT_TRUE(banned.empty());
+    for (int token : {3, 1, 3}) {
+        index.add(0, token);
+    }
+    index.getBannedTokens(0, &banned);
+    EXPECT_TRUE((banned == std::vector<int>{1, 3}));
+}
+
+// Random sequences over a small vocabulary, with beams reordered at every step as beam search does.
+void testRandomBeams() {
+    const size_t                       batch_size = 2;
+    const size_t                       beam_width = 3;
+    const size_t                       num_rows   = batch_size * beam_width;
+    std::mt19937                       gen(11);
+    std::uniform_int_distribution<int> token_dist(0, 3);
+    std::uniform_int_distribution<int> beam_dist(0, beam_width - 1);
+
+    for (size_t ngram_size = 1; ngram_size <= 4; ngram_size++) {
+        NgramIndex                    index(num_rows, ngram_size);
+        std::vector<std::vector<int>> histories(num_rows);
+        std::vector<int>              banned;
+
+        // a shared prompt
+        for (int i = 0; i < 5; i++) {
+            const int token = token_dist(gen);
+            for (size_t row = 0; row < num_rows; row++) {
+                index.add(row, token);
+                histories[row].push_back(token);
+            }
+        }
+        for (int step = 0; step < 60; step++) {
+            for (size_t row = 0; row < num_rows; row++) {
+                index.getBannedTokens(row, &banned);
+                EXPECT_TRUE(banned == getBannedTokensReference(histories[row], ngram_size));
+            }
+
+            // each beam continues a beam of its batch
+            std::vector<int> parent_rows(num_rows);
+            std::vector<int> tokens(num_rows);
+            for (size_t row = 0; row < num_rows; row++) {
+                parent_rows[row] = (int)((row / beam_width) * beam_width + beam_dist(gen));
+                tokens[row]      = token_dist(gen);
+            }
+            index.gather(parent_rows.data());
+            index.update(tokens.data());
+
+            std::vector<std::vector<int>> new_histories(num_rows);
+            for (size_t row = 0; row < num_rows; row++) {
+                new_histories[row] = histories[parent_rows[row]];
+                new_histories[row].push_back(tokens[row]);
+            }
+            histories.swap(new_histories);
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    testBigram();
+    testUnigram();
+    testRandomBeams();
+    FT_LOG_INFO("Test Done");
+    return 0;
+}
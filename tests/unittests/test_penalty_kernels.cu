@@ -29,6 +29,7 @@
 #include "src/fastertransformer/kernels/beam_search_penalty_kernels.h"
 #include "src/fastertransformer/kernels/sampling_penalty_kernels.h"
 #include "src/fastertransformer/utils/cuda_utils.h"
+#include "src/fastertransformer/utils/token_count_table.h"
 
 #include "tests/unittests/unittest_utils.h"
 
@@ -697,6 +698,133 @@ void testConsistencyRepetitionPenaltyKernel(RepetitionTestCase tc) {
     EXPECT_TRUE(passed);
 }
 
+template<typename T>
+void testBatchApplyTokenCountPenaltyKernel(RepetitionTestCase tc) {
+    // The table is built from the history in two updates, as BaseSamplingLayer catches up a step at a time, and the
+    // penalties are checked against the host TokenCountTable.
+    const size_t batch_size = tc.batch_size;
+    const size_t vocab_size = tc.vocab_size;
+    const size_t vocab_size_padded = pad_vocab_size(vocab_size);
+    const size_t max_input_length = tc.max_input_length;
+    const size_t step = 2 * tc.max_input_length;
+    float* h_repetition_penalties = new float[batch_size];
+    float* h_presence_penalties = new float[batch_size];
+    float* h_frequency_penalties = new float[batch_size];
+    for (size_t i = 0; i < batch_size; ++i) {
+        h_repetition_penalties[i] = i % 2 == 0 ? tc.repetition_penalty : 1.0f;
+        h_presence_penalties[i] = i % 3 == 0 ? 0.0f : 0.5f;
+        h_frequency_penalties[i] = i % 3 == 1 ? 0.0f : 0.25f;
+    }
+
+    T* h_logits = new T[batch_size * vocab_size_padded];
+    float* h_ref_logits = new float[batch_size * vocab_size_padded];
+    int* h_output_ids = new int[step * batch_size];
+    int* h_input_lengths = new int[batch_size];
+    initLogitsAndBias(h_logits, (T*)nullptr, batch_size, vocab_size, vocab_size_padded);
+    // a small range of ids so that tokens repeat
+    initRandomInt(h_output_ids, step * batch_size, 0, std::min(vocab_size, (size_t)16));
+    initRandomInt(h_input_lengths, batch_size, 1, max_input_length);
+    for (size_t i = 0; i < batch_size * vocab_size_padded; ++i) {
+        h_ref_logits[i] = (float)h_logits[i];
+    }
+
+    T* d_logits;
+    check_cuda_error(cudaMalloc(&d_logits, sizeof(T) * batch_size * vocab_size_padded));
+    check_cuda_error(cudaMemcpy(d_logits, h_logits, sizeof(T) * batch_size * vocab_size_padded, cudaMemcpyHostToDevice));
+    int* d_output_ids;
+    check_cuda_error(cudaMalloc(&d_output_ids, sizeof(int) * step * batch_size));
+    check_cuda_error(cudaMemcpy(d_output_ids, h_output_ids, sizeof(int) * step * batch_size, cudaMemcpyHostToDevice));
+    int* d_input_lengths;
+    check_cuda_error(cudaMalloc(&d_input_lengths, sizeof(int) * batch_size));
+    check_cuda_error(cudaMemcpy(d_input_lengths, h_input_lengths, sizeof(int) * batch_size, cudaMemcpyHostToDevice));
+    float* d_penalties;
+    check_cuda_error(cudaMalloc(&d_penalties, sizeof(float) * 3 * batch_size));
+    check_cuda_error(cudaMemcpy(d_penalties, h_repetition_penalties, sizeof(float) * batch_size, cudaMemcpyHostToDevice));
+    check_cuda_error(cudaMemcpy(d_penalties + batch_size, h_presence_penalties, sizeof(float) * batch_size,
+                                cudaMemcpyHostToDevice));
+    check_cuda_error(cudaMemcpy(d_penalties + 2 * batch_size, h_frequency_penalties, sizeof(float) * batch_size,
+                                cudaMemcpyHostToDevice));
+    int* d_token_counts;
+    check_cuda_error(cudaMalloc(&d_token_counts, sizeof(int) * batch_size * vocab_size_padded));
+    check_cuda_error(cudaMemset(d_token_counts, 0, sizeof(int) * batch_size * vocab_size_padded));
+    bool* d_prompt_tokens;
+    check_cuda_error(cudaMalloc(&d_prompt_tokens, sizeof(bool) * batch_size * vocab_size_padded));
+    check_cuda_error(cudaMemset(d_prompt_tokens, 0, sizeof(bool) * batch_size * vocab_size_padded));
+
+    cudaStream_t stream;
+    check_cuda_error(cudaStreamCreate(&stream));
+
+    // Do test
+    for (size_t start_step : {(size_t)0, step - 1}) {
+        invokeUpdateTokenCounts(d_token_counts,
+                                d_prompt_tokens,
+                                d_output_ids,
+                                batch_size,
+                                batch_size,
+                                vocab_size_padded,
+                                d_input_lengths,
+                                max_input_length,
+                                start_step,
+                                start_step == 0 ? step - 1 : step,
+                                stream);
+    }
+    invokeBatchApplyTokenCountPenalty(d_logits,
+                                      d_token_counts,
+                                      d_prompt_tokens,
+                                      d_penalties,
+                                      d_penalties + batch_size,
+                                      d_penalties + 2 * batch_size,
+                                      batch_size,
+                                      vocab_size,
+                                      vocab_size_padded,
+                                      stream);
+
+    TokenCountTable table(batch_size);
+    for (size_t i = 0; i < batch_size; ++i) {
+        for (size_t s = 0; s < step; ++s) {
+            const int token = h_output_ids[s * batch_size + i];
+            if (s < (size_t)h_input_lengths[i]) {
+                table.addPrompt(i, &token, 1);
+            }
+            else if (s >= max_input_length) {
+                table.add(i, token);
+            }
+        }
+    }
+    applyTokenCountPenalties(h_ref_logits,
+                             table,
+                             h_repetition_penalties,
+                             h_presence_penalties,
+                             h_frequency_penalties,
+                             batch_size,
+                             vocab_size,
+                             vocab_size_padded);
+    for (size_t i = 0; i < batch_size * vocab_size_padded; ++i) {
+        h_logits[i] = (T)h_ref_logits[i];
+    }
+
+    std::string tag = "Correctness TokenCount " + tc.toString() + (isHalf<T>() ? " (FP16)" : " (FP32)");
+    bool passed = checkResult(tag, d_logits, h_logits, batch_size * vocab_size_padded);
+
+    // Tear down test
+    check_cuda_error(cudaStreamDestroy(stream));
+    check_cuda_error(cudaFree(d_logits));
+    check_cuda_error(cudaFree(d_output_ids));
+    check_cuda_error(cudaFree(d_input_lengths));
+    check_cuda_error(cudaFree(d_penalties));
+    check_cuda_error(cudaFree(d_token_counts));
+    check_cuda_error(cudaFree(d_prompt_tokens));
+    delete[] h_repetition_penalties;
+    delete[] h_presence_penalties;
+    delete[] h_frequency_penalties;
+    delete[] h_logits;
+    delete[] h_ref_logits;
+    delete[] h_output_ids;
+    delete[] h_input_lengths;
+
+    EXPECT_TRUE(passed);
+}
+
 template<typename T>
 void testBeamPenaltyKernelCorrectness() {
     // Set up test
@@ -861,6 +989,8 @@ int main() {
         testBatchApplyRepetitonPenaltyKernelWithLocalBatch<half>(tc);
         testConsistencyRepetitionPenaltyKernel<float>(tc);
         testConsistencyRepetitionPenaltyKernel<half>(tc);
+        testBatchApplyTokenCountPenaltyKernel<float>(tc);
+        testBatchApplyTokenCountPenaltyKernel<half>(tc);
     }
     FT_LOG_INFO("test RepetitionPenaltyKernel done");
 
@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "src/fastertransformer/kernels/cpu_sampling_kernels.h"
+#include "src/fastertransformer/kernels/philox_random.h"
+#include "src/fastertransformer/utils/cuda_utils.h"
+#include "tests/unittests/unittest_host_utils.h"
+
+using namespace fastertransformer;
+
+static bool equal(const PhiloxValue& value, uint32_t x0, uint32_t x1, uint32_t x2, uint32_t x3) {
+    return value.x[0] == x0 && value.x[1] == x1 && value.x[2] == x2 && value.x[3] == x3;
+}
+
+void testKnownAnswers() {
+    // known-answer vectors of Philox4x32-10 from Random123
+    EXPECT_TRUE(equal(philox4x32(0, 0, 0, 0, 0, 0), 0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8));
+    EXPECT_TRUE(equal(philox4x32(0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff),
+                      0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd));
+    EXPECT_TRUE(equal(philox4x32(0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344, 0xa4093822, 0x299f31d0),
+                      0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1));
+}
+
+void testUniform() {
+    // a function of the seed and the step only, in (0, 1], and roughly uniform
+    const int num_steps = 100000;
+    double    sum       = 0.0;
+    for (int step = 0; step < num_steps; step++) {
+        const float u = philoxUniform(42, step);
+        EXPECT_TRUE(u > 0.0f && u <= 1.0f);
+        EXPECT_TRUE(u == philoxUniform(42, step));
+        sum += u;
+    }
+    EXPECT_TRUE(std::fabs(sum / num_steps - 0.5) < 0.01);
+    EXPECT_TRUE(philoxRandom(42, 0) != philoxRandom(43, 0));
+    EXPECT_TRUE(philoxRandom(42, 0) != philoxRandom(42, 1));
+    // both halves of the seed are used
+    EXPECT_TRUE(philoxRandom(42, 0) != philoxRandom(42 + (1ULL << 32), 0));
+}
+
+struct Request {
+    unsigned long long seed;
+    uint32_t           top_k;
+    float              top_p;
+    float              temperature;
+};
+
+// Decodes the requests as one batch, the logits of a request only depending on the request (its seed) and the step.
+// Returns the tokens [batch_size, num_steps] generated by each request.
+static std::vector<std::vector<int>> runDecode(const std::vector<Request>& requests, int num_steps) {
+    const int batch_size = requests.size(), vocab_size = 12, vocab_size_padded = 12, max_input_length = 3;
+    const int max_seq_len = max_input_length + num_steps;
+
+    std::vector<unsigned long long> seeds;
+    std::vector<uint32_t>           top_ks;
+    std::vector<float>              top_ps;
+    std::vector<float>              temperatures;
+    for (const Request& request : requests) {
+        seeds.push_back(request.seed);
+        top_ks.push_back(request.top_k);
+        top_ps.push_back(request.top_p);
+        temperatures.push_back(request.temperature);
+    }
+    std::vector<int>        output_ids(max_seq_len * batch_size, 1);
+    std::vector<int>        end_ids(batch_size, -1);
+    std::vector<int>        sequence_length(batch_size, max_input_length);
+    std::unique_ptr<bool[]> finished(new bool[batch_size]());
+
+    CpuDynamicDecodeOutputs outputs;
+    outputs.output_ids      = output_ids.data();
+    outputs.finished        = finished.get();
+    outputs.sequence_length = sequence_length.data();
+
+    std::vector<float> logits(batch_size * vocab_size_padded);
+    for (int step = max_input_length; step < max_seq_len; step++) {
+        for (int b = 0; b < batch_size; b++) {
+            for (int i = 0; i < vocab_size_padded; i++) {
+                logits[b * vocab_size_padded + i] = 0.5f * std::cos(0.3f * (i + 1) * (step + 1) + seeds[b] % 7);
+            }
+        }
+        CpuDynamicDecodeInputs inputs;
+        inputs.logits           = logits.data();
+        inputs.step             = step;
+        inputs.max_input_length = max_input_length;
+        inputs.end_ids          = end_ids.data();
+        inputs.runtime_top_k    = top_ks.data();
+        inputs.runtime_top_p    = top_ps.data();
+        inputs.temperature      = temperatures.data();
+        cpuDynamicDecode(&outputs, inputs, seeds.data(), batch_size, vocab_size, vocab_size_padded);
+    }
+
+    std::vector<std::vector<int>> tokens(batch_size);
+    for (int b = 0; b < batch_size; b++) {
+        for (int step = max_input_length; step < max_seq_len; step++) {
+            tokens[b].push_back(output_ids[step * batch_size + b]);
+        }
+    }
+    return tokens;
+}
+
+void testBatchInvariance() {
+    const int                  num_steps = 16;
+    const std::vector<Request> requests  = {{11, 4, 0.0f, 1.0f},
+                                           {2022, 0, 0.9f, 0.8f},
+                                           {7, 8, 0.0f, 1.5f},
+                                           {11, 0, 0.95f, 1.0f},
+                                           {123456789, 3, 0.0f, 1.0f}};
+    const std::vector<std::vector<int>> tokens = runDecode(requests, num_steps);
+
+    // the requests sample: not every step draws the most likely token
+    bool varies = false;
+    for (int step = 1; step < num_steps; step++) {
+        varies |= tokens[0][step] != tokens[0][0];
+    }
+    EXPECT_TRUE(varies);
+
+    // the tokens of a request do not depend on its slot in the batch
+    const std::vector<int> permutation = {3, 0, 4, 2, 1};
+    std::vector<Request>   permuted;
+    for (int i : permutation) {
+        permuted.push_back(requests[i]);
+    }
+    const std::vector<std::vector<int>> permuted_tokens = runDecode(permuted, num_steps);
+    for (size_t i = 0; i < permutation.size(); i++) {
+        EXPECT_TRUE(permuted_tokens[i] == tokens[permutation[i]]);
+    }
+
+    // nor on the other requests of the batch
+    for (size_t i = 0; i < requests.size(); i++) {
+        EXPECT_TRUE(runDecode({requests[i]}, num_steps)[0] == tokens[i]);
+    }
+    const std::vector<std::vector<int>> other_tokens =
+        runDecode({requests[1], {99, 2, 0.0f, 1.0f}, requests[4]}, num_steps);
+    EXPECT_TRUE(other_tokens[0] == tokens[1]);
+    EXPECT_TRUE(other_tokens[2] == tokens[4]);
+}
+
+int main(int argc, char* argv[]) {
+    testKnownAnswers();
+    testUniform();
+    testBatchInvariance();
+    FT_LOG_INFO("Test Done");
+    return 0;
+}
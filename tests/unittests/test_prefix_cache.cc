@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "src/fastertransformer/utils/cuda_utils.h"
+#include "src/fastertransformer/utils/prefix_cache.h"
+#include "tests/unittests/unittest_host_utils.h"
+
+using namespace fastertransformer;
+
+void testMatchAndInsert() {
+    PrefixCache cache(4, 1, 1 << 20);
+    const std::vector<int> a{1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+    // the partial third block is not cached
+    PrefixCacheInsertion insertion = cache.insert(a, {0, 1, 2});
+    EXPECT_TRUE(insertion.num_cached == 0 && insertion.num_inserted == 2);
+    EXPECT_TRUE(cache.getNumBlocks() == 2);
+
+    PrefixCacheMatch match = cache.match(a);
+    EXPECT_TRUE(match.num_tokens == 8 && (match.blocks == std::vector<int>{0, 1}));
+    cache.release(match);
+    match = cache.match(a, 7);
+    EXPECT_TRUE(match.num_tokens == 4 && (match.blocks == std::vector<int>{0}));
+    cache.release(match);
+    match = cache.match({1, 2, 3});
+    EXPECT_TRUE(match.num_tokens == 0 && match.blocks.empty());
+    cache.release(match);
+    match = cache.match({2, 2, 3, 4, 5});
+    EXPECT_TRUE(match.num_tokens == 0);
+    cache.release(match);
+
+    insertion = cache.insert(a, {5, 6, 7});
+    EXPECT_TRUE(insertion.num_cached == 2 && insertion.num_inserted == 0);
+    EXPECT_TRUE(cache.getStats().num_lookups == 4 && cache.getStats().num_hits == 2);
+}
+
+void testSplitOnDivergence() {
+    PrefixCache cache(4, 1, 1 << 20);
+    cache.insert({1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3}, {0, 1, 2});
+    EXPECT_TRUE(cache.getNumNodes() == 1);
+    // shares the first block only
+    PrefixCacheInsertion insertion = cache.insert({1, 1, 1, 1, 2, 2, 2, 9, 3, 3, 3, 3}, {5, 6, 7});
+    EXPECT_TRUE(insertion.num_cached == 1 && insertion.num_inserted == 2);
+    EXPECT_TRUE(cache.getNumNodes() == 3 && cache.getNumBlocks() == 5);
+
+    PrefixCacheMatch match = cache.match({1, 1, 1, 1, 2, 2, 2, 9, 3, 3, 3, 3, 4});
+    EXPECT_TRUE((match.blocks == std::vector<int>{0, 6, 7}));
+    cache.release(match);
+    match = cache.match({1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3});
+    EXPECT_TRUE((match.blocks == std::vector<int>{0, 1, 2}));
+    cache.release(match);
+}
+
+void testLruEviction() {
+    PrefixCache cache(2, 100, 300);
+    cache.insert({1, 1, 2, 2}, {0, 1});
+    cache.insert({3, 3}, {2});
+    EXPECT_TRUE(cache.getBytes() == 300);
+    // {1, 1, 2, 2} becomes the most recently used
+    cache.release(cache.match({1, 1, 2, 2}));
+
+    PrefixCacheInsertion insertion = cache.insert({4, 4}, {3});
+    EXPECT_TRUE(insertion.num_inserted == 1);
+    EXPECT_TRUE((cache.popEvictedBlocks() == std::vector<int>{2}));
+    EXPECT_TRUE(cache.popEvictedBlocks().empty());
+    PrefixCacheMatch match = cache.match({1, 1, 2, 2});
+    EXPECT_TRUE(match.num_tokens == 4);
+    cache.release(match);
+    EXPECT_TRUE(cache.getBytes() <= cache.getMaxBytes());
+    EXPECT_TRUE(cache.getStats().num_evicted == 1);
+}
+
+void testLockedPrefixNotEvicted() {
+    PrefixCache cache(2, 100, 300);
+    cache.insert({1, 1, 2, 2, 3, 3}, {0, 1, 2});
+    PrefixCacheMatch     whole     = cache.match({1, 1, 2, 2, 3, 3});
+    PrefixCacheInsertion insertion = cache.insert({4, 4}, {3});
+    EXPECT_TRUE(insertion.num_inserted == 0 && cache.getStats().num_rejected == 1);
+    EXPECT_TRUE(cache.popEvictedBlocks().empty());
+    cache.release(whole);
+
+    // only the first block is in use: the tail of the edge is split off and can go
+    PrefixCacheMatch head = cache.match({1, 1, 5, 5});
+    EXPECT_TRUE((head.blocks == std::vector<int>{0}));
+    insertion = cache.insert({4, 4}, {3});
+    EXPECT_TRUE(insertion.num_inserted == 1);
+    EXPECT_TRUE((cache.popEvictedBlocks() == std::vector<int>{1, 2}));
+    EXPECT_FALSE(cache.evict(0));
+    EXPECT_TRUE((cache.popEvictedBlocks() == std::vector<int>{3}));
+    cache.release(head);
+    EXPECT_TRUE(cache.evict(0));
+    EXPECT_TRUE((cache.popEvictedBlocks() == std::vector<int>{0}));
+    EXPECT_TRUE(cache.getNumNodes() == 0);
+}
+
+void testRandomAgainstReference() {
+    const size_t block_size = 3;
+    PrefixCache  cache(block_size, 1, 1 << 20);
+    // block id of every cached prefix of whole blocks
+    std::map<std::vector<int>, int> reference;
+    std::mt19937                    gen(7);
+    int                             next_block = 0;
+    for (int i = 0; i < 2000; i++) {
+        // few distinct tokens so that prefixes are shared
+        std::vector<int> tokens(gen() % 20);
+        for (int& token : tokens) {
+            token = gen() % 3;
+        }
+        if (gen() % 2 == 0) {
+            std::vector<int> blocks;
+            for (size_t b = 0; b < tokens.size() / block_size + 1; b++) {
+                blocks.push_back(next_block++);
+            }
+            PrefixCacheInsertion insertion = cache.insert(tokens, blocks);
+            for (size_t b = 0; b < tokens.size() / block_size; b++) {
+                std::vector<int> prefix(tokens.begin(), tokens.begin() + (b + 1) * block_size);
+                EXPECT_TRUE((b < insertion.num_cached) == (reference.count(prefix) > 0));
+                reference.insert({prefix, blocks[b]});
+            }
+        }
+        else {
+            PrefixCacheMatch match = cache.match(tokens);
+            std::vector<int> expected;
+            for (size_t b = 0; b < tokens.size() / block_size; b++) {
+                auto it = reference.find(std::vector<int>(tokens.begin(), tokens.begin() + (b + 1) * block_size));
+                if (it == reference.end()) {
+                    break;
+                }
+                expected.push_back(it->second);
+            }
+            EXPECT_TRUE(match.blocks == expected);
+            cache.release(match);
+        }
+    }
+    EXPECT_TRUE(cache.getNumBlocks() == reference.size());
+
+    // no reference is left behind, everything can be evicted
+    EXPECT_TRUE(cache.evict(0));
+    std::vector<int> evicted = cache.popEvictedBlocks();
+    std::vector<int> cached;
+    for (const auto& entry : reference) {
+        cached.push_back(entry.second);
+    }
+    std::sort(evicted.begin(), evicted.end());
+    std::sort(cached.begin(), cached.end());
+    EXPECT_TRUE(evicted == cached);
+    FT_LOG_INFO("%s", cache.toString().c_str());
+}
+
+int main() {
+    testMatchAndInsert();
+    testSplitOnDivergence();
+    testLruEviction();
+    testLockedPrefixNotEvicted();
+    testRandomAgainstReference();
+    FT_LOG_INFO("Test Done");
+    return 0;
+}
@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "src/fastertransformer/utils/logger.h"
+#include "src/fastertransformer/utils/request_cancellation.h"
+#include "tests/unittests/unittest_host_utils.h"
+
+using namespace fastertransformer;
+
+using Clock     = RequestCancellation::Clock;
+using TimePoint = RequestCancellation::TimePoint;
+
+// Decodes a step of the unfinished sequences of finished [batch_size * beam_width] at time now, and returns whether
+// every sequence is finished, as the dynamic decode layer does.
+using FakeStep = std::function<bool(int step, std::vector<bool>& finished, TimePoint now)>;
+
+struct FakeGeneration {
+    int              num_steps = 0;  // steps decoded
+    std::vector<int> num_decoded;    // [batch_size * beam_width], steps decoded of each sequence
+};
+
+// The decoding loop of GptJ and ParallelGpt, the clock starting at start and advancing by step_time every step.
+FakeGeneration runFakeGeneration(RequestCancellation* cancellation,
+                                 size_t               batch_size,
+                                 size_t               beam_width,
+                                 int                  gen_len,
+                                 TimePoint            start,
+                                 Clock::duration      step_time,
+                                 const FakeStep&      fake_step)
+{
+    FakeGeneration    generation;
+    std::vector<bool> finished(batch_size * beam_width, false);
+    generation.num_decoded.assign(batch_size * beam_width, 0);
+    for (int step = 0; step < gen_len; step++) {
+        const TimePoint now = start + step * step_time;
+        if (cancellation != nullptr) {
+            for (const size_t i : cancellation->update(now)) {
+                std::fill(finished.begin() + i * beam_width, finished.begin() + (i + 1) * beam_width, true);
+            }
+            if (cancellation->allStopped()) {
+                break;
+            }
+        }
+        for (size_t i = 0; i < finished.size(); i++) {
+            generation.num_decoded[i] += !finished[i];
+        }
+        generation.num_steps++;
+        if (fake_step(step, finished, now)) {
+            break;
+        }
+    }
+    return generation;
+}
+
+// Finishes sequence i at step finish_steps[i], -1 never.
+FakeStep finishAt(std::vector<int> finish_steps)
+{
+    return [finish_steps](int step, std::vector<bool>& finished, TimePoint) {
+        bool all_finished = true;
+        for (size_t i = 0; i < finished.size(); i++) {
+            if (finish_steps[i] == step) {
+                finished[i] = true;
+            }
+            all_finished &= finished[i];
+        }
+        return all_finished;
+    };
+}
+
+void testStatuses()
+{
+    RequestCancellation cancellation(4);
+    const TimePoint     now = Clock::now();
+    cancellation.setDeadline(2, now + std::chrono::milliseconds(10));
+    EXPECT_TRUE(cancellation.update(now).empty());
+    EXPECT_FALSE(cancellation.allStopped());
+
+    cancellation.cancel(1);
+    std::vector<int32_t> statuses(4);
+    cancellation.poll(statuses.data(), now);
+    EXPECT_TRUE(statuses[1] == CANCELLED);
+    // polling applies nothing
+    EXPECT_TRUE(cancellation.getStatus(1) == NOT_CANCELLED);
+
+    std::vector<size_t> stopped = cancellation.update(now + std::chrono::milliseconds(10));
+    EXPECT_TRUE(stopped.size() == 2 && stopped[0] == 1 && stopped[1] == 2);
+    EXPECT_TRUE(cancellation.getStatus(0) == NOT_CANCELLED);
+    EXPECT_TRUE(cancellation.getStatus(1) == CANCELLED);
+    EXPECT_TRUE(cancellation.getStatus(2) == DEADLINE_EXCEEDED);
+    // a stopped request is reported once and keeps its first status
+    cancellation.cancel(2);
+    EXPECT_TRUE(cancellation.update(now + std::chrono::milliseconds(20)).empty());
+    EXPECT_TRUE(cancellation.getStatus(2) == DEADLINE_EXCEEDED);
+
+    // the statuses of another rank override the flags and deadlines of this one
+    const int32_t rank0_statuses[4] = {CANCELLED, NOT_CANCELLED, NOT_CANCELLED, NOT_CANCELLED};
+    stopped                         = cancellation.commit(rank0_statuses);
+    EXPECT_TRUE(stopped.size() == 1 && stopped[0] == 0);
+    EXPECT_FALSE(cancellation.allStopped());
+    cancellation.cancel(3);
+    EXPECT_TRUE(cancellation.update(now).size() == 1);
+    EXPECT_TRUE(cancellation.allStopped());
+
+    cancellation.reset();
+    EXPECT_FALSE(cancellation.allStopped());
+    EXPECT_TRUE(cancellation.update(now + std::chrono::hours(1)).empty());
+    EXPECT_TRUE(cancellation.getStatuses()[1] == NOT_CANCELLED);
+}
+
+void testDeadlinesStopSequences()
+{
+    const size_t        batch_size = 3;
+    const size_t        beam_width = 2;
+    const auto          step_time  = std::chrono::milliseconds(10);
+    const TimePoint     start      = Clock::now();
+    RequestCancellation cancellation(batch_size);
+    // request 0 runs out of time before step 5, request 1 finishes by itself, request 2 has no deadline
+    cancellation.setDeadline(0, start + 5 * step_time);
+    cancellation.setDeadline(1, start + 100 * step_time);
+
+    FakeGeneration generation = runFakeGeneration(
+        &cancellation, batch_size, beam_width, 50, start, step_time, finishAt({-1, -1, 7, 7, 20, 30}));
+    EXPECT_TRUE(generation.num_steps == 31);
+    // the sequences of request 0 are stopped at the beginning of step 5
+    EXPECT_TRUE(generation.num_decoded[0] == 5 && generation.num_decoded[1] == 5);
+    EXPECT_TRUE(generation.num_decoded[2] == 8 && generation.num_decoded[3] == 8);
+    EXPECT_TRUE(generation.num_decoded[4] == 21 && generation.num_decoded[5] == 31);
+    EXPECT_TRUE(cancellation.getStatus(0) == DEADLINE_EXCEEDED);
+    EXPECT_TRUE(cancellation.getStatus(1) == NOT_CANCELLED);
+    EXPECT_TRUE(cancellation.getStatus(2) == NOT_CANCELLED);
+}
+
+void testAllStoppedEndsGeneration()
+{
+    const size_t        batch_size = 4;
+    const auto          step_time  = std::chrono::milliseconds(1);
+    const TimePoint     start      = Clock::now();
+    RequestCancellation cancellation(batch_size);
+    for (size_t i = 0; i < batch_size; i++) {
+        cancellation.setDeadline(i, start + (int)(i + 3) * step_time);
+    }
+    FakeGeneration generation =
+        runFakeGeneration(&cancellation, batch_size, 1, 1000, start, step_time, finishAt({-1, -1, -1, -1}));
+    // request 3 is the last stopped, at the beginning of step 6, which is not decoded
+    EXPECT_TRUE(generation.num_steps == 6);
+    for (size_t i = 0; i < batch_size; i++) {
+        EXPECT_TRUE(generation.num_decoded[i] == (int)i + 3);
+        EXPECT_TRUE(cancellation.getStatus(i) == DEADLINE_EXCEEDED);
+    }
+
+    // without cancellation, the batch runs to gen_len
+    generation = runFakeGeneration(nullptr, batch_size, 1, 1000, start, step_time, finishAt({-1, -1, -1, -1}));
+    EXPECT_TRUE(generation.num_steps == 1000);
+}
+
+// A client thread cancels its requests while the steps are running: request 1 during step 10, request 0 during step 20.
+void testCancelFromAnotherThread()
+{
+    const size_t        batch_size = 2;
+    RequestCancellation cancellation(batch_size);
+    std::atomic<int>    cancel_request{-1};
+    std::thread         client([&] {
+        for (int cancelled = 0; cancelled < 2; cancelled++) {
+            int request;
+            while ((request = cancel_request.load()) < 0) {
+                std::this_thread::yield();
+            }
+            cancellation.cancel(request);
+            cancel_request.store(-1);
+        }
+    });
+
+    FakeStep step_cancelling = [&](int step, std::vector<bool>& finished, TimePoint) {
+        if (step == 10 || step == 20) {
+            cancel_request.store(step == 10 ? 1 : 0);
+            while (cancel_request.load() >= 0) {
+                std::this_thread::yield();
+            }
+        }
+        return false;
+    };
+    FakeGeneration generation = runFakeGeneration(
+        &cancellation, batch_size, 1, 1000, Clock::now(), std::chrono::milliseconds(0), step_cancelling);
+    client.join();
+
+    EXPECT_TRUE(generation.num_steps == 21);
+    EXPECT_TRUE(generation.num_decoded[0] == 21);
+    EXPECT_TRUE(generation.num_decoded[1] == 11);
+    EXPECT_TRUE(cancellation.getStatus(0) == CANCELLED);
+    EXPECT_TRUE(cancellation.getStatus(1) == CANCELLED);
+}
+
+int main(int argc, char** argv)
+{
+    testStatuses();
+    testDeadlinesStopSequences();
+    testAllStoppedEndsGeneration();
+    testCancelFromAnotherThread();
+    FT_LOG_INFO("Test Done");
+    return 0;
+}
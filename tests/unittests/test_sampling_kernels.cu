@@ -118,9 +118,10 @@ void testTopKSamplingKernel(TestCase tc) {
     initRandom(h_logits, batch_size * vocab_size, -10.0f, -1.0f);
     memset(expected_cum_log_probs, 0, sizeof(float) * batch_size);
 
-    curandState_t* curand_states = reinterpret_cast<curandState_t*>(
-        allocator->malloc(sizeof(curandState_t) * batch_size, false));
-    invokeCurandInitialize(curand_states, batch_size, seed, stream);
+    unsigned long long* random_seeds = reinterpret_cast<unsigned long long*>(
+        allocator->malloc(sizeof(unsigned long long) * batch_size, false));
+    deviceFill(random_seeds, batch_size, seed, stream);
+    int* random_steps = reinterpret_cast<int*>(allocator->malloc(sizeof(int) * batch_size, false));
 
     size_t workspace_size = 0;
     // retrieve the workspace size of the top-k sampling kernel.
@@ -133,6 +134,7 @@ void testTopKSamplingKernel(TestCase tc) {
                           nullptr,
                           nullptr,
                           nullptr,
+                          nullptr,
                           top_k,
                           1.0f,
                           vocab_size,
@@ -163,6 +165,7 @@ void testTopKSamplingKernel(TestCase tc) {
     void* h_worksapce = malloc(workspace_size);
 
     for (size_t step = 0; step < max_output_len; ++step) {
+        deviceFill(random_steps, batch_size, (int)step, stream);
         initRandom(h_logits, batch_size * vocab_size, -10.0f, -1.0f);
         computeProb(h_probs, h_logits, batch_size, vocab_size);
         cudaH2Dcpy(probs, h_probs, batch_size * vocab_size);
@@ -178,7 +181,8 @@ void testTopKSamplingKernel(TestCase tc) {
                            finished,
                            cum_log_probs,
                            output_log_probs + step * batch_size,
-                           curand_states,
+                           random_seeds,
+                           random_steps,
                            top_k,
                            1.0f,
                            vocab_size,
@@ -258,9 +262,10 @@ void testBatchTopKSamplingKernel(TestCase tc, bool has_diff_runtime_args) {
     initRandom(h_logits, batch_size * vocab_size, -10.0f, -1.0f);
     memset(expected_cum_log_probs, 0, sizeof(float) * batch_size);
 
-    curandState_t* curand_states = reinterpret_cast<curandState_t*>(
-        allocator->malloc(sizeof(curandState_t) * batch_size, false));
-    invokeCurandInitialize(curand_states, batch_size, seed, stream);
+    unsigned long long* random_seeds = reinterpret_cast<unsigned long long*>(
+        allocator->malloc(sizeof(unsigned long long) * batch_size, false));
+    deviceFill(random_seeds, batch_size, seed, stream);
+    int* random_steps = reinterpret_cast<int*>(allocator->malloc(sizeof(int) * batch_size, false));
 
     size_t workspace_size = 0;
     // retrieve the workspace size of the top-k sampling kernel.
@@ -272,7 +277,8 @@ void testBatchTopKSamplingKernel(TestCase tc, bool has_diff_runtime_args) {
                                nullptr,  // finished
                                nullptr,  // cum_log_probs
                                nullptr,  // output_log_probs
-                               nullptr,  // curandstates
+                               nullptr,  // random_seeds
+                               nullptr,  // random_steps
                                max_top_k,
                                nullptr,  // top_ks
                                1.0f,
@@ -304,6 +310,7 @@ void testBatchTopKSamplingKernel(TestCase tc, bool has_diff_runtime_args) {
     deviceFill(output_ids, max_seq_len * batch_size, 0);
 
     for (size_t step = 0; step < max_output_len; ++step) {
+        deviceFill(random_steps, batch_size, (int)step, stream);
         initRandom(h_logits, batch_size * vocab_size, -10.0f, -1.0f);
         computeProb(h_probs, h_logits, batch_size, vocab_size);
         cudaH2Dcpy(probs, h_probs, batch_size * vocab_size);
@@ -320,7 +327,8 @@ void testBatchTopKSamplingKernel(TestCase tc, bool has_diff_runtime_args) {
                                 finished,
                                 cum_log_probs,
                                 output_log_probs + step * batch_size,
-                                curand_states,
+                                random_seeds,
+                                random_steps,
                                 max_top_k,
                                 top_ks,
                                 1.0f,
@@ -408,9 +416,10 @@ void testBatchTopKSamplingWithSkipDecode(TestCase tc) {
     initRandom(h_logits, batch_size * vocab_size, -3.0f, 3.0f);
     memset(expected_cum_log_probs, 0, sizeof(float) * batch_size);
 
-    curandState_t* curand_states = reinterpret_cast<curandState_t*>(
-        allocator->malloc(sizeof(curandState_t) * batch_size, false));
-    invokeCurandInitialize(curand_states, batch_size, seed, stream);
+    unsigned long long* random_seeds = reinterpret_cast<unsigned long long*>(
+        allocator->malloc(sizeof(unsigned long long) * batch_size, false));
+    deviceFill(random_seeds, batch_size, seed, stream);
+    int* random_steps = reinterpret_cast<int*>(allocator->malloc(sizeof(int) * batch_size, false));
 
     size_t workspace_size = 0;
     // retrieve the workspace size of the top-k sampling kernel.
@@ -422,7 +431,8 @@ void testBatchTopKSamplingWithSkipDecode(TestCase tc) {
                                nullptr,  // finished
                                nullptr,  // cum_log_probs
                                nullptr,  // output_log_probs
-                               nullptr,  // curandstates
+                               nullptr,  // random_seeds
+                               nullptr,  // random_steps
                                max_top_k,
                                nullptr,  // top_ks
                                1.0f,
@@ -456,6 +466,7 @@ void testBatchTopKSamplingWithSkipDecode(TestCase tc) {
     deviceFill(output_ids, max_seq_len * batch_size, 0);
 
     for (size_t step = 0; step < max_output_len; ++step) {
+        deviceFill(random_steps, batch_size, (int)step, stream);
         initRandom(h_logits, batch_size * vocab_size, -10.0f, -1.0f);
         computeProb(h_probs, h_logits, batch_size, vocab_size);
         cudaH2Dcpy(probs, h_probs, batch_size * vocab_size);
@@ -472,7 +483,8 @@ void testBatchTopKSamplingWithSkipDecode(TestCase tc) {
                                 finished,
                                 cum_log_probs,
                                 output_log_probs + step * batch_size,
-                                curand_states,
+                                random_seeds,
+                                random_steps,
                                 max_top_k,
                                 top_ks,
                                 1.0f,
@@ -569,9 +581,10 @@ void testBatchTopPSamplingKernel(TestCase tc, bool has_diff_runtime_args) {
     struct cudaDeviceProp device_prop;
     cudaGetDeviceProperties(&device_prop, device);
 
-    curandState_t* curand_states = reinterpret_cast<curandState_t*>(
-        allocator->malloc(sizeof(curandState_t) * batch_size, false));
-    invokeCurandInitialize(curand_states, batch_size, seed, stream);
+    unsigned long long* random_seeds = reinterpret_cast<unsigned long long*>(
+        allocator->malloc(sizeof(unsigned long long) * batch_size, false));
+    deviceFill(random_seeds, batch_size, seed, stream);
+    int* random_steps = reinterpret_cast<int*>(allocator->malloc(sizeof(int) * batch_size, false));
 
     float* top_ps = reinterpret_cast<float*>(allocator->malloc(sizeof(float) * batch_size));
     int* end_ids = reinterpret_cast<int*>(allocator->malloc(sizeof(int) * batch_size));
@@ -602,7 +615,8 @@ void testBatchTopPSamplingKernel(TestCase tc, bool has_diff_runtime_args) {
                             topp_id_vals_buf,
                             end_offsets,
                             begin_offsets,
-                            curand_states,
+                            random_seeds,
+                            nullptr,
                             batch_size,
                             vocab_size,
                             nullptr,
@@ -623,6 +637,7 @@ void testBatchTopPSamplingKernel(TestCase tc, bool has_diff_runtime_args) {
     deviceFill(output_ids, max_seq_len * batch_size, 0);
 
     for (size_t step = 0; step < max_output_len; ++step) {
+        deviceFill(random_steps, batch_size, (int)step, stream);
         initRandom(h_logits, batch_size * vocab_size, -10.0f, -1.0f);
         computeProb(h_probs, h_logits, batch_size, vocab_size);
         cudaH2Dcpy(probs, h_probs, batch_size * vocab_size);
@@ -650,7 +665,8 @@ void testBatchTopPSamplingKernel(TestCase tc, bool has_diff_runtime_args) {
                                    topp_id_vals_buf,
                                    end_offsets,
                                    begin_offsets,
-                                   curand_states,
+                                   random_seeds,
+                                   random_steps,
                                    batch_size,
                                    vocab_size,
                                    end_ids,
@@ -738,9 +754,10 @@ void testBatchTopPSamplingWithSkipDecode(TestCase tc) {
     struct cudaDeviceProp device_prop;
     cudaGetDeviceProperties(&device_prop, device);
 
-    curandState_t* curand_states = reinterpret_cast<curandState_t*>(
-        allocator->malloc(sizeof(curandState_t) * batch_size, false));
-    invokeCurandInitialize(curand_states, batch_size, seed, stream);
+    unsigned long long* random_seeds = reinterpret_cast<unsigned long long*>(
+        allocator->malloc(sizeof(unsigned long long) * batch_size, false));
+    deviceFill(random_seeds, batch_size, seed, stream);
+    int* random_steps = reinterpret_cast<int*>(allocator->malloc(sizeof(int) * batch_size, false));
 
     float* top_ps = reinterpret_cast<float*>(allocator->malloc(sizeof(float) * batch_size));
     int* end_ids = reinterpret_cast<int*>(allocator->malloc(sizeof(int) * batch_size));
@@ -774,7 +791,8 @@ void testBatchTopPSamplingWithSkipDecode(TestCase tc) {
                                topp_id_vals_buf,
                                end_offsets,
                                begin_offsets,
-                               curand_states,
+                               random_seeds,
+                               nullptr,
                                batch_size,
                                vocab_size,
                                nullptr,
@@ -795,6 +813,7 @@ void testBatchTopPSamplingWithSkipDecode(TestCase tc) {
     deviceFill(output_ids, max_seq_len * batch_size, 0);
 
     for (size_t step = 0; step < max_output_len; ++step) {
+        deviceFill(random_steps, batch_size, (int)step, stream);
         initRandom(h_logits, batch_size * vocab_size, -3.0f, 3.0f);
         computeProb(h_probs, h_logits, batch_size, vocab_size);
         cudaH2Dcpy(probs, h_probs, batch_size * vocab_size);
@@ -822,7 +841,8 @@ void testBatchTopPSamplingWithSkipDecode(TestCase tc) {
                                    topp_id_vals_buf,
                                    end_offsets,
                                    begin_offsets,
-                                   curand_states,
+                                   random_seeds,
+                                   random_steps,
                                    batch_size,
                                    vocab_size,
                                    end_ids,
@@ -0,0 +1,309 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "src/fastertransformer/utils/cuda_utils.h"
+#include "src/fastertransformer/utils/kv_block_manager.h"
+#include "src/fastertransformer/utils/speculative_decoding.h"
+#include "tests/unittests/unittest_host_utils.h"
+
+using namespace fastertransformer;
+
+void testGreedy() {
+    SpeculativeVerifier verifier;
+    const std::vector<int> drafts = {5, 6, 7};
+
+    // the third draft disagrees with the target: two drafts kept, then the target token
+    const int             partial[4] = {5, 6, 9, 1};
+    SpeculativeStepResult result     = verifier.verifyGreedy(10, drafts, partial);
+    EXPECT_TRUE(result.num_accepted == 2 && result.cache_length == 12 && !result.finished);
+    EXPECT_TRUE((result.tokens == std::vector<int>{5, 6, 9}));
+
+    // every draft kept, plus the target token after the last one
+    const int all[4] = {5, 6, 7, 8};
+    result           = verifier.verifyGreedy(10, drafts, all);
+    EXPECT_TRUE(result.num_accepted == 3 && result.cache_length == 13);
+    EXPECT_TRUE((result.tokens == std::vector<int>{5, 6, 7, 8}));
+
+    // the first draft is rejected: the step still emits one token
+    const int none[4] = {4, 6, 7, 8};
+    result            = verifier.verifyGreedy(10, drafts, none);
+    EXPECT_TRUE(result.num_accepted == 0 && result.cache_length == 10);
+    EXPECT_TRUE((result.tokens == std::vector<int>{4}));
+
+    const SpeculativeDecodingStats stats = verifier.getStats();
+    EXPECT_TRUE(stats.num_steps == 3 && stats.num_draft_tokens == 9);
+    EXPECT_TRUE(stats.num_accepted_tokens == 5 && stats.num_emitted_tokens == 8);
+    EXPECT_TRUE(std::fabs(stats.acceptanceRate() - 5.0 / 9) < 1e-9);
+    EXPECT_TRUE(std::fabs(stats.tokensPerStep() - 8.0 / 3) < 1e-9);
+}
+
+void testEndId() {
+    SpeculativeVerifier verifier(2);
+    const int           target[4] = {5, 2, 7, 1};
+    // nothing is committed after an accepted end id
+    SpeculativeStepResult result = verifier.verifyGreedy(3, {5, 2, 7}, target);
+    EXPECT_TRUE(result.finished && result.num_accepted == 2 && result.cache_length == 5);
+    EXPECT_TRUE((result.tokens == std::vector<int>{5, 2}));
+
+    // the target token can be the end id too
+    result = verifier.verifyGreedy(3, {5, 3, 7}, target);
+    EXPECT_TRUE(result.finished && result.num_accepted == 1);
+    EXPECT_TRUE((result.tokens == std::vector<int>{5, 2}));
+}
+
+static int sampleToken(const std::vector<float>& probs, CpuCurandState* state) {
+    const float u      = cpuCurandUniform(state);
+    float       prefix = 0.0f;
+    for (size_t i = 0; i < probs.size(); i++) {
+        prefix += probs[i];
+        if (u <= prefix) {
+            return (int)i;
+        }
+    }
+    return (int)probs.size() - 1;
+}
+
+// Whatever the draft distribution, the first committed token follows the target distribution.
+void testRejectionSamplingKeepsTargetDistribution() {
+    const size_t             vocab_size = 4;
+    const std::vector<float> q          = {0.4f, 0.3f, 0.2f, 0.1f};
+    // target distributions after x and after the draft
+    const std::vector<float> p = {0.1f, 0.2f, 0.3f, 0.4f, 0.25f, 0.25f, 0.25f, 0.25f};
+
+    SpeculativeVerifier verifier;
+    CpuCurandState      state;
+    cpuCurandInitialize(&state, 1, 2022);
+    const int        num_trials = 40000;
+    std::vector<int> counts(vocab_size, 0);
+    for (int i = 0; i < num_trials; i++) {
+        const int             draft  = sampleToken(q, &state);
+        SpeculativeStepResult result = verifier.verifySampling(1, {draft}, q.data(), p.data(), vocab_size, &state);
+        EXPECT_TRUE(result.tokens.size() == result.num_accepted + 1);
+        counts[result.tokens[0]]++;
+    }
+    for (size_t v = 0; v < vocab_size; v++) {
+        EXPECT_TRUE(std::fabs(counts[v] / (float)num_trials - p[v]) < 0.01f);
+    }
+    // the expected acceptance rate is sum_v min(p_v, q_v) = 0.1 + 0.2 + 0.2 + 0.1
+    EXPECT_TRUE(std::fabs(verifier.getStats().acceptanceRate() - 0.6) < 0.01);
+}
+
+void testSamplingIsDeterministic() {
+    const size_t             vocab_size = 3;
+    const std::vector<float> q          = {0.5f, 0.25f, 0.25f, 0.5f, 0.25f, 0.25f};
+    const std::vector<float> p          = {0.2f, 0.3f, 0.5f, 0.6f, 0.2f, 0.2f, 0.1f, 0.1f, 0.8f};
+
+    std::vector<int> runs[2];
+    for (int run = 0; run < 2; run++) {
+        SpeculativeVerifier verifier;
+        CpuCurandState      state;
+        cpuCurandInitialize(&state, 1, 7);
+        for (int i = 0; i < 100; i++) {
+            SpeculativeStepResult result =
+                verifier.verifySampling(i, {i % 3, (i + 1) % 3}, q.data(), p.data(), vocab_size, &state);
+            runs[run].insert(runs[run].end(), result.tokens.begin(), result.tokens.end());
+        }
+    }
+    EXPECT_TRUE(runs[0] == runs[1]);
+
+    // identical distributions always accept
+    SpeculativeVerifier verifier;
+    CpuCurandState      state;
+    cpuCurandInitialize(&state, 1, 7);
+    for (int i = 0; i < 100; i++) {
+        SpeculativeStepResult result = verifier.verifySampling(0, {i % 3}, p.data(), p.data(), vocab_size, &state);
+        EXPECT_TRUE(result.num_accepted == 1);
+    }
+}
+
+// Deterministic toy language model: the next token is a hash of the sequence.
+static int nextToken(const std::vector<int>& tokens, int vocab_size) {
+    unsigned int hash = 2166136261u;
+    for (int token : tokens) {
+        hash = (hash ^ (unsigned int)token) * 16777619u;
+    }
+    return (int)(hash % (unsigned int)vocab_size);
+}
+
+// Greedy speculative decoding with a draft model that is right most of the time produces exactly the tokens of the
+// target model alone, and the paged KV cache of the target ends up holding every committed token but the last.
+void testGreedyLoopMatchesTarget() {
+    const int    vocab_size = 50, num_draft_tokens = 4, num_new_tokens = 200;
+    const size_t block_size = 8;
+    std::vector<int> prompt = {1, 2, 3};
+
+    std::vector<int> reference = prompt;
+    while (reference.size() < prompt.size() + num_new_tokens) {
+        reference.push_back(nextToken(reference, vocab_size));
+    }
+
+    SpeculativeVerifier verifier;
+    KVBlockManager      target_cache(64, block_size);
+    std::vector<int>    tokens = prompt;
+    // the context phase wrote the KV of the prompt but its last token
+    EXPECT_TRUE(target_cache.allocateSequence(0, prompt.size() - 1));
+    while (tokens.size() < prompt.size() + num_new_tokens) {
+        // draft: the target model, wrong on every 7th position
+        std::vector<int> draft_seq = tokens;
+        std::vector<int> drafts;
+        for (int i = 0; i < num_draft_tokens; i++) {
+            int token = nextToken(draft_seq, vocab_size);
+            if (draft_seq.size() % 7 == 0) {
+                token = (token + 1) % vocab_size;
+            }
+            drafts.push_back(token);
+            draft_seq.push_back(token);
+        }
+
+        // target pass over the last token and the drafts
+        const size_t sequence_length = tokens.size();
+        EXPECT_TRUE(target_cache.appendTokens(0, num_draft_tokens + 1));
+        std::vector<int> target_ids;
+        std::vector<int> target_seq = tokens;
+        for (int i = 0; i <= num_draft_tokens; i++) {
+            target_ids.push_back(nextToken(target_seq, vocab_size));
+            if (i < num_draft_tokens) {
+                target_seq.push_back(drafts[i]);
+            }
+        }
+
+        SpeculativeStepResult result = verifier.verifyGreedy(sequence_length, drafts, target_ids.data());
+        target_cache.truncateSequence(0, result.cache_length);
+        tokens.insert(tokens.end(), result.tokens.begin(), result.tokens.end());
+        EXPECT_TRUE(target_cache.getSequenceLength(0) == tokens.size() - 1);
+    }
+    tokens.resize(reference.size());
+    EXPECT_TRUE(tokens == reference);
+
+    const SpeculativeDecodingStats stats = verifier.getStats();
+    EXPECT_TRUE(stats.tokensPerStep() > 2.0);
+    FT_LOG_INFO(verifier.toString());
+}
+
+// Toy model for generate(): it keeps the tokens of its KV cache and puts a logit of 10 on nextToken of the sequence.
+// Every `error_period` positions the draft prefers the next token instead.
+struct ToyModel {
+    int              vocab_size, vocab_size_padded, error_period;
+    std::vector<int> cache;
+    size_t           num_passes = 0;
+
+    void forward(const int* token_ids, size_t num_tokens, size_t start, size_t num_logits, float* logits) {
+        // a pass continues from the committed tokens, past ones being rolled back
+        EXPECT_TRUE(start <= cache.size() && num_logits <= num_tokens);
+        cache.resize(start);
+        cache.insert(cache.end(), token_ids, token_ids + num_tokens);
+        for (size_t i = 0; i < num_logits; i++) {
+            const std::vector<int> seq(cache.begin(), cache.end() - (num_logits - 1 - i));
+            int token = nextToken(seq, vocab_size);
+            if (error_period > 0 && seq.size() % error_period == 0) {
+                token = (token + 1) % vocab_size;
+            }
+            float* row = logits + i * vocab_size_padded;
+            std::fill(row, row + vocab_size_padded, 0.0f);
+            row[token] = 10.0f;
+        }
+        num_passes++;
+    }
+
+    SpeculativeForwardFn fn() {
+        return [this](const int* token_ids, size_t num_tokens, size_t start, size_t num_logits, float* logits) {
+            forward(token_ids, num_tokens, start, num_logits, logits);
+        };
+    }
+};
+
+// generate() with a greedy target gives the tokens of the target alone, in fewer target passes, and leaves both caches
+// holding the committed tokens.
+void testGenerateMatchesTarget() {
+    const int              vocab_size = 50;
+    const std::vector<int> prompt     = {1, 2, 3};
+    SpeculativeGenerationParam param;
+    param.num_draft_tokens  = 4;
+    param.max_seq_len       = 203;
+    param.vocab_size        = vocab_size;
+    param.vocab_size_padded = 64;
+
+    std::vector<int> reference = prompt;
+    while (reference.size() < param.max_seq_len) {
+        reference.push_back(nextToken(reference, vocab_size));
+    }
+
+    ToyModel            target{vocab_size, 64, 0};
+    ToyModel            draft{vocab_size, 64, 7};
+    SpeculativeVerifier verifier;
+    const std::vector<int> tokens = verifier.generate(prompt, param, target.fn(), draft.fn());
+    EXPECT_TRUE(tokens == reference);
+
+    const SpeculativeDecodingStats stats = verifier.getStats();
+    EXPECT_TRUE(target.num_passes == stats.num_steps + 1);
+    EXPECT_TRUE(stats.num_emitted_tokens == param.max_seq_len - prompt.size() - 1);
+    EXPECT_TRUE(stats.tokensPerStep() > 2.0 && stats.acceptanceRate() < 1.0);
+    // the last token was never run
+    EXPECT_TRUE(std::vector<int>(target.cache.begin(), target.cache.begin() + tokens.size() - 1)
+                == std::vector<int>(tokens.begin(), tokens.end() - 1));
+
+    // the end id stops the generation at its first occurrence
+    size_t end = 20;
+    while (std::find(reference.begin() + prompt.size(), reference.begin() + end, reference[end])
+           != reference.begin() + end) {
+        end++;
+    }
+    SpeculativeVerifier stopping(reference[end]);
+    ToyModel            target2{vocab_size, 64, 0};
+    ToyModel            draft2{vocab_size, 64, 7};
+    EXPECT_TRUE(stopping.generate(prompt, param, target2.fn(), draft2.fn())
+                == std::vector<int>(reference.begin(), reference.begin() + end + 1));
+}
+
+// A draft identical to the target has every draft accepted under sampling.
+void testGenerateSampling() {
+    SpeculativeGenerationParam param;
+    param.num_draft_tokens  = 3;
+    param.max_seq_len       = 100;
+    param.vocab_size        = 20;
+    param.vocab_size_padded = 20;
+    param.temperature       = 1.0f;
+    param.random_seed       = 11;
+
+    std::vector<int> runs[2];
+    for (int run = 0; run < 2; run++) {
+        ToyModel            target{20, 20, 0};
+        ToyModel            draft{20, 20, 0};
+        SpeculativeVerifier verifier;
+        runs[run] = verifier.generate({4, 5}, param, target.fn(), draft.fn());
+        EXPECT_TRUE(runs[run].size() == param.max_seq_len);
+        EXPECT_TRUE(verifier.getStats().acceptanceRate() == 1.0);
+    }
+    EXPECT_TRUE(runs[0] == runs[1]);
+}
+
+int main() {
+    testGreedy();
+    testEndId();
+    testRejectionSamplingKeepsTargetDistribution();
+    testSamplingIsDeterministic();
+    testGreedyLoopMatchesTarget();
+    testGenerateMatchesTarget();
+    testGenerateSampling();
+    FT_LOG_INFO("Test Done");
+    return 0;
+}
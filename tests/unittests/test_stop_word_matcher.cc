@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "src/fastertransformer/kernels/cpu_sampling_kernels.h"
+#include "src/fastertransformer/utils/cuda_utils.h"
+#include "src/fastertransformer/utils/stop_word_matcher.h"
+#include "tests/unittests/unittest_host_utils.h"
+
+using namespace fastertransformer;
+
+void testAutomaton() {
+    // "he", "she", "his", "hers" over h=1 e=2 s=3 i=4 r=5
+    const std::vector<std::vector<int>> words = {{1, 2}, {3, 1, 2}, {1, 4, 3}, {1, 2, 5, 3}};
+    StopWordAutomaton                   automaton(words);
+    EXPECT_TRUE(automaton.getNumWords() == 4);
+    EXPECT_TRUE(automaton.getAlphabetSize() == 5);
+
+    // "ushers": "she" and "he" end at the 4th token, "hers" at the 6th
+    const std::vector<int> text  = {7, 3, 1, 2, 5, 3};
+    int                    state = StopWordAutomaton::kRoot;
+    std::vector<int>       found;
+    for (size_t i = 0; i < text.size(); i++) {
+        state = automaton.next(state, text[i]);
+        automaton.getWords(state, &found);
+        if (i == 3) {
+            EXPECT_TRUE(automaton.getWord(state) == 1);
+            EXPECT_TRUE((found == std::vector<int>{1, 0}));
+        }
+        else if (i == 5) {
+            EXPECT_TRUE(automaton.getWord(state) == 3);
+            EXPECT_TRUE((found == std::vector<int>{3}));
+        }
+        else {
+            EXPECT_TRUE(automaton.getWord(state) == -1 && found.empty());
+        }
+    }
+}
+
+void testFromWordList() {
+    // words {4 5}, {6}, read_word_list format with -1 padded offsets
+    const std::vector<int> word_list = {4, 5, 6, 2, 3, -1};
+    StopWordAutomaton      automaton = StopWordAutomaton::fromWordList(word_list);
+    StopWordMatcher        matcher(&automaton, 1);
+    EXPECT_TRUE(automaton.getNumWords() == 2);
+
+    EXPECT_FALSE(matcher.update(0, 4));
+    EXPECT_FALSE(matcher.update(0, 4));
+    EXPECT_TRUE(matcher.update(0, 5));
+    StopWordMatch match = matcher.getMatch(0);
+    EXPECT_TRUE(match.word == 0 && match.start == 1 && match.end == 3);
+
+    // the first match is kept
+    EXPECT_TRUE(matcher.update(0, 6));
+    EXPECT_TRUE(matcher.getMatch(0).word == 0 && matcher.getLength(0) == 4);
+
+    matcher.reset(0);
+    EXPECT_FALSE(matcher.isMatched(0));
+    EXPECT_TRUE(matcher.update(0, 6));
+    match = matcher.getMatch(0);
+    EXPECT_TRUE(match.word == 1 && match.start == 0 && match.end == 1);
+}
+
+void testGather() {
+    StopWordAutomaton automaton({{1, 2, 3}});
+    StopWordMatcher   matcher(&automaton, 2);
+    bool              finished[2] = {false, false};
+    const int         first[2]    = {1, 1};
+    const int         second[2]   = {2, 5};
+    matcher.update(first, finished);
+    matcher.update(second, finished);
+
+    // both beams continue the first one
+    const int parents[2] = {0, 0};
+    matcher.gather(parents);
+    const int third[2] = {3, 3};
+    matcher.update(third, finished);
+    EXPECT_TRUE(finished[0] && finished[1]);
+    EXPECT_TRUE(matcher.getMatch(1).start == 0 && matcher.getMatch(1).end == 3);
+}
+
+// The matcher finishes the same rows as the stop criterion kernel, for random lists and sequences.
+void testMatchesStopWordsCriterion() {
+    const int                          batch_size = 4;
+    const int                          max_step   = 50;
+    std::mt19937                       gen(7);
+    std::uniform_int_distribution<int> token_dist(0, 4);
+    std::uniform_int_distribution<int> length_dist(1, 4);
+
+    for (int trial = 0; trial < 50; trial++) {
+        std::vector<std::vector<int>> words(1 + trial % 8);
+        std::vector<int>              ids, offsets;
+        for (auto& word : words) {
+            word.resize(length_dist(gen));
+            for (int& token : word) {
+                token = token_dist(gen);
+            }
+            ids.insert(ids.end(), word.begin(), word.end());
+            offsets.push_back((int)ids.size());
+        }
+        offsets.resize(ids.size(), -1);
+        std::vector<int> word_list = ids;
+        word_list.insert(word_list.end(), offsets.begin(), offsets.end());
+        std::vector<int> tiled_word_list;
+        for (int i = 0; i < batch_size; i++) {
+            tiled_word_list.insert(tiled_word_list.end(), word_list.begin(), word_list.end());
+        }
+
+        StopWordAutomaton automaton = StopWordAutomaton::fromWordList(word_list);
+        StopWordMatcher   matcher(&automaton, batch_size);
+        std::vector<int>  output_ids(max_step * batch_size);
+        bool              expected[batch_size] = {false};
+        bool              actual[batch_size]   = {false};
+        for (int step = 0; step < max_step; step++) {
+            for (int b = 0; b < batch_size; b++) {
+                output_ids[step * batch_size + b] = token_dist(gen);
+            }
+            cpuStopWordsCriterion(output_ids.data(),
+                                  nullptr,
+                                  tiled_word_list.data(),
+                                  expected,
+                                  0,
+                                  ids.size(),
+                                  batch_size,
+                                  1,
+                                  step);
+            matcher.update(output_ids.data() + step * batch_size, actual);
+            for (int b = 0; b < batch_size; b++) {
+                EXPECT_TRUE(expected[b] == actual[b]);
+                if (!actual[b]) {
+                    continue;
+                }
+                // the reported position holds the matched word
+                const StopWordMatch match = matcher.getMatch(b);
+                const auto&         word  = words[match.word];
+                EXPECT_TRUE(match.end - match.start == word.size());
+                for (size_t i = 0; i < word.size(); i++) {
+                    EXPECT_TRUE(output_ids[(match.start + i) * batch_size + b] == word[i]);
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    testAutomaton();
+    testFromWordList();
+    testGather();
+    testMatchesStopWordsCriterion();
+    FT_LOG_INFO("Test Done");
+    return 0;
+}
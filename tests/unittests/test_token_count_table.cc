@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "src/fastertransformer/kernels/cpu_sampling_kernels.h"
+#include "src/fastertransformer/utils/cuda_utils.h"
+#include "src/fastertransformer/utils/token_count_table.h"
+#include "tests/unittests/unittest_host_utils.h"
+
+using namespace fastertransformer;
+
+bool almostEqual(const std::vector<float>& a, const std::vector<float>& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        if (std::fabs(a[i] - b[i]) > 1e-5f * std::max(1.0f, std::fabs(a[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void testCounts() {
+    TokenCountTable table(2);
+    const int       prompt[3] = {4, 4, 7};
+    table.addPrompt(0, prompt, 3);
+    EXPECT_TRUE(table.getNumDistinct(0) == 2);
+    EXPECT_TRUE(table.getCount(0, 4) == 0);
+
+    const int step0[2] = {4, 1};
+    const int step1[2] = {9, 1};
+    table.update(step0);
+    table.update(step1);
+    EXPECT_TRUE(table.getCount(0, 4) == 1 && table.getCount(0, 9) == 1 && table.getCount(0, 7) == 0);
+    EXPECT_TRUE(table.getNumDistinct(0) == 3);
+    EXPECT_TRUE(table.getCount(1, 1) == 2 && table.getNumDistinct(1) == 1);
+
+    // finished rows are not updated
+    const bool finished[2] = {false, true};
+    table.update(step0, finished);
+    EXPECT_TRUE(table.getCount(0, 4) == 2 && table.getCount(1, 4) == 0);
+
+    // both beams continue the first one
+    const int parents[2] = {0, 0};
+    table.gather(parents);
+    EXPECT_TRUE(table.getCount(1, 4) == 2 && table.getNumDistinct(1) == 3);
+
+    table.reset(0);
+    EXPECT_TRUE(table.getNumDistinct(0) == 0 && table.getNumDistinct(1) == 3);
+}
+
+void testPenalties() {
+    TokenCountTable table(1);
+    const int       prompt[1] = {0};
+    table.addPrompt(0, prompt, 1);
+    table.add(0, 1);
+    table.add(0, 1);
+    table.add(0, 2);
+
+    std::vector<float> logits        = {2.0f, -2.0f, 1.0f, 3.0f};
+    const float        repetition[1] = {2.0f};
+    const float        presence[1]   = {0.5f};
+    const float        frequency[1]  = {0.25f};
+    applyTokenCountPenalties(logits.data(), table, repetition, presence, frequency, 1, 4, 4);
+    // the prompt token only gets the repetition penalty
+    EXPECT_TRUE((logits == std::vector<float>{1.0f, -4.0f - 0.5f - 0.5f, 0.5f - 0.5f - 0.25f, 3.0f}));
+
+    // presence and frequency without repetition penalty
+    logits = {2.0f, -2.0f, 1.0f, 3.0f};
+    applyTokenCountPenalties(logits.data(), table, nullptr, presence, nullptr, 1, 4, 4);
+    EXPECT_TRUE((logits == std::vector<float>{2.0f, -2.5f, 0.5f, 3.0f}));
+}
+
+// Mixed per-request settings: the repetition penalty matches cpuBatchApplyRepetitionPenalty over the whole history and
+// the additive penalties follow the generated token counts.
+void testMixedBatch() {
+    const int                             batch_size       = 5;
+    const int                             vocab_size       = 24;
+    const int                             max_input_length = 6;
+    const int                             max_step         = 40;
+    const int                             input_lengths[5] = {6, 3, 4, 6, 1};
+    const float                           repetition[5]    = {1.0f, 1.5f, 1.0f, 2.0f, 1.0f};
+    const float                           presence[5]      = {0.0f, 0.0f, 0.5f, 0.3f, 0.0f};
+    const float                           frequency[5]     = {0.0f, 0.0f, 0.2f, 0.1f, 0.0f};
+    std::mt19937                          gen(3);
+    std::uniform_int_distribution<int>    token_dist(0, vocab_size - 1);
+    std::uniform_real_distribution<float> logit_dist(-4.0f, 4.0f);
+
+    // output_ids [max_step, batch_size], the prompts padded up to max_input_length
+    std::vector<int> output_ids(max_step * batch_size, 0);
+    TokenCountTable  table(batch_size);
+    for (int b = 0; b < batch_size; b++) {
+        std::vector<int> prompt(input_lengths[b]);
+        for (int i = 0; i < input_lengths[b]; i++) {
+            prompt[i] = output_ids[i * batch_size + b] = token_dist(gen);
+        }
+        table.addPrompt(b, prompt.data(), prompt.size());
+    }
+
+    for (int step = max_input_length; step < max_step; step++) {
+        std::vector<float> logits(batch_size * vocab_size);
+        for (float& logit : logits) {
+            logit = logit_dist(gen);
+        }
+
+        std::vector<float> expected = logits;
+        cpuBatchApplyRepetitionPenalty(expected.data(),
+                                       repetition,
+                                       output_ids.data(),
+                                       batch_size,
+                                       batch_size,
+                                       vocab_size,
+                                       input_lengths,
+                                       max_input_length,
+                                       step);
+        for (int b = 0; b < batch_size; b++) {
+            std::vector<int> counts(vocab_size, 0);
+            for (int i = max_input_length; i < step; i++) {
+                counts[output_ids[i * batch_size + b]]++;
+            }
+            for (int v = 0; v < vocab_size; v++) {
+                if (counts[v] > 0) {
+                    expected[b * vocab_size + v] -= presence[b] + frequency[b] * counts[v];
+                }
+            }
+        }
+
+        std::vector<float> actual = logits;
+        applyTokenCountPenalties(
+            actual.data(), table, repetition, presence, frequency, batch_size, vocab_size, vocab_size);
+        EXPECT_TRUE(almostEqual(expected, actual));
+        // neutral rows are untouched
+        for (int v = 0; v < vocab_size; v++) {
+            EXPECT_TRUE(actual[v] == logits[v] && actual[4 * vocab_size + v] == logits[4 * vocab_size + v]);
+        }
+
+        for (int b = 0; b < batch_size; b++) {
+            output_ids[step * batch_size + b] = token_dist(gen);
+        }
+        table.update(output_ids.data() + step * batch_size);
+    }
+    // the table grows with the distinct tokens only
+    for (int b = 0; b < batch_size; b++) {
+        EXPECT_TRUE(table.getNumDistinct(b) <= (size_t)vocab_size);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    testCounts();
+    testPenalties();
+    testMixedBatch();
+    FT_LOG_INFO("Test Done");
+    return 0;
+}
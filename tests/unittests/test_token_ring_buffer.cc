@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "src/fastertransformer/utils/logger.h"
+#include "src/fastertransformer/utils/token_ring_buffer.h"
+#include "tests/unittests/unittest_host_utils.h"
+
+using namespace fastertransformer;
+
+void testSingleThread()
+{
+    SpmcRingBuffer<int> ring(5);
+    EXPECT_TRUE(ring.capacity() == 8);
+    int value;
+    EXPECT_FALSE(ring.tryPop(&value));
+
+    // wraps around several times, in order
+    int next_pushed = 0;
+    int next_popped = 0;
+    for (int lap = 0; lap < 5; lap++) {
+        while (ring.tryPush(next_pushed)) {
+            next_pushed++;
+        }
+        EXPECT_TRUE(ring.size() == 8);
+        for (int i = 0; i < 3; i++) {
+            EXPECT_TRUE(ring.tryPop(&value));
+            EXPECT_TRUE(value == next_popped++);
+        }
+        EXPECT_TRUE(ring.size() == 5);
+    }
+    while (ring.tryPop(&value)) {
+        EXPECT_TRUE(value == next_popped++);
+    }
+    EXPECT_TRUE(next_popped == next_pushed);
+    EXPECT_TRUE(ring.size() == 0);
+}
+
+// Every token is popped by exactly one consumer, and each consumer sees the tokens of a sequence in step order.
+void testConcurrentConsumers()
+{
+    const int num_consumers = 4;
+    const int batch_size    = 16;
+    const int num_steps     = 20000;
+
+    TokenRingBuffer               ring(64);
+    std::atomic<bool>             produced{false};
+    std::vector<std::thread>      consumers;
+    std::vector<int>              num_popped(num_consumers * batch_size, 0);
+    std::vector<int>              num_disordered(num_consumers, 0);
+    std::vector<int>              num_finished(num_consumers, 0);
+    std::vector<std::vector<int>> seen(batch_size, std::vector<int>(num_steps, 0));
+
+    for (int c = 0; c < num_consumers; c++) {
+        consumers.emplace_back([&, c] {
+            std::vector<int> last_step(batch_size, -1);
+            GeneratedToken   token;
+            while (true) {
+                if (!ring.tryPop(&token)) {
+                    if (produced.load()) {
+                        // the last pushes are visible once produced is
+                        if (!ring.tryPop(&token)) {
+                            return;
+                        }
+                    }
+                    else {
+                        std::this_thread::yield();
+                        continue;
+                    }
+                }
+                num_disordered[c] += token.step <= last_step[token.batch_idx];
+                num_disordered[c] += token.token_id != (int)token.batch_idx * num_steps + token.step;
+                last_step[token.batch_idx] = token.step;
+                // each (sequence, step) is written by a single consumer, the counts are checked after the join
+                seen[token.batch_idx][token.step]++;
+                num_popped[c * batch_size + token.batch_idx]++;
+                num_finished[c] += token.finished;
+            }
+        });
+    }
+
+    for (int step = 0; step < num_steps; step++) {
+        for (int i = 0; i < batch_size; i++) {
+            GeneratedToken token;
+            token.batch_idx = i;
+            token.beam_idx  = 0;
+            token.step      = step;
+            token.token_id  = i * num_steps + step;
+            token.finished  = step + 1 == num_steps;
+            while (!ring.tryPush(token)) {
+                std::this_thread::yield();
+            }
+        }
+    }
+    produced.store(true);
+    for (auto& consumer : consumers) {
+        consumer.join();
+    }
+
+    int total_finished = 0;
+    for (int c = 0; c < num_consumers; c++) {
+        EXPECT_TRUE(num_disordered[c] == 0);
+        total_finished += num_finished[c];
+    }
+    EXPECT_TRUE(total_finished == batch_size);
+    for (int i = 0; i < batch_size; i++) {
+        int total = 0;
+        for (int c = 0; c < num_consumers; c++) {
+            total += num_popped[c * batch_size + i];
+        }
+        EXPECT_TRUE(total == num_steps);
+        for (int step = 0; step < num_steps; step++) {
+            EXPECT_TRUE(seen[i][step] == 1);
+        }
+    }
+    EXPECT_TRUE(ring.size() == 0);
+}
+
+int main(int argc, char** argv)
+{
+    testSingleThread();
+    testConcurrentConsumers();
+    FT_LOG_INFO("Test Done");
+    return 0;
+}
@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "src/fastertransformer/kernels/cpu_sampling_kernels.h"
+#include "src/fastertransformer/utils/cuda_utils.h"
+#include "src/fastertransformer/utils/token_trie.h"
+#include "tests/unittests/unittest_host_utils.h"
+
+using namespace fastertransformer;
+
+std::vector<int> getRowTokens(const TokenTrieMask& mask, size_t row) {
+    std::vector<int> tokens(mask.tokens.begin() + mask.offsets[row], mask.tokens.begin() + mask.offsets[row + 1]);
+    std::sort(tokens.begin(), tokens.end());
+    tokens.erase(std::unique(tokens.begin(), tokens.end()), tokens.end());
+    return tokens;
+}
+
+void testBuild() {
+    // words {1 2 3}, {1 4}, {5}, {1 2}: the word list file format, offsets padded with -1
+    const std::vector<int> word_list = {1, 2, 3, 1, 4, 5, 1, 2, 0, 0, 3, 5, 6, 8, -1, -1};
+    TokenTrie              trie      = TokenTrie::fromWordList(word_list);
+    EXPECT_TRUE(trie.getNumWords() == 4);
+    EXPECT_TRUE(trie.getNumStates() == 6);
+    EXPECT_TRUE(trie.getMaxWordLength() == 3);
+
+    const int s1 = trie.step(TokenTrie::kRoot, 1);
+    const int s2 = trie.step(s1, 2);
+    EXPECT_TRUE(s1 != TokenTrie::kNoState && !trie.isTerminal(s1));
+    EXPECT_TRUE(s2 != TokenTrie::kNoState && trie.isTerminal(s2));
+    EXPECT_TRUE(trie.isTerminal(trie.step(s2, 3)));
+    EXPECT_TRUE(trie.step(s2, 4) == TokenTrie::kNoState);
+    EXPECT_TRUE(trie.step(TokenTrie::kRoot, 2) == TokenTrie::kNoState);
+    // children are sorted by token
+    EXPECT_TRUE(trie.getChildEnd(s1) - trie.getChildBegin(s1) == 2);
+    EXPECT_TRUE(trie.getEdgeToken(trie.getChildBegin(s1)) == 2);
+    EXPECT_TRUE(trie.getEdgeToken(trie.getChildBegin(s1) + 1) == 4);
+}
+
+void testBan() {
+    // bans 7 everywhere, 3 after 1 2 and 4 after 2
+    TokenTrie        trie({{7}, {1, 2, 3}, {2, 4}});
+    TokenTrieMatcher matcher(&trie, TokenTrieMode::BAN, 1);
+    TokenTrieMask    mask;
+
+    matcher.getMask(&mask);
+    EXPECT_TRUE((getRowTokens(mask, 0) == std::vector<int>{7}));
+    matcher.update(0, 1);
+    matcher.getMask(&mask);
+    EXPECT_TRUE((getRowTokens(mask, 0) == std::vector<int>{7}));
+    matcher.update(0, 2);
+    matcher.getMask(&mask);
+    EXPECT_TRUE((getRowTokens(mask, 0) == std::vector<int>{3, 4, 7}));
+    matcher.update(0, 5);
+    matcher.getMask(&mask);
+    EXPECT_TRUE((getRowTokens(mask, 0) == std::vector<int>{7}));
+
+    std::vector<float> logits(8, 1.0f);
+    matcher.update(0, 2);
+    matcher.getMask(&mask);
+    applyTokenMask(logits.data(), mask, 8, 8);
+    for (int i = 0; i < 8; i++) {
+        EXPECT_TRUE(std::isinf(logits[i]) == (i == 4 || i == 7));
+    }
+}
+
+// The trie bans the same tokens as the bad words kernel, for random lists and sequences.
+void testBanMatchesBadWords() {
+    const int                          vocab_size = 12;
+    const int                          batch_size = 4;
+    const int                          max_step   = 40;
+    std::mt19937                       gen(42);
+    std::uniform_int_distribution<int> token_dist(1, vocab_size - 1);
+    std::uniform_int_distribution<int> length_dist(1, 4);
+
+    for (int trial = 0; trial < 20; trial++) {
+        std::vector<std::vector<int>> words(1 + trial * 3);
+        std::vector<int>              ids, offsets;
+        for (auto& word : words) {
+            word.resize(length_dist(gen));
+            for (int& token : word) {
+                token = token_dist(gen) % 4 + 1;  // a small alphabet so that words match often
+            }
+            ids.insert(ids.end(), word.begin(), word.end());
+            offsets.push_back((int)ids.size());
+        }
+        offsets.resize(ids.size(), -1);
+        std::vector<int> word_list = ids;
+        word_list.insert(word_list.end(), offsets.begin(), offsets.end());
+
+        TokenTrie        trie = TokenTrie::fromWordList(word_list);
+        TokenTrieMatcher matcher(&trie, TokenTrieMode::BAN, batch_size);
+        TokenTrieMask    mask;
+        std::vector<int> output_ids(max_step * batch_size);
+        for (int step = 0; step < max_step; step++) {
+            std::vector<float> expected(batch_size * vocab_size, 0.0f);
+            std::vector<float> actual(batch_size * vocab_size, 0.0f);
+            cpuBanBadWords(expected.data(),
+                           output_ids.data(),
+                           nullptr,
+                           batch_size,
+                           batch_size,
+                           1,
+                           word_list.data(),
+                           true,
+                           ids.size(),
+                           0,
+                           vocab_size,
+                           step);
+            matcher.getMask(&mask);
+            applyTokenMask(actual.data(), mask, vocab_size, vocab_size);
+            EXPECT_TRUE(expected == actual);
+
+            for (int b = 0; b < batch_size; b++) {
+                output_ids[step * batch_size + b] = token_dist(gen) % 5 + 1;
+            }
+            matcher.update(output_ids.data() + step * batch_size);
+            EXPECT_TRUE(matcher.getNumActiveStates() <= batch_size * (trie.getMaxWordLength() + 1));
+        }
+    }
+}
+
+void testAllow() {
+    // a forced vocabulary of three words, end id 0
+    TokenTrie        trie({{1, 2, 3}, {1, 4}, {5}});
+    TokenTrieMatcher matcher(&trie, TokenTrieMode::ALLOW, 2, 0, true);
+    TokenTrieMask    mask;
+
+    matcher.getMask(&mask);
+    EXPECT_TRUE((getRowTokens(mask, 0) == std::vector<int>{1, 5}));
+
+    const int first[2] = {1, 5};
+    matcher.update(first);
+    matcher.getMask(&mask);
+    EXPECT_TRUE((getRowTokens(mask, 0) == std::vector<int>{2, 4}));
+    // a complete word: the end id or a next word
+    EXPECT_TRUE((getRowTokens(mask, 1) == std::vector<int>{0, 1, 5}));
+
+    std::vector<float> logits(2 * 8);
+    for (size_t i = 0; i < logits.size(); i++) {
+        logits[i] = (float)i;
+    }
+    applyTokenMask(logits.data(), mask, 6, 8);
+    for (int i = 0; i < 6; i++) {
+        EXPECT_TRUE(std::isinf(logits[i]) == (i != 2 && i != 4));
+        EXPECT_TRUE(std::isinf(logits[8 + i]) == (i != 0 && i != 1 && i != 5));
+    }
+    EXPECT_TRUE(logits[2] == 2.0f && logits[8 + 5] == 13.0f);
+    // the padding is left to the sampling kernels
+    EXPECT_TRUE(logits[6] == 6.0f);
+
+    const int second[2] = {4, 1};
+    matcher.update(second);
+    matcher.getMask(&mask);
+    EXPECT_TRUE((getRowTokens(mask, 0) == std::vector<int>{0, 1, 5}));
+    EXPECT_TRUE((getRowTokens(mask, 1) == std::vector<int>{2, 4}));
+
+    // a token outside the trie lifts the constraint of the row
+    const int third[2] = {0, 7};
+    matcher.update(third);
+    matcher.getMask(&mask);
+    EXPECT_FALSE(matcher.isViolated(0));
+    EXPECT_TRUE((getRowTokens(mask, 0) == std::vector<int>{0, 1, 5}));
+    EXPECT_TRUE(matcher.isViolated(1) && mask.unconstrained[1]);
+
+    matcher.reset(1);
+    EXPECT_FALSE(matcher.isViolated(1));
+}
+
+void testAllowNoRepeat() {
+    TokenTrie        trie({{1, 2}, {1, 2, 3}});
+    TokenTrieMatcher matcher(&trie, TokenTrieMode::ALLOW, 1, 9);
+    TokenTrieMask    mask;
+    matcher.update(0, 1);
+    matcher.update(0, 2);
+    matcher.getMask(&mask);
+    // either the longer word, or the end
+    EXPECT_TRUE((getRowTokens(mask, 0) == std::vector<int>{3, 9}));
+    matcher.update(0, 3);
+    matcher.getMask(&mask);
+    EXPECT_TRUE((getRowTokens(mask, 0) == std::vector<int>{9}));
+}
+
+void testGather() {
+    TokenTrie        trie({{1, 2}, {3, 4}});
+    TokenTrieMatcher matcher(&trie, TokenTrieMode::BAN, 2);
+    TokenTrieMask    mask;
+    const int        tokens[2] = {1, 3};
+    matcher.update(tokens);
+
+    // both beams continue the second one
+    const int parents[2] = {1, 1};
+    matcher.gather(parents);
+    matcher.getMask(&mask);
+    EXPECT_TRUE((getRowTokens(mask, 0) == std::vector<int>{4}));
+    EXPECT_TRUE((getRowTokens(mask, 1) == std::vector<int>{4}));
+}
+
+// A step only visits the active states: with many words the cost stays bounded by the word length.
+void testLargeList() {
+    std::vector<std::vector<int>> words;
+    for (int i = 0; i < 20000; i++) {
+        words.push_back({100000 + i % 5000, 200000 + i / 5000, i});
+    }
+    TokenTrie        trie(words);
+    TokenTrieMatcher matcher(&trie, TokenTrieMode::BAN, 1);
+    TokenTrieMask    mask;
+    EXPECT_TRUE(trie.getNumWords() == 20000);
+
+    matcher.update(0, 100003);
+    matcher.update(0, 200001);
+    EXPECT_TRUE(matcher.getNumActiveStates() == 2);
+    matcher.getMask(&mask);
+    // the third token of word 3 + 5000 * 1
+    EXPECT_TRUE((getRowTokens(mask, 0) == std::vector<int>{5003}));
+    FT_LOG_INFO(trie.toString());
+}
+
+int main(int argc, char* argv[]) {
+    testBuild();
+    testBan();
+    testBanMatchesBadWords();
+    testAllow();
+    testAllowNoRepeat();
+    testGather();
+    testLargeList();
+    FT_LOG_INFO("Test Done");
+    return 0;
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "src/fastertransformer/utils/packed_checkpoint.h"
+#include "src/fastertransformer/utils/weight_loader.h"
+#include "tests/unittests/unittest_host_utils.h"
+
+using namespace fastertransformer;
+
+static const int    NUM_LAYERS = 8;
+static const size_t DIM0       = 16;
+static const size_t DIM1       = 24;
+
+static std::string layerFile(int l) {
+    return "test_weight_loader.layer." + std::to_string(l) + ".bin";
+}
+
+static void writeLayerFiles() {
+    for (int l = 0; l < NUM_LAYERS; ++l) {
+        std::vector<float> data(DIM0 * DIM1);
+        for (size_t i = 0; i < data.size(); ++i) {
+            data[i] = (float)((l * 7919 + i * 104729) % 2001) / 1000.0f - 1.0f;
+        }
+        std::ofstream out(layerFile(l), std::ios::out | std::ios::binary);
+        out.write((char*)data.data(), data.size() * sizeof(float));
+    }
+}
+
+static void removeLayerFiles() {
+    for (int l = 0; l < NUM_LAYERS; ++l) {
+        remove(layerFile(l).c_str());
+    }
+}
+
+template<typename T>
+static std::vector<T> loadAllLayers(int num_threads) {
+    std::vector<T> buffer(NUM_LAYERS * DIM0 * DIM1);
+    ParallelWeightLoader loader(num_threads);
+    loader.run(NUM_LAYERS, [&](size_t l) {
+        int ret = loadWeightFromBinToHost<T>(buffer.data() + l * DIM0 * DIM1, {DIM0, DIM1}, layerFile(l));
+        EXPECT_TRUE(ret == 0);
+    });
+    return buffer;
+}
+
+template<typename T>
+void testParallelLoadIsDeterministic() {
+    std::vector<T> ref = loadAllLayers<T>(1);
+    for (int num_threads : {2, 3, 8, 16}) {
+        std::vector<T> out = loadAllLayers<T>(num_threads);
+        EXPECT_TRUE(memcmp(ref.data(), out.data(), ref.size() * sizeof(T)) == 0);
+    }
+}
+
+void testMmapModeMatchesIfstream() {
+    std::vector<float> ref = loadAllLayers<float>(1);
+    setWeightLoadMode(WeightLoadMode::MMAP);
+    std::vector<float> out = loadAllLayers<float>(4);
+    setWeightLoadMode(WeightLoadMode::IFSTREAM);
+    EXPECT_TRUE(memcmp(ref.data(), out.data(), ref.size() * sizeof(float)) == 0);
+}
+
+void testPhaseStats() {
+    getWeightLoadStats().reset();
+    loadAllLayers<float>(4);
+    EXPECT_TRUE(getWeightLoadStats().getBytes(WeightLoadPhase::READ) == NUM_LAYERS * DIM0 * DIM1 * sizeof(float));
+    EXPECT_TRUE(getWeightLoadStats().getBytes(WeightLoadPhase::UPLOAD) == NUM_LAYERS * DIM0 * DIM1 * sizeof(float));
+    EXPECT_TRUE(getWeightLoadStats().getPhaseMs(WeightLoadPhase::QUANTIZE) == 0.0);
+
+    getWeightLoadStats().reset();
+    loadAllLayers<half>(4);
+    EXPECT_TRUE(getWeightLoadStats().getBytes(WeightLoadPhase::UPLOAD) == 0);
+    EXPECT_TRUE(getWeightLoadStats().getPhaseMs(WeightLoadPhase::CONVERT) > 0.0);
+    FT_LOG_INFO(getWeightLoadStats().toString());
+}
+
+void testMissingFile() {
+    std::vector<float> buffer(DIM0 * DIM1);
+    EXPECT_TRUE(loadWeightFromBinToHost<float>(buffer.data(), {DIM0, DIM1}, "test_weight_loader.none.bin") == -1);
+    // the file holds fewer elements than requested
+    EXPECT_TRUE(loadWeightFromBinToHost<float>(buffer.data(), {DIM0, DIM1 + 1}, layerFile(0)) == -1);
+}
+
+void testThreadInitAndBound() {
+    std::atomic<int> num_inits(0);
+    std::atomic<int> running(0);
+    std::atomic<int> max_running(0);
+    ParallelWeightLoader loader(3);
+    loader.run(
+        32,
+        [&](size_t) {
+            int now = ++running;
+            int prev = max_running.load();
+            while (now > prev && !max_running.compare_exchange_weak(prev, now)) {}
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            --running;
+        },
+        [&]() { ++num_inits; });
+    EXPECT_TRUE(num_inits == 3);
+    EXPECT_TRUE(max_running <= 3);
+}
+
+void testExceptionIsRethrown() {
+    ParallelWeightLoader loader(4);
+    try {
+        loader.run(16, [](size_t i) {
+            if (i == 5) {
+                throw std::runtime_error("task 5 fails");
+            }
+        });
+        EXPECT_TRUE(false);
+    } catch (std::runtime_error& e) {
+        EXPECT_TRUE(std::string(e.what()) == "task 5 fails");
+    }
+}
+
+static void writeBytes(const std::string& filename, const std::vector<char>& bytes) {
+    std::ofstream out(filename, std::ios::out | std::ios::binary);
+    out.write(bytes.data(), bytes.size());
+}
+
+void testPackedCheckpointRejectsCorruptedIndex() {
+    const std::string packed_file = "test_weight_loader.ftpack";
+    PackedCheckpointWriter writer(64);
+    writer.addTensor("layer.0", FtCudaDataType::FP32, {DIM0, DIM1}, layerFile(0));
+    writer.addTensor("layer.1", FtCudaDataType::FP32, {DIM0, DIM1}, layerFile(1));
+    EXPECT_TRUE(writer.write(packed_file));
+    {
+        PackedCheckpointReader reader;
+        EXPECT_TRUE(reader.open(packed_file));
+        const PackedTensorInfo* info = reader.find("layer.1");
+        EXPECT_TRUE(info != nullptr && info->shape.size() == 2 && info->shape[1] == DIM1);
+    }
+
+    std::ifstream     in(packed_file, std::ios::in | std::ios::binary);
+    std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    const size_t header_size = 8 + 4 + 4 + 8 + 8;
+    // cut in the middle of the shape of the first tensor: name_len, name, data_type, num_dims, dim0 and half of dim1
+    const size_t cut = header_size + 4 + strlen("layer.0") + 4 + 4 + 8 + 4;
+    writeBytes(packed_file, std::vector<char>(bytes.begin(), bytes.begin() + cut));
+    {
+        PackedCheckpointReader reader;
+        EXPECT_TRUE(!reader.open(packed_file));
+        EXPECT_TRUE(reader.tensors().empty());
+    }
+
+    // more tensors than the file can hold
+    std::vector<char> corrupted = bytes;
+    const uint64_t    num_tensors = bytes.size() + 1;
+    memcpy(corrupted.data() + 16, &num_tensors, sizeof(num_tensors));
+    writeBytes(packed_file, corrupted);
+    {
+        PackedCheckpointReader reader;
+        EXPECT_TRUE(!reader.open(packed_file));
+    }
+    remove(packed_file.c_str());
+}
+
+int main() {
+    writeLayerFiles();
+    testParallelLoadIsDeterministic<float>();
+    testParallelLoadIsDeterministic<half>();
+    testMmapModeMatchesIfstream();
+    testPhaseStats();
+    testMissingFile();
+    testThreadInitAndBound();
+    testExceptionIsRethrown();
+    testPackedCheckpointRejectsCorruptedIndex();
+    removeLayerFiles();
+    FT_LOG_INFO("Test Done");
+    return 0;
+}
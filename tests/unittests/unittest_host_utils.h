@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2022, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Test failures and checks, without CUDA, for the host-only tests.
+
+#pragma once
+
+#include <exception>  // exception
+#include <string>     // string
+
+#include "src/fastertransformer/utils/logger.h"
+#include "src/fastertransformer/utils/string_utils.h"
+
+using namespace fastertransformer;
+
+class TestFailureError: public std::exception {
+private:
+    std::string msg_;
+
+public:
+    explicit TestFailureError() = default;
+    explicit TestFailureError(std::string name, std::string msg = "")
+    {
+        msg_ = fmtstr("TEST FAIL [%s] %s", name.c_str(), msg.c_str());
+    }
+    const char* what() const throw()
+    {
+        return msg_.c_str();
+    }
+};
+
+#define EXPECT_TRUE(cond)                                                                                              \
+    do {                                                                                                               \
+        if (!(cond)) {                                                                                                 \
+            FT_LOG_ERROR("TEST FAIL [%s]: %s at %s:%d", __func__, #cond, __FILE__, __LINE__);                          \
+            throw TestFailureError(__func__);                                                                          \
+        }                                                                                                              \
+    } while (false)
+
+#define EXPECT_FALSE(cond)                                                                                             \
+    do {                                                                                                               \
+        if (cond) {                                                                                                    \
+            FT_LOG_ERROR("TEST FAIL [%s]: %s at %s:%d", __func__, #cond, __FILE__, __LINE__);                          \
+            throw TestFailureError(__func__);                                                                          \
+        }                                                                                                              \
+    } while (false)
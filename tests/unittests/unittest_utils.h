@@ -29,6 +29,7 @@
 #include "src/fastertransformer/utils/cuda_utils.h"
 #include "src/fastertransformer/utils/memory_utils.h"
 #include "src/fastertransformer/utils/string_utils.h"
+#include "tests/unittests/unittest_host_utils.h"
 
 #define PRINT_LIMIT 16
 #define EPSILON (1e-20)
@@ -36,33 +37,6 @@
 
 using namespace fastertransformer;
 
-class TestFailureError : public std::exception {
-private:
-    std::string msg_;
-public:
-    explicit TestFailureError() = default;
-    explicit TestFailureError(std::string name, std::string msg = "") {
-        msg_ = fmtstr("TEST FAIL [%s] %s", name.c_str(), msg.c_str());
-    }
-	const char* what () const throw () {
-    	return msg_.c_str();
-    }
-};
-
-#define EXPECT_TRUE(cond)                                  \
-    do { if(!(cond)) {                                     \
-        FT_LOG_ERROR("TEST FAIL [%s]: %s at %s:%d",        \
-                     __func__, #cond, __FILE__, __LINE__); \
-        throw TestFailureError(__func__);                  \
-    } } while(false)
-
-#define EXPECT_FALSE(cond)                                 \
-    do { if(cond) {                                        \
-        FT_LOG_ERROR("TEST FAIL [%s]: %s at %s:%d",        \
-                     __func__, #cond, __FILE__, __LINE__); \
-        throw TestFailureError(__func__);                  \
-    } } while(false)
-
 bool almostEqual(float a, float b, float atol = 1e-5, float rtol = 1e-8)
 {
     // Params: a = value to compare and b = reference